@@ -1,6 +1,6 @@
 
 
-# Generated Wed, 12 Jun 2024 11:56:10 +0000
+# Generated Wed, 14 Oct 2026 16:18:35 +0000
 # This is an automatically generated library file. Do not edit this file manually.
 # This file contains enrivonment variables for the VM architecture. 
 
@@ -34,6 +34,47 @@
 
     %%- HOST_FS_INTR: 17
 
+    %%- MALLOC: 18
+    %%- CALLOC: 19
+    %%- REALLOC: 20
+    %%- FREE: 21
+    %%- HEAP_STATS: 22
+
+    %%- SNAPSHOT: 23
+
+    %%- THREAD_SPAWN: 24
+    %%- THREAD_JOIN: 25
+    %%- MEMORY_WAIT: 26
+    %%- MEMORY_NOTIFY: 27
+
+    %%- DISK_SUBMIT_READ: 28
+    %%- DISK_SUBMIT_WRITE: 29
+    %%- DISK_POLL: 30
+    %%- DISK_WAIT: 31
+
+    %%- TIMER_START: 32
+    %%- TIMER_CANCEL: 33
+    %%- WAIT_EVENTS: 34
+
+    %%- PERF_COUNTERS: 35
+
+    # Offsets of the counters in the buffer filled by PERF_COUNTERS
+    %%- PERF_INSTRUCTIONS: 0
+    %%- PERF_CALLS: 8
+    %%- PERF_RETURNS: 16
+    %%- PERF_INTERRUPTS: 24
+    %%- PERF_BULK_MEMORY_BYTES: 32
+    %%- PERF_STORAGE_BYTES_READ: 40
+    %%- PERF_STORAGE_BYTES_WRITTEN: 48
+    %%- PERF_HOST_FS_BYTES_READ: 56
+    %%- PERF_HOST_FS_BYTES_WRITTEN: 64
+    %%- PERF_HEAP_LIVE_BYTES: 72
+    %%- PERF_HEAP_PEAK_BYTES: 80
+    %%- PERF_STORAGE_NANOS: 88
+    %%- PERF_HOST_FS_NANOS: 96
+    %%- PERF_TERMINAL_NANOS: 104
+    %%- PERF_COUNTERS_SIZE: 112
+
 
     %%- NO_ERROR: 0
     %%- END_OF_FILE: 1
@@ -1,6 +1,6 @@
 .include:
 
-    interrupts.asm
+    archlib.asm
     stdio/print.asm
 
 
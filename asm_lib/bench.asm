@@ -0,0 +1,161 @@
+# bench
+# Measure the cost of routines with the performance counters of the VM
+
+
+.include:
+
+    archlib.asm
+    asmutils/functional.asm
+    stdio/print.asm
+
+
+.data:
+
+    BENCH_INSTRUCTIONS string "instructions: \0"
+    BENCH_CALLS string "calls: \0"
+    BENCH_RETURNS string "returns: \0"
+    BENCH_INTERRUPTS string "interrupts: \0"
+    BENCH_BULK_MEMORY_BYTES string "bulk memory bytes: \0"
+    BENCH_STORAGE_BYTES_READ string "storage bytes read: \0"
+    BENCH_STORAGE_BYTES_WRITTEN string "storage bytes written: \0"
+    BENCH_HOST_FS_BYTES_READ string "host fs bytes read: \0"
+    BENCH_HOST_FS_BYTES_WRITTEN string "host fs bytes written: \0"
+    BENCH_HEAP_LIVE_BYTES string "heap live bytes: \0"
+    BENCH_HEAP_PEAK_BYTES string "heap peak bytes: \0"
+    BENCH_STORAGE_NANOS string "storage nanos: \0"
+    BENCH_HOST_FS_NANOS string "host fs nanos: \0"
+    BENCH_TERMINAL_NANOS string "terminal nanos: \0"
+
+
+.text:
+
+    # Call the routine the given number of times and print the average cost of a call,
+    # computed from the performance counters read before and after the calls.
+    # The cost of a call includes the call instruction and the decrement and jump of the loop around it.
+    # In JIT mode, the instructions run as compiled native code are not counted
+    #
+    # Args:
+    #   - routine: label of the routine, which must return with the stack as it found it (label)
+    #   - iterations: number of calls, at least 1 (8 bytes)
+    #
+    %% bench routine iterations:
+
+        %- loop: &
+
+        # From the stack top: the loop counter, the counters before the calls, the counters after the calls, the number of iterations
+        push8 {iterations}
+        pushsp2 =PERF_COUNTERS_SIZE
+        pushsp2 =PERF_COUNTERS_SIZE
+        push8 {iterations}
+
+        mov r1 stp
+        mov1 r2 8
+        iadd
+        intr =PERF_COUNTERS
+
+        @=loop
+
+            call {routine}
+
+            dec8 [stp]
+            jmpnz =loop
+
+        popsp1 8
+
+        mov r1 stp
+        mov2 r2 =PERF_COUNTERS_SIZE
+        iadd
+        intr =PERF_COUNTERS
+
+        mov r1 stp
+        call bench_report
+
+        popsp2 =PERF_COUNTERS_SIZE
+        popsp2 =PERF_COUNTERS_SIZE
+        popsp1 8
+
+    %endmacro
+
+
+    # Print the difference of a counter between two snapshots, divided by the number of iterations
+    #
+    # Args:
+    #   - name: label of the counter's name string
+    #   - offset: offset of the counter in the snapshots
+    #
+    # Registers used:
+    #   - r1
+    #   - r2
+    #   - r5
+    #
+    %% bench_print_counter name offset:
+
+        !print_str {name}
+
+        mov r1 =before
+        mov2 r2 {offset}
+        iadd
+        mov8 r5 [r1]
+
+        mov2 r2 =PERF_COUNTERS_SIZE
+        iadd
+        mov8 r1 [r1]
+
+        mov r2 r5
+        isub
+        mov r2 =iterations
+        idiv
+
+        !println_uint r1
+
+    %endmacro
+
+
+    # Print the per-iteration difference of every counter between two snapshots filled by the PERF_COUNTERS interrupt.
+    # The heap counters are levels, so their difference is how much the heap grew on each iteration
+    #
+    # Args:
+    #   - r1: address of the snapshot taken before the iterations, followed by the snapshot taken after them
+    #         and by the 8-byte number of iterations
+    #
+    @@ bench_report
+
+        !save_reg_state r1
+        !save_reg_state r2
+        !save_reg_state r3
+        !save_reg_state r4
+        !save_reg_state r5
+
+        %- before: r3
+        %- iterations: r4
+
+        mov =before r1
+
+        mov2 r2 =PERF_COUNTERS_SIZE
+        iadd
+        mov2 r2 =PERF_COUNTERS_SIZE
+        iadd
+        mov8 =iterations [r1]
+
+        !bench_print_counter BENCH_INSTRUCTIONS =PERF_INSTRUCTIONS
+        !bench_print_counter BENCH_CALLS =PERF_CALLS
+        !bench_print_counter BENCH_RETURNS =PERF_RETURNS
+        !bench_print_counter BENCH_INTERRUPTS =PERF_INTERRUPTS
+        !bench_print_counter BENCH_BULK_MEMORY_BYTES =PERF_BULK_MEMORY_BYTES
+        !bench_print_counter BENCH_STORAGE_BYTES_READ =PERF_STORAGE_BYTES_READ
+        !bench_print_counter BENCH_STORAGE_BYTES_WRITTEN =PERF_STORAGE_BYTES_WRITTEN
+        !bench_print_counter BENCH_HOST_FS_BYTES_READ =PERF_HOST_FS_BYTES_READ
+        !bench_print_counter BENCH_HOST_FS_BYTES_WRITTEN =PERF_HOST_FS_BYTES_WRITTEN
+        !bench_print_counter BENCH_HEAP_LIVE_BYTES =PERF_HEAP_LIVE_BYTES
+        !bench_print_counter BENCH_HEAP_PEAK_BYTES =PERF_HEAP_PEAK_BYTES
+        !bench_print_counter BENCH_STORAGE_NANOS =PERF_STORAGE_NANOS
+        !bench_print_counter BENCH_HOST_FS_NANOS =PERF_HOST_FS_NANOS
+        !bench_print_counter BENCH_TERMINAL_NANOS =PERF_TERMINAL_NANOS
+
+        !restore_reg_state r5
+        !restore_reg_state r4
+        !restore_reg_state r3
+        !restore_reg_state r2
+        !restore_reg_state r1
+
+        ret
@@ -10,8 +10,10 @@
 .include:
 
     @@ array/get.asm
+    @@ array/get_ptr.asm
     @@ array/item_size.asm
     @@ array/length.asm
+    @@ array/metadata.asm
     @@ array/new.asm
     @@ array/set.asm
     @@ array/resize.asm
@@ -70,10 +70,10 @@
         iadd
         mov =item_addr r1
 
-        # Calculate the return value address
-        mov r1 stp
+        # Calculate the return value address, which is right above the arguments
+        mov r1 =FSTART_REG
         mov1 r2 24
-        isub
+        iadd
 
         # Copy the return value onto the stack
         !memcpy =item_addr r1 =item_size
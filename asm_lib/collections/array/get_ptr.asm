@@ -3,6 +3,7 @@
     asmutils/functional.asm
 
     item_size.asm
+    metadata.asm
 
 
 .text:
@@ -23,7 +24,7 @@
 
         call array_get_ptr
 
-        popsp 16
+        popsp1 16
 
     %endmacro
 
@@ -38,9 +39,9 @@
         %- array: r3
         %- item_offset: r4
 
-        # Load the index into r2 for later use
-        !load_arg8 8 r2
         !load_arg8 16 =array
+        # Load the index into r2 for later use. Loading an argument clobbers r2, so it's loaded last
+        !load_arg8 8 r2
 
         !array_item_size =array
 
@@ -51,7 +52,7 @@
         mov =item_offset r1
 
         # Calculate the item address (array* + data offset + item offset)
-        !array_get_data_ptr
+        !array_get_data_ptr =array
         mov r2 =item_offset
         iadd
 
@@ -18,7 +18,7 @@
     #
     %% array_length array:
 
-        !array_get_length_ptr     
+        !array_get_length_ptr {array}
 
         # Get the length field
         mov8 r1 [r1]
@@ -1,3 +1,8 @@
+.include:
+
+    shared.asm
+
+
 .text:
 
     %% array_get_item_size_ptr array:
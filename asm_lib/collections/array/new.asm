@@ -4,6 +4,7 @@
     stdlib/memory.asm
 
     metadata.asm
+    shared.asm
 
 
 .text:
@@ -15,7 +16,7 @@
     #   - length: 8 bytes
     #
     # Return:
-    #   - r1: array address (8 bytes)
+    #   - r1: array address (8 bytes), or 0 if the allocation failed
     #
     %% array_new item_size length:
 
@@ -58,6 +59,18 @@
         # Allocate the new array
         !malloc r1
 
+        cmp8 r1 0
+        jmpz array_new_end
+
+        # Write the metadata
+        mov8 [r1] =item_size
+        push8 r1
+        mov1 r2 =ARRAY_LENGTH_OFFSET
+        iadd
+        mov8 [r1] =length
+        pop8 r1
+
+        @array_new_end
 
         !restore_reg_state r8
         !restore_reg_state r7
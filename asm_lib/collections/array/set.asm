@@ -60,7 +60,7 @@
         mov =item_offset r1
 
         # Calculate the item address (array* + data offset + item offset)
-        !array_get_data_ptr
+        !array_get_data_ptr =array
         mov r2 =item_offset
         iadd
 
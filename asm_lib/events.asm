@@ -0,0 +1,71 @@
+# events
+# Timers and a single wait for all the event sources of the program, to write programs as event loops
+# The events are reported by the timers, the terminal key listener and the asynchronous disk requests
+
+
+.include:
+
+    archlib.asm
+
+
+.text:
+
+    # Event kinds
+
+    %%- EVENT_NONE: 0
+    %%- EVENT_TIMER: 1
+    %%- EVENT_KEY: 2
+    %%- EVENT_DISK: 3
+
+
+    # Start a timer that fires after `delay` nanoseconds, then every `period` nanoseconds unless the period is 0.
+    # The program doesn't stop while it waits: the timer is reported by `wait_events`
+    #
+    # Args:
+    #   - delay: nanoseconds before the timer first fires (8 bytes)
+    #   - period: nanoseconds between the next firings, or 0 for a one-shot timer (8 bytes)
+    #
+    # Return:
+    #   - r1: the handle of the timer
+    %% timer_start delay period:
+
+        mov8 r2 {period}
+        mov8 r1 {delay}
+        intr =TIMER_START
+
+    %endmacro
+
+
+    # Stop the timer with the given handle. A one-shot timer is removed once it fires
+    #
+    # Args:
+    #   - timer: the handle returned by `timer_start` (8 bytes)
+    #
+    # Return:
+    #   - error: NOT_FOUND if there is no such timer
+    %% timer_cancel timer:
+
+        mov8 r1 {timer}
+        intr =TIMER_CANCEL
+
+    %endmacro
+
+
+    # Block until the next event, or until `timeout` nanoseconds passed unless it's 0.
+    # A completed disk request is collected, so it can't be polled or waited on after its event
+    #
+    # Args:
+    #   - timeout: the longest time to wait in nanoseconds, or 0 to wait without a timeout (8 bytes)
+    #
+    # Return:
+    #   - r1: the kind of the event, one of the EVENT_* constants, or EVENT_NONE if the wait timed out
+    #   - r2: the timer handle, the key modifier code, or the disk request id
+    #   - r3: the key code, or the error code of the disk request
+    #   - error: TIMED_OUT if the wait timed out
+    %% wait_events timeout:
+
+        mov8 r1 {timeout}
+        intr =WAIT_EVENTS
+
+    %endmacro
+
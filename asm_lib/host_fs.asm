@@ -16,6 +16,29 @@
     %- HOST_FS_WRITE_ALL: 2
     %- HOST_FS_CREATE_FILE: 3
     %- HOST_FS_CREATE_DIR: 4
+    %- HOST_FS_OPEN: 5
+    %- HOST_FS_CLOSE: 6
+    %- HOST_FS_READ: 7
+    %- HOST_FS_WRITE: 8
+    %- HOST_FS_READ_AT: 9
+    %- HOST_FS_WRITE_AT: 10
+    %- HOST_FS_SEEK: 11
+    %- HOST_FS_STAT: 12
+    %- HOST_FS_MAP: 13
+
+    # Open flags, to combine with `or`
+
+    %- HOST_FS_OPEN_READ: 1
+    %- HOST_FS_OPEN_WRITE: 2
+    %- HOST_FS_OPEN_CREATE: 4
+    %- HOST_FS_OPEN_TRUNCATE: 8
+    %- HOST_FS_OPEN_APPEND: 16
+
+    # Seek origins
+
+    %- HOST_FS_SEEK_START: 0
+    %- HOST_FS_SEEK_CURRENT: 1
+    %- HOST_FS_SEEK_END: 2
 
     # Constants
 
@@ -51,7 +74,7 @@
 
         mov8 r1 {file_path}
         mov1 =HOST_FS_CODE_REG =HOST_FS_CREATE_FILE
-        intr =HOST_FS_CODE_REG
+        intr =HOST_FS_INTR
     
     %endmacro
 
@@ -60,7 +83,185 @@
 
         mov8 r1 {dir_path}
         mov1 =HOST_FS_CODE_REG =HOST_FS_CREATE_DIR
-        intr =HOST_FS_CODE_REG
+        intr =HOST_FS_INTR
+
+    %endmacro
+
+
+    # Open the file at the given path and return a descriptor to access it
+    #
+    # Args:
+    #   - file_path: the address of the null-terminated path (8 bytes)
+    #   - flags: a combination of the HOST_FS_OPEN_* flags (8 bytes)
+    #
+    # Return:
+    #   - r1: the descriptor of the file, or 0 if it couldn't be opened
+    %% host_fs_open file_path flags:
+
+        mov8 r2 {flags}
+        mov8 r1 {file_path}
+        mov1 =HOST_FS_CODE_REG =HOST_FS_OPEN
+        intr =HOST_FS_INTR
+
+    %endmacro
+
+
+    # Close the file with the given descriptor
+    #
+    # Args:
+    #   - fd: the descriptor of the file (8 bytes)
+    %% host_fs_close fd:
+
+        mov8 r1 {fd}
+        mov1 =HOST_FS_CODE_REG =HOST_FS_CLOSE
+        intr =HOST_FS_INTR
+
+    %endmacro
+
+
+    # Read from the current position of the file, which is moved forward
+    #
+    # Args:
+    #   - fd: the descriptor of the file (8 bytes)
+    #   - buffer: the buffer address to read into (8 bytes)
+    #   - size: the number of bytes to read (8 bytes)
+    #
+    # Return:
+    #   - r1: the number of bytes read, which is less than size at the end of the file
+    %% host_fs_read fd buffer size:
+
+        mov8 r3 {size}
+        mov8 r2 {buffer}
+        mov8 r1 {fd}
+        mov1 =HOST_FS_CODE_REG =HOST_FS_READ
+        intr =HOST_FS_INTR
+
+    %endmacro
+
+
+    # Write at the current position of the file, which is moved forward
+    #
+    # Args:
+    #   - fd: the descriptor of the file (8 bytes)
+    #   - buffer: the buffer address to write (8 bytes)
+    #   - size: the number of bytes to write (8 bytes)
+    #
+    # Return:
+    #   - r1: the number of bytes written
+    %% host_fs_write fd buffer size:
+
+        mov8 r3 {size}
+        mov8 r2 {buffer}
+        mov8 r1 {fd}
+        mov1 =HOST_FS_CODE_REG =HOST_FS_WRITE
+        intr =HOST_FS_INTR
+
+    %endmacro
+
+
+    # Read at the given offset of the file, without moving its current position
+    #
+    # Args:
+    #   - fd: the descriptor of the file (8 bytes)
+    #   - buffer: the buffer address to read into (8 bytes)
+    #   - size: the number of bytes to read (8 bytes)
+    #   - offset: the file offset to read at (8 bytes)
+    #
+    # Return:
+    #   - r1: the number of bytes read, which is less than size at the end of the file
+    %% host_fs_read_at fd buffer size offset:
+
+        mov8 r4 {offset}
+        mov8 r3 {size}
+        mov8 r2 {buffer}
+        mov8 r1 {fd}
+        mov1 =HOST_FS_CODE_REG =HOST_FS_READ_AT
+        intr =HOST_FS_INTR
+
+    %endmacro
+
+
+    # Write at the given offset of the file, without moving its current position
+    #
+    # Args:
+    #   - fd: the descriptor of the file (8 bytes)
+    #   - buffer: the buffer address to write (8 bytes)
+    #   - size: the number of bytes to write (8 bytes)
+    #   - offset: the file offset to write at (8 bytes)
+    #
+    # Return:
+    #   - r1: the number of bytes written
+    %% host_fs_write_at fd buffer size offset:
+
+        mov8 r4 {offset}
+        mov8 r3 {size}
+        mov8 r2 {buffer}
+        mov8 r1 {fd}
+        mov1 =HOST_FS_CODE_REG =HOST_FS_WRITE_AT
+        intr =HOST_FS_INTR
+
+    %endmacro
+
+
+    # Move the current position of the file
+    #
+    # Args:
+    #   - fd: the descriptor of the file (8 bytes)
+    #   - offset: the signed offset from the origin (8 bytes)
+    #   - origin: one of the HOST_FS_SEEK_* origins (8 bytes)
+    #
+    # Return:
+    #   - r1: the new position
+    %% host_fs_seek fd offset origin:
+
+        mov8 r3 {origin}
+        mov8 r2 {offset}
+        mov8 r1 {fd}
+        mov1 =HOST_FS_CODE_REG =HOST_FS_SEEK
+        intr =HOST_FS_INTR
+
+    %endmacro
+
+
+    # Get information about the file
+    #
+    # Args:
+    #   - fd: the descriptor of the file (8 bytes)
+    #
+    # Return:
+    #   - r1: the size of the file
+    #   - r2: the last modification time, in seconds since the Unix epoch
+    %% host_fs_stat fd:
+
+        mov8 r1 {fd}
+        mov1 =HOST_FS_CODE_REG =HOST_FS_STAT
+        intr =HOST_FS_INTR
+
+    %endmacro
+
+
+    # Map the file into the given memory range, so that its pages are only read from the host when they're accessed.
+    # Only the whole pages inside the range are mapped, so the file data doesn't start at the start of the range.
+    # The mapping is copy-on-write: writes to it never reach the file
+    #
+    # Args:
+    #   - fd: the descriptor of the file (8 bytes)
+    #   - address: the start of the memory range (8 bytes)
+    #   - size: the size of the memory range, which must hold at least one page (8 bytes)
+    #   - offset: the file offset to map (8 bytes)
+    #
+    # Return:
+    #   - r1: the address of the byte at the file offset
+    #   - r2: the number of file bytes that can be read from r1
+    #   - error: END_OF_FILE if the offset is past the end of the file, INVALID_INPUT if the range is too small
+    %% host_fs_map fd address size offset:
+
+        mov8 r4 {offset}
+        mov8 r3 {size}
+        mov8 r2 {address}
+        mov8 r1 {fd}
+        mov1 =HOST_FS_CODE_REG =HOST_FS_MAP
+        intr =HOST_FS_INTR
 
     %endmacro
 
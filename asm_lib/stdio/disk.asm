@@ -38,9 +38,12 @@
         %- buffer: r2
         %- size: r3
 
+        # load_arg8 overwrites r1 and r2, so the buffer is passed through the stack
+        !load_arg8 16 =size
+        push8 =size
         !load_arg8 8 =size
-        !load_arg8 16 =buffer
         !load_arg8 24 =address
+        pop8 =buffer
 
         intr =DISK_READ
 
@@ -58,13 +61,13 @@
     #   - buffer: the buffer address to write (8 bytes)
     #   - size: the number of bytes to write (8 bytes)
     #
-    %% write_disk address buffer size:
+    %% disk_write address buffer size:
 
         push8 {address}
         push8 {buffer}
         push8 {size}
 
-        call write_disk
+        call disk_write
 
         popsp1 24
 
@@ -82,9 +85,12 @@
         %- buffer: r2
         %- size: r3
 
+        # load_arg8 overwrites r1 and r2, so the buffer is passed through the stack
+        !load_arg8 16 =size
+        push8 =size
         !load_arg8 8 =size
-        !load_arg8 16 =buffer
         !load_arg8 24 =address
+        pop8 =buffer
 
         intr =DISK_WRITE
 
@@ -95,6 +101,141 @@
         ret
     
 
+    # Start reading `size` bytes from local storage at `address` into `buffer` without waiting for the read to complete.
+    # The buffer must not be used until the request is completed
+    #
+    # Args:
+    #   - address: the disk read address (8 bytes)
+    #   - buffer: the buffer address to read into (8 bytes)
+    #   - size: the number of bytes to read (8 bytes)
+    #
+    # Return:
+    #   - r1: the id of the request, or 0 if no disk is available
+    #   - error: MODULE_UNAVAILABLE if no disk is available
+    #
+    %% disk_submit_read address buffer size:
+
+        push8 {address}
+        push8 {buffer}
+        push8 {size}
+
+        call disk_submit_read
+
+        popsp1 24
+
+    %endmacro
+
+    @@ disk_submit_read
+
+        !set_fstart
+
+        !save_reg_state r2
+        !save_reg_state r3
+
+        %- address: r1
+        %- buffer: r2
+        %- size: r3
+
+        # load_arg8 overwrites r1 and r2, so the buffer is passed through the stack
+        !load_arg8 16 =size
+        push8 =size
+        !load_arg8 8 =size
+        !load_arg8 24 =address
+        pop8 =buffer
+
+        intr =DISK_SUBMIT_READ
+
+        !restore_reg_state r3
+        !restore_reg_state r2
+
+        ret
+
+
+    # Start writing `size` bytes from `buffer` into local storage at `address` without waiting for the write to complete.
+    # The buffer must not be modified until the request is completed
+    #
+    # Args:
+    #   - address: the disk write address (8 bytes)
+    #   - buffer: the buffer address to write (8 bytes)
+    #   - size: the number of bytes to write (8 bytes)
+    #
+    # Return:
+    #   - r1: the id of the request, or 0 if no disk is available
+    #   - error: MODULE_UNAVAILABLE if no disk is available
+    #
+    %% disk_submit_write address buffer size:
+
+        push8 {address}
+        push8 {buffer}
+        push8 {size}
+
+        call disk_submit_write
+
+        popsp1 24
+
+    %endmacro
+
+    @@ disk_submit_write
+
+        !set_fstart
+
+        !save_reg_state r2
+        !save_reg_state r3
+
+        %- address: r1
+        %- buffer: r2
+        %- size: r3
+
+        # load_arg8 overwrites r1 and r2, so the buffer is passed through the stack
+        !load_arg8 16 =size
+        push8 =size
+        !load_arg8 8 =size
+        !load_arg8 24 =address
+        pop8 =buffer
+
+        intr =DISK_SUBMIT_WRITE
+
+        !restore_reg_state r3
+        !restore_reg_state r2
+
+        ret
+
+
+    # Check whether a request submitted with `disk_submit_read` or `disk_submit_write` is completed.
+    # A completed request is forgotten, so its result is only returned once
+    #
+    # Args:
+    #   - request: the request id (8 bytes)
+    #
+    # Return:
+    #   - r1: 1 if the request is completed, 0 otherwise
+    #   - error: the result of the completed request, or NOT_FOUND if there is no such request
+    #
+    %% disk_poll request:
+
+        mov8 r1 {request}
+        intr =DISK_POLL
+
+    %endmacro
+
+
+    # Wait for a request submitted with `disk_submit_read` or `disk_submit_write` to complete.
+    # The request is forgotten
+    #
+    # Args:
+    #   - request: the request id (8 bytes)
+    #
+    # Return:
+    #   - error: the result of the request, or NOT_FOUND if there is no such request
+    #
+    %% disk_wait request:
+
+        mov8 r1 {request}
+        intr =DISK_WAIT
+
+    %endmacro
+
+
     # Check if a disk is available
     #
     # Return:
@@ -9,4 +9,5 @@
     @@ stdlib/exit.asm
     @@ stdlib/memory.asm
     @@ stdlib/rand.asm
+    @@ stdlib/snapshot.asm
     
@@ -7,7 +7,7 @@
 
 .include:
 
-    errors.asm
+    archlib.asm
 
 
 .text:
@@ -1,7 +1,6 @@
 # memory
 # Library for memory management
-
-# THIS IS DEPRECATED
+# The heap is managed by the VM allocator, which lives between the program and the stack
 
 
 .include:
@@ -12,7 +11,14 @@
 
 .text:
 
-    # Call malloc with the given size
+    # Allocate a memory block of at least `size` bytes
+    #
+    # Args:
+    #   - size: the size of the block (8 bytes)
+    #
+    # Return:
+    #   - r1: the address of the allocated block, or 0 if the allocation failed
+    #   - error: OUT_OF_MEMORY if the allocation failed
     %% malloc size:
 
         mov8 r1 {size}
@@ -21,7 +27,13 @@
     %endmacro
 
 
-    # Call free with the given arguemnt
+    # Free the memory block at the given address. Freeing address 0 does nothing
+    #
+    # Args:
+    #   - addr: the address of the block (8 bytes)
+    #
+    # Return:
+    #   - error: INVALID_INPUT if the address is not an allocated block
     %% free addr:
 
         mov8 r1 {addr}
@@ -30,80 +42,97 @@
     %endmacro
 
 
-    # Allocate a memory region of `num` * `size` bytes and return its address
+    # Resize the memory block at `addr` to at least `size` bytes.
+    # The block is moved if it doesn't fit, in which case its content is copied over.
+    # Address 0 allocates a new block
     #
     # Args:
-    #   - num: the number of elements (8 bytes)
-    #   - size: the size of each element (8 bytes)
+    #   - addr: the address of the block (8 bytes)
+    #   - size: the new size of the block (8 bytes)
     #
     # Return:
-    #   - r1: the address of the allocated memory region
-    %% calloc num size:
+    #   - r1: the address of the resized block, or 0 if the allocation failed
+    #   - error: OUT_OF_MEMORY or INVALID_INPUT if the reallocation failed
+    %% realloc addr size:
 
         push8 {size}
-        mov8 r1 {num}
-        
-        call calloc
+        mov8 r1 {addr}
+
+        call realloc
 
-        popsp 8
+        popsp1 8
 
     %endmacro
 
-    # Allocates memory block to fit num*size bytes
-    # r1: number of elements
-    # r2: size of element
-    @@ calloc
+    @@ realloc
 
         !set_fstart
 
         !save_reg_state r2
-        !save_reg_state r3
 
+        # Loading the argument clobbers r1
+        push8 r1
         !load_arg8 8 r2
+        pop8 r1
 
-        # Calculate the size to allocate
-        # r1 is `num`, r2 is `size`
-        imul
+        intr =REALLOC
 
-        # Save into r2 the number of bytes to initialize
-        mov r2 r1
+        !restore_reg_state r2
 
-        intr =MALLOC
-        
-        # r1 is now the address of the memory block
-        # Save the allocated block address
-        mov r3 r1
+        ret
 
-        # Initialize the memory block to zeroes
-        call init_zeros
 
-        # Move the return value to r1
-        mov r1 r3
+    # Allocate a memory region of `num` * `size` bytes initialized to zeros and return its address
+    #
+    # Args:
+    #   - num: the number of elements (8 bytes)
+    #   - size: the size of each element (8 bytes)
+    #
+    # Return:
+    #   - r1: the address of the allocated memory region, or 0 if the allocation failed
+    #   - error: OUT_OF_MEMORY if the allocation failed
+    %% calloc num size:
 
-        !restore_reg_state r3
-        !restore_reg_state r2
+        push8 {size}
+        mov8 r1 {num}
 
-        ret
+        call calloc
 
+        popsp1 8
 
-    # Set from addr in r1 until size in r2 with zeros
-    @ init_zeros
+    %endmacro
 
-        @loop
+    # Allocates zeroed memory block to fit num*size bytes
+    # r1: number of elements
+    # r2: size of element
+    @@ calloc
 
-            # Check if finished
-            cmp1 r2 0
-            jmpz endloop
+        !set_fstart
 
-            # Set byte to 0
-            mov1 [r1] 0
+        !save_reg_state r2
 
-            inc r1
-            dec r2
+        # Loading the argument clobbers r1
+        push8 r1
+        !load_arg8 8 r2
+        pop8 r1
 
-            jmp loop
+        intr =CALLOC
 
-        @endloop
+        !restore_reg_state r2
 
         ret
 
+
+    # Get the heap allocation statistics
+    #
+    # Return:
+    #   - r1: bytes currently allocated
+    #   - r2: maximum number of bytes allocated at the same time
+    #   - r3: number of blocks currently allocated
+    #   - r4: total number of allocations
+    %% heap_stats:
+
+        intr =HEAP_STATS
+
+    %endmacro
+
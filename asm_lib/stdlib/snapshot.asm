@@ -0,0 +1,23 @@
+# snapshot
+# Save the state of the program so that later runs can resume from it
+
+
+.include:
+
+    archlib.asm
+
+
+.text:
+
+    # Save a snapshot of the whole program state to the VM snapshot file.
+    # Running the VM with --restore on the snapshot resumes the program right after this macro
+    #
+    # Return:
+    #   - r1: 0 after saving the snapshot, 1 when resuming from it
+    #   - error: NO_ERROR, or the error that made saving the snapshot fail
+    %% snapshot:
+
+        intr =SNAPSHOT
+
+    %endmacro
+
@@ -11,6 +11,8 @@
     @@ string/strncpy.asm
     @@ string/memcpy.asm
     @@ string/memmove.asm
+    @@ string/memset.asm
+    @@ string/memchr.asm
     @@ string/memswap.asm
     @@ string/str_from_int.asm
 
@@ -0,0 +1,36 @@
+# memchr
+
+
+.text:
+
+    # Find the first occurrence of `value` in the `num` bytes at `ptr`
+    #
+    # Args:
+    #   - ptr: memory region address (8 bytes)
+    #   - value: the byte to search for (1 byte)
+    #   - num: number of bytes to search (8 bytes)
+    #
+    # Return:
+    #   - r1: the address of the first occurrence, or `ptr` + `num` if `value` was not found
+    #
+    %% memchr ptr value num:
+
+        push8 r2
+        push8 r3
+
+        # Pass the arguments through the stack, so that they can be any register
+        push8 {ptr}
+        push8 {value}
+        push8 {num}
+
+        pop8 r3
+        pop8 r2
+        pop8 r1
+
+        mchr
+
+        pop8 r3
+        pop8 r2
+
+    %endmacro
+
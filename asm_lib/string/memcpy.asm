@@ -1,15 +1,10 @@
 # memcpy
 
 
-.include:
-
-    asmutils/functoinal.asm
-
-
 .text:
 
-    # Copy `num` bytes from `src` into `dest` without checking for overlapping memory regions.
-    # For copying overlapping memory regions, consider using `memmove`
+    # Copy `num` bytes from `src` into `dest`.
+    # The copy is done by the VM in a single instruction, so overlapping memory regions are handled too
     #
     # Args:
     #   - src: source memory region address (8 bytes)
@@ -18,57 +13,24 @@
     #
     %% memcpy src dest num:
 
+        push8 r1
+        push8 r2
+        push8 r3
+
+        # Pass the arguments through the stack, so that they can be any register
         push8 {src}
         push8 {dest}
         push8 {num}
 
-        call memcpy
-
-        popsp1 24
-
-    %endmacro
-
-    @@ memcpy
-
-        !set_fstart
-
-        !save_reg_state r1
-        !save_reg_state r2
-        !save_reg_state r3
+        pop8 r3
+        pop8 r1
+        pop8 r2
 
-        %- src: r1
-        %- dest: r2
-        %- num: r3
+        mcpy
 
-        !load_arg8 8 =num
-        !load_arg8 16 =dest
-        !load_arg8 24 =src
+        pop8 r3
+        pop8 r2
+        pop8 r1
 
-        @ loop
-
-            # Check if all bytes have been copied
-            cmp1 =num 0
-            jmpz endloop
-
-            # Copy the byte
-            mov1 [=dest] [=src]
-
-            # Increment the byte pointers
-            inc =src
-            inc =dest
-
-            # Decrement the bytes still to write
-            dec =num
-
-            jmp loop
-
-        @ endloop
-
-
-        # Restore previous register states
-        !restore_reg_state r3
-        !restore_reg_state r2
-        !restore_reg_state r1
-
-        ret
+    %endmacro
 
@@ -0,0 +1,35 @@
+# memset
+
+
+.text:
+
+    # Fill `num` bytes at `dest` with `value`
+    #
+    # Args:
+    #   - dest: destination memory region address (8 bytes)
+    #   - value: the byte to write (1 byte)
+    #   - num: number of bytes to write (8 bytes)
+    #
+    %% memset dest value num:
+
+        push8 r1
+        push8 r2
+        push8 r3
+
+        # Pass the arguments through the stack, so that they can be any register
+        push8 {dest}
+        push8 {value}
+        push8 {num}
+
+        pop8 r3
+        pop8 r2
+        pop8 r1
+
+        mset
+
+        pop8 r3
+        pop8 r2
+        pop8 r1
+
+    %endmacro
+
@@ -3,7 +3,6 @@
 
 .include:
 
-    string/memcpy.asm
     asmutils/functional.asm
 
 
@@ -24,7 +23,7 @@
 
         call memswap
 
-        popsp 24
+        popsp1 24
 
     %endmacro
 
@@ -32,6 +31,9 @@
 
         !set_fstart
 
+        !save_reg_state r1
+        !save_reg_state r2
+        !save_reg_state r3
         !save_reg_state r4
         !save_reg_state r5
         !save_reg_state r6
@@ -46,23 +48,33 @@
 
         # Allocate an intermediate buffer on the stack
         pushsp =num
+        mov r3 =num
 
         # Copy the first memory region into the buffer
-        !memcpy =first stp =num
+        mov r1 stp
+        mov r2 =first
+        mcpy
 
         # Copy the second memory region into the first one
-        !memcpy =second =first =num
+        mov r1 =first
+        mov r2 =second
+        mcpy
 
         # Copy the temporary buffer into the second memory region
-        !memcpy stp =second =num
+        mov r1 =second
+        mov r2 stp
+        mcpy
 
         # Pop the intermediate buffer from the stack
-        popsp r6
+        popsp =num
 
 
         !restore_reg_state r6
         !restore_reg_state r5
         !restore_reg_state r4
+        !restore_reg_state r3
+        !restore_reg_state r2
+        !restore_reg_state r1
 
         ret
 
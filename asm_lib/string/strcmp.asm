@@ -25,7 +25,7 @@
 
         call strcmp
 
-        popsp 8
+        popsp1 8
 
     %endmacro
 
@@ -33,48 +33,51 @@
 
         !set_fstart
 
+        !save_reg_state r2
         !save_reg_state r3
         !save_reg_state r4
 
 
         %- s1: r3
         %- s2: r4
-        %- eq: r1
+        %- len: r2
 
-        !load_arg8 8 =s1
         mov =s2 r1
+        !load_arg8 8 =s1
 
-        # Initialize the return value to 0 (strings are not equal)
-        mov1 =eq 0
-
-        @ loop
-
-            # Compare the chars
-            cmp1 [=s1] [=s2]
-            jmpnz not_equal
-
-            # The chars are equal here
-            # Check if they are null and finish
-            cmp1 [=s1] 0
-            jmpz equal
+        # Strings of different lengths can't be equal
+        mov r1 =s1
+        slen
+        mov =len r1
 
-            # If the chars are equal but not null, increment the pointers and continue
-            inc =s1
-            inc =s2
+        mov r1 =s2
+        slen
 
-            jmp loop
+        cmp r1 =len
+        jmpnz not_equal
 
+        # Compare the characters of the two strings
+        mov r1 =s1
+        mov r3 =len
+        mov r2 =s2
+        mcmp
+        jmpnz not_equal
 
-    @ equal
         # Set return value to 1
-        mov1 =eq 1
+        mov1 r1 1
+        jmp end
 
 
     @ not_equal
 
+        mov1 r1 0
+
+
+    @ end
 
     !restore_reg_state r4
     !restore_reg_state r3
+    !restore_reg_state r2
 
     ret
 
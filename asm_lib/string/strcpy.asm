@@ -23,7 +23,7 @@
 
         call strcpy
 
-        popsp 16
+        popsp1 16
 
     %endmacro
 
@@ -31,6 +31,8 @@
 
         !set_fstart
 
+        !save_reg_state r1
+        !save_reg_state r2
         !save_reg_state r3
         !save_reg_state r4
 
@@ -40,26 +42,20 @@
         !load_arg8 8 =dest
         !load_arg8 16 =src
 
-        @ loop
+        # Copy the string including the termination character
+        mov r1 =src
+        slen
+        inc r1
 
-            # Copy the current char over
-            mov1 [=dest] [=src]
-
-            # Check if the char is null
-            cmp1 [=src] 0
-            jmpz endloop
-
-            # The char is not null, continue
-            inc =src
-            inc =dest
-
-            jmp loop
-
-            
-        @ endloop
+        mov r2 =src
+        mov r3 r1
+        mov r1 =dest
+        mcpy
 
         !restore_reg_state r4
         !restore_reg_state r3
+        !restore_reg_state r2
+        !restore_reg_state r1
 
         ret
 
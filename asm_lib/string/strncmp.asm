@@ -35,6 +35,7 @@
 
         !set_fstart
 
+        !save_reg_state r2
         !save_reg_state r3
         !save_reg_state r4
         !save_reg_state r5
@@ -48,37 +49,24 @@
         !load_arg8 8 =s2
         !load_arg8 16 =s1
 
-        # Initialize the return value to 1 (strings are equal)
-        mov1 =eq 1
-
-        @ loop
-
-            # Check if the comparison is finished
-            cmp1 =num 0
-            jmpz endloop
-
-            # Compare the chars
-            cmp1 [=s1] [=s2]
-            jmpnz not_equal
-
-            # Continue the loop
-            inc =s1
-            inc =s2
-            dec =num
+        # Compare the bytes of the two strings
+        mov r1 =s1
+        mov r2 =s2
+        mcmp
 
-            jmp loop
-
-
-        @ not_equal
+        # Set the return value to 1 if the strings are equal
+        mov1 =eq 1
+        jmpz end
 
-            mov1 =eq 0
+        mov1 =eq 0
 
 
-        @ endloop
+    @ end
 
         !restore_reg_state r5
         !restore_reg_state r4
         !restore_reg_state r3
+        !restore_reg_state r2
 
         ret
-        
+
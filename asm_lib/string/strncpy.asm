@@ -27,7 +27,7 @@
 
         call strncpy
 
-        popsp 24
+        popsp1 24
 
     %endmacro
 
@@ -35,6 +35,8 @@
 
         !set_fstart
 
+        !save_reg_state r1
+        !save_reg_state r2
         !save_reg_state r3
         !save_reg_state r4
         !save_reg_state r5
@@ -47,54 +49,41 @@
         !load_arg8 16 =dest
         !load_arg8 24 =src
 
-        @ loop_copy
+        # Copy at most `num` characters, including the termination character
+        mov r1 =src
+        slen
+        inc r1
 
-            # Check if the requested chars have been copied
-            cmp1 =num 0
-            jmpz endloop
+        cmp r1 =num
+        jmple copy
+        mov r1 =num
 
-            # Copy the chars
-            mov1 [=dest] [=src]
+    @ copy
 
-            # Check if the source char is null (source string is finished)
-            cmp1 [=src] 0
-            jmpz pad_with_zeroes
+        mov r2 =src
+        mov r3 r1
+        mov r1 =dest
+        mcpy
 
-            # Increment the char*
-            inc =src
-            inc =dest
+        # Pad the rest of the buffer with zeros
+        mov r2 r3
+        iadd
+        mov =dest r1
 
-            # Decrement the chars still to write
-            dec =num
+        mov r1 =num
+        mov r2 r3
+        isub
+        mov r3 r1
 
-            jmp loop_copy
-
-
-    @ pad_with_zeroes
-
-        @ loop_pad
-
-            # Check if the requested chars have been copied
-            cmp1 =num 0
-            jmpz endloop
-
-            # Write 0 to destination
-            mov1 [=dest] 0
-
-            # Increment the char*
-            inc =dest
-
-            # Decrement the chars still to write
-            dec =num
-
-            jmp loop_pad
-
-
-    @ endloop
+        mov r1 =dest
+        mov1 r2 0
+        mset
 
     !restore_reg_state r5
     !restore_reg_state r4
     !restore_reg_state r3
+    !restore_reg_state r2
+    !restore_reg_state r1
 
     ret
 
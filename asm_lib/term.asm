@@ -6,9 +6,8 @@
 
     archlib.asm
     stdbool.asm
-    errors.asm
     asmutils/functional.asm
-    asmutils/ptr_index.asm
+    asmutils/pointer/ptr_index.asm
 
 
 .text:
@@ -44,6 +43,7 @@
     %- TERM_GET_CURSOR_POSITION: 26
     %- TERM_GET_KEY_LISTENER: 27
     %- TERM_STOP_KEY_LISTENER: 28
+    %- TERM_PRESENT_FRAME: 29
 
     # Constants
 
@@ -313,6 +313,25 @@
     %endmacro
 
 
+    # Draw a frame of characters, one byte per cell with 0 for a blank, row after row.
+    # Only the cells that changed since the last frame are drawn. After other output, clear the terminal to draw the next frame whole
+    #
+    # Args:
+    #   - frame: the address of the cells (8 bytes)
+    #   - width: the number of columns (8 bytes)
+    #   - height: the number of rows (8 bytes)
+    #
+    %% term_present_frame frame width height:
+
+        mov8 r3 {height}
+        mov8 r2 {width}
+        mov8 r1 {frame}
+        mov1 =TERM_CODE_REG =TERM_PRESENT_FRAME
+        intr =TERM_INTR
+
+    %endmacro
+
+
     %% clear_key_data key_data_address:
 
         mov2 [{key_data_address}] 0
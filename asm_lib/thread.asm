@@ -0,0 +1,178 @@
+# thread
+# Guest threads and the primitives to synchronize them
+# The threads share the memory of the program. Each thread runs on its own stack, which is allocated on the heap
+
+
+.include:
+
+    archlib.asm
+    asmutils/functional.asm
+
+
+.text:
+
+    # Start a thread that executes the code at `entry` on a new stack of `stack_size` bytes.
+    # The thread starts with `arg` in r1 and ends when it executes `exit`, with the exit register as its result
+    #
+    # Args:
+    #   - entry: the address of the code the thread executes (8 bytes)
+    #   - arg: the value of r1 in the new thread (8 bytes)
+    #   - stack_size: the size of the thread stack (8 bytes)
+    #
+    # Return:
+    #   - r1: the id of the thread, or 0 if it couldn't be started
+    #   - error: OUT_OF_MEMORY if the stack couldn't be allocated
+    %% thread_spawn entry arg stack_size:
+
+        mov8 r3 {stack_size}
+        mov8 r2 {arg}
+        mov8 r1 {entry}
+        intr =THREAD_SPAWN
+
+    %endmacro
+
+
+    # Wait for the thread with the given id to end. A thread can only be joined once
+    #
+    # Args:
+    #   - id: the id returned by `thread_spawn` (8 bytes)
+    #
+    # Return:
+    #   - r1: the exit code of the thread, or 0 if it failed
+    #   - error: NOT_FOUND if there is no such thread, STACK_OVERFLOW if the thread overflowed its stack,
+    #     GENERIC_ERROR if the thread hit a fatal error
+    %% thread_join id:
+
+        mov8 r1 {id}
+        intr =THREAD_JOIN
+
+    %endmacro
+
+
+    # Block while the 8-byte value at `addr` equals `expected`, until another thread calls `notify` on the address.
+    # The thread may also wake up for no reason, so the value must be checked again
+    #
+    # Args:
+    #   - addr: the 8-byte aligned address of the value (8 bytes)
+    #   - expected: the value to wait on (8 bytes)
+    #
+    # Return:
+    #   - error: UNALIGNED_ADDRESS if the address is not aligned
+    %% wait addr expected:
+
+        mov8 r2 {expected}
+        mov8 r1 {addr}
+        intr =MEMORY_WAIT
+
+    %endmacro
+
+
+    # Wake up all the threads waiting on the given address
+    #
+    # Args:
+    #   - addr: the address the threads wait on (8 bytes)
+    %% notify addr:
+
+        mov8 r1 {addr}
+        intr =MEMORY_NOTIFY
+
+    %endmacro
+
+
+    # Lock the mutex at the given address, waiting for other threads to unlock it.
+    # A mutex is an 8-byte aligned 8-byte value, initialized to 0
+    #
+    # Args:
+    #   - mutex: the address of the mutex (8 bytes)
+    %% mutex_lock mutex:
+
+        mov8 r1 {mutex}
+
+        call mutex_lock
+
+    %endmacro
+
+    # Mutex states: 0 unlocked, 1 locked, 2 locked with threads waiting
+    # r1: address of the mutex
+    @@ mutex_lock
+
+        !save_reg_state r1
+        !save_reg_state r2
+        !save_reg_state r3
+        !save_reg_state r4
+
+        %- mutex: r4
+
+        mov8 =mutex r1
+
+        # Take the unlocked mutex without waiting
+        mov8 r2 0
+        mov8 r3 1
+        cas8
+        jmpz locked
+
+    @ contended
+
+        # Mark the mutex as waited on. If it was unlocked meanwhile, it's now taken
+        mov8 r1 =mutex
+        mov8 r2 2
+        xchg8
+        cmp8 r1 0
+        jmpz locked
+
+        mov8 r1 =mutex
+        mov8 r2 2
+        intr =MEMORY_WAIT
+        jmp contended
+
+    @ locked
+
+        !restore_reg_state r4
+        !restore_reg_state r3
+        !restore_reg_state r2
+        !restore_reg_state r1
+
+        ret
+
+
+    # Unlock the mutex at the given address, which must be locked by this thread
+    #
+    # Args:
+    #   - mutex: the address of the mutex (8 bytes)
+    %% mutex_unlock mutex:
+
+        mov8 r1 {mutex}
+
+        call mutex_unlock
+
+    %endmacro
+
+    # r1: address of the mutex
+    @@ mutex_unlock
+
+        !save_reg_state r1
+        !save_reg_state r2
+        !save_reg_state r3
+
+        %- mutex: r3
+
+        mov8 =mutex r1
+
+        mov8 r2 0
+        xchg8
+
+        # Only wake up the waiting threads if there are any
+        cmp8 r1 2
+        jmpnz unlocked
+
+        mov8 r1 =mutex
+        intr =MEMORY_NOTIFY
+
+    @ unlocked
+
+        !restore_reg_state r3
+        !restore_reg_state r2
+        !restore_reg_state r1
+
+        ret
+
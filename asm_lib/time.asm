@@ -114,3 +114,17 @@
     
     %endmacro
 
+
+    # Fill the buffer with the performance counters of the VM.
+    # The counters are 8-byte unsigned integers at the PERF_* offsets of archlib.asm.
+    # Instructions, calls, returns, interrupts and bulk memory bytes are counted for the current thread only
+    #
+    # Args:
+    #   - buffer: address of a buffer of PERF_COUNTERS_SIZE bytes (8 bytes)
+    #
+    %% perf_counters buffer:
+
+        mov8 r1 {buffer}
+        intr =PERF_COUNTERS
+
+    %endmacro
@@ -0,0 +1,76 @@
+//! Throughput benchmarks of the assembler.
+//!
+//! Run with `cargo bench -p assembler`.
+
+#![feature(test)]
+
+extern crate test;
+
+use std::fs;
+use std::path::{Path, PathBuf};
+
+use test::Bencher;
+
+use ::assembler::{assembler, files};
+use ::assembler::assembler::AssemblerOptions;
+
+
+fn workspace_path(path: &str) -> PathBuf {
+    Path::new(env!("CARGO_MANIFEST_DIR")).join("..").join(path).canonicalize().unwrap()
+}
+
+
+fn bench_assemble(b: &mut Bencher, unit_path: &Path, assembly: Vec<String>, use_cache: bool) {
+
+    let options = AssemblerOptions {
+        include_lib_path: workspace_path("asm_lib"),
+        cache_dir: use_cache.then(|| Path::new(env!("CARGO_TARGET_TMPDIR")).join("asm_cache")),
+        ..Default::default()
+    };
+
+    b.iter(|| assembler::assemble(assembly.clone(), unit_path, options.clone()));
+}
+
+
+/// Write a program that includes every top-level library of `asm_lib`, and through them the whole include graph
+fn full_asm_lib_program() -> (PathBuf, Vec<String>) {
+
+    let mut libraries: Vec<String> = fs::read_dir(workspace_path("asm_lib")).unwrap()
+        .map(|entry| entry.unwrap().path())
+        .filter(|path| path.extension().is_some_and(|extension| extension == "asm"))
+        .map(|path| path.file_name().unwrap().to_str().unwrap().to_string())
+        .collect();
+    libraries.sort();
+
+    let mut assembly = vec![".include:".to_string()];
+    assembly.extend(libraries.iter().map(|library| format!("    {}", library)));
+    assembly.extend([".text:", "@start", "    mov8 exit 0"].map(String::from));
+
+    let unit_path = Path::new(env!("CARGO_TARGET_TMPDIR")).join("full_asm_lib.asm");
+    fs::write(&unit_path, assembly.join("\n")).unwrap();
+
+    (unit_path, assembly)
+}
+
+
+#[bench]
+fn full_asm_lib(b: &mut Bencher) {
+    let (unit_path, assembly) = full_asm_lib_program();
+    bench_assemble(b, &unit_path, assembly, false);
+}
+
+
+/// Same as `full_asm_lib`, with the library units linked from their cached objects
+#[bench]
+fn full_asm_lib_cached(b: &mut Bencher) {
+    let (unit_path, assembly) = full_asm_lib_program();
+    bench_assemble(b, &unit_path, assembly, true);
+}
+
+
+#[bench]
+fn terminal_game(b: &mut Bencher) {
+    let unit_path = workspace_path("impl/terminal_game/main.asm");
+    let assembly = files::load_assembly(&unit_path).unwrap();
+    bench_assemble(b, &unit_path, assembly, false);
+}
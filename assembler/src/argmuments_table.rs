@@ -1499,6 +1499,42 @@ const SHL_ARGS: ArgTable = ArgTable::Zero(Mnemonic::new(ByteCodes::SHIFT_LEFT, 0
 
 const SHR_ARGS: ArgTable = ArgTable::Zero(Mnemonic::new(ByteCodes::SHIFT_RIGHT, 0, 0));
 
+const MCPY_ARGS: ArgTable = ArgTable::Zero(Mnemonic::new(ByteCodes::MEMORY_COPY, 0, 0));
+
+const MSET_ARGS: ArgTable = ArgTable::Zero(Mnemonic::new(ByteCodes::MEMORY_SET, 0, 0));
+
+const MCMP_ARGS: ArgTable = ArgTable::Zero(Mnemonic::new(ByteCodes::MEMORY_COMPARE, 0, 0));
+
+const SLEN_ARGS: ArgTable = ArgTable::Zero(Mnemonic::new(ByteCodes::STRING_LENGTH, 0, 0));
+
+const MCHR_ARGS: ArgTable = ArgTable::Zero(Mnemonic::new(ByteCodes::MEMORY_FIND, 0, 0));
+
+const CAS1_ARGS: ArgTable = ArgTable::Zero(Mnemonic::new(ByteCodes::ATOMIC_COMPARE_EXCHANGE, 1, 0));
+
+const CAS2_ARGS: ArgTable = ArgTable::Zero(Mnemonic::new(ByteCodes::ATOMIC_COMPARE_EXCHANGE, 2, 0));
+
+const CAS4_ARGS: ArgTable = ArgTable::Zero(Mnemonic::new(ByteCodes::ATOMIC_COMPARE_EXCHANGE, 4, 0));
+
+const CAS8_ARGS: ArgTable = ArgTable::Zero(Mnemonic::new(ByteCodes::ATOMIC_COMPARE_EXCHANGE, 8, 0));
+
+const XADD1_ARGS: ArgTable = ArgTable::Zero(Mnemonic::new(ByteCodes::ATOMIC_FETCH_ADD, 1, 0));
+
+const XADD2_ARGS: ArgTable = ArgTable::Zero(Mnemonic::new(ByteCodes::ATOMIC_FETCH_ADD, 2, 0));
+
+const XADD4_ARGS: ArgTable = ArgTable::Zero(Mnemonic::new(ByteCodes::ATOMIC_FETCH_ADD, 4, 0));
+
+const XADD8_ARGS: ArgTable = ArgTable::Zero(Mnemonic::new(ByteCodes::ATOMIC_FETCH_ADD, 8, 0));
+
+const XCHG1_ARGS: ArgTable = ArgTable::Zero(Mnemonic::new(ByteCodes::ATOMIC_EXCHANGE, 1, 0));
+
+const XCHG2_ARGS: ArgTable = ArgTable::Zero(Mnemonic::new(ByteCodes::ATOMIC_EXCHANGE, 2, 0));
+
+const XCHG4_ARGS: ArgTable = ArgTable::Zero(Mnemonic::new(ByteCodes::ATOMIC_EXCHANGE, 4, 0));
+
+const XCHG8_ARGS: ArgTable = ArgTable::Zero(Mnemonic::new(ByteCodes::ATOMIC_EXCHANGE, 8, 0));
+
+const FENCE_ARGS: ArgTable = ArgTable::Zero(Mnemonic::new(ByteCodes::FENCE, 0, 0));
+
 const INTR_ARGS: ArgTable = ArgTable::One([
     // Register
     Some(Mnemonic::new(ByteCodes::INTERRUPT_REG, 0, REGISTER_ID_SIZE)),
@@ -1676,6 +1712,46 @@ pub fn get_arguments_table(operator_name: &str) -> Option<&'static ArgTable> {
 
         "shr" => &SHR_ARGS,
 
+        // Bulk memory
+
+        "mcpy" => &MCPY_ARGS,
+
+        "mset" => &MSET_ARGS,
+
+        "mcmp" => &MCMP_ARGS,
+
+        "slen" => &SLEN_ARGS,
+
+        "mchr" => &MCHR_ARGS,
+
+        // Atomics
+
+        "cas1" => &CAS1_ARGS,
+
+        "cas2" => &CAS2_ARGS,
+
+        "cas4" => &CAS4_ARGS,
+
+        "cas8" => &CAS8_ARGS,
+
+        "xadd1" => &XADD1_ARGS,
+
+        "xadd2" => &XADD2_ARGS,
+
+        "xadd4" => &XADD4_ARGS,
+
+        "xadd8" => &XADD8_ARGS,
+
+        "xchg1" => &XCHG1_ARGS,
+
+        "xchg2" => &XCHG2_ARGS,
+
+        "xchg4" => &XCHG4_ARGS,
+
+        "xchg8" => &XCHG8_ARGS,
+
+        "fence" => &FENCE_ARGS,
+
         // Interrupts
 
         "intr" => &INTR_ARGS,
@@ -1,6 +1,7 @@
 use rusty_vm_lib::assembly::{AssemblyCode, ByteCode};
-use rusty_vm_lib::byte_code::ByteCodes;
+use rusty_vm_lib::byte_code::{ByteCodes, JumpCondition, get_superinstruction};
 use rusty_vm_lib::vm::{Address, ADDRESS_SIZE};
+use rusty_vm_lib::symbols::SymbolTable;
 
 use crate::data_types::DataType;
 use crate::error;
@@ -9,14 +10,24 @@ use crate::argmuments_table::get_arguments_table;
 use crate::token_to_byte_code::generate_operand_bytecode;
 use crate::files;
 use crate::configs;
+use crate::object::{self, ExportedLabel, UnitObject};
+use crate::peephole;
 
+use std::borrow::Cow;
 use std::collections::HashMap;
 use std::io;
 use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::{Arc, Mutex};
+use std::thread;
 
 
-/// Maps a macro name to its definition
-pub type MacroMap = HashMap<String, MacroDefinition>;
+/// Stack size of the threads that assemble units in parallel. Macro expansion is recursive, so they get as much stack as the main thread
+const WORKER_STACK_SIZE: usize = 8 * 1024 * 1024;
+
+
+/// Maps a macro name to its definition. Definitions are shared by all the units that include them
+pub type MacroMap = HashMap<String, Arc<MacroDefinition>>;
 
 
 #[derive(Clone, Debug)]
@@ -46,11 +57,52 @@ impl MacroDefinition {
         }
     }
 
+
+    /// Replace the `{arg}` placeholders of a line of the body with the arguments of the macro call.
+    /// The line is scanned once, and it's borrowed as it is if it has no placeholders
+    pub fn expand_line<'a>(&self, line: &'a str, call_args: &[&str]) -> Cow<'a, str> {
+
+        let mut expanded: Option<String> = None;
+        // The line is copied into the expanded line up to here
+        let mut copied_until = 0;
+        let mut rest = line;
+
+        while let Some(open) = rest.find('{') {
+
+            let placeholder_start = line.len() - rest.len() + open;
+            rest = &rest[open + 1..];
+
+            let Some(close) = rest.find('}') else {
+                break;
+            };
+
+            let Some(arg_index) = self.args.iter().position(|arg| *arg == rest[..close]) else {
+                // Not a placeholder, but the brace may open one
+                continue;
+            };
+
+            let expanded = expanded.get_or_insert_with(|| String::with_capacity(line.len()));
+            expanded.push_str(&line[copied_until..placeholder_start]);
+            expanded.push_str(call_args[arg_index]);
+
+            rest = &rest[close + 1..];
+            copied_until = line.len() - rest.len();
+        }
+
+        match expanded {
+            Some(mut expanded) => {
+                expanded.push_str(&line[copied_until..]);
+                Cow::Owned(expanded)
+            },
+            None => Cow::Borrowed(line)
+        }
+    }
+
 }
 
 
 /// Maps a contant macro name to its definition
-pub type ConstMacroMap = HashMap<String, ConstMacroDefinition>;
+pub type ConstMacroMap = HashMap<String, Arc<ConstMacroDefinition>>;
 
 
 #[derive(Clone, Debug)]
@@ -84,14 +136,14 @@ impl ConstMacroDefinition {
 pub struct LabelDeclaration {
 
     pub address: Address,
-    pub unit_path: PathBuf,
+    pub unit_path: Arc<Path>,
 
 }
 
 
 impl LabelDeclaration {
 
-    pub fn new(address: Address, unit_path: PathBuf) -> LabelDeclaration {
+    pub fn new(address: Address, unit_path: Arc<Path>) -> LabelDeclaration {
         LabelDeclaration {
             address,
             unit_path,
@@ -237,32 +289,88 @@ impl LabelInfo {
 }
 
 
+/// An instruction that was just added to the byte code
+#[derive(Clone, Copy)]
+struct EmittedInstruction {
+
+    pub instruction: ByteCodes,
+    pub address: Address,
+
+}
+
+
 struct ProgramInfo {
 
     pub included_units: ASMUnitMap,
+    /// Where the units of the standard library are looked up
+    pub include_lib_path: PathBuf,
+    /// Where the objects of the units are cached, if the cache is enabled
+    pub cache_dir: Option<PathBuf>,
+    /// Objects of the included units that were assembled beforehand, to link instead of assembling the units
+    pub objects: HashMap<PathBuf, UnitObject>,
+    /// Whether to keep the objects of the included units in `objects`
+    pub keep_objects: bool,
+    /// Assembly code of the units that were read beforehand, to use instead of reading the units again
+    pub sources: HashMap<PathBuf, AssemblyCode>,
     pub byte_code: ByteCode,
+    /// The last instruction added to the byte code, if it can still be fused with the next instruction.
+    /// 
+    /// Anything that may be the target of a jump, like a label, must reset this to `None`
+    pub last_instruction: Option<EmittedInstruction>,
+    /// Addresses of the instructions in the byte code. A fused instruction counts once
+    pub instructions: Vec<Address>,
+    /// Locations in the byte code of the label addresses, so that they can be moved if the byte code changes
+    pub relocations: Vec<Address>,
+    /// Whether any unit uses the current address `$`, whose value can't be moved
+    pub uses_current_address: bool,
 
 }
 
 
 impl ProgramInfo {
 
-    pub fn new() -> ProgramInfo {
+    pub fn new(include_lib_path: PathBuf, cache_dir: Option<PathBuf>) -> ProgramInfo {
         ProgramInfo {
             included_units: ASMUnitMap::new(),
+            include_lib_path,
+            cache_dir,
+            objects: HashMap::new(),
+            keep_objects: false,
+            sources: HashMap::new(),
             byte_code: ByteCode::new(),
+            last_instruction: None,
+            instructions: Vec::new(),
+            relocations: Vec::new(),
+            uses_current_address: false,
         }
     }
 
 }
 
 
-type ASMUnitMap = HashMap<PathBuf, (LabelMap, MacroMap, ConstMacroMap)>;
+/// The symbols an assembly unit exports to the units that include it
+#[derive(Default, Clone)]
+struct UnitExports {
+
+    pub labels: LabelMap,
+    pub macros: MacroMap,
+    pub const_macros: ConstMacroMap,
+    /// Changes whenever the unit or any of its includes change.
+    /// `None` if the unit can't be cached, or while it's being assembled
+    pub key: Option<u64>,
+
+}
+
+
+/// Maps the path of an included unit to its exports, which are shared by all the units that include it
+type ASMUnitMap = HashMap<PathBuf, Arc<UnitExports>>;
 
 
 struct AssemblyUnit<'a> {
 
     pub path: &'a Path,
+    /// The same path, shared by the declarations of the unit
+    pub shared_path: Arc<Path>,
     pub assembly: AssemblyCode,
     pub is_main_unit: bool,
 
@@ -274,6 +382,7 @@ impl AssemblyUnit<'_> {
     pub fn new(path: &Path, assembly: AssemblyCode, is_main_unit: bool) -> AssemblyUnit {
         AssemblyUnit {
             path,
+            shared_path: Arc::from(path),
             assembly,
             is_main_unit,
         }
@@ -282,29 +391,83 @@ impl AssemblyUnit<'_> {
 }
 
 
-/// Try to load an assembly unit
+/// Information about an assembly unit that's needed to store it as a relocatable object
+struct UnitInfo {
+
+    /// Distinguishes the unique symbols of the unit from the ones of the other units
+    pub id: u64,
+    pub last_unique_symbol: usize,
+    /// Address of the first byte emitted by the unit itself, after the byte code of its includes.
+    /// `None` if the byte code depends on where the unit is placed, because it uses the current address `$`
+    /// or because it's interleaved with the byte code of its includes
+    pub own_code_start: Option<Address>,
+    /// The includes of the unit in inclusion order, as written in the include section
+    pub includes: Vec<String>,
+    /// The keys of the includes, in the same order
+    pub include_keys: Vec<Option<u64>>,
+    /// Whether the unit uses the current address `$`
+    pub uses_current_address: bool,
+
+}
+
+
+impl UnitInfo {
+
+    pub fn new(unit_path: &Path, unit_start: Address) -> UnitInfo {
+        UnitInfo {
+            id: object::hash_path(unit_path),
+            last_unique_symbol: 0,
+            own_code_start: Some(unit_start),
+            includes: Vec::new(),
+            include_keys: Vec::new(),
+            uses_current_address: false,
+        }
+    }
+
+
+    /// Generate a symbol name that is unique in the program.
+    /// The name only depends on the unit, so it's the same whether the unit is assembled or linked from the cache
+    pub fn unique_symbol_name(&mut self) -> String {
+        let symbol_name = format!("__unique_symbol_{:x}_{}", self.id, self.last_unique_symbol);
+        self.last_unique_symbol += 1;
+        symbol_name
+    }
+
+
+    /// Return the key of the unit, or `None` if it can't be cached.
+    /// A unit that includes a unit that can't be cached can't be cached either
+    pub fn key(&self, source_hash: u64) -> Option<u64> {
+        self.own_code_start?;
+        let include_keys: Vec<u64> = self.include_keys.iter().copied().collect::<Option<_>>()?;
+        Some(object::unit_key(source_hash, &include_keys))
+    }
+
+}
+
+
+/// Find the assembly unit with the given include name
 /// 
-/// If successful, return the assembly code and the absolute path to the unit
-fn load_asm_unit(unit_name: &str, current_unit_path: &Path) -> io::Result<(PathBuf, AssemblyCode)> {
+/// If successful, return the absolute path to the unit
+fn resolve_asm_unit(unit_name: &str, current_unit_path: &Path, include_lib_path: &Path) -> io::Result<PathBuf> {
 
     let unit_path = Path::new(unit_name);
 
     if unit_path.is_absolute() {
-        // The unit path is absolute, try to load it directly
-        return Ok((unit_path.to_path_buf(), files::load_assembly(unit_path)?));
+        // The unit path is absolute, use it directly
+        return Ok(unit_path.to_path_buf());
     }
 
     // The unit path is relative then
 
-    // Try to load the unit from the standard library
+    // Try to find the unit in the standard library
     {
-        let unit_path = configs::INCLUDE_LIB_PATH.join(unit_path);
-        if let Ok(assembly) = files::load_assembly(&unit_path) {
-            return Ok((unit_path.canonicalize().unwrap(), assembly))
+        let unit_path = include_lib_path.join(unit_path);
+        if unit_path.is_file() {
+            return unit_path.canonicalize();
         }
     }
 
-    // Finally, try to load the unit from the current assembly unit directory
+    // Finally, try to find the unit in the current assembly unit directory
 
     let parent_dir = match current_unit_path.parent() {
         Some(parent_dir) => parent_dir,
@@ -319,9 +482,25 @@ fn load_asm_unit(unit_name: &str, current_unit_path: &Path) -> io::Result<(PathB
     };  
 
     // Get the absolute path of the include unit
-    let unit_path = parent_dir.join(unit_name).canonicalize()?;
+    parent_dir.join(unit_name).canonicalize()
+}
+
+
+/// Try to load an assembly unit. Units that were already included are not read again, so their assembly code is empty
+/// 
+/// If successful, return the assembly code and the absolute path to the unit
+fn load_asm_unit(unit_name: &str, current_unit_path: &Path, program_info: &mut ProgramInfo) -> io::Result<(PathBuf, AssemblyCode)> {
+
+    let unit_path = resolve_asm_unit(unit_name, current_unit_path, &program_info.include_lib_path)?;
 
-    let assembly = files::load_assembly(&unit_path)?;
+    if program_info.included_units.contains_key(&unit_path) {
+        return Ok((unit_path, AssemblyCode::new()));
+    }
+
+    let assembly = match program_info.sources.remove(&unit_path) {
+        Some(assembly) => assembly,
+        None => files::load_assembly(&unit_path)?
+    };
 
     Ok((unit_path, assembly))
 }
@@ -334,7 +513,9 @@ fn load_asm_unit(unit_name: &str, current_unit_path: &Path) -> io::Result<(PathB
 /// Does not substitute $ symbols inside strings or character literals
 /// 
 /// Does not evaluate escape characters inside strings or character literals
-fn evaluate_special_symbols(line: &str, current_binary_address: Address, line_number: usize, unit_path: &Path, local_const_macros: &ConstMacroMap) -> String {
+///
+/// Most lines have nothing to substitute, so the line is only copied once a symbol is substituted
+fn evaluate_special_symbols<'a>(line: &'a str, current_binary_address: Address, line_number: usize, unit_path: &Path, local_const_macros: &ConstMacroMap, unit_info: &mut UnitInfo) -> Cow<'a, str> {
 
     enum TextType {
         Asm,
@@ -343,12 +524,25 @@ fn evaluate_special_symbols(line: &str, current_binary_address: Address, line_nu
         Char {starts_at: (usize, usize) },
     }
 
-    let mut evaluated_line = String::with_capacity(line.len());
+    // The evaluated line, once it differs from the original.
+    // Until then, the evaluated line is the original up to the current character
+    let mut evaluated_line: Option<String> = None;
+
+    // Copy the line up to the substituted text, if it wasn't copied yet
+    let substitute = |evaluated_line: &mut Option<String>, byte_index: usize, text: &str| {
+        evaluated_line.get_or_insert_with(|| {
+            let mut copy = String::with_capacity(line.len() + text.len());
+            copy.push_str(&line[..byte_index]);
+            copy
+        }).push_str(text);
+    };
 
     let mut text_type = TextType::Asm;
     let mut escape_char = false;
+    // Where the evaluated part of the line ends, excluding the comment
+    let mut line_end = line.len();
 
-    for (char_index, c) in line.chars().enumerate() {
+    for (char_index, (byte_index, c)) in line.char_indices().enumerate() {
 
         match text_type {
 
@@ -358,7 +552,9 @@ fn evaluate_special_symbols(line: &str, current_binary_address: Address, line_nu
 
             TextType::String {..} => {
 
-                evaluated_line.push(c);
+                if let Some(evaluated_line) = &mut evaluated_line {
+                    evaluated_line.push(c);
+                }
 
                 if escape_char {
                     escape_char = false;
@@ -373,7 +569,9 @@ fn evaluate_special_symbols(line: &str, current_binary_address: Address, line_nu
 
             TextType::Char {..} => {
 
-                evaluated_line.push(c);
+                if let Some(evaluated_line) = &mut evaluated_line {
+                    evaluated_line.push(c);
+                }
 
                 if escape_char {
                     escape_char = false;
@@ -388,19 +586,20 @@ fn evaluate_special_symbols(line: &str, current_binary_address: Address, line_nu
 
             TextType::ConstMacro { starts_at } => {
 
-                if is_identifier_char(c, starts_at + 1 == char_index) {
+                if is_identifier_char(c, starts_at + 1 == byte_index) {
                     continue;
                 }
 
                 // The const macro name is finished
-                let const_macro_name = &line[starts_at + 1..char_index];
+                let const_macro_name = &line[starts_at + 1..byte_index];
 
                 if let Some(const_macro) = local_const_macros.get(const_macro_name) {
                     // See if the macro can be replaced now
-                    evaluated_line.push_str(const_macro.replace.as_str());
-                } else {
+                    substitute(&mut evaluated_line, starts_at, const_macro.replace.as_str());
+                } else if let Some(evaluated_line) = &mut evaluated_line {
                     // Maybe the macro will be replaced later
-                    evaluated_line.push_str(format!("={}", const_macro_name).as_str());
+                    evaluated_line.push('=');
+                    evaluated_line.push_str(const_macro_name);
                 }
 
                 text_type = TextType::Asm;
@@ -412,29 +611,39 @@ fn evaluate_special_symbols(line: &str, current_binary_address: Address, line_nu
 
         match c {
             '$' => {
-                evaluated_line.push_str(format!("{}", current_binary_address).as_str());
+                substitute(&mut evaluated_line, byte_index, current_binary_address.to_string().as_str());
+                // The byte code now depends on where the unit is placed
+                unit_info.own_code_start = None;
+                unit_info.uses_current_address = true;
             },
             '"' => {
-                evaluated_line.push('"');
+                if let Some(evaluated_line) = &mut evaluated_line {
+                    evaluated_line.push('"');
+                }
                 text_type = TextType::String { starts_at: (line_number, char_index) };
             },
             '\'' => {
-                evaluated_line.push('\'');
+                if let Some(evaluated_line) = &mut evaluated_line {
+                    evaluated_line.push('\'');
+                }
                 text_type = TextType::Char { starts_at: (line_number, char_index) };
             },
             '#' => {
                 // Skip comments
+                line_end = byte_index;
                 break;
             }
             '=' => {
-                text_type = TextType::ConstMacro { starts_at: char_index };
+                text_type = TextType::ConstMacro { starts_at: byte_index };
             },
             '&' => {
-                let symbol = get_unique_symbol_name();
-                evaluated_line.push_str(symbol.as_str());
+                let symbol = unit_info.unique_symbol_name();
+                substitute(&mut evaluated_line, byte_index, symbol.as_str());
             }
             _ => {
-                evaluated_line.push(c);
+                if let Some(evaluated_line) = &mut evaluated_line {
+                    evaluated_line.push(c);
+                }
             }
         }
     }
@@ -457,15 +666,19 @@ fn evaluate_special_symbols(line: &str, current_binary_address: Address, line_nu
 
             if let Some(const_macro) = local_const_macros.get(const_macro_name) {
                 // See if the macro can be replaced now
-                evaluated_line.push_str(const_macro.replace.as_str());
-            } else {
+                substitute(&mut evaluated_line, starts_at, const_macro.replace.as_str());
+            } else if let Some(evaluated_line) = &mut evaluated_line {
                 // Maybe the macro will be replaced later
-                evaluated_line.push_str(format!("={}", const_macro_name).as_str());
+                evaluated_line.push('=');
+                evaluated_line.push_str(const_macro_name);
             }
         }
     }
 
-    evaluated_line
+    match evaluated_line {
+        Some(evaluated_line) => Cow::Owned(evaluated_line),
+        None => Cow::Borrowed(&line[..line_end])
+    }
 }
 
 
@@ -473,20 +686,36 @@ fn evaluate_special_symbols(line: &str, current_binary_address: Address, line_nu
 fn assemble_unit(asm_unit: AssemblyUnit, verbose: bool, program_info: &mut ProgramInfo) {
 
     // Check if the assembly unit has already been included
-    if let Some((exported_labels, exported_macros, exported_const_macros)) = program_info.included_units.get(asm_unit.path) {
+    if let Some(exports) = program_info.included_units.get(asm_unit.path) {
         if verbose {
             println!("Unit already included: {}", asm_unit.path.display());
-            println!("Exported labels: {:?}\n", exported_labels.keys());
-            println!("Exported macros: {:?}\n", exported_macros.keys());
-            println!("Exported const macros: {:?}\n", exported_const_macros.keys());
+            println!("Exported labels: {:?}\n", exports.labels.keys());
+            println!("Exported macros: {:?}\n", exports.macros.keys());
+            println!("Exported const macros: {:?}\n", exports.const_macros.keys());
         }
-
-        program_info.included_units.insert(asm_unit.path.to_path_buf(), (exported_labels.clone(), exported_macros.clone(), exported_const_macros.clone()));
         return;
     }
     // Insert a temporary entry in the included units map to avoid infinite recursive unit inclusion
-    program_info.included_units.insert(asm_unit.path.to_path_buf(), (LabelMap::new(), MacroMap::new(), ConstMacroMap::new()));
+    program_info.included_units.insert(asm_unit.path.to_path_buf(), Arc::default());
+
+    let source_hash = object::hash_source(asm_unit.path, &asm_unit.assembly);
 
+    // Units that were assembled beforehand, or that didn't change since they were last assembled, are linked from their object
+    if !asm_unit.is_main_unit {
+
+        let object = program_info.objects.remove(asm_unit.path).or_else(
+            || object::load_object(program_info.cache_dir.as_ref()?, asm_unit.path)
+        );
+
+        if let Some(object) = object {
+            if link_unit_object(&asm_unit, &object, source_hash, verbose, program_info) {
+                if program_info.keep_objects {
+                    program_info.objects.insert(asm_unit.path.to_path_buf(), object);
+                }
+                return;
+            }
+        }
+    }
 
     if verbose {
         if asm_unit.is_main_unit {
@@ -502,6 +731,11 @@ fn assemble_unit(asm_unit: AssemblyUnit, verbose: bool, program_info: &mut Progr
 
     let mut section_info = SectionInfo::new();
 
+    let mut unit_info = UnitInfo::new(asm_unit.path, program_info.byte_code.len());
+
+    // Instructions of different units are never fused, so that a unit is assembled the same wherever it's placed
+    program_info.last_instruction = None;
+
     for (i, line) in asm_unit.assembly.iter().enumerate() {
         let line_number = i + 1;
 
@@ -510,7 +744,7 @@ fn assemble_unit(asm_unit: AssemblyUnit, verbose: bool, program_info: &mut Progr
         }
 
         // Evaluate the compile-time special symbols
-        let evaluated_line = evaluate_special_symbols(line, program_info.byte_code.len(), line_number, asm_unit.path, &macro_info.local_const_macros);
+        let evaluated_line = evaluate_special_symbols(line, program_info.byte_code.len(), line_number, asm_unit.path, &macro_info.local_const_macros, &mut unit_info);
 
         // Remove redundant whitespaces
         let trimmed_line = evaluated_line.trim();
@@ -522,7 +756,7 @@ fn assemble_unit(asm_unit: AssemblyUnit, verbose: bool, program_info: &mut Progr
 
         let last_byte_code_address: Address = program_info.byte_code.len();
 
-        parse_line(trimmed_line, &mut macro_info, &asm_unit, &evaluated_line, line_number, program_info, &mut label_info, &mut section_info, verbose);
+        parse_line(trimmed_line, &mut macro_info, &asm_unit, &evaluated_line, line_number, program_info, &mut label_info, &mut section_info, &mut unit_info, verbose);
         
         if verbose && last_byte_code_address != program_info.byte_code.len() {
             println!(" => {:?}", &program_info.byte_code[last_byte_code_address..]);
@@ -537,8 +771,13 @@ fn assemble_unit(asm_unit: AssemblyUnit, verbose: bool, program_info: &mut Progr
         error::unclosed_macro_definition(asm_unit.path, &def.name, def.line_number, asm_unit.assembly[def.line_number - 1].as_str());
     }
 
+    program_info.last_instruction = None;
+
     // After tokenization and conversion to bytecode, substitute the labels with their real address
 
+    let mut local_relocations = Vec::new();
+    let mut external_relocations = Vec::new();
+
     for reference in label_info.label_references {
 
         let label = label_info.local_labels.get(&reference.name).unwrap_or_else(
@@ -547,6 +786,20 @@ fn assemble_unit(asm_unit: AssemblyUnit, verbose: bool, program_info: &mut Progr
 
         // Substitute the label with the real address (little endian)
         program_info.byte_code[reference.location..reference.location + ADDRESS_SIZE].copy_from_slice(&label.address.to_le_bytes());
+        program_info.relocations.push(reference.location);
+
+        // Record where the address must be patched when the unit is linked from its object
+        if let Some(own_code_start) = unit_info.own_code_start {
+            let location = reference.location - own_code_start;
+            if *label.unit_path != *asm_unit.path {
+                external_relocations.push((location, label.unit_path.to_path_buf(), reference.name));
+            } else if let Some(offset) = label.address.checked_sub(own_code_start) {
+                local_relocations.push((location, offset));
+            } else {
+                // The label was declared before the includes, so it points to their byte code
+                unit_info.own_code_start = None;
+            }
+        }
 
     }
 
@@ -561,14 +814,344 @@ fn assemble_unit(asm_unit: AssemblyUnit, verbose: bool, program_info: &mut Progr
         }
     }
 
+    program_info.uses_current_address |= unit_info.uses_current_address;
+
+    let exports = UnitExports {
+        labels: label_info.export_labels,
+        macros: macro_info.export_macros,
+        const_macros: macro_info.export_const_macros,
+        key: unit_info.key(source_hash),
+    };
+
+    if !asm_unit.is_main_unit && (program_info.cache_dir.is_some() || program_info.keep_objects) {
+
+        let object = build_object(&asm_unit, &unit_info, source_hash, &exports, program_info, local_relocations, external_relocations);
+
+        if let (Some(object), Some(cache_dir)) = (&object, &program_info.cache_dir) {
+            if let Err(err) = object::save_object(cache_dir, asm_unit.path, object) {
+                // The unit will just be assembled again next time
+                if verbose {
+                    error::warn(format!("Failed to cache assembly unit \"{}\": {}", asm_unit.path.display(), err).as_str());
+                }
+            }
+        }
+
+        if let (Some(object), true) = (object, program_info.keep_objects) {
+            program_info.objects.insert(asm_unit.path.to_path_buf(), object);
+        }
+    }
+
     // Add the assembly unit to the included units
-    program_info.included_units.insert(asm_unit.path.to_path_buf(), (label_info.export_labels, macro_info.export_macros, macro_info.export_const_macros));
+    program_info.included_units.insert(asm_unit.path.to_path_buf(), Arc::new(exports));
 
 }
 
 
+/// Build the relocatable object of an assembled unit. Return `None` if the unit can't be cached
 #[allow(clippy::too_many_arguments)]
-fn parse_line(trimmed_line: &str, macro_info: &mut MacroInfo, asm_unit: &AssemblyUnit, line: &str, line_number: usize, program_info: &mut ProgramInfo, label_info: &mut LabelInfo, section_info: &mut SectionInfo, verbose: bool) {
+fn build_object(asm_unit: &AssemblyUnit, unit_info: &UnitInfo, source_hash: u64, exports: &UnitExports, program_info: &ProgramInfo, local_relocations: Vec<(Address, Address)>, external_relocations: Vec<(Address, PathBuf, String)>) -> Option<UnitObject> {
+
+    let own_code_start = unit_info.own_code_start?;
+
+    let labels = exports.labels.iter().map(|(name, label)| {
+        let label = if *label.unit_path == *asm_unit.path {
+            ExportedLabel::Local(label.address.checked_sub(own_code_start)?)
+        } else {
+            ExportedLabel::External(label.unit_path.to_path_buf())
+        };
+        Some((name.clone(), label))
+    }).collect::<Option<_>>()?;
+
+    // The instructions of the unit are the last ones emitted, after the ones of its includes
+    let first_instruction = program_info.instructions.partition_point(|&address| address < own_code_start);
+    let instructions = program_info.instructions[first_instruction..].iter().map(|address| address - own_code_start).collect();
+
+    Some(UnitObject {
+        source_hash,
+        key: exports.key?,
+        unit_path: asm_unit.path.to_path_buf(),
+        source: asm_unit.assembly.clone(),
+        includes: unit_info.includes.clone(),
+        byte_code: program_info.byte_code[own_code_start..].to_vec(),
+        instructions,
+        local_relocations,
+        external_relocations,
+        labels,
+        macros: exports.macros.values().cloned().collect(),
+        const_macros: exports.const_macros.values().cloned().collect(),
+    })
+}
+
+
+/// Place the unit in the program from its object, after its includes.
+/// Return false if the object is stale, in which case the unit must be assembled.
+/// The includes placed before finding out that the object is stale don't change the result, since the unit includes them first anyway
+fn link_unit_object(asm_unit: &AssemblyUnit, object: &UnitObject, source_hash: u64, verbose: bool, program_info: &mut ProgramInfo) -> bool {
+
+    if object.source_hash != source_hash || object.unit_path != asm_unit.path || object.source != asm_unit.assembly {
+        return false;
+    }
+
+    let mut include_keys = Vec::with_capacity(object.includes.len());
+
+    for include_unit_raw in &object.includes {
+
+        // Assembling the unit reports the error
+        let Ok((include_path, include_asm)) = load_asm_unit(include_unit_raw, asm_unit.path, program_info) else {
+            return false;
+        };
+
+        assemble_unit(AssemblyUnit::new(&include_path, include_asm, false), verbose, program_info);
+
+        match program_info.included_units.get(&include_path).and_then(|exports| exports.key) {
+            Some(key) => include_keys.push(key),
+            None => return false
+        }
+    }
+
+    if object::unit_key(source_hash, &include_keys) != object.key {
+        return false;
+    }
+
+    let unit_start = program_info.byte_code.len();
+
+    let imported_label = |unit_path: &Path, name: &str| -> Option<LabelDeclaration> {
+        program_info.included_units.get(unit_path)?.labels.get(name).cloned()
+    };
+
+    let external_addresses: Option<Vec<Address>> = object.external_relocations.iter().map(
+        |(_, unit_path, name)| imported_label(unit_path, name).map(|label| label.address)
+    ).collect();
+
+    let labels: Option<LabelMap> = object.labels.iter().map(|(name, label)| {
+        let declaration = match label {
+            ExportedLabel::Local(offset) => LabelDeclaration::new(unit_start + offset, asm_unit.shared_path.clone()),
+            ExportedLabel::External(unit_path) => imported_label(unit_path, name)?
+        };
+        Some((name.clone(), declaration))
+    }).collect();
+
+    let (Some(external_addresses), Some(labels)) = (external_addresses, labels) else {
+        return false;
+    };
+
+    let relocations = object.local_relocations.iter().map(|&(location, offset)| (location, unit_start + offset))
+        .chain(object.external_relocations.iter().map(|(location, ..)| *location).zip(external_addresses))
+        .collect::<Vec<(Address, Address)>>();
+
+    if relocations.iter().any(|&(location, _)| location + ADDRESS_SIZE > object.byte_code.len())
+        || object.instructions.last().is_some_and(|&offset| offset >= object.byte_code.len())
+    {
+        return false;
+    }
+
+    program_info.byte_code.extend(&object.byte_code);
+
+    for (location, address) in relocations {
+        let location = unit_start + location;
+        program_info.byte_code[location..location + ADDRESS_SIZE].copy_from_slice(&address.to_le_bytes());
+        program_info.relocations.push(location);
+    }
+
+    program_info.instructions.extend(object.instructions.iter().map(|offset| unit_start + offset));
+
+    program_info.last_instruction = None;
+
+    if verbose {
+        println!("\nAssembly unit linked from its object: {} ({})\n", asm_unit.path.file_name().unwrap().to_string_lossy(), asm_unit.path.display());
+    }
+
+    let exports = UnitExports {
+        labels,
+        macros: object.macros.iter().map(|def| (def.name.clone(), def.clone())).collect(),
+        const_macros: object.const_macros.iter().map(|def| (def.name.clone(), def.clone())).collect(),
+        key: Some(object.key),
+    };
+
+    program_info.included_units.insert(asm_unit.path.to_path_buf(), Arc::new(exports));
+
+    true
+}
+
+
+/// An included unit found by reading the include sections, before anything is assembled
+struct IncludedUnit {
+
+    pub assembly: AssemblyCode,
+    /// The units it includes. `None` if they can't be known before assembling the unit
+    pub includes: Option<Vec<PathBuf>>,
+
+}
+
+
+/// Read the include section of a unit without assembling it.
+/// Return `None` if the includes can't be known in advance, because the include section comes after another section
+/// or because it uses special symbols
+fn scan_includes(assembly: &AssemblyCode) -> Option<Vec<&str>> {
+
+    fn code(line: &str) -> &str {
+        line.split_once('#').map_or(line, |(code, _comment)| code).trim()
+    }
+
+    let mut includes = Vec::new();
+    let mut in_include_section = false;
+
+    for line in assembly.iter().map(|line| code(line)).filter(|line| !line.is_empty()) {
+
+        if line.starts_with('.') {
+            if in_include_section {
+                break;
+            }
+            if line == ".include:" {
+                in_include_section = true;
+                continue;
+            }
+            // The first section isn't the include section
+            return if assembly.iter().any(|line| code(line) == ".include:") { None } else { Some(includes) };
+        }
+
+        // Code outside of any section is reported when the unit is assembled
+        if !in_include_section || line.contains(['=', '$', '&', '"', '\'']) {
+            return None;
+        }
+
+        includes.push(line.strip_prefix("@@").map_or(line, str::trim));
+    }
+
+    Some(includes)
+}
+
+
+/// Find the units the given unit includes. Return `None` if they can't be known in advance
+fn resolve_includes(unit_path: &Path, assembly: &AssemblyCode, include_lib_path: &Path) -> Option<Vec<PathBuf>> {
+    scan_includes(assembly)?.into_iter().map(
+        // Units that can't be found are reported when the including unit is assembled
+        |include_unit_raw| resolve_asm_unit(include_unit_raw, unit_path, include_lib_path).ok()
+    ).collect()
+}
+
+
+/// Find all the units the main unit includes, directly or not.
+/// Return `None` if the includes of the main unit can't be known in advance
+fn scan_include_graph(main_path: &Path, main_assembly: &AssemblyCode, include_lib_path: &Path) -> Option<HashMap<PathBuf, IncludedUnit>> {
+
+    let mut units: HashMap<PathBuf, IncludedUnit> = HashMap::new();
+    let mut to_visit = resolve_includes(main_path, main_assembly, include_lib_path)?;
+
+    while let Some(unit_path) = to_visit.pop() {
+
+        if units.contains_key(&unit_path) || unit_path == main_path {
+            continue;
+        }
+
+        // Units that can't be read are reported when they're included
+        let Ok(assembly) = files::load_assembly(&unit_path) else {
+            continue;
+        };
+
+        let includes = resolve_includes(&unit_path, &assembly, include_lib_path);
+        to_visit.extend(includes.iter().flatten().cloned());
+
+        units.insert(unit_path, IncludedUnit { assembly, includes });
+    }
+
+    Some(units)
+}
+
+
+/// Assemble an included unit on its own into an object, given the exports of its includes.
+/// Return the object and the exports of the unit, or `None` if the unit can't be stored as an object
+fn assemble_object(unit_path: &Path, unit: &IncludedUnit, assembled: &ASMUnitMap, include_lib_path: &Path, cache_dir: &Option<PathBuf>) -> Option<(UnitObject, Arc<UnitExports>)> {
+
+    let mut program_info = ProgramInfo::new(include_lib_path.to_path_buf(), cache_dir.clone());
+    program_info.keep_objects = true;
+
+    // The includes count as already included, so the byte code only holds the unit's own code.
+    // Until the object is linked, the addresses of the labels are just placeholders
+    for include_path in unit.includes.iter().flatten() {
+        program_info.included_units.insert(include_path.clone(), assembled[include_path].clone());
+    }
+
+    assemble_unit(AssemblyUnit::new(unit_path, unit.assembly.clone(), false), false, &mut program_info);
+
+    let object = program_info.objects.remove(unit_path)?;
+    let exports = program_info.included_units.remove(unit_path)?;
+
+    Some((object, exports))
+}
+
+
+/// Assemble the units included by the main unit into objects, assembling in parallel the units that don't depend on each other.
+/// A unit is assembled once all of its includes are.
+/// The units whose includes can't be known in advance are left to the serial pass, along with the units that include them.
+/// 
+/// The objects and the assembly code of the units are stored in `program_info` for the serial pass
+fn assemble_includes_in_parallel(main_path: &Path, main_assembly: &AssemblyCode, threads: usize, program_info: &mut ProgramInfo) {
+
+    let Some(mut pending) = scan_include_graph(main_path, main_assembly, &program_info.include_lib_path) else {
+        return;
+    };
+
+    let include_lib_path = &program_info.include_lib_path;
+    let cache_dir = &program_info.cache_dir;
+
+    let mut assembled = ASMUnitMap::new();
+
+    loop {
+
+        let ready_paths: Vec<PathBuf> = pending.iter().filter(
+            |(_, unit)| unit.includes.as_ref().is_some_and(
+                |includes| includes.iter().all(|include_path| assembled.contains_key(include_path))
+            )
+        ).map(|(unit_path, _)| unit_path.clone()).collect();
+
+        if ready_paths.is_empty() {
+            break;
+        }
+
+        let ready: Vec<(PathBuf, IncludedUnit)> = ready_paths.into_iter().map(|unit_path| {
+            let unit = pending.remove(&unit_path).unwrap();
+            (unit_path, unit)
+        }).collect();
+
+        let results: Vec<Mutex<Option<(UnitObject, Arc<UnitExports>)>>> = ready.iter().map(|_| Mutex::default()).collect();
+        let next_unit = AtomicUsize::new(0);
+
+        let work = || loop {
+            let index = next_unit.fetch_add(1, Ordering::Relaxed);
+            let Some((unit_path, unit)) = ready.get(index) else {
+                break;
+            };
+            *results[index].lock().unwrap() = assemble_object(unit_path, unit, &assembled, include_lib_path, cache_dir);
+        };
+
+        thread::scope(|scope| {
+            for worker in 1..threads.min(ready.len()) {
+                thread::Builder::new()
+                    .name(format!("assembler worker {}", worker))
+                    .stack_size(WORKER_STACK_SIZE)
+                    .spawn_scoped(scope, work)
+                    .expect("Failed to start an assembler thread");
+            }
+            work();
+        });
+
+        // Units that can't be stored as objects are assembled by the serial pass, and so are the units that include them
+        for ((unit_path, unit), result) in ready.into_iter().zip(results) {
+            if let Some((object, exports)) = result.into_inner().unwrap() {
+                assembled.insert(unit_path.clone(), exports);
+                program_info.objects.insert(unit_path.clone(), object);
+            }
+            program_info.sources.insert(unit_path, unit.assembly);
+        }
+    }
+
+    program_info.sources.extend(pending.into_iter().map(|(unit_path, unit)| (unit_path, unit.assembly)));
+}
+
+
+#[allow(clippy::too_many_arguments)]
+fn parse_line(trimmed_line: &str, macro_info: &mut MacroInfo, asm_unit: &AssemblyUnit, line: &str, line_number: usize, program_info: &mut ProgramInfo, label_info: &mut LabelInfo, section_info: &mut SectionInfo, unit_info: &mut UnitInfo, verbose: bool) {
 
     if let Some(mut section_name) = trimmed_line.strip_prefix('.') {
         // This line specifies a program section
@@ -637,12 +1220,14 @@ fn parse_line(trimmed_line: &str, macro_info: &mut MacroInfo, asm_unit: &Assembl
                     error::invalid_macro_declaration(asm_unit.path, macro_definition.name.as_str(), line_number, line, "Macro definition end `%endmacro` must be on its own line");
                 }
 
+                let macro_definition = Arc::new(macro_info.current_macro.take().unwrap());
+
                 if let Some(def) = macro_info.local_macros.insert(macro_definition.name.clone(), macro_definition.clone()) {
                     error::macro_redeclaration(asm_unit.path, macro_definition.name.as_str(), def.line_number, &def.unit_path, line_number, line);
                 }
 
                 if macro_definition.to_export {
-                    macro_info.export_macros.insert(macro_definition.name.clone(), macro_info.current_macro.take().unwrap());
+                    macro_info.export_macros.insert(macro_definition.name.clone(), macro_definition);
                 }
 
                 // Macros can only be defined inside text sections, so the section is assumed to be text
@@ -666,29 +1251,40 @@ fn parse_line(trimmed_line: &str, macro_info: &mut MacroInfo, asm_unit: &Assembl
                 }
             };
 
-            let (include_path, include_asm) = match load_asm_unit(include_unit_raw, asm_unit.path) {
+            let (include_path, include_asm) = match load_asm_unit(include_unit_raw, asm_unit.path, program_info) {
                 Ok(x) => x,
                 Err(error) => error::include_error(asm_unit.path, &error, include_unit_raw, line_number, line)
             };
 
             let new_asm_unit = AssemblyUnit::new(&include_path, include_asm, false);
 
+            // The unit is relocatable only if its own byte code follows the byte code of all its includes
+            if unit_info.own_code_start != Some(program_info.byte_code.len()) {
+                unit_info.own_code_start = None;
+            }
+
             // Assemble the included assembly unit
             assemble_unit(new_asm_unit, verbose, program_info);
                 
-            let (exported_labels, exported_macros, exported_const_macros): &(LabelMap, MacroMap, ConstMacroMap) = program_info.included_units.get(&include_path).unwrap_or_else(
+            let exports = Arc::clone(program_info.included_units.get(&include_path).unwrap_or_else(
                 || panic!("Internal assembler error: included unit not found in included units map. This is a bug.")
-            );
+            ));
+
+            if unit_info.own_code_start.is_some() {
+                unit_info.own_code_start = Some(program_info.byte_code.len());
+            }
+            unit_info.includes.push(include_unit_raw.to_string());
+            unit_info.include_keys.push(exports.key);
 
             if to_export {
-                label_info.export_labels.extend(exported_labels.clone());
-                macro_info.export_macros.extend(exported_macros.clone());
-                macro_info.export_const_macros.extend(exported_const_macros.clone());
+                label_info.export_labels.extend(exports.labels.iter().map(|(name, label)| (name.clone(), label.clone())));
+                macro_info.export_macros.extend(exports.macros.iter().map(|(name, def)| (name.clone(), def.clone())));
+                macro_info.export_const_macros.extend(exports.const_macros.iter().map(|(name, def)| (name.clone(), def.clone())));
             }
 
-            label_info.local_labels.extend(exported_labels.clone());
-            macro_info.local_macros.extend(exported_macros.clone());
-            macro_info.local_const_macros.extend(exported_const_macros.clone());
+            label_info.local_labels.extend(exports.labels.iter().map(|(name, label)| (name.clone(), label.clone())));
+            macro_info.local_macros.extend(exports.macros.iter().map(|(name, def)| (name.clone(), def.clone())));
+            macro_info.local_const_macros.extend(exports.const_macros.iter().map(|(name, def)| (name.clone(), def.clone())));
 
         },
 
@@ -732,7 +1328,7 @@ fn parse_line(trimmed_line: &str, macro_info: &mut MacroInfo, asm_unit: &Assembl
             // Encode the string data into byte code
             let encoded_data: ByteCode = data_type.encode(data_string, line_number, line, asm_unit.path);
 
-            let label_declaration = LabelDeclaration::new(program_info.byte_code.len(), asm_unit.path.to_path_buf());
+            let label_declaration = LabelDeclaration::new(program_info.byte_code.len(), asm_unit.shared_path.clone());
 
             // Add the data name and its address in the binary to the data map
             label_info.local_labels.insert(label.to_string(), label_declaration.clone());
@@ -743,6 +1339,7 @@ fn parse_line(trimmed_line: &str, macro_info: &mut MacroInfo, asm_unit: &Assembl
 
             // Add the data to the byte code
             program_info.byte_code.extend(encoded_data);
+            program_info.last_instruction = None;
 
         },
 
@@ -786,7 +1383,7 @@ fn parse_line(trimmed_line: &str, macro_info: &mut MacroInfo, asm_unit: &Assembl
                 error::invalid_bss_declaration(asm_unit.path, line_number, line, "Static BSS declarations cannot have anything after the data type");
             }
 
-            let label_declaration = LabelDeclaration::new(program_info.byte_code.len(), asm_unit.path.to_path_buf());
+            let label_declaration = LabelDeclaration::new(program_info.byte_code.len(), asm_unit.shared_path.clone());
 
             // Add the data name and its address in the binary to the data map
             label_info.local_labels.insert(label.to_string(), label_declaration.clone());
@@ -798,6 +1395,7 @@ fn parse_line(trimmed_line: &str, macro_info: &mut MacroInfo, asm_unit: &Assembl
             // Add a data placeholder to the byte code
             // Doesn't take advantage of the .bss section optimization, though
             program_info.byte_code.extend(vec![0; data_size]);
+            program_info.last_instruction = None;
 
         },
 
@@ -823,7 +1421,7 @@ fn parse_line(trimmed_line: &str, macro_info: &mut MacroInfo, asm_unit: &Assembl
                     error::invalid_label_name(asm_unit.path, label, line_number, line, format!("\"{}\" is a reserved name.", label).as_str());
                 }
 
-                let label_declaration = LabelDeclaration::new(program_info.byte_code.len(), asm_unit.path.to_path_buf());
+                let label_declaration = LabelDeclaration::new(program_info.byte_code.len(), asm_unit.shared_path.clone());
 
                 if asm_unit.is_main_unit && label == "start" || to_export {
                     label_info.export_labels.insert(label.to_string(), label_declaration.clone());
@@ -833,6 +1431,9 @@ fn parse_line(trimmed_line: &str, macro_info: &mut MacroInfo, asm_unit: &Assembl
                     error::label_redeclaration(asm_unit.path, label, line_number, line);
                 }
 
+                // The next instruction may be jumped to, so it cannot be fused with the previous one
+                program_info.last_instruction = None;
+
                 return;
             }
 
@@ -881,12 +1482,12 @@ fn parse_line(trimmed_line: &str, macro_info: &mut MacroInfo, asm_unit: &Assembl
                         error::invalid_macro_declaration(asm_unit.path, macro_name, line_number, line, "Constant macros must have a replacement text value");
                     }
 
-                    let macro_declaration = ConstMacroDefinition::new(
+                    let macro_declaration = Arc::new(ConstMacroDefinition::new(
                         macro_name.to_string(), 
                         replace.to_string(), 
                         asm_unit.path.to_path_buf(), 
                         line_number
-                    );
+                    ));
                     
                     // Const macros can be redeclared
                     macro_info.local_const_macros.insert(macro_name.to_string(), macro_declaration.clone());
@@ -966,28 +1567,23 @@ fn parse_line(trimmed_line: &str, macro_info: &mut MacroInfo, asm_unit: &Assembl
                     error::invalid_macro_call(asm_unit.path, line_number, line, format!("Macro \"{}\" ({}, {}) expects {} arguments, but {} were given.", macro_name, def.unit_path.display(), def.line_number, def.args.len(), macro_args.len()).as_str());
                 }
 
-                // Replace the macro argument placeholders in the macro body with the macro call arguments
-                let mut mlines: Vec<String> = def.body.clone();
-                for mline in mlines.iter_mut() {
-                
-                    // Not very efficient, but works
-                    for (i, arg) in def.args.iter().enumerate() {
-                        *mline = mline.replace(format!("{{{}}}", arg).as_str(), macro_args[i]);
-                    }
-
-                }
+                // The body lines are parsed while the definition is borrowed, and parsing a line may declare other macros
+                let def = Arc::clone(def);
 
                 // Parse the macro body
-                for mline in mlines {
+                for body_line in &def.body {
+
+                    // Replace the macro argument placeholders in the macro body with the macro call arguments
+                    let mline = def.expand_line(body_line, &macro_args);
 
                     if verbose {
                         println!("Macro {: >3}, Pos: {: >5} | {}", line_number, program_info.byte_code.len(), mline);
                     }
 
                     // Evaluate the compile-time special symbols that were not evaluated before
-                    let mline = evaluate_special_symbols(mline.as_str(), program_info.byte_code.len(), line_number, asm_unit.path, &macro_info.local_const_macros);
+                    let mline = evaluate_special_symbols(&mline, program_info.byte_code.len(), line_number, asm_unit.path, &macro_info.local_const_macros, unit_info);
 
-                    parse_line(&mline, macro_info, asm_unit, line, line_number, program_info, label_info, section_info, verbose);
+                    parse_line(&mline, macro_info, asm_unit, line, line_number, program_info, label_info, section_info, unit_info, verbose);
 
                 }
 
@@ -996,7 +1592,7 @@ fn parse_line(trimmed_line: &str, macro_info: &mut MacroInfo, asm_unit: &Assembl
 
 
             // The line doesn't contain label declarations, macros, or special operators, so it's an instruction
-            assemble_instruction(asm_unit, trimmed_line, line, line_number, &mut program_info.byte_code, &mut label_info.label_references);
+            assemble_instruction(asm_unit, trimmed_line, line, line_number, &mut program_info.byte_code, &mut program_info.last_instruction, &mut program_info.instructions, &mut label_info.label_references);
 
         },
 
@@ -1059,7 +1655,8 @@ fn handle_pseudo_instruction(pi: PseudoInstruction, asm_unit: &AssemblyUnit, arg
 
 
 /// Assemble an instruction into byte code
-fn assemble_instruction(asm_unit: &AssemblyUnit, trimmed_line: &str, line: &str, line_number: usize, byte_code: &mut ByteCode, label_reference_registry: &mut LabelReferenceRegistry) {
+#[allow(clippy::too_many_arguments)]
+fn assemble_instruction(asm_unit: &AssemblyUnit, trimmed_line: &str, line: &str, line_number: usize, byte_code: &mut ByteCode, last_instruction: &mut Option<EmittedInstruction>, instructions: &mut Vec<Address>, label_reference_registry: &mut LabelReferenceRegistry) {
 
     // Split the operator from its arguments
     let (operator_name, raw_tokens): (&str, &str) = trimmed_line.split_once(char::is_whitespace).unwrap_or((
@@ -1070,6 +1667,7 @@ fn assemble_instruction(asm_unit: &AssemblyUnit, trimmed_line: &str, line: &str,
     // Check for pseudo instructions
     if let Some(pi) = get_pseudo_instruction(operator_name) {
         handle_pseudo_instruction(pi, asm_unit, raw_tokens.trim_start(), line, line_number, byte_code);
+        *last_instruction = None;
         return;
     }
 
@@ -1083,25 +1681,119 @@ fn assemble_instruction(asm_unit: &AssemblyUnit, trimmed_line: &str, line: &str,
 
     let operation = arg_table.get_operation(operator_name, &operands, asm_unit.path, line_number, line);
 
-    // Add the instruction code to the byte code
-    byte_code.push(operation.instruction as u8);
+    let superinstruction = last_instruction.and_then(
+        |last| get_superinstruction(last.instruction, operation.instruction).map(|fused| (last, fused))
+    );
+
+    let mut omit_handled_size = false;
+
+    if let Some((last, fused)) = superinstruction {
+        // Fuse the instruction with the previous one by replacing the previous opcode with the superinstruction.
+        // The operands of this instruction follow the operands of the previous one
+        byte_code[last.address] = fused as u8;
+
+        if let Some(condition) = JumpCondition::from_jump(operation.instruction) {
+            byte_code.push(condition as u8);
+        }
+
+        *last_instruction = Some(EmittedInstruction { instruction: fused, address: last.address });
+
+    } else {
+        // Encode the handled size in the opcode if the instruction has a size-specialized variant
+        let instruction = match operation.instruction.sized_variant(operation.handled_size) {
+            Some(specialized) => {
+                omit_handled_size = true;
+                specialized
+            },
+            None => operation.instruction
+        };
+
+        *last_instruction = Some(EmittedInstruction { instruction, address: byte_code.len() });
+        instructions.push(byte_code.len());
 
-    // Add the operands to the byte code
-    let operand_bytes = generate_operand_bytecode(operation.instruction, operands, operation.handled_size, label_reference_registry, byte_code.len(), line_number, asm_unit.path, line);
+        // Add the instruction code to the byte code
+        byte_code.push(instruction as u8);
+    }
+
+    // Add the operands to the byte code.
+    // If the handled size is omitted, the operands are generated as if the handled size byte was at the opcode's address, so that label references still point to the right bytes
+    let operands_address = byte_code.len() - omit_handled_size as usize;
+    let operand_bytes = generate_operand_bytecode(operation.instruction, operands, operation.handled_size, label_reference_registry, operands_address, line_number, asm_unit.path, line);
     
     if operand_bytes.len() != operation.total_arg_size as usize {
         panic!("The generated operand byte code size {} for instruction \"{}\" does not match the expected size {}. This is a bug.", operand_bytes.len(), operation.instruction, operation.total_arg_size);
     }
 
-    byte_code.extend(operand_bytes);
+    byte_code.extend(&operand_bytes[omit_handled_size as usize..]);
+
+}
+
+
+/// How to assemble a program
+#[derive(Debug, Clone)]
+pub struct AssemblerOptions {
+
+    pub verbose: bool,
+    /// Only check the assembly for errors, then exit
+    pub just_check: bool,
+    /// Where the units of the standard library are looked up
+    pub include_lib_path: PathBuf,
+    /// Where to link the included units from their cached objects when they didn't change, and cache the objects of the other included units.
+    /// The main unit is always assembled. `None` disables the cache
+    pub cache_dir: Option<PathBuf>,
+    /// Run the peephole optimizer on the byte code of the program
+    pub optimize: bool,
+
+}
+
+
+impl Default for AssemblerOptions {
+
+    /// The standard library of the environment and no cache
+    fn default() -> Self {
+        Self {
+            verbose: false,
+            just_check: false,
+            include_lib_path: configs::INCLUDE_LIB_PATH.clone(),
+            cache_dir: None,
+            optimize: false,
+        }
+    }
 
 }
 
 
 /// Assembles the assembly code into byte code
-pub fn assemble(assembly: AssemblyCode, verbose: bool, unit_path: &Path, just_check: bool) -> ByteCode {
+/// Assemble the main assembly unit and its dependencies.
+/// 
+/// Return the byte code and the labels exported by all the assembly units
+pub fn assemble(assembly: AssemblyCode, unit_path: &Path, options: AssemblerOptions) -> (ByteCode, LabelMap) {
+    let threads = thread::available_parallelism().map_or(1, |threads| threads.get());
+    assemble_with_threads(assembly, unit_path, options, threads)
+}
+
+
+/// Assemble the program using at most `threads` threads for the included units
+fn assemble_with_threads(assembly: AssemblyCode, unit_path: &Path, options: AssemblerOptions, threads: usize) -> (ByteCode, LabelMap) {
 
-    let mut program_info = ProgramInfo::new();
+    let AssemblerOptions { verbose, just_check, include_lib_path, cache_dir, optimize } = options;
+
+    let cache_dir = cache_dir.filter(|cache_dir| match object::open_cache_dir(cache_dir) {
+        Ok(()) => true,
+        Err(err) => {
+            error::warn(format!("The assembly cache \"{}\" is not used: {}", cache_dir.display(), err).as_str());
+            false
+        }
+    });
+
+    let mut program_info = ProgramInfo::new(include_lib_path, cache_dir);
+
+    // Most of the work is in the included units, so the ones that don't depend on each other are assembled in parallel first.
+    // The serial pass then links their objects in inclusion order, so the byte code is the same as if they were assembled serially.
+    // The verbose output of parallel units would be interleaved, so the verbose mode only assembles serially
+    if threads > 1 && !verbose {
+        assemble_includes_in_parallel(unit_path, &assembly, threads, &mut program_info);
+    }
 
     let asm_unit = AssemblyUnit::new(unit_path, assembly, true);
 
@@ -1113,27 +1805,71 @@ pub fn assemble(assembly: AssemblyCode, verbose: bool, unit_path: &Path, just_ch
         std::process::exit(0);
     }
 
-    // Append the exit instruction to the end of the binary
-    program_info.byte_code.push(ByteCodes::EXIT as u8);
-
-    // Append the address of the program start to the end of the binary
-
-    let (label_map, _macro_map, _const_macro_map) = program_info.included_units.get(unit_path).unwrap_or_else(
+    let main_exports = program_info.included_units.get(unit_path).unwrap_or_else(
         || panic!("Internal assembler error: main assembly unit not found in included units map. This is a bug.")
     );
 
-    let program_start = label_map.get("start").unwrap_or_else(
-        || error::undeclared_label(unit_path, "start", label_map, 0, "The program must have a start label.")
-    );
+    let mut program_start = main_exports.labels.get("start").unwrap_or_else(
+        || error::undeclared_label(unit_path, "start", &main_exports.labels, 0, "The program must have a start label.")
+    ).address;
+
+    // Different units may export labels with the same name, so the units are merged in a fixed order for the labels to be the same on every run
+    let mut included_units: Vec<(PathBuf, Arc<UnitExports>)> = program_info.included_units.into_iter().collect();
+    included_units.sort_unstable_by(|(a, _), (b, _)| a.cmp(b));
+
+    let mut exported_labels: LabelMap = included_units.into_iter().flat_map(
+        |(_, exports)| Arc::unwrap_or_clone(exports).labels
+    ).collect();
+
+    if optimize {
+        if program_info.uses_current_address {
+            // The addresses computed from `$` can't be told apart from other numbers, so they couldn't be moved
+            error::warn("The peephole optimizer was skipped because the program uses the current address `$`.");
+        } else {
+            // The exported labels may be used to enter the program without a label reference, for example by the symbol table
+            let entry_points: Vec<Address> = exported_labels.values().map(|label| label.address).collect();
+
+            match peephole::optimize(&mut program_info.byte_code, &mut program_info.instructions, &mut program_info.relocations, &entry_points) {
+
+                Some((address_map, report)) => {
+                    program_start = address_map.map(program_start);
+                    for label in exported_labels.values_mut() {
+                        label.address = address_map.map(label.address);
+                    }
+                    println!("Peephole optimizer removed {} instructions ({} bytes) and retargeted {} jumps", report.removed_instructions, report.removed_bytes, report.retargeted_jumps);
+                },
+
+                None => error::warn("The peephole optimizer was skipped because the byte code holds addresses that can't be moved.")
+            }
+        }
+    }
+
+    // Append the exit instruction to the end of the binary
+    program_info.byte_code.push(ByteCodes::EXIT as u8);
 
-    program_info.byte_code.extend(program_start.address.to_le_bytes());
+    // Append the address of the program start to the end of the binary
+    program_info.byte_code.extend(program_start.to_le_bytes());
 
     if verbose {
         println!("Byte code size is {} bytes", program_info.byte_code.len());
-        println!("Start address is {}", program_start.address);
+        println!("Start address is {}", program_start);
     }
 
-    program_info.byte_code
+    (program_info.byte_code, exported_labels)
+}
+
+
+/// Build the symbol table of the given labels.
+/// If more than one label is declared at the same address, the first one in alphabetical order is used
+pub fn symbol_table(labels: &LabelMap) -> SymbolTable {
+    let mut names: Vec<(&String, &LabelDeclaration)> = labels.iter().collect();
+    names.sort_unstable_by_key(|(name, _)| *name);
+
+    let mut symbols = SymbolTable::new();
+    for (name, declaration) in names {
+        symbols.entry(declaration.address).or_insert_with(|| name.clone());
+    }
+    symbols
 }
 
 
@@ -1269,15 +2005,241 @@ impl<'a> Iterator for MacroArgIterator<'a> {
 }
 
 
-static mut LAST_UNIQUE_SYMBOL_INDEX: usize = 0;
+#[cfg(test)]
+mod tests {
+
+    use super::*;
 
-/// Genetate a unique symbol name
-fn get_unique_symbol_name() -> String {
-    let symbol_name: String;
-    unsafe {
-        symbol_name = format!("__unique_symbol_{}", LAST_UNIQUE_SYMBOL_INDEX);
-        LAST_UNIQUE_SYMBOL_INDEX += 1;
+
+    /// Assemble a program without includes and return the byte code and the exported labels
+    fn assemble_source(name: &str, source: &str) -> (ByteCode, LabelMap) {
+        let path = std::env::temp_dir().join(format!("rusty_vm_assembler_test_{}_{}.asm", std::process::id(), name));
+        std::fs::write(&path, source).unwrap();
+        let assembly = files::load_assembly(&path).unwrap();
+        let result = assemble(assembly, &path, AssemblerOptions::default());
+        std::fs::remove_file(&path).ok();
+        result
     }
-    symbol_name
-}
 
+
+    fn read_address(byte_code: &[u8], address: Address) -> Address {
+        Address::from_le_bytes(byte_code[address..address + ADDRESS_SIZE].try_into().unwrap())
+    }
+
+
+    #[test]
+    fn test_superinstruction_labels() {
+        let (byte_code, labels) = assemble_source("superinstruction_labels", "
+.text:
+
+@start
+    cmp8 r1 5
+    jmpz done
+
+@@second
+    cmp8 r1 6
+@@between
+    jmpz done
+
+@@third
+    cmp r1 r2
+    jmplt second
+
+@@done
+    mov8 r2 1
+");
+        let label = |name: &str| labels[name].address;
+        let opcode = |address: Address| byte_code[address];
+        let generic_opcode = |address: Address| ByteCodes::from(byte_code[address]).generic_variant() as u8;
+
+        // The fused jump is followed by its condition and its target at the end of the superinstruction
+        assert_eq!(label("start"), 0);
+        assert_eq!(opcode(0), ByteCodes::COMPARE_JUMP_REG_CONST as u8);
+        assert_eq!(byte_code[label("second") - ADDRESS_SIZE - 1], JumpCondition::Zero as u8);
+        assert_eq!(read_address(&byte_code, label("second") - ADDRESS_SIZE), label("done"));
+
+        // The label between the compare and the jump blocks the fusion
+        assert_eq!(generic_opcode(label("second")), ByteCodes::COMPARE_REG_CONST as u8);
+        assert_eq!(opcode(label("between")), ByteCodes::JUMP_ZERO as u8);
+        assert_eq!(label("third"), label("between") + 1 + ADDRESS_SIZE);
+        assert_eq!(read_address(&byte_code, label("between") + 1), label("done"));
+
+        assert_eq!(opcode(label("third")), ByteCodes::COMPARE_JUMP_REG_REG as u8);
+        assert_eq!(byte_code[label("done") - ADDRESS_SIZE - 1], JumpCondition::Less as u8);
+        assert_eq!(read_address(&byte_code, label("done") - ADDRESS_SIZE), label("second"));
+
+        assert_eq!(generic_opcode(label("done")), ByteCodes::MOVE_INTO_REG_FROM_CONST as u8);
+    }
+
+
+    #[test]
+    fn test_sized_moves() {
+        // Every memory move form, with its generic opcode and its size without the handled size byte
+        let forms = |size: usize| [
+            ("mov{} r1 [r2]", ByteCodes::MOVE_INTO_REG_FROM_ADDR_IN_REG, 3),
+            ("mov{} r1 [slot]", ByteCodes::MOVE_INTO_REG_FROM_ADDR_LITERAL, 2 + ADDRESS_SIZE),
+            ("mov{} [r2] r1", ByteCodes::MOVE_INTO_ADDR_IN_REG_FROM_REG, 3),
+            ("mov{} [r2] 5", ByteCodes::MOVE_INTO_ADDR_IN_REG_FROM_CONST, 2 + size),
+            ("mov{} [slot] r1", ByteCodes::MOVE_INTO_ADDR_LITERAL_FROM_REG, 2 + ADDRESS_SIZE),
+            ("mov{} [slot] 5", ByteCodes::MOVE_INTO_ADDR_LITERAL_FROM_CONST, 1 + ADDRESS_SIZE + size),
+        ];
+
+        let mut source = String::from(".bss:\n\n    @@slot u8\n\n.text:\n\n@start\n");
+        for size in [1, 2, 4, 8] {
+            for (i, (form, _, _)) in forms(size).iter().enumerate() {
+                source.push_str(&format!("@@move_{}_{}\n    {}\n", size, i, form.replace("{}", &size.to_string())));
+            }
+        }
+        source.push_str("@@end\n");
+
+        let (byte_code, labels) = assemble_source("sized_moves", &source);
+        let label = |name: &str| labels[name].address;
+
+        let mut next = label("start");
+        for size in [1, 2, 4, 8] {
+            for (i, &(_, generic, instruction_size)) in forms(size).iter().enumerate() {
+                let address = label(&format!("move_{}_{}", size, i));
+                assert_eq!(address, next);
+                assert_eq!(byte_code[address], generic.sized_variant(size as u8).unwrap() as u8);
+                next = address + instruction_size;
+            }
+        }
+        assert_eq!(label("end"), next);
+
+        // Label references follow the opcode directly
+        let literal_load = label("move_4_1");
+        assert_eq!(read_address(&byte_code, literal_load + 2), label("slot"));
+        let literal_store = label("move_4_5");
+        assert_eq!(read_address(&byte_code, literal_store + 1), label("slot"));
+    }
+
+
+    #[test]
+    fn test_expand_macro_line() {
+        let definition = MacroDefinition::new("load".to_string(), vec!["reg".to_string(), "value".to_string()], Vec::new(), PathBuf::new(), 0, false);
+        let expand = |line| definition.expand_line(line, &["r2", "5"]);
+
+        assert!(matches!(expand("    inc r1"), Cow::Borrowed("    inc r1")));
+        assert!(matches!(expand("{other} {reg"), Cow::Borrowed("{other} {reg")));
+        assert_eq!(expand("mov8 {reg} {value}"), "mov8 r2 5");
+        assert_eq!(expand("{reg}{value}{reg}"), "r25r2");
+        assert_eq!(expand("{other} {reg} {value"), "{other} r2 {value");
+        // A brace that doesn't open a placeholder may be followed by one
+        assert_eq!(expand("{{value}}"), "{5}");
+    }
+
+
+    #[test]
+    fn test_evaluate_special_symbols() {
+        let path = Path::new("special_symbols.asm");
+        let mut unit_info = UnitInfo::new(path, 0);
+        let mut const_macros = ConstMacroMap::new();
+        const_macros.insert("SIZE".to_string(), Arc::new(ConstMacroDefinition {
+            name: "SIZE".to_string(),
+            replace: "8".to_string(),
+            unit_path: path.to_path_buf(),
+            line_number: 1,
+        }));
+
+        // Lines without special symbols are borrowed, up to the comment
+        assert!(matches!(evaluate_special_symbols("    mov1 r1 2", 42, 2, path, &const_macros, &mut unit_info), Cow::Borrowed("    mov1 r1 2")));
+        assert!(matches!(evaluate_special_symbols("    mov1 r1 2 # = $ &", 42, 2, path, &const_macros, &mut unit_info), Cow::Borrowed("    mov1 r1 2 ")));
+        assert!(matches!(evaluate_special_symbols("    mov8 r1 =OTHER", 42, 2, path, &const_macros, &mut unit_info), Cow::Borrowed("    mov8 r1 =OTHER")));
+        assert!(unit_info.own_code_start.is_some() && !unit_info.uses_current_address);
+
+        assert_eq!(evaluate_special_symbols("    mov8 r1 =SIZE", 42, 2, path, &const_macros, &mut unit_info), "    mov8 r1 8");
+        assert_eq!(evaluate_special_symbols("    mov8 r1 =SIZE # r1 = 8", 42, 2, path, &const_macros, &mut unit_info), "    mov8 r1 8 ");
+        assert_eq!(evaluate_special_symbols("    mov8 =SIZE =OTHER", 42, 2, path, &const_macros, &mut unit_info), "    mov8 8 =OTHER");
+        // Const macros are found by byte index after multibyte characters
+        assert_eq!(evaluate_special_symbols("    \"é\" 'è' =SIZE", 42, 2, path, &const_macros, &mut unit_info), "    \"é\" 'è' 8");
+        assert_eq!(evaluate_special_symbols("    \"=SIZE $ \\\" #\" =SIZE", 42, 2, path, &const_macros, &mut unit_info), "    \"=SIZE $ \\\" #\" 8");
+        assert!(unit_info.own_code_start.is_some() && !unit_info.uses_current_address);
+
+        assert_eq!(evaluate_special_symbols("    jmp $ '$'", 42, 2, path, &const_macros, &mut unit_info), "    jmp 42 '$'");
+        assert!(unit_info.own_code_start.is_none() && unit_info.uses_current_address);
+
+        // Unique symbols only depend on the unit and on how many were generated before
+        let mut other_unit_info = UnitInfo::new(path, 0);
+        assert_eq!(evaluate_special_symbols("@&", 42, 2, path, &const_macros, &mut other_unit_info), format!("@__unique_symbol_{:x}_0", object::hash_path(path)));
+        assert_eq!(evaluate_special_symbols("    jmp &", 42, 2, path, &const_macros, &mut other_unit_info), format!("    jmp __unique_symbol_{:x}_1", object::hash_path(path)));
+    }
+
+
+    #[test]
+    fn test_macros_assemble_as_expanded() {
+        let (macro_byte_code, macro_labels) = assemble_source("macros", "
+.text:
+
+    %%- COUNT: 3
+    %%- STEP: 2
+
+    %% load_next reg value:
+        # Load a constant and bump it
+        mov8 {reg} {value}
+        inc {reg}
+        mov r8 {reg}
+    %endmacro
+
+@start
+    mov8 r1 =COUNT # Set the counter
+    !load_next r1 =STEP
+    !load_next r2 7
+@@end
+    mov8 r3 $
+");
+        let (expanded_byte_code, expanded_labels) = assemble_source("expanded", "
+.text:
+
+@start
+    mov8 r1 3
+    mov8 r1 2
+    inc r1
+    mov r8 r1
+    mov8 r2 7
+    inc r2
+    mov r8 r2
+@@end
+    mov8 r3 $
+");
+
+        assert_eq!(macro_labels["end"].address, expanded_labels["end"].address);
+        assert!(macro_byte_code == expanded_byte_code, "The byte code of the macros differs from the expanded one");
+    }
+
+
+    #[test]
+    fn test_parallel_assembly() {
+        let path = std::env::temp_dir().join(format!("rusty_vm_assembler_test_{}_parallel_assembly.asm", std::process::id()));
+        std::fs::write(&path, "
+.include:
+
+    stdio.asm
+    string.asm
+    collections.asm
+    math.asm
+    ctype.asm
+
+.text:
+
+@start
+    mov1 r1 0
+").unwrap();
+
+        let include_lib_path = Path::new(env!("CARGO_MANIFEST_DIR")).join("../asm_lib");
+        let options = || AssemblerOptions { include_lib_path: include_lib_path.clone(), ..Default::default() };
+
+        // The includes are independent enough to be assembled into objects by several threads
+        let mut program_info = ProgramInfo::new(include_lib_path.clone(), None);
+        assemble_includes_in_parallel(&path, &files::load_assembly(&path).unwrap(), 4, &mut program_info);
+        assert!(program_info.objects.len() > 1, "{} objects assembled in parallel", program_info.objects.len());
+
+        let (serial_byte_code, serial_labels) = assemble_with_threads(files::load_assembly(&path).unwrap(), &path, options(), 1);
+        let (parallel_byte_code, parallel_labels) = assemble_with_threads(files::load_assembly(&path).unwrap(), &path, options(), 4);
+        std::fs::remove_file(&path).ok();
+
+        assert!(parallel_byte_code == serial_byte_code, "The byte code assembled in parallel differs from the serial one");
+        assert_eq!(symbol_table(&parallel_labels), symbol_table(&serial_labels));
+        assert_eq!(parallel_labels.len(), serial_labels.len());
+    }
+
+}
@@ -20,6 +20,18 @@ pub struct CliParser {
     /// Just check the assembly without writing the byte code to a file
     #[clap(short = 'c', long = "check", action)]
     pub check: bool,
+
+    /// Embed the address of every exported label in the byte code and write it to a symbol file next to it, for the VM profiler
+    #[clap(short = 's', long = "symbols", action)]
+    pub symbols: bool,
+
+    /// Assemble every included unit instead of linking the unchanged ones from their cached objects
+    #[clap(long = "no-cache", action)]
+    pub no_cache: bool,
+
+    /// Run the peephole optimizer, which removes the instructions that have no effect and shortens the jumps to jumps
+    #[clap(short = 'O', action)]
+    pub optimize: bool,
     
 }
 
@@ -13,5 +13,17 @@ lazy_static! {
         }
     };
 
+    /// Directory where the objects of the assembled units are cached. An empty `RUSTYVM_ASM_CACHE` disables the cache.
+    /// By default it's in the cache directory of the user, `$XDG_CACHE_HOME` or `~/.cache`, so that other users can't write to it
+    pub static ref ASM_CACHE_PATH: Option<PathBuf> = {
+        match env::var("RUSTYVM_ASM_CACHE") {
+            Ok(path) if path.is_empty() => None,
+            Ok(path) => Some(PathBuf::from_str(&path).unwrap()),
+            Err(_) => env::var_os("XDG_CACHE_HOME").map(PathBuf::from).filter(|path| path.is_absolute())
+                .or_else(|| env::var_os("HOME").map(|home| PathBuf::from(home).join(".cache")))
+                .map(|cache_home| cache_home.join("rusty_vm")),
+        }
+    };
+
 }
 
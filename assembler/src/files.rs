@@ -2,6 +2,8 @@ use std::fs;
 use std::path::Path;
 use std::io;
 use rusty_vm_lib::assembly::{AssemblyCode, ByteCode};
+use rusty_vm_lib::executable::Executable;
+use rusty_vm_lib::symbols::{self, SymbolTable};
 
 
 pub fn load_assembly(file_path: &Path) -> io::Result<AssemblyCode> {
@@ -22,11 +24,21 @@ fn generate_output_name(input_name: &Path) -> String {
 }
 
 
-pub fn save_byte_code(byte_code: ByteCode, input_file: &Path) -> io::Result<String> {
+/// Save the byte code generated by the assembler as an executable file, with the given symbol table if any
+pub fn save_byte_code(byte_code: ByteCode, input_file: &Path, symbols: Option<&SymbolTable>) -> io::Result<String> {
 
     let output_name = generate_output_name(input_file);
 
-    fs::write(&output_name, byte_code)?;
+    let mut executable = Executable::from_image(&byte_code).map_err(
+        |message| io::Error::new(io::ErrorKind::InvalidData, message)
+    )?;
+
+    let encoded_symbols = symbols.map(symbols::encode_symbols);
+    if let Some(encoded_symbols) = &encoded_symbols {
+        executable.add_symbols(encoded_symbols);
+    }
+
+    fs::write(&output_name, executable.encode())?;
     
     Ok(output_name)
 }
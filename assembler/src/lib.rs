@@ -0,0 +1,10 @@
+pub mod assembler;
+pub mod object;
+mod peephole;
+pub mod files;
+mod token_to_byte_code;
+mod tokenizer;
+mod argmuments_table;
+pub mod error;
+mod data_types;
+pub mod configs;
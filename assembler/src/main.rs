@@ -1,16 +1,13 @@
-mod assembler;
-mod files;
-mod token_to_byte_code;
-mod tokenizer;
-mod argmuments_table;
-mod error;
-mod data_types;
-mod configs;
 mod cli_parser;
 
 use std::path::Path;
 use clap::Parser;
 
+use rusty_vm_lib::symbols;
+
+use ::assembler::{assembler, configs, error, files};
+use ::assembler::assembler::AssemblerOptions;
+
 use crate::cli_parser::CliParser;
 
 
@@ -39,15 +36,25 @@ fn main() {
 
     };
 
-    let byte_code = assembler::assemble(assembly, args.verbose, &main_path, args.check);
+    let options = AssemblerOptions {
+        verbose: args.verbose,
+        just_check: args.check,
+        include_lib_path: configs::INCLUDE_LIB_PATH.clone(),
+        cache_dir: configs::ASM_CACHE_PATH.clone().filter(|_| !args.no_cache),
+        optimize: args.optimize,
+    };
+
+    let (byte_code, labels) = assembler::assemble(assembly, &main_path, options);
+
+    let symbol_table = args.symbols.then(|| assembler::symbol_table(&labels));
     
-    if let Some(output_raw) = &args.output {
+    let output_file = if let Some(output_raw) = &args.output {
 
         let output_path = Path::new(output_raw);
 
-        match files::save_byte_code(byte_code, output_path) {
+        let output_file = match files::save_byte_code(byte_code, output_path, symbol_table.as_ref()) {
 
-            Ok(_) => {}
+            Ok(output_file) => output_file,
 
             Err(error) => {
                 error::io_error(phantom_path, &error, format!("Failed to save byte code to \"{}\"", output_path.display()).as_str());
@@ -59,8 +66,10 @@ fn main() {
             println!("\n\nAssembly code saved to {}", output_path.display());
         }
 
+        output_file
+
     } else {
-        let output_file = match files::save_byte_code(byte_code, &main_path) {
+        let output_file = match files::save_byte_code(byte_code, &main_path, symbol_table.as_ref()) {
 
             Ok(output_file) => output_file,
 
@@ -74,7 +83,20 @@ fn main() {
             println!("\n\nAssembly code saved to {}", output_file);
         }
 
+        output_file
     };
+
+    if let Some(symbol_table) = &symbol_table {
+
+        let symbol_path = symbols::symbol_file_path(Path::new(&output_file));
+
+        if let Err(error) = symbols::save_symbols(symbol_table, &symbol_path) {
+            error::io_error(phantom_path, &error, format!("Failed to save symbols to \"{}\"", symbol_path.display()).as_str());
+        }
+
+        if args.verbose {
+            println!("Symbols saved to {}", symbol_path.display());
+        }
+    }
     
 }
-
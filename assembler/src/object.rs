@@ -0,0 +1,470 @@
+//! Relocatable objects of assembled units, cached on disk so that units that didn't change aren't assembled again.
+//!
+//! An object holds the byte code emitted by the unit itself, assembled as if the unit started at address 0,
+//! the places in the byte code where label addresses must be patched when the unit is placed in a program,
+//! and the labels, macros and const macros the unit exports.
+//! An object is valid as long as the unit source and the objects of its includes don't change,
+//! and only for the assembler build that created it.
+//!
+//! Whoever can write to the cache decides the byte code of the programs that link its objects,
+//! so the cache directory must be private to the current user
+
+use std::fs::{self, DirBuilder};
+use std::io;
+use std::os::unix::fs::{DirBuilderExt, MetadataExt};
+use std::path::{Path, PathBuf};
+use std::sync::Arc;
+
+use lazy_static::lazy_static;
+
+use rusty_vm_lib::assembly::{AssemblyCode, ByteCode};
+use rusty_vm_lib::byte_code::{ByteCodes, BYTE_CODE_COUNT};
+use rusty_vm_lib::vm::Address;
+
+use crate::assembler::{ConstMacroDefinition, MacroDefinition};
+
+
+/// Identifies the object files
+const OBJECT_MAGIC: &[u8; 4] = b"RVMO";
+
+/// Changes whenever the object format or the byte code generation changes, so that old objects are assembled again
+const OBJECT_VERSION: u64 = 3;
+
+const OBJECT_EXTENSION: &str = "obj";
+
+
+const FNV_OFFSET_BASIS: u64 = 0xcbf29ce484222325;
+const FNV_PRIME: u64 = 0x100000001b3;
+
+
+/// Hash the bytes with the 64-bit FNV-1a function, continuing from `hash`.
+/// Unlike the hasher of the standard library, the result is stable across builds, so it can be stored
+fn hash_bytes(mut hash: u64, bytes: &[u8]) -> u64 {
+    for &byte in bytes {
+        hash ^= byte as u64;
+        hash = hash.wrapping_mul(FNV_PRIME);
+    }
+    hash
+}
+
+
+lazy_static! {
+
+    /// Hash of what the generated byte code depends on besides the source: the assembler version, the opcodes,
+    /// and the assembler binary itself, since the operand encodings may change without touching the opcodes.
+    /// Objects created by another build, which may share the cache directory, are never linked
+    static ref BUILD_HASH: u64 = {
+        let mut hash = hash_bytes(FNV_OFFSET_BASIS, env!("CARGO_PKG_VERSION").as_bytes());
+        for opcode in 0..BYTE_CODE_COUNT {
+            hash = hash_bytes(hash, ByteCodes::from(opcode as u8).name().as_bytes());
+        }
+        if let Ok(metadata) = std::env::current_exe().and_then(fs::metadata) {
+            hash = hash_bytes(hash, &metadata.len().to_le_bytes());
+            if let Ok(modified) = metadata.modified().map(|time| time.duration_since(std::time::UNIX_EPOCH).unwrap_or_default()) {
+                hash = hash_bytes(hash, &modified.as_nanos().to_le_bytes());
+            }
+        }
+        hash
+    };
+
+}
+
+
+/// Hash the path of a unit. Used to tell the units apart
+pub fn hash_path(path: &Path) -> u64 {
+    hash_bytes(FNV_OFFSET_BASIS, path.to_string_lossy().as_bytes())
+}
+
+
+/// Hash the path and the source of a unit, along with the assembler build
+pub fn hash_source(path: &Path, assembly: &[String]) -> u64 {
+    let mut hash = hash_bytes(FNV_OFFSET_BASIS, &OBJECT_VERSION.to_le_bytes());
+    hash = hash_bytes(hash, &BUILD_HASH.to_le_bytes());
+    hash = hash_bytes(hash, path.to_string_lossy().as_bytes());
+    for line in assembly {
+        hash = hash_bytes(hash, line.as_bytes());
+        hash = hash_bytes(hash, b"\n");
+    }
+    hash
+}
+
+
+/// Return the key of a unit, which changes if the unit source or any of its includes change
+pub fn unit_key(source_hash: u64, include_keys: &[u64]) -> u64 {
+    include_keys.iter().fold(source_hash, |hash, key| hash_bytes(hash, &key.to_le_bytes()))
+}
+
+
+/// Where an exported label is declared
+pub enum ExportedLabel {
+
+    /// Declared by the unit, at the given offset from the unit start
+    Local(Address),
+    /// Re-exported from the unit that declared it
+    External(PathBuf),
+
+}
+
+
+/// An assembled unit that can be placed anywhere in a program
+pub struct UnitObject {
+
+    /// Hash of the unit path and source
+    pub source_hash: u64,
+    /// The unit path and source, compared with the unit before linking the object, since the hashes aren't collision resistant
+    pub unit_path: PathBuf,
+    pub source: AssemblyCode,
+    /// The key of the unit, computed from its source hash and the keys of its includes
+    pub key: u64,
+    /// The includes of the unit in inclusion order, as written in its include section
+    pub includes: Vec<String>,
+    /// The byte code emitted by the unit itself, without its includes
+    pub byte_code: ByteCode,
+    /// Offsets in the byte code of the instructions, in ascending order
+    pub instructions: Vec<Address>,
+    /// Offsets in the byte code of the addresses of labels declared by the unit, with the offset of the label
+    pub local_relocations: Vec<(Address, Address)>,
+    /// Offsets in the byte code of the addresses of labels declared by other units, with the unit path and the label name
+    pub external_relocations: Vec<(Address, PathBuf, String)>,
+    pub labels: Vec<(String, ExportedLabel)>,
+    pub macros: Vec<Arc<MacroDefinition>>,
+    pub const_macros: Vec<Arc<ConstMacroDefinition>>,
+
+}
+
+
+impl UnitObject {
+
+    fn encode(&self) -> Vec<u8> {
+
+        let mut encoder = Encoder { bytes: OBJECT_MAGIC.to_vec() };
+
+        encoder.u64(OBJECT_VERSION);
+        encoder.u64(self.source_hash);
+        encoder.u64(self.key);
+
+        encoder.path(&self.unit_path);
+        encoder.u64(self.source.len() as u64);
+        for line in &self.source {
+            encoder.str(line);
+        }
+
+        encoder.u64(self.includes.len() as u64);
+        for include in &self.includes {
+            encoder.str(include);
+        }
+
+        encoder.bytes(&self.byte_code);
+
+        encoder.u64(self.instructions.len() as u64);
+        for &offset in &self.instructions {
+            encoder.u64(offset as u64);
+        }
+
+        encoder.u64(self.local_relocations.len() as u64);
+        for &(location, offset) in &self.local_relocations {
+            encoder.u64(location as u64);
+            encoder.u64(offset as u64);
+        }
+
+        encoder.u64(self.external_relocations.len() as u64);
+        for (location, unit_path, name) in &self.external_relocations {
+            encoder.u64(*location as u64);
+            encoder.path(unit_path);
+            encoder.str(name);
+        }
+
+        encoder.u64(self.labels.len() as u64);
+        for (name, label) in &self.labels {
+            encoder.str(name);
+            match label {
+                ExportedLabel::Local(offset) => {
+                    encoder.u64(0);
+                    encoder.u64(*offset as u64);
+                },
+                ExportedLabel::External(unit_path) => {
+                    encoder.u64(1);
+                    encoder.path(unit_path);
+                }
+            }
+        }
+
+        encoder.u64(self.macros.len() as u64);
+        for definition in &self.macros {
+            encoder.str(&definition.name);
+            encoder.u64(definition.args.len() as u64);
+            for arg in &definition.args {
+                encoder.str(arg);
+            }
+            encoder.u64(definition.body.len() as u64);
+            for line in &definition.body {
+                encoder.str(line);
+            }
+            encoder.path(&definition.unit_path);
+            encoder.u64(definition.line_number as u64);
+        }
+
+        encoder.u64(self.const_macros.len() as u64);
+        for definition in &self.const_macros {
+            encoder.str(&definition.name);
+            encoder.str(&definition.replace);
+            encoder.path(&definition.unit_path);
+            encoder.u64(definition.line_number as u64);
+        }
+
+        encoder.bytes
+    }
+
+
+    fn decode(bytes: &[u8]) -> Option<UnitObject> {
+
+        let mut decoder = Decoder { bytes: bytes.strip_prefix(OBJECT_MAGIC)? };
+
+        if decoder.u64()? != OBJECT_VERSION {
+            return None;
+        }
+
+        let source_hash = decoder.u64()?;
+        let key = decoder.u64()?;
+
+        let unit_path = decoder.path()?;
+        let source = (0..decoder.u64()?).map(|_| decoder.string()).collect::<Option<_>>()?;
+
+        let includes = (0..decoder.u64()?).map(|_| decoder.string()).collect::<Option<_>>()?;
+
+        let byte_code = decoder.bytes()?.to_vec();
+
+        let instructions = (0..decoder.u64()?).map(|_| decoder.usize()).collect::<Option<_>>()?;
+
+        let local_relocations = (0..decoder.u64()?).map(
+            |_| Some((decoder.usize()?, decoder.usize()?))
+        ).collect::<Option<_>>()?;
+
+        let external_relocations = (0..decoder.u64()?).map(
+            |_| Some((decoder.usize()?, decoder.path()?, decoder.string()?))
+        ).collect::<Option<_>>()?;
+
+        let labels = (0..decoder.u64()?).map(|_| {
+            let name = decoder.string()?;
+            let label = match decoder.u64()? {
+                0 => ExportedLabel::Local(decoder.usize()?),
+                1 => ExportedLabel::External(decoder.path()?),
+                _ => return None
+            };
+            Some((name, label))
+        }).collect::<Option<_>>()?;
+
+        let macros = (0..decoder.u64()?).map(|_| {
+            let name = decoder.string()?;
+            let args = (0..decoder.u64()?).map(|_| decoder.string()).collect::<Option<_>>()?;
+            let body = (0..decoder.u64()?).map(|_| decoder.string()).collect::<Option<_>>()?;
+            let unit_path = decoder.path()?;
+            let line_number = decoder.usize()?;
+            Some(Arc::new(MacroDefinition::new(name, args, body, unit_path, line_number, true)))
+        }).collect::<Option<_>>()?;
+
+        let const_macros = (0..decoder.u64()?).map(|_| {
+            Some(Arc::new(ConstMacroDefinition::new(decoder.string()?, decoder.string()?, decoder.path()?, decoder.usize()?)))
+        }).collect::<Option<_>>()?;
+
+        if !decoder.bytes.is_empty() {
+            return None;
+        }
+
+        Some(UnitObject {
+            source_hash,
+            key,
+            unit_path,
+            source,
+            includes,
+            byte_code,
+            instructions,
+            local_relocations,
+            external_relocations,
+            labels,
+            macros,
+            const_macros,
+        })
+    }
+
+}
+
+
+fn object_path(cache_dir: &Path, unit_path: &Path) -> PathBuf {
+    cache_dir.join(format!("{:016x}", hash_path(unit_path))).with_extension(OBJECT_EXTENSION)
+}
+
+
+/// Create the cache directory if it doesn't exist, accessible only by the current user.
+/// Refuse a directory that is owned by another user or that other users can write to
+pub fn open_cache_dir(cache_dir: &Path) -> io::Result<()> {
+
+    DirBuilder::new().recursive(true).mode(0o700).create(cache_dir)?;
+
+    // The directory itself is checked, not what a symbolic link points to
+    let metadata = fs::symlink_metadata(cache_dir)?;
+
+    if !metadata.is_dir() {
+        return Err(io::Error::new(io::ErrorKind::Other, "not a directory"));
+    }
+    if metadata.uid() != unsafe { libc::geteuid() } {
+        return Err(io::Error::new(io::ErrorKind::PermissionDenied, "the directory is owned by another user"));
+    }
+    if metadata.mode() & 0o022 != 0 {
+        return Err(io::Error::new(io::ErrorKind::PermissionDenied, "other users can write to the directory"));
+    }
+
+    Ok(())
+}
+
+
+/// Load the cached object of the given unit, if there is a readable one
+pub fn load_object(cache_dir: &Path, unit_path: &Path) -> Option<UnitObject> {
+    UnitObject::decode(&fs::read(object_path(cache_dir, unit_path)).ok()?)
+}
+
+
+/// Store the object of the given unit in the cache, replacing the previous one. The cache directory must have been opened with `open_cache_dir`
+pub fn save_object(cache_dir: &Path, unit_path: &Path, object: &UnitObject) -> io::Result<()> {
+
+    // Write to a temporary file first, so that concurrent assemblers never read a partial object
+    let path = object_path(cache_dir, unit_path);
+    let temp_path = path.with_extension(format!("{}.tmp", std::process::id()));
+    fs::write(&temp_path, object.encode())?;
+    fs::rename(&temp_path, &path)
+}
+
+
+struct Encoder {
+
+    bytes: Vec<u8>,
+
+}
+
+
+impl Encoder {
+
+    fn u64(&mut self, value: u64) {
+        self.bytes.extend(value.to_le_bytes());
+    }
+
+    fn bytes(&mut self, bytes: &[u8]) {
+        self.u64(bytes.len() as u64);
+        self.bytes.extend(bytes);
+    }
+
+    fn str(&mut self, string: &str) {
+        self.bytes(string.as_bytes());
+    }
+
+    fn path(&mut self, path: &Path) {
+        self.str(&path.to_string_lossy());
+    }
+
+}
+
+
+struct Decoder<'a> {
+
+    bytes: &'a [u8],
+
+}
+
+
+impl<'a> Decoder<'a> {
+
+    fn take(&mut self, size: usize) -> Option<&'a [u8]> {
+        if size > self.bytes.len() {
+            return None;
+        }
+        let (taken, rest) = self.bytes.split_at(size);
+        self.bytes = rest;
+        Some(taken)
+    }
+
+    fn u64(&mut self) -> Option<u64> {
+        Some(u64::from_le_bytes(self.take(8)?.try_into().unwrap()))
+    }
+
+    fn usize(&mut self) -> Option<usize> {
+        self.u64()?.try_into().ok()
+    }
+
+    fn bytes(&mut self) -> Option<&'a [u8]> {
+        let size = self.usize()?;
+        self.take(size)
+    }
+
+    fn string(&mut self) -> Option<String> {
+        String::from_utf8(self.bytes()?.to_vec()).ok()
+    }
+
+    fn path(&mut self) -> Option<PathBuf> {
+        self.string().map(PathBuf::from)
+    }
+
+}
+
+
+#[cfg(test)]
+mod tests {
+
+    use super::*;
+
+
+    #[test]
+    fn test_object_round_trip() {
+
+        let object = UnitObject {
+            source_hash: 1,
+            key: 2,
+            unit_path: PathBuf::from("/lib/c.asm"),
+            source: vec![".text:".to_string(), "".to_string(), "@@ c".to_string()],
+            includes: vec!["archlib.asm".to_string()],
+            byte_code: vec![1, 2, 3, 0, 0, 0, 0, 0, 0, 0, 0],
+            instructions: vec![0, 2],
+            local_relocations: vec![(3, 1)],
+            external_relocations: vec![(3, PathBuf::from("/lib/a.asm"), "a".to_string())],
+            labels: vec![("b".to_string(), ExportedLabel::Local(1)), ("a".to_string(), ExportedLabel::External(PathBuf::from("/lib/a.asm")))],
+            macros: vec![Arc::new(MacroDefinition::new("m".to_string(), vec!["x".to_string()], vec!["mov8 r1 {x}".to_string()], PathBuf::from("/lib/b.asm"), 4, true))],
+            const_macros: vec![Arc::new(ConstMacroDefinition::new("C".to_string(), "7".to_string(), PathBuf::from("/lib/b.asm"), 5))],
+        };
+
+        let encoded = object.encode();
+        let decoded = UnitObject::decode(&encoded).unwrap();
+
+        assert_eq!(decoded.encode(), encoded);
+        assert_eq!(decoded.macros[0].body, object.macros[0].body);
+        assert_eq!(decoded.source, object.source);
+        assert!(matches!(decoded.labels[1].1, ExportedLabel::External(ref path) if path == Path::new("/lib/a.asm")));
+
+        // Truncated objects are rejected
+        assert!(UnitObject::decode(&encoded[..encoded.len() - 1]).is_none());
+        assert!(UnitObject::decode(b"RVMO").is_none());
+    }
+
+
+    #[test]
+    fn test_open_cache_dir() {
+        use std::os::unix::fs::PermissionsExt;
+
+        let root = std::env::temp_dir().join(format!("rusty_vm_assembler_test_{}_cache", std::process::id()));
+        let cache_dir = root.join("rusty_vm");
+
+        open_cache_dir(&cache_dir).unwrap();
+        assert_eq!(fs::metadata(&cache_dir).unwrap().mode() & 0o777, 0o700);
+
+        // Other users could plant objects in the directory
+        fs::set_permissions(&cache_dir, fs::Permissions::from_mode(0o777)).unwrap();
+        assert!(open_cache_dir(&cache_dir).is_err());
+
+        // A link is refused even if it points to a private directory
+        fs::set_permissions(&cache_dir, fs::Permissions::from_mode(0o700)).unwrap();
+        let link = root.join("link");
+        std::os::unix::fs::symlink(&cache_dir, &link).unwrap();
+        assert!(open_cache_dir(&link).is_err());
+
+        fs::remove_dir_all(&root).unwrap();
+    }
+
+}
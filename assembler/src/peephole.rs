@@ -0,0 +1,473 @@
+//! Peephole optimizer that runs on the byte code of the whole program, after the label addresses are resolved.
+//!
+//! The optimizer removes instructions that have no effect and retargets the jumps that land on an unconditional jump.
+//! Since removing instructions moves the code after them, it needs to know where every instruction starts
+//! and where every label address is stored in the byte code, so that the addresses can be moved too.
+//! The bytes between instructions are data and are never touched
+
+use std::collections::HashSet;
+
+use rusty_vm_lib::assembly::ByteCode;
+use rusty_vm_lib::byte_code::{is_jump_instruction, ByteCodes, OperandKind, BYTE_CODE_COUNT};
+use rusty_vm_lib::registers::{Registers, GENERAL_PURPOSE_REGISTER_COUNT, REGISTER_COUNT, REGISTER_ID_SIZE};
+use rusty_vm_lib::vm::{Address, ADDRESS_SIZE};
+
+
+/// What the optimizer did to the program
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+pub struct PeepholeReport {
+
+    pub removed_instructions: usize,
+    pub removed_bytes: usize,
+    pub retargeted_jumps: usize,
+
+}
+
+
+/// Maps the addresses of the byte code before the optimization to the addresses after it
+pub struct AddressMap {
+
+    /// Addresses of the removed instructions, in ascending order
+    removed_starts: Vec<Address>,
+    /// Bytes removed up to and including each removed instruction
+    removed_bytes: Vec<usize>,
+
+}
+
+
+impl AddressMap {
+
+    /// Return the new address of the given address.
+    /// The address of a removed instruction maps to the address of the code that follows it
+    pub fn map(&self, address: Address) -> Address {
+        let removed_before = self.removed_starts.partition_point(|&start| start < address);
+        match removed_before {
+            0 => address,
+            n => address - self.removed_bytes[n - 1]
+        }
+    }
+
+}
+
+
+/// A decoded instruction of the program
+struct Instruction {
+
+    address: Address,
+    size: usize,
+    opcode: ByteCodes,
+    handled_size: u8,
+    /// Ids of the registers the instruction names, including the registers that hold an address
+    registers: [Option<u8>; 2],
+    constants: [Option<u64>; 2],
+    /// Offsets from the instruction address of the address literals
+    addresses: Vec<usize>,
+    /// Offset from the instruction address of the jump target, if the instruction jumps
+    target: Option<usize>,
+
+}
+
+
+impl Instruction {
+
+    fn decode(byte_code: &[u8], address: Address) -> Option<Instruction> {
+
+        let opcode = *byte_code.get(address)?;
+        if opcode as usize >= BYTE_CODE_COUNT {
+            return None;
+        }
+        let opcode = ByteCodes::from(opcode);
+        let layout = opcode.operand_layout();
+
+        let mut offset = 1;
+
+        let handled_size = if layout.sized {
+            offset += 1;
+            *byte_code.get(address + 1)?
+        } else if let Some((_, size)) = opcode.fixed_size() {
+            size
+        } else {
+            0
+        };
+
+        let mut registers = [None; 2];
+        let mut constants = [None; 2];
+        let mut addresses = Vec::new();
+
+        for (i, kind) in layout.operands.iter().enumerate() {
+            match kind {
+
+                OperandKind::None => {},
+
+                OperandKind::Register => {
+                    let id = *byte_code.get(address + offset)?;
+                    if id as usize >= REGISTER_COUNT {
+                        return None;
+                    }
+                    registers[i] = Some(id);
+                    offset += REGISTER_ID_SIZE;
+                },
+
+                OperandKind::Constant => {
+                    // Interrupt codes are the only constants without a handled size and are 1 byte long
+                    let size = if handled_size != 0 { handled_size as usize } else { 1 };
+                    if size > 8 {
+                        return None;
+                    }
+                    let mut bytes = [0; 8];
+                    bytes[..size].copy_from_slice(byte_code.get(address + offset..address + offset + size)?);
+                    constants[i] = Some(u64::from_le_bytes(bytes));
+                    offset += size;
+                },
+
+                OperandKind::Address => {
+                    addresses.push(offset);
+                    offset += ADDRESS_SIZE;
+                },
+            }
+        }
+
+        if layout.condition {
+            offset += 1;
+        }
+
+        let target = if layout.target {
+            addresses.push(offset);
+            offset += ADDRESS_SIZE;
+            Some(offset - ADDRESS_SIZE)
+        } else if is_jump_instruction(opcode) {
+            // The jump instructions take their target as first operand, except for the return, which has none
+            addresses.first().copied()
+        } else {
+            None
+        };
+
+        if address + offset > byte_code.len() {
+            return None;
+        }
+
+        Some(Instruction {
+            address,
+            size: offset,
+            opcode,
+            handled_size,
+            registers,
+            constants,
+            addresses,
+            target,
+        })
+    }
+
+
+    fn end(&self) -> Address {
+        self.address + self.size
+    }
+
+
+    fn names_register(&self, register: u8) -> bool {
+        self.registers.contains(&Some(register))
+    }
+
+
+    /// Return whether the instruction only changes general purpose registers and flags, without touching memory or jumping
+    fn only_changes_registers(&self) -> bool {
+        matches!(self.opcode,
+            ByteCodes::MOVE_INTO_REG_FROM_REG |
+            ByteCodes::MOVE_INTO_REG_FROM_CONST |
+            ByteCodes::COMPARE_REG_REG |
+            ByteCodes::COMPARE_REG_CONST |
+            ByteCodes::COMPARE_CONST_REG |
+            ByteCodes::COMPARE_CONST_CONST |
+            ByteCodes::INC_REG |
+            ByteCodes::DEC_REG |
+            ByteCodes::NO_OPERATION
+        ) && !self.names_register(Registers::STACK_TOP_POINTER as u8)
+          && !self.names_register(Registers::PROGRAM_COUNTER as u8)
+    }
+
+}
+
+
+fn read_address(byte_code: &[u8], location: Address) -> Address {
+    Address::from_le_bytes(byte_code[location..location + ADDRESS_SIZE].try_into().unwrap())
+}
+
+
+fn write_address(byte_code: &mut [u8], location: Address, address: Address) {
+    byte_code[location..location + ADDRESS_SIZE].copy_from_slice(&address.to_le_bytes());
+}
+
+
+/// The addresses the program may jump to: the label addresses stored in the byte code and the entry points
+fn jump_targets(byte_code: &[u8], relocations: &[Address], entry_points: &[Address]) -> HashSet<Address> {
+    relocations.iter()
+        .map(|&location| read_address(byte_code, location))
+        .chain(entry_points.iter().copied())
+        .collect()
+}
+
+
+/// Optimize the byte code of the program in place.
+///
+/// `instructions` holds the addresses of the instructions in ascending order, `relocations` the locations of the label addresses
+/// and `entry_points` the addresses that can be reached without a label reference, like the exported labels.
+/// Both `instructions` and `relocations` are updated for the optimized byte code.
+///
+/// Return the map from the old addresses to the new ones and what was done,
+/// or `None` if the byte code doesn't match the instructions or holds addresses that can't be moved, in which case nothing is changed
+pub fn optimize(byte_code: &mut ByteCode, instructions: &mut Vec<Address>, relocations: &mut Vec<Address>, entry_points: &[Address]) -> Option<(AddressMap, PeepholeReport)> {
+
+    let mut decoded = Vec::with_capacity(instructions.len());
+    for (i, &address) in instructions.iter().enumerate() {
+        let instruction = Instruction::decode(byte_code, address)?;
+        // The next instruction, or the data after this one, can't overlap it
+        if instructions.get(i + 1).is_some_and(|&next| instruction.end() > next) {
+            return None;
+        }
+        decoded.push(instruction);
+    }
+
+    let relocated: HashSet<Address> = relocations.iter().copied().collect();
+    if relocated.iter().any(|&location| location + ADDRESS_SIZE > byte_code.len()) {
+        return None;
+    }
+
+    // An address literal that isn't a label reference but points into the program couldn't be moved
+    let fixed_address = decoded.iter().flat_map(
+        |instruction| instruction.addresses.iter().map(move |offset| instruction.address + offset)
+    ).find(|location| !relocated.contains(location) && read_address(byte_code, *location) < byte_code.len());
+    if fixed_address.is_some() {
+        return None;
+    }
+
+    let index_at = |address: Address| instructions.binary_search(&address).ok();
+
+    let mut report = PeepholeReport::default();
+
+    // Jumps that land on an unconditional jump go straight to its target.
+    // The visited set stops at jump cycles, which would otherwise be followed forever
+    for i in 0..decoded.len() {
+        let Some(location) = decoded[i].target.map(|offset| decoded[i].address + offset).filter(|location| relocated.contains(location)) else {
+            continue;
+        };
+
+        let original_target = read_address(byte_code, location);
+        let mut target = original_target;
+        let mut visited = HashSet::from([decoded[i].address]);
+
+        while let Some(next) = index_at(target).map(|index| &decoded[index]) {
+            if !matches!(next.opcode, ByteCodes::JUMP) || !visited.insert(target) {
+                break;
+            }
+            let next_location = next.address + next.target.unwrap();
+            if !relocated.contains(&next_location) {
+                break;
+            }
+            target = read_address(byte_code, next_location);
+        }
+
+        if target != original_target {
+            write_address(byte_code, location, target);
+            report.retargeted_jumps += 1;
+        }
+    }
+
+    let targets = jump_targets(byte_code, relocations, entry_points);
+
+    let mut removed = vec![false; decoded.len()];
+
+    // Removing a save and restore pair may make the enclosing pair removable, so repeat until nothing changes
+    let mut changed = true;
+    while changed {
+        changed = false;
+
+        for i in 0..decoded.len() {
+            if removed[i] {
+                continue;
+            }
+            let instruction = &decoded[i];
+
+            let no_effect = match instruction.opcode {
+
+                // Copying the program counter into itself would repeat the instruction
+                ByteCodes::MOVE_INTO_REG_FROM_REG
+                    => instruction.registers[0] == instruction.registers[1] && !instruction.names_register(Registers::PROGRAM_COUNTER as u8),
+
+                ByteCodes::PUSH_STACK_POINTER_CONST |
+                ByteCodes::POP_STACK_POINTER_CONST
+                    => instruction.constants[0] == Some(0),
+
+                // A jump to the next instruction
+                ByteCodes::JUMP => {
+                    let location = instruction.address + instruction.target.unwrap();
+                    relocated.contains(&location) && read_address(byte_code, location) == instruction.end()
+                },
+
+                _ => false
+            };
+
+            if no_effect {
+                removed[i] = true;
+                changed = true;
+                continue;
+            }
+
+            if let Some(restore) = find_restore(&decoded, &removed, &targets, i) {
+                removed[i] = true;
+                removed[restore] = true;
+                changed = true;
+            }
+        }
+    }
+
+    // Move the kept code over the removed instructions
+
+    let mut map = AddressMap { removed_starts: Vec::new(), removed_bytes: Vec::new() };
+    let mut optimized = ByteCode::with_capacity(byte_code.len());
+    let mut copied_up_to = 0;
+
+    for (instruction, _) in decoded.iter().zip(&removed).filter(|(_, &removed)| removed) {
+        optimized.extend(&byte_code[copied_up_to..instruction.address]);
+        copied_up_to = instruction.end();
+
+        report.removed_instructions += 1;
+        report.removed_bytes += instruction.size;
+        map.removed_starts.push(instruction.address);
+        map.removed_bytes.push(report.removed_bytes);
+    }
+    optimized.extend(&byte_code[copied_up_to..]);
+
+    // The label addresses stored in the removed instructions are dropped with them
+    let removed_ranges: Vec<(Address, Address)> = decoded.iter().zip(&removed)
+        .filter(|(_, &removed)| removed)
+        .map(|(instruction, _)| (instruction.address, instruction.end()))
+        .collect();
+    let is_removed = |address: Address| {
+        let i = removed_ranges.partition_point(|&(start, _)| start <= address);
+        i != 0 && address < removed_ranges[i - 1].1
+    };
+
+    relocations.retain(|&location| !is_removed(location));
+    for location in relocations.iter_mut() {
+        let new_location = map.map(*location);
+        write_address(&mut optimized, new_location, map.map(read_address(byte_code, *location)));
+        *location = new_location;
+    }
+
+    let mut kept = removed.iter();
+    instructions.retain(|_| !kept.next().unwrap());
+    for address in instructions.iter_mut() {
+        *address = map.map(*address);
+    }
+
+    *byte_code = optimized;
+
+    Some((map, report))
+}
+
+
+/// If the instruction at `push` saves a register that is restored later without being used in between, return the index of the restore.
+///
+/// The instructions in between must only change other registers, and no jump can land after the save,
+/// or the restore would pop a value that wasn't pushed
+fn find_restore(decoded: &[Instruction], removed: &[bool], targets: &HashSet<Address>, push: usize) -> Option<usize> {
+
+    let save = &decoded[push];
+    if !matches!(save.opcode, ByteCodes::PUSH_FROM_REG) {
+        return None;
+    }
+    let register = save.registers[0]?;
+
+    // Moving the stack pointer or the program counter through the stack changes them
+    if register == Registers::STACK_TOP_POINTER as u8 || register == Registers::PROGRAM_COUNTER as u8 {
+        return None;
+    }
+
+    let mut end = save.end();
+
+    for (i, instruction) in decoded.iter().enumerate().skip(push + 1) {
+
+        // Data in between, or a jump that lands after the save
+        if instruction.address != end || targets.contains(&instruction.address) {
+            return None;
+        }
+        end = instruction.end();
+
+        if removed[i] {
+            continue;
+        }
+
+        if matches!(instruction.opcode, ByteCodes::POP_INTO_REG) && instruction.handled_size == 8 && instruction.registers[0] == Some(register) {
+            return Some(i);
+        }
+
+        // The instructions in between may change the flags, so only general purpose registers can be saved around them
+        if !instruction.only_changes_registers() || instruction.names_register(register) || register as usize >= GENERAL_PURPOSE_REGISTER_COUNT {
+            return None;
+        }
+    }
+
+    None
+}
+
+
+#[cfg(test)]
+mod tests {
+
+    use super::*;
+
+
+    fn emit(byte_code: &mut ByteCode, instructions: &mut Vec<Address>, bytes: &[u8]) {
+        instructions.push(byte_code.len());
+        byte_code.extend(bytes);
+    }
+
+
+    #[test]
+    fn test_optimize() {
+
+        let r1 = Registers::R1 as u8;
+        let r2 = Registers::R2 as u8;
+
+        let mut byte_code = ByteCode::new();
+        let mut instructions = Vec::new();
+        let mut relocations = Vec::new();
+
+        // 0: jmp 10, which is a jump to a jump
+        emit(&mut byte_code, &mut instructions, &[ByteCodes::JUMP as u8]);
+        relocations.push(byte_code.len());
+        byte_code.extend(10usize.to_le_bytes());
+        // 9: nop
+        emit(&mut byte_code, &mut instructions, &[ByteCodes::NO_OPERATION as u8]);
+        // 10: jmp 24
+        emit(&mut byte_code, &mut instructions, &[ByteCodes::JUMP as u8]);
+        relocations.push(byte_code.len());
+        byte_code.extend(24usize.to_le_bytes());
+        // 19: push r1, mov r1 r1
+        emit(&mut byte_code, &mut instructions, &[ByteCodes::PUSH_FROM_REG as u8, r1]);
+        emit(&mut byte_code, &mut instructions, &[ByteCodes::MOVE_INTO_REG_FROM_REG as u8, r1, r1]);
+        // 24: pop8 r1, which is a jump target, so the pair must stay
+        emit(&mut byte_code, &mut instructions, &[ByteCodes::POP_INTO_REG as u8, 8, r1]);
+        // 27: push r2, inc r1, pop8 r2
+        emit(&mut byte_code, &mut instructions, &[ByteCodes::PUSH_FROM_REG as u8, r2]);
+        emit(&mut byte_code, &mut instructions, &[ByteCodes::INC_REG as u8, r1]);
+        emit(&mut byte_code, &mut instructions, &[ByteCodes::POP_INTO_REG as u8, 8, r2]);
+        // 34: popsp1 0
+        emit(&mut byte_code, &mut instructions, &[ByteCodes::POP_STACK_POINTER_CONST as u8, 1, 0]);
+        // 37: exit
+        emit(&mut byte_code, &mut instructions, &[ByteCodes::EXIT as u8]);
+
+        let (map, report) = optimize(&mut byte_code, &mut instructions, &mut relocations, &[0]).unwrap();
+
+        assert_eq!(report, PeepholeReport { removed_instructions: 4, removed_bytes: 11, retargeted_jumps: 1 });
+
+        // The first jump skips the second one, which went to the restore
+        assert_eq!(read_address(&byte_code, relocations[0]), 21);
+        assert_eq!(read_address(&byte_code, relocations[1]), 21);
+        assert_eq!(map.map(24), 21);
+        assert_eq!(byte_code[21], ByteCodes::POP_INTO_REG as u8);
+        assert_eq!(&byte_code[24..], &[ByteCodes::INC_REG as u8, r1, ByteCodes::EXIT as u8]);
+        assert_eq!(instructions, vec![0, 9, 10, 19, 21, 24, 26]);
+    }
+
+}
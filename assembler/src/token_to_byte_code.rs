@@ -110,11 +110,24 @@ pub fn generate_operand_bytecode(instruction: ByteCodes, mut operands: Vec<Token
         ByteCodes::SHIFT_LEFT |
         ByteCodes::SHIFT_RIGHT |
         ByteCodes::RETURN |
-        ByteCodes::EXIT
+        ByteCodes::EXIT |
+        ByteCodes::MEMORY_COPY |
+        ByteCodes::MEMORY_SET |
+        ByteCodes::MEMORY_COMPARE |
+        ByteCodes::STRING_LENGTH |
+        ByteCodes::MEMORY_FIND |
+        ByteCodes::FENCE
          => {
             ByteCode::new()
         },
 
+        ByteCodes::ATOMIC_COMPARE_EXCHANGE |
+        ByteCodes::ATOMIC_FETCH_ADD |
+        ByteCodes::ATOMIC_EXCHANGE
+         => {
+            vec![handled_size]
+        },
+
         ByteCodes::INC_REG => {
             extract!(operands[0], Register).to_bytes().to_vec()
         },
@@ -401,6 +414,47 @@ pub fn generate_operand_bytecode(instruction: ByteCodes, mut operands: Vec<Token
         ByteCodes::LABEL => {
             unreachable!()
         },
+
+        // Superinstructions are never parsed from the assembly, they are created by fusing instructions
+        ByteCodes::COMPARE_JUMP_REG_REG |
+        ByteCodes::COMPARE_JUMP_REG_CONST |
+        ByteCodes::COMPARE_JUMP_ADDR_IN_REG_REG |
+        ByteCodes::COMPARE_JUMP_ADDR_IN_REG_CONST |
+        ByteCodes::PUSH_FROM_REG_CALL |
+        ByteCodes::PUSH_FROM_CONST_CALL |
+        ByteCodes::POP_INTO_REG_RETURN
+         => {
+            unreachable!()
+        },
+
+        // Size-specialized instructions are emitted in place of the generic ones, whose operands are generated instead
+        ByteCodes::MOVE_INTO_REG_FROM_ADDR_IN_REG_1 |
+        ByteCodes::MOVE_INTO_REG_FROM_ADDR_IN_REG_2 |
+        ByteCodes::MOVE_INTO_REG_FROM_ADDR_IN_REG_4 |
+        ByteCodes::MOVE_INTO_REG_FROM_ADDR_IN_REG_8 |
+        ByteCodes::MOVE_INTO_REG_FROM_ADDR_LITERAL_1 |
+        ByteCodes::MOVE_INTO_REG_FROM_ADDR_LITERAL_2 |
+        ByteCodes::MOVE_INTO_REG_FROM_ADDR_LITERAL_4 |
+        ByteCodes::MOVE_INTO_REG_FROM_ADDR_LITERAL_8 |
+        ByteCodes::MOVE_INTO_ADDR_IN_REG_FROM_REG_1 |
+        ByteCodes::MOVE_INTO_ADDR_IN_REG_FROM_REG_2 |
+        ByteCodes::MOVE_INTO_ADDR_IN_REG_FROM_REG_4 |
+        ByteCodes::MOVE_INTO_ADDR_IN_REG_FROM_REG_8 |
+        ByteCodes::MOVE_INTO_ADDR_IN_REG_FROM_CONST_1 |
+        ByteCodes::MOVE_INTO_ADDR_IN_REG_FROM_CONST_2 |
+        ByteCodes::MOVE_INTO_ADDR_IN_REG_FROM_CONST_4 |
+        ByteCodes::MOVE_INTO_ADDR_IN_REG_FROM_CONST_8 |
+        ByteCodes::MOVE_INTO_ADDR_LITERAL_FROM_REG_1 |
+        ByteCodes::MOVE_INTO_ADDR_LITERAL_FROM_REG_2 |
+        ByteCodes::MOVE_INTO_ADDR_LITERAL_FROM_REG_4 |
+        ByteCodes::MOVE_INTO_ADDR_LITERAL_FROM_REG_8 |
+        ByteCodes::MOVE_INTO_ADDR_LITERAL_FROM_CONST_1 |
+        ByteCodes::MOVE_INTO_ADDR_LITERAL_FROM_CONST_2 |
+        ByteCodes::MOVE_INTO_ADDR_LITERAL_FROM_CONST_4 |
+        ByteCodes::MOVE_INTO_ADDR_LITERAL_FROM_CONST_8
+         => {
+            unreachable!()
+        },
         
         ByteCodes::JUMP |
         ByteCodes::JUMP_NOT_ZERO |
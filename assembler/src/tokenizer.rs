@@ -111,6 +111,9 @@ pub fn tokenize_operands(operands: &str, line_number: usize, line: &str, unit_pa
     let mut tokens: Vec<Token> = Vec::new();
 
     let mut current_token: Option<Token> = None;
+    // Start of the name being read. Names are sliced from the operands only once they're complete,
+    // so register names are never copied
+    let mut name_start: Option<usize> = None;
 
     let mut escape_char = false;
     let mut string_length: usize = 0;
@@ -122,7 +125,27 @@ pub fn tokenize_operands(operands: &str, line_number: usize, line: &str, unit_pa
 
         // Get the next character
         // chars_iter.next() will fail only at the end of the string
+        let byte_index = operands.len() - chars_iter.as_str().len();
         let c = chars_iter.next().unwrap_or('#');
+
+        if let Some(start) = name_start {
+            if is_identifier_char(c, false) {
+                continue;
+            }
+
+            let name = &operands[start..byte_index];
+
+            // Check if the name is a special reserved name 
+            if let Some(register) = Registers::from_name(name) {
+                tokens.push(Token::new(TokenValue::Register(register)));
+
+            } else {
+                // The name is not special, then it's a label
+                tokens.push(Token::new(TokenValue::Label(name.to_string())));
+            }
+
+            name_start = None;
+        }
         
         if let Some(token) = &mut current_token {
 
@@ -279,25 +302,6 @@ pub fn tokenize_operands(operands: &str, line_number: usize, line: &str, unit_pa
                     continue;
                 },
 
-                TokenValue::Name(name) => {
-                    if is_identifier_char(c, false) {
-                        name.push(c);
-                        continue;
-                    }
-
-                    // Check if the name is a special reserved name 
-
-                    if let Some(register) = Registers::from_name(name) {
-                        tokens.push(Token::new(TokenValue::Register(register)));
-
-                    } else {
-                        // The name is not special, then it's a label
-                        tokens.push(Token::new(TokenValue::Label(mem::take(name))));
-                    }
-                    
-                    current_token = None;
-                }
-                   
                 TokenValue::Number { value, sign, format } => {
 
                     match format {
@@ -422,7 +426,7 @@ pub fn tokenize_operands(operands: &str, line_number: usize, line: &str, unit_pa
 
 
         if is_identifier_char(c, true) {
-            current_token = Some(Token::new(TokenValue::Name(c.to_string())));
+            name_start = Some(byte_index);
             continue;
         }
 
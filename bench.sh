@@ -0,0 +1,6 @@
+#!/bin/bash
+# Run the benchmarks of the VM, the assembler and oxide.
+# The results are also saved to bench_results/<commit>.txt, so that they can be compared across commits.
+
+mkdir -p bench_results
+cargo bench -p vm -p assembler -p oxide $@ 2>&1 | tee bench_results/$(git rev-parse --short HEAD).txt
@@ -1,77 +1,250 @@
-use rust_vm_lib::assembly::{ByteCode, AssemblyCode};
-use rust_vm_lib::byte_code::ByteCodes;
-use crate::disassembly_table::{DISASSEMBLY_TABLE, OPERATOR_DISASSEMBLY_TABLE, Argument};
+use rusty_vm_lib::assembly::AssemblyCode;
+use rusty_vm_lib::byte_code::{format_instruction, ByteCodes, OperandKind, BYTE_CODE_COUNT};
+use rusty_vm_lib::executable::{Executable, SectionKind};
+use rusty_vm_lib::registers::REGISTER_ID_SIZE;
+use rusty_vm_lib::vm::{Address, ADDRESS_SIZE};
+
 use crate::error;
 
 
-pub fn disassemble(byte_code: ByteCode, verbose: bool) -> AssemblyCode {
+fn read_bytes<'a>(byte_code: &'a [u8], offset: usize, size: usize) -> Result<&'a [u8], String> {
+    byte_code.get(offset..offset + size).ok_or_else(|| "The instruction is truncated".to_string())
+}
 
-    let mut assembly = AssemblyCode::new();
 
-    let mut i: usize = 0;
-    while i < byte_code.len() {
+fn read_address(byte_code: &[u8], offset: usize) -> Result<Address, String> {
+    Ok(Address::from_le_bytes(read_bytes(byte_code, offset, ADDRESS_SIZE)?.try_into().unwrap()))
+}
 
-        let start_index = i;
-        let operator = byte_code[start_index];
-        i += 1;
 
-        let (base_name, sizes, args) 
-            = DISASSEMBLY_TABLE.get(operator as usize)
-            .unwrap_or_else(
-                || error::invalid_instruction_code(operator, start_index)
-        );   
+/// Decode the instruction at the start of `byte_code` following the operand layout of its opcode, like the VM does.
+///
+/// Return the formatted instruction and its size in bytes
+fn disassemble_instruction(byte_code: &[u8]) -> Result<(String, usize), String> {
 
-        if verbose {
-            print!("\n{}: {} ({})", start_index, ByteCodes::from(operator), operator);
-        }
-        
-        let mut line = base_name.to_string();
+    let opcode = byte_code[0];
+    if opcode as usize >= BYTE_CODE_COUNT {
+        return Err(format!("Invalid instruction code {}", opcode));
+    }
+    let layout = ByteCodes::from(opcode).operand_layout();
 
-        if let Some(args) = args {
-            // The operator has arguments
+    let mut offset = 1;
 
-            // Need mutable args to update them
-            let mut args: Vec<Argument> = args.to_vec();
+    let handled_size = if layout.sized {
+        offset += 1;
+        read_bytes(byte_code, 1, 1)?[0]
+    } else if let Some((_, size)) = ByteCodes::from(opcode).fixed_size() {
+        size
+    } else {
+        0
+    };
 
-            if let Some(sizes) = sizes {
-                // The operands have a variable size
-                // The first byte is the handled size for sized operands
-                let handled_size = byte_code[i];
-                i += 1;
-                line += &handled_size.to_string();
+    let mut registers = [0; 2];
+    let mut args = [0; 2];
 
-                // Update the arguments with variable sizes
-                for size in sizes {
-                    args[*size as usize].size = handled_size;
-                }
-            }
+    for (i, kind) in layout.operands.iter().enumerate() {
+        match kind {
 
-            // Disassemble the operands
-            for arg in args {
-                let disassembler = match OPERATOR_DISASSEMBLY_TABLE.get(arg.kind as usize) {
-                    Some(disassembler) => disassembler,
-                    None => panic!("Invalid argument type: {}. This is a bug.", arg.kind)
-                };
-                
-                let operand_string = match disassembler(&byte_code[i..i + arg.size as usize]) {
-                    Ok(operand_string) => operand_string,
-                    Err(message) => error::invalid_arguments(&arg, &byte_code[i..i + arg.size as usize], i, &message)
-                };
-                
-                i += arg.size as usize;
-
-                line += &format!(" {}", operand_string);
-            }
+            OperandKind::None => {},
+
+            OperandKind::Register => {
+                registers[i] = read_bytes(byte_code, offset, REGISTER_ID_SIZE)?[0];
+                offset += REGISTER_ID_SIZE;
+            },
 
+            OperandKind::Constant => {
+                // Interrupt codes are the only constants without a handled size and are 1 byte long
+                let size = if handled_size != 0 { handled_size as usize } else { 1 };
+                if size > 8 {
+                    return Err(format!("Invalid handled size {}", handled_size));
+                }
+                let mut bytes = [0; 8];
+                bytes[..size].copy_from_slice(read_bytes(byte_code, offset, size)?);
+                args[i] = u64::from_le_bytes(bytes);
+                offset += size;
+            },
+
+            OperandKind::Address => {
+                args[i] = read_address(byte_code, offset)? as u64;
+                offset += ADDRESS_SIZE;
+            },
         }
+    }
 
-        if verbose {
-            println!(" <= {:?}\n{}\n", &byte_code[start_index..i], line);
+    let mut condition = 0;
+    if layout.condition {
+        condition = read_bytes(byte_code, offset, 1)?[0];
+        offset += 1;
+    }
+
+    let mut target = 0;
+    if layout.target {
+        target = read_address(byte_code, offset)?;
+        offset += ADDRESS_SIZE;
+    }
+
+    Ok((format_instruction(opcode, handled_size, registers, args, condition, target), offset))
+}
+
+
+/// List every instruction in the code sections of the executable with its address.
+///
+/// The sections are laid out in the program image first, so that an instruction can end in the zeros of a following bss section.
+/// Bss sections are listed as a single line, since decoding their zeros would only repeat the same instruction
+pub fn disassemble(executable: &Executable, verbose: bool) -> AssemblyCode {
+
+    let mut image = vec![0; executable.image_size()];
+    let mut sections: Vec<_> = executable.sections.iter()
+        .filter(|section| section.kind != SectionKind::Symbols)
+        .collect();
+    sections.sort_by_key(|section| section.address);
+
+    for section in &sections {
+        image[section.address..section.address + section.data.len()].copy_from_slice(section.data);
+    }
+
+    let mut assembly = AssemblyCode::new();
+    assembly.push(format!("# entry point {:#010x}", executable.entry));
+
+    let mut address: Address = 0;
+    for section in sections {
+
+        let end = section.address + section.size;
+        // The previous instruction may extend into this section
+        address = address.max(section.address);
+
+        if section.kind == SectionKind::Bss {
+            if address < end {
+                assembly.push(format!("{:#010x}: ({} zero bytes)", address, end - address));
+                address = end;
+            }
+            continue;
         }
 
-        assembly.push(line);
+        while address < end {
+
+            let (instruction, size) = disassemble_instruction(&image[address..]).unwrap_or_else(
+                |message| error::invalid_instruction(address, &message)
+            );
+
+            let line = format!("{:#010x}: {}", address, instruction);
+
+            if verbose {
+                println!("{} <= {:?}", line, &image[address..address + size]);
+            }
+
+            assembly.push(line);
+            address += size;
+        }
     }
 
     assembly
 }
 
+
+#[cfg(test)]
+mod tests {
+
+    use std::path::Path;
+
+    use ::assembler::assembler::AssemblerOptions;
+
+    use super::*;
+
+
+    fn assemble(name: &str, program: &str) -> Vec<u8> {
+        let source = std::env::temp_dir().join(format!("rusty_vm_disassembler_test_{}_{}.asm", std::process::id(), name));
+        std::fs::write(&source, program).unwrap();
+        let assembly = ::assembler::files::load_assembly(&source).unwrap();
+        let byte_code = ::assembler::assembler::assemble(assembly, &source, AssemblerOptions {
+            include_lib_path: Path::new(env!("CARGO_MANIFEST_DIR")).join("../asm_lib"),
+            ..Default::default()
+        }).0;
+        std::fs::remove_file(&source).ok();
+        byte_code
+    }
+
+
+    fn disassemble_program(name: &str, program: &str) -> AssemblyCode {
+        let byte_code = assemble(name, program);
+        disassemble(&Executable::load(&byte_code).unwrap(), false)
+    }
+
+
+    #[test]
+    fn test_disassemble_new_opcodes() {
+        let listing = disassemble_program("new_opcodes", "
+.text:
+
+@routine
+
+    pop8 r1
+    ret
+
+@start
+
+    cmp8 r1 r2
+    jmpz routine
+    push8 r1
+    call routine
+    mov4 r1 [r2]
+    mov2 [r2] r1
+    mcpy
+    mset
+    mcmp
+    slen
+    mchr
+    cas4
+    xadd8
+    xchg1
+");
+        assert_eq!(listing, [
+            "# entry point 0x00000003",
+            "0x00000000: POP_INTO_REG_RETURN (8B) r1",
+            "0x00000003: COMPARE_JUMP_REG_REG r1 r2 if Zero -> 0x0",
+            "0x0000000f: PUSH_FROM_REG_CALL r1 -> 0x0",
+            "0x00000019: MOVE_INTO_REG_FROM_ADDR_IN_REG_4 (4B) r1 r2",
+            "0x0000001c: MOVE_INTO_ADDR_IN_REG_FROM_REG_2 (2B) r2 r1",
+            "0x0000001f: MEMORY_COPY",
+            "0x00000020: MEMORY_SET",
+            "0x00000021: MEMORY_COMPARE",
+            "0x00000022: STRING_LENGTH",
+            "0x00000023: MEMORY_FIND",
+            "0x00000024: ATOMIC_COMPARE_EXCHANGE (4B)",
+            "0x00000026: ATOMIC_FETCH_ADD (8B)",
+            "0x00000028: ATOMIC_EXCHANGE (1B)",
+            "0x0000002a: EXIT",
+        ]);
+    }
+
+
+    #[test]
+    fn test_disassemble_executable_sections() {
+        let byte_code = assemble("executable_sections", "
+.text:
+
+@start
+
+    mov8 r1 7
+");
+
+        // Append enough zeros to the image to be stored as a bss section
+        let (image, entry) = byte_code.split_at(byte_code.len() - ADDRESS_SIZE);
+        let mut byte_code = image.to_vec();
+        byte_code.resize(image.len() + 1000, 0);
+        byte_code.extend_from_slice(entry);
+
+        let encoded = Executable::from_image(&byte_code).unwrap().encode();
+        let listing = disassemble(&Executable::load(&encoded).unwrap(), false);
+
+        assert_eq!(listing, [
+            "# entry point 0x00000000",
+            "0x00000000: MOVE_INTO_REG_FROM_CONST (8B) r1 7",
+            "0x0000000b: EXIT",
+            "0x0000000c: (1000 zero bytes)",
+        ]);
+        // The raw image is listed the same way
+        assert_eq!(disassemble(&Executable::load(&byte_code).unwrap(), false), listing);
+    }
+
+}
@@ -1,24 +1,16 @@
-use crate::disassembly_table::Argument;
-
+pub fn invalid_instruction(address: usize, message: &str) -> ! {
+    println!("Invalid instruction at byte {}: {}", address, message);
+    std::process::exit(1);
+}
 
 
-pub fn invalid_instruction_code(code: u8, byte_index: usize) -> ! {
-    println!(
-        "Invalid instruction code: {} at byte {}",
-        code, byte_index
-    );
+pub fn invalid_trace(message: &str) -> ! {
+    println!("Invalid trace file: {}", message);
     std::process::exit(1);
 }
 
 
-pub fn invalid_arguments(expected: &Argument, got: &[u8], byte_index: usize, hint: &str) -> ! {
-    println!(
-        "Invalid arguments for instruction at byte {}. Expected {}, got:
-        {:?}
-        
-        {}",
-        byte_index, expected, got, hint
-    );
+pub fn invalid_executable(message: &str) -> ! {
+    println!("Invalid executable: {}", message);
     std::process::exit(1);
 }
-
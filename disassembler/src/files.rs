@@ -1,8 +1,9 @@
 use std::fs;
-use rust_vm_lib::assembly::{AssemblyCode, ByteCode};
+use rusty_vm_lib::assembly::AssemblyCode;
 
 
-pub fn load_byte_code(file_path: &str) -> ByteCode {
+/// Read a bytecode, executable or trace file
+pub fn load_file(file_path: &str) -> Vec<u8> {
     fs::read(file_path)
         .expect(format!("Failed to read file {}", file_path).as_str())
 }
@@ -1,8 +1,9 @@
 mod files;
 mod disassembler;
-mod disassembly_table;
 mod error;
+mod trace_decoder;
 use clap::Parser;
+use rusty_vm_lib::executable::Executable;
 use std::path::Path;
 
 
@@ -10,7 +11,7 @@ use std::path::Path;
 #[clap(author, version, about)]
 struct Cli {
 
-    /// The input file path to disassemble
+    /// The input file path to disassemble, or the trace file to decode with --trace
     #[clap(value_parser)]
     pub input_file: String,
 
@@ -21,6 +22,10 @@ struct Cli {
     /// Run the disassembler in verbose mode
     #[clap(short, long, action)]
     pub verbose: bool,
+
+    /// Decode an execution trace written by the VM trace mode instead of disassembling bytecode
+    #[clap(short, long, action)]
+    pub trace: bool,
 }
 
 
@@ -33,8 +38,13 @@ fn main() {
 
     let args = Cli::parse();
 
-    let byte_code = files::load_byte_code(&args.input_file);
-    let assembly = disassembler::disassemble(byte_code, args.verbose);
+    let bytes = files::load_file(&args.input_file);
+    let assembly = if args.trace {
+        trace_decoder::decode_trace(&bytes, args.verbose)
+    } else {
+        let executable = Executable::load(&bytes).unwrap_or_else(|message| error::invalid_executable(&message));
+        disassembler::disassemble(&executable, args.verbose)
+    };
 
     if let Some(output) = &args.output {
         files::save_assembly_code(&output, &assembly);
@@ -0,0 +1,29 @@
+use rusty_vm_lib::assembly::AssemblyCode;
+use rusty_vm_lib::trace::{self, TraceRecord, TRACE_HEADER_SIZE, TRACE_RECORD_SIZE};
+
+use crate::error;
+
+
+/// Turn a binary execution trace written by the VM trace mode into a readable listing.
+///
+/// Every instruction is listed with its address, followed by the registers and memory it changed, if recorded
+pub fn decode_trace(bytes: &[u8], verbose: bool) -> AssemblyCode {
+
+    let records = trace::decode_trace(bytes).unwrap_or_else(|message| error::invalid_trace(&message));
+
+    if bytes.len() >= TRACE_HEADER_SIZE && (bytes.len() - TRACE_HEADER_SIZE) % TRACE_RECORD_SIZE != 0 {
+        println!("Warning: the trace ends with a truncated record, which is ignored");
+    }
+
+    let listing: AssemblyCode = records.iter().map(TraceRecord::to_string).collect();
+
+    if verbose {
+        for line in &listing {
+            println!("{}", line);
+        }
+        let instructions = records.iter().filter(|record| matches!(record, TraceRecord::Instruction { .. })).count();
+        println!("\n{} instructions traced", instructions);
+    }
+
+    listing
+}
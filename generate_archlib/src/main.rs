@@ -3,7 +3,7 @@ use std::fs;
 use std::env;
 
 use rusty_vm_lib::assembly::LIBRARY_ENV_VARIABLE;
-use rusty_vm_lib::interrupts::Interrupts;
+use rusty_vm_lib::interrupts::{Interrupts, PerfCounter, PERF_COUNTERS_SIZE};
 use rusty_vm_lib::vm::ErrorCodes;
 
 
@@ -16,6 +16,12 @@ fn exit(message: &str) -> ! {
 }
 
 
+/// Offset of the counter in the buffer filled by the PerfCounters interrupt
+fn perf_offset(counter: PerfCounter) -> usize {
+    counter as usize * std::mem::size_of::<u64>()
+}
+
+
 fn main() {
 
     let library_dir = env::var_os(LIBRARY_ENV_VARIABLE)
@@ -60,6 +66,47 @@ fn main() {
 
     %%- HOST_FS_INTR: {HOST_FS_INTR_CODE}
 
+    %%- MALLOC: {MALLOC_CODE}
+    %%- CALLOC: {CALLOC_CODE}
+    %%- REALLOC: {REALLOC_CODE}
+    %%- FREE: {FREE_CODE}
+    %%- HEAP_STATS: {HEAP_STATS_CODE}
+
+    %%- SNAPSHOT: {SNAPSHOT_CODE}
+
+    %%- THREAD_SPAWN: {THREAD_SPAWN_CODE}
+    %%- THREAD_JOIN: {THREAD_JOIN_CODE}
+    %%- MEMORY_WAIT: {MEMORY_WAIT_CODE}
+    %%- MEMORY_NOTIFY: {MEMORY_NOTIFY_CODE}
+
+    %%- DISK_SUBMIT_READ: {DISK_SUBMIT_READ_CODE}
+    %%- DISK_SUBMIT_WRITE: {DISK_SUBMIT_WRITE_CODE}
+    %%- DISK_POLL: {DISK_POLL_CODE}
+    %%- DISK_WAIT: {DISK_WAIT_CODE}
+
+    %%- TIMER_START: {TIMER_START_CODE}
+    %%- TIMER_CANCEL: {TIMER_CANCEL_CODE}
+    %%- WAIT_EVENTS: {WAIT_EVENTS_CODE}
+
+    %%- PERF_COUNTERS: {PERF_COUNTERS_CODE}
+
+    # Offsets of the counters in the buffer filled by PERF_COUNTERS
+    %%- PERF_INSTRUCTIONS: {PERF_INSTRUCTIONS_OFFSET}
+    %%- PERF_CALLS: {PERF_CALLS_OFFSET}
+    %%- PERF_RETURNS: {PERF_RETURNS_OFFSET}
+    %%- PERF_INTERRUPTS: {PERF_INTERRUPTS_OFFSET}
+    %%- PERF_BULK_MEMORY_BYTES: {PERF_BULK_MEMORY_BYTES_OFFSET}
+    %%- PERF_STORAGE_BYTES_READ: {PERF_STORAGE_BYTES_READ_OFFSET}
+    %%- PERF_STORAGE_BYTES_WRITTEN: {PERF_STORAGE_BYTES_WRITTEN_OFFSET}
+    %%- PERF_HOST_FS_BYTES_READ: {PERF_HOST_FS_BYTES_READ_OFFSET}
+    %%- PERF_HOST_FS_BYTES_WRITTEN: {PERF_HOST_FS_BYTES_WRITTEN_OFFSET}
+    %%- PERF_HEAP_LIVE_BYTES: {PERF_HEAP_LIVE_BYTES_OFFSET}
+    %%- PERF_HEAP_PEAK_BYTES: {PERF_HEAP_PEAK_BYTES_OFFSET}
+    %%- PERF_STORAGE_NANOS: {PERF_STORAGE_NANOS_OFFSET}
+    %%- PERF_HOST_FS_NANOS: {PERF_HOST_FS_NANOS_OFFSET}
+    %%- PERF_TERMINAL_NANOS: {PERF_TERMINAL_NANOS_OFFSET}
+    %%- PERF_COUNTERS_SIZE: {PERF_COUNTERS_SIZE}
+
 
     %%- NO_ERROR: {NO_ERROR_CODE}
     %%- END_OF_FILE: {END_OF_FILE_CODE}
@@ -100,6 +147,39 @@ fn main() {
         SET_TIMER_NANOS_CODE = Interrupts::SetTimerNanos as u8,
         FLUSH_STDOUT_CODE = Interrupts::FlushStdout as u8,
         HOST_FS_INTR_CODE = Interrupts::HostFs as u8,
+        MALLOC_CODE = Interrupts::Malloc as u8,
+        CALLOC_CODE = Interrupts::Calloc as u8,
+        REALLOC_CODE = Interrupts::Realloc as u8,
+        FREE_CODE = Interrupts::Free as u8,
+        HEAP_STATS_CODE = Interrupts::HeapStats as u8,
+        SNAPSHOT_CODE = Interrupts::Snapshot as u8,
+        THREAD_SPAWN_CODE = Interrupts::ThreadSpawn as u8,
+        THREAD_JOIN_CODE = Interrupts::ThreadJoin as u8,
+        MEMORY_WAIT_CODE = Interrupts::MemoryWait as u8,
+        MEMORY_NOTIFY_CODE = Interrupts::MemoryNotify as u8,
+        DISK_SUBMIT_READ_CODE = Interrupts::DiskSubmitRead as u8,
+        DISK_SUBMIT_WRITE_CODE = Interrupts::DiskSubmitWrite as u8,
+        DISK_POLL_CODE = Interrupts::DiskPoll as u8,
+        DISK_WAIT_CODE = Interrupts::DiskWait as u8,
+        TIMER_START_CODE = Interrupts::TimerStart as u8,
+        TIMER_CANCEL_CODE = Interrupts::TimerCancel as u8,
+        WAIT_EVENTS_CODE = Interrupts::WaitEvents as u8,
+        PERF_COUNTERS_CODE = Interrupts::PerfCounters as u8,
+        PERF_INSTRUCTIONS_OFFSET = perf_offset(PerfCounter::Instructions),
+        PERF_CALLS_OFFSET = perf_offset(PerfCounter::Calls),
+        PERF_RETURNS_OFFSET = perf_offset(PerfCounter::Returns),
+        PERF_INTERRUPTS_OFFSET = perf_offset(PerfCounter::Interrupts),
+        PERF_BULK_MEMORY_BYTES_OFFSET = perf_offset(PerfCounter::BulkMemoryBytes),
+        PERF_STORAGE_BYTES_READ_OFFSET = perf_offset(PerfCounter::StorageBytesRead),
+        PERF_STORAGE_BYTES_WRITTEN_OFFSET = perf_offset(PerfCounter::StorageBytesWritten),
+        PERF_HOST_FS_BYTES_READ_OFFSET = perf_offset(PerfCounter::HostFsBytesRead),
+        PERF_HOST_FS_BYTES_WRITTEN_OFFSET = perf_offset(PerfCounter::HostFsBytesWritten),
+        PERF_HEAP_LIVE_BYTES_OFFSET = perf_offset(PerfCounter::HeapLiveBytes),
+        PERF_HEAP_PEAK_BYTES_OFFSET = perf_offset(PerfCounter::HeapPeakBytes),
+        PERF_STORAGE_NANOS_OFFSET = perf_offset(PerfCounter::StorageNanos),
+        PERF_HOST_FS_NANOS_OFFSET = perf_offset(PerfCounter::HostFsNanos),
+        PERF_TERMINAL_NANOS_OFFSET = perf_offset(PerfCounter::TerminalNanos),
+        PERF_COUNTERS_SIZE = PERF_COUNTERS_SIZE,
         NO_ERROR_CODE = ErrorCodes::NoError as u8,
         END_OF_FILE_CODE = ErrorCodes::EndOfFile as u8,
         INVALID_INPUT_CODE = ErrorCodes::InvalidInput as u8,
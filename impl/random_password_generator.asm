@@ -6,7 +6,7 @@
 
     stdio.asm
     stdlib.asm
-    errors.asm
+    archlib.asm
 
 
 .data:
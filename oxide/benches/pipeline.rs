@@ -0,0 +1,117 @@
+//! Throughput benchmarks of the compiler stages.
+//!
+//! Every stage consumes the output of the previous one and libtest has no per-iteration setup,
+//! so each benchmark runs the pipeline up to its stage. The cost of a stage is the difference with the previous benchmark.
+//! Run with `cargo bench -p oxide`.
+
+#![feature(test)]
+
+extern crate test;
+
+use std::fs;
+use std::path::{Path, PathBuf};
+
+use test::{black_box, Bencher};
+
+use rusty_vm_lib::ir::SourceCode;
+
+use oxide::cli_parser::OptimizationFlags;
+use oxide::symbol_table::SymbolTable;
+use oxide::{ast, flow_analyzer, function_parser, irc, tokenizer};
+
+
+/// Number of copies of the sample function in the benchmark source
+const FUNCTION_COPIES: usize = 50;
+
+
+fn source_path() -> PathBuf {
+    Path::new(env!("CARGO_MANIFEST_DIR")).join("impl/history.o2")
+}
+
+
+/// Build a source made of many renamed copies of `impl/history.o2`, which exercises most of the language
+fn load_source() -> SourceCode {
+
+    let sample = fs::read_to_string(source_path()).unwrap();
+
+    let mut source = String::new();
+    for i in 0..FUNCTION_COPIES {
+        source.push_str(&sample.replace("fn big_foo()", &format!("fn big_foo_{}()", i)));
+        source.push('\n');
+    }
+    source.push_str("fn main() {\n}\n");
+
+    source.lines().map(String::from).collect()
+}
+
+
+/// Run the pipeline up to and including the given stage
+fn run_pipeline(source: &SourceCode, path: &Path, last_stage: usize) {
+
+    let optimization_flags = OptimizationFlags::none();
+    let mut symbol_table = SymbolTable::new();
+
+    let tokens = tokenizer::tokenize(source, path, &mut symbol_table);
+    if last_stage == 0 {
+        black_box(tokens);
+        return;
+    }
+
+    let ast = ast::build_ast(tokens, source, &mut symbol_table, false);
+    if last_stage == 1 {
+        black_box(ast);
+        return;
+    }
+
+    let functions = function_parser::parse_functions(ast, &optimization_flags, &mut symbol_table, source, false);
+    if last_stage == 2 {
+        black_box(functions);
+        return;
+    }
+
+    let ir_code = irc::generate(functions, &mut symbol_table, &optimization_flags, false, source);
+    if last_stage == 3 {
+        black_box(ir_code);
+        return;
+    }
+
+    black_box(flow_analyzer::flow_graph(ir_code, &optimization_flags, false));
+}
+
+
+fn bench_stage(b: &mut Bencher, last_stage: usize) {
+    let source = load_source();
+    let path = source_path();
+    b.bytes = source.iter().map(|line| line.len() as u64 + 1).sum();
+    b.iter(|| run_pipeline(&source, &path, last_stage));
+}
+
+
+#[bench]
+fn stage_0_tokenize(b: &mut Bencher) {
+    bench_stage(b, 0);
+}
+
+
+#[bench]
+fn stage_1_build_ast(b: &mut Bencher) {
+    bench_stage(b, 1);
+}
+
+
+#[bench]
+fn stage_2_parse_functions(b: &mut Bencher) {
+    bench_stage(b, 2);
+}
+
+
+#[bench]
+fn stage_3_irc_generate(b: &mut Bencher) {
+    bench_stage(b, 3);
+}
+
+
+#[bench]
+fn stage_4_flow_graph(b: &mut Bencher) {
+    bench_stage(b, 4);
+}
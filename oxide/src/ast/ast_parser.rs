@@ -1,4 +1,4 @@
-use std::rc::Rc;
+use std::sync::Arc;
 
 use rusty_vm_lib::ir::SourceCode;
 
@@ -204,8 +204,11 @@ fn parse_block_hierarchy<'a>(block: UnparsedScopeBlock<'a>, symbol_table: &mut S
             break;
         }
         
+        // The last parsed operation and its priority, from which the search for the next operation resumes
+        let mut previous_op: Option<(*mut TokenParsingNode, TokenPriority)> = None;
+
         #[allow(unused_unsafe)] // A bug in the linter causes the below unsafe block to be marked as unnecessary, but removing it causes a compiler error
-        while let Some(op_node) = find_highest_priority(&mut statement)
+        while let Some(op_node) = find_highest_priority(&mut statement, previous_op)
             .and_then(|node_ptr| unsafe { node_ptr.as_mut() }) // Convert the raw pointer to a mutable reference
         {
 
@@ -213,6 +216,7 @@ fn parse_block_hierarchy<'a>(block: UnparsedScopeBlock<'a>, symbol_table: &mut S
                 // No more operations to parse
                 break;
             }
+            previous_op = Some((op_node as *mut TokenParsingNode, node_priority(op_node)));
             // Set the priority to 0 so that the node is not visited again
             zero_node_priority(op_node);
     
@@ -567,7 +571,7 @@ fn parse_block_hierarchy<'a>(block: UnparsedScopeBlock<'a>, symbol_table: &mut S
                                     |arg| error::invalid_argument(&token.value, arg.source_token(), source, "Invalid data type after assignment operator in type definition.")
                             );
 
-                            let data_type: Rc<DataType> = match_or!(SyntaxNodeValue::DataType(data_type) = definition_node.value, data_type,
+                            let data_type: Arc<DataType> = match_or!(SyntaxNodeValue::DataType(data_type) = definition_node.value, data_type,
                                 error::invalid_argument(&token.value, &definition_node.token, source, "Expected a data type after assignment operator in type definition.")
                             );
         
@@ -633,7 +637,7 @@ fn parse_block_hierarchy<'a>(block: UnparsedScopeBlock<'a>, symbol_table: &mut S
                                 .unwrap_or_else(
                                     |arg| error::invalid_argument(&token.value, arg.source_token(), source, "Invalid data type in static declaration.")
                             );
-                            let data_type: Rc<DataType> = match_or!(SyntaxNodeValue::DataType(data_type) = data_type_node.value, data_type,
+                            let data_type: Arc<DataType> = match_or!(SyntaxNodeValue::DataType(data_type) = data_type_node.value, data_type,
                                 error::invalid_argument(&token.value, &data_type_node.token, source, "Invalid data type in static declaration.")
                             );
         
@@ -711,7 +715,7 @@ fn parse_block_hierarchy<'a>(block: UnparsedScopeBlock<'a>, symbol_table: &mut S
                                     |arg| error::invalid_argument(&token.value, arg.source_token(), source, "Invalid data type in constant declaration.")
                                 );
 
-                            let data_type: Rc<DataType> = match_or!(SyntaxNodeValue::DataType(data_type) = data_type_node.value, data_type,
+                            let data_type: Arc<DataType> = match_or!(SyntaxNodeValue::DataType(data_type) = data_type_node.value, data_type,
                                 error::invalid_argument(&token.value, &data_type_node.token, source, "Invalid data type in constant declaration.")
                             );
         
@@ -880,7 +884,7 @@ fn parse_block_hierarchy<'a>(block: UnparsedScopeBlock<'a>, symbol_table: &mut S
                         TokenKind::Value(Value::Literal { value }) => {
 
                             TokenParsingNodeValue::SyntaxToken(SyntaxNode::new(
-                                SyntaxNodeValue::Literal(value), // TODO: fix this clone with Rc<LiteralValue>
+                                SyntaxNodeValue::Literal(value), // TODO: fix this clone with Arc<LiteralValue>
                                 token.source_token.clone()
                             ))
                         },
@@ -905,7 +909,7 @@ fn parse_block_hierarchy<'a>(block: UnparsedScopeBlock<'a>, symbol_table: &mut S
                             };
         
                             // Default return type is void, unless specified by the arrow ->
-                            let mut return_type = Rc::new(DataType::Void);
+                            let mut return_type = Arc::new(DataType::Void);
             
                             let name_node = unsafe { extract_right!() }.unwrap_or_else(
                                 || error::expected_argument(&token, source, "Missing function name after fn in function declaration.")
@@ -973,7 +977,7 @@ fn parse_block_hierarchy<'a>(block: UnparsedScopeBlock<'a>, symbol_table: &mut S
                                 error::invalid_argument(&token.value, &body_node.token, source, "Expected a function body enclosed in curly braces.");
                             };
                             
-                            let signature: Rc<DataType> = DataType::Function { 
+                            let signature: Arc<DataType> = DataType::Function { 
                                 params: params.iter().map(|param| param.data_type.clone()).collect(), // Take only the data type of the parameter
                                 return_type: return_type.clone() // Here we clone the Rc pointer, not the DataType value
                             }.into();
@@ -1083,7 +1087,7 @@ fn parse_block_hierarchy<'a>(block: UnparsedScopeBlock<'a>, symbol_table: &mut S
                                             .unwrap_or_else(
                                                 |arg| error::invalid_argument(&token.value, arg.source_token(), source, "Invalid data type after colon in function declaration.")
                                             );
-                                        let data_type: Rc<DataType> = match_or!(SyntaxNodeValue::DataType(data_type) = data_type_node.value, data_type,
+                                        let data_type: Arc<DataType> = match_or!(SyntaxNodeValue::DataType(data_type) = data_type_node.value, data_type,
                                             error::invalid_argument(&token.value, &data_type_node.token, source, "Invalid data type in function declaration.")
                                         );
         
@@ -1553,7 +1557,22 @@ fn zero_node_priority(node: &mut TokenParsingNode) {
 
 
 /// Find the token node with the highest priority in the uppermost layer of the tree.
-fn find_highest_priority<'a>(tokens: &mut TokenParsingList<'a>) -> Option<*mut TokenParsingNode<'a>> {
+///
+/// Parsing an operation only removes its operands and lowers priorities, and the parsed operation was the first node with the highest priority.
+/// So, if another node with the same priority is left, it's the first one after the previous operation, which stays in the list as a syntax node.
+/// Resuming from there avoids scanning the whole statement for every operation, which made long statements quadratic to parse
+fn find_highest_priority<'a>(tokens: &mut TokenParsingList<'a>, previous_op: Option<(*mut TokenParsingNode<'a>, TokenPriority)>) -> Option<*mut TokenParsingNode<'a>> {
+
+    if let Some((previous_node, previous_priority)) = previous_op {
+
+        let mut node_ptr = unsafe { (*previous_node).right() };
+        while let Some(node) = unsafe { node_ptr.as_ref() } {
+            if node_priority(node) == previous_priority {
+                return Some(node_ptr);
+            }
+            node_ptr = unsafe { node.right() };
+        }
+    }
 
     let mut highest_priority: Option<&mut TokenParsingNode> = None;
 
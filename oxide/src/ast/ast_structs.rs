@@ -1,5 +1,6 @@
 use std::fmt::Display;
 use std::rc::Rc;
+use std::sync::Arc;
 
 use crate::lang::data_types::{DataType, LiteralValue};
 use crate::symbol_table::{ScopeDiscriminant, ScopeID, SymbolTable};
@@ -47,7 +48,7 @@ impl RuntimeOp<'_> {
 
     /// Assumes the operation is allowed at compile-time.
     /// Assumes the operands are literals.
-    pub fn execute(&self, scope_id: ScopeID, symbol_table: &SymbolTable) -> Result<Rc<LiteralValue>, &'static str> {
+    pub fn execute(&self, scope_id: ScopeID, symbol_table: &SymbolTable) -> Result<Arc<LiteralValue>, &'static str> {
 
         match self {
 
@@ -335,20 +336,20 @@ pub enum SyntaxNodeValue<'a> {
 
     RuntimeOp(RuntimeOp<'a>),
     FunctionParams(Vec<FunctionParam<'a>>),
-    DataType(Rc<DataType>),
-    Function { name: &'a str, signature: Rc<DataType>, body: ScopeBlock<'a>, marked_const: bool },
-    As { target_type: Rc<DataType>, expr: Box<SyntaxNode<'a>> },
+    DataType(Arc<DataType>),
+    Function { name: &'a str, signature: Arc<DataType>, body: ScopeBlock<'a>, marked_const: bool },
+    As { target_type: Arc<DataType>, expr: Box<SyntaxNode<'a>> },
     IfChain { if_blocks: Vec<IfBlock<'a>>, else_block: Option<ScopeBlock<'a>> },
     While { condition: Box<SyntaxNode<'a>>, body: ScopeBlock<'a> },
     Loop { body: ScopeBlock<'a> },
     DoWhile { body: ScopeBlock<'a>, condition: Box<SyntaxNode<'a>> },
     Scope(ScopeBlock<'a>),
     Symbol { name: &'a str, scope_discriminant: ScopeDiscriminant },
-    Literal(Rc<LiteralValue>),
+    Literal(Arc<LiteralValue>),
     
-    Const { name: &'a str, data_type: Rc<DataType>, definition: Box<SyntaxNode<'a>> },
-    Static { name: &'a str, data_type: Rc<DataType>, definition: Box<SyntaxNode<'a>> },
-    TypeDef { name: &'a str, definition: Rc<DataType> },
+    Const { name: &'a str, data_type: Arc<DataType>, definition: Box<SyntaxNode<'a>> },
+    Static { name: &'a str, data_type: Arc<DataType>, definition: Box<SyntaxNode<'a>> },
+    TypeDef { name: &'a str, definition: Arc<DataType> },
 
     /// A placeholder value used to satisfy Rust's no-uninitalized-fields rule
     /// This value should never be used in any other context.
@@ -418,7 +419,7 @@ pub struct SyntaxNode<'a> {
     pub token: Rc<SourceToken<'a>>,
 
     /// The data type this node evaluates to
-    pub data_type: Rc<DataType>,
+    pub data_type: Arc<DataType>,
 
     /// Whether the node may have side effects.
     /// If this is false, then the node is guaranteed to not have side effects.
@@ -432,7 +433,7 @@ impl<'a> SyntaxNode<'a> {
     pub fn new(value: SyntaxNodeValue<'a>, token: Rc<SourceToken<'a>>) -> SyntaxNode<'a> {
         Self {
             value,
-            data_type: Rc::new(DataType::Unspecified),
+            data_type: Arc::new(DataType::Unspecified),
             has_side_effects: false,
             token,
         }
@@ -445,7 +446,7 @@ impl<'a> SyntaxNode<'a> {
 
 
     /// Return the symbol's literal value, if it is known at compile-time.
-    pub fn known_literal_value(&'a self, scope_id: ScopeID, symbol_table: &'a SymbolTable) -> Option<Rc<LiteralValue>> {
+    pub fn known_literal_value(&'a self, scope_id: ScopeID, symbol_table: &'a SymbolTable) -> Option<Arc<LiteralValue>> {
         match &self.value {
             SyntaxNodeValue::Literal(value) => Some(value.clone()),
             SyntaxNodeValue::Symbol { name, scope_discriminant } => {
@@ -457,7 +458,7 @@ impl<'a> SyntaxNode<'a> {
     }
 
 
-    pub fn assume_literal(&self) -> Rc<LiteralValue> {
+    pub fn assume_literal(&self) -> Arc<LiteralValue> {
         match &self.value {
             SyntaxNodeValue::Literal(value) => value.clone(),
             _ => panic!("Expected a literal, but got {:?}", self.value),
@@ -697,7 +698,7 @@ impl ScopeBlock<'_> {
         }
     }
 
-    pub fn return_type(&self) -> Rc<DataType> {
+    pub fn return_type(&self) -> Arc<DataType> {
         if let Some(last_statement) = self.statements.last() {
             last_statement.data_type.clone()
         } else {
@@ -705,7 +706,7 @@ impl ScopeBlock<'_> {
         }
     }
 
-    pub fn return_value_literal(&self, symbol_table: &SymbolTable ) -> Option<Rc<LiteralValue>> {
+    pub fn return_value_literal(&self, symbol_table: &SymbolTable ) -> Option<Arc<LiteralValue>> {
 
         self.statements.last()
             .and_then(|last_statement| last_statement.known_literal_value(self.scope_id, symbol_table)
@@ -749,7 +750,7 @@ pub struct IfBlock<'a> {
 
 pub struct FunctionParam<'a> {
     pub token: Rc<SourceToken<'a>>,
-    pub data_type: Rc<DataType>,
+    pub data_type: Arc<DataType>,
     pub mutable: bool,
 }
 
@@ -189,6 +189,14 @@ macro_rules! declare_optimizations {
 
 declare_optimizations!(
     evaluate_constants = true,
-    remove_useless_code = false
+    remove_useless_code = false,
+    propagate_constants = false,
+    propagate_copies = false,
+    eliminate_common_subexpressions = false,
+    hoist_loop_invariants = false,
+    eliminate_dead_code = false,
+    inline_functions = false,
+    inline_jump_targets = false,
+    optimize_tail_calls = false
 );
 
@@ -1,16 +1,23 @@
-use std::rc::Rc;
 use std::mem;
-use std::cell::RefCell;
+use std::sync::Mutex;
+use std::thread;
 
-use crate::irc::{FunctionIR, IROperator};
+use crate::irc::{FunctionIR, IRCode, IROperator};
 use crate::cli_parser::OptimizationFlags;
 
-use super::{BasicBlock, BasicBlockTable, FunctionGraph};
+use super::{BasicBlock, BasicBlockTable, BlockID, FunctionGraph};
+use super::optimizer::optimize_function;
+use super::inlining::{inline_jump_targets, mark_tail_calls};
 
 
-fn divide_basic_blocks(ir_function: FunctionIR, bb_table: &mut BasicBlockTable) -> Vec<Rc<RefCell<BasicBlock>>> {
+/// Number of functions a thread takes at a time when the passes run in parallel.
+/// Small chunks keep the threads busy when a few functions are much larger than the others
+const FUNCTIONS_PER_CHUNK: usize = 16;
+
+
+fn divide_basic_blocks(ir_function: FunctionIR, bb_table: &mut BasicBlockTable) -> FunctionGraph {
     
-    let mut basic_blocks: Vec<Rc<RefCell<BasicBlock>>> = Vec::new();
+    let mut basic_blocks: FunctionGraph = Vec::new();
 
     // TODO: this may fuck up the function code in the symbol table
     let mut function_code = ir_function.code.take();
@@ -55,7 +62,7 @@ fn divide_basic_blocks(ir_function: FunctionIR, bb_table: &mut BasicBlockTable)
         
             IROperator::JumpIf { .. } |
             IROperator::Call { .. } |
-            IROperator::Return |
+            IROperator::Return { .. } |
             IROperator::JumpIfNot { .. } |
             IROperator::Jump { .. } => {
 
@@ -77,47 +84,51 @@ fn divide_basic_blocks(ir_function: FunctionIR, bb_table: &mut BasicBlockTable)
         // Don't bother adding an empty block
         // Note that an empty block cannot be jumped to because jumping to a block requires that the block contains (starts with) a label.
         if !first_half.is_empty() {
-
-            let basic_block = Rc::new(RefCell::new(BasicBlock::new(first_half)));
-        
-            // If the basic block is introduced by a label, record it in the table to allow jumps to this block
-            if let IROperator::Label { label } = unsafe { basic_block.borrow().code.head().as_ref() }.unwrap().data.op {
-                bb_table.insert(label.0, basic_block.clone());
-            }
-
-            basic_blocks.push(basic_block);
+            push_basic_block(&mut basic_blocks, first_half, bb_table);
         }
     }
 
     // Add the last block, if it wasn't added yet
     if !function_code.is_empty() {
+        push_basic_block(&mut basic_blocks, function_code, bb_table);
+    }
 
-        let basic_block = Rc::new(RefCell::new(BasicBlock::new(function_code)));
-        
-        if let IROperator::Label { label } = unsafe { basic_block.borrow().code.head().as_ref() }.unwrap().data.op {
-            bb_table.insert(label.0, basic_block.clone());
-        }
+    basic_blocks
+}
+
+
+fn push_basic_block(basic_blocks: &mut FunctionGraph, code: IRCode, bb_table: &mut BasicBlockTable) {
 
-        basic_blocks.push(basic_block);
+    // If the basic block is introduced by a label, record it in the table to allow jumps to this block
+    if let IROperator::Label { label } = unsafe { code.head().as_ref() }.unwrap().data.op {
+        bb_table.insert(label.0, BlockID(basic_blocks.len()));
     }
 
-    basic_blocks
+    basic_blocks.push(BasicBlock::new(code));
 }
 
 
-fn connect_function_graph(function_graph: &FunctionGraph, bb_table: &BasicBlockTable) {
+fn connect_function_graph(function_graph: &mut FunctionGraph, bb_table: &BasicBlockTable) {
     /*
         Set the next and refs fields of each basic block.
         Iterate over the basic blocks and update the parameters based on the last instruction of the block.
     */
 
-    let mut graph_iter = function_graph.iter().peekable();
-    while let Some(basic_block_ref) = graph_iter.next() {
-        
-        let mut basic_block = basic_block_ref.borrow_mut();
+    let block_count = function_graph.len();
+
+    for block_index in 0..block_count {
+
+        let block_id = BlockID(block_index);
+        // The block that follows in the code, which is executed when the control flow doesn't change
+        let next_block = (block_index + 1 < block_count).then(|| BlockID(block_index + 1));
+
+        let basic_block = &function_graph[block_index];
         
         assert!(!basic_block.code.is_empty(), "Empty basic blocks should not be allowed. This is a bug.");
 
+        // Links are collected first, since the blocks they point to can't be borrowed while the block is
+        let mut next: Vec<BlockID> = Vec::new();
+
         match &unsafe { basic_block.code.tail().as_ref() }.unwrap().data.op {
 
             // These instructions don't change the control flow
@@ -149,65 +160,34 @@ fn connect_function_graph(function_graph: &FunctionGraph, bb_table: &BasicBlockT
             IROperator::PopScope { .. } |
             IROperator::Nop |
             IROperator::Label { .. } => {
-                
-                if let Some(&next_block) = graph_iter.peek() {
-                    basic_block.push_next(next_block.clone());
-                    next_block.borrow_mut().push_ref(basic_block_ref.clone());
-                }
+                next.extend(next_block);
             },
 
             IROperator::Jump { target } => {
-
-                let target_ref = bb_table.get(&target.0).unwrap();
-
-                basic_block.push_next(target_ref.clone());
-
-                let mut target = if Rc::ptr_eq(target_ref, basic_block_ref) {
-                    // The block jumps to itself. To satisfy the borrow checker, we don't borrow the block again.
-                    basic_block
-                } else {
-                    // If the block jumps to another block, it's safe to borrow the block as mutable.
-                    target_ref.borrow_mut()
-                };
-
-                target.push_ref(basic_block_ref.clone());
+                next.push(bb_table[&target.0]);
             },
 
             IROperator::JumpIfNot { target, .. } |
             IROperator::JumpIf { target, .. } => {
-
-                let target_ref = bb_table.get(&target.0).unwrap();
-
-                basic_block.push_next(target_ref.clone());
-
+                next.push(bb_table[&target.0]);
                 // If the jump condition isn't met, the next block is the one that will be executed.
-                if let Some(&next_block) = graph_iter.peek() {
-                    basic_block.push_next(next_block.clone());
-                    next_block.borrow_mut().push_ref(basic_block_ref.clone());
-                }
-
-                let mut target = if Rc::ptr_eq(target_ref, basic_block_ref) {
-                    // The block jumps to itself. To satisfy the borrow checker, we don't borrow the block again.
-                    basic_block
-                } else {
-                    // If the block jumps to another block, it's safe to borrow the block as mutable.
-                    target_ref.borrow_mut()
-                };
-
-                target.push_ref(basic_block_ref.clone());
+                next.extend(next_block);
             },
 
             IROperator::Call { return_label, .. } => {
-
-                let return_target_ref = bb_table.get(&return_label.0).unwrap();
                 // The next block will be execute after the function call returns.
-                return_target_ref.borrow_mut().push_ref(basic_block_ref.clone());
+                function_graph[bb_table[&return_label.0].0].push_ref(block_id);
 
                 // We may not know which block will be executed by the function call, so don't do anything with it.
             },
 
             // Return does not know where to jump to, but it breaks the control flow
-            IROperator::Return => {},
+            IROperator::Return { .. } => {},
+        }
+
+        for next_block in next {
+            function_graph[block_index].push_next(next_block);
+            function_graph[next_block.0].push_ref(block_id);
         }
         
     }
@@ -228,24 +208,37 @@ fn remove_unreachable_blocks(function_graph: &mut FunctionGraph) {
     */
     
     let old_graph = mem::replace(function_graph, Vec::with_capacity(function_graph.len()));
-    let mut old_graph_iter = old_graph.into_iter();
-    
-    function_graph.push(
-        old_graph_iter.next().unwrap() // Assume the graph has at least one initial basic block
-    );
 
-    for block_ref in old_graph_iter {
+    // The new id of each block, or None if the block was removed
+    let mut new_ids: Vec<Option<BlockID>> = vec![None; old_graph.len()];
+    let mut ref_counts: Vec<usize> = old_graph.iter().map(|block| block.ref_count).collect();
+
+    // Assume the graph has at least one initial basic block
+    new_ids[0] = Some(BlockID(0));
+    let mut kept_blocks = 1;
+
+    for (block_index, block) in old_graph.iter().enumerate().skip(1) {
 
-        if block_ref.borrow().ref_count == 0 {
+        if ref_counts[block_index] == 0 {
             // The block is unreachable. Remove it and decrement the ref_count of its next blocks
-            for referenced_block in block_ref.borrow().next_blocks() {
-                // Since the block has no refs, we can assume that the next block is not the block itself, so it's safe to borrow_mut
-                referenced_block.borrow_mut().ref_count -= 1;
+            for referenced_block in block.next_blocks() {
+                // Since the block has no refs, we can assume that the next block is not the block itself
+                ref_counts[referenced_block.0] -= 1;
             }
             
         } else {
             // The block is reachable, so keep it
-            function_graph.push(block_ref);
+            new_ids[block_index] = Some(BlockID(kept_blocks));
+            kept_blocks += 1;
+        }
+    }
+
+    // The kept blocks refer to each other by their new ids
+    for (block_index, mut block) in old_graph.into_iter().enumerate() {
+        if new_ids[block_index].is_some() {
+            block.ref_count = ref_counts[block_index];
+            block.renumber_links(&new_ids);
+            function_graph.push(block);
         }
     }
 
@@ -254,14 +247,52 @@ fn remove_unreachable_blocks(function_graph: &mut FunctionGraph) {
 }
 
 
+/// Run the pass on every function, spreading the functions over at most `threads` threads.
+/// The functions are independent and updated in place, so the result doesn't depend on how they are scheduled
+fn for_each_function<T: Send>(functions: &mut [T], threads: usize, pass: impl Fn(&mut T) + Sync) {
+
+    let threads = threads.min(functions.len().div_ceil(FUNCTIONS_PER_CHUNK));
+
+    if threads <= 1 {
+        functions.iter_mut().for_each(pass);
+        return;
+    }
+
+    let chunks = Mutex::new(functions.chunks_mut(FUNCTIONS_PER_CHUNK));
+
+    thread::scope(|scope| {
+        for _ in 0..threads {
+            scope.spawn(|| loop {
+                // The lock is released before the chunk is processed
+                let Some(chunk) = chunks.lock().unwrap().next() else {
+                    break;
+                };
+                chunk.iter_mut().for_each(&pass);
+            });
+        }
+    });
+}
+
+
+/// Divide the IR code of every function into a graph of basic blocks and optimize it, running the passes on all the available cores
 pub fn flow_graph(ir_code: Vec<FunctionIR>, optimization_flags: &OptimizationFlags, verbose: bool) -> Vec<FunctionGraph> {
+    let threads = thread::available_parallelism().map_or(1, |threads| threads.get());
+    flow_graph_with_threads(ir_code, optimization_flags, verbose, threads)
+}
+
 
-    let mut bb_table = BasicBlockTable::new();
+/// Like `flow_graph`, running the passes on at most `threads` threads
+pub fn flow_graph_with_threads(ir_code: Vec<FunctionIR>, optimization_flags: &OptimizationFlags, verbose: bool, threads: usize) -> Vec<FunctionGraph> {
+
+    let mut bb_tables: Vec<BasicBlockTable> = Vec::with_capacity(ir_code.len());
 
     // First, we need to divide the basic blocks of each function
     let mut function_blocks: Vec<FunctionGraph> = ir_code.into_iter()
     .map(|ir_function| {
-        divide_basic_blocks(ir_function, &mut bb_table)
+        let mut bb_table = BasicBlockTable::new();
+        let basic_blocks = divide_basic_blocks(ir_function, &mut bb_table);
+        bb_tables.push(bb_table);
+        basic_blocks
     }).collect();
 
     if verbose {
@@ -269,37 +300,89 @@ pub fn flow_graph(ir_code: Vec<FunctionIR>, optimization_flags: &OptimizationFla
     }
 
     // Now we can analyze the relationships between the basic blocks
-    for basic_blocks in function_blocks.iter() {
-        connect_function_graph(basic_blocks, &bb_table);
-    }
+    for_each_function(&mut function_blocks.iter_mut().zip(&bb_tables).collect::<Vec<_>>(), threads, |(basic_blocks, bb_table)| {
+        connect_function_graph(basic_blocks, bb_table);
+    });
 
     if verbose {
         println!("Connected the basic blocks into a graph\n\n{:#?}\n\n", function_blocks);
     }
 
-    if optimization_flags.remove_useless_code {
+    if optimization_flags.inline_jump_targets {
 
-        for basic_blocks in function_blocks.iter_mut() {
-            remove_unreachable_blocks(basic_blocks);
+        for_each_function(&mut function_blocks.iter_mut().zip(&bb_tables).collect::<Vec<_>>(), threads, |(basic_blocks, bb_table)| {
+            inline_jump_targets(basic_blocks, bb_table);
+        });
+
+        if verbose {
+            println!("Inlined the jump targets\n\n{:#?}\n\n", function_blocks);
         }
+    }
+
+    if optimization_flags.remove_useless_code {
+
+        for_each_function(&mut function_blocks, threads, remove_unreachable_blocks);
 
         if verbose {
             println!("Removed unreachable basic blocks\n\n{:#?}\n\n", function_blocks);
         }
     }
 
+    if optimization_flags.propagate_constants
+        || optimization_flags.propagate_copies
+        || optimization_flags.eliminate_common_subexpressions
+        || optimization_flags.hoist_loop_invariants
+        || optimization_flags.eliminate_dead_code
+    {
+        for_each_function(&mut function_blocks, threads, |basic_blocks| {
+            optimize_function(basic_blocks, optimization_flags);
+        });
+
+        if verbose {
+            println!("Optimized the basic blocks\n\n{:#?}\n\n", function_blocks);
+        }
+    }
+
+    // Tail calls are marked last, since the other optimizations may remove the code between a call and the function's return
+    if optimization_flags.optimize_tail_calls {
+
+        for_each_function(&mut function_blocks, threads, mark_tail_calls);
+
+        if verbose {
+            println!("Marked the tail calls\n\n{:#?}\n\n", function_blocks);
+        }
+    }
+
     function_blocks
 }
 
-/*
-    Possible optimizations:
 
-    When unconditionally jumping to a basic block, if the target block is small enough (small number of instructions)
-    we can inline the jump target and remove the jump instruction.
+#[cfg(test)]
+mod tests {
 
-    When calling a function (which is a special case of unconditional jumping), if the function is small enough,
-    we can inline the function and remove the call instruction.
+    use super::*;
 
-    
-*/
+    use crate::test_utils::{compile_with_threads, SAMPLE_PROGRAM};
+
+
+    #[test]
+    fn test_parallel_passes() {
+
+        // Enough functions for every thread to take several chunks
+        let mut program: String = (0..40).map(|i| SAMPLE_PROGRAM
+            .replace("three", &format!("three_{}", i))
+            .replace("seven", &format!("seven_{}", i))
+            .replace("fn main", &format!("fn main_{}", i))
+        ).collect();
+        program.push_str("fn main() {\n}\n");
+
+        for optimization_flags in [OptimizationFlags::none(), OptimizationFlags::all()] {
+            let serial = compile_with_threads(&program, &optimization_flags, 1);
+            let parallel = compile_with_threads(&program, &optimization_flags, 4);
 
+            assert!(serial.function_graphs == parallel.function_graphs, "The graphs optimized in parallel differ from the serial ones");
+            assert!(serial.bytecode == parallel.bytecode, "The bytecode compiled in parallel differs from the serial one");
+        }
+    }
+
+}
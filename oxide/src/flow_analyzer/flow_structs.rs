@@ -1,10 +1,14 @@
 use std::collections::HashMap;
-use std::rc::Rc;
-use std::cell::RefCell;
 
 use crate::irc::{IRCode, LabelID};
 
 
+/// Index of a basic block in its function graph.
+/// Blocks refer to each other through their ids, so the graph is stored contiguously and freed in one go
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+pub struct BlockID(pub usize);
+
+
 /// A basic block is a sequence of instructions that always get executed together.
 /// 
 /// A basic block ends when the control flow changes.
@@ -14,9 +18,9 @@ pub struct BasicBlock {
     /// The IR code of this basic block
     pub code: IRCode,
     /// List of basic blocks that can be directly reached from this basic block
-    next: Vec<Rc<RefCell<BasicBlock>>>,
+    next: Vec<BlockID>,
     /// List of basic blocks that can directly reach this basic block
-    refs: Vec<Rc<RefCell<BasicBlock>>>,
+    refs: Vec<BlockID>,
     /// Number of times this block is referenced by other blocks.
     /// This is different from `refs.len()` because a referencing block may get deleted as an optimization.
     /// Since iterating through the `refs` vector would be inefficient, we keep a mutable count of the references.
@@ -35,28 +39,42 @@ impl BasicBlock {
     }
 
 
-    pub fn next_blocks(&self) -> &Vec<Rc<RefCell<BasicBlock>>> {
+    pub fn next_blocks(&self) -> &[BlockID] {
         &self.next
     }
 
 
-    pub fn push_next(&mut self, next: Rc<RefCell<BasicBlock>>) {
+    pub fn push_next(&mut self, next: BlockID) {
         self.next.push(next);
     }
 
 
-    pub fn push_ref(&mut self, ref_: Rc<RefCell<BasicBlock>>) {
+    /// Replace the list of blocks that can be directly reached from this block
+    pub fn set_next(&mut self, next: Vec<BlockID>) {
+        self.next = next;
+    }
+
+
+    pub fn push_ref(&mut self, ref_: BlockID) {
         self.refs.push(ref_);
         self.ref_count += 1;
     }
 
+
+    /// Update the ids of the linked blocks after the graph has been compacted.
+    /// `new_ids` maps the old id of every block to its new id, or to None if the block was removed
+    pub fn renumber_links(&mut self, new_ids: &[Option<BlockID>]) {
+        self.next.retain_mut(|block| new_ids[block.0].map(|new_id| *block = new_id).is_some());
+        self.refs.retain_mut(|block| new_ids[block.0].map(|new_id| *block = new_id).is_some());
+    }
+
 }
 
 impl std::fmt::Debug for BasicBlock {
     fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
         writeln!(f, "BasicBlock {{")?;
-        writeln!(f, "  next: {}", self.next.len())?;
-        writeln!(f, "  refs: {}", self.refs.len())?;
+        writeln!(f, "  next: {:?}", self.next.iter().map(|block| block.0).collect::<Vec<usize>>())?;
+        writeln!(f, "  refs: {:?}", self.refs.iter().map(|block| block.0).collect::<Vec<usize>>())?;
         writeln!(f, "  ref_count: {:?}", self.ref_count)?;
         writeln!(f, "  code:")?;
         
@@ -72,8 +90,10 @@ impl std::fmt::Debug for BasicBlock {
 /// Maps a label to the basic block it introduces.
 /// 
 /// This is used to determine which basic block to jump to.
-pub type BasicBlockTable = HashMap<LabelID, Rc<RefCell<BasicBlock>>>;
+/// Jumps never leave their function, so every function graph has its own table
+pub type BasicBlockTable = HashMap<LabelID, BlockID>;
 
 // TODO: make this a struct with references to the original function to allow for generating code and identifying the main function/exporting functionsand identifying the main function, etc.
-pub type FunctionGraph = Vec<Rc<RefCell<BasicBlock>>>;
+/// The basic blocks of a function, indexed by their BlockID
+pub type FunctionGraph = Vec<BasicBlock>;
 
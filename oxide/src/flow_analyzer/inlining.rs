@@ -0,0 +1,233 @@
+use std::collections::HashMap;
+
+use crate::irc::{IRNode, IROperator, IRValue, Label, LabelID, Tn, TnID};
+
+use super::{BasicBlock, BasicBlockTable, BlockID, FunctionGraph};
+
+
+/// Blocks with more operations than this are not copied into the blocks that jump to them.
+/// The label that introduces the block is not counted
+const MAX_INLINED_BLOCK_SIZE: usize = 4;
+
+/// Once a jump target is inlined, the block may end with a jump to another small block.
+/// This limits how many blocks are inlined one after the other into the same block
+const MAX_INLINED_BLOCK_CHAIN: usize = 4;
+
+
+/// Return whether the block can be copied in place of a jump to it.
+/// The copy would not be followed by the block that follows the original, so the block must not fall through
+fn is_inlinable(block: &BasicBlock) -> bool {
+
+    let Some(IROperator::Label { label }) = block.code.iter().next().map(|ir_node| &ir_node.op) else {
+        return false;
+    };
+
+    block.code.iter().count() - 1 <= MAX_INLINED_BLOCK_SIZE && match block.code.iter().last().map(|ir_node| &ir_node.op) {
+        // A block that jumps to itself would be copied over and over
+        Some(IROperator::Jump { target }) => target != label,
+        Some(IROperator::Return { .. }) => true,
+        _ => false
+    }
+}
+
+
+/// Replace the unconditional jumps to small blocks with the code of the jumped-to block.
+/// The links of the graph are updated, so the blocks that are not jumped to anymore can be removed as unreachable.
+/// Jumps to the block that follows are removed, since the execution falls through to it anyway
+pub fn inline_jump_targets(function_graph: &mut FunctionGraph, bb_table: &BasicBlockTable) {
+
+    for block_index in 0..function_graph.len() {
+
+        for _ in 0..MAX_INLINED_BLOCK_CHAIN {
+
+            let block = &mut function_graph[block_index];
+
+            let Some(IROperator::Jump { target }) = block.code.iter().last().map(|ir_node| &ir_node.op) else {
+                break;
+            };
+
+            let target_id = bb_table[&target.0];
+            if target_id.0 == block_index {
+                break;
+            }
+
+            if target_id.0 == block_index + 1 {
+                unsafe {
+                    let jump_ptr = block.code.tail();
+                    block.code.remove(jump_ptr);
+                }
+                break;
+            }
+
+            let target = &function_graph[target_id.0];
+            if !is_inlinable(target) {
+                break;
+            }
+
+            // The block now continues where the target did
+            let inlined_code: Vec<IRNode> = target.code.iter().skip(1).cloned().collect();
+            let next_blocks = target.next_blocks().to_vec();
+
+            // Replace the jump with the code of the target, except for its label
+            let block = &mut function_graph[block_index];
+            unsafe {
+                let jump_ptr = block.code.tail();
+                block.code.remove(jump_ptr);
+            }
+            for ir_node in inlined_code {
+                block.code.push_back(ir_node);
+            }
+            block.set_next(next_blocks.clone());
+
+            function_graph[target_id.0].ref_count -= 1;
+            for next_block in next_blocks {
+                function_graph[next_block.0].push_ref(BlockID(block_index));
+            }
+        }
+    }
+}
+
+
+/// Return whether the code reached from the label only returns the value of the Tn to the caller.
+/// `value` is None if the value is Void
+fn returns_immediately(function_graph: &FunctionGraph, label_blocks: &HashMap<LabelID, usize>, label: &Label, value: Option<&Tn>) -> bool {
+
+    let Some(&(mut block_index)) = label_blocks.get(&label.0) else {
+        return false;
+    };
+
+    // The returned value may be moved into other Tns before being returned
+    let mut returned: Option<TnID> = value.map(|tn| tn.id);
+
+    // Every block is visited at most once, unless the code loops without returning
+    for _ in 0..function_graph.len() {
+
+        let block = &function_graph[block_index];
+
+        let mut jump_target = None;
+
+        for ir_node in block.code.iter() {
+            match &ir_node.op {
+
+                IROperator::Label { .. } |
+                IROperator::PopScope { .. } |
+                IROperator::Nop => {},
+
+                IROperator::Assign { target, source: IRValue::Tn(source) } if Some(source.id) == returned && target.data_type == source.data_type
+                    => returned = Some(target.id),
+
+                IROperator::Jump { target } => {
+                    jump_target = Some(*target);
+                    break;
+                },
+
+                IROperator::Return { value } => return value.as_ref().map(|tn| tn.id) == returned,
+
+                _ => return false
+            }
+        }
+
+        block_index = match jump_target {
+            Some(target) => match label_blocks.get(&target.0) {
+                Some(&index) => index,
+                None => return false
+            },
+            // The block falls through to the next one
+            None if block_index + 1 < function_graph.len() => block_index + 1,
+            None => return false
+        };
+    }
+
+    false
+}
+
+
+/// Mark the calls whose return value is returned right away by the function as tail calls
+pub fn mark_tail_calls(function_graph: &mut FunctionGraph) {
+
+    let label_blocks: HashMap<LabelID, usize> = function_graph.iter().enumerate()
+        .filter_map(|(i, block)| match block.code.iter().next().map(|ir_node| &ir_node.op) {
+            Some(IROperator::Label { label }) => Some((label.0, i)),
+            _ => None
+        })
+        .collect();
+
+    let tail_call_blocks: Vec<usize> = function_graph.iter().enumerate()
+        .filter(|(_, block)| matches!(block.code.iter().last().map(|ir_node| &ir_node.op),
+            Some(IROperator::Call { return_target, return_label, .. })
+                if returns_immediately(function_graph, &label_blocks, return_label, return_target.as_ref())
+        ))
+        .map(|(i, _)| i)
+        .collect();
+
+    for block_index in tail_call_blocks {
+
+        let block = &function_graph[block_index];
+
+        if let Some(IROperator::Call { tail, .. }) = (unsafe { block.code.tail().as_mut() }).map(|node| &mut node.data.op) {
+            *tail = true;
+        }
+    }
+}
+
+
+#[cfg(test)]
+mod tests {
+
+    use std::sync::Arc;
+
+    use super::*;
+
+    use crate::irc::{IRCode, IRJumpTarget};
+    use crate::lang::data_types::DataType;
+
+
+    fn tn(id: usize) -> Tn {
+        Tn { id: TnID(id), data_type: Arc::new(DataType::U64) }
+    }
+
+
+    fn node(op: IROperator) -> IRNode {
+        IRNode { op, has_side_effects: false }
+    }
+
+
+    fn call(target: usize, return_label: usize) -> IRNode {
+        node(IROperator::Call { return_target: Some(tn(target)), return_label: Label(LabelID(return_label)), callable: IRJumpTarget::Label(Label(LabelID(9))), args: vec![], tail: false })
+    }
+
+
+    fn block(ops: Vec<IRNode>) -> BasicBlock {
+        let mut code = IRCode::new();
+        for op in ops {
+            code.push_back(op);
+        }
+        BasicBlock::new(code)
+    }
+
+
+    fn is_tail_call(block: &BasicBlock) -> bool {
+        matches!(block.code.iter().last().map(|ir_node| &ir_node.op), Some(IROperator::Call { tail: true, .. }))
+    }
+
+
+    #[test]
+    fn test_mark_tail_calls() {
+
+        let mut function_graph: FunctionGraph = vec![
+            // The value of the first call is moved into the returned Tn and returned
+            block(vec![call(1, 1)]),
+            block(vec![node(IROperator::Label { label: Label(LabelID(1)) }), node(IROperator::Assign { target: tn(0), source: IRValue::Tn(tn(1)) }), node(IROperator::Jump { target: Label(LabelID(3)) })]),
+            // The value of the second call is discarded
+            block(vec![call(2, 2)]),
+            block(vec![node(IROperator::Label { label: Label(LabelID(2)) })]),
+            block(vec![node(IROperator::Label { label: Label(LabelID(3)) }), node(IROperator::PopScope { bytes: 0 }), node(IROperator::Return { value: Some(tn(0)) })]),
+        ];
+
+        mark_tail_calls(&mut function_graph);
+
+        assert!(is_tail_call(&function_graph[0]));
+        assert!(!is_tail_call(&function_graph[2]));
+    }
+
+}
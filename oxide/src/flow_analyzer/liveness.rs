@@ -0,0 +1,185 @@
+use std::collections::HashMap;
+
+use crate::irc::{IROperator, LabelID, Tn, TnID};
+
+use super::FunctionGraph;
+
+
+/// Set of Tns, indexed by their dense index in the function
+#[derive(Clone, PartialEq)]
+pub struct TnSet {
+    words: Vec<u64>,
+}
+
+impl TnSet {
+
+    pub fn new(tn_count: usize) -> Self {
+        Self {
+            words: vec![0; tn_count.div_ceil(64)]
+        }
+    }
+
+
+    pub fn insert(&mut self, index: usize) {
+        self.words[index / 64] |= 1 << (index % 64);
+    }
+
+
+    pub fn remove(&mut self, index: usize) {
+        self.words[index / 64] &= !(1 << (index % 64));
+    }
+
+
+    pub fn contains(&self, index: usize) -> bool {
+        self.words[index / 64] & (1 << (index % 64)) != 0
+    }
+
+
+    pub fn union_with(&mut self, other: &TnSet) {
+        for (word, other) in self.words.iter_mut().zip(&other.words) {
+            *word |= other;
+        }
+    }
+
+
+    pub fn iter(&self) -> impl Iterator<Item = usize> + '_ {
+        self.words.iter().enumerate().flat_map(|(i, &word)|
+            (0..64).filter(move |bit| word & (1 << bit) != 0).map(move |bit| i * 64 + bit)
+        )
+    }
+
+}
+
+
+/// Return the indices of the blocks that can be executed right after each block.
+///
+/// The flow graph doesn't link a call to the block it returns to, but the values live after the call must survive it, so the edge is added here.
+/// Tail calls don't return to the function, so they have no such edge
+pub fn block_successors(function_graph: &FunctionGraph) -> Vec<Vec<usize>> {
+
+    let label_blocks: HashMap<LabelID, usize> = function_graph.iter().enumerate()
+        .filter_map(|(i, block)| match block.code.iter().next().map(|ir_node| &ir_node.op) {
+            Some(IROperator::Label { label }) => Some((label.0, i)),
+            _ => None
+        })
+        .collect();
+
+    function_graph.iter().map(|block| {
+
+        let mut successors: Vec<usize> = block.next_blocks().iter()
+            .map(|next| next.0)
+            .collect();
+
+        if let Some(IROperator::Call { return_label, tail: false, .. }) = block.code.iter().last().map(|ir_node| &ir_node.op) {
+            successors.extend(label_blocks.get(&return_label.0));
+        }
+
+        successors
+    }).collect()
+}
+
+
+/// The Tns live at the boundaries of the basic blocks of a function
+pub struct FunctionLiveness {
+
+    /// The Tns of the function, in the order they first appear
+    pub tns: Vec<Tn>,
+    /// Maps a Tn to its dense index
+    pub tn_indices: HashMap<TnID, usize>,
+    pub successors: Vec<Vec<usize>>,
+    /// Tns live at the start of each block
+    pub live_in: Vec<TnSet>,
+    /// Tns live at the end of each block
+    pub live_out: Vec<TnSet>,
+
+}
+
+impl FunctionLiveness {
+
+    /// Compute the live Tns by iterating the dataflow equations until they converge
+    pub fn analyze(function_graph: &FunctionGraph) -> Self {
+
+        let mut tns: Vec<Tn> = Vec::new();
+        let mut tn_indices: HashMap<TnID, usize> = HashMap::new();
+
+        for block in function_graph {
+            for ir_node in block.code.iter() {
+                for tn in ir_node.op.defined_tn().into_iter().chain(ir_node.op.used_tns()) {
+                    tn_indices.entry(tn.id).or_insert_with(|| {
+                        tns.push(tn.clone());
+                        tns.len() - 1
+                    });
+                }
+            }
+        }
+
+        let tn_count = tns.len();
+
+        // Tns read by each block before being assigned in it, and Tns assigned by each block
+        let mut used = Vec::with_capacity(function_graph.len());
+        let mut defined = Vec::with_capacity(function_graph.len());
+
+        for block in function_graph {
+
+            let mut block_used = TnSet::new(tn_count);
+            let mut block_defined = TnSet::new(tn_count);
+
+            for ir_node in block.code.iter() {
+
+                // The operands are read before the target is assigned
+                for tn in ir_node.op.used_tns() {
+                    let index = tn_indices[&tn.id];
+                    if !block_defined.contains(index) {
+                        block_used.insert(index);
+                    }
+                }
+
+                if let Some(tn) = ir_node.op.defined_tn() {
+                    block_defined.insert(tn_indices[&tn.id]);
+                }
+            }
+
+            used.push(block_used);
+            defined.push(block_defined);
+        }
+
+        let successors = block_successors(function_graph);
+
+        let mut live_in = vec![TnSet::new(tn_count); function_graph.len()];
+        let mut live_out = vec![TnSet::new(tn_count); function_graph.len()];
+
+        let mut changed = true;
+        while changed {
+            changed = false;
+
+            // Liveness flows backwards, so visiting the blocks in reverse converges faster
+            for block in (0..function_graph.len()).rev() {
+
+                let mut live = TnSet::new(tn_count);
+                for &successor in &successors[block] {
+                    live.union_with(&live_in[successor]);
+                }
+                live_out[block] = live.clone();
+
+                for tn in defined[block].iter() {
+                    live.remove(tn);
+                }
+                live.union_with(&used[block]);
+
+                if live != live_in[block] {
+                    live_in[block] = live;
+                    changed = true;
+                }
+            }
+        }
+
+        Self {
+            tns,
+            tn_indices,
+            successors,
+            live_in,
+            live_out,
+        }
+    }
+
+}
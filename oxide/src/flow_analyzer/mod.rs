@@ -1,7 +1,9 @@
-
 mod analyzer;
 mod flow_structs;
+mod liveness;
+mod optimizer;
+mod inlining;
 
 pub use flow_structs::*;
-pub use analyzer::flow_graph;
-
+pub use analyzer::{flow_graph, flow_graph_with_threads};
+pub use liveness::*;
@@ -0,0 +1,884 @@
+use std::collections::{HashMap, HashSet};
+use std::mem::{self, Discriminant};
+use std::sync::Arc;
+
+use crate::irc::{IRJumpTarget, IRNode, IROperator, IRValue, Tn, TnID};
+use crate::lang::data_types::{DataType, LiteralValue, Number};
+use crate::cli_parser::OptimizationFlags;
+
+use super::{block_successors, FunctionGraph, FunctionLiveness};
+
+
+/// The passes are repeated until they stop changing the code, but no more than this many times
+const MAX_OPTIMIZATION_ROUNDS: usize = 8;
+
+/// Larger constants, like arrays, are not propagated because copying them everywhere they're used would bloat the code
+const MAX_PROPAGATED_CONST_SIZE: usize = 8;
+
+
+/// Return the Tns whose address is taken.
+/// Their value can change through pointers, so the passes never track or remove their assignments
+fn addressed_tns(function_graph: &FunctionGraph) -> HashSet<TnID> {
+    function_graph.iter()
+        .flat_map(|block| block.code.iter()
+            .filter_map(|ir_node| match &ir_node.op {
+                IROperator::Ref { ref_, .. } => Some(ref_.id),
+                _ => None
+            })
+            .collect::<Vec<_>>()
+        )
+        .collect()
+}
+
+
+fn static_size(data_type: &DataType) -> usize {
+    data_type.static_size().unwrap_or_else(
+        |()| panic!("Could not determine static size of {:?}. This is a bug.", data_type)
+    )
+}
+
+
+fn same_literal(a: &LiteralValue, b: &LiteralValue) -> bool {
+    match (a, b) {
+        // Numbers of different kinds can't be compared
+        (LiteralValue::Numeric(n1), LiteralValue::Numeric(n2)) => mem::discriminant(n1) == mem::discriminant(n2) && n1.equal(n2),
+        _ => a.equal(b)
+    }
+}
+
+
+fn same_value(a: &IRValue, b: &IRValue) -> bool {
+    match (a, b) {
+        (IRValue::Tn(a), IRValue::Tn(b)) => a.id == b.id,
+        (IRValue::Const(a), IRValue::Const(b)) => same_literal(a, b),
+        _ => false
+    }
+}
+
+
+/// Return whether the integer data type is signed and its width in bits
+fn integer_kind(data_type: &DataType) -> Option<(bool, u32)> {
+    let signed = match data_type {
+        DataType::I8 | DataType::I16 | DataType::I32 | DataType::I64 | DataType::Isize => true,
+        DataType::U8 | DataType::U16 | DataType::U32 | DataType::U64 | DataType::Usize => false,
+        _ => return None
+    };
+    Some((signed, static_size(data_type) as u32 * 8))
+}
+
+
+/// Return the bits of the integer literal, sign-extended to 64 bits
+fn integer_bits(value: &LiteralValue) -> Option<u64> {
+    match value {
+        LiteralValue::Numeric(Number::Int(n)) => Some(*n as u64),
+        LiteralValue::Numeric(Number::Uint(n)) => Some(*n),
+        _ => None
+    }
+}
+
+
+/// Return the literal of the given integer type with the bits, wrapping them to the type width like the VM does
+fn integer_literal(bits: u64, data_type: &DataType) -> Option<Arc<LiteralValue>> {
+    let (signed, width) = integer_kind(data_type)?;
+    let shift = 64 - width;
+    let number = if signed {
+        Number::Int(((bits << shift) as i64) >> shift)
+    } else {
+        Number::Uint((bits << shift) >> shift)
+    };
+    Some(Arc::new(LiteralValue::Numeric(number)))
+}
+
+
+/// Compute the result of the operation, if all its operands are known constants.
+/// `constant` returns the constant value of an operand, if it's known
+fn fold(op: &IROperator, constant: impl Fn(&IRValue) -> Option<Arc<LiteralValue>>) -> Option<Arc<LiteralValue>> {
+
+    match op {
+
+        IROperator::Assign { source, .. } => constant(source),
+
+        // Casts copy the literal into a Tn of the new type
+        IROperator::Copy { target, source } => {
+            let bits = integer_bits(&*constant(source)?)?;
+            integer_literal(bits, &target.data_type)
+        },
+
+        IROperator::Add { target, left, right } |
+        IROperator::Sub { target, left, right } |
+        IROperator::Mul { target, left, right } |
+        IROperator::Div { target, left, right } |
+        IROperator::Mod { target, left, right } |
+        IROperator::BitShiftLeft { target, left, right } |
+        IROperator::BitShiftRight { target, left, right } |
+        IROperator::BitAnd { target, left, right } |
+        IROperator::BitOr { target, left, right } |
+        IROperator::BitXor { target, left, right } => {
+
+            let (signed, width) = integer_kind(&target.data_type)?;
+            let left = integer_bits(&*constant(left)?)?;
+            let right = integer_bits(&*constant(right)?)?;
+
+            let result = match op {
+                IROperator::Add { .. } => left.wrapping_add(right),
+                IROperator::Sub { .. } => left.wrapping_sub(right),
+                IROperator::Mul { .. } => left.wrapping_mul(right),
+                // Division by zero is left to the runtime
+                IROperator::Div { .. } if signed => (left as i64).checked_div(right as i64)? as u64,
+                IROperator::Div { .. } => left.checked_div(right)?,
+                IROperator::Mod { .. } if signed => (left as i64).checked_rem(right as i64)? as u64,
+                IROperator::Mod { .. } => left.checked_rem(right)?,
+                IROperator::BitShiftLeft { .. } if right < width as u64 => left << right,
+                IROperator::BitShiftRight { .. } if right < width as u64 => if signed { ((left as i64) >> right) as u64 } else { left >> right },
+                IROperator::BitAnd { .. } => left & right,
+                IROperator::BitOr { .. } => left | right,
+                IROperator::BitXor { .. } => left ^ right,
+                _ => return None
+            };
+
+            integer_literal(result, &target.data_type)
+        },
+
+        IROperator::BitNot { target, operand } => {
+            let operand = integer_bits(&*constant(operand)?)?;
+            integer_literal(!operand, &target.data_type)
+        },
+
+        IROperator::Greater { left, right, .. } |
+        IROperator::Less { left, right, .. } |
+        IROperator::GreaterEqual { left, right, .. } |
+        IROperator::LessEqual { left, right, .. } |
+        IROperator::Equal { left, right, .. } |
+        IROperator::NotEqual { left, right, .. } => {
+
+            let left = constant(left)?;
+            let right = constant(right)?;
+
+            let ordering = match (left.as_ref(), right.as_ref()) {
+                (LiteralValue::Numeric(Number::Int(l)), LiteralValue::Numeric(Number::Int(r))) => l.cmp(r),
+                (LiteralValue::Numeric(Number::Uint(l)), LiteralValue::Numeric(Number::Uint(r))) => l.cmp(r),
+                (LiteralValue::Bool(l), LiteralValue::Bool(r)) => l.cmp(r),
+                (LiteralValue::Char(l), LiteralValue::Char(r)) => l.cmp(r),
+                _ => return None
+            };
+
+            let result = match op {
+                IROperator::Greater { .. } => ordering.is_gt(),
+                IROperator::Less { .. } => ordering.is_lt(),
+                IROperator::GreaterEqual { .. } => ordering.is_ge(),
+                IROperator::LessEqual { .. } => ordering.is_le(),
+                IROperator::Equal { .. } => ordering.is_eq(),
+                IROperator::NotEqual { .. } => ordering.is_ne(),
+                _ => unreachable!()
+            };
+
+            Some(Arc::new(LiteralValue::Bool(result)))
+        },
+
+        _ => None
+    }
+}
+
+
+/// What is known about the value of a Tn at some point of the function
+#[derive(Clone)]
+enum KnownValue {
+
+    Const (Arc<LiteralValue>),
+    /// The Tn holds the same value as this other Tn
+    Copy (Tn),
+
+}
+
+impl PartialEq for KnownValue {
+    fn eq(&self, other: &Self) -> bool {
+        match (self, other) {
+            (KnownValue::Const(a), KnownValue::Const(b)) => same_literal(a, b),
+            (KnownValue::Copy(a), KnownValue::Copy(b)) => a.id == b.id,
+            _ => false
+        }
+    }
+}
+
+type KnownValues = HashMap<TnID, KnownValue>;
+
+
+/// Constant and copy propagation over the whole function
+struct Propagation<'a> {
+
+    constants: bool,
+    copies: bool,
+    addressed: &'a HashSet<TnID>,
+
+}
+
+impl Propagation<'_> {
+
+    fn known_constant(value: &IRValue, known: &KnownValues) -> Option<Arc<LiteralValue>> {
+        match value {
+            IRValue::Const(literal) => Some(literal.clone()),
+            IRValue::Tn(tn) => match known.get(&tn.id) {
+                Some(KnownValue::Const(literal)) => Some(literal.clone()),
+                _ => None
+            }
+        }
+    }
+
+
+    /// Update the known values after the operation is executed
+    fn transfer(&self, op: &IROperator, known: &mut KnownValues) {
+
+        let Some(target) = op.defined_tn() else {
+            return;
+        };
+
+        let value = if self.constants && static_size(&target.data_type) <= MAX_PROPAGATED_CONST_SIZE {
+            fold(op, |value| Self::known_constant(value, known)).map(KnownValue::Const)
+        } else {
+            None
+        };
+
+        let value = value.or_else(|| match op {
+            IROperator::Assign { target, source: IRValue::Tn(source) } |
+            IROperator::Copy { target, source: IRValue::Tn(source) }
+                if self.copies && !self.addressed.contains(&source.id)
+                    // Copy may extend the source to a larger target
+                    && static_size(&target.data_type) == static_size(&source.data_type)
+            => {
+                // Point to the original Tn, so that copy chains collapse
+                match known.get(&source.id) {
+                    Some(value) => Some(value.clone()),
+                    None => Some(KnownValue::Copy(source.clone())),
+                }
+            },
+            _ => None
+        });
+
+        // The old value of the target, and every copy of it, is not valid anymore
+        known.remove(&target.id);
+        known.retain(|_, value| !matches!(value, KnownValue::Copy(tn) if tn.id == target.id));
+
+        if let Some(value) = value {
+            if !self.addressed.contains(&target.id) && !matches!(&value, KnownValue::Copy(tn) if tn.id == target.id) {
+                known.insert(target.id, value);
+            }
+        }
+    }
+
+
+    fn transfer_block(&self, block: &super::BasicBlock, known: &mut KnownValues) {
+        for ir_node in block.code.iter() {
+            self.transfer(&ir_node.op, known);
+        }
+    }
+
+
+    /// Replace the operands with their known values and fold the operations with constant operands.
+    /// Return whether the block changed
+    fn rewrite_block(&self, block: &mut super::BasicBlock, known: &mut KnownValues) -> bool {
+
+        let mut changed = false;
+
+        let mut node_ptr = unsafe { block.code.head() };
+        while let Some(node) = unsafe { node_ptr.as_mut() } {
+
+            let next_ptr = unsafe { node.next() };
+            let op = &mut node.data.op;
+
+            for operand in op.operands_mut() {
+                if let IRValue::Tn(tn) = operand {
+                    match known.get(&tn.id) {
+                        Some(KnownValue::Const(literal)) => *operand = IRValue::Const(literal.clone()),
+                        Some(KnownValue::Copy(source)) => *operand = IRValue::Tn(source.clone()),
+                        None => continue
+                    }
+                    changed = true;
+                }
+            }
+
+            // Tn-only operands can take copies, but not constants
+            let tn_operand = match op {
+                IROperator::DerefAssign { target, .. } |
+                IROperator::DerefCopy { target, .. } |
+                IROperator::JumpIf { condition: target, .. } |
+                IROperator::JumpIfNot { condition: target, .. } |
+                IROperator::Call { callable: IRJumpTarget::Tn(target), .. }
+                    => Some(target),
+                _ => None
+            };
+            if let Some(tn) = tn_operand {
+                if let Some(KnownValue::Copy(source)) = known.get(&tn.id) {
+                    *tn = source.clone();
+                    changed = true;
+                }
+            }
+
+            // Branches on known conditions become unconditional.
+            // The graph keeps the edge that is not taken anymore, which is harmless for the analyses
+            let branch = match op {
+                IROperator::JumpIf { condition, target } => Some((condition.id, *target, true)),
+                IROperator::JumpIfNot { condition, target } => Some((condition.id, *target, false)),
+                _ => None
+            };
+            if let Some((condition, target, jump_if)) = branch {
+                if let Some(KnownValue::Const(literal)) = known.get(&condition) {
+                    if let LiteralValue::Bool(value) = literal.as_ref() {
+                        changed = true;
+                        if *value == jump_if {
+                            *op = IROperator::Jump { target };
+                        } else {
+                            unsafe { block.code.remove(node_ptr) };
+                            node_ptr = next_ptr;
+                            continue;
+                        }
+                    }
+                }
+            }
+
+            if self.constants && !matches!(op, IROperator::Assign { source: IRValue::Const(_), .. }) {
+                if let Some(literal) = fold(op, |value| Self::known_constant(value, known)) {
+                    let target = op.defined_tn().unwrap().clone();
+                    *op = IROperator::Assign { target, source: IRValue::Const(literal) };
+                    changed = true;
+                }
+            }
+
+            self.transfer(op, known);
+
+            node_ptr = next_ptr;
+        }
+
+        changed
+    }
+
+
+    fn run(&self, function_graph: &mut FunctionGraph) -> bool {
+
+        let successors = block_successors(function_graph);
+        let mut predecessors: Vec<Vec<usize>> = vec![Vec::new(); function_graph.len()];
+        for (block, block_successors) in successors.iter().enumerate() {
+            for &successor in block_successors {
+                predecessors[successor].push(block);
+            }
+        }
+
+        // The values known at the start of a block are the ones known at the end of all its predecessors.
+        // Blocks that weren't visited yet don't restrict them, which lets the values known before a loop flow into it.
+        // A block none of whose predecessors was visited isn't known to be reachable yet, so it's not visited either
+        let known_in = |block: usize, known_out: &[Option<KnownValues>]| -> Option<KnownValues> {
+            if block == 0 {
+                return Some(KnownValues::new());
+            }
+            let mut visited = predecessors[block].iter().filter_map(|&predecessor| known_out[predecessor].as_ref());
+            let mut known = visited.next()?.clone();
+            for other in visited {
+                known.retain(|tn, value| other.get(tn) == Some(&*value));
+            }
+            Some(known)
+        };
+
+        let mut known_out: Vec<Option<KnownValues>> = vec![None; function_graph.len()];
+
+        let mut changed = true;
+        while changed {
+            changed = false;
+
+            for (i, block) in function_graph.iter().enumerate() {
+                let Some(mut known) = known_in(i, &known_out) else {
+                    continue;
+                };
+                self.transfer_block(block, &mut known);
+                if known_out[i].as_ref() != Some(&known) {
+                    known_out[i] = Some(known);
+                    changed = true;
+                }
+            }
+        }
+
+        let mut changed = false;
+        for (i, block) in function_graph.iter_mut().enumerate() {
+            // Unreachable blocks are left as they are
+            if let Some(mut known) = known_in(i, &known_out) {
+                changed |= self.rewrite_block(block, &mut known);
+            }
+        }
+
+        changed
+    }
+
+}
+
+
+/// Return the kind and the operands of the operation if it computes a value only from its operands
+fn expression(op: &IROperator) -> Option<(Discriminant<IROperator>, Vec<&IRValue>)> {
+    match op {
+        IROperator::Add { left, right, .. } |
+        IROperator::Sub { left, right, .. } |
+        IROperator::Mul { left, right, .. } |
+        IROperator::Div { left, right, .. } |
+        IROperator::Mod { left, right, .. } |
+        IROperator::Greater { left, right, .. } |
+        IROperator::Less { left, right, .. } |
+        IROperator::GreaterEqual { left, right, .. } |
+        IROperator::LessEqual { left, right, .. } |
+        IROperator::Equal { left, right, .. } |
+        IROperator::NotEqual { left, right, .. } |
+        IROperator::BitShiftLeft { left, right, .. } |
+        IROperator::BitShiftRight { left, right, .. } |
+        IROperator::BitAnd { left, right, .. } |
+        IROperator::BitOr { left, right, .. } |
+        IROperator::BitXor { left, right, .. }
+            => Some((mem::discriminant(op), vec![left, right])),
+
+        IROperator::BitNot { operand, .. } => Some((mem::discriminant(op), vec![operand])),
+
+        _ => None
+    }
+}
+
+
+fn is_commutative(op: &IROperator) -> bool {
+    matches!(op,
+        IROperator::Add { .. } |
+        IROperator::Mul { .. } |
+        IROperator::Equal { .. } |
+        IROperator::NotEqual { .. } |
+        IROperator::BitAnd { .. } |
+        IROperator::BitOr { .. } |
+        IROperator::BitXor { .. }
+    )
+}
+
+
+/// An expression computed earlier in the block, whose value is still held by a Tn
+struct AvailableExpression {
+    kind: Discriminant<IROperator>,
+    operands: Vec<IRValue>,
+    commutative: bool,
+    holder: Tn,
+}
+
+impl AvailableExpression {
+
+    fn matches(&self, kind: Discriminant<IROperator>, operands: &[&IRValue]) -> bool {
+        if self.kind != kind || self.operands.len() != operands.len() {
+            return false;
+        }
+        let same = self.operands.iter().zip(operands).all(|(a, b)| same_value(a, b));
+        same || (self.commutative && same_value(&self.operands[0], operands[1]) && same_value(&self.operands[1], operands[0]))
+    }
+
+
+    fn uses(&self, tn: &Tn) -> bool {
+        self.operands.iter().any(|operand| matches!(operand, IRValue::Tn(operand) if operand.id == tn.id))
+    }
+
+}
+
+
+/// Replace expressions computed again in the same block with a copy of the Tn that holds them
+fn eliminate_common_subexpressions(function_graph: &mut FunctionGraph, addressed: &HashSet<TnID>) -> bool {
+
+    let mut changed = false;
+
+    for block in function_graph.iter_mut() {
+        let mut available: Vec<AvailableExpression> = Vec::new();
+
+        let mut node_ptr = unsafe { block.code.head() };
+        while let Some(node) = unsafe { node_ptr.as_mut() } {
+
+            let op = &mut node.data.op;
+
+            let reused = expression(op)
+                .filter(|(_, operands)| !operands.iter().any(|operand| matches!(operand, IRValue::Tn(tn) if addressed.contains(&tn.id))))
+                .and_then(|(kind, operands)| {
+                    let target = op.defined_tn().unwrap();
+                    available.iter()
+                        .find(|expression| expression.matches(kind, &operands) && expression.holder.data_type == target.data_type)
+                        .map(|expression| expression.holder.clone())
+                });
+
+            if let Some(holder) = reused {
+                let target = op.defined_tn().unwrap().clone();
+                *op = IROperator::Assign { target, source: IRValue::Tn(holder) };
+                changed = true;
+            }
+
+            if let Some(target) = op.defined_tn() {
+                available.retain(|expression| expression.holder.id != target.id && !expression.uses(target));
+
+                if let Some((kind, operands)) = expression(op) {
+                    let self_referencing = operands.iter().any(|operand| matches!(operand, IRValue::Tn(tn) if tn.id == target.id));
+                    let uses_addressed = operands.iter().any(|operand| matches!(operand, IRValue::Tn(tn) if addressed.contains(&tn.id)));
+                    if !self_referencing && !uses_addressed && !addressed.contains(&target.id) {
+                        available.push(AvailableExpression {
+                            kind,
+                            operands: operands.into_iter().cloned().collect(),
+                            commutative: is_commutative(op),
+                            holder: target.clone(),
+                        });
+                    }
+                }
+            }
+
+            node_ptr = unsafe { node.next() };
+        }
+    }
+
+    changed
+}
+
+
+/// Return whether the operation only assigns its target, so that it can be removed if the target is never read
+fn is_pure(op: &IROperator) -> bool {
+    match op {
+        // Division by zero is a runtime error, so only divisions by known non-zero constants are pure
+        IROperator::Div { right, .. } |
+        IROperator::Mod { right, .. }
+            => matches!(right, IRValue::Const(literal) if integer_bits(literal).is_some_and(|bits| bits != 0)),
+
+        IROperator::Add { .. } |
+        IROperator::Sub { .. } |
+        IROperator::Mul { .. } |
+        IROperator::Assign { .. } |
+        IROperator::Ref { .. } |
+        IROperator::Greater { .. } |
+        IROperator::Less { .. } |
+        IROperator::GreaterEqual { .. } |
+        IROperator::LessEqual { .. } |
+        IROperator::Equal { .. } |
+        IROperator::NotEqual { .. } |
+        IROperator::BitShiftLeft { .. } |
+        IROperator::BitShiftRight { .. } |
+        IROperator::BitNot { .. } |
+        IROperator::BitAnd { .. } |
+        IROperator::BitOr { .. } |
+        IROperator::BitXor { .. } |
+        IROperator::Copy { .. }
+            => true,
+
+        _ => false
+    }
+}
+
+
+/// Remove the operations whose result is never read, and the assignments of Tns to themselves
+fn eliminate_dead_code(function_graph: &mut FunctionGraph, addressed: &HashSet<TnID>) -> bool {
+
+    let mut changed = false;
+
+    // Removing an operation may make the operations that computed its operands dead
+    loop {
+
+        let liveness = FunctionLiveness::analyze(function_graph);
+        let mut removed = false;
+
+        for (i, block) in function_graph.iter_mut().enumerate() {
+
+            let mut live = liveness.live_out[i].clone();
+
+            let mut node_ptr = unsafe { block.code.tail() };
+            while let Some(node) = unsafe { node_ptr.as_mut() } {
+
+                let prev_ptr = unsafe { node.prev() };
+                let op = &node.data.op;
+
+                let self_assignment = matches!(op,
+                    IROperator::Assign { target, source: IRValue::Tn(source) } |
+                    IROperator::Copy { target, source: IRValue::Tn(source) }
+                        if target.id == source.id
+                );
+
+                let dead = self_assignment || matches!(op, IROperator::Nop) || op.defined_tn().is_some_and(|target|
+                    is_pure(op) && !addressed.contains(&target.id) && !live.contains(liveness.tn_indices[&target.id])
+                );
+
+                if dead {
+                    unsafe { block.code.remove(node_ptr) };
+                    removed = true;
+                } else {
+                    if let Some(target) = op.defined_tn() {
+                        live.remove(liveness.tn_indices[&target.id]);
+                    }
+                    for tn in op.used_tns() {
+                        live.insert(liveness.tn_indices[&tn.id]);
+                    }
+                }
+
+                node_ptr = prev_ptr;
+            }
+        }
+
+        if !removed {
+            break;
+        }
+        changed = true;
+    }
+
+    changed
+}
+
+
+/// Return, for every block reachable from the entry block, which blocks are always executed before it
+fn dominators(successors: &[Vec<usize>], predecessors: &[Vec<usize>]) -> Vec<Option<Vec<bool>>> {
+
+    let block_count = successors.len();
+
+    let mut reachable = vec![false; block_count];
+    let mut to_visit = vec![0];
+    while let Some(block) = to_visit.pop() {
+        if !reachable[block] {
+            reachable[block] = true;
+            to_visit.extend(&successors[block]);
+        }
+    }
+
+    let mut dominators: Vec<Option<Vec<bool>>> = (0..block_count)
+        .map(|block| reachable[block].then(|| vec![block != 0; block_count]))
+        .collect();
+    if let Some(entry) = dominators.first_mut().and_then(Option::as_mut) {
+        entry[0] = true;
+    }
+
+    let mut changed = true;
+    while changed {
+        changed = false;
+
+        for block in 1..block_count {
+
+            if !reachable[block] {
+                continue;
+            }
+
+            // A block is dominated by itself and by the blocks that dominate all its predecessors
+            let mut block_dominators = vec![true; block_count];
+            for &predecessor in &predecessors[block] {
+                if let Some(predecessor_dominators) = &dominators[predecessor] {
+                    for (dominator, &dominates) in block_dominators.iter_mut().zip(predecessor_dominators) {
+                        *dominator &= dominates;
+                    }
+                }
+            }
+            block_dominators[block] = true;
+
+            if dominators[block].as_ref() != Some(&block_dominators) {
+                dominators[block] = Some(block_dominators);
+                changed = true;
+            }
+        }
+    }
+
+    dominators
+}
+
+
+/// Move the operations that compute the same value in every iteration of a loop to the block that enters the loop
+fn hoist_loop_invariants(function_graph: &mut FunctionGraph, addressed: &HashSet<TnID>) -> bool {
+
+    let successors = block_successors(function_graph);
+    let mut predecessors: Vec<Vec<usize>> = vec![Vec::new(); function_graph.len()];
+    for (block, block_successors) in successors.iter().enumerate() {
+        for &successor in block_successors {
+            predecessors[successor].push(block);
+        }
+    }
+
+    // A back edge jumps to a header that dominates the jumping block, which closes a loop
+    let dominators = &dominators(&successors, &predecessors);
+    let back_edges: Vec<(usize, usize)> = successors.iter().enumerate()
+        .flat_map(|(block, block_successors)| block_successors.iter()
+            .filter(move |&&successor| dominators[block].as_ref().is_some_and(|dominators| dominators[successor]))
+            .map(move |&header| (block, header))
+        )
+        .collect();
+
+    let mut changed = false;
+
+    for (latch, header) in back_edges {
+
+        // The loop body is made of the blocks that reach the latch without going through the header
+        let mut body: HashSet<usize> = HashSet::from([header]);
+        let mut to_visit = vec![latch];
+        while let Some(block) = to_visit.pop() {
+            if body.insert(block) {
+                to_visit.extend(&predecessors[block]);
+            }
+        }
+
+        // The loop must be entered from a single block that always continues into the header, where the invariants are moved
+        let entries: Vec<usize> = predecessors[header].iter().copied().filter(|block| !body.contains(block)).collect();
+        let &[preheader] = entries.as_slice() else {
+            continue;
+        };
+        if successors[preheader].as_slice() != [header] {
+            continue;
+        }
+        let preheader_ends_with_jump = match function_graph[preheader].code.iter().last().map(|ir_node| &ir_node.op) {
+            Some(IROperator::Jump { .. }) => true,
+            Some(IROperator::Call { .. } | IROperator::Return { .. } | IROperator::JumpIf { .. } | IROperator::JumpIfNot { .. }) => continue,
+            _ => false
+        };
+
+        let liveness = FunctionLiveness::analyze(function_graph);
+
+        // Number of assignments of each Tn inside the loop
+        let mut definitions: HashMap<TnID, usize> = HashMap::new();
+        for &block in &body {
+            for ir_node in function_graph[block].code.iter() {
+                if let Some(tn) = ir_node.op.defined_tn() {
+                    *definitions.entry(tn.id).or_default() += 1;
+                }
+            }
+        }
+
+        let mut body: Vec<usize> = body.into_iter().collect();
+        body.sort_unstable();
+
+        // Hoisting an operation may make the operations that use its result invariant
+        let mut hoisted = true;
+        while hoisted {
+            hoisted = false;
+
+            for &block in &body {
+
+                // The preheader isn't part of the loop, so the hoisted operations are moved to it once the block has been visited
+                let mut hoisted_nodes: Vec<IRNode> = Vec::new();
+                let block = &mut function_graph[block];
+
+                let mut node_ptr = unsafe { block.code.head() };
+                while let Some(node) = unsafe { node_ptr.as_mut() } {
+
+                    let next_ptr = unsafe { node.next() };
+                    let op = &node.data.op;
+
+                    // The operation may be executed even in iterations that wouldn't execute it, so it must not fail
+                    let invariant = is_pure(op) && op.defined_tn().is_some_and(|target|
+                        // The target is assigned only here and its value from before the loop is never read
+                        definitions.get(&target.id) == Some(&1)
+                            && !addressed.contains(&target.id)
+                            && !liveness.live_in[header].contains(liveness.tn_indices[&target.id])
+                    ) && match op {
+                        // The address of a Tn doesn't change
+                        IROperator::Ref { .. } => true,
+                        _ => op.used_tns().iter().all(|tn| !definitions.contains_key(&tn.id) && !addressed.contains(&tn.id))
+                    };
+
+                    if invariant {
+                        let ir_node: IRNode = unsafe { block.code.remove(node_ptr) };
+                        definitions.remove(&ir_node.op.defined_tn().unwrap().id);
+                        hoisted_nodes.push(ir_node);
+
+                        hoisted = true;
+                        changed = true;
+                    }
+
+                    node_ptr = next_ptr;
+                }
+
+                let preheader_block = &mut function_graph[preheader];
+                for ir_node in hoisted_nodes {
+                    if preheader_ends_with_jump {
+                        let jump_ptr = unsafe { preheader_block.code.tail() };
+                        unsafe { preheader_block.code.insert_before(jump_ptr, ir_node) };
+                    } else {
+                        preheader_block.code.push_back(ir_node);
+                    }
+                }
+            }
+        }
+    }
+
+    changed
+}
+
+
+/// Run the enabled dataflow optimizations on the function until they stop changing it.
+pub fn optimize_function(function_graph: &mut FunctionGraph, optimization_flags: &OptimizationFlags) {
+
+    let propagation_enabled = optimization_flags.propagate_constants || optimization_flags.propagate_copies;
+
+    for _ in 0..MAX_OPTIMIZATION_ROUNDS {
+
+        // Passes may add or remove references to Tns, so the addressed Tns are collected every round
+        let addressed = addressed_tns(function_graph);
+        let mut changed = false;
+
+        if propagation_enabled {
+            changed |= Propagation {
+                constants: optimization_flags.propagate_constants,
+                copies: optimization_flags.propagate_copies,
+                addressed: &addressed,
+            }.run(function_graph);
+        }
+
+        if optimization_flags.eliminate_common_subexpressions {
+            changed |= eliminate_common_subexpressions(function_graph, &addressed);
+        }
+
+        if optimization_flags.hoist_loop_invariants {
+            changed |= hoist_loop_invariants(function_graph, &addressed);
+        }
+
+        if optimization_flags.eliminate_dead_code {
+            changed |= eliminate_dead_code(function_graph, &addressed);
+        }
+
+        if !changed {
+            break;
+        }
+    }
+}
+
+
+#[cfg(test)]
+mod tests {
+
+    use super::*;
+
+    use crate::flow_analyzer::BasicBlock;
+    use crate::irc::IRCode;
+
+
+    fn tn(id: usize) -> Tn {
+        Tn { id: TnID(id), data_type: Arc::new(DataType::U64) }
+    }
+
+
+    fn node(op: IROperator) -> IRNode {
+        IRNode { op, has_side_effects: false }
+    }
+
+
+    fn constant(value: u64) -> IRValue {
+        IRValue::Const(Arc::new(LiteralValue::Numeric(Number::Uint(value))))
+    }
+
+
+    #[test]
+    fn test_optimize_function() {
+
+        let mut code = IRCode::new();
+        code.push_back(node(IROperator::Assign { target: tn(1), source: constant(2) }));
+        code.push_back(node(IROperator::Copy { target: tn(2), source: constant(3) }));
+        code.push_back(node(IROperator::Mul { target: tn(3), left: IRValue::Tn(tn(1)), right: IRValue::Tn(tn(2)) }));
+        // T4 is never read
+        code.push_back(node(IROperator::Add { target: tn(4), left: IRValue::Tn(tn(3)), right: IRValue::Tn(tn(5)) }));
+        code.push_back(node(IROperator::Mul { target: tn(6), left: IRValue::Tn(tn(5)), right: IRValue::Tn(tn(3)) }));
+        code.push_back(node(IROperator::Mul { target: tn(7), left: IRValue::Tn(tn(3)), right: IRValue::Tn(tn(5)) }));
+        code.push_back(node(IROperator::Add { target: tn(0), left: IRValue::Tn(tn(6)), right: IRValue::Tn(tn(7)) }));
+        // T0 holds the return value
+        code.push_back(node(IROperator::Return { value: Some(tn(0)) }));
+
+        let mut function_graph: FunctionGraph = vec![BasicBlock::new(code)];
+
+        optimize_function(&mut function_graph, &OptimizationFlags::all());
+
+        let code: Vec<String> = function_graph[0].code.iter().map(|ir_node| ir_node.op.to_string()).collect();
+        assert_eq!(code, [
+            "T6 = T5 * 6",
+            "T0 = T6 + T6",
+            "return T0",
+        ]);
+    }
+
+}
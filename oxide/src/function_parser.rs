@@ -1,5 +1,6 @@
 use std::mem;
 use std::rc::Rc;
+use std::sync::Arc;
 
 use crate::cli_parser::OptimizationFlags;
 use crate::match_unreachable;
@@ -17,7 +18,7 @@ pub struct Function<'a> {
 
     pub name: &'a str,
     pub code: ScopeBlock<'a>,
-    pub signature: Rc<DataType>,
+    pub signature: Arc<DataType>,
     pub parent_scope: ScopeID,
     /// Whether the function has non-local side effects (e.g. modifying a global variable, I/O, etc.)
     pub has_side_effects: bool,
@@ -27,7 +28,7 @@ pub struct Function<'a> {
 
 impl Function<'_> {
 
-    pub fn new<'a>(name: &'a str, body: ScopeBlock<'a>, signature: Rc<DataType>, parent_scope: ScopeID, marked_const: bool) -> Function<'a> {
+    pub fn new<'a>(name: &'a str, body: ScopeBlock<'a>, signature: Arc<DataType>, parent_scope: ScopeID, marked_const: bool) -> Function<'a> {
         Function {
             name,
             code: body,
@@ -38,7 +39,7 @@ impl Function<'_> {
         }
     }
 
-    pub fn return_type(&self) -> Rc<DataType> {
+    pub fn return_type(&self) -> Arc<DataType> {
         match_unreachable!(DataType::Function { return_type, .. } = self.signature.as_ref(), return_type).clone()
     }
 
@@ -438,7 +439,7 @@ fn evaluate_constants_functions(functions: &mut [Function], symbol_table: &mut S
 
 
 /// Resolve and check the types of symbols and expressions.
-fn resolve_scope_types(block: &mut ScopeBlock, outer_function_return: Option<Rc<DataType>>, function_parent_scope: ScopeID, symbol_table: &mut SymbolTable, source: &SourceCode) {
+fn resolve_scope_types(block: &mut ScopeBlock, outer_function_return: Option<Arc<DataType>>, function_parent_scope: ScopeID, symbol_table: &mut SymbolTable, source: &SourceCode) {
     // Perform a depth-first traversal of the scope tree to determine the types in a top-to-bottom order (relative to the source code).
     // For every node in every scope, determine the node data type and check if it matches the expected type.
 
@@ -810,7 +811,7 @@ fn evaluate_constants_block(block: &mut ScopeBlock, source: &SourceCode, symbol_
 
 
 /// Recursively resolve the type of this expression and check if its children have the correct types.
-fn resolve_expression_types(expression: &mut SyntaxNode, scope_id: ScopeID, outer_function_return: Option<Rc<DataType>>, function_parent_scope: ScopeID, symbol_table: &mut SymbolTable, source: &SourceCode) {
+fn resolve_expression_types(expression: &mut SyntaxNode, scope_id: ScopeID, outer_function_return: Option<Arc<DataType>>, function_parent_scope: ScopeID, symbol_table: &mut SymbolTable, source: &SourceCode) {
 
     /// Assert that, if the node is a symbol, it is initialized.
     /// Not all operators require their operands to be initialized (l_value of assignment, ref)
@@ -1181,7 +1182,7 @@ fn resolve_expression_types(expression: &mut SyntaxNode, scope_id: ScopeID, oute
                         (DataType::Array { element_type: DataType::Void.into(), size: Some(0) }, true, DataType::Void.into())
                     } else {
         
-                        let mut element_type: Option<Rc<DataType>> = None;
+                        let mut element_type: Option<Arc<DataType>> = None;
         
                         let mut is_literal_array = true;
                         for element in elements.iter_mut() {
@@ -1308,7 +1309,7 @@ fn resolve_expression_types(expression: &mut SyntaxNode, scope_id: ScopeID, oute
             // Recursively resolve the types of the if-else chain
             // The return type of the chain is the return type of the conditional blocks
 
-            let mut chain_return_type: Option<Rc<DataType>> = None;
+            let mut chain_return_type: Option<Arc<DataType>> = None;
 
             for if_block in if_blocks {
                 resolve_expression_types(&mut if_block.condition, scope_id, outer_function_return.clone(), function_parent_scope, symbol_table, source);
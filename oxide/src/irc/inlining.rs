@@ -0,0 +1,411 @@
+use std::collections::HashMap;
+
+use super::ir_parser::IRIDGenerator;
+use super::{FunctionIR, IRJumpTarget, IRNode, IROperator, IRValue, Label, LabelID, Tn, TnID};
+
+
+/// Functions with more operations than this are not inlined, since copying their body at every call site would bloat the code.
+/// The function's label, scope and return operations are not counted because inlining removes them
+const MAX_INLINED_FUNCTION_SIZE: usize = 16;
+
+
+fn is_function_frame(op: &IROperator) -> bool {
+    matches!(op, IROperator::Label { .. } | IROperator::PushScope { .. } | IROperator::PopScope { .. } | IROperator::Return { .. })
+}
+
+
+/// Number of operations the function's body is made of
+fn body_size(function: &FunctionIR) -> usize {
+    function.code.borrow().iter()
+        .filter(|ir_node| !is_function_frame(&ir_node.op))
+        .count()
+}
+
+
+/// Return, for every function, whether it can call itself, directly or through other functions
+fn recursive_functions(ir_functions: &[FunctionIR], function_indices: &HashMap<LabelID, usize>) -> Vec<bool> {
+
+    let callees: Vec<Vec<usize>> = ir_functions.iter().map(|function|
+        function.code.borrow().iter()
+            .filter_map(|ir_node| match &ir_node.op {
+                IROperator::Call { callable: IRJumpTarget::Label(label), .. } => function_indices.get(&label.0).copied(),
+                _ => None
+            })
+            .collect()
+    ).collect();
+
+    (0..ir_functions.len()).map(|function| {
+        let mut visited = vec![false; ir_functions.len()];
+        let mut to_visit = callees[function].clone();
+        while let Some(callee) = to_visit.pop() {
+            if callee == function {
+                return true;
+            }
+            if !visited[callee] {
+                visited[callee] = true;
+                to_visit.extend(&callees[callee]);
+            }
+        }
+        false
+    }).collect()
+}
+
+
+/// Copy the body of the callee, giving its Tns and labels new ids so that it can be inlined any number of times.
+/// The callee's return value is assigned to the call's return target and its returns jump to the call's return label
+fn inline_body(callee: &FunctionIR, return_target: Option<&Tn>, return_label: Label, irid_gen: &mut IRIDGenerator) -> Vec<IRNode> {
+
+    let code = callee.code.borrow();
+
+    let labels: HashMap<LabelID, Label> = code.iter()
+        .filter_map(|ir_node| match ir_node.op {
+            IROperator::Label { label } => Some((label.0, irid_gen.next_label())),
+            _ => None
+        })
+        .collect();
+
+    let mut tns: HashMap<TnID, TnID> = HashMap::new();
+    let mut rename = |tn: &mut Tn, irid_gen: &mut IRIDGenerator| {
+        tn.id = *tns.entry(tn.id).or_insert_with(|| irid_gen.next_tn());
+    };
+
+    let mut inlined: Vec<IRNode> = Vec::with_capacity(code.estimated_length());
+
+    for ir_node in code.iter() {
+
+        match &ir_node.op {
+
+            // The callee's Tns live in the caller's frame, so the callee doesn't push its own scope
+            IROperator::Label { label } if *label == callee.function_labels.start => {},
+            IROperator::PushScope { .. } |
+            IROperator::PopScope { .. } => {},
+
+            IROperator::Return { value } => {
+                if let (Some(target), Some(value)) = (return_target, value) {
+                    let mut value = value.clone();
+                    rename(&mut value, irid_gen);
+                    inlined.push(IRNode {
+                        op: IROperator::Assign { target: target.clone(), source: IRValue::Tn(value) },
+                        has_side_effects: false
+                    });
+                }
+                inlined.push(IRNode {
+                    op: IROperator::Jump { target: return_label },
+                    has_side_effects: false
+                });
+            },
+
+            _ => {
+                let mut ir_node = ir_node.clone();
+                for tn in ir_node.op.tns_mut() {
+                    rename(tn, irid_gen);
+                }
+                for label in ir_node.op.labels_mut() {
+                    if let Some(&new_label) = labels.get(&label.0) {
+                        *label = new_label;
+                    }
+                }
+                inlined.push(ir_node);
+            }
+        }
+    }
+
+    // The return label follows the call, so the final jump to it is useless
+    if matches!(inlined.last(), Some(IRNode { op: IROperator::Jump { target }, .. }) if *target == return_label) {
+        inlined.pop();
+    }
+
+    inlined
+}
+
+
+/// Replace the calls to small functions with the body of the called function.
+///
+/// Recursive functions are never inlined, so the inlining always terminates.
+/// Calls that pass arguments are not inlined because the IR doesn't bind parameters to Tns yet
+pub fn inline_functions(ir_functions: &[FunctionIR], irid_gen: &mut IRIDGenerator) {
+
+    let function_indices: HashMap<LabelID, usize> = ir_functions.iter().enumerate()
+        .map(|(i, function)| (function.function_labels.start.0, i))
+        .collect();
+
+    let recursive = recursive_functions(ir_functions, &function_indices);
+
+    for (caller_index, caller) in ir_functions.iter().enumerate() {
+
+        let mut code = caller.code.borrow_mut();
+
+        let mut node_ptr = unsafe { code.head() };
+        while let Some(node) = unsafe { node_ptr.as_mut() } {
+
+            let next_ptr = unsafe { node.next() };
+
+            let callee = match &node.data.op {
+                IROperator::Call { callable: IRJumpTarget::Label(label), args, tail: false, .. } if args.is_empty()
+                    => function_indices.get(&label.0).copied(),
+                _ => None
+            }.filter(|&callee|
+                callee != caller_index && !recursive[callee] && body_size(&ir_functions[callee]) <= MAX_INLINED_FUNCTION_SIZE
+            );
+
+            let Some(callee) = callee else {
+                node_ptr = next_ptr;
+                continue;
+            };
+
+            let IROperator::Call { return_target, return_label, .. } = &node.data.op else {
+                unreachable!()
+            };
+
+            let inlined = inline_body(&ir_functions[callee], return_target.as_ref(), *return_label, irid_gen);
+
+            let prev_ptr = unsafe { node.prev() };
+            for ir_node in inlined {
+                unsafe { code.insert_before(node_ptr, ir_node) };
+            }
+            unsafe { code.remove(node_ptr) };
+
+            // Continue from the inlined body, so that the calls it contains can be inlined too
+            node_ptr = if prev_ptr.is_null() {
+                unsafe { code.head() }
+            } else {
+                unsafe { (*prev_ptr).next() }
+            };
+        }
+    }
+}
+
+
+#[cfg(test)]
+mod tests {
+
+    use std::sync::Arc;
+
+    use super::*;
+
+    use crate::lang::data_types::{DataType, LiteralValue, Number};
+    use crate::symbol_table::ScopeID;
+
+
+    fn tn(irid_gen: &mut IRIDGenerator) -> Tn {
+        Tn { id: irid_gen.next_tn(), data_type: Arc::new(DataType::U64) }
+    }
+
+
+    fn constant(value: u64) -> IRValue {
+        IRValue::Const(Arc::new(LiteralValue::Numeric(Number::Uint(value))))
+    }
+
+
+    /// Build a function made of the given body, wrapped in its label, scope and return
+    fn function<'a>(name: &'a str, body: Vec<IROperator>, return_value: Option<Tn>, irid_gen: &mut IRIDGenerator) -> FunctionIR<'a> {
+        let mut function = FunctionIR::new(name, ScopeID::placeholder(), irid_gen);
+        push_body(&mut function, body, return_value);
+        function
+    }
+
+
+    fn push_body(function: &mut FunctionIR, body: Vec<IROperator>, return_value: Option<Tn>) {
+        let start = function.function_labels.start;
+        let ops = [IROperator::Label { label: start }, IROperator::PushScope { bytes: 8 }].into_iter()
+            .chain(body)
+            .chain([IROperator::PopScope { bytes: 8 }, IROperator::Return { value: return_value }]);
+        for op in ops {
+            function.push_code(IRNode { op, has_side_effects: false });
+        }
+    }
+
+
+    fn call(callee: &FunctionIR, return_target: Option<Tn>, args: Vec<IRValue>, irid_gen: &mut IRIDGenerator) -> Vec<IROperator> {
+        let return_label = irid_gen.next_label();
+        vec![
+            IROperator::Call { return_target, return_label, callable: IRJumpTarget::Label(callee.function_labels.start), args, tail: false },
+            IROperator::Label { label: return_label },
+        ]
+    }
+
+
+    fn ops(function: &FunctionIR) -> Vec<IROperator> {
+        function.code.borrow().iter().map(|ir_node| ir_node.op.clone()).collect()
+    }
+
+
+    fn calls(function: &FunctionIR) -> usize {
+        function.code.borrow().iter().filter(|ir_node| matches!(ir_node.op, IROperator::Call { .. })).count()
+    }
+
+
+    #[test]
+    fn test_inline_return_value() {
+
+        let mut irid_gen = IRIDGenerator::new();
+
+        // fn callee { loop: T0 = 5; T1 = T0 + 1; if T1 goto loop; return T1 }
+        let (t0, t1) = (tn(&mut irid_gen), tn(&mut irid_gen));
+        let callee_loop = irid_gen.next_label();
+        let callee = function("callee", vec![
+            IROperator::Label { label: callee_loop },
+            IROperator::Assign { target: t0.clone(), source: constant(5) },
+            IROperator::Add { target: t1.clone(), left: IRValue::Tn(t0.clone()), right: constant(1) },
+            IROperator::JumpIf { condition: t1.clone(), target: callee_loop },
+        ], Some(t1.clone()), &mut irid_gen);
+        let callee_code = ops(&callee);
+
+        // fn caller { T2 = callee(); return T2 }
+        let t2 = tn(&mut irid_gen);
+        let caller_body = call(&callee, Some(t2.clone()), Vec::new(), &mut irid_gen);
+        let caller = function("caller", caller_body, Some(t2.clone()), &mut irid_gen);
+
+        let functions = [callee, caller];
+        inline_functions(&functions, &mut irid_gen);
+
+        // The callee itself doesn't change
+        assert_eq!(format!("{:?}", ops(&functions[0])), format!("{:?}", callee_code));
+
+        let caller_code = ops(&functions[1]);
+        assert_eq!(calls(&functions[1]), 0);
+
+        // The callee's Tns and labels are renamed, and its return value is assigned to the call's return target
+        let [
+            IROperator::Label { .. }, IROperator::PushScope { bytes: 8 },
+            IROperator::Label { label: inlined_loop },
+            IROperator::Assign { target: inlined_t0, source: IRValue::Const(_) },
+            IROperator::Add { target: inlined_t1, left: IRValue::Tn(added), right: IRValue::Const(_) },
+            IROperator::JumpIf { condition, target: jump_target },
+            IROperator::Assign { target: return_target, source: IRValue::Tn(returned) },
+            IROperator::Label { .. },
+            IROperator::PopScope { bytes: 8 }, IROperator::Return { value: Some(returned_by_caller) },
+        ] = caller_code.as_slice() else {
+            panic!("Unexpected inlined code: {:?}", caller_code)
+        };
+
+        assert_ne!(*inlined_loop, callee_loop);
+        assert_eq!(jump_target, inlined_loop);
+        assert!(inlined_t0.id != t0.id && inlined_t0.id != t1.id);
+        assert!(inlined_t1.id != t0.id && inlined_t1.id != t1.id && inlined_t1.id != inlined_t0.id);
+        assert_eq!(added.id, inlined_t0.id);
+        assert_eq!(condition.id, inlined_t1.id);
+        assert_eq!(returned.id, inlined_t1.id);
+        assert_eq!(return_target.id, t2.id);
+        assert_eq!(returned_by_caller.id, t2.id);
+    }
+
+
+    #[test]
+    fn test_inline_twice() {
+
+        let mut irid_gen = IRIDGenerator::new();
+
+        let t0 = tn(&mut irid_gen);
+        let callee = function("callee", vec![
+            IROperator::Assign { target: t0.clone(), source: constant(1) },
+        ], Some(t0.clone()), &mut irid_gen);
+
+        let (t1, t2) = (tn(&mut irid_gen), tn(&mut irid_gen));
+        let mut caller_body = call(&callee, Some(t1.clone()), Vec::new(), &mut irid_gen);
+        caller_body.extend(call(&callee, Some(t2.clone()), Vec::new(), &mut irid_gen));
+        let caller = function("caller", caller_body, None, &mut irid_gen);
+
+        let functions = [callee, caller];
+        inline_functions(&functions, &mut irid_gen);
+
+        assert_eq!(calls(&functions[1]), 0);
+
+        // Every copy of the body gets its own Tns
+        let assigned: Vec<TnID> = ops(&functions[1]).iter().filter_map(|op| match op {
+            IROperator::Assign { target, source: IRValue::Const(_) } => Some(target.id),
+            _ => None
+        }).collect();
+        assert_eq!(assigned.len(), 2);
+        assert_ne!(assigned[0], assigned[1]);
+        assert!(!assigned.contains(&t0.id));
+    }
+
+
+    #[test]
+    fn test_arguments_are_not_substituted() {
+
+        let mut irid_gen = IRIDGenerator::new();
+
+        let t0 = tn(&mut irid_gen);
+        let callee = function("callee", vec![
+            IROperator::Assign { target: t0.clone(), source: constant(1) },
+        ], Some(t0.clone()), &mut irid_gen);
+
+        // The IR doesn't bind the parameters of the callee to Tns, so the arguments could not be substituted
+        let t1 = tn(&mut irid_gen);
+        let caller_body = call(&callee, Some(t1.clone()), vec![constant(2)], &mut irid_gen);
+        let caller = function("caller", caller_body, Some(t1), &mut irid_gen);
+        let caller_code = ops(&caller);
+
+        let functions = [callee, caller];
+        inline_functions(&functions, &mut irid_gen);
+
+        assert_eq!(format!("{:?}", ops(&functions[1])), format!("{:?}", caller_code));
+    }
+
+
+    #[test]
+    fn test_recursive_functions_are_not_inlined() {
+
+        let mut irid_gen = IRIDGenerator::new();
+
+        // fn recursive { recursive() }
+        let mut recursive = FunctionIR::new("recursive", ScopeID::placeholder(), &mut irid_gen);
+        let recursive_body = call(&recursive, None, Vec::new(), &mut irid_gen);
+        push_body(&mut recursive, recursive_body, None);
+
+        // fn even { odd() }, fn odd { even() }
+        let mut even = FunctionIR::new("even", ScopeID::placeholder(), &mut irid_gen);
+        let mut odd = FunctionIR::new("odd", ScopeID::placeholder(), &mut irid_gen);
+        let even_body = call(&odd, None, Vec::new(), &mut irid_gen);
+        let odd_body = call(&even, None, Vec::new(), &mut irid_gen);
+        push_body(&mut even, even_body, None);
+        push_body(&mut odd, odd_body, None);
+
+        let mut caller_body = call(&recursive, None, Vec::new(), &mut irid_gen);
+        caller_body.extend(call(&even, None, Vec::new(), &mut irid_gen));
+        let caller = function("caller", caller_body, None, &mut irid_gen);
+
+        let functions = [recursive, even, odd, caller];
+        let codes: Vec<String> = functions.iter().map(|function| format!("{:?}", ops(function))).collect();
+
+        inline_functions(&functions, &mut irid_gen);
+
+        for (function, code) in functions.iter().zip(codes) {
+            assert_eq!(format!("{:?}", ops(function)), code, "{} changed", function.name);
+        }
+    }
+
+
+    #[test]
+    fn test_size_threshold() {
+
+        let mut irid_gen = IRIDGenerator::new();
+
+        let body = |size: usize, irid_gen: &mut IRIDGenerator| -> (Vec<IROperator>, Tn) {
+            let target = tn(irid_gen);
+            ((0..size).map(|i| IROperator::Assign { target: target.clone(), source: constant(i as u64) }).collect(), target)
+        };
+
+        let (small_body, small_value) = body(MAX_INLINED_FUNCTION_SIZE, &mut irid_gen);
+        let small = function("small", small_body, Some(small_value), &mut irid_gen);
+        let (large_body, large_value) = body(MAX_INLINED_FUNCTION_SIZE + 1, &mut irid_gen);
+        let large = function("large", large_body, Some(large_value), &mut irid_gen);
+
+        let t0 = tn(&mut irid_gen);
+        let mut caller_body = call(&small, Some(t0.clone()), Vec::new(), &mut irid_gen);
+        caller_body.extend(call(&large, Some(t0.clone()), Vec::new(), &mut irid_gen));
+        let caller = function("caller", caller_body, Some(t0), &mut irid_gen);
+
+        let functions = [small, large, caller];
+        inline_functions(&functions, &mut irid_gen);
+
+        // Only the call to the large function is left
+        let remaining: Vec<IROperator> = ops(&functions[2]).into_iter().filter(|op| matches!(op, IROperator::Call { .. })).collect();
+        assert!(matches!(remaining.as_slice(), [IROperator::Call { callable: IRJumpTarget::Label(label), .. }] if *label == functions[1].function_labels.start));
+        // The caller's frame, the small body with the assignment of its return value, the two return labels and the remaining call
+        assert_eq!(ops(&functions[2]).len(), 4 + (MAX_INLINED_FUNCTION_SIZE + 1) + 2 + 1);
+    }
+
+}
@@ -11,6 +11,7 @@ use crate::lang::data_types::{DataType, LiteralValue, Number};
 use crate::ast::{RuntimeOp, ScopeBlock, SyntaxNode, SyntaxNodeValue};
 
 use super::{FunctionIR, IRJumpTarget, IRNode, IROperator, IRScopeID, IRValue, Label, LabelID, Tn, TnID};
+use super::inlining::inline_functions;
 
 
 /// Generates a sequence of unique ids for the IR code
@@ -276,6 +277,7 @@ fn generate_node<'a>(node: SyntaxNode<'a>, target: Option<Tn>, outer_loop: Optio
                         return_label,
                         callable,
                         args,
+                        tail: false,
                     },
                     has_side_effects: node.has_side_effects // This will be true, but future changes could break this, though unlikely
                 });
@@ -1168,7 +1170,17 @@ fn generate_function<'a>(function: Function<'a>, irid_gen: &mut IRIDGenerator, s
 
     symbol_table.map_function_label(FunctionUUID { name: function.name.to_string(), scope: function.parent_scope }, ir_function.function_labels.start);
 
-    generate_block(function.code, return_tn, None, irid_gen, &mut ir_function, ir_scope, symbol_table, source);
+    // Make the function's code known before generating it, so that recursive calls can jump straight to the function's label
+    {
+        let mut function_symbol = symbol_table.get_function(function.name, function.parent_scope).unwrap().borrow_mut();
+        let function_info = match_unreachable!(SymbolValue::Function(function_info) = &mut function_symbol.value, function_info);
+        function_info.code = Some(FunctionCode {
+            label: ir_function.function_labels.start,
+            code: ir_function.code.clone(),
+        });
+    }
+
+    generate_block(function.code, return_tn.clone(), None, irid_gen, &mut ir_function, ir_scope, symbol_table, source);
 
     ir_function.push_code(IRNode {
         op: IROperator::Label { label: ir_function.function_labels.exit },
@@ -1181,7 +1193,7 @@ fn generate_function<'a>(function: Function<'a>, irid_gen: &mut IRIDGenerator, s
     });
 
     ir_function.push_code(IRNode {
-        op: IROperator::Return,
+        op: IROperator::Return { value: return_tn },
         has_side_effects: false
     });
 
@@ -1295,7 +1307,7 @@ fn remove_unread_operations(ir_function: &mut FunctionIR) {
                 read_tns.insert(condition.id, ());
             },
 
-            IROperator::Call { return_target: _, return_label: _, callable: _, args } => {
+            IROperator::Call { return_target: _, return_label: _, callable: _, args, tail: _ } => {
                 // The function will be called anyway. 
                 // TODO: if there are no side effects to the functions, the call can be removed
 
@@ -1306,9 +1318,15 @@ fn remove_unread_operations(ir_function: &mut FunctionIR) {
                 }
             },
 
+            // The return value is read by the caller
+            IROperator::Return { value } => {
+                if let Some(tn) = value {
+                    read_tns.insert(tn.id, ());
+                }
+            },
+
             IROperator::Jump { target: _ } |
             IROperator::Label { label: _ } |
-            IROperator::Return |
             IROperator::PushScope { bytes: _ } |
             IROperator::PopScope { bytes: _ } |
             IROperator::Nop
@@ -1324,37 +1342,108 @@ fn remove_unread_operations(ir_function: &mut FunctionIR) {
 /// Generate ir code from the given functions
 pub fn generate<'a>(functions: Vec<Function<'a>>, symbol_table: &mut SymbolTable, optimization_flags: &OptimizationFlags, verbose: bool, source: &SourceCode) -> Vec<FunctionIR<'a>> {
 
-    let mut ir_functions = Vec::new();
     let mut irid_gen = IRIDGenerator::new();
 
     if verbose {
         println!("\n\nGenerating IR code for the following functions:");
     }
 
-    for function in functions {
+    let mut ir_functions: Vec<FunctionIR> = functions.into_iter()
+        .map(|function| generate_function(function, &mut irid_gen, symbol_table, source))
+        .collect();
 
-        let mut ir_function = generate_function(function, &mut irid_gen, symbol_table, source);
+    // Functions may be called before they are defined, so they are inlined only once all of them have been generated
+    if optimization_flags.inline_functions {
+        inline_functions(&ir_functions, &mut irid_gen);
+    }
 
-        let mut function_symbol = symbol_table.get_function(ir_function.name, ir_function.parent_scope(symbol_table)).unwrap().borrow_mut();
-        let function_info = match_unreachable!(SymbolValue::Function(function_info) = &mut function_symbol.value, function_info);
-        function_info.code = Some(FunctionCode {
-            label: ir_function.function_labels.start,
-            code: ir_function.code.clone(),
-        });
+    for ir_function in ir_functions.iter_mut() {
 
         if optimization_flags.remove_useless_code {
-            remove_unread_operations(&mut ir_function);
+            remove_unread_operations(ir_function);
         }
 
-        ir_functions.push(
-            ir_function
-        );
-
         if verbose {
-            println!("\n{}\n", ir_functions.last().unwrap());
+            println!("\n{}\n", ir_function);
         }
     }
 
     ir_functions
 }
 
+
+#[cfg(test)]
+mod tests {
+
+    use crate::cli_parser::OptimizationFlags;
+    use crate::test_utils::{compile, SAMPLE_PROGRAM};
+
+
+    #[test]
+    fn test_sample_program_ir() {
+        // Generated before the basic blocks were stored contiguously and before the statement parsing was made linear
+        let expected = "\
+fn three {
+    L0:
+    pushscope 0
+    T0 = 3
+    L1:
+    popscope 0
+    return T0
+}
+fn seven {
+    L2:
+    pushscope 0
+    T27 = 3
+    L16:
+    T2 = T27
+    L4:
+    T3 = 4
+    T1 = T2 + T3
+    L3:
+    popscope 0
+    return T1
+}
+fn main {
+    L5:
+    pushscope 32
+    T5 = 0
+    jump L8
+    L7:
+    T9 = 2
+    copy T9 -> T8
+    T7 = T5 % T8
+    T11 = 0
+    copy T11 -> T10
+    T6 = T7 == T10
+    jumpifnot T6 L10
+    L18:
+    L19:
+    L20:
+    L12:
+    jump L11
+    L10:
+    T16 = 5
+    copy T16 -> T15
+    T14 = T5 == T15
+    jumpifnot T14 L13
+    jump L11
+    L13:
+    L11:
+    T22 = 1
+    copy T22 -> T21
+    T5 = T5 + T21
+    L8:
+    T24 = 10
+    T23 = T5 < T24
+    jumpif T23 L7
+    L9:
+    L6:
+    popscope 32
+    return
+}
+";
+        assert_eq!(compile(SAMPLE_PROGRAM, &OptimizationFlags::all()).ir_code, expected);
+    }
+
+}
@@ -2,6 +2,7 @@ use core::fmt::{Debug, Display};
 
 use std::cell::RefCell;
 use std::rc::Rc;
+use std::sync::Arc;
 use std::collections::HashMap;
 
 use crate::symbol_table::{ScopeDiscriminant, ScopeID, SymbolTable};
@@ -15,7 +16,7 @@ use super::ir_parser::{FunctionLabels, IRIDGenerator};
 #[derive(Debug, Clone)]
 pub struct Tn {
     pub id: TnID,
-    pub data_type: Rc<DataType>,
+    pub data_type: Arc<DataType>,
 }
 
 impl Display for Tn {
@@ -37,10 +38,11 @@ impl Display for Label {
 
 
 /// Represents an operand of ir operations
+#[derive(Clone)]
 pub enum IRValue {
 
     Tn (Tn),
-    Const (Rc<LiteralValue>),
+    Const (Arc<LiteralValue>),
 
 }
 
@@ -61,6 +63,7 @@ impl Display for IRValue {
 }
 
 
+#[derive(Clone)]
 pub enum IRJumpTarget {
 
     Tn (Tn),
@@ -167,7 +170,7 @@ impl<'a> ScopeTable<'a> {
 
 
 /// Represents an intermediate code operation
-#[derive(Debug)]
+#[derive(Debug, Clone)]
 pub enum IROperator {
 
     Add { target: Tn, left: IRValue, right: IRValue },
@@ -211,8 +214,10 @@ pub enum IROperator {
     JumpIfNot { condition: Tn, target: Label },
     Label { label: Label },
 
-    Call { return_target: Option<Tn>, return_label: Label, callable: IRJumpTarget, args: Vec<IRValue> },
-    Return,
+    /// A tail call is the last operation of the function, so the callee can return directly to the caller of the function
+    Call { return_target: Option<Tn>, return_label: Label, callable: IRJumpTarget, args: Vec<IRValue>, tail: bool },
+    /// Return to the caller. `value` holds the return value of the function, if it's not Void
+    Return { value: Option<Tn> },
 
     PushScope { bytes: usize },
     PopScope { bytes: usize },
@@ -222,6 +227,243 @@ pub enum IROperator {
 
 }
 
+impl IROperator {
+
+    /// Return the Tn the operation assigns to, if any.
+    /// Operations that write through a pointer read the pointer Tn instead of assigning to it
+    pub fn defined_tn(&self) -> Option<&Tn> {
+        match self {
+            IROperator::Add { target, .. } |
+            IROperator::Sub { target, .. } |
+            IROperator::Mul { target, .. } |
+            IROperator::Div { target, .. } |
+            IROperator::Mod { target, .. } |
+            IROperator::Assign { target, .. } |
+            IROperator::Deref { target, .. } |
+            IROperator::Ref { target, .. } |
+            IROperator::Greater { target, .. } |
+            IROperator::Less { target, .. } |
+            IROperator::GreaterEqual { target, .. } |
+            IROperator::LessEqual { target, .. } |
+            IROperator::Equal { target, .. } |
+            IROperator::NotEqual { target, .. } |
+            IROperator::BitShiftLeft { target, .. } |
+            IROperator::BitShiftRight { target, .. } |
+            IROperator::BitNot { target, .. } |
+            IROperator::BitAnd { target, .. } |
+            IROperator::BitOr { target, .. } |
+            IROperator::BitXor { target, .. } |
+            IROperator::Copy { target, .. }
+                => Some(target),
+
+            IROperator::Call { return_target, .. } => return_target.as_ref(),
+
+            IROperator::DerefAssign { .. } |
+            IROperator::DerefCopy { .. } |
+            IROperator::Jump { .. } |
+            IROperator::JumpIf { .. } |
+            IROperator::JumpIfNot { .. } |
+            IROperator::Label { .. } |
+            IROperator::Return { .. } |
+            IROperator::PushScope { .. } |
+            IROperator::PopScope { .. } |
+            IROperator::Nop
+                => None
+        }
+    }
+
+
+    /// Return the Tns the operation reads
+    pub fn used_tns(&self) -> Vec<&Tn> {
+
+        fn tn(value: &IRValue) -> Option<&Tn> {
+            match value {
+                IRValue::Tn(tn) => Some(tn),
+                IRValue::Const(_) => None
+            }
+        }
+
+        match self {
+            IROperator::Add { left, right, .. } |
+            IROperator::Sub { left, right, .. } |
+            IROperator::Mul { left, right, .. } |
+            IROperator::Div { left, right, .. } |
+            IROperator::Mod { left, right, .. } |
+            IROperator::Greater { left, right, .. } |
+            IROperator::Less { left, right, .. } |
+            IROperator::GreaterEqual { left, right, .. } |
+            IROperator::LessEqual { left, right, .. } |
+            IROperator::Equal { left, right, .. } |
+            IROperator::NotEqual { left, right, .. } |
+            IROperator::BitShiftLeft { left, right, .. } |
+            IROperator::BitShiftRight { left, right, .. } |
+            IROperator::BitAnd { left, right, .. } |
+            IROperator::BitOr { left, right, .. } |
+            IROperator::BitXor { left, right, .. }
+                => tn(left).into_iter().chain(tn(right)).collect(),
+
+            IROperator::Assign { source: operand, .. } |
+            IROperator::Deref { ref_: operand, .. } |
+            IROperator::BitNot { operand, .. } |
+            IROperator::Copy { source: operand, .. }
+                => tn(operand).into_iter().collect(),
+
+            IROperator::DerefAssign { target, source } |
+            IROperator::DerefCopy { target, source }
+                => std::iter::once(target).chain(tn(source)).collect(),
+
+            IROperator::Ref { ref_, .. } => vec![ref_],
+
+            IROperator::JumpIf { condition, .. } |
+            IROperator::JumpIfNot { condition, .. }
+                => vec![condition],
+
+            IROperator::Call { callable, args, .. } => {
+                let callable = match callable {
+                    IRJumpTarget::Tn(tn) => Some(tn),
+                    IRJumpTarget::Label(_) => None
+                };
+                callable.into_iter().chain(args.iter().filter_map(tn)).collect()
+            },
+
+            IROperator::Return { value } => value.iter().collect(),
+
+            IROperator::Jump { .. } |
+            IROperator::Label { .. } |
+            IROperator::PushScope { .. } |
+            IROperator::PopScope { .. } |
+            IROperator::Nop
+                => Vec::new()
+        }
+    }
+
+
+    /// Return the operands of the operation that can be replaced by any value.
+    /// Tn-only operands, like jump conditions and pointers, are not included
+    pub fn operands_mut(&mut self) -> Vec<&mut IRValue> {
+        match self {
+            IROperator::Add { left, right, .. } |
+            IROperator::Sub { left, right, .. } |
+            IROperator::Mul { left, right, .. } |
+            IROperator::Div { left, right, .. } |
+            IROperator::Mod { left, right, .. } |
+            IROperator::Greater { left, right, .. } |
+            IROperator::Less { left, right, .. } |
+            IROperator::GreaterEqual { left, right, .. } |
+            IROperator::LessEqual { left, right, .. } |
+            IROperator::Equal { left, right, .. } |
+            IROperator::NotEqual { left, right, .. } |
+            IROperator::BitShiftLeft { left, right, .. } |
+            IROperator::BitShiftRight { left, right, .. } |
+            IROperator::BitAnd { left, right, .. } |
+            IROperator::BitOr { left, right, .. } |
+            IROperator::BitXor { left, right, .. }
+                => vec![left, right],
+
+            IROperator::Assign { source: operand, .. } |
+            IROperator::Deref { ref_: operand, .. } |
+            IROperator::BitNot { operand, .. } |
+            IROperator::Copy { source: operand, .. } |
+            IROperator::DerefAssign { source: operand, .. } |
+            IROperator::DerefCopy { source: operand, .. }
+                => vec![operand],
+
+            IROperator::Call { args, .. } => args.iter_mut().collect(),
+
+            IROperator::Ref { .. } |
+            IROperator::JumpIf { .. } |
+            IROperator::JumpIfNot { .. } |
+            IROperator::Jump { .. } |
+            IROperator::Label { .. } |
+            IROperator::Return { .. } |
+            IROperator::PushScope { .. } |
+            IROperator::PopScope { .. } |
+            IROperator::Nop
+                => Vec::new()
+        }
+    }
+
+
+    /// Return every Tn the operation assigns or reads
+    pub fn tns_mut(&mut self) -> Vec<&mut Tn> {
+
+        fn tn(value: &mut IRValue) -> Option<&mut Tn> {
+            match value {
+                IRValue::Tn(tn) => Some(tn),
+                IRValue::Const(_) => None
+            }
+        }
+
+        match self {
+            IROperator::Add { target, left, right } |
+            IROperator::Sub { target, left, right } |
+            IROperator::Mul { target, left, right } |
+            IROperator::Div { target, left, right } |
+            IROperator::Mod { target, left, right } |
+            IROperator::Greater { target, left, right } |
+            IROperator::Less { target, left, right } |
+            IROperator::GreaterEqual { target, left, right } |
+            IROperator::LessEqual { target, left, right } |
+            IROperator::Equal { target, left, right } |
+            IROperator::NotEqual { target, left, right } |
+            IROperator::BitShiftLeft { target, left, right } |
+            IROperator::BitShiftRight { target, left, right } |
+            IROperator::BitAnd { target, left, right } |
+            IROperator::BitOr { target, left, right } |
+            IROperator::BitXor { target, left, right }
+                => std::iter::once(target).chain(tn(left)).chain(tn(right)).collect(),
+
+            IROperator::Assign { target, source: operand } |
+            IROperator::Deref { target, ref_: operand } |
+            IROperator::DerefAssign { target, source: operand } |
+            IROperator::BitNot { target, operand } |
+            IROperator::Copy { target, source: operand } |
+            IROperator::DerefCopy { target, source: operand }
+                => std::iter::once(target).chain(tn(operand)).collect(),
+
+            IROperator::Ref { target, ref_ } => vec![target, ref_],
+
+            IROperator::JumpIf { condition, .. } |
+            IROperator::JumpIfNot { condition, .. }
+                => vec![condition],
+
+            IROperator::Call { return_target, callable, args, .. } => {
+                let callable = match callable {
+                    IRJumpTarget::Tn(tn) => Some(tn),
+                    IRJumpTarget::Label(_) => None
+                };
+                return_target.iter_mut().chain(callable).chain(args.iter_mut().filter_map(tn)).collect()
+            },
+
+            IROperator::Return { value } => value.iter_mut().collect(),
+
+            IROperator::Jump { .. } |
+            IROperator::Label { .. } |
+            IROperator::PushScope { .. } |
+            IROperator::PopScope { .. } |
+            IROperator::Nop
+                => Vec::new()
+        }
+    }
+
+
+    /// Return the labels the operation defines or jumps to.
+    /// The label of a called function is not included, since it belongs to the function
+    pub fn labels_mut(&mut self) -> Vec<&mut Label> {
+        match self {
+            IROperator::Jump { target } |
+            IROperator::JumpIf { target, .. } |
+            IROperator::JumpIfNot { target, .. } |
+            IROperator::Label { label: target } |
+            IROperator::Call { return_label: target, .. }
+                => vec![target],
+
+            _ => Vec::new()
+        }
+    }
+
+}
+
 impl Display for IROperator {
     fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
         match self {
@@ -250,8 +492,8 @@ impl Display for IROperator {
             IROperator::JumpIf { condition, target } => write!(f, "jumpif {} {}", condition, target),
             IROperator::JumpIfNot { condition, target } => write!(f, "jumpifnot {} {}", condition, target),
             IROperator::Label { label } => write!(f, "{}:", label),
-            IROperator::Call { return_target, return_label, callable, args } => write!(f, "{}call {callable} {:?} (return: {return_label})", if let Some(target) = return_target { format!("{target} = ") } else { "".to_string() }, args),
-            IROperator::Return => write!(f, "return"),
+            IROperator::Call { return_target, return_label, callable, args, tail } => write!(f, "{}{}call {callable} {:?} (return: {return_label})", if let Some(target) = return_target { format!("{target} = ") } else { "".to_string() }, if *tail { "tail " } else { "" }, args),
+            IROperator::Return { value } => if let Some(value) = value { write!(f, "return {}", value) } else { write!(f, "return") },
             IROperator::PushScope { bytes } => write!(f, "pushscope {}", bytes),
             IROperator::PopScope { bytes } => write!(f, "popscope {}", bytes),
             IROperator::Nop => write!(f, "nop"),
@@ -262,7 +504,7 @@ impl Display for IROperator {
 }
 
 
-#[derive(Debug)]
+#[derive(Debug, Clone)]
 pub struct IRNode {
 
     pub op: IROperator,
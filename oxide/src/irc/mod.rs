@@ -1,6 +1,7 @@
 
 mod ir_parser;
 mod ir_structs;
+mod inlining;
 
 pub use ir_parser::generate;
 pub use ir_structs::*;
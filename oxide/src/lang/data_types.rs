@@ -1,6 +1,6 @@
 use std::borrow::Cow;
 use std::fmt::{Display, Debug};
-use std::rc::Rc;
+use std::sync::Arc;
 
 use crate::match_unreachable;
 use crate::symbol_table::{StaticID, SymbolTable};
@@ -19,8 +19,8 @@ pub enum DataType {
     RawString { length: usize },
     String,
 
-    Array { element_type: Rc<DataType>, size: Option<usize> },
-    Ref { target: Rc<DataType>, mutable: bool },
+    Array { element_type: Arc<DataType>, size: Option<usize> },
+    Ref { target: Arc<DataType>, mutable: bool },
     StringRef { length: usize },
 
     I8,
@@ -39,7 +39,7 @@ pub enum DataType {
     Usize,
     Isize,
 
-    Function { params: Vec<Rc<DataType>>, return_type: Rc<DataType> },
+    Function { params: Vec<Arc<DataType>>, return_type: Arc<DataType> },
 
     Void,
     
@@ -464,20 +464,20 @@ pub enum LiteralValue {
     Char (char),
     StaticString (StaticID),
 
-    Array { element_type: Rc<DataType>, items: Vec<Rc<LiteralValue>> },
+    Array { element_type: Arc<DataType>, items: Vec<Arc<LiteralValue>> },
 
     Numeric (Number),
 
     Bool (bool),
 
     // TODO: probably we should use a RefCell here to allow for runtime mutability when evaluating constant operations.
-    Ref { target: Rc<LiteralValue>, mutable: bool }
+    Ref { target: Arc<LiteralValue>, mutable: bool }
 
 }
 
 impl LiteralValue {
 
-    pub fn assume_array(&self) -> (&Rc<DataType>, &[Rc<LiteralValue>]) {
+    pub fn assume_array(&self) -> (&Arc<DataType>, &[Arc<LiteralValue>]) {
         match self {
             LiteralValue::Array { element_type, items } => (element_type, items),
             _ => unreachable!("Cannot assume array value from {:?}", self)
@@ -498,7 +498,7 @@ impl LiteralValue {
         }
     }
 
-    pub fn assume_ref(&self) -> (&Rc<LiteralValue>, bool) {
+    pub fn assume_ref(&self) -> (&Arc<LiteralValue>, bool) {
         match self {
             LiteralValue::Ref { target, mutable } => (target, *mutable),
             _ => unreachable!("Cannot assume reference value from {:?}", self)
@@ -508,7 +508,7 @@ impl LiteralValue {
     /// Assumes that the source value is castable to the target type. This should have been checked during type resolution.
     /// 
     /// This function can perform only compile-time casts.
-    pub fn from_cast(src_value: &LiteralValue, src_type: &DataType, target_type: &DataType) -> Rc<Self> {
+    pub fn from_cast(src_value: &LiteralValue, src_type: &DataType, target_type: &DataType) -> Arc<Self> {
         
         assert!(src_type.is_castable_to(target_type));
 
@@ -663,7 +663,7 @@ impl Display for LiteralValue {
 #[cfg(test)]
 mod tests {
     use super::*;
-    use std::rc::Rc;
+    use std::sync::Arc;
 
     use super::DataType;
 
@@ -717,32 +717,32 @@ mod tests {
 
         // Array implicit casts
         assert_implicitly_castable!(
-            DataType::Array { element_type: Rc::new(DataType::I8), size: Some(3) },
-            DataType::Array { element_type: Rc::new(DataType::I16), size: Some(3) }
+            DataType::Array { element_type: Arc::new(DataType::I8), size: Some(3) },
+            DataType::Array { element_type: Arc::new(DataType::I16), size: Some(3) }
         );
 
         // Array of positive signed integers can be cast to array of unsigned integers.
-        let a = LiteralValue::Array { element_type: Rc::new(DataType::I32), items: vec![
+        let a = LiteralValue::Array { element_type: Arc::new(DataType::I32), items: vec![
             LiteralValue::Numeric(Number::Int(1)).into(),
             LiteralValue::Numeric(Number::Int(2)).into(),
             LiteralValue::Numeric(Number::Int(3)).into(),
         ]};
-            assert!(DataType::Array { element_type: Rc::new(DataType::I32), size: Some(3) }.is_implicitly_castable_to(&DataType::Array { element_type: Rc::new(DataType::U8), size: Some(3) }, Some(&a)));
-            assert!(DataType::Array { element_type: Rc::new(DataType::I32), size: Some(3) }.is_implicitly_castable_to(&DataType::Array { element_type: Rc::new(DataType::U16), size: Some(3) }, Some(&a)));
-            assert!(DataType::Array { element_type: Rc::new(DataType::I32), size: Some(3) }.is_implicitly_castable_to(&DataType::Array { element_type: Rc::new(DataType::U32), size: Some(3) }, Some(&a)));
-            assert!(DataType::Array { element_type: Rc::new(DataType::I32), size: Some(3) }.is_implicitly_castable_to(&DataType::Array { element_type: Rc::new(DataType::U64), size: Some(3) }, Some(&a)));
+            assert!(DataType::Array { element_type: Arc::new(DataType::I32), size: Some(3) }.is_implicitly_castable_to(&DataType::Array { element_type: Arc::new(DataType::U8), size: Some(3) }, Some(&a)));
+            assert!(DataType::Array { element_type: Arc::new(DataType::I32), size: Some(3) }.is_implicitly_castable_to(&DataType::Array { element_type: Arc::new(DataType::U16), size: Some(3) }, Some(&a)));
+            assert!(DataType::Array { element_type: Arc::new(DataType::I32), size: Some(3) }.is_implicitly_castable_to(&DataType::Array { element_type: Arc::new(DataType::U32), size: Some(3) }, Some(&a)));
+            assert!(DataType::Array { element_type: Arc::new(DataType::I32), size: Some(3) }.is_implicitly_castable_to(&DataType::Array { element_type: Arc::new(DataType::U64), size: Some(3) }, Some(&a)));
 
             // Array with negative integers can only be cast to array of signed integers, not unsigned integers.
-            let b = LiteralValue::Array { element_type: Rc::new(DataType::I32), items: vec![
+            let b = LiteralValue::Array { element_type: Arc::new(DataType::I32), items: vec![
                 LiteralValue::Numeric(Number::Int(1)).into(),
                 LiteralValue::Numeric(Number::Int(-2)).into(),
                 LiteralValue::Numeric(Number::Int(3)).into(),
             ]};
-            assert!(DataType::Array { element_type: Rc::new(DataType::I32), size: Some(3) }.is_implicitly_castable_to(&DataType::Array { element_type: Rc::new(DataType::I64), size: Some(3) }, Some(&b)));
-            assert!(!DataType::Array { element_type: Rc::new(DataType::I32), size: Some(3) }.is_implicitly_castable_to(&DataType::Array { element_type: Rc::new(DataType::U8), size: Some(3) }, Some(&b)));
-            assert!(!DataType::Array { element_type: Rc::new(DataType::I32), size: Some(3) }.is_implicitly_castable_to(&DataType::Array { element_type: Rc::new(DataType::U16), size: Some(3) }, Some(&b)));
-            assert!(!DataType::Array { element_type: Rc::new(DataType::I32), size: Some(3) }.is_implicitly_castable_to(&DataType::Array { element_type: Rc::new(DataType::U32), size: Some(3) }, Some(&b)));
-            assert!(!DataType::Array { element_type: Rc::new(DataType::I32), size: Some(3) }.is_implicitly_castable_to(&DataType::Array { element_type: Rc::new(DataType::U64), size: Some(3) }, Some(&b)));
+            assert!(DataType::Array { element_type: Arc::new(DataType::I32), size: Some(3) }.is_implicitly_castable_to(&DataType::Array { element_type: Arc::new(DataType::I64), size: Some(3) }, Some(&b)));
+            assert!(!DataType::Array { element_type: Arc::new(DataType::I32), size: Some(3) }.is_implicitly_castable_to(&DataType::Array { element_type: Arc::new(DataType::U8), size: Some(3) }, Some(&b)));
+            assert!(!DataType::Array { element_type: Arc::new(DataType::I32), size: Some(3) }.is_implicitly_castable_to(&DataType::Array { element_type: Arc::new(DataType::U16), size: Some(3) }, Some(&b)));
+            assert!(!DataType::Array { element_type: Arc::new(DataType::I32), size: Some(3) }.is_implicitly_castable_to(&DataType::Array { element_type: Arc::new(DataType::U32), size: Some(3) }, Some(&b)));
+            assert!(!DataType::Array { element_type: Arc::new(DataType::I32), size: Some(3) }.is_implicitly_castable_to(&DataType::Array { element_type: Arc::new(DataType::U64), size: Some(3) }, Some(&b)));
         }
 
 }
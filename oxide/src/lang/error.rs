@@ -1,6 +1,7 @@
 use std::cmp::min;
 use std::path::Path;
 use std::rc::Rc;
+use std::sync::Arc;
 
 use indoc::{printdoc, formatdoc};
 use colored::Colorize;
@@ -383,7 +384,7 @@ pub fn illegal_symbol_capture(token: &SourceToken, source: &SourceCode, hint: &s
 }
 
 
-pub fn unknown_sizes(tokens: &[(Rc<SourceToken>, Rc<DataType>)], source: &SourceCode, hint: &str) -> ! {
+pub fn unknown_sizes(tokens: &[(Rc<SourceToken>, Arc<DataType>)], source: &SourceCode, hint: &str) -> ! {
     
     for (token, dt) in tokens {
         printdoc!("
@@ -0,0 +1,14 @@
+mod lang;
+pub mod tokenizer;
+pub mod cli_parser;
+pub mod files;
+pub mod ast;
+pub mod symbol_table;
+mod utils;
+pub mod irc;
+pub mod function_parser;
+pub mod flow_analyzer;
+mod open_linked_list;
+pub mod targets;
+#[cfg(test)]
+mod test_utils;
@@ -1,21 +1,8 @@
-mod lang;
-mod tokenizer;
-mod cli_parser;
-mod files;
-mod ast;
-mod symbol_table;
-mod utils;
-mod irc;
-mod function_parser;
-mod flow_analyzer;
-mod open_linked_list;
-mod targets;
-
 use clap::Parser;
-use cli_parser::{OptimizationFlags, TopLevelCommand};
 
-use crate::cli_parser::CliParser;
-use crate::targets::Targets;
+use oxide::{ast, files, flow_analyzer, function_parser, irc, symbol_table, tokenizer};
+use oxide::cli_parser::{CliParser, OptimizationFlags, TopLevelCommand};
+use oxide::targets::Targets;
 
 
 fn main() {
@@ -73,7 +60,13 @@ fn main() {
 
     let function_graphs = flow_analyzer::flow_graph(ir_code, &optimization_flags, args.verbose);
 
-    let bytecode = args.target().generate(&symbol_table, function_graphs);
+    let bytecode = match args.target().generate(&symbol_table, function_graphs) {
+        Ok(bytecode) => bytecode,
+        Err(e) => {
+            println!("Could not generate code for the target\n{}", e);
+            std::process::exit(1);
+        }
+    };
 
     if let Err(e) = files::save_byte_code(&bytecode, input_file) {
         println!("Could not save bytecode to file: {}", e);
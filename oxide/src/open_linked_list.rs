@@ -95,6 +95,31 @@ impl<T> OpenLinkedList<T> {
     }
 
 
+    /// Insert the item before the node, assuming the node is in the list.
+    ///
+    /// Passing a node that is not in the list is undefined behavior.
+    pub unsafe fn insert_before(&mut self, at: *mut OpenNode<T>, data: T) {
+
+        self.length += 1;
+
+        let at_node = &mut *at;
+
+        let new_node = Box::into_raw(Box::new(OpenNode {
+            data,
+            next: at,
+            prev: at_node.prev,
+        }));
+
+        if at_node.prev.is_null() {
+            self.head = new_node;
+        } else {
+            (*at_node.prev).next = new_node;
+        }
+
+        at_node.prev = new_node;
+    }
+
+
     /// Remove the node from the list, assuming the node is indeed in the list.
     ///
     /// Passing a node that is not in the list is undefined behavior.
@@ -102,7 +127,8 @@ impl<T> OpenLinkedList<T> {
     /// The node will be deallocated and its data will be returned. Accessing the node after calling this method is undefined behavior.
     pub unsafe fn remove(&mut self, node: *mut OpenNode<T>) -> T {
 
-        self.length -= 1;
+        // Split lists don't keep track of their length, so it may already be 0
+        self.length = self.length.saturating_sub(1);
 
         let node = Box::from_raw(node);
 
@@ -207,6 +233,9 @@ impl<T> OpenLinkedList<T> {
 
 }
 
+// The list owns its nodes like a Box does, so it can be moved to another thread along with its items
+unsafe impl<T: Send> Send for OpenLinkedList<T> {}
+
 impl<T> Drop for OpenLinkedList<T> {
     fn drop(&mut self) {
         let mut node_ptr = self.head;
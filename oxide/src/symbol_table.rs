@@ -2,6 +2,7 @@ use std::borrow::Cow;
 use std::cell::RefCell;
 use std::fmt::Display;
 use std::rc::Rc;
+use std::sync::Arc;
 use std::collections::HashMap;
 
 use crate::lang::data_types::{DataType, LiteralValue};
@@ -16,7 +17,7 @@ use crate::tokenizer::SourceToken;
 pub struct Symbol<'a> {
 
     /// The data type this symbol was declared as.
-    pub data_type: Rc<DataType>,
+    pub data_type: Arc<DataType>,
     /// The source code token this symbol was declared at.
     pub token: Rc<SourceToken<'a>>,
     /// The type and value of the symbol.
@@ -41,7 +42,7 @@ impl<'a> Symbol<'a> {
     }
 
 
-    pub fn new_uninitialized(data_type: Rc<DataType>, token: Rc<SourceToken<'a>>, value: SymbolValue<'a>) -> Symbol<'a> {
+    pub fn new_uninitialized(data_type: Arc<DataType>, token: Rc<SourceToken<'a>>, value: SymbolValue<'a>) -> Symbol<'a> {
         Symbol {
             data_type,
             token,
@@ -53,7 +54,7 @@ impl<'a> Symbol<'a> {
     }
 
 
-    pub fn new_function(signature: Rc<DataType>, param_names: Box<[&'a str]>, is_const: bool, token: Rc<SourceToken<'a>>) -> Symbol<'a> {
+    pub fn new_function(signature: Arc<DataType>, param_names: Box<[&'a str]>, is_const: bool, token: Rc<SourceToken<'a>>) -> Symbol<'a> {
         Symbol {
             data_type: signature,
             token,
@@ -70,7 +71,7 @@ impl<'a> Symbol<'a> {
     }
 
 
-    pub fn initialize_immutable(&mut self, value: Rc<LiteralValue>) {
+    pub fn initialize_immutable(&mut self, value: Arc<LiteralValue>) {
 
         assert!(matches!(self.value, SymbolValue::Immutable(None)));
         
@@ -79,7 +80,7 @@ impl<'a> Symbol<'a> {
     }
 
 
-    pub fn get_value(&self) -> Option<Rc<LiteralValue>> {
+    pub fn get_value(&self) -> Option<Arc<LiteralValue>> {
         match &self.value {
             SymbolValue::Mutable => None,
             SymbolValue::Function { .. } => None,
@@ -146,10 +147,10 @@ pub struct FunctionInfo<'a> {
 #[derive(Debug)]
 pub enum SymbolValue<'a> {
     Mutable,
-    Immutable (Option<Rc<LiteralValue>>),
-    Constant (Rc<LiteralValue>),
+    Immutable (Option<Arc<LiteralValue>>),
+    Constant (Arc<LiteralValue>),
     Function (FunctionInfo<'a>),
-    Static { init_value: Rc<LiteralValue>, mutable: bool },
+    Static { init_value: Arc<LiteralValue>, mutable: bool },
 
     UninitializedConstant,
     UninitializedStatic { mutable: bool },
@@ -202,7 +203,7 @@ pub struct StaticValue<'a> {
 
 
 pub struct TypeDef<'a> {
-    pub definition: Rc<DataType>,
+    pub definition: Arc<DataType>,
     pub token: Rc<SourceToken<'a>>
 }
 
@@ -346,7 +347,7 @@ impl<'a> SymbolTable<'a> {
 
     /// Get the size of a scope in bytes, including its children.
     #[allow(clippy::type_complexity)]
-    pub fn total_scope_size(&self, scope_id: ScopeID) -> Result<usize, Vec<(Rc<SourceToken>, Rc<DataType>)>> {
+    pub fn total_scope_size(&self, scope_id: ScopeID) -> Result<usize, Vec<(Rc<SourceToken>, Arc<DataType>)>> {
 
         let mut size = 0;
         let mut unknown_sizes = Vec::new();
@@ -401,7 +402,7 @@ impl<'a> SymbolTable<'a> {
     }
 
 
-    pub fn define_static(&self, name: &str, scope_id: ScopeID, value: Rc<LiteralValue>) -> Result<(), ()> {
+    pub fn define_static(&self, name: &str, scope_id: ScopeID, value: Arc<LiteralValue>) -> Result<(), ()> {
         
         let mut symbol = self.get_symbol(scope_id, name, ScopeDiscriminant(0))
             .ok_or(())?
@@ -415,7 +416,7 @@ impl<'a> SymbolTable<'a> {
     }
 
 
-    pub fn define_constant(&self, name: &str, scope_id: ScopeID, value: Rc<LiteralValue>) -> Result<(), ()> {
+    pub fn define_constant(&self, name: &str, scope_id: ScopeID, value: Arc<LiteralValue>) -> Result<(), ()> {
         
         let mut symbol = self.get_symbol(scope_id, name, ScopeDiscriminant(0))
             .ok_or(())?
@@ -439,7 +440,7 @@ impl<'a> SymbolTable<'a> {
     }
 
 
-    pub fn declare_function(&mut self, name: &'a str, is_const: bool, signature: Rc<DataType>, param_names: Box<[&'a str]>, token: Rc<SourceToken<'a>>, scope_id: ScopeID) -> Result<(), Rc<SourceToken>> {
+    pub fn declare_function(&mut self, name: &'a str, is_const: bool, signature: Arc<DataType>, param_names: Box<[&'a str]>, token: Rc<SourceToken<'a>>, scope_id: ScopeID) -> Result<(), Rc<SourceToken>> {
         
         let symbol_list = self.scopes[scope_id.0].symbols.entry(name).or_default();
         let discriminant = ScopeDiscriminant(symbol_list.len() as u16);
@@ -623,7 +624,7 @@ impl<'a> SymbolTable<'a> {
 
     /// Try to define a new type in the scope.
     /// If a type with the same name is already defined in the same scope, return an error.
-    pub fn define_type(&mut self, name: &'a str, scope_id: ScopeID, definition: Rc<DataType>, token: Rc<SourceToken<'a>>) -> Result<(), TypeDef> {
+    pub fn define_type(&mut self, name: &'a str, scope_id: ScopeID, definition: Arc<DataType>, token: Rc<SourceToken<'a>>) -> Result<(), TypeDef> {
 
         let type_def = TypeDef {
             definition,
@@ -647,6 +648,6 @@ impl<'a> SymbolTable<'a> {
 
 pub enum NameType {
     Symbol(ScopeDiscriminant),
-    Type(Rc<DataType>)
+    Type(Arc<DataType>)
 }
 
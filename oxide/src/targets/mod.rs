@@ -58,7 +58,7 @@ macro_rules! declare_targets {
             }
         
         
-            pub fn generate(&self, symbol_table: &SymbolTable, function_graphs: Vec<FunctionGraph>) -> impl CompiledBinary {
+            pub fn generate(&self, symbol_table: &SymbolTable, function_graphs: Vec<FunctionGraph>) -> Result<impl CompiledBinary, String> {
                 match self {
                     Targets::RustyVM => rusty_vm::generate_bytecode(symbol_table, function_graphs),
                 }
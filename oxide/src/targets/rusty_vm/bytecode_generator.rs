@@ -3,196 +3,863 @@ use std::mem;
 
 use rusty_vm_lib::assembly::ByteCode;
 use rusty_vm_lib::byte_code::ByteCodes;
-use rusty_vm_lib::vm::Address;
-use rusty_vm_lib::registers::{Registers, GENERAL_PURPOSE_REGISTER_COUNT};
+use rusty_vm_lib::vm::{Address, ADDRESS_SIZE};
+use rusty_vm_lib::registers::{Registers, REGISTER_SIZE};
 
-use crate::irc::{LabelID, IROperator};
+use crate::irc::{IRJumpTarget, IROperator, IRValue, Label, LabelID, Tn};
+use crate::lang::data_types::{DataType, LiteralValue, Number};
+use crate::lang::data_types::dt_macros::*;
 use crate::symbol_table::{StaticID, SymbolTable};
 use crate::flow_analyzer::FunctionGraph;
 
+use super::register_allocator::{allocate_registers, FunctionAllocation, TnLocation};
+
 
 type LabelAddressMap = HashMap<LabelID, Address>;
-type StaticAddressMap = HashMap<StaticID, Address>;
+/// Maps a static to its address and its size
+type StaticAddressMap = HashMap<StaticID, (Address, usize)>;
 
 
-// struct GeneralPurposeRegisterSet {
-//     registers: Vec<bool>,
-// }
+/// Where the value of an IR operand is read from
+enum Operand {
 
-// impl GeneralPurposeRegisterSet {
+    Register (Registers),
+    Stack { offset: usize },
+    Const (Vec<u8>),
 
-//     pub fn new() -> Self {
-//         Self {
-//             registers: vec![false; GENERAL_PURPOSE_REGISTER_COUNT]
-//         }
-//     }
+}
 
 
-//     pub fn set(&mut self, reg: Registers) {
-//         self.registers[reg as usize] = true;
-//     }
+fn static_size(data_type: &DataType) -> usize {
+    data_type.static_size().unwrap_or_else(
+        |()| panic!("Could not determine static size of {:?}. This is a bug.", data_type)
+    )
+}
 
 
-//     pub fn is_set(&mut self, reg: Registers) -> bool {
-//         self.registers[reg as usize]
-//     }
+/// Return the size of the values of the operation, which is the size of the Tn operand, if any
+fn operands_size(left: &IRValue, right: &IRValue) -> usize {
+    match (left, right) {
+        (IRValue::Tn(tn), _) |
+        (_, IRValue::Tn(tn))
+            => static_size(&tn.data_type),
+        _ => REGISTER_SIZE
+    }
+}
 
 
-//     pub fn clear(&mut self, reg: Registers) {
-//         self.registers[reg as usize] = false;
-//     }
+/// Return the type the reference Tn points to
+fn pointee_type(ref_: &Tn) -> &DataType {
+    match ref_.data_type.as_ref() {
+        DataType::Ref { target, .. } => target,
+        _ => unreachable!("Tn {} is not a reference. This is a bug.", ref_)
+    }
+}
 
-// }
 
+struct Generator {
 
-pub fn generate_bytecode(symbol_table: &SymbolTable, function_graphs: Vec<FunctionGraph>) -> ByteCode {
-    /*
-        Generate a static section for static data
-        Generate a text section for the code
-        Substitute labels with actual addresses
-    */
+    bytecode: ByteCode,
+    label_address_map: LabelAddressMap,
+    static_address_map: StaticAddressMap,
+    /// List of labels that will need to be filled in later, when all label addresses are known.
+    labels_to_resolve: Vec<Address>,
+    /// Bytes pushed onto the stack by the code generator on top of the function frame, which shift the stack offsets of the Tns
+    stack_shift: usize,
 
-    let mut label_address_map = LabelAddressMap::new();
-    let mut static_address_map = StaticAddressMap::new();
-    // let mut reg_set = GeneralPurposeRegisterSet::new();
+}
 
-    let mut bytecode = ByteCode::new();
+impl Generator {
 
-    // Generate static data section (equivalent to .data section in assembly)
+    fn push_opcode(&mut self, instruction: ByteCodes) {
+        self.bytecode.push(instruction as u8);
+    }
 
-    for (static_id, static_value) in symbol_table.get_statics() {
 
-        let static_size = static_value.data_type.static_size().unwrap_or_else(
-            |()| panic!("Could not determine static size of {:?}. This is a bug.", static_value.data_type)
-        );
+    fn push_register(&mut self, reg: Registers) {
+        self.bytecode.push(reg as u8);
+    }
 
-        let byte_repr = static_value.value.as_bytes();
 
-        assert_eq!(static_size, byte_repr.len());
+    fn push_size(&mut self, size: usize) {
+        assert!(size != 0 && size <= REGISTER_SIZE, "Invalid operand size {}. This is a bug.", size);
+        self.bytecode.push(size as u8);
+    }
 
-        static_address_map.insert(static_id, bytecode.len());
 
-        bytecode.extend(byte_repr);
+    fn placeholder_label(&mut self, label: &Label) {
+        self.labels_to_resolve.push(self.bytecode.len());
+        self.bytecode.extend(label.0.0.to_le_bytes());
     }
 
-    // Generate the code section (equivalent to .text section in assembly)
-    // And also populate the label-address map
 
-    // List of labels that will need to be filled in later, when all label addresses are known.
-    let mut labels_to_resolve: Vec<Address> = Vec::new();
-    
-    for function_graph in function_graphs {
+    /// Encode an unsigned constant with the fewest bytes
+    fn compact_const(value: u64) -> Vec<u8> {
+        let size = match value {
+            0..=0xFF => 1,
+            0x100..=0xFFFF => 2,
+            0x10000..=0xFFFFFFFF => 4,
+            _ => 8
+        };
+        value.to_le_bytes()[..size].to_vec()
+    }
 
-        for block in function_graph {
 
-            for ir_node in block.borrow().code.iter() {
+    /// Return the byte representation of the literal value with the given size
+    fn literal_bytes(&self, value: &LiteralValue, size: usize) -> Vec<u8> {
 
-                macro_rules! pushbc {
-                    ($instruction:path) => {
-                        bytecode.push($instruction as u8);
-                    }
+        let mut bytes = match value {
+
+            LiteralValue::Char(ch) => vec![*ch as u8],
+            LiteralValue::Bool(b) => vec![*b as u8],
+
+            LiteralValue::Numeric(number) => match number {
+                Number::Int(n) => n.to_le_bytes().to_vec(),
+                Number::Uint(n) => n.to_le_bytes().to_vec(),
+                Number::Float(f) if size == mem::size_of::<f32>() => (*f as f32).to_le_bytes().to_vec(),
+                Number::Float(f) => f.to_le_bytes().to_vec(),
+            },
+
+            LiteralValue::StaticString(static_id) => {
+                // A string reference is made of the string address and its length
+                let (address, length) = self.static_address_map[static_id];
+                let mut bytes = address.to_le_bytes().to_vec();
+                bytes.extend(length.to_le_bytes());
+                bytes
+            },
+
+            LiteralValue::Array { element_type, items } => {
+                let element_size = static_size(element_type);
+                items.iter().flat_map(|item| self.literal_bytes(item, element_size)).collect()
+            },
+
+            LiteralValue::Ref { .. } => todo!("References to literal values are not supported by the RustyVM target yet"),
+        };
+
+        // Numbers are encoded in little endian, so truncating them keeps their value, if it fits
+        bytes.resize(size, 0);
+        bytes
+    }
+
+
+    fn operand(&self, value: &IRValue, size: usize, allocation: &FunctionAllocation) -> Operand {
+        match value {
+            IRValue::Tn(tn) => match allocation.location(tn) {
+                TnLocation::Register(reg) => Operand::Register(reg),
+                TnLocation::Stack { offset } => Operand::Stack { offset },
+            },
+            IRValue::Const(literal) => Operand::Const(self.literal_bytes(literal, size)),
+        }
+    }
+
+
+    fn move_reg_reg(&mut self, dest: Registers, src: Registers) {
+        if dest as u8 != src as u8 {
+            self.push_opcode(ByteCodes::MOVE_INTO_REG_FROM_REG);
+            self.push_register(dest);
+            self.push_register(src);
+        }
+    }
+
+
+    fn move_reg_const(&mut self, dest: Registers, value: &[u8]) {
+        self.push_opcode(ByteCodes::MOVE_INTO_REG_FROM_CONST);
+        self.push_size(value.len());
+        self.push_register(dest);
+        self.bytecode.extend(value);
+    }
+
+
+    fn move_reg_addr_in_reg(&mut self, dest: Registers, src: Registers, size: usize) {
+        self.push_opcode(ByteCodes::MOVE_INTO_REG_FROM_ADDR_IN_REG);
+        self.push_size(size);
+        self.push_register(dest);
+        self.push_register(src);
+    }
+
+
+    fn move_addr_in_reg_reg(&mut self, dest: Registers, src: Registers, size: usize) {
+        self.push_opcode(ByteCodes::MOVE_INTO_ADDR_IN_REG_FROM_REG);
+        self.push_size(size);
+        self.push_register(dest);
+        self.push_register(src);
+    }
+
+
+    fn move_addr_in_reg_const(&mut self, dest: Registers, value: &[u8]) {
+        self.push_opcode(ByteCodes::MOVE_INTO_ADDR_IN_REG_FROM_CONST);
+        self.push_size(value.len());
+        self.push_register(dest);
+        self.bytecode.extend(value);
+    }
+
+
+    fn compare_reg_const(&mut self, reg: Registers, value: &[u8]) {
+        self.push_opcode(ByteCodes::COMPARE_REG_CONST);
+        self.push_size(value.len());
+        self.push_register(reg);
+        self.bytecode.extend(value);
+    }
+
+
+    fn push_reg(&mut self, reg: Registers) {
+        self.push_opcode(ByteCodes::PUSH_FROM_REG);
+        self.push_register(reg);
+        self.stack_shift += REGISTER_SIZE;
+    }
+
+
+    fn pop_reg(&mut self, reg: Registers) {
+        self.push_opcode(ByteCodes::POP_INTO_REG);
+        self.push_size(REGISTER_SIZE);
+        self.push_register(reg);
+        self.stack_shift -= REGISTER_SIZE;
+    }
+
+
+    /// Put the address of the given stack offset in r1. Clobbers r2
+    fn stack_address(&mut self, offset: usize) {
+        self.move_reg_reg(Registers::R1, Registers::STACK_TOP_POINTER);
+        let offset = offset + self.stack_shift;
+        if offset != 0 {
+            self.move_reg_const(Registers::R2, &Self::compact_const(offset as u64));
+            self.push_opcode(ByteCodes::INTEGER_ADD);
+        }
+    }
+
+
+    /// Load the operand into the register. Loading from the stack clobbers r1 and r2
+    fn load(&mut self, reg: Registers, operand: &Operand, size: usize) {
+        match operand {
+            Operand::Register(src) => self.move_reg_reg(reg, *src),
+            Operand::Const(value) => self.move_reg_const(reg, value),
+            Operand::Stack { offset } => {
+                self.stack_address(*offset);
+                self.move_reg_addr_in_reg(reg, Registers::R1, size);
+            },
+        }
+    }
+
+
+    /// Load the left operand into r1 and the right operand into r2, which is where the VM expects the operands of arithmetic operations
+    fn load_pair(&mut self, left: &Operand, right: &Operand, size: usize) {
+        match (left, right) {
+
+            (Operand::Stack { .. }, Operand::Stack { .. }) => {
+                self.load(Registers::R1, right, size);
+                self.push_reg(Registers::R1);
+                self.load(Registers::R1, left, size);
+                self.pop_reg(Registers::R2);
+            },
+
+            // Loading from the stack clobbers r2, so the right operand is loaded first
+            (_, Operand::Stack { .. }) => {
+                self.load(Registers::R2, right, size);
+                self.load(Registers::R1, left, size);
+            },
+
+            _ => {
+                self.load(Registers::R1, left, size);
+                self.load(Registers::R2, right, size);
+            }
+        }
+    }
+
+
+    /// Store r1 into the target Tn
+    fn store_r1(&mut self, target: &Tn, allocation: &FunctionAllocation) {
+        match allocation.location(target) {
+            TnLocation::Register(reg) => self.move_reg_reg(reg, Registers::R1),
+            TnLocation::Stack { offset } => {
+                let size = static_size(&target.data_type);
+                self.push_reg(Registers::R1);
+                self.stack_address(offset);
+                self.pop_reg(Registers::R2);
+                self.move_addr_in_reg_reg(Registers::R1, Registers::R2, size);
+            }
+        }
+    }
+
+
+    /// Write the bytes of a constant at the address in r1, in register-sized chunks. Clobbers r1 and r2
+    fn store_const_at_r1(&mut self, value: &[u8]) {
+        let mut chunks = value.chunks(REGISTER_SIZE).peekable();
+        while let Some(chunk) = chunks.next() {
+            self.move_addr_in_reg_const(Registers::R1, chunk);
+            if chunks.peek().is_some() {
+                self.move_reg_const(Registers::R2, &Self::compact_const(chunk.len() as u64));
+                self.push_opcode(ByteCodes::INTEGER_ADD);
+            }
+        }
+    }
+
+
+    /// Copy `size` bytes from the `src` stack offset to the address in r1, which is kept on the stack.
+    /// r3 is saved because it's an allocatable register
+    fn memory_copy_from_stack(&mut self, src: usize, size: usize) {
+        self.push_reg(Registers::R3);
+        self.push_reg(Registers::R1);
+        self.stack_address(src);
+        self.move_reg_reg(Registers::R2, Registers::R1);
+        self.pop_reg(Registers::R1);
+        self.move_reg_const(Registers::R3, &Self::compact_const(size as u64));
+        self.push_opcode(ByteCodes::MEMORY_COPY);
+        self.pop_reg(Registers::R3);
+    }
+
+
+    /// Copy the value of the source into the target Tn, which has at least `size` bytes
+    fn assign(&mut self, target: &Tn, source: &IRValue, size: usize, allocation: &FunctionAllocation) {
+
+        if size == 0 {
+            return;
+        }
+
+        let source = self.operand(source, size, allocation);
+
+        match (allocation.location(target), &source) {
+
+            (TnLocation::Register(dest), _) => self.load(dest, &source, size),
+
+            (TnLocation::Stack { offset }, Operand::Register(src)) => {
+                self.stack_address(offset);
+                self.move_addr_in_reg_reg(Registers::R1, *src, size);
+            },
+
+            (TnLocation::Stack { offset }, Operand::Const(value)) => {
+                self.stack_address(offset);
+                self.store_const_at_r1(value);
+            },
+
+            (TnLocation::Stack { offset }, Operand::Stack { offset: src }) => {
+                if size <= REGISTER_SIZE {
+                    self.load(Registers::R1, &source, size);
+                    self.store_r1(target, allocation);
+                } else {
+                    self.stack_address(offset);
+                    self.memory_copy_from_stack(*src, size);
                 }
+            },
+        }
+    }
 
-                macro_rules! set_reg_const {
-                    ($reg:path, $val:expr) => {
-                        pushbc!(ByteCodes::MOVE_INTO_REG_FROM_CONST);
-                        bytecode.extend(mem::size_of::<usize>().to_le_bytes());
-                        pushbc!($reg);
-                        bytecode.extend(($val).to_le_bytes());
-                    }
+
+    /// Copy the value of the source into the address pointed to by the target
+    fn deref_assign(&mut self, target: &Tn, source: &IRValue, size: usize, allocation: &FunctionAllocation) {
+
+        if size == 0 {
+            return;
+        }
+
+        let pointer = self.operand(&IRValue::Tn(target.clone()), ADDRESS_SIZE, allocation);
+        let source = self.operand(source, size, allocation);
+
+        match (&pointer, &source) {
+
+            (Operand::Register(dest), Operand::Register(src)) => self.move_addr_in_reg_reg(*dest, *src, size),
+
+            (Operand::Register(dest), Operand::Const(value)) if value.len() <= REGISTER_SIZE => self.move_addr_in_reg_const(*dest, value),
+
+            (_, Operand::Const(value)) => {
+                self.load(Registers::R1, &pointer, ADDRESS_SIZE);
+                self.store_const_at_r1(value);
+            },
+
+            (_, Operand::Register(src)) => {
+                self.load(Registers::R1, &pointer, ADDRESS_SIZE);
+                self.move_addr_in_reg_reg(Registers::R1, *src, size);
+            },
+
+            (_, Operand::Stack { offset }) => {
+                if size <= REGISTER_SIZE {
+                    self.load_pair(&pointer, &source, size);
+                    self.move_addr_in_reg_reg(Registers::R1, Registers::R2, size);
+                } else {
+                    self.load(Registers::R1, &pointer, ADDRESS_SIZE);
+                    self.memory_copy_from_stack(*offset, size);
                 }
+            },
+        }
+    }
 
-                macro_rules! move_into_reg_from_reg {
-                    ($reg1:path, $reg2:path) => {
-                        pushbc!(ByteCodes::MOVE_INTO_REG_FROM_REG);
-                        pushbc!($reg1);
-                        pushbc!($reg2);
-                    }
+
+    fn binary_operation(&mut self, instruction: ByteCodes, target: &Tn, left: &IRValue, right: &IRValue, allocation: &FunctionAllocation) {
+
+        let size = static_size(&target.data_type);
+        let left_operand = self.operand(left, size, allocation);
+        let right_operand = self.operand(right, size, allocation);
+
+        // Adding or subtracting 1 from a register in place doesn't need the arithmetic registers
+        if let (TnLocation::Register(dest), Operand::Register(src), IRValue::Const(value)) = (allocation.location(target), &left_operand, right) {
+            if dest as u8 == *src as u8 && matches!(value.as_ref(), LiteralValue::Numeric(Number::Int(1) | Number::Uint(1))) {
+                match instruction {
+                    ByteCodes::INTEGER_ADD => {
+                        self.push_opcode(ByteCodes::INC_REG);
+                        self.push_register(dest);
+                        return;
+                    },
+                    ByteCodes::INTEGER_SUB => {
+                        self.push_opcode(ByteCodes::DEC_REG);
+                        self.push_register(dest);
+                        return;
+                    },
+                    _ => {}
                 }
+            }
+        }
+
+        self.load_pair(&left_operand, &right_operand, size);
+        self.push_opcode(instruction);
+        self.store_r1(target, allocation);
+    }
+
+
+    fn arithmetic_operation(&mut self, integer: ByteCodes, float: ByteCodes, target: &Tn, left: &IRValue, right: &IRValue, allocation: &FunctionAllocation) {
+        let instruction = if matches!(target.data_type.as_ref(), floating_point_pattern!()) { float } else { integer };
+        self.binary_operation(instruction, target, left, right, allocation);
+    }
+
+
+    /// Compare the operands and store the given flag in the target, inverted if requested
+    fn comparison(&mut self, target: &Tn, left: &IRValue, right: &IRValue, flag: Registers, invert: bool, allocation: &FunctionAllocation) {
 
-                macro_rules! placeholder_label {
-                    ($label:ident) => {
-                        labels_to_resolve.push(bytecode.len());
-                        bytecode.extend(($label.0.0).to_le_bytes());
+        let size = operands_size(left, right);
+        let left_operand = self.operand(left, size, allocation);
+        let right_operand = self.operand(right, size, allocation);
+
+        // Compare registers and constants directly instead of going through r1 and r2
+        match &right_operand {
+
+            Operand::Stack { .. } => {
+                self.load_pair(&left_operand, &right_operand, size);
+                self.push_opcode(ByteCodes::COMPARE_REG_REG);
+                self.push_register(Registers::R1);
+                self.push_register(Registers::R2);
+            },
+
+            _ => {
+                let left_reg = match left_operand {
+                    Operand::Register(reg) => reg,
+                    _ => {
+                        self.load(Registers::R1, &left_operand, size);
+                        Registers::R1
                     }
+                };
+
+                match &right_operand {
+                    Operand::Register(right_reg) => {
+                        self.push_opcode(ByteCodes::COMPARE_REG_REG);
+                        self.push_register(left_reg);
+                        self.push_register(*right_reg);
+                    },
+                    Operand::Const(value) => self.compare_reg_const(left_reg, value),
+                    Operand::Stack { .. } => unreachable!(),
                 }
+            }
+        }
+
+        self.move_reg_reg(Registers::R1, flag);
+
+        if invert {
+            self.compare_reg_const(Registers::R1, &[0]);
+            self.move_reg_reg(Registers::R1, Registers::ZERO_FLAG);
+        }
+
+        self.store_r1(target, allocation);
+    }
+
+
+    /// Jump to the target if the condition is true, or if it's false when `if_false` is set
+    fn conditional_jump(&mut self, condition: &Tn, target: &Label, if_false: bool, allocation: &FunctionAllocation) {
+
+        let size = static_size(&condition.data_type);
+
+        match self.operand(&IRValue::Tn(condition.clone()), size, allocation) {
+            Operand::Register(reg) => self.compare_reg_const(reg, &[0]),
+            operand => {
+                self.load(Registers::R1, &operand, size);
+                self.compare_reg_const(Registers::R1, &[0]);
+            }
+        }
+
+        self.push_opcode(if if_false { ByteCodes::JUMP_ZERO } else { ByteCodes::JUMP_NOT_ZERO });
+        self.placeholder_label(target);
+    }
+
+
+    /// The frame holds the spill slots as well as the scope, so it's larger than the scope bytes
+    fn push_frame(&mut self, allocation: &FunctionAllocation) {
+        if allocation.frame_size != 0 {
+            self.push_opcode(ByteCodes::PUSH_STACK_POINTER_CONST);
+            let value = Self::compact_const(allocation.frame_size as u64);
+            self.push_size(value.len());
+            self.bytecode.extend(value);
+        }
+    }
+
+
+    fn pop_frame(&mut self, allocation: &FunctionAllocation) {
+        if allocation.frame_size != 0 {
+            self.push_opcode(ByteCodes::POP_STACK_POINTER_CONST);
+            let value = Self::compact_const(allocation.frame_size as u64);
+            self.push_size(value.len());
+            self.bytecode.extend(value);
+        }
+    }
+
+
+    /// Functions return their value in r1, so it must fit in a register
+    fn return_value_size(value: &Tn) -> Result<usize, String> {
+        let size = static_size(&value.data_type);
+        if size > REGISTER_SIZE {
+            return Err(format!("Returning {} is not supported by the RustyVM target yet: values larger than a register need the caller to provide a return slot", value));
+        }
+        Ok(size)
+    }
+
+
+    fn generate_function(&mut self, function_graph: &FunctionGraph) -> Result<(), String> {
+
+        let allocation = allocate_registers(function_graph);
+
+        // The function is called through the label that introduces it
+        let function_label = function_graph.first().and_then(|block| match block.code.iter().next().map(|ir_node| &ir_node.op) {
+            Some(IROperator::Label { label }) => Some(*label),
+            _ => None
+        });
+
+        // Every return of the function returns the same Tn
+        let return_value: Option<Tn> = function_graph.iter().find_map(|block|
+            block.code.iter().find_map(|ir_node| match &ir_node.op {
+                IROperator::Return { value } => value.clone(),
+                _ => None
+            })
+        );
+
+        // Address right after the function's frame is pushed, where recursive tail calls jump to reuse the frame
+        let mut body_address: Option<Address> = None;
+
+        for block in function_graph {
+
+            for ir_node in block.code.iter() {
 
                 match &ir_node.op {
 
-                    IROperator::Add { target, left, right } => {
-                        // TODO: we need to keep a record of which tns map to which memory address in the stack.                
-                    },
-                    IROperator::Sub { target, left, right } => todo!(),
-                    IROperator::Mul { target, left, right } => todo!(),
-                    IROperator::Div { target, left, right } => todo!(),
-                    IROperator::Mod { target, left, right } => todo!(),
-                    IROperator::Assign { target, source } => todo!(),
-                    IROperator::Deref { target, ref_ } => todo!(),
-                    IROperator::DerefAssign { target, source } => todo!(),
-                    IROperator::Ref { target, ref_ } => todo!(),
-                    IROperator::Greater { target, left, right } => todo!(),
-                    IROperator::Less { target, left, right } => todo!(),
-                    IROperator::GreaterEqual { target, left, right } => todo!(),
-                    IROperator::LessEqual { target, left, right } => todo!(),
-                    IROperator::Equal { target, left, right } => todo!(),
-                    IROperator::NotEqual { target, left, right } => todo!(),
-                    IROperator::BitShiftLeft { target, left, right } => todo!(),
-                    IROperator::BitShiftRight { target, left, right } => todo!(),
-                    IROperator::BitNot { target, operand } => todo!(),
-                    IROperator::BitAnd { target, left, right } => todo!(),
-                    IROperator::BitOr { target, left, right } => todo!(),
-                    IROperator::BitXor { target, left, right } => todo!(),
-                    IROperator::Copy { target, source } => todo!(),
-                    IROperator::DerefCopy { target, source } => todo!(),
+                    IROperator::Add { target, left, right } => self.arithmetic_operation(ByteCodes::INTEGER_ADD, ByteCodes::FLOAT_ADD, target, left, right, &allocation),
+                    IROperator::Sub { target, left, right } => self.arithmetic_operation(ByteCodes::INTEGER_SUB, ByteCodes::FLOAT_SUB, target, left, right, &allocation),
+                    IROperator::Mul { target, left, right } => self.arithmetic_operation(ByteCodes::INTEGER_MUL, ByteCodes::FLOAT_MUL, target, left, right, &allocation),
+                    IROperator::Div { target, left, right } => self.arithmetic_operation(ByteCodes::INTEGER_DIV, ByteCodes::FLOAT_DIV, target, left, right, &allocation),
+                    IROperator::Mod { target, left, right } => self.arithmetic_operation(ByteCodes::INTEGER_MOD, ByteCodes::FLOAT_MOD, target, left, right, &allocation),
+
+                    IROperator::Assign { target, source } => {
+                        let size = static_size(&target.data_type);
+                        self.assign(target, source, size, &allocation);
+                    },
+
+                    IROperator::Copy { target, source } => {
+                        // The target may be larger than the source
+                        let size = match source {
+                            IRValue::Tn(tn) => static_size(&tn.data_type),
+                            IRValue::Const(_) => static_size(&target.data_type),
+                        };
+                        self.assign(target, source, size, &allocation);
+                    },
+
+                    IROperator::Deref { target, ref_ } => {
+                        let size = static_size(&target.data_type);
+                        if size != 0 {
+                            let pointer = self.operand(ref_, ADDRESS_SIZE, &allocation);
+                            match allocation.location(target) {
+                                TnLocation::Register(dest) => {
+                                    let pointer_reg = match pointer {
+                                        Operand::Register(reg) => reg,
+                                        pointer => {
+                                            self.load(Registers::R1, &pointer, ADDRESS_SIZE);
+                                            Registers::R1
+                                        }
+                                    };
+                                    self.move_reg_addr_in_reg(dest, pointer_reg, size);
+                                },
+                                TnLocation::Stack { offset } => {
+                                    if size <= REGISTER_SIZE {
+                                        self.load(Registers::R1, &pointer, ADDRESS_SIZE);
+                                        self.move_reg_addr_in_reg(Registers::R1, Registers::R1, size);
+                                        self.store_r1(target, &allocation);
+                                    } else {
+                                        // Copy from the pointed address to the stack
+                                        self.push_reg(Registers::R3);
+                                        self.load(Registers::R1, &pointer, ADDRESS_SIZE);
+                                        self.push_reg(Registers::R1);
+                                        self.stack_address(offset);
+                                        self.pop_reg(Registers::R2);
+                                        self.move_reg_const(Registers::R3, &Self::compact_const(size as u64));
+                                        self.push_opcode(ByteCodes::MEMORY_COPY);
+                                        self.pop_reg(Registers::R3);
+                                    }
+                                }
+                            }
+                        }
+                    },
+
+                    IROperator::DerefAssign { target, source } => {
+                        let size = static_size(pointee_type(target));
+                        self.deref_assign(target, source, size, &allocation);
+                    },
+
+                    IROperator::DerefCopy { target, source } => {
+                        let size = match source {
+                            IRValue::Tn(tn) => static_size(&tn.data_type),
+                            IRValue::Const(_) => static_size(pointee_type(target)),
+                        };
+                        self.deref_assign(target, source, size, &allocation);
+                    },
+
+                    IROperator::Ref { target, ref_ } => {
+                        let TnLocation::Stack { offset } = allocation.location(ref_) else {
+                            unreachable!("Tn {} has its address taken but lives in a register. This is a bug.", ref_)
+                        };
+                        self.stack_address(offset);
+                        self.store_r1(target, &allocation);
+                    },
+
+                    IROperator::Greater { target, left, right } => self.comparison(target, right, left, Registers::SIGN_FLAG, false, &allocation),
+                    IROperator::Less { target, left, right } => self.comparison(target, left, right, Registers::SIGN_FLAG, false, &allocation),
+                    IROperator::GreaterEqual { target, left, right } => self.comparison(target, left, right, Registers::SIGN_FLAG, true, &allocation),
+                    IROperator::LessEqual { target, left, right } => self.comparison(target, right, left, Registers::SIGN_FLAG, true, &allocation),
+                    IROperator::Equal { target, left, right } => self.comparison(target, left, right, Registers::ZERO_FLAG, false, &allocation),
+                    IROperator::NotEqual { target, left, right } => self.comparison(target, left, right, Registers::ZERO_FLAG, true, &allocation),
+
+                    IROperator::BitShiftLeft { target, left, right } => self.binary_operation(ByteCodes::SHIFT_LEFT, target, left, right, &allocation),
+                    IROperator::BitShiftRight { target, left, right } => self.binary_operation(ByteCodes::SHIFT_RIGHT, target, left, right, &allocation),
+                    IROperator::BitAnd { target, left, right } => self.binary_operation(ByteCodes::AND, target, left, right, &allocation),
+                    IROperator::BitOr { target, left, right } => self.binary_operation(ByteCodes::OR, target, left, right, &allocation),
+                    IROperator::BitXor { target, left, right } => self.binary_operation(ByteCodes::XOR, target, left, right, &allocation),
+
+                    IROperator::BitNot { target, operand } => {
+                        let size = static_size(&target.data_type);
+                        let operand = self.operand(operand, size, &allocation);
+                        self.load(Registers::R1, &operand, size);
+                        self.push_opcode(ByteCodes::NOT);
+                        self.store_r1(target, &allocation);
+                    },
 
                     IROperator::Jump { target } => {
-                        pushbc!(ByteCodes::JUMP);
-                        placeholder_label!(target);
+                        self.push_opcode(ByteCodes::JUMP);
+                        self.placeholder_label(target);
                     },
 
-                    IROperator::JumpIf { condition, target } => todo!(),
-                    IROperator::JumpIfNot { condition, target } => todo!(),
+                    IROperator::JumpIf { condition, target } => self.conditional_jump(condition, target, false, &allocation),
+                    IROperator::JumpIfNot { condition, target } => self.conditional_jump(condition, target, true, &allocation),
 
                     IROperator::Label { label } => {
-                        label_address_map.insert(label.0, bytecode.len());
+                        self.label_address_map.insert(label.0, self.bytecode.len());
+                    },
+
+                    IROperator::Call { return_target, callable, args, tail, .. } => {
+
+                        let IRJumpTarget::Label(callee) = callable else {
+                            return Err(format!("Calling {:?} is not supported by the RustyVM target yet: calls through a pointer need an indirect call instruction", callable));
+                        };
+                        if !args.is_empty() {
+                            return Err(format!("Calling {:?} with arguments is not supported by the RustyVM target yet: the IR doesn't bind the parameters of the called function", callable));
+                        }
+
+                        if *tail {
+                            // The callee returns its value straight to the caller of this function
+                            match body_address {
+                                // A recursive call needs a frame of the same size, so the current one is reused
+                                Some(address) if function_label == Some(*callee) => {
+                                    self.push_opcode(ByteCodes::JUMP);
+                                    self.bytecode.extend(address.to_le_bytes());
+                                },
+                                _ => {
+                                    self.pop_frame(&allocation);
+                                    self.push_opcode(ByteCodes::JUMP);
+                                    self.placeholder_label(callee);
+                                }
+                            }
+                        } else {
+                            self.push_opcode(ByteCodes::CALL);
+                            self.placeholder_label(callee);
+
+                            if let Some(target) = return_target {
+                                Self::return_value_size(target)?;
+                                self.store_r1(target, &allocation);
+                            }
+                        }
                     },
 
-                    IROperator::Call { return_target, return_label, callable, args } => todo!(),
-                    IROperator::Return => todo!(),
+                    IROperator::Return { .. } => {
+                        self.push_opcode(ByteCodes::RETURN);
+                    },
 
-                    IROperator::PushScope { bytes } => {
-                        set_reg_const!(Registers::R1, bytes);
-                        move_into_reg_from_reg!(Registers::R2, Registers::STACK_TOP_POINTER);
-                        // The stack grows downwards
-                        pushbc!(ByteCodes::INTEGER_SUB);
-                        move_into_reg_from_reg!(Registers::STACK_TOP_POINTER, Registers::R1);
+                    IROperator::PushScope { bytes: _ } => {
+                        self.push_frame(&allocation);
+                        body_address = Some(self.bytecode.len());
                     },
-                    IROperator::PopScope { bytes } => {
-                        set_reg_const!(Registers::R1, bytes);
-                        move_into_reg_from_reg!(Registers::R2, Registers::STACK_TOP_POINTER);
-                        pushbc!(ByteCodes::INTEGER_ADD);
-                        move_into_reg_from_reg!(Registers::STACK_TOP_POINTER, Registers::R1);
+                    IROperator::PopScope { bytes: _ } => {
+                        // The return value may be in the frame, so it's moved to r1 before the frame is popped
+                        if let Some(value) = &return_value {
+                            let size = Self::return_value_size(value)?;
+                            if size != 0 {
+                                let operand = self.operand(&IRValue::Tn(value.clone()), size, &allocation);
+                                self.load(Registers::R1, &operand, size);
+                            }
+                        }
+                        self.pop_frame(&allocation);
                     },
 
                     IROperator::Nop => {
-                        pushbc!(ByteCodes::NO_OPERATION);
+                        self.push_opcode(ByteCodes::NO_OPERATION);
                     },
                 }
             }
         }
+
+        Ok(())
     }
 
+}
+
+
+/// Generate the bytecode of the program, or return why a construct it uses can't be compiled for the VM
+pub fn generate_bytecode(symbol_table: &SymbolTable, function_graphs: Vec<FunctionGraph>) -> Result<ByteCode, String> {
+    /*
+        Generate a static section for static data
+        Generate a text section for the code
+        Substitute labels with actual addresses
+    */
+
+    let mut generator = Generator {
+        bytecode: ByteCode::new(),
+        label_address_map: LabelAddressMap::new(),
+        static_address_map: StaticAddressMap::new(),
+        labels_to_resolve: Vec::new(),
+        stack_shift: 0,
+    };
+
+    // Generate static data section (equivalent to .data section in assembly)
+
+    for (static_id, static_value) in symbol_table.get_statics() {
+
+        let static_size = static_size(&static_value.data_type);
+
+        let byte_repr = static_value.value.as_bytes();
+
+        assert_eq!(static_size, byte_repr.len());
+
+        generator.static_address_map.insert(static_id, (generator.bytecode.len(), static_size));
+
+        generator.bytecode.extend(byte_repr);
+    }
+
+    // Generate the code section (equivalent to .text section in assembly)
+    // And also populate the label-address map
+
+    for function_graph in function_graphs {
+        generator.generate_function(&function_graph)?;
+    }
+
+    let mut bytecode = generator.bytecode;
+
     // Substitute labels with actual addresses
-    for label_location in labels_to_resolve {
+    for label_location in generator.labels_to_resolve {
         let label_id = LabelID(usize::from_le_bytes(
             bytecode[label_location..label_location + mem::size_of::<LabelID>()].try_into().unwrap()
         ));
-        let address = label_address_map.get(&label_id).unwrap();
+        let address = generator.label_address_map.get(&label_id).unwrap();
         bytecode[label_location..label_location + mem::size_of::<LabelID>()].copy_from_slice(&address.to_le_bytes());
     }
 
     // Specify the entry point of the program (main function or __init__ function)
 
-    bytecode
+    Ok(bytecode)
 }
 
+
+#[cfg(test)]
+mod tests {
+
+    use std::sync::Arc;
+
+    use super::*;
+
+    use crate::cli_parser::OptimizationFlags;
+    use crate::flow_analyzer::BasicBlock;
+    use crate::irc::{IRCode, IRNode, TnID};
+    use crate::test_utils::{compile, SAMPLE_PROGRAM};
+
+
+    fn function_calling(callable: IRJumpTarget, args: Vec<IRValue>) -> FunctionGraph {
+        let mut code = IRCode::new();
+        for op in [
+            IROperator::Label { label: Label(LabelID(0)) },
+            IROperator::PushScope { bytes: 0 },
+            IROperator::Call { return_target: None, return_label: Label(LabelID(1)), callable, args, tail: false },
+            IROperator::Label { label: Label(LabelID(1)) },
+            IROperator::PopScope { bytes: 0 },
+            IROperator::Return { value: None },
+        ] {
+            code.push_back(IRNode { op, has_side_effects: true });
+        }
+        vec![BasicBlock::new(code)]
+    }
+
+
+    #[test]
+    fn test_unsupported_calls() {
+
+        let symbol_table = SymbolTable::new();
+        let pointer = Tn { id: TnID(0), data_type: Arc::new(DataType::U64) };
+
+        let bytecode = generate_bytecode(&symbol_table, vec![function_calling(IRJumpTarget::Label(Label(LabelID(0))), Vec::new())]);
+        assert!(bytecode.is_ok());
+
+        let error = generate_bytecode(&symbol_table, vec![function_calling(IRJumpTarget::Tn(pointer), Vec::new())]);
+        assert!(error.is_err());
+
+        let error = generate_bytecode(&symbol_table, vec![function_calling(IRJumpTarget::Label(Label(LabelID(0))), vec![IRValue::Tn(Tn { id: TnID(1), data_type: Arc::new(DataType::U64) })])]);
+        assert!(error.is_err());
+    }
+
+
+    fn sample_program_bytecode(optimization_flags: &OptimizationFlags) -> String {
+        compile(SAMPLE_PROGRAM, optimization_flags).bytecode.iter().map(|byte| format!("{:02x}", byte)).collect()
+    }
+
+
+    #[test]
+    fn test_sample_program_bytecode() {
+        // Generated before the basic blocks were stored contiguously and before the statement parsing was made linear
+        let unoptimized = concat!(
+            "130402030000001103021100033b3a0000000000000000110200130403040000",
+            "00110403110002110104001103001100033b2301301304020000000011000c13",
+            "01012000150400021304020000000011000c1301012800150400022da0010000",
+            "000000001304020200000011030211000c130101280012080000110103041102",
+            "00130403000000001104033c020411000e1103003e0103002fea000000000000",
+            "003a0e0000000000000011030011000c13010128001208000011010302110400",
+            "11000c130101200012080000110104001d0011000c1301012800250801150800",
+            "012d75010000000000001304040500000011030411000c130101280012080000",
+            "3c000311000e1104003e0104002f4a0100000000000013040401000000110304",
+            "11000c130101200012080000110103011d0011000c1301012800250801150800",
+            "012d75010000000000001304030200000011040311000c130101200012080000",
+            "110104021d0011000c1301012800250801150800011304040100000011030411",
+            "000c130101280012080000110103001d0011000c130101300025080115080001",
+            "1304030a00000011040311000c1301012800120800003c000411000f1103003e",
+            "0103002e640000000000000011000c13010120001208030011000c1301012000",
+            "12080100110003001104002a01303b",
+        );
+        let optimized = concat!(
+            "13080203000000000000001100023b13080207000000000000001100023b2301",
+            "2013080200000000000000002d97000000000000001100021308010200000000",
+            "000000041103003e0803000000000000000011000e1104003e0104002f6e0000",
+            "00000000002d95000000000000003e0802050000000000000011000e1104003e",
+            "0104002f95000000000000002d95000000000000000a023e08020a0000000000",
+            "000011000f1104003e0104002e35000000000000002a01203b",
+        );
+
+        assert_eq!(sample_program_bytecode(&OptimizationFlags::none()), unoptimized);
+        assert_eq!(sample_program_bytecode(&OptimizationFlags::all()), optimized);
+    }
+
+}
@@ -1,5 +1,5 @@
 
 mod bytecode_generator;
+mod register_allocator;
 
 pub use bytecode_generator::*;
-
@@ -0,0 +1,444 @@
+use std::collections::HashMap;
+
+use rusty_vm_lib::registers::{Registers, GENERAL_PURPOSE_REGISTER_COUNT, REGISTER_SIZE};
+
+use crate::irc::{IROperator, Tn, TnID};
+use crate::flow_analyzer::{FunctionGraph, FunctionLiveness};
+
+
+/// Registers the code generator uses as operands of the VM's arithmetic, which always works on r1 and r2,
+/// and to compute stack addresses. They are never allocated to Tns
+pub const SCRATCH_REGISTERS: [Registers; 2] = [Registers::R1, Registers::R2];
+
+
+/// Where a Tn is stored while it's live
+#[derive(Debug, Clone, Copy)]
+pub enum TnLocation {
+
+    Register (Registers),
+    /// Offset from the stack top once the function's frame has been pushed
+    Stack { offset: usize },
+
+}
+
+
+/// The locations of the Tns of a function
+pub struct FunctionAllocation {
+
+    locations: HashMap<TnID, TnLocation>,
+    /// Bytes of the function's stack frame: the scope pushed by the function, which holds its local symbols, followed by the spill slots
+    pub frame_size: usize,
+
+}
+
+impl FunctionAllocation {
+
+    pub fn location(&self, tn: &Tn) -> TnLocation {
+        *self.locations.get(&tn.id).unwrap_or_else(
+            || panic!("Tn {} has no location. This is a bug.", tn)
+        )
+    }
+
+}
+
+/// The range of operation positions in which a Tn is live
+struct LiveInterval {
+    /// Dense index of the Tn
+    tn: usize,
+    start: usize,
+    end: usize,
+}
+
+
+/// Operations of a function, numbered in the order they appear in the function graph
+struct FunctionInfo {
+
+    liveness: FunctionLiveness,
+    /// Position of the first and of the last operation of each block, if the block isn't empty
+    block_ranges: Vec<Option<(usize, usize)>>,
+    /// Positions of the function calls, which don't preserve the registers
+    calls: Vec<usize>,
+    /// Tns whose address is taken, which must stay in memory
+    addressed: Vec<usize>,
+    /// First and last position at which each Tn is read or assigned
+    occurrences: Vec<Option<(usize, usize)>>,
+    /// Bytes of the function's scope
+    scope_size: usize,
+
+}
+
+
+impl FunctionInfo {
+
+    fn new(function_graph: &FunctionGraph) -> Self {
+
+        let liveness = FunctionLiveness::analyze(function_graph);
+
+        let mut info = FunctionInfo {
+            block_ranges: Vec::with_capacity(function_graph.len()),
+            calls: Vec::new(),
+            addressed: Vec::new(),
+            occurrences: vec![None; liveness.tns.len()],
+            scope_size: 0,
+            liveness,
+        };
+
+        let mut position = 0;
+        for block in function_graph {
+
+            let start = position;
+
+            for ir_node in block.code.iter() {
+
+                for tn in ir_node.op.defined_tn().into_iter().chain(ir_node.op.used_tns()) {
+                    info.occur(info.liveness.tn_indices[&tn.id], position);
+                }
+
+                match &ir_node.op {
+                    IROperator::Ref { ref_, .. } => info.addressed.push(info.liveness.tn_indices[&ref_.id]),
+                    IROperator::PushScope { bytes } => info.scope_size = *bytes,
+                    // Nothing of the function survives a tail call
+                    IROperator::Call { tail: false, .. } => info.calls.push(position),
+                    _ => {}
+                }
+
+                position += 1;
+            }
+
+            info.block_ranges.push((position != start).then(|| (start, position - 1)));
+        }
+
+        info
+    }
+
+
+    fn occur(&mut self, tn: usize, position: usize) {
+        let occurrence = self.occurrences[tn].get_or_insert((position, position));
+        occurrence.0 = occurrence.0.min(position);
+        occurrence.1 = occurrence.1.max(position);
+    }
+
+
+    /// Build the live interval of every Tn. A Tn that is live across a block boundary is live in the whole range between its occurrences and the boundary
+    fn live_intervals(&self) -> Vec<LiveInterval> {
+
+        let mut ranges = self.occurrences.clone();
+        let mut extend = |tn: usize, position: usize| {
+            let range = ranges[tn].get_or_insert((position, position));
+            range.0 = range.0.min(position);
+            range.1 = range.1.max(position);
+        };
+
+        for (block, range) in self.block_ranges.iter().enumerate() {
+
+            // Values live through an empty block are live at the boundaries of the blocks around it
+            let Some((start, end)) = *range else {
+                continue;
+            };
+
+            for tn in self.liveness.live_in[block].iter() {
+                extend(tn, start);
+            }
+
+            for tn in self.liveness.live_out[block].iter() {
+                extend(tn, end);
+            }
+        }
+
+        ranges.into_iter().enumerate()
+            .filter_map(|(tn, range)| range.map(|(start, end)| LiveInterval { tn, start, end }))
+            .collect()
+    }
+
+}
+
+
+fn tn_size(tn: &Tn) -> usize {
+    tn.data_type.static_size().unwrap_or_else(
+        |()| panic!("Could not determine static size of {:?}. This is a bug.", tn.data_type)
+    )
+}
+
+
+/// Assign every Tn of the function to a general purpose register or to a spill slot in the function's stack frame.
+///
+/// Registers are assigned with a linear scan over the live intervals of the Tns, computed by a liveness analysis over the basic blocks.
+/// When there are more live Tns than registers, the Tn whose interval ends last is spilled.
+/// Tns that don't fit in a register, whose address is taken or that are live across a function call always get a spill slot.
+/// The spill slots follow the bytes of the function's scope, so the frame is larger than the scope pushed by the IR code
+pub fn allocate_registers(function_graph: &FunctionGraph) -> FunctionAllocation {
+
+    let info = FunctionInfo::new(function_graph);
+    let mut intervals = info.live_intervals();
+
+    let mut in_memory = vec![false; info.liveness.tns.len()];
+
+    for &tn in &info.addressed {
+        in_memory[tn] = true;
+    }
+
+    for interval in &intervals {
+        let size = tn_size(&info.liveness.tns[interval.tn]);
+        // The callee may use every register, and a Tn assigned by the call starts living right after it
+        let live_across_call = info.calls.iter().any(|&call| interval.start < call && call < interval.end);
+        if size > REGISTER_SIZE || live_across_call {
+            in_memory[interval.tn] = true;
+        }
+    }
+
+    // The registers are handed out in ascending order
+    let mut free_registers: Vec<Registers> = (0..GENERAL_PURPOSE_REGISTER_COUNT as u8).rev()
+        .map(Registers::from)
+        .filter(|register| !SCRATCH_REGISTERS.iter().any(|scratch| *scratch as u8 == *register as u8))
+        .collect();
+
+    let mut registers: Vec<Option<Registers>> = vec![None; info.liveness.tns.len()];
+    // Indices in `intervals` of the intervals that hold a register, sorted by increasing end
+    let mut active: Vec<usize> = Vec::new();
+
+    intervals.sort_by_key(|interval| (interval.start, interval.end));
+
+    for (i, interval) in intervals.iter().enumerate() {
+
+        if in_memory[interval.tn] {
+            continue;
+        }
+
+        // Free the registers of the intervals that ended
+        active.retain(|&active_interval| {
+            let ended = intervals[active_interval].end < interval.start;
+            if ended {
+                free_registers.push(registers[intervals[active_interval].tn].unwrap());
+            }
+            !ended
+        });
+
+        let register = if let Some(register) = free_registers.pop() {
+            register
+        } else {
+            // Spill the interval that ends last, which frees a register for the longest time
+            let &last = active.last().expect("There is at least one allocatable register");
+            if intervals[last].end <= interval.end {
+                in_memory[interval.tn] = true;
+                continue;
+            }
+            active.pop();
+            in_memory[intervals[last].tn] = true;
+            registers[intervals[last].tn].take().unwrap()
+        };
+
+        registers[interval.tn] = Some(register);
+        let position = active.partition_point(|&active_interval| intervals[active_interval].end <= interval.end);
+        active.insert(position, i);
+    }
+
+    let mut allocation = FunctionAllocation {
+        locations: HashMap::with_capacity(info.liveness.tns.len()),
+        frame_size: info.scope_size,
+    };
+
+    for (index, tn) in info.liveness.tns.iter().enumerate() {
+        let location = match registers[index] {
+            Some(register) => TnLocation::Register(register),
+            None => {
+                let offset = allocation.frame_size;
+                allocation.frame_size += tn_size(tn);
+                TnLocation::Stack { offset }
+            }
+        };
+        allocation.locations.insert(tn.id, location);
+    }
+
+    allocation
+}
+
+
+#[cfg(test)]
+mod tests {
+
+    use std::sync::Arc;
+
+    use super::*;
+
+    use crate::flow_analyzer::{BasicBlock, BlockID};
+    use crate::irc::{IRCode, IRJumpTarget, IRNode, IRValue, Label, LabelID};
+    use crate::lang::data_types::{DataType, LiteralValue, Number};
+
+
+    fn tn(id: usize) -> Tn {
+        Tn { id: TnID(id), data_type: Arc::new(DataType::U64) }
+    }
+
+
+    fn node(op: IROperator) -> IRNode {
+        IRNode { op, has_side_effects: false }
+    }
+
+
+    fn constant(value: u64) -> IRValue {
+        IRValue::Const(Arc::new(LiteralValue::Numeric(Number::Uint(value))))
+    }
+
+
+    #[test]
+    fn test_allocate_registers() {
+
+        let mut code = IRCode::new();
+        code.push_back(node(IROperator::PushScope { bytes: 16 }));
+
+        // T0..T6 are live at the same time, so one of them doesn't get a register
+        for id in 0..7 {
+            code.push_back(node(IROperator::Assign { target: tn(id), source: constant(id as u64) }));
+        }
+        for id in 1..7 {
+            code.push_back(node(IROperator::Add { target: tn(0), left: IRValue::Tn(tn(0)), right: IRValue::Tn(tn(id)) }));
+        }
+
+        code.push_back(node(IROperator::Assign { target: tn(7), source: IRValue::Tn(tn(0)) }));
+        // T8 is only live after the others die, so it reuses a register
+        code.push_back(node(IROperator::Ref { target: tn(8), ref_: tn(7) }));
+        code.push_back(node(IROperator::Jump { target: Label(LabelID(0)) }));
+
+        let function_graph: FunctionGraph = vec![BasicBlock::new(code)];
+
+        let allocation = allocate_registers(&function_graph);
+
+        let registers = (0..7).filter(|&id| matches!(allocation.location(&tn(id)), TnLocation::Register(_))).count();
+        assert_eq!(registers, GENERAL_PURPOSE_REGISTER_COUNT - SCRATCH_REGISTERS.len());
+
+        // T0 lives longest, so it's the one that is spilled
+        assert!(matches!(allocation.location(&tn(0)), TnLocation::Stack { offset: 16 }));
+
+        // The address of T7 is taken, so it stays in memory
+        assert!(matches!(allocation.location(&tn(7)), TnLocation::Stack { offset: 24 }));
+        assert!(matches!(allocation.location(&tn(8)), TnLocation::Register(_)));
+
+        assert_eq!(allocation.frame_size, 32);
+    }
+
+
+    fn register(allocation: &FunctionAllocation, id: usize) -> Option<u8> {
+        match allocation.location(&tn(id)) {
+            TnLocation::Register(register) => Some(register as u8),
+            TnLocation::Stack { .. } => None,
+        }
+    }
+
+
+    #[test]
+    fn test_interference() {
+
+        let mut code = IRCode::new();
+        code.push_back(node(IROperator::Assign { target: tn(0), source: constant(1) }));
+        code.push_back(node(IROperator::Assign { target: tn(1), source: constant(2) }));
+        // T0 and T1 are live at the same time
+        code.push_back(node(IROperator::Add { target: tn(2), left: IRValue::Tn(tn(0)), right: IRValue::Tn(tn(1)) }));
+        // T0 and T1 are dead, so T3 and T4 can reuse their registers
+        code.push_back(node(IROperator::Assign { target: tn(3), source: IRValue::Tn(tn(2)) }));
+        code.push_back(node(IROperator::Add { target: tn(4), left: IRValue::Tn(tn(3)), right: constant(3) }));
+        code.push_back(node(IROperator::Return { value: Some(tn(4)) }));
+
+        let allocation = allocate_registers(&vec![BasicBlock::new(code)]);
+        let registers: Vec<u8> = (0..5).map(|id| register(&allocation, id).expect("No Tn is spilled")).collect();
+
+        assert_ne!(registers[0], registers[1]);
+        assert_ne!(registers[2], registers[3]);
+        assert_ne!(registers[3], registers[4]);
+        assert!(registers[3] == registers[0] || registers[3] == registers[1]);
+        assert!(SCRATCH_REGISTERS.iter().all(|scratch| !registers.contains(&(*scratch as u8))));
+        assert_eq!(allocation.frame_size, 0);
+    }
+
+
+    #[test]
+    fn test_interference_across_loop() {
+
+        // BB0: T0 = 1
+        let mut code = IRCode::new();
+        code.push_back(node(IROperator::Assign { target: tn(0), source: constant(1) }));
+        let mut block0 = BasicBlock::new(code);
+        block0.push_next(BlockID(1));
+
+        // BB1: T1 = T0 + 1; T2 = T1 + 1; loop while T2
+        let mut code = IRCode::new();
+        code.push_back(node(IROperator::Label { label: Label(LabelID(0)) }));
+        code.push_back(node(IROperator::Add { target: tn(1), left: IRValue::Tn(tn(0)), right: constant(1) }));
+        code.push_back(node(IROperator::Add { target: tn(2), left: IRValue::Tn(tn(1)), right: constant(1) }));
+        code.push_back(node(IROperator::JumpIf { condition: tn(2), target: Label(LabelID(0)) }));
+        let mut block1 = BasicBlock::new(code);
+        block1.push_next(BlockID(1));
+        block1.push_next(BlockID(2));
+
+        // BB2: return T1
+        let mut code = IRCode::new();
+        code.push_back(node(IROperator::Return { value: Some(tn(1)) }));
+        let block2 = BasicBlock::new(code);
+
+        let allocation = allocate_registers(&vec![block0, block1, block2]);
+        let registers: Vec<u8> = (0..3).map(|id| register(&allocation, id).expect("No Tn is spilled")).collect();
+
+        // T0 is last read before T2 is defined, but the back edge keeps it live until the end of the loop
+        assert_ne!(registers[0], registers[2]);
+        assert_ne!(registers[0], registers[1]);
+        assert_ne!(registers[1], registers[2]);
+    }
+
+
+    fn call(return_target: Option<Tn>, tail: bool) -> IRNode {
+        node(IROperator::Call {
+            return_target,
+            return_label: Label(LabelID(1)),
+            callable: IRJumpTarget::Label(Label(LabelID(0))),
+            args: Vec::new(),
+            tail,
+        })
+    }
+
+
+    #[test]
+    fn test_registers_across_calls() {
+
+        let mut code = IRCode::new();
+        code.push_back(node(IROperator::PushScope { bytes: 8 }));
+        code.push_back(node(IROperator::Assign { target: tn(0), source: constant(1) }));
+        code.push_back(node(IROperator::Assign { target: tn(1), source: constant(2) }));
+        // T1 dies before the call
+        code.push_back(node(IROperator::Add { target: tn(2), left: IRValue::Tn(tn(1)), right: constant(3) }));
+        code.push_back(call(Some(tn(3)), false));
+        code.push_back(node(IROperator::Label { label: Label(LabelID(1)) }));
+        // T0 and T2 are live across the call, T3 is assigned by it
+        code.push_back(node(IROperator::Add { target: tn(4), left: IRValue::Tn(tn(0)), right: IRValue::Tn(tn(3)) }));
+        code.push_back(node(IROperator::Add { target: tn(5), left: IRValue::Tn(tn(4)), right: IRValue::Tn(tn(2)) }));
+        code.push_back(node(IROperator::PopScope { bytes: 8 }));
+        code.push_back(node(IROperator::Return { value: Some(tn(5)) }));
+
+        let allocation = allocate_registers(&vec![BasicBlock::new(code)]);
+
+        // The callee may overwrite every register, so the values that must survive the call are kept in the frame
+        assert!(matches!(allocation.location(&tn(0)), TnLocation::Stack { offset } if offset >= 8));
+        assert!(matches!(allocation.location(&tn(2)), TnLocation::Stack { offset } if offset >= 8));
+        assert!(register(&allocation, 1).is_some());
+        assert!(register(&allocation, 3).is_some());
+        assert!(register(&allocation, 4).is_some());
+        assert!(register(&allocation, 5).is_some());
+        assert_eq!(allocation.frame_size, 24);
+    }
+
+
+    #[test]
+    fn test_registers_across_tail_calls() {
+
+        let mut code = IRCode::new();
+        code.push_back(node(IROperator::Assign { target: tn(0), source: constant(1) }));
+        code.push_back(call(None, true));
+        code.push_back(node(IROperator::Label { label: Label(LabelID(1)) }));
+        code.push_back(node(IROperator::Return { value: Some(tn(0)) }));
+
+        let allocation = allocate_registers(&vec![BasicBlock::new(code)]);
+
+        // Nothing of the function survives a tail call, so it doesn't force Tns into memory
+        assert!(register(&allocation, 0).is_some());
+        assert_eq!(allocation.frame_size, 0);
+    }
+
+}
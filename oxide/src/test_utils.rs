@@ -0,0 +1,89 @@
+//! Fixtures shared by the tests of the compiler stages
+
+use std::path::Path;
+use std::thread;
+
+use rusty_vm_lib::assembly::ByteCode;
+use rusty_vm_lib::ir::SourceCode;
+
+use crate::cli_parser::OptimizationFlags;
+use crate::symbol_table::SymbolTable;
+use crate::targets::rusty_vm;
+use crate::{ast, flow_analyzer, function_parser, irc, tokenizer};
+
+
+/// A program with calls, loops and conditions that the RustyVM target can compile
+pub const SAMPLE_PROGRAM: &str = "
+fn three() -> u64 {
+    3 as u64
+}
+
+fn seven() -> u64 {
+    three() + 4 as u64
+}
+
+fn main() {
+
+    let mut total: u64 = 0 as u64;
+    let mut i: u64 = 0 as u64;
+
+    while i < 10 as u64 {
+        if (i % 2 as u64) == 0 as u64 {
+            total = total + i * seven();
+        } else if i == 5 as u64 {
+            total = total - 1 as u64;
+        } else {
+            total = total * 2 as u64;
+        }
+        i = i + 1 as u64;
+    }
+
+    let mut a: u64 = total;
+
+    let x = a + total;
+}
+";
+
+
+/// The output of every stage of the compiler
+pub struct Compilation {
+
+    /// The IR code of every function, as printed by the verbose mode
+    pub ir_code: String,
+    pub function_graphs: String,
+    pub bytecode: ByteCode,
+
+}
+
+
+/// Compile the program for the RustyVM target
+pub fn compile(program: &str, optimization_flags: &OptimizationFlags) -> Compilation {
+    compile_with_threads(program, optimization_flags, thread::available_parallelism().map_or(1, |threads| threads.get()))
+}
+
+
+/// Like `compile`, running the flow analysis passes on at most `threads` threads
+pub fn compile_with_threads(program: &str, optimization_flags: &OptimizationFlags, threads: usize) -> Compilation {
+
+    let source: SourceCode = program.lines().map(String::from).collect();
+    let unit_path = Path::new("test.o2");
+    let mut symbol_table = SymbolTable::new();
+
+    let tokens = tokenizer::tokenize(&source, unit_path, &mut symbol_table);
+    let ast = ast::build_ast(tokens, &source, &mut symbol_table, false);
+    let functions = function_parser::parse_functions(ast, optimization_flags, &mut symbol_table, &source, false);
+    let ir_code = irc::generate(functions, &mut symbol_table, optimization_flags, false, &source);
+
+    let ir_text = ir_code.iter().map(|function| function.to_string()).collect();
+
+    let function_graphs = flow_analyzer::flow_graph_with_threads(ir_code, optimization_flags, false, threads);
+    let function_graphs_text = format!("{:#?}", function_graphs);
+
+    let bytecode = rusty_vm::generate_bytecode(&symbol_table, function_graphs).unwrap();
+
+    Compilation {
+        ir_code: ir_text,
+        function_graphs: function_graphs_text,
+        bytecode,
+    }
+}
@@ -1,4 +1,5 @@
 use std::borrow::Cow;
+use std::iter;
 use std::path::Path;
 
 use super::{Priority, SourceToken, Token, TokenKind, TokenPriority, Value, TokenParsingList};
@@ -188,21 +189,21 @@ impl TokenizerStatus {
 }
 
 
-/// Divide the source code into meaningful string tokens
+/// Divide the source code into meaningful string tokens.
+///
+/// The tokens are matched lazily, one line at a time, and borrow their text from the source
 fn lex<'a>(source: &'a SourceCode, unit_path: &'a Path) -> impl Iterator<Item = SourceToken<'a>> {
 
     let mut multiline_comment = false;
 
-    source.iter().enumerate().flat_map(
-        move |(line_index, line)| {
+    let mut lines = source.iter().enumerate();
+    let mut line_matches: Option<(usize, regex::Matches<'static, 'a>)> = None;
 
-            if line.trim().is_empty() && !multiline_comment {
-                return Vec::new();
-            }
+    iter::from_fn(move || loop {
 
-            let mut matches = Vec::new();
+        if let Some((line_index, matches)) = &mut line_matches {
 
-            for mat in TOKEN_REGEX.find_iter(line) {
+            for mat in matches.by_ref() {
 
                 if multiline_comment {
                     if mat.as_str() == "*/" {
@@ -212,23 +213,26 @@ fn lex<'a>(source: &'a SourceCode, unit_path: &'a Path) -> impl Iterator<Item =
                 }
 
                 match mat.as_str() {
+                    // The rest of the line is a comment
                     "//" => break,
                     "/*" => {
                         multiline_comment = true;
                     },
-                    s => matches.push(
+                    s => return Some(
                         SourceToken {
                             string: s,
                             unit_path,
-                            line_index,
+                            line_index: *line_index,
                             column: mat.start() + 1
                         }
                     )
                 }
             }
-            matches
         }
-    )
+
+        let (line_index, line) = lines.next()?;
+        line_matches = Some((line_index, TOKEN_REGEX.find_iter(line)));
+    })
 }
 
 
@@ -462,3 +466,41 @@ pub fn tokenize<'a>(source: &'a SourceCode, unit_path: &'a Path, symbol_table: &
     tokens
 }
 
+
+
+#[cfg(test)]
+mod tests {
+
+    use super::*;
+
+
+    #[test]
+    fn test_lex() {
+        let source: SourceCode = [
+            "fn main() {",
+            "    let s: str = \"a // b\"; // comment",
+            "",
+            "    x = 1.5 /* comment",
+            "    still comment */ -> 'c' >= -2;",
+            "}",
+        ].iter().map(|line| line.to_string()).collect();
+        let unit_path = Path::new("lex.oxide");
+
+        let tokens: Vec<(&str, usize, usize)> = lex(&source, unit_path)
+            .map(|token| (token.string, token.line_index, token.column))
+            .collect();
+
+        assert_eq!(tokens, [
+            ("fn", 0, 1), ("main", 0, 4), ("(", 0, 8), (")", 0, 9), ("{", 0, 11),
+            ("let", 1, 5), ("s", 1, 9), (":", 1, 10), ("str", 1, 12), ("=", 1, 16), ("\"a // b\"", 1, 18), (";", 1, 26),
+            ("x", 3, 5), ("=", 3, 7), ("1.5", 3, 9),
+            ("->", 4, 22), ("'c'", 4, 25), (">=", 4, 29), ("-2", 4, 32), (";", 4, 34),
+            ("}", 5, 1),
+        ]);
+
+        // The tokens borrow their text from the source
+        let first = lex(&source, unit_path).next().unwrap();
+        assert!(std::ptr::eq(first.string.as_ptr(), source[0].as_ptr()));
+    }
+
+}
@@ -1,6 +1,7 @@
 use std::fmt::Display;
 use std::path::Path;
 use std::rc::Rc;
+use std::sync::Arc;
 use std::ptr;
 
 use crate::lang::data_types::{DataType, LiteralValue};
@@ -475,7 +476,7 @@ impl SourceToken<'_> {
 #[derive(Debug)]
 pub enum Value<'a> {
 
-    Literal { value: Rc<LiteralValue> },
+    Literal { value: Arc<LiteralValue> },
     Symbol { name: &'a str, scope_discriminant: ScopeDiscriminant }
 
 }
@@ -560,7 +561,7 @@ pub enum TokenKind<'a> {
     Continue,
 
     Value (Value<'a>),
-    DataType (Rc<DataType>),
+    DataType (Arc<DataType>),
 
     RefType,
 
@@ -1,6 +1,9 @@
 use std::mem;
 use std::fmt;
 
+use crate::registers::{Registers, REGISTER_COUNT};
+use crate::vm::Address;
+
 
 macro_rules! declare_bytecodes {
     ($($name:ident),+) => {       
@@ -130,7 +133,125 @@ declare_bytecodes! {
     INTERRUPT_CONST,
     INTERRUPT_ADDR_LITERAL,
 
-    EXIT
+    EXIT,
+
+    // Bulk memory operations. Their operands are passed in r1, r2 and r3
+
+    MEMORY_COPY,
+    MEMORY_SET,
+    MEMORY_COMPARE,
+    STRING_LENGTH,
+    MEMORY_FIND,
+
+    // Superinstructions emitted by the assembler in place of common instruction sequences
+
+    COMPARE_JUMP_REG_REG,
+    COMPARE_JUMP_REG_CONST,
+    COMPARE_JUMP_ADDR_IN_REG_REG,
+    COMPARE_JUMP_ADDR_IN_REG_CONST,
+
+    PUSH_FROM_REG_CALL,
+    PUSH_FROM_CONST_CALL,
+
+    POP_INTO_REG_RETURN,
+
+    // Size-specialized instructions emitted by the assembler in place of the generic ones.
+    // The handled size is encoded in the opcode instead of in an operand byte
+
+    MOVE_INTO_REG_FROM_ADDR_IN_REG_1,
+    MOVE_INTO_REG_FROM_ADDR_IN_REG_2,
+    MOVE_INTO_REG_FROM_ADDR_IN_REG_4,
+    MOVE_INTO_REG_FROM_ADDR_IN_REG_8,
+
+    MOVE_INTO_REG_FROM_ADDR_LITERAL_1,
+    MOVE_INTO_REG_FROM_ADDR_LITERAL_2,
+    MOVE_INTO_REG_FROM_ADDR_LITERAL_4,
+    MOVE_INTO_REG_FROM_ADDR_LITERAL_8,
+
+    MOVE_INTO_ADDR_IN_REG_FROM_REG_1,
+    MOVE_INTO_ADDR_IN_REG_FROM_REG_2,
+    MOVE_INTO_ADDR_IN_REG_FROM_REG_4,
+    MOVE_INTO_ADDR_IN_REG_FROM_REG_8,
+
+    MOVE_INTO_ADDR_IN_REG_FROM_CONST_1,
+    MOVE_INTO_ADDR_IN_REG_FROM_CONST_2,
+    MOVE_INTO_ADDR_IN_REG_FROM_CONST_4,
+    MOVE_INTO_ADDR_IN_REG_FROM_CONST_8,
+
+    MOVE_INTO_ADDR_LITERAL_FROM_REG_1,
+    MOVE_INTO_ADDR_LITERAL_FROM_REG_2,
+    MOVE_INTO_ADDR_LITERAL_FROM_REG_4,
+    MOVE_INTO_ADDR_LITERAL_FROM_REG_8,
+
+    MOVE_INTO_ADDR_LITERAL_FROM_CONST_1,
+    MOVE_INTO_ADDR_LITERAL_FROM_CONST_2,
+    MOVE_INTO_ADDR_LITERAL_FROM_CONST_4,
+    MOVE_INTO_ADDR_LITERAL_FROM_CONST_8,
+
+    // Atomic memory operations, used to synchronize guest threads. Their operands are passed in r1, r2 and r3
+
+    ATOMIC_COMPARE_EXCHANGE,
+    ATOMIC_FETCH_ADD,
+    ATOMIC_EXCHANGE,
+    FENCE
+
+}
+
+
+macro_rules! declare_sized_variants {
+    ($($generic:ident => [$size1:ident, $size2:ident, $size4:ident, $size8:ident]),+) => {
+
+impl ByteCodes {
+
+    /// Return the variant of the instruction that handles `size` bytes without encoding the handled size, if any
+    pub const fn sized_variant(&self, size: u8) -> Option<ByteCodes> {
+        match (self, size) {
+            $(
+                (Self::$generic, 1) => Some(Self::$size1),
+                (Self::$generic, 2) => Some(Self::$size2),
+                (Self::$generic, 4) => Some(Self::$size4),
+                (Self::$generic, 8) => Some(Self::$size8),
+            )+
+            _ => None
+        }
+    }
+
+
+    /// Return the generic instruction and the handled size of a size-specialized instruction
+    pub const fn fixed_size(&self) -> Option<(ByteCodes, u8)> {
+        match self {
+            $(
+                Self::$size1 => Some((Self::$generic, 1)),
+                Self::$size2 => Some((Self::$generic, 2)),
+                Self::$size4 => Some((Self::$generic, 4)),
+                Self::$size8 => Some((Self::$generic, 8)),
+            )+
+            _ => None
+        }
+    }
+
+
+    /// Return the generic instruction of a size-specialized instruction, or the instruction itself
+    pub const fn generic_variant(&self) -> ByteCodes {
+        match self.fixed_size() {
+            Some((generic, _)) => generic,
+            None => *self
+        }
+    }
+
+}
+
+    };
+}
+
+declare_sized_variants! {
+
+    MOVE_INTO_REG_FROM_ADDR_IN_REG => [MOVE_INTO_REG_FROM_ADDR_IN_REG_1, MOVE_INTO_REG_FROM_ADDR_IN_REG_2, MOVE_INTO_REG_FROM_ADDR_IN_REG_4, MOVE_INTO_REG_FROM_ADDR_IN_REG_8],
+    MOVE_INTO_REG_FROM_ADDR_LITERAL => [MOVE_INTO_REG_FROM_ADDR_LITERAL_1, MOVE_INTO_REG_FROM_ADDR_LITERAL_2, MOVE_INTO_REG_FROM_ADDR_LITERAL_4, MOVE_INTO_REG_FROM_ADDR_LITERAL_8],
+    MOVE_INTO_ADDR_IN_REG_FROM_REG => [MOVE_INTO_ADDR_IN_REG_FROM_REG_1, MOVE_INTO_ADDR_IN_REG_FROM_REG_2, MOVE_INTO_ADDR_IN_REG_FROM_REG_4, MOVE_INTO_ADDR_IN_REG_FROM_REG_8],
+    MOVE_INTO_ADDR_IN_REG_FROM_CONST => [MOVE_INTO_ADDR_IN_REG_FROM_CONST_1, MOVE_INTO_ADDR_IN_REG_FROM_CONST_2, MOVE_INTO_ADDR_IN_REG_FROM_CONST_4, MOVE_INTO_ADDR_IN_REG_FROM_CONST_8],
+    MOVE_INTO_ADDR_LITERAL_FROM_REG => [MOVE_INTO_ADDR_LITERAL_FROM_REG_1, MOVE_INTO_ADDR_LITERAL_FROM_REG_2, MOVE_INTO_ADDR_LITERAL_FROM_REG_4, MOVE_INTO_ADDR_LITERAL_FROM_REG_8],
+    MOVE_INTO_ADDR_LITERAL_FROM_CONST => [MOVE_INTO_ADDR_LITERAL_FROM_CONST_1, MOVE_INTO_ADDR_LITERAL_FROM_CONST_2, MOVE_INTO_ADDR_LITERAL_FROM_CONST_4, MOVE_INTO_ADDR_LITERAL_FROM_CONST_8]
 
 }
 
@@ -157,8 +278,375 @@ impl std::convert::From<u8> for ByteCodes {
 }
 
 
+macro_rules! declare_jump_conditions {
+    ($($name:ident => $jump:ident),+) => {
+
+/// Represents the condition of a conditional jump.
+/// 
+/// Used to encode the condition of the fused compare-and-jump instructions
+#[derive(Debug, Clone, Copy)]
+#[repr(u8)]
+pub enum JumpCondition {
+    $($name),+
+}
+
+
+impl JumpCondition {
+
+    /// Return the condition checked by the given conditional jump instruction
+    pub const fn from_jump(instruction: ByteCodes) -> Option<Self> {
+        match instruction {
+            $(ByteCodes::$jump => Some(Self::$name),)+
+            _ => None
+        }
+    }
+
+
+    /// Return the conditional jump instruction that checks this condition
+    pub const fn to_jump(&self) -> ByteCodes {
+        match self {
+            $(Self::$name => ByteCodes::$jump),+
+        }
+    }
+
+}
+
+    };
+}
+
+declare_jump_conditions! {
+
+    NotZero => JUMP_NOT_ZERO,
+    Zero => JUMP_ZERO,
+    Greater => JUMP_GREATER,
+    Less => JUMP_LESS,
+    GreaterOrEqual => JUMP_GREATER_OR_EQUAL,
+    LessOrEqual => JUMP_LESS_OR_EQUAL,
+    Carry => JUMP_CARRY,
+    NotCarry => JUMP_NOT_CARRY,
+    Overflow => JUMP_OVERFLOW,
+    NotOverflow => JUMP_NOT_OVERFLOW,
+    Sign => JUMP_SIGN,
+    NotSign => JUMP_NOT_SIGN
+
+}
+
+
+pub const JUMP_CONDITION_COUNT: usize = mem::variant_count::<JumpCondition>();
+
+
+impl std::convert::From<u8> for JumpCondition {
+
+    fn from(value: u8) -> Self {
+        if value < JUMP_CONDITION_COUNT as u8 {
+            unsafe { std::mem::transmute(value) }
+        } else {
+            panic!("Invalid jump condition: {}", value);
+        }
+    }
+}
+
+
+/// Return the superinstruction that can replace `first` immediately followed by `second`, if any.
+/// 
+/// The superinstruction is encoded as the bytecode of `first` followed by the operands of `second`.
+/// If `second` is a conditional jump, its condition is encoded in place of its opcode.
+pub const fn get_superinstruction(first: ByteCodes, second: ByteCodes) -> Option<ByteCodes> {
+    let is_conditional_jump = JumpCondition::from_jump(second).is_some();
+
+    Some(match first {
+        ByteCodes::COMPARE_REG_REG if is_conditional_jump => ByteCodes::COMPARE_JUMP_REG_REG,
+        ByteCodes::COMPARE_REG_CONST if is_conditional_jump => ByteCodes::COMPARE_JUMP_REG_CONST,
+        ByteCodes::COMPARE_ADDR_IN_REG_REG if is_conditional_jump => ByteCodes::COMPARE_JUMP_ADDR_IN_REG_REG,
+        ByteCodes::COMPARE_ADDR_IN_REG_CONST if is_conditional_jump => ByteCodes::COMPARE_JUMP_ADDR_IN_REG_CONST,
+        ByteCodes::PUSH_FROM_REG if matches!(second, ByteCodes::CALL) => ByteCodes::PUSH_FROM_REG_CALL,
+        ByteCodes::PUSH_FROM_CONST if matches!(second, ByteCodes::CALL) => ByteCodes::PUSH_FROM_CONST_CALL,
+        ByteCodes::POP_INTO_REG if matches!(second, ByteCodes::RETURN) => ByteCodes::POP_INTO_REG_RETURN,
+        _ => return None
+    })
+}
+
+
+/// How an instruction operand is encoded in the bytecode
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum OperandKind {
+
+    /// The operand slot is unused
+    None,
+    /// A register id, used both for register operands and for addresses stored in registers
+    Register,
+    /// A constant of `handled_size` bytes
+    Constant,
+    /// An address literal
+    Address,
+
+}
+
+
+/// Describes the operands that follow an opcode in the bytecode
+#[derive(Debug, Clone, Copy)]
+pub struct OperandLayout {
+
+    /// Whether the opcode is followed by a handled size byte
+    pub sized: bool,
+    pub operands: [OperandKind; 2],
+    /// Whether the operands are followed by a jump condition byte
+    pub condition: bool,
+    /// Whether the instruction ends with a jump target address
+    pub target: bool,
+
+}
+
+
+impl OperandLayout {
+
+    const fn new(sized: bool, first: OperandKind, second: OperandKind) -> Self {
+        Self {
+            sized,
+            operands: [first, second],
+            condition: false,
+            target: false,
+        }
+    }
+
+
+    const fn with_target(mut self, condition: bool) -> Self {
+        self.condition = condition;
+        self.target = true;
+        self
+    }
+
+}
+
+
+impl ByteCodes {
+
+    /// Return the operand encoding of the instruction.
+    /// 
+    /// `INTERRUPT_CONST` is the only generic instruction with a constant operand but no handled size byte: its constant is always 1 byte long.
+    /// Size-specialized instructions have the same operands as their generic instruction, without the handled size byte.
+    pub const fn operand_layout(&self) -> OperandLayout {
+        use OperandKind::*;
+
+        if let Some((generic, _)) = self.fixed_size() {
+            let mut layout = generic.operand_layout();
+            layout.sized = false;
+            return layout;
+        }
+
+        match self {
+
+            Self::INTEGER_ADD |
+            Self::INTEGER_SUB |
+            Self::INTEGER_MUL |
+            Self::INTEGER_DIV |
+            Self::INTEGER_MOD |
+            Self::FLOAT_ADD |
+            Self::FLOAT_SUB |
+            Self::FLOAT_MUL |
+            Self::FLOAT_DIV |
+            Self::FLOAT_MOD |
+            Self::NO_OPERATION |
+            Self::LABEL |
+            Self::RETURN |
+            Self::AND |
+            Self::OR |
+            Self::XOR |
+            Self::NOT |
+            Self::SHIFT_LEFT |
+            Self::SHIFT_RIGHT |
+            Self::EXIT |
+            Self::MEMORY_COPY |
+            Self::MEMORY_SET |
+            Self::MEMORY_COMPARE |
+            Self::STRING_LENGTH |
+            Self::MEMORY_FIND |
+            Self::FENCE
+                => OperandLayout::new(false, None, None),
+
+            Self::ATOMIC_COMPARE_EXCHANGE |
+            Self::ATOMIC_FETCH_ADD |
+            Self::ATOMIC_EXCHANGE
+                => OperandLayout::new(true, None, None),
+
+            Self::INC_REG |
+            Self::DEC_REG |
+            Self::PUSH_FROM_REG |
+            Self::PUSH_STACK_POINTER_REG |
+            Self::POP_STACK_POINTER_REG |
+            Self::INTERRUPT_REG |
+            Self::INTERRUPT_ADDR_IN_REG
+                => OperandLayout::new(false, Register, None),
+
+            Self::INC_ADDR_IN_REG |
+            Self::DEC_ADDR_IN_REG |
+            Self::PUSH_FROM_ADDR_IN_REG |
+            Self::PUSH_STACK_POINTER_ADDR_IN_REG |
+            Self::POP_INTO_REG |
+            Self::POP_INTO_ADDR_IN_REG |
+            Self::POP_STACK_POINTER_ADDR_IN_REG
+                => OperandLayout::new(true, Register, None),
+
+            Self::INC_ADDR_LITERAL |
+            Self::DEC_ADDR_LITERAL |
+            Self::PUSH_FROM_ADDR_LITERAL |
+            Self::PUSH_STACK_POINTER_ADDR_LITERAL |
+            Self::POP_INTO_ADDR_LITERAL |
+            Self::POP_STACK_POINTER_ADDR_LITERAL
+                => OperandLayout::new(true, Address, None),
+
+            Self::PUSH_FROM_CONST |
+            Self::PUSH_STACK_POINTER_CONST |
+            Self::POP_STACK_POINTER_CONST
+                => OperandLayout::new(true, Constant, None),
+
+            Self::JUMP |
+            Self::JUMP_NOT_ZERO |
+            Self::JUMP_ZERO |
+            Self::JUMP_GREATER |
+            Self::JUMP_LESS |
+            Self::JUMP_GREATER_OR_EQUAL |
+            Self::JUMP_LESS_OR_EQUAL |
+            Self::JUMP_CARRY |
+            Self::JUMP_NOT_CARRY |
+            Self::JUMP_OVERFLOW |
+            Self::JUMP_NOT_OVERFLOW |
+            Self::JUMP_SIGN |
+            Self::JUMP_NOT_SIGN |
+            Self::CALL |
+            Self::INTERRUPT_ADDR_LITERAL
+                => OperandLayout::new(false, Address, None),
+
+            Self::INTERRUPT_CONST
+                => OperandLayout::new(false, Constant, None),
+
+            Self::MOVE_INTO_REG_FROM_REG |
+            Self::COMPARE_REG_REG
+                => OperandLayout::new(false, Register, Register),
+
+            Self::MOVE_INTO_REG_FROM_ADDR_IN_REG |
+            Self::MOVE_INTO_ADDR_IN_REG_FROM_REG |
+            Self::MOVE_INTO_ADDR_IN_REG_FROM_ADDR_IN_REG |
+            Self::COMPARE_REG_ADDR_IN_REG |
+            Self::COMPARE_ADDR_IN_REG_REG |
+            Self::COMPARE_ADDR_IN_REG_ADDR_IN_REG
+                => OperandLayout::new(true, Register, Register),
+
+            Self::MOVE_INTO_REG_FROM_CONST |
+            Self::MOVE_INTO_ADDR_IN_REG_FROM_CONST |
+            Self::COMPARE_REG_CONST |
+            Self::COMPARE_ADDR_IN_REG_CONST
+                => OperandLayout::new(true, Register, Constant),
+
+            Self::MOVE_INTO_REG_FROM_ADDR_LITERAL |
+            Self::MOVE_INTO_ADDR_IN_REG_FROM_ADDR_LITERAL |
+            Self::COMPARE_REG_ADDR_LITERAL |
+            Self::COMPARE_ADDR_IN_REG_ADDR_LITERAL
+                => OperandLayout::new(true, Register, Address),
+
+            Self::MOVE_INTO_ADDR_LITERAL_FROM_REG |
+            Self::MOVE_INTO_ADDR_LITERAL_FROM_ADDR_IN_REG |
+            Self::COMPARE_ADDR_LITERAL_REG |
+            Self::COMPARE_ADDR_LITERAL_ADDR_IN_REG
+                => OperandLayout::new(true, Address, Register),
+
+            Self::MOVE_INTO_ADDR_LITERAL_FROM_CONST |
+            Self::COMPARE_ADDR_LITERAL_CONST
+                => OperandLayout::new(true, Address, Constant),
+
+            Self::MOVE_INTO_ADDR_LITERAL_FROM_ADDR_LITERAL |
+            Self::COMPARE_ADDR_LITERAL_ADDR_LITERAL
+                => OperandLayout::new(true, Address, Address),
+
+            Self::COMPARE_CONST_REG |
+            Self::COMPARE_CONST_ADDR_IN_REG
+                => OperandLayout::new(true, Constant, Register),
+
+            Self::COMPARE_CONST_CONST
+                => OperandLayout::new(true, Constant, Constant),
+
+            Self::COMPARE_CONST_ADDR_LITERAL
+                => OperandLayout::new(true, Constant, Address),
+
+            Self::COMPARE_JUMP_REG_REG
+                => OperandLayout::new(false, Register, Register).with_target(true),
+
+            Self::COMPARE_JUMP_ADDR_IN_REG_REG
+                => OperandLayout::new(true, Register, Register).with_target(true),
+
+            Self::COMPARE_JUMP_REG_CONST |
+            Self::COMPARE_JUMP_ADDR_IN_REG_CONST
+                => OperandLayout::new(true, Register, Constant).with_target(true),
+
+            Self::PUSH_FROM_REG_CALL
+                => OperandLayout::new(false, Register, None).with_target(false),
+
+            Self::PUSH_FROM_CONST_CALL
+                => OperandLayout::new(true, Constant, None).with_target(false),
+
+            Self::POP_INTO_REG_RETURN
+                => OperandLayout::new(true, Register, None),
+
+            // Handled above
+            _ => unreachable!()
+
+        }
+    }
+
+}
+
+
 /// Return whether the given instruction is a jump instruction
 pub fn is_jump_instruction(instruction: ByteCodes) -> bool {
     ByteCodes::JUMP as usize <= instruction as usize && instruction as usize <= ByteCodes::RETURN as usize
 }
 
+
+fn register_name(id: u8) -> String {
+    if (id as usize) < REGISTER_COUNT {
+        Registers::from(id).to_string()
+    } else {
+        format!("<invalid register {}>", id)
+    }
+}
+
+
+/// Format an instruction from its decoded operands, laid out as described by `ByteCodes::operand_layout`.
+/// Used by the tools that list byte code, so that they all show instructions the same way
+pub fn format_instruction(opcode: u8, handled_size: u8, registers: [u8; 2], args: [u64; 2], condition: u8, target: Address) -> String {
+
+    if opcode as usize >= BYTE_CODE_COUNT {
+        return format!("<invalid opcode {}>", opcode);
+    }
+    let opcode = ByteCodes::from(opcode);
+    let layout = opcode.operand_layout();
+
+    let mut line = opcode.to_string();
+
+    if handled_size != 0 {
+        line += &format!(" ({}B)", handled_size);
+    }
+
+    for (i, kind) in layout.operands.iter().enumerate() {
+        match kind {
+            OperandKind::None => {},
+            OperandKind::Register => line += &format!(" {}", register_name(registers[i])),
+            OperandKind::Constant => line += &format!(" {}", args[i]),
+            OperandKind::Address => line += &format!(" [{:#x}]", args[i]),
+        }
+    }
+
+    if layout.condition {
+        if (condition as usize) < JUMP_CONDITION_COUNT {
+            line += &format!(" if {:?}", JumpCondition::from(condition));
+        } else {
+            line += &format!(" if <invalid condition {}>", condition);
+        }
+    }
+
+    if layout.target {
+        line += &format!(" -> {:#x}", target);
+    }
+
+    line
+}
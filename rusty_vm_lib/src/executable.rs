@@ -0,0 +1,420 @@
+use crate::vm::{Address, ADDRESS_SIZE};
+
+
+/// Bytes at the start of every executable file
+pub const EXECUTABLE_MAGIC: &[u8; 8] = b"RVMEXEC\0";
+
+pub const EXECUTABLE_VERSION: u32 = 2;
+
+/// Size of the executable header: magic, version, section count, entry point, table checksum and contents checksum
+pub const EXECUTABLE_HEADER_SIZE: usize = EXECUTABLE_MAGIC.len() + 4 + 4 + 8 + 8 + 8;
+
+/// Offset of the checksum of the header fields before it and of the section table
+const TABLE_CHECKSUM_OFFSET: usize = 24;
+
+/// Offset of the checksum of the bytes after the section table
+const CONTENTS_CHECKSUM_OFFSET: usize = 32;
+
+/// Size of every entry of the section table, which follows the header: kind, flags, address, size and offset
+pub const SECTION_ENTRY_SIZE: usize = 4 + 4 + 8 + 8 + 8;
+
+/// Sections of at least this size are stored at an offset congruent to their address modulo `SECTION_ALIGNMENT`,
+/// so that the loader can map their pages. Smaller sections are packed right after each other, since copying them is cheaper than mapping them
+pub const MAPPED_SECTION_MIN_SIZE: usize = 256 * 1024;
+
+/// Alignment of the mapped sections in the file. It's a multiple of the common host page sizes
+pub const SECTION_ALIGNMENT: usize = 16 * 1024;
+
+/// Runs of zeros in the program image at least this long are stored as bss sections, which take no space in the file.
+/// Shorter runs would take less space than the section table entries needed to split the image around them
+const MIN_BSS_SIZE: usize = 4 * SECTION_ENTRY_SIZE;
+
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+#[repr(u32)]
+pub enum SectionKind {
+
+    /// Program image bytes, loaded at their address in memory. Data declared in the program is part of the image
+    Code = 0,
+    /// Zeroed program image bytes, which are not stored in the file
+    Bss = 1,
+    /// Symbol table of the program, encoded by `symbols::encode_symbols`. It's not loaded in memory
+    Symbols = 2,
+
+}
+
+
+impl SectionKind {
+
+    fn from_u32(kind: u32) -> Option<Self> {
+        match kind {
+            0 => Some(Self::Code),
+            1 => Some(Self::Bss),
+            2 => Some(Self::Symbols),
+            _ => None
+        }
+    }
+
+}
+
+
+#[derive(Debug, Clone)]
+pub struct Section<'a> {
+
+    pub kind: SectionKind,
+    /// Address of the section in the program image. Unused by the symbol table
+    pub address: Address,
+    /// Size of the section in memory
+    pub size: usize,
+    /// Content of the section, which is empty for bss sections
+    pub data: &'a [u8],
+    /// Offset of the content in the file the section was parsed from
+    pub offset: usize,
+
+}
+
+
+/// A program split into sections, as stored in an executable file
+#[derive(Debug, Clone)]
+pub struct Executable<'a> {
+
+    pub entry: Address,
+    pub sections: Vec<Section<'a>>,
+
+}
+
+
+/// FNV-1a hash of the bytes, continuing from `hash`. Used to detect corrupted executables
+fn checksum_from(hash: u64, bytes: &[u8]) -> u64 {
+    bytes.iter().fold(hash, |hash, &byte| (hash ^ byte as u64).wrapping_mul(0x100000001b3))
+}
+
+
+fn checksum(bytes: &[u8]) -> u64 {
+    checksum_from(0xcbf29ce484222325, bytes)
+}
+
+
+/// Checksum of the header fields before the checksums and of the section table, which ends at `table_end`
+fn table_checksum(bytes: &[u8], table_end: usize) -> u64 {
+    checksum_from(checksum(&bytes[..TABLE_CHECKSUM_OFFSET]), &bytes[EXECUTABLE_HEADER_SIZE..table_end])
+}
+
+
+fn read_u32(bytes: &[u8], offset: usize) -> u32 {
+    u32::from_le_bytes(bytes[offset..offset + 4].try_into().unwrap())
+}
+
+
+fn read_u64(bytes: &[u8], offset: usize) -> u64 {
+    u64::from_le_bytes(bytes[offset..offset + 8].try_into().unwrap())
+}
+
+
+impl<'a> Executable<'a> {
+
+    /// Split a raw program image, whose last bytes are the address of its entry point, into sections.
+    /// This is the layout of the byte code generated by the assembler
+    pub fn from_image(byte_code: &'a [u8]) -> Result<Self, String> {
+
+        if byte_code.len() < ADDRESS_SIZE {
+            return Err(format!("Bytecode is too small to contain a start address: minimum required size is {} bytes, got {}", ADDRESS_SIZE, byte_code.len()));
+        }
+
+        let (image, entry) = byte_code.split_at(byte_code.len() - ADDRESS_SIZE);
+        let entry = Address::from_le_bytes(entry.try_into().unwrap());
+
+        let mut sections = Vec::new();
+        let push_code = |sections: &mut Vec<Section<'a>>, start: usize, end: usize| if start < end {
+            sections.push(Section { kind: SectionKind::Code, address: start, size: end - start, data: &image[start..end], offset: 0 });
+        };
+
+        // Start of the image bytes that are not yet part of a section
+        let mut code_start = 0;
+        let mut zeros_start = 0;
+
+        for (i, &byte) in image.iter().enumerate() {
+            if byte != 0 {
+                if i - zeros_start >= MIN_BSS_SIZE {
+                    push_code(&mut sections, code_start, zeros_start);
+                    sections.push(Section { kind: SectionKind::Bss, address: zeros_start, size: i - zeros_start, data: &[], offset: 0 });
+                    code_start = i;
+                }
+                zeros_start = i + 1;
+            }
+        }
+
+        // Zeros at the end of the image
+        if image.len() - zeros_start >= MIN_BSS_SIZE {
+            push_code(&mut sections, code_start, zeros_start);
+            sections.push(Section { kind: SectionKind::Bss, address: zeros_start, size: image.len() - zeros_start, data: &[], offset: 0 });
+        } else {
+            push_code(&mut sections, code_start, image.len());
+        }
+
+        Ok(Self { entry, sections })
+    }
+
+
+    /// Parse an executable file or, if the bytes don't start with the executable magic, a raw program image
+    pub fn load(bytes: &'a [u8]) -> Result<Self, String> {
+        if bytes.starts_with(EXECUTABLE_MAGIC) {
+            Self::parse(bytes)
+        } else {
+            Self::from_image(bytes)
+        }
+    }
+
+
+    /// Parse an executable file written by `encode`.
+    ///
+    /// Only the header and the section table are checked against their checksum, so that loading doesn't read every page of the file.
+    /// Use `verify` to also check the section contents
+    pub fn parse(bytes: &'a [u8]) -> Result<Self, String> {
+
+        if bytes.len() < EXECUTABLE_HEADER_SIZE || !bytes.starts_with(EXECUTABLE_MAGIC) {
+            return Err("Not an executable file".to_string());
+        }
+
+        let version = read_u32(bytes, 8);
+        if version != EXECUTABLE_VERSION {
+            return Err(format!("Unsupported executable version {}", version));
+        }
+
+        let section_count = read_u32(bytes, 12) as usize;
+        let entry = read_u64(bytes, 16) as Address;
+
+        let table_end = section_count.checked_mul(SECTION_ENTRY_SIZE)
+            .and_then(|size| size.checked_add(EXECUTABLE_HEADER_SIZE))
+            .filter(|&table_end| table_end <= bytes.len())
+            .ok_or_else(|| "The section table is truncated".to_string())?;
+
+        if table_checksum(bytes, table_end) != read_u64(bytes, TABLE_CHECKSUM_OFFSET) {
+            return Err("The executable is corrupted: section table checksum mismatch".to_string());
+        }
+
+        let sections = (0..section_count).map(|index| {
+
+            let entry_offset = EXECUTABLE_HEADER_SIZE + index * SECTION_ENTRY_SIZE;
+
+            let kind = SectionKind::from_u32(read_u32(bytes, entry_offset)).ok_or_else(
+                || format!("Section {} has an unknown kind {}", index, read_u32(bytes, entry_offset))
+            )?;
+            let address = read_u64(bytes, entry_offset + 8) as Address;
+            let size = read_u64(bytes, entry_offset + 16) as usize;
+            let offset = read_u64(bytes, entry_offset + 24) as usize;
+
+            if address.checked_add(size).is_none() {
+                return Err(format!("Section {} overflows the address space", index));
+            }
+
+            let data = if kind == SectionKind::Bss {
+                &[]
+            } else {
+                offset.checked_add(size).and_then(|end| bytes.get(offset..end)).ok_or_else(
+                    || format!("Section {} is truncated", index)
+                )?
+            };
+
+            Ok(Section { kind, address, size, data, offset })
+
+        }).collect::<Result<Vec<Section>, String>>()?;
+
+        Ok(Self { entry, sections })
+    }
+
+
+    /// Check the whole executable file, including the section contents that `parse` doesn't check.
+    /// This reads every byte of the file
+    pub fn verify(bytes: &[u8]) -> Result<(), String> {
+        let executable = Executable::parse(bytes)?;
+        let table_end = EXECUTABLE_HEADER_SIZE + executable.sections.len() * SECTION_ENTRY_SIZE;
+        if checksum(&bytes[table_end..]) != read_u64(bytes, CONTENTS_CHECKSUM_OFFSET) {
+            return Err("The executable is corrupted: contents checksum mismatch".to_string());
+        }
+        Ok(())
+    }
+
+
+    /// Encode the executable file. The offsets of the sections are recomputed
+    pub fn encode(&self) -> Vec<u8> {
+
+        let table_end = EXECUTABLE_HEADER_SIZE + self.sections.len() * SECTION_ENTRY_SIZE;
+
+        // Place the section contents after the section table
+        let mut end = table_end;
+        let offsets: Vec<usize> = self.sections.iter().map(|section| {
+            if section.data.len() >= MAPPED_SECTION_MIN_SIZE {
+                end += (section.address % SECTION_ALIGNMENT + SECTION_ALIGNMENT - end % SECTION_ALIGNMENT) % SECTION_ALIGNMENT;
+            }
+            let offset = end;
+            end += section.data.len();
+            offset
+        }).collect();
+
+        let mut bytes = Vec::with_capacity(end);
+        bytes.extend_from_slice(EXECUTABLE_MAGIC);
+        bytes.extend_from_slice(&EXECUTABLE_VERSION.to_le_bytes());
+        bytes.extend_from_slice(&(self.sections.len() as u32).to_le_bytes());
+        bytes.extend_from_slice(&(self.entry as u64).to_le_bytes());
+        // Checksum placeholders
+        bytes.extend_from_slice(&0u64.to_le_bytes());
+        bytes.extend_from_slice(&0u64.to_le_bytes());
+
+        for (section, &offset) in self.sections.iter().zip(&offsets) {
+            bytes.extend_from_slice(&(section.kind as u32).to_le_bytes());
+            // Flags, reserved
+            bytes.extend_from_slice(&0u32.to_le_bytes());
+            bytes.extend_from_slice(&(section.address as u64).to_le_bytes());
+            bytes.extend_from_slice(&(section.size as u64).to_le_bytes());
+            bytes.extend_from_slice(&(offset as u64).to_le_bytes());
+        }
+
+        for (section, &offset) in self.sections.iter().zip(&offsets) {
+            bytes.resize(offset, 0);
+            bytes.extend_from_slice(section.data);
+        }
+
+        let table_checksum = table_checksum(&bytes, table_end);
+        bytes[TABLE_CHECKSUM_OFFSET..TABLE_CHECKSUM_OFFSET + 8].copy_from_slice(&table_checksum.to_le_bytes());
+        let contents_checksum = checksum(&bytes[table_end..]);
+        bytes[CONTENTS_CHECKSUM_OFFSET..CONTENTS_CHECKSUM_OFFSET + 8].copy_from_slice(&contents_checksum.to_le_bytes());
+
+        bytes
+    }
+
+
+    /// Add the encoded symbol table of the program
+    pub fn add_symbols(&mut self, symbols: &'a str) {
+        self.sections.push(Section { kind: SectionKind::Symbols, address: 0, size: symbols.len(), data: symbols.as_bytes(), offset: 0 });
+    }
+
+
+    /// Return the encoded symbol table of the program, if any
+    pub fn symbols(&self) -> Option<&'a str> {
+        self.sections.iter()
+            .find(|section| section.kind == SectionKind::Symbols)
+            .and_then(|section| std::str::from_utf8(section.data).ok())
+    }
+
+
+    /// Return the size of the program image, which ends with the last code or bss section
+    pub fn image_size(&self) -> usize {
+        self.sections.iter()
+            .filter(|section| section.kind != SectionKind::Symbols)
+            .map(|section| section.address + section.size)
+            .max()
+            .unwrap_or(0)
+    }
+
+}
+
+
+#[cfg(test)]
+mod tests {
+
+    use super::*;
+
+
+    /// A program image made of code, a long run of zeros and more code, followed by the entry address
+    fn image(entry: Address) -> Vec<u8> {
+        let mut image = vec![1, 2, 3, 4];
+        image.resize(image.len() + MIN_BSS_SIZE + 10, 0);
+        image.extend_from_slice(&[5, 6, 7]);
+        // Too short to be a bss section
+        image.extend_from_slice(&[0; 8]);
+        image.push(8);
+        image.extend_from_slice(&entry.to_le_bytes());
+        image
+    }
+
+
+    #[test]
+    fn test_from_image() {
+        let image = image(2);
+        let executable = Executable::from_image(&image).unwrap();
+
+        assert_eq!(executable.entry, 2);
+
+        let layout: Vec<(SectionKind, Address, usize)> = executable.sections.iter().map(|section| (section.kind, section.address, section.size)).collect();
+        assert_eq!(layout, [
+            (SectionKind::Code, 0, 4),
+            (SectionKind::Bss, 4, MIN_BSS_SIZE + 10),
+            (SectionKind::Code, MIN_BSS_SIZE + 14, 12),
+        ]);
+        assert_eq!(executable.image_size(), image.len() - ADDRESS_SIZE);
+
+        assert!(Executable::from_image(&[0; ADDRESS_SIZE - 1]).is_err());
+    }
+
+
+    #[test]
+    fn test_round_trip() {
+        let image = image(7);
+        let mut executable = Executable::from_image(&image).unwrap();
+        executable.add_symbols("symbols");
+
+        let encoded = executable.encode();
+        // The zeros of the bss section take no space in the file
+        assert!(encoded.len() < EXECUTABLE_HEADER_SIZE + executable.sections.len() * SECTION_ENTRY_SIZE + image.len());
+        Executable::verify(&encoded).unwrap();
+
+        let decoded = Executable::load(&encoded).unwrap();
+        assert_eq!(decoded.entry, 7);
+        assert_eq!(decoded.symbols(), Some("symbols"));
+        assert_eq!(decoded.sections.len(), executable.sections.len());
+        for (decoded, original) in decoded.sections.iter().zip(&executable.sections) {
+            assert_eq!((decoded.kind, decoded.address, decoded.size, decoded.data), (original.kind, original.address, original.size, original.data));
+        }
+
+        // Raw images are still accepted by `load`
+        assert_eq!(Executable::load(&image).unwrap().sections.len(), 3);
+    }
+
+
+    #[test]
+    fn test_mapped_section_alignment() {
+        let mut image = vec![0xaa; MAPPED_SECTION_MIN_SIZE + 100];
+        image.extend_from_slice(&0usize.to_le_bytes());
+
+        let encoded = Executable::from_image(&image).unwrap().encode();
+        let decoded = Executable::parse(&encoded).unwrap();
+        assert_eq!(decoded.sections[0].offset % SECTION_ALIGNMENT, decoded.sections[0].address % SECTION_ALIGNMENT);
+    }
+
+
+    #[test]
+    fn test_truncated_table() {
+        let encoded = Executable::from_image(&image(0)).unwrap().encode();
+
+        assert!(Executable::parse(&encoded[..EXECUTABLE_HEADER_SIZE + SECTION_ENTRY_SIZE]).is_err());
+        assert!(Executable::parse(&encoded[..EXECUTABLE_HEADER_SIZE - 1]).is_err());
+
+        // A section count that doesn't fit in the file
+        let mut huge_count = encoded.clone();
+        huge_count[12..16].copy_from_slice(&u32::MAX.to_le_bytes());
+        assert!(Executable::parse(&huge_count).is_err());
+    }
+
+
+    #[test]
+    fn test_bad_checksum() {
+        let encoded = Executable::from_image(&image(0)).unwrap().encode();
+
+        // The section table is checked on every load
+        let mut corrupted_table = encoded.clone();
+        corrupted_table[EXECUTABLE_HEADER_SIZE + 8] ^= 1;
+        assert!(Executable::parse(&corrupted_table).is_err());
+
+        let mut corrupted_entry = encoded.clone();
+        corrupted_entry[16] ^= 1;
+        assert!(Executable::parse(&corrupted_entry).is_err());
+
+        // The contents are only checked on request
+        let mut corrupted_contents = encoded;
+        *corrupted_contents.last_mut().unwrap() ^= 1;
+        assert!(Executable::parse(&corrupted_contents).is_ok());
+        assert!(Executable::verify(&corrupted_contents).is_err());
+    }
+
+}
@@ -1,6 +1,7 @@
 use std::mem;
 
 
+#[derive(Debug, Clone, Copy)]
 #[repr(u8)]
 pub enum Interrupts {
 
@@ -22,6 +23,24 @@ pub enum Interrupts {
     SetTimerNanos,
     FlushStdout,
     HostFs,
+    Malloc,
+    Calloc,
+    Realloc,
+    Free,
+    HeapStats,
+    Snapshot,
+    ThreadSpawn,
+    ThreadJoin,
+    MemoryWait,
+    MemoryNotify,
+    DiskSubmitRead,
+    DiskSubmitWrite,
+    DiskPoll,
+    DiskWait,
+    TimerStart,
+    TimerCancel,
+    WaitEvents,
+    PerfCounters,
 
 }
 
@@ -34,3 +53,39 @@ impl From<u8> for Interrupts {
     }
 }
 
+
+
+/// Counters written by the PerfCounters interrupt to the guest buffer, in this order. Every counter is a u64
+#[derive(Debug, Clone, Copy)]
+#[repr(u8)]
+pub enum PerfCounter {
+
+    /// Instructions run by the interpreter in the calling thread. Instructions run as compiled native code are not counted
+    Instructions,
+    /// Calls made by the calling thread
+    Calls,
+    /// Returns made by the calling thread
+    Returns,
+    /// Interrupts dispatched by the calling thread, including this one
+    Interrupts,
+    /// Bytes copied or set by the bulk memory instructions of the calling thread
+    BulkMemoryBytes,
+    StorageBytesRead,
+    StorageBytesWritten,
+    HostFsBytesRead,
+    HostFsBytesWritten,
+    HeapLiveBytes,
+    HeapPeakBytes,
+    /// Time spent in the synchronous storage interrupts
+    StorageNanos,
+    HostFsNanos,
+    TerminalNanos,
+
+}
+
+
+/// Number of counters written by the PerfCounters interrupt
+pub const PERF_COUNTER_COUNT: usize = mem::variant_count::<PerfCounter>();
+
+/// Size of the buffer filled by the PerfCounters interrupt
+pub const PERF_COUNTERS_SIZE: usize = PERF_COUNTER_COUNT * mem::size_of::<u64>();
@@ -7,3 +7,6 @@ pub mod token;
 pub mod vm;
 pub mod ir;
 pub mod interrupts;
+pub mod symbols;
+pub mod executable;
+pub mod trace;
@@ -0,0 +1,93 @@
+use std::collections::BTreeMap;
+use std::fs;
+use std::io;
+use std::path::{Path, PathBuf};
+
+use crate::vm::Address;
+
+
+/// Extension of the symbol file written next to a byte code file
+pub const SYMBOL_FILE_EXTENSION: &str = "sym";
+
+
+/// Maps the address of a label to its name
+pub type SymbolTable = BTreeMap<Address, String>;
+
+
+/// Return the path of the symbol file of the given byte code file
+pub fn symbol_file_path(byte_code_path: &Path) -> PathBuf {
+    byte_code_path.with_extension(SYMBOL_FILE_EXTENSION)
+}
+
+
+/// Return the name of the symbol that contains `address`, with the offset from the symbol start, if any
+pub fn resolve(symbols: &SymbolTable, address: Address) -> Option<(&str, usize)> {
+    symbols.range(..=address).next_back().map(
+        |(&start, name)| (name.as_str(), address - start)
+    )
+}
+
+
+/// Encode the symbol table as text, one `address name` pair per line
+pub fn encode_symbols(symbols: &SymbolTable) -> String {
+    symbols.iter().map(
+        |(address, name)| format!("{:#x} {}\n", address, name)
+    ).collect()
+}
+
+
+/// Write the symbol table to a file, one `address name` pair per line
+pub fn save_symbols(symbols: &SymbolTable, path: &Path) -> io::Result<()> {
+    fs::write(path, encode_symbols(symbols))
+}
+
+
+/// Load a symbol table written by `save_symbols`
+pub fn load_symbols(path: &Path) -> io::Result<SymbolTable> {
+    parse_symbols(&fs::read_to_string(path)?)
+}
+
+
+/// Parse a symbol table encoded by `encode_symbols`
+pub fn parse_symbols(content: &str) -> io::Result<SymbolTable> {
+
+    content.lines().enumerate().filter(|(_, line)| !line.trim().is_empty()).map(|(line_number, line)| {
+
+        let invalid_line = || io::Error::new(
+            io::ErrorKind::InvalidData,
+            format!("Invalid symbol at line {}: \"{}\"", line_number + 1, line)
+        );
+
+        let (address, name) = line.trim().split_once(' ').ok_or_else(invalid_line)?;
+        let address = Address::from_str_radix(address.trim_start_matches("0x"), 16).map_err(|_| invalid_line())?;
+
+        Ok((address, name.to_string()))
+
+    }).collect()
+}
+
+
+#[cfg(test)]
+mod tests {
+
+    use super::*;
+
+
+    #[test]
+    fn test_symbol_file() {
+        let symbols = SymbolTable::from([(0, "start".to_string()), (0x2a, "print_line".to_string())]);
+
+        let encoded = encode_symbols(&symbols);
+        assert_eq!(encoded, "0x0 start\n0x2a print_line\n");
+        assert_eq!(parse_symbols(&encoded).unwrap(), symbols);
+
+        assert_eq!(resolve(&symbols, 0x29), Some(("start", 0x29)));
+        assert_eq!(resolve(&symbols, 0x30), Some(("print_line", 6)));
+        assert_eq!(resolve(&SymbolTable::new(), 1), None);
+
+        let error = parse_symbols("0x0 start\nstart\n").unwrap_err();
+        assert_eq!(error.kind(), io::ErrorKind::InvalidData);
+        assert!(error.to_string().contains("line 2"), "{}", error);
+    }
+
+}
@@ -0,0 +1,270 @@
+use std::fmt;
+
+use crate::byte_code::format_instruction;
+use crate::registers::{Registers, REGISTER_COUNT};
+use crate::vm::Address;
+
+
+/// Bytes at the start of every trace file
+pub const TRACE_MAGIC: &[u8; 8] = b"RVMTRACE";
+
+pub const TRACE_VERSION: u32 = 1;
+
+/// Size of the trace file header: magic, version, record size
+pub const TRACE_HEADER_SIZE: usize = TRACE_MAGIC.len() + 4 + 4;
+
+/// Size of every record in a trace file
+pub const TRACE_RECORD_SIZE: usize = 40;
+
+
+const INSTRUCTION_RECORD: u8 = 0;
+const REGISTER_RECORD: u8 = 1;
+const MEMORY_RECORD: u8 = 2;
+
+
+/// A fixed-size entry of an execution trace.
+///
+/// Register and memory records describe the effects of the last instruction record before them
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum TraceRecord {
+
+    /// An executed instruction with its decoded operands
+    Instruction {
+        pc: Address,
+        opcode: u8,
+        handled_size: u8,
+        reg1: u8,
+        reg2: u8,
+        condition: u8,
+        arg1: u64,
+        arg2: u64,
+        target: Address,
+    },
+
+    /// A register that was changed by the instruction
+    Register {
+        register: u8,
+        value: u64,
+    },
+
+    /// A memory range that was written by the instruction. Only the first 8 bytes of data are recorded, in little endian
+    Memory {
+        address: Address,
+        size: usize,
+        data: u64,
+    },
+
+}
+
+
+/// Return the trace file header
+pub fn trace_header() -> [u8; TRACE_HEADER_SIZE] {
+    let mut header = [0; TRACE_HEADER_SIZE];
+    header[..8].copy_from_slice(TRACE_MAGIC);
+    header[8..12].copy_from_slice(&TRACE_VERSION.to_le_bytes());
+    header[12..16].copy_from_slice(&(TRACE_RECORD_SIZE as u32).to_le_bytes());
+    header
+}
+
+
+/// Check that the given bytes start with a valid trace file header
+pub fn check_trace_header(bytes: &[u8]) -> Result<(), String> {
+    if bytes.len() < TRACE_HEADER_SIZE || &bytes[..8] != TRACE_MAGIC {
+        return Err("Not a trace file".to_string());
+    }
+
+    let version = u32::from_le_bytes(bytes[8..12].try_into().unwrap());
+    let record_size = u32::from_le_bytes(bytes[12..16].try_into().unwrap()) as usize;
+
+    if version != TRACE_VERSION || record_size != TRACE_RECORD_SIZE {
+        return Err(format!("Unsupported trace version {} with {} byte records", version, record_size));
+    }
+
+    Ok(())
+}
+
+
+#[inline(always)]
+fn read_u64(bytes: &[u8; TRACE_RECORD_SIZE], offset: usize) -> u64 {
+    u64::from_le_bytes(bytes[offset..offset + 8].try_into().unwrap())
+}
+
+
+impl TraceRecord {
+
+    #[inline]
+    pub fn encode(&self) -> [u8; TRACE_RECORD_SIZE] {
+        let mut bytes = [0; TRACE_RECORD_SIZE];
+
+        match *self {
+
+            TraceRecord::Instruction { pc, opcode, handled_size, reg1, reg2, condition, arg1, arg2, target } => {
+                bytes[..6].copy_from_slice(&[INSTRUCTION_RECORD, opcode, handled_size, reg1, reg2, condition]);
+                bytes[8..16].copy_from_slice(&(pc as u64).to_le_bytes());
+                bytes[16..24].copy_from_slice(&arg1.to_le_bytes());
+                bytes[24..32].copy_from_slice(&arg2.to_le_bytes());
+                bytes[32..40].copy_from_slice(&(target as u64).to_le_bytes());
+            },
+
+            TraceRecord::Register { register, value } => {
+                bytes[..2].copy_from_slice(&[REGISTER_RECORD, register]);
+                bytes[8..16].copy_from_slice(&value.to_le_bytes());
+            },
+
+            TraceRecord::Memory { address, size, data } => {
+                bytes[0] = MEMORY_RECORD;
+                bytes[8..16].copy_from_slice(&(address as u64).to_le_bytes());
+                bytes[16..24].copy_from_slice(&(size as u64).to_le_bytes());
+                bytes[24..32].copy_from_slice(&data.to_le_bytes());
+            },
+
+        }
+
+        bytes
+    }
+
+
+    /// Decode a record. Return `None` if the record kind is unknown
+    pub fn decode(bytes: &[u8; TRACE_RECORD_SIZE]) -> Option<TraceRecord> {
+        Some(match bytes[0] {
+
+            INSTRUCTION_RECORD => TraceRecord::Instruction {
+                pc: read_u64(bytes, 8) as Address,
+                opcode: bytes[1],
+                handled_size: bytes[2],
+                reg1: bytes[3],
+                reg2: bytes[4],
+                condition: bytes[5],
+                arg1: read_u64(bytes, 16),
+                arg2: read_u64(bytes, 24),
+                target: read_u64(bytes, 32) as Address,
+            },
+
+            REGISTER_RECORD => TraceRecord::Register {
+                register: bytes[1],
+                value: read_u64(bytes, 8),
+            },
+
+            MEMORY_RECORD => TraceRecord::Memory {
+                address: read_u64(bytes, 8) as Address,
+                size: read_u64(bytes, 16) as usize,
+                data: read_u64(bytes, 24),
+            },
+
+            _ => return None
+
+        })
+    }
+
+}
+
+
+/// Lines of the listing of a trace. The effects of an instruction are indented under it
+impl fmt::Display for TraceRecord {
+
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        match *self {
+
+            TraceRecord::Instruction { pc, opcode, handled_size, reg1, reg2, condition, arg1, arg2, target } =>
+                write!(f, "{:#010x}: {}", pc, format_instruction(opcode, handled_size, [reg1, reg2], [arg1, arg2], condition, target)),
+
+            TraceRecord::Register { register, value } => {
+                if (register as usize) < REGISTER_COUNT {
+                    write!(f, "            {} = {} ({:#x})", Registers::from(register), value, value)
+                } else {
+                    write!(f, "            <invalid register {}> = {} ({:#x})", register, value, value)
+                }
+            },
+
+            TraceRecord::Memory { address, size, data } => {
+                let shown = size.min(8);
+                let data = &data.to_le_bytes()[..shown];
+                write!(f, "            [{:#x}; {}] = {:?}{}", address, size, data, if size > shown { " ..." } else { "" })
+            },
+
+        }
+    }
+
+}
+
+
+/// Decode the records of a trace file. A truncated record at the end, left by a VM that was killed while tracing, is ignored
+pub fn decode_trace(bytes: &[u8]) -> Result<Vec<TraceRecord>, String> {
+
+    check_trace_header(bytes)?;
+
+    bytes[TRACE_HEADER_SIZE..].chunks_exact(TRACE_RECORD_SIZE).enumerate().map(
+        |(index, record)| TraceRecord::decode(record.try_into().unwrap()).ok_or_else(
+            || format!("Invalid record kind {} at record {}", record[0], index)
+        )
+    ).collect()
+}
+
+
+#[cfg(test)]
+mod tests {
+
+    use crate::byte_code::ByteCodes;
+
+    use super::*;
+
+
+    #[test]
+    fn test_record_round_trip() {
+        let records = [
+            TraceRecord::Instruction { pc: 0x1234, opcode: 7, handled_size: 4, reg1: 1, reg2: 2, condition: 3, arg1: u64::MAX, arg2: 42, target: 0xdead_beef },
+            TraceRecord::Register { register: 9, value: 0x0102_0304_0506_0708 },
+            TraceRecord::Memory { address: usize::MAX, size: 16, data: 0xffee_ddcc_bbaa_9988 },
+        ];
+
+        for record in records {
+            assert_eq!(TraceRecord::decode(&record.encode()), Some(record));
+        }
+
+        let mut unknown = records[0].encode();
+        unknown[0] = 0xff;
+        assert_eq!(TraceRecord::decode(&unknown), None);
+    }
+
+
+    #[test]
+    fn test_header() {
+        let header = trace_header();
+        assert!(check_trace_header(&header).is_ok());
+        assert!(check_trace_header(&header[..TRACE_HEADER_SIZE - 1]).is_err());
+
+        let mut other_version = header;
+        other_version[8] ^= 1;
+        assert!(check_trace_header(&other_version).is_err());
+    }
+
+
+    #[test]
+    fn test_decode_trace() {
+        let records = [
+            TraceRecord::Instruction { pc: 0x10, opcode: ByteCodes::MOVE_INTO_REG_FROM_CONST as u8, handled_size: 8, reg1: Registers::R1 as u8, reg2: 0, condition: 0, arg1: 0, arg2: 5, target: 0 },
+            TraceRecord::Register { register: Registers::R1 as u8, value: 5 },
+            TraceRecord::Memory { address: 0x20, size: 2, data: 0x0201 },
+        ];
+
+        let mut bytes = trace_header().to_vec();
+        for record in &records {
+            bytes.extend(record.encode());
+        }
+
+        // The truncated record at the end is ignored
+        bytes.push(0);
+        assert_eq!(decode_trace(&bytes).unwrap(), records);
+
+        let listing: Vec<String> = records.iter().map(TraceRecord::to_string).collect();
+        assert_eq!(listing, [
+            "0x00000010: MOVE_INTO_REG_FROM_CONST (8B) r1 5",
+            "            r1 = 5 (0x5)",
+            "            [0x20; 2] = [1, 2]",
+        ]);
+
+        bytes[TRACE_HEADER_SIZE] = 0xff;
+        assert!(decode_trace(&bytes).is_err());
+    }
+
+}
@@ -12,7 +12,7 @@ pub const ADDRESS_SIZE: usize = mem::size_of::<Address>();
 macro_rules! declare_errors {
     ($($name:ident),+) => {
 
-#[derive(Clone, Copy, Debug)]
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
 pub enum ErrorCodes {
 
     $($name),+
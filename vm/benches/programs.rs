@@ -0,0 +1,127 @@
+//! End-to-end benchmarks of the VM running whole programs.
+//!
+//! The programs are assembled once, then executed by the `vm` binary with stdin and stdout redirected,
+//! so the results include the VM startup and are comparable across commits.
+//! Run with `cargo bench -p vm`.
+
+#![feature(test)]
+
+extern crate test;
+
+use std::fs;
+use std::io::Write;
+use std::path::{Path, PathBuf};
+use std::process::{Command, Stdio};
+
+use test::Bencher;
+
+use ::assembler::{assembler, files};
+use ::assembler::assembler::AssemblerOptions;
+
+
+fn workspace_path(path: &str) -> PathBuf {
+    Path::new(env!("CARGO_MANIFEST_DIR")).join("..").join(path).canonicalize().unwrap()
+}
+
+
+/// Assemble the given program and return the path of its bytecode
+fn assemble(source: &Path) -> PathBuf {
+
+    let assembly = files::load_assembly(source).unwrap();
+    let (byte_code, _) = assembler::assemble(assembly, source, AssemblerOptions {
+        include_lib_path: workspace_path("asm_lib"),
+        cache_dir: Some(Path::new(env!("CARGO_TARGET_TMPDIR")).join("asm_cache")),
+        ..Default::default()
+    });
+
+    let output = Path::new(env!("CARGO_TARGET_TMPDIR")).join(source.file_name().unwrap()).with_extension("bc");
+    fs::write(&output, byte_code).unwrap();
+    output
+}
+
+
+fn bench_program(b: &mut Bencher, source: &Path, args: &[&str], stdin: &[u8]) {
+
+    let byte_code = assemble(source);
+
+    b.iter(|| {
+        let mut vm = Command::new(env!("CARGO_BIN_EXE_vm"))
+            .arg(&byte_code)
+            .arg("-q")
+            .args(args)
+            .stdin(Stdio::piped())
+            .stdout(Stdio::null())
+            .spawn()
+            .unwrap();
+
+        vm.stdin.take().unwrap().write_all(stdin).unwrap();
+
+        let status = vm.wait().unwrap();
+        assert!(status.success(), "{} exited with {}", source.display(), status);
+    });
+}
+
+
+fn bench_program_named(b: &mut Bencher, name: &str) {
+    bench_program(b, &workspace_path("vm/benches/programs").join(name).with_extension("asm"), &[], &[]);
+}
+
+
+#[bench]
+fn arithmetic_loop(b: &mut Bencher) {
+    bench_program_named(b, "arithmetic");
+}
+
+
+#[bench]
+fn recursion(b: &mut Bencher) {
+    bench_program_named(b, "recursion");
+}
+
+
+#[bench]
+fn string_routines(b: &mut Bencher) {
+    bench_program_named(b, "strings");
+}
+
+
+#[bench]
+fn array(b: &mut Bencher) {
+    bench_program_named(b, "array");
+}
+
+
+#[bench]
+fn storage_io(b: &mut Bencher) {
+    let storage_file = Path::new(env!("CARGO_TARGET_TMPDIR")).join("bench_storage.bin");
+    bench_program(
+        b,
+        &workspace_path("vm/benches/programs/storage.asm"),
+        &["--storage-file", storage_file.to_str().unwrap(), "--max-storage", "1000000"],
+        &[]
+    );
+}
+
+
+#[bench]
+fn storage_io_mapped(b: &mut Bencher) {
+    let storage_file = Path::new(env!("CARGO_TARGET_TMPDIR")).join("bench_storage_mapped.bin");
+    bench_program(
+        b,
+        &workspace_path("vm/benches/programs/storage.asm"),
+        &["--storage-file", storage_file.to_str().unwrap(), "--max-storage", "1000000", "--map-storage"],
+        &[]
+    );
+}
+
+
+#[bench]
+fn impl_test(b: &mut Bencher) {
+    bench_program(b, &workspace_path("impl/test.asm"), &[], &[]);
+}
+
+
+#[bench]
+fn impl_random_password_generator(b: &mut Bencher) {
+    bench_program(b, &workspace_path("impl/random_password_generator.asm"), &[], b"4096\n");
+}
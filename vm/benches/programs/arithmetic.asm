@@ -0,0 +1,39 @@
+# Tight integer arithmetic loop
+
+.include:
+
+    stdio/print.asm
+
+
+.text:
+
+@start
+
+    # Accumulator
+    mov8 r4 0
+    # Counter
+    mov8 r3 0
+
+    @loop
+
+        mov r1 r4
+        mov r2 r3
+        iadd
+
+        mov8 r2 3
+        imul
+
+        mov r2 r3
+        isub
+
+        mov8 r2 7
+        imod
+        mov r4 r1
+
+        inc r3
+        cmp8 r3 200000
+        jmplt loop
+
+    !println_uint r4
+
+    mov8 exit 0
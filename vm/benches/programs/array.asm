@@ -0,0 +1,64 @@
+# Fill, read and resize a heap array
+
+.include:
+
+    stdio/print.asm
+    collections/array.asm
+    stdlib/memory.asm
+
+
+.data:
+
+    value u8 0
+
+
+.text:
+
+    %- LENGTH: 2000
+
+
+@start
+
+    !array_new 8 =LENGTH
+    mov r8 r1
+
+    mov8 r3 0
+
+    @fill
+
+        mov8 [value] r3
+        !array_set r8 r3 value
+
+        inc r3
+        cmp8 r3 =LENGTH
+        jmplt fill
+
+    # Sum all the items
+    mov8 r4 0
+    mov8 r3 0
+
+    @sum
+
+        !array_get_ptr r8 r3
+        mov8 r2 [r1]
+        mov r1 r4
+        iadd
+        mov r4 r1
+
+        inc r3
+        cmp8 r3 =LENGTH
+        jmplt sum
+
+    !array_resize r8 4000
+    mov r8 r1
+
+    !array_get r8 1999
+    pop8 r1
+    mov r2 r4
+    iadd
+
+    !println_uint r1
+
+    !free r8
+
+    mov8 exit 0
@@ -0,0 +1,51 @@
+# Recursive Fibonacci, heavy on CALL and RETURN
+
+.include:
+
+    stdio/print.asm
+
+
+.text:
+
+    # Compute the nth Fibonacci number
+    #
+    # Args:
+    #   - r1: n
+    #
+    # Return:
+    #   - r1: the nth Fibonacci number
+    #
+    @ fib
+
+        cmp8 r1 2
+        jmplt fib_end
+
+        push8 r1
+
+        dec r1
+        call fib
+
+        pop8 r2
+        push8 r1
+
+        mov r1 r2
+        mov8 r2 2
+        isub
+        call fib
+
+        pop8 r2
+        iadd
+
+        @fib_end
+
+        ret
+
+
+@start
+
+    mov8 r1 20
+    call fib
+
+    !println_uint r1
+
+    mov8 exit 0
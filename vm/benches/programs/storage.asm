@@ -0,0 +1,62 @@
+# Write blocks to the storage and read them back
+
+.include:
+
+    stdio/print.asm
+    stdio/disk.asm
+    stdlib/memory.asm
+    string.asm
+
+
+.text:
+
+    %- BLOCK_SIZE: 4096
+    %- BLOCK_COUNT: 64
+
+
+@start
+
+    !malloc =BLOCK_SIZE
+    mov r8 r1
+
+    # Disk address
+    mov8 r7 0
+    # Block index, used as the block content
+    mov8 r6 0
+
+    @write
+
+        !memset r8 r6 =BLOCK_SIZE
+        !disk_write r7 r8 =BLOCK_SIZE
+
+        mov r1 r7
+        mov8 r2 =BLOCK_SIZE
+        iadd
+        mov r7 r1
+
+        inc r6
+        cmp8 r6 =BLOCK_COUNT
+        jmplt write
+
+    mov8 r7 0
+
+    @read
+
+        !disk_read r7 r8 =BLOCK_SIZE
+
+        mov r1 r7
+        mov8 r2 =BLOCK_SIZE
+        iadd
+        mov r7 r1
+
+        dec r6
+        cmp8 r6 0
+        jmpnz read
+
+    # The last block read is the last one written
+    mov1 r1 [r8]
+    !println_uint r1
+
+    !free r8
+
+    mov8 exit 0
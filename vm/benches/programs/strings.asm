@@ -0,0 +1,53 @@
+# String routines over a large heap buffer
+
+.include:
+
+    stdio/print.asm
+    stdlib/memory.asm
+    string.asm
+
+
+.text:
+
+    %- BUFFER_SIZE: 65536
+
+
+@start
+
+    !malloc =BUFFER_SIZE
+    mov r8 r1
+
+    !malloc =BUFFER_SIZE
+    mov r7 r1
+
+    mov8 r6 0
+
+    @loop
+
+        # Fill the first buffer with a null-terminated string
+        !memset r8 'a' =BUFFER_SIZE
+        mov r1 r8
+        mov8 r2 =BUFFER_SIZE
+        iadd
+        dec r1
+        mov1 [r1] 0
+
+        !strcpy r8 r7
+        !strlen r7
+        mov r5 r1
+
+        !strcmp r8 r7
+        !memchr r8 0 =BUFFER_SIZE
+
+        !memcpy r7 r8 =BUFFER_SIZE
+
+        inc r6
+        cmp8 r6 20
+        jmplt loop
+
+    !println_uint r5
+
+    !free r8
+    !free r7
+
+    mov8 exit 0
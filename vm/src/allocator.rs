@@ -0,0 +1,377 @@
+use std::collections::{BTreeMap, HashMap};
+
+use rusty_vm_lib::vm::{Address, ErrorCodes};
+
+use crate::memory::Memory;
+use crate::snapshot::{Decoder, Encoder};
+
+
+/// Alignment of every allocated block
+const ALIGNMENT: usize = 16;
+
+/// Sizes of the small blocks. Bigger requests are served from the large block free list or the bump arena
+const SIZE_CLASSES: [usize; 8] = [16, 32, 64, 128, 256, 512, 1024, 2048];
+
+const MAX_SMALL_SIZE: usize = SIZE_CLASSES[SIZE_CLASSES.len() - 1];
+
+
+/// Return the index of the smallest size class that fits `size` bytes
+fn size_class(size: usize) -> Option<usize> {
+    SIZE_CLASSES.iter().position(|&class_size| size <= class_size)
+}
+
+
+/// Round up to the allocation alignment
+fn align(size: usize) -> Option<usize> {
+    Some(size.checked_add(ALIGNMENT - 1)? & !(ALIGNMENT - 1))
+}
+
+
+/// Allocation statistics of the guest heap
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+pub struct HeapStats {
+
+    /// Bytes currently allocated, including the padding of each block
+    pub allocated_bytes: usize,
+    /// Maximum value of `allocated_bytes`
+    pub peak_allocated_bytes: usize,
+    /// Number of blocks currently allocated
+    pub live_blocks: usize,
+    /// Number of allocations since the start of the program
+    pub total_allocations: usize,
+
+}
+
+
+/// Heap allocator for the guest program.
+///
+/// The heap lives in guest memory between the program image and the stack.
+/// Freed small blocks are kept in per-size-class free lists, freed large blocks in a best-fit free list.
+/// New blocks are carved out of the heap with a bump pointer, as long as they stay below the stack top.
+/// Block sizes are kept on the host, so the guest cannot corrupt the allocator's bookkeeping.
+pub struct Allocator {
+
+    heap_start: Address,
+    /// End of the memory carved out of the heap so far
+    heap_top: Address,
+    small_free_lists: [Vec<Address>; SIZE_CLASSES.len()],
+    /// Freed large blocks by size
+    large_free_blocks: BTreeMap<usize, Vec<Address>>,
+    /// Size of each allocated block
+    blocks: HashMap<Address, usize>,
+    stats: HeapStats,
+
+}
+
+
+impl Allocator {
+
+    pub fn new() -> Self {
+        Self {
+            heap_start: 0,
+            heap_top: 0,
+            small_free_lists: Default::default(),
+            large_free_blocks: BTreeMap::new(),
+            blocks: HashMap::new(),
+            stats: HeapStats::default(),
+        }
+    }
+
+
+    /// Start the heap right after the program image, discarding all allocations
+    pub fn set_heap_start(&mut self, program_end: Address) {
+        // The heap start is never 0, so 0 can't be a valid block address
+        self.heap_start = align(program_end.max(1)).unwrap();
+        self.heap_top = self.heap_start;
+        self.small_free_lists.iter_mut().for_each(Vec::clear);
+        self.large_free_blocks.clear();
+        self.blocks.clear();
+        self.stats = HeapStats::default();
+    }
+
+
+    pub fn stats(&self) -> HeapStats {
+        self.stats
+    }
+
+
+    /// Allocate a block of at least `size` bytes. The heap may not grow past `stack_top`
+    pub fn malloc(&mut self, size: usize, stack_top: Address) -> Result<Address, ErrorCodes> {
+
+        let (address, block_size) = if let Some(class) = size_class(size) {
+            let block_size = SIZE_CLASSES[class];
+            match self.small_free_lists[class].pop() {
+                Some(address) => (address, block_size),
+                None => (self.bump(block_size, stack_top)?, block_size)
+            }
+        } else {
+            let block_size = align(size).ok_or(ErrorCodes::OutOfMemory)?;
+            match self.take_large_free_block(block_size) {
+                Some(block) => block,
+                None => (self.bump(block_size, stack_top)?, block_size)
+            }
+        };
+
+        self.blocks.insert(address, block_size);
+
+        self.stats.allocated_bytes += block_size;
+        self.stats.peak_allocated_bytes = self.stats.peak_allocated_bytes.max(self.stats.allocated_bytes);
+        self.stats.live_blocks += 1;
+        self.stats.total_allocations += 1;
+
+        Ok(address)
+    }
+
+
+    /// Allocate a zeroed block of `count * size` bytes
+    pub fn calloc(&mut self, count: usize, size: usize, stack_top: Address, memory: &mut Memory) -> Result<Address, ErrorCodes> {
+        let total_size = count.checked_mul(size).ok_or(ErrorCodes::OutOfMemory)?;
+        let address = self.malloc(total_size, stack_top)?;
+        memory.get_bytes_mut(address, total_size).fill(0);
+        Ok(address)
+    }
+
+
+    /// Resize the block at `address` to at least `size` bytes, moving it if it doesn't fit.
+    /// A null address allocates a new block
+    pub fn realloc(&mut self, address: Address, size: usize, stack_top: Address, memory: &mut Memory) -> Result<Address, ErrorCodes> {
+
+        if address == 0 {
+            return self.malloc(size, stack_top);
+        }
+
+        let block_size = *self.blocks.get(&address).ok_or(ErrorCodes::InvalidInput)?;
+        if size <= block_size {
+            return Ok(address);
+        }
+
+        let new_address = self.malloc(size, stack_top)?;
+        memory.memcpy(address, new_address, block_size);
+        self.free(address)?;
+
+        Ok(new_address)
+    }
+
+
+    /// Free the block at `address`. Freeing a null address does nothing
+    pub fn free(&mut self, address: Address) -> Result<(), ErrorCodes> {
+
+        if address == 0 {
+            return Ok(());
+        }
+
+        let block_size = self.blocks.remove(&address).ok_or(ErrorCodes::InvalidInput)?;
+
+        self.stats.allocated_bytes -= block_size;
+        self.stats.live_blocks -= 1;
+
+        if block_size <= MAX_SMALL_SIZE {
+            self.small_free_lists[size_class(block_size).unwrap()].push(address);
+        } else if address + block_size == self.heap_top {
+            // Give the last block back to the arena
+            self.heap_top = address;
+        } else {
+            self.large_free_blocks.entry(block_size).or_default().push(address);
+        }
+
+        Ok(())
+    }
+
+
+    /// Serialize the allocator state into a snapshot
+    pub fn encode(&self, encoder: &mut Encoder) {
+
+        encoder.usize(self.heap_start);
+        encoder.usize(self.heap_top);
+
+        for list in &self.small_free_lists {
+            encoder.usize(list.len());
+            list.iter().for_each(|&address| encoder.usize(address));
+        }
+
+        encoder.usize(self.large_free_blocks.len());
+        for (&size, addresses) in &self.large_free_blocks {
+            encoder.usize(size);
+            encoder.usize(addresses.len());
+            addresses.iter().for_each(|&address| encoder.usize(address));
+        }
+
+        encoder.usize(self.blocks.len());
+        for (&address, &size) in &self.blocks {
+            encoder.usize(address);
+            encoder.usize(size);
+        }
+
+        encoder.usize(self.stats.allocated_bytes);
+        encoder.usize(self.stats.peak_allocated_bytes);
+        encoder.usize(self.stats.live_blocks);
+        encoder.usize(self.stats.total_allocations);
+    }
+
+
+    /// Deserialize an allocator state written by `encode`
+    pub fn decode(decoder: &mut Decoder) -> Option<Self> {
+
+        fn addresses(decoder: &mut Decoder) -> Option<Vec<Address>> {
+            (0..decoder.usize()?).map(|_| decoder.usize()).collect()
+        }
+
+        let heap_start = decoder.usize()?;
+        let heap_top = decoder.usize()?;
+
+        let mut small_free_lists: [Vec<Address>; SIZE_CLASSES.len()] = Default::default();
+        for list in small_free_lists.iter_mut() {
+            *list = addresses(decoder)?;
+        }
+
+        let mut large_free_blocks = BTreeMap::new();
+        for _ in 0..decoder.usize()? {
+            let size = decoder.usize()?;
+            large_free_blocks.insert(size, addresses(decoder)?);
+        }
+
+        let mut blocks = HashMap::new();
+        for _ in 0..decoder.usize()? {
+            let address = decoder.usize()?;
+            blocks.insert(address, decoder.usize()?);
+        }
+
+        let stats = HeapStats {
+            allocated_bytes: decoder.usize()?,
+            peak_allocated_bytes: decoder.usize()?,
+            live_blocks: decoder.usize()?,
+            total_allocations: decoder.usize()?,
+        };
+
+        Some(Self {
+            heap_start,
+            heap_top,
+            small_free_lists,
+            large_free_blocks,
+            blocks,
+            stats,
+        })
+    }
+
+
+    /// Carve a new block out of the heap
+    fn bump(&mut self, size: usize, stack_top: Address) -> Result<Address, ErrorCodes> {
+        let address = self.heap_top;
+        let end = address.checked_add(size).ok_or(ErrorCodes::OutOfMemory)?;
+        if end > stack_top {
+            return Err(ErrorCodes::OutOfMemory);
+        }
+        self.heap_top = end;
+        Ok(address)
+    }
+
+
+    /// Take the smallest free large block that fits `size` bytes
+    fn take_large_free_block(&mut self, size: usize) -> Option<(Address, usize)> {
+        let (&block_size, addresses) = self.large_free_blocks.range_mut(size..).next()?;
+        let address = addresses.pop().unwrap();
+        if addresses.is_empty() {
+            self.large_free_blocks.remove(&block_size);
+        }
+        Some((address, block_size))
+    }
+
+}
+
+
+#[cfg(test)]
+mod tests {
+
+    use super::*;
+
+    const STACK_TOP: Address = 1 << 16;
+
+
+    #[test]
+    fn test_small_blocks_are_reused() {
+        let mut allocator = Allocator::new();
+        allocator.set_heap_start(100);
+
+        let a = allocator.malloc(10, STACK_TOP).unwrap();
+        let b = allocator.malloc(10, STACK_TOP).unwrap();
+        assert_eq!(a, 112);
+        assert_eq!(b, a + 16);
+
+        allocator.free(a).unwrap();
+        assert_eq!(allocator.malloc(16, STACK_TOP).unwrap(), a);
+        assert_eq!(allocator.free(a + 1), Err(ErrorCodes::InvalidInput));
+    }
+
+
+    #[test]
+    fn test_large_blocks() {
+        let mut allocator = Allocator::new();
+        allocator.set_heap_start(0);
+
+        let a = allocator.malloc(5000, STACK_TOP).unwrap();
+        let b = allocator.malloc(3000, STACK_TOP).unwrap();
+        allocator.free(a).unwrap();
+
+        // The freed block is reused by a smaller large allocation
+        assert_eq!(allocator.malloc(4000, STACK_TOP).unwrap(), a);
+
+        // The last block is given back to the arena
+        allocator.free(b).unwrap();
+        assert_eq!(allocator.malloc(3000, STACK_TOP).unwrap(), b);
+
+        assert_eq!(allocator.malloc(STACK_TOP, STACK_TOP), Err(ErrorCodes::OutOfMemory));
+    }
+
+
+    #[test]
+    fn test_calloc_realloc() {
+        let mut memory = Memory::new(1024);
+        let mut allocator = Allocator::new();
+        allocator.set_heap_start(0);
+
+        let a = allocator.malloc(8, 1024).unwrap();
+        memory.set_bytes(a, &[1, 2, 3, 4, 5, 6, 7, 8]);
+
+        assert_eq!(allocator.realloc(a, 16, 1024, &mut memory).unwrap(), a);
+        let b = allocator.realloc(a, 100, 1024, &mut memory).unwrap();
+        assert_ne!(a, b);
+        assert_eq!(memory.get_bytes(b, 8), [1, 2, 3, 4, 5, 6, 7, 8]);
+
+        let c = allocator.calloc(2, 8, 1024, &mut memory).unwrap();
+        assert_eq!(c, a);
+        assert_eq!(memory.get_bytes(c, 16), [0; 16]);
+
+        assert_eq!(allocator.stats(), HeapStats {
+            allocated_bytes: 128 + 16,
+            peak_allocated_bytes: 128 + 16,
+            live_blocks: 2,
+            total_allocations: 3,
+        });
+    }
+
+
+
+    #[test]
+    fn test_encode_decode() {
+        let mut allocator = Allocator::new();
+        allocator.set_heap_start(0);
+
+        let a = allocator.malloc(10, STACK_TOP).unwrap();
+        let b = allocator.malloc(5000, STACK_TOP).unwrap();
+        allocator.malloc(10, STACK_TOP).unwrap();
+        allocator.free(a).unwrap();
+        allocator.free(b).unwrap();
+
+        let mut encoder = Encoder::default();
+        allocator.encode(&mut encoder);
+        let bytes = encoder.into_bytes();
+
+        let mut restored = Allocator::decode(&mut Decoder::new(&bytes)).unwrap();
+        assert_eq!(restored.stats(), allocator.stats());
+        assert_eq!(restored.malloc(16, STACK_TOP), allocator.malloc(16, STACK_TOP));
+        assert_eq!(restored.malloc(5000, STACK_TOP), allocator.malloc(5000, STACK_TOP));
+
+        assert!(Allocator::decode(&mut Decoder::new(&bytes[..bytes.len() - 1])).is_none());
+    }
+
+}
@@ -1,5 +1,7 @@
 use std::path::PathBuf;
 
+use rusty_vm_lib::vm::Address;
+
 use clap::{ValueEnum, Parser};
 
 
@@ -8,14 +10,28 @@ use clap::{ValueEnum, Parser};
 pub struct CliParser {
 
     /// The input bytecode file to execute
-    #[clap(value_parser, required = true)]
-    pub input_file: PathBuf,
+    #[clap(value_parser, required_unless_present = "restore")]
+    pub input_file: Option<PathBuf>,
+
+    /// Resume the program saved in a snapshot instead of executing a bytecode file.
+    /// The memory size and the storage file are the ones of the snapshot, unless a storage file is given
+    #[clap(long = "restore", conflicts_with = "input_file")]
+    pub restore: Option<PathBuf>,
+
+    /// Where snapshots are saved. Defaults to the input file with the .img extension, or to the restored snapshot
+    #[clap(long = "snapshot-file")]
+    pub snapshot_file: Option<PathBuf>,
+
+    /// Save a snapshot when the program first reaches this address, decimal or 0x-prefixed hexadecimal.
+    /// The program runs in normal mode until then
+    #[clap(long = "snapshot-at", value_parser = parse_address)]
+    pub snapshot_at: Option<Address>,
 
-    /// Maximum memory size in bytes. Set to 0 for unlimited memory (not recommended).
+    /// Maximum memory size in bytes. Memory is only committed when it is first used. Set to 0 to reserve a 4 GiB address space.
     #[clap(long = "max-mem", default_value="1000000")]
     pub max_memory_size: usize,
 
-    /// Execution mode. n = normal, v = verbose, i = interactive
+    /// Execution mode. n = normal, v = verbose, i = interactive, j = just-in-time compilation of hot code (x86-64 only), p = profile, t = binary execution trace
     #[arg(value_enum)]
     #[clap(short = 'm', long, default_value="n")]
     pub mode: ExecutionMode,
@@ -24,6 +40,11 @@ pub struct CliParser {
     #[clap(short = 'q', long, action)]
     pub quiet: bool,
 
+    /// Check the whole executable against its checksum before running it. By default, only its header and section table are checked,
+    /// so that the sections that aren't touched by the program are never read from the file
+    #[clap(long, action)]
+    pub verify: bool,
+
     /// Attach a storage file to the VM
     #[clap(short = 's', long = "storage-file", action)]
     pub storage_file: Option<PathBuf>,
@@ -32,6 +53,59 @@ pub struct CliParser {
     #[clap(long = "max-storage", default_value="1000000", requires = "storage_file")]
     pub max_storage_size: usize,
 
+    /// Map the storage file into memory. Storage accesses become memory copies and writes are only saved to the file when the VM exits,
+    /// instead of after every write. Requires a maximum storage size
+    #[clap(long = "map-storage", action)]
+    pub map_storage: bool,
+
+    /// Guest stdout buffering. line = flush at every newline, full = flush only when the buffer is full or when the program flushes, reads input or exits
+    #[arg(value_enum)]
+    #[clap(long = "stdout-buffer", default_value="line")]
+    pub stdout_buffering: StdoutBuffering,
+
+    /// Symbol file written by the assembler, used to name functions in the profile. Defaults to the input file with the .sym extension, if it exists
+    #[clap(long = "symbols")]
+    pub symbols_file: Option<PathBuf>,
+
+    /// Where the profile mode writes the folded call stacks. Defaults to the input file with the .folded extension
+    #[clap(long = "folded-stacks")]
+    pub folded_stacks_file: Option<PathBuf>,
+
+    /// Where the trace mode writes the execution trace. Defaults to the input file with the .trace extension
+    #[clap(long = "trace-file")]
+    pub trace_file: Option<PathBuf>,
+
+    /// Only trace the instructions in the address range START:END, end excluded. Addresses may be decimal or 0x-prefixed hexadecimal
+    #[clap(long = "trace-range", value_parser = parse_address_range)]
+    pub trace_range: Option<(Address, Address)>,
+
+    /// Maximum trace file size in bytes, after which tracing stops. Set to 0 for an unlimited trace
+    #[clap(long = "max-trace-size", default_value="100000000")]
+    pub max_trace_size: usize,
+
+    /// Also trace the registers changed by every instruction
+    #[clap(long = "trace-registers", action)]
+    pub trace_registers: bool,
+
+    /// Also trace the memory written by every instruction
+    #[clap(long = "trace-memory", action)]
+    pub trace_memory: bool,
+
+}
+
+
+fn parse_address(input: &str) -> Result<Address, String> {
+    let parsed = match input.strip_prefix("0x") {
+        Some(hex) => Address::from_str_radix(hex, 16),
+        None => input.parse()
+    };
+    parsed.map_err(|_| format!("Invalid address: {}", input))
+}
+
+
+fn parse_address_range(input: &str) -> Result<(Address, Address), String> {
+    let (start, end) = input.split_once(':').ok_or_else(|| format!("Invalid address range, expected START:END: {}", input))?;
+    Ok((parse_address(start)?, parse_address(end)?))
 }
 
 
@@ -41,6 +115,9 @@ pub enum ExecutionMode {
     Normal,
     Verbose,
     Interactive,
+    Jit,
+    Profile,
+    Trace,
 }
 
 
@@ -54,6 +131,12 @@ impl ValueEnum for ExecutionMode {
 
             "i" => Ok(ExecutionMode::Interactive),
 
+            "j" => Ok(ExecutionMode::Jit),
+
+            "p" => Ok(ExecutionMode::Profile),
+
+            "t" => Ok(ExecutionMode::Trace),
+
             _ => Err(format!("Invalid execution mode: {}", input)),
         }
     }
@@ -64,6 +147,9 @@ impl ValueEnum for ExecutionMode {
             ExecutionMode::Normal,
             ExecutionMode::Verbose,
             ExecutionMode::Interactive,
+            ExecutionMode::Jit,
+            ExecutionMode::Profile,
+            ExecutionMode::Trace,
         ]
     }
 
@@ -73,8 +159,50 @@ impl ValueEnum for ExecutionMode {
             ExecutionMode::Normal => Some(clap::builder::PossibleValue::new("n")),
             ExecutionMode::Verbose => Some(clap::builder::PossibleValue::new("v")),
             ExecutionMode::Interactive => Some(clap::builder::PossibleValue::new("i")),
+            ExecutionMode::Jit => Some(clap::builder::PossibleValue::new("j")),
+            ExecutionMode::Profile => Some(clap::builder::PossibleValue::new("p")),
+            ExecutionMode::Trace => Some(clap::builder::PossibleValue::new("t")),
         }
     }
     
 }
 
+
+
+/// When the buffered guest stdout is written out
+#[derive(Copy, Clone, PartialEq, Eq, Debug)]
+pub enum StdoutBuffering {
+    Line,
+    Full,
+}
+
+
+impl ValueEnum for StdoutBuffering {
+
+    fn from_str(input: &str, _ignore_case: bool) -> Result<Self, String> {
+        match input {
+            "line" => Ok(StdoutBuffering::Line),
+
+            "full" => Ok(StdoutBuffering::Full),
+
+            _ => Err(format!("Invalid stdout buffering: {}", input)),
+        }
+    }
+
+
+    fn value_variants<'a>() -> &'a [Self] {
+        &[
+            StdoutBuffering::Line,
+            StdoutBuffering::Full,
+        ]
+    }
+
+
+    fn to_possible_value(&self) -> Option<clap::builder::PossibleValue> {
+        match self {
+            StdoutBuffering::Line => Some(clap::builder::PossibleValue::new("line")),
+            StdoutBuffering::Full => Some(clap::builder::PossibleValue::new("full")),
+        }
+    }
+
+}
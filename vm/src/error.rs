@@ -1,10 +1,47 @@
+use std::cell::Cell;
+use std::panic;
 use std::path::Path;
 
 use indoc::{printdoc, formatdoc};
 use colored::Colorize;
 
+use crate::output;
+
+
+/// Unwinding payload of a fatal error raised while a processor is embedded in another program
+pub struct Fault(pub String);
+
+
+thread_local! {
+
+    /// Whether fatal errors on this thread are raised as `Fault`s instead of terminating the process
+    static EMBEDDED: Cell<bool> = const { Cell::new(false) };
+
+}
+
+
+/// Raise fatal errors on this thread as `Fault`s if `embedded`, or terminate the process. Returns the previous setting
+pub fn set_embedded(embedded: bool) -> bool {
+    EMBEDDED.with(|current| current.replace(embedded))
+}
+
+
+/// Whether fatal errors on this thread are raised as `Fault`s
+pub fn is_embedded() -> bool {
+    EMBEDDED.with(Cell::get)
+}
+
+
+fn raise_if_embedded(message: impl FnOnce() -> String) {
+    if is_embedded() {
+        panic::resume_unwind(Box::new(Fault(message())));
+    }
+}
+
 
 pub fn io_error(path: &Path, error: &std::io::Error, hint: &str) -> ! {
+    raise_if_embedded(|| format!("{}: {} ({})", hint, error, path.display()));
+    output::flush();
     printdoc!("
         ❌ Error in file \"{}\"
 
@@ -27,6 +64,8 @@ pub fn warn(message: &str) {
 
 
 pub fn error(message: &str) -> ! {
+    raise_if_embedded(|| message.to_string());
+    output::flush();
     printdoc!("
         ❌ Error: {}
 
@@ -0,0 +1,219 @@
+use std::collections::{HashMap, VecDeque};
+use std::sync::{Condvar, Mutex};
+use std::time::{Duration, Instant};
+
+
+/// Maximum number of events waiting to be reported. Beyond it the oldest events are dropped,
+/// so a program that never waits for events doesn't accumulate them
+const MAX_PENDING_EVENTS: usize = 1024;
+
+/// Longest time a thread waits before checking whether it must stop
+const MAX_WAIT_TIME: Duration = Duration::from_millis(10);
+
+
+/// Source of an event. A wait that times out reports 0
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+#[repr(u64)]
+pub enum EventKind {
+
+    Timer = 1,
+    Key = 2,
+    Storage = 3,
+
+}
+
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct Event {
+
+    pub kind: EventKind,
+    /// The timer handle, the key modifier code or the storage request id
+    pub source: u64,
+    /// The key code or the error code of the storage request. Always 0 for timers
+    pub value: u64,
+
+}
+
+
+struct Timer {
+
+    deadline: Instant,
+    /// Interval of a periodic timer
+    period: Option<Duration>,
+
+}
+
+
+#[derive(Default)]
+struct State {
+
+    timers: HashMap<u64, Timer>,
+    last_timer_id: u64,
+    /// Events that weren't reported yet, oldest first
+    pending: VecDeque<Event>,
+
+}
+
+
+impl State {
+
+    fn push(&mut self, event: Event) {
+        if self.pending.len() == MAX_PENDING_EVENTS {
+            self.pending.pop_front();
+        }
+        self.pending.push_back(event);
+    }
+
+
+    /// Report the timers whose deadline has passed and schedule the periodic ones again
+    fn fire_timers(&mut self, now: Instant) {
+
+        let mut fired = Vec::new();
+        self.timers.retain(|&id, timer| {
+            if timer.deadline > now {
+                return true;
+            }
+            fired.push((timer.deadline, id));
+
+            match timer.period {
+                Some(period) => {
+                    // Skip the ticks that were missed rather than reporting them all at once
+                    let missed = (now - timer.deadline).as_nanos() / period.as_nanos();
+                    timer.deadline += period * (missed as u32 + 1);
+                    true
+                },
+                None => false
+            }
+        });
+
+        // Report the timers in the order they expired
+        fired.sort_unstable();
+        for (_, id) in fired {
+            self.push(Event { kind: EventKind::Timer, source: id, value: 0 });
+        }
+    }
+
+
+    fn next_deadline(&self) -> Option<Instant> {
+        self.timers.values().map(|timer| timer.deadline).min()
+    }
+
+}
+
+
+/// The event sources of a program, shared by its threads and by the modules that complete work in the background.
+///
+/// A thread that waits for events is woken up by the first ready event, so a program can wait for
+/// its timers, the terminal keys and the storage requests at once
+pub struct Events {
+
+    state: Mutex<State>,
+    ready: Condvar,
+
+}
+
+
+impl Events {
+
+    pub fn new() -> Self {
+        Self {
+            state: Mutex::default(),
+            ready: Condvar::new(),
+        }
+    }
+
+
+    /// Start a timer that fires after `delay`, then every `period` if given. Return its handle
+    pub fn start_timer(&self, delay: Duration, period: Option<Duration>) -> u64 {
+        let mut state = self.state.lock().unwrap();
+        state.last_timer_id += 1;
+        let id = state.last_timer_id;
+        state.timers.insert(id, Timer {
+            deadline: Instant::now() + delay,
+            period: period.filter(|period| !period.is_zero()),
+        });
+
+        // A waiting thread may have to wake up earlier for the new timer
+        self.ready.notify_all();
+        id
+    }
+
+
+    /// Stop the timer with the given handle. Return whether it existed
+    pub fn cancel_timer(&self, id: u64) -> bool {
+        self.state.lock().unwrap().timers.remove(&id).is_some()
+    }
+
+
+    /// Report an event and wake up a waiting thread
+    pub fn push(&self, event: Event) {
+        self.state.lock().unwrap().push(event);
+        self.ready.notify_one();
+    }
+
+
+    /// Wait for the next event until the deadline, if any. Return `None` if the deadline passed or `should_stop` returned true
+    pub fn wait(&self, deadline: Option<Instant>, should_stop: impl Fn() -> bool) -> Option<Event> {
+
+        let mut state = self.state.lock().unwrap();
+
+        loop {
+            let now = Instant::now();
+            state.fire_timers(now);
+
+            if let Some(event) = state.pending.pop_front() {
+                return Some(event);
+            }
+
+            if deadline.is_some_and(|deadline| now >= deadline) || should_stop() {
+                return None;
+            }
+
+            let wakeup = [deadline, state.next_deadline(), Some(now + MAX_WAIT_TIME)]
+                .into_iter()
+                .flatten()
+                .min()
+                .expect("The maximum wait time is always given");
+
+            state = self.ready.wait_timeout(state, wakeup - now).unwrap().0;
+        }
+    }
+
+
+    /// Stop all the timers and drop the pending events
+    pub fn reset(&self) {
+        *self.state.lock().unwrap() = State::default();
+    }
+
+}
+
+
+#[cfg(test)]
+mod tests {
+
+    use super::*;
+
+
+    #[test]
+    fn test_events() {
+        let events = Events::new();
+
+        let slow = events.start_timer(Duration::from_millis(200), None);
+        let fast = events.start_timer(Duration::from_millis(5), Some(Duration::from_millis(5)));
+
+        assert_eq!(events.wait(None, || false).map(|event| event.source), Some(fast));
+        assert_eq!(events.wait(None, || false).map(|event| event.source), Some(fast));
+        assert!(events.cancel_timer(fast));
+        assert!(!events.cancel_timer(fast));
+
+        events.push(Event { kind: EventKind::Key, source: 14, value: b'q' as u64 });
+        assert_eq!(events.wait(None, || false), Some(Event { kind: EventKind::Key, source: 14, value: b'q' as u64 }));
+
+        assert_eq!(events.wait(None, || false).map(|event| event.source), Some(slow));
+
+        let start = Instant::now();
+        assert_eq!(events.wait(Some(start + Duration::from_millis(5)), || false), None);
+        assert!(start.elapsed() >= Duration::from_millis(5));
+    }
+
+}
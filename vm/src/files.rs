@@ -1,14 +1,80 @@
-use std::fs;
+use std::fs::File;
+use std::os::fd::AsRawFd;
 use std::path::Path;
 
-use rusty_vm_lib::assembly::ByteCode;
-
 use crate::error;
+use crate::memory::Byte;
 
 
-pub fn load_byte_code(file_path: &Path) -> ByteCode {
-    fs::read(file_path).unwrap_or_else(
-        |err| error::io_error(file_path, &err, format!("Failed to read file {}", file_path.display()).as_str())
-    )
+/// A byte code file mapped read-only, so that it's never read as a whole.
+///
+/// The file is kept open so that the loader can also map its sections directly into the guest memory
+pub struct ByteCodeFile {
+
+    file: File,
+    mapping: *const Byte,
+    size: usize,
+
+}
+
+
+impl ByteCodeFile {
+
+    pub fn bytes(&self) -> &[Byte] {
+        if self.size == 0 {
+            &[]
+        } else {
+            unsafe { std::slice::from_raw_parts(self.mapping, self.size) }
+        }
+    }
+
+
+    pub fn file(&self) -> &File {
+        &self.file
+    }
+
 }
 
+
+impl Drop for ByteCodeFile {
+    fn drop(&mut self) {
+        if self.size != 0 {
+            unsafe {
+                libc::munmap(self.mapping as *mut libc::c_void, self.size);
+            }
+        }
+    }
+}
+
+
+pub fn load_byte_code(file_path: &Path) -> ByteCodeFile {
+
+    let file = File::open(file_path).unwrap_or_else(
+        |err| error::io_error(file_path, &err, format!("Failed to read file {}", file_path.display()).as_str())
+    );
+
+    let size = file.metadata().unwrap_or_else(
+        |err| error::io_error(file_path, &err, format!("Failed to read file {}", file_path.display()).as_str())
+    ).len() as usize;
+
+    // Empty files can't be mapped
+    if size == 0 {
+        return ByteCodeFile { file, mapping: std::ptr::null(), size };
+    }
+
+    let mapping = unsafe {
+        libc::mmap(
+            std::ptr::null_mut(),
+            size,
+            libc::PROT_READ,
+            libc::MAP_PRIVATE,
+            file.as_raw_fd(),
+            0
+        )
+    };
+    if mapping == libc::MAP_FAILED {
+        error::io_error(file_path, &std::io::Error::last_os_error(), format!("Failed to map file {}", file_path.display()).as_str());
+    }
+
+    ByteCodeFile { file, mapping: mapping as *const Byte, size }
+}
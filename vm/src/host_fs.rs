@@ -1,25 +1,75 @@
-use std::fs;
+use std::collections::HashMap;
+use std::fs::{self, File, OpenOptions};
+use std::io::{self, Read, Seek, SeekFrom, Write};
+use std::os::unix::fs::FileExt;
 use std::path::Path;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::{Arc, Mutex};
+use std::time::UNIX_EPOCH;
 
 use rusty_vm_lib::registers::Registers;
 use rusty_vm_lib::vm::{ErrorCodes, Address};
 
-use crate::memory::Memory;
+use crate::memory::{self, Memory};
+use crate::perf_counters::Traffic;
 use crate::register::CPURegisters;
 
 
-pub struct HostFS;
+/// Flags of the open operation
+const OPEN_READ: u64 = 1;
+const OPEN_WRITE: u64 = 1 << 1;
+const OPEN_CREATE: u64 = 1 << 2;
+const OPEN_TRUNCATE: u64 = 1 << 3;
+const OPEN_APPEND: u64 = 1 << 4;
+
+/// Origins of the seek operation
+const SEEK_START: u64 = 0;
+const SEEK_CURRENT: u64 = 1;
+const SEEK_END: u64 = 2;
+
+
+/// Access to the host file system.
+///
+/// Besides the operations on whole files, a program can open files and get a descriptor to stream them through a small buffer.
+/// The descriptors are shared by all the threads of the program
+pub struct HostFS {
+
+    /// Files opened by the program, by descriptor. Operations clone the file out so that the table isn't locked during I/O
+    files: Mutex<HashMap<u64, Arc<File>>>,
+    last_descriptor: AtomicU64,
+    /// Bytes read and written by the program, for the PerfCounters interrupt
+    pub traffic: Traffic,
+
+}
 
 
 impl HostFS {
 
     pub fn new() -> Self {
-        Self {}
+        Self {
+            files: Mutex::default(),
+            last_descriptor: AtomicU64::new(0),
+            traffic: Traffic::default(),
+        }
     }
 
 
     pub fn handle_code(&self, code: usize, registers: &mut CPURegisters, memory: &mut Memory) -> ErrorCodes {
-        CODE_HANDLERS[code](registers, memory)
+        match CODE_HANDLERS.get(code) {
+            Some(handler) => handler(self, registers, memory),
+            None => ErrorCodes::InvalidInput
+        }
+    }
+
+
+    /// Close all the files opened by the program
+    pub fn close_all(&self) {
+        self.files.lock().unwrap().clear();
+    }
+
+
+    fn get_file(&self, descriptor: u64) -> Result<Arc<File>, ErrorCodes> {
+        self.files.lock().unwrap().get(&descriptor).cloned().ok_or(ErrorCodes::NotFound)
     }
 
 }
@@ -31,17 +81,52 @@ fn read_until_null(data: &[u8]) -> Option<&[u8]> {
 }
 
 
-fn handle_exists(registers: &mut CPURegisters, memory: &mut Memory) -> ErrorCodes {
+/// Read the null-terminated path at the given address
+fn read_path(memory: &Memory, address: Address) -> Result<&Path, ErrorCodes> {
+    let raw_bytes = read_until_null(&memory.get_raw()[address..]).ok_or(ErrorCodes::InvalidInput)?;
+    std::str::from_utf8(raw_bytes)
+        .map(Path::new)
+        .map_err(|_| ErrorCodes::InvalidInput)
+}
 
-    let path_address = registers.get(Registers::R1) as Address;
 
-    let file_path = if let Some(raw_bytes) = read_until_null(&memory.get_raw()[path_address..]) {
-        match std::str::from_utf8(raw_bytes) {
-            Ok(s) => Path::new(s),
-            Err(_) => return ErrorCodes::InvalidInput
+/// Store the value in r1, or 0 if the operation failed, and return the error code
+fn set_result(registers: &mut CPURegisters, result: Result<u64, ErrorCodes>) -> ErrorCodes {
+    match result {
+        Ok(value) => {
+            registers.set(Registers::R1, value);
+            ErrorCodes::NoError
+        },
+        Err(e) => {
+            registers.set(Registers::R1, 0);
+            e
         }
-    } else {
-        return ErrorCodes::InvalidInput;
+    }
+}
+
+
+/// Read into the buffer until it's full or the end of file is reached. Return the number of bytes read
+fn read_full(buffer: &mut [u8], mut read: impl FnMut(&mut [u8]) -> io::Result<usize>) -> io::Result<usize> {
+    let mut total = 0;
+    while total < buffer.len() {
+        match read(&mut buffer[total..]) {
+            Ok(0) => break,
+            Ok(count) => total += count,
+            Err(e) if e.kind() == io::ErrorKind::Interrupted => {},
+            Err(e) => return Err(e)
+        }
+    }
+    Ok(total)
+}
+
+
+fn handle_exists(_fs: &HostFS, registers: &mut CPURegisters, memory: &mut Memory) -> ErrorCodes {
+
+    let path_address = registers.get(Registers::R1) as Address;
+
+    let file_path = match read_path(memory, path_address) {
+        Ok(path) => path,
+        Err(e) => return e
     };
 
     registers.set(Registers::R1, file_path.exists() as u64);
@@ -50,23 +135,20 @@ fn handle_exists(registers: &mut CPURegisters, memory: &mut Memory) -> ErrorCode
 }
 
 
-fn handle_read_all(registers: &mut CPURegisters, memory: &mut Memory) -> ErrorCodes {
+fn handle_read_all(fs: &HostFS, registers: &mut CPURegisters, memory: &mut Memory) -> ErrorCodes {
 
     let path_address = registers.get(Registers::R1) as Address;
     let buffer_address = registers.get(Registers::R2) as Address;
 
-    let file_path = if let Some(raw_bytes) = read_until_null(&memory.get_raw()[path_address..]) {
-        match std::str::from_utf8(raw_bytes) {
-            Ok(s) => Path::new(s),
-            Err(_) => return ErrorCodes::InvalidInput
-        }
-    } else {
-        return ErrorCodes::InvalidInput;
+    let file_path = match read_path(memory, path_address) {
+        Ok(path) => path,
+        Err(e) => return e
     };
 
     match fs::read(file_path) {
         Ok(bytes) => {
             memory.set_bytes(buffer_address, &bytes);
+            fs.traffic.record_read(bytes.len());
             ErrorCodes::NoError
         },
         Err(e) => ErrorCodes::from(e)
@@ -74,36 +156,32 @@ fn handle_read_all(registers: &mut CPURegisters, memory: &mut Memory) -> ErrorCo
 }
 
 
-fn handle_write_all(registers: &mut CPURegisters, memory: &mut Memory) -> ErrorCodes {
+fn handle_write_all(fs: &HostFS, registers: &mut CPURegisters, memory: &mut Memory) -> ErrorCodes {
 
     let path_address = registers.get(Registers::R1) as Address;
     let buffer_address = registers.get(Registers::R2) as Address;
     let buffer_size = registers.get(Registers::R3) as usize;
 
-    let file_path = if let Some(raw_bytes) = read_until_null(&memory.get_raw()[path_address..]) {
-        match std::str::from_utf8(raw_bytes) {
-            Ok(s) => Path::new(s),
-            Err(_) => return ErrorCodes::InvalidInput
-        }
-    } else {
-        return ErrorCodes::InvalidInput;
+    let file_path = match read_path(memory, path_address) {
+        Ok(path) => path,
+        Err(e) => return e
     };
 
-    fs::write(file_path, memory.get_bytes(buffer_address, buffer_size)).into()
+    let result = fs::write(file_path, memory.get_bytes(buffer_address, buffer_size));
+    if result.is_ok() {
+        fs.traffic.record_write(buffer_size);
+    }
+    result.into()
 }
 
 
-fn handle_create_file(registers: &mut CPURegisters, memory: &mut Memory) -> ErrorCodes {
+fn handle_create_file(_fs: &HostFS, registers: &mut CPURegisters, memory: &mut Memory) -> ErrorCodes {
 
     let path_address = registers.get(Registers::R1) as Address;
 
-    let file_path = if let Some(raw_bytes) = read_until_null(&memory.get_raw()[path_address..]) {
-        match std::str::from_utf8(raw_bytes) {
-            Ok(s) => Path::new(s),
-            Err(_) => return ErrorCodes::InvalidInput
-        }
-    } else {
-        return ErrorCodes::InvalidInput;
+    let file_path = match read_path(memory, path_address) {
+        Ok(path) => path,
+        Err(e) => return e
     };
 
     fs::File::create(file_path).into()
@@ -111,17 +189,13 @@ fn handle_create_file(registers: &mut CPURegisters, memory: &mut Memory) -> Erro
 }
 
 
-fn handle_create_dir(registers: &mut CPURegisters, memory: &mut Memory) -> ErrorCodes {
+fn handle_create_dir(_fs: &HostFS, registers: &mut CPURegisters, memory: &mut Memory) -> ErrorCodes {
 
     let path_address = registers.get(Registers::R1) as Address;
 
-    let dir_path = if let Some(raw_bytes) = read_until_null(&memory.get_raw()[path_address..]) {
-        match std::str::from_utf8(raw_bytes) {
-            Ok(s) => Path::new(s),
-            Err(_) => return ErrorCodes::InvalidInput
-        }
-    } else {
-        return ErrorCodes::InvalidInput;
+    let dir_path = match read_path(memory, path_address) {
+        Ok(path) => path,
+        Err(e) => return e
     };
 
     fs::create_dir_all(dir_path).into()
@@ -129,13 +203,338 @@ fn handle_create_dir(registers: &mut CPURegisters, memory: &mut Memory) -> Error
 }
 
 
-type CodeHanlder = fn(&mut CPURegisters, &mut Memory) -> ErrorCodes;
+fn handle_open(fs: &HostFS, registers: &mut CPURegisters, memory: &mut Memory) -> ErrorCodes {
+
+    let path_address = registers.get(Registers::R1) as Address;
+    let flags = registers.get(Registers::R2);
+
+    let result = read_path(memory, path_address).and_then(|file_path| {
+        let file = OpenOptions::new()
+            .read(flags & OPEN_READ != 0)
+            .write(flags & OPEN_WRITE != 0)
+            .create(flags & OPEN_CREATE != 0)
+            .truncate(flags & OPEN_TRUNCATE != 0)
+            .append(flags & OPEN_APPEND != 0)
+            .open(file_path)?;
+
+        let descriptor = fs.last_descriptor.fetch_add(1, Ordering::Relaxed) + 1;
+        fs.files.lock().unwrap().insert(descriptor, Arc::new(file));
+        Ok(descriptor)
+    });
+
+    set_result(registers, result)
+}
+
+
+fn handle_close(fs: &HostFS, registers: &mut CPURegisters, _memory: &mut Memory) -> ErrorCodes {
+
+    let descriptor = registers.get(Registers::R1);
+
+    match fs.files.lock().unwrap().remove(&descriptor) {
+        Some(_) => ErrorCodes::NoError,
+        None => ErrorCodes::NotFound
+    }
+}
+
+
+fn handle_read(fs: &HostFS, registers: &mut CPURegisters, memory: &mut Memory) -> ErrorCodes {
+
+    let descriptor = registers.get(Registers::R1);
+    let buffer_address = registers.get(Registers::R2) as Address;
+    let size = registers.get(Registers::R3) as usize;
+
+    let result = fs.get_file(descriptor).and_then(|file| {
+        let buffer = memory.get_bytes_mut(buffer_address, size);
+        let count = read_full(buffer, |buffer| (&*file).read(buffer))?;
+        fs.traffic.record_read(count);
+        Ok(count as u64)
+    });
+
+    set_result(registers, result)
+}
+
+
+fn handle_write(fs: &HostFS, registers: &mut CPURegisters, memory: &mut Memory) -> ErrorCodes {
+
+    let descriptor = registers.get(Registers::R1);
+    let buffer_address = registers.get(Registers::R2) as Address;
+    let size = registers.get(Registers::R3) as usize;
+
+    let result = fs.get_file(descriptor).and_then(|file| {
+        (&*file).write_all(memory.get_bytes(buffer_address, size))?;
+        fs.traffic.record_write(size);
+        Ok(size as u64)
+    });
+
+    set_result(registers, result)
+}
+
+
+fn handle_read_at(fs: &HostFS, registers: &mut CPURegisters, memory: &mut Memory) -> ErrorCodes {
+
+    let descriptor = registers.get(Registers::R1);
+    let buffer_address = registers.get(Registers::R2) as Address;
+    let size = registers.get(Registers::R3) as usize;
+    let offset = registers.get(Registers::R4);
+
+    let result = fs.get_file(descriptor).and_then(|file| {
+        let buffer = memory.get_bytes_mut(buffer_address, size);
+        let mut position = offset;
+        let count = read_full(buffer, |buffer| {
+            let count = file.read_at(buffer, position)?;
+            position += count as u64;
+            Ok(count)
+        })?;
+        fs.traffic.record_read(count);
+        Ok(count as u64)
+    });
+
+    set_result(registers, result)
+}
+
+
+fn handle_write_at(fs: &HostFS, registers: &mut CPURegisters, memory: &mut Memory) -> ErrorCodes {
+
+    let descriptor = registers.get(Registers::R1);
+    let buffer_address = registers.get(Registers::R2) as Address;
+    let size = registers.get(Registers::R3) as usize;
+    let offset = registers.get(Registers::R4);
+
+    let result = fs.get_file(descriptor).and_then(|file| {
+        file.write_all_at(memory.get_bytes(buffer_address, size), offset)?;
+        fs.traffic.record_write(size);
+        Ok(size as u64)
+    });
+
+    set_result(registers, result)
+}
+
+
+fn handle_seek(fs: &HostFS, registers: &mut CPURegisters, _memory: &mut Memory) -> ErrorCodes {
+
+    let descriptor = registers.get(Registers::R1);
+    let offset = registers.get(Registers::R2);
+    let origin = registers.get(Registers::R3);
 
-const CODE_HANDLERS: [CodeHanlder; 5] = [
+    let result = fs.get_file(descriptor).and_then(|file| {
+        let position = match origin {
+            SEEK_START => SeekFrom::Start(offset),
+            SEEK_CURRENT => SeekFrom::Current(offset as i64),
+            SEEK_END => SeekFrom::End(offset as i64),
+            _ => return Err(ErrorCodes::InvalidInput)
+        };
+        Ok((&*file).seek(position)?)
+    });
+
+    set_result(registers, result)
+}
+
+
+fn handle_stat(fs: &HostFS, registers: &mut CPURegisters, _memory: &mut Memory) -> ErrorCodes {
+
+    let descriptor = registers.get(Registers::R1);
+
+    let result = fs.get_file(descriptor).and_then(|file| {
+        let metadata = file.metadata()?;
+        let modified = metadata.modified().ok()
+            .and_then(|time| time.duration_since(UNIX_EPOCH).ok())
+            .map_or(0, |time| time.as_secs());
+        Ok((metadata.len(), modified))
+    });
+
+    match result {
+        Ok((size, modified)) => {
+            registers.set(Registers::R1, size);
+            registers.set(Registers::R2, modified);
+            ErrorCodes::NoError
+        },
+        Err(e) => {
+            registers.set(Registers::R1, 0);
+            registers.set(Registers::R2, 0);
+            e
+        }
+    }
+}
+
+
+/// Map the file into the largest page-aligned range inside the given memory range, so that its pages are only read when they're accessed.
+/// Return the address of the byte at the given file offset and the number of file bytes that can be accessed from there
+fn map_file(file: &File, memory: &mut Memory, address: Address, size: usize, offset: u64) -> Result<(Address, usize), ErrorCodes> {
+
+    let end = address.checked_add(size)
+        .filter(|&end| end <= memory.get_stack_base())
+        .ok_or(ErrorCodes::OutOfBounds)?;
+
+    let file_size = file.metadata()?.len();
+    if offset >= file_size {
+        return Err(ErrorCodes::EndOfFile);
+    }
+
+    // The mapping must start at a page boundary in both the memory and the file
+    let page_size = memory::page_size();
+    let start = memory.align_to_page(address);
+    let file_start = offset - offset % page_size as u64;
+    let data_address = start + (offset - file_start) as usize;
+
+    let whole_pages_size = end.saturating_sub(start) / page_size * page_size;
+    if data_address >= start + whole_pages_size {
+        return Err(ErrorCodes::InvalidInput);
+    }
+
+    // Pages past the end of the file can't be accessed, so they're left out
+    let file_pages_size = ((file_size - file_start) as usize).div_ceil(page_size) * page_size;
+    let mapping_size = whole_pages_size.min(file_pages_size);
+
+    memory.map_file(start, mapping_size, file, file_start)?;
+
+    let data_end = (start + mapping_size).min(start + (file_size - file_start) as usize);
+    Ok((data_address, data_end - data_address))
+}
+
+
+fn handle_map(fs: &HostFS, registers: &mut CPURegisters, memory: &mut Memory) -> ErrorCodes {
+
+    let descriptor = registers.get(Registers::R1);
+    let address = registers.get(Registers::R2) as Address;
+    let size = registers.get(Registers::R3) as usize;
+    let offset = registers.get(Registers::R4);
+
+    let result = fs.get_file(descriptor).and_then(|file| map_file(&file, memory, address, size, offset));
+
+    match result {
+        Ok((data_address, data_size)) => {
+            registers.set(Registers::R1, data_address as u64);
+            registers.set(Registers::R2, data_size as u64);
+            ErrorCodes::NoError
+        },
+        Err(e) => {
+            registers.set(Registers::R1, 0);
+            registers.set(Registers::R2, 0);
+            e
+        }
+    }
+}
+
+
+type CodeHanlder = fn(&HostFS, &mut CPURegisters, &mut Memory) -> ErrorCodes;
+
+const CODE_HANDLERS: [CodeHanlder; 14] = [
     handle_exists, // 0
     handle_read_all, // 1
     handle_write_all, // 2
     handle_create_file, //3
     handle_create_dir, // 4
+    handle_open, // 5
+    handle_close, // 6
+    handle_read, // 7
+    handle_write, // 8
+    handle_read_at, // 9
+    handle_write_at, // 10
+    handle_seek, // 11
+    handle_stat, // 12
+    handle_map, // 13
 ];
 
+
+#[cfg(test)]
+mod tests {
+
+    use super::*;
+
+
+    fn call(fs: &HostFS, code: usize, registers: &mut CPURegisters, memory: &mut Memory, args: &[u64]) -> ErrorCodes {
+        for (&register, &value) in [Registers::R1, Registers::R2, Registers::R3, Registers::R4].iter().zip(args) {
+            registers.set(register, value);
+        }
+        fs.handle_code(code, registers, memory)
+    }
+
+
+    fn test_file(name: &str, content: &[u8]) -> String {
+        let path = std::env::temp_dir().join(format!("rusty_vm_host_fs_{}_{}", std::process::id(), name));
+        fs::write(&path, content).unwrap();
+        path.to_str().unwrap().to_string()
+    }
+
+
+    #[test]
+    fn test_descriptors() {
+        let path = test_file("descriptors", b"hello world");
+
+        let mut memory = Memory::new(4096);
+        let mut registers = CPURegisters::new();
+        let fs = HostFS::new();
+
+        memory.set_bytes(0, path.as_bytes());
+        memory.set_bytes(path.len(), &[0]);
+
+        assert_eq!(call(&fs, 5, &mut registers, &mut memory, &[0, OPEN_READ | OPEN_WRITE]), ErrorCodes::NoError);
+        let descriptor = registers.get(Registers::R1);
+
+        // Stream the file through a 4-byte buffer
+        let mut content = Vec::new();
+        loop {
+            assert_eq!(call(&fs, 7, &mut registers, &mut memory, &[descriptor, 1024, 4]), ErrorCodes::NoError);
+            let count = registers.get(Registers::R1) as usize;
+            if count == 0 {
+                break;
+            }
+            content.extend_from_slice(memory.get_bytes(1024, count));
+        }
+        assert_eq!(content, b"hello world");
+
+        memory.set_bytes(1024, b"W");
+        assert_eq!(call(&fs, 10, &mut registers, &mut memory, &[descriptor, 1024, 1, 6]), ErrorCodes::NoError);
+        assert_eq!(call(&fs, 9, &mut registers, &mut memory, &[descriptor, 1024, 16, 4]), ErrorCodes::NoError);
+        assert_eq!(memory.get_bytes(1024, registers.get(Registers::R1) as usize), b"o World");
+
+        assert_eq!(call(&fs, 11, &mut registers, &mut memory, &[descriptor, -5i64 as u64, SEEK_END]), ErrorCodes::NoError);
+        assert_eq!(registers.get(Registers::R1), 6);
+
+        assert_eq!(call(&fs, 12, &mut registers, &mut memory, &[descriptor]), ErrorCodes::NoError);
+        assert_eq!(registers.get(Registers::R1), 11);
+
+        assert_eq!(call(&fs, 6, &mut registers, &mut memory, &[descriptor]), ErrorCodes::NoError);
+        assert_eq!(call(&fs, 7, &mut registers, &mut memory, &[descriptor, 1024, 4]), ErrorCodes::NotFound);
+
+        fs::remove_file(path).unwrap();
+    }
+
+
+    #[test]
+    fn test_map() {
+        let page_size = memory::page_size();
+        let content: Vec<u8> = (0..page_size * 3).map(|i| (i % 251) as u8).collect();
+        let path = test_file("map", &content);
+
+        let mut memory = Memory::new(page_size * 8);
+        let mut registers = CPURegisters::new();
+        let fs = HostFS::new();
+
+        memory.set_bytes(0, path.as_bytes());
+        memory.set_bytes(path.len(), &[0]);
+
+        assert_eq!(call(&fs, 5, &mut registers, &mut memory, &[0, OPEN_READ]), ErrorCodes::NoError);
+        let descriptor = registers.get(Registers::R1);
+
+        // The range is unaligned and the offset is in the middle of a page
+        let offset = page_size as u64 + 10;
+        assert_eq!(call(&fs, 13, &mut registers, &mut memory, &[descriptor, 100, (page_size * 5) as u64, offset]), ErrorCodes::NoError);
+        let data_address = registers.get(Registers::R1) as Address;
+        let data_size = registers.get(Registers::R2) as usize;
+
+        assert!(data_address >= 100);
+        assert_eq!(data_size, content.len() - offset as usize);
+        assert_eq!(memory.get_bytes(data_address, data_size), &content[offset as usize..]);
+
+        // Writes to the mapping don't reach the file
+        memory.set_bytes(data_address, &[0xff]);
+        assert_eq!(fs::read(&path).unwrap(), content);
+
+        assert_eq!(call(&fs, 13, &mut registers, &mut memory, &[descriptor, 100, 10, 0]), ErrorCodes::InvalidInput);
+        assert_eq!(call(&fs, 13, &mut registers, &mut memory, &[descriptor, 100, 10, content.len() as u64]), ErrorCodes::EndOfFile);
+
+        fs::remove_file(path).unwrap();
+    }
+
+}
@@ -0,0 +1,362 @@
+use rusty_vm_lib::byte_code::{ByteCodes, JumpCondition, OperandKind, BYTE_CODE_COUNT, JUMP_CONDITION_COUNT};
+use rusty_vm_lib::registers::{Registers, REGISTER_COUNT, REGISTER_ID_SIZE};
+use rusty_vm_lib::vm::{Address, ADDRESS_SIZE};
+
+use crate::error;
+use crate::memory::{Memory, Byte};
+
+
+/// The size of the largest encoded instruction: opcode, handled size, two 8-byte operands, jump condition and jump target
+pub const MAX_INSTRUCTION_SIZE: usize = 1 + 1 + ADDRESS_SIZE * 2 + 1 + ADDRESS_SIZE;
+
+
+/// An instruction whose operands have already been read from the bytecode.
+/// 
+/// The first operand is stored in `reg1` or `arg1` and the second operand in `reg2` or `arg2`, depending on the operand kind.
+/// Register and address-in-register operands are stored as registers, while constants and address literals are stored as integers.
+/// Constants are zero-extended to 8 bytes.
+/// The handled size of size-specialized instructions is taken from the opcode.
+/// The jump condition and target of superinstructions are stored in `condition` and `target`.
+#[derive(Clone, Copy, Debug)]
+pub struct DecodedInstruction {
+
+    pub opcode: ByteCodes,
+    pub handled_size: Byte,
+    /// The size of the encoded instruction in bytes. Zero marks a stale cache entry
+    pub size: u8,
+    pub reg1: Registers,
+    pub reg2: Registers,
+    pub arg1: u64,
+    pub arg2: u64,
+    /// Only meaningful for instructions with a jump condition
+    pub condition: JumpCondition,
+    pub target: Address,
+
+}
+
+
+/// Decode the instruction at the start of `code`.
+/// 
+/// Return `None` if the opcode or a register id is invalid, or if the instruction is truncated.
+pub fn decode(code: &[Byte]) -> Option<DecodedInstruction> {
+
+    let opcode = *code.first()?;
+    if opcode as usize >= BYTE_CODE_COUNT {
+        return None;
+    }
+    let opcode = ByteCodes::from(opcode);
+    let layout = opcode.operand_layout();
+
+    let mut offset = 1;
+
+    let handled_size = if layout.sized {
+        offset += 1;
+        *code.get(1)?
+    } else if let Some((_, size)) = opcode.fixed_size() {
+        size
+    } else {
+        0
+    };
+
+    let mut registers = [Registers::R1; 2];
+    let mut args = [0; 2];
+
+    for (i, kind) in layout.operands.iter().enumerate() {
+        match kind {
+
+            OperandKind::None => {},
+
+            OperandKind::Register => {
+                let id = *code.get(offset)?;
+                if id as usize >= REGISTER_COUNT {
+                    return None;
+                }
+                registers[i] = Registers::from(id);
+                offset += REGISTER_ID_SIZE;
+            },
+
+            OperandKind::Constant => {
+                // Interrupt codes are the only constants without a handled size and are 1 byte long
+                let size = if handled_size != 0 { handled_size as usize } else { 1 };
+                if size > 8 {
+                    return None;
+                }
+                let mut bytes = [0; 8];
+                bytes[..size].copy_from_slice(code.get(offset..offset + size)?);
+                args[i] = u64::from_le_bytes(bytes);
+                offset += size;
+            },
+
+            OperandKind::Address => {
+                let bytes = code.get(offset..offset + ADDRESS_SIZE)?;
+                args[i] = Address::from_le_bytes(bytes.try_into().unwrap()) as u64;
+                offset += ADDRESS_SIZE;
+            },
+        }
+    }
+
+    let mut condition = JumpCondition::Zero;
+    if layout.condition {
+        let byte = *code.get(offset)?;
+        if byte as usize >= JUMP_CONDITION_COUNT {
+            return None;
+        }
+        condition = JumpCondition::from(byte);
+        offset += 1;
+    }
+
+    let mut target = 0;
+    if layout.target {
+        let bytes = code.get(offset..offset + ADDRESS_SIZE)?;
+        target = Address::from_le_bytes(bytes.try_into().unwrap());
+        offset += ADDRESS_SIZE;
+    }
+
+    Some(DecodedInstruction {
+        opcode,
+        handled_size,
+        size: offset as u8,
+        reg1: registers[0],
+        reg2: registers[1],
+        arg1: args[0],
+        arg2: args[1],
+        condition,
+        target,
+    })
+}
+
+
+/// Decode the instruction at the given address, terminating the program if it's invalid
+fn decode_at(address: Address, memory: &Memory) -> DecodedInstruction {
+    let code = &memory.get_raw()[address..];
+    decode(code).unwrap_or_else(
+        || error::error(format!("Invalid instruction at address {:#X}", address).as_str())
+    )
+}
+
+
+/// Cache of the decoded instructions of the program image.
+/// 
+/// Instructions are stored in a compact array. Every address of the program image maps to the index of the instruction that starts there, if any.
+/// Instructions outside the program image (for example, code generated at runtime on the heap) are decoded every time they are executed.
+pub struct InstructionCache {
+
+    /// Index + 1 of the decoded instruction starting at each address of the program image. Zero means not decoded yet
+    index_map: Box<[u32]>,
+    instructions: Vec<DecodedInstruction>,
+
+}
+
+
+impl InstructionCache {
+
+    pub fn new() -> Self {
+        Self {
+            index_map: Box::default(),
+            instructions: Vec::new(),
+        }
+    }
+
+
+    /// Decode the program image, which is the first `program_size` bytes of memory.
+    /// 
+    /// The control flow is followed from the entry point so that data in the image is never decoded as code.
+    /// Instructions that aren't statically reachable are decoded lazily the first time they are executed.
+    pub fn load(&mut self, memory: &Memory, program_size: usize, entry_point: Address) {
+
+        self.index_map = vec![0; program_size].into_boxed_slice();
+        self.instructions.clear();
+
+        let code = &memory.get_raw()[..program_size];
+
+        let mut to_visit = vec![entry_point];
+
+        while let Some(mut address) = to_visit.pop() {
+            while address < program_size && self.index_map[address] == 0 {
+
+                let Some(instruction) = decode(&code[address..]) else {
+                    // Leave the error to be reported if the instruction is ever executed
+                    break;
+                };
+
+                self.insert(address, instruction);
+                address += instruction.size as usize;
+
+                match instruction.opcode {
+
+                    ByteCodes::JUMP => {
+                        to_visit.push(instruction.arg1 as Address);
+                        break;
+                    },
+
+                    ByteCodes::JUMP_NOT_ZERO |
+                    ByteCodes::JUMP_ZERO |
+                    ByteCodes::JUMP_GREATER |
+                    ByteCodes::JUMP_LESS |
+                    ByteCodes::JUMP_GREATER_OR_EQUAL |
+                    ByteCodes::JUMP_LESS_OR_EQUAL |
+                    ByteCodes::JUMP_CARRY |
+                    ByteCodes::JUMP_NOT_CARRY |
+                    ByteCodes::JUMP_OVERFLOW |
+                    ByteCodes::JUMP_NOT_OVERFLOW |
+                    ByteCodes::JUMP_SIGN |
+                    ByteCodes::JUMP_NOT_SIGN |
+                    ByteCodes::CALL
+                        => to_visit.push(instruction.arg1 as Address),
+
+                    ByteCodes::RETURN |
+                    ByteCodes::POP_INTO_REG_RETURN |
+                    ByteCodes::EXIT
+                        => break,
+
+                    // Superinstructions that jump or call
+                    _ if instruction.opcode.operand_layout().target
+                        => to_visit.push(instruction.target),
+
+                    _ => {}
+                }
+            }
+        }
+    }
+
+
+    /// Empty the cache for a program image of `program_size` bytes that is already in memory.
+    /// Unlike `load`, nothing is decoded ahead of time, so this is cheap even for big images
+    pub fn prepare(&mut self, program_size: usize) {
+        self.index_map = vec![0; program_size].into_boxed_slice();
+        self.instructions.clear();
+    }
+
+
+    fn insert(&mut self, address: Address, instruction: DecodedInstruction) {
+        self.instructions.push(instruction);
+        self.index_map[address] = self.instructions.len() as u32;
+    }
+
+
+    /// Get the decoded instruction at the given address
+    #[inline(always)]
+    pub fn fetch(&mut self, address: Address, memory: &Memory) -> DecodedInstruction {
+
+        let Some(&index) = self.index_map.get(address) else {
+            // The instruction is outside the program image and cannot be cached
+            return decode_at(address, memory);
+        };
+
+        if index != 0 {
+            let cached = &mut self.instructions[index as usize - 1];
+            if cached.size == 0 {
+                // The entry was invalidated by a write to its code, decode it again in place
+                *cached = decode_at(address, memory);
+            }
+            return *cached;
+        }
+
+        let instruction = decode_at(address, memory);
+        self.insert(address, instruction);
+        instruction
+    }
+
+
+    /// Invalidate all the decoded instructions that overlap the address range `start..end`
+    pub fn invalidate(&mut self, start: Address, end: Address) {
+
+        let end = end.min(self.index_map.len());
+
+        // An instruction that starts before `start` may still extend into the range
+        for address in start.saturating_sub(MAX_INSTRUCTION_SIZE - 1)..end {
+            let index = self.index_map[address];
+            if index != 0 {
+                let instruction = &mut self.instructions[index as usize - 1];
+                if address + instruction.size as usize > start {
+                    instruction.size = 0;
+                }
+            }
+        }
+    }
+
+}
+
+
+#[cfg(test)]
+mod tests {
+
+    use super::*;
+
+
+    const R1: u8 = Registers::R1 as u8;
+
+
+    /// mov8 r1 1, inc r1, exit
+    fn program() -> Vec<Byte> {
+        let mut code = vec![ByteCodes::MOVE_INTO_REG_FROM_CONST as u8, 8, R1];
+        code.extend(1u64.to_le_bytes());
+        code.extend([ByteCodes::INC_REG as u8, R1, ByteCodes::EXIT as u8]);
+        code
+    }
+
+
+    /// Write the program at the start of memory and mark it as the program image
+    fn memory_with(code: &[Byte]) -> Memory {
+        let mut memory = Memory::new(4096);
+        memory.set_bytes(0, code);
+        memory.set_code_size(code.len());
+        memory
+    }
+
+
+    /// Overwrite code like a guest store would, and invalidate the written range like the processor does
+    fn write_code(cache: &mut InstructionCache, memory: &mut Memory, address: Address, bytes: &[Byte]) {
+        memory.set_bytes(address, bytes);
+        let (start, end) = memory.take_code_writes().unwrap();
+        cache.invalidate(start, end);
+    }
+
+
+    #[test]
+    fn test_invalidate() {
+        let code = program();
+        let mut memory = memory_with(&code);
+
+        let mut cache = InstructionCache::new();
+        cache.load(&memory, code.len(), 0);
+        assert_eq!(cache.fetch(0, &memory).arg2, 1);
+
+        // Writing the constant re-decodes the instruction it belongs to
+        write_code(&mut cache, &mut memory, 3, &5u64.to_le_bytes());
+        assert_eq!(cache.fetch(0, &memory).arg2, 5);
+
+        // Writing the last byte of the instruction also re-decodes it, although the instruction starts before the range
+        write_code(&mut cache, &mut memory, 10, &[1]);
+        assert_eq!(cache.fetch(0, &memory).arg2, 5 | 1 << 56);
+
+        // Instructions outside the range stay cached: without invalidation, the old instruction is still returned
+        memory.set_bytes(11, &[ByteCodes::DEC_REG as u8]);
+        assert!(matches!(cache.fetch(11, &memory).opcode, ByteCodes::INC_REG));
+
+        cache.invalidate(11, 12);
+        assert!(matches!(cache.fetch(11, &memory).opcode, ByteCodes::DEC_REG));
+        assert!(matches!(cache.fetch(13, &memory).opcode, ByteCodes::EXIT));
+    }
+
+
+    #[test]
+    fn test_invalidate_lazy() {
+        let code = program();
+        let mut memory = memory_with(&code);
+
+        // Nothing is decoded ahead of time, so the instructions are decoded when they're first fetched
+        let mut cache = InstructionCache::new();
+        cache.prepare(code.len());
+
+        memory.set_bytes(11, &[ByteCodes::DEC_REG as u8]);
+        memory.take_code_writes();
+        assert!(matches!(cache.fetch(11, &memory).opcode, ByteCodes::DEC_REG));
+
+        // Replace the decrement and the exit with an exit and a decrement
+        write_code(&mut cache, &mut memory, 11, &[ByteCodes::EXIT as u8, ByteCodes::DEC_REG as u8, R1]);
+        assert!(matches!(cache.fetch(11, &memory).opcode, ByteCodes::EXIT));
+        assert!(matches!(cache.fetch(12, &memory).opcode, ByteCodes::DEC_REG));
+    }
+
+}
@@ -0,0 +1,843 @@
+//! Baseline just-in-time compiler for hot code.
+//!
+//! Basic blocks are compiled to native code after they have been entered `HOT_BLOCK_THRESHOLD` times.
+//! A compiled block follows the fallthrough path of conditional jumps and loops back natively when it jumps to its own entry point,
+//! so tight loops run without returning to the interpreter.
+//!
+//! Guest registers are kept in the `CPURegisters` array and memory is accessed through the `Memory` base pointer,
+//! so a compiled block can return to the interpreter at any instruction by just setting the program counter.
+//! Unsupported instructions, jumps to other blocks, out-of-bounds accesses and writes to the program image all return to the interpreter.
+//! Only code in the program image is compiled, because writes to the rest of memory aren't tracked and can't invalidate the compiled blocks.
+//!
+//! Native code is only generated on x86-64. On other architectures no block is ever compiled and the program is fully interpreted.
+
+use std::collections::HashMap;
+
+use rusty_vm_lib::byte_code::{is_jump_instruction, ByteCodes};
+use rusty_vm_lib::vm::Address;
+
+use crate::instruction_cache::MAX_INSTRUCTION_SIZE;
+use crate::memory::Memory;
+use crate::register::CPURegisters;
+
+
+/// Number of times a basic block has to be entered before it's compiled
+const HOT_BLOCK_THRESHOLD: u32 = 64;
+
+/// Maximum number of guest instructions compiled into a single block
+const MAX_BLOCK_INSTRUCTIONS: usize = 256;
+
+
+/// Return whether the instruction ends a basic block
+pub fn ends_basic_block(opcode: ByteCodes) -> bool {
+    is_jump_instruction(opcode)
+        || opcode.operand_layout().target
+        || matches!(opcode, ByteCodes::POP_INTO_REG_RETURN | ByteCodes::EXIT)
+}
+
+
+/// Signature of a compiled block: registers, memory base, memory size, program image size.
+///
+/// The block sets the program counter to the next instruction to execute before returning
+type NativeBlock = unsafe extern "sysv64" fn(*mut u64, *mut u8, usize, usize);
+
+
+struct CompiledBlock {
+
+    code: ExecutableBuffer,
+    /// Address range of the guest code the block was compiled from
+    guest_start: Address,
+    guest_end: Address,
+
+}
+
+
+enum BlockState {
+
+    /// The block is not hot yet. Stores the number of times it was entered
+    Counting(u32),
+    Compiled(CompiledBlock),
+    /// The block starts with an instruction that cannot be compiled
+    Uncompilable,
+
+}
+
+
+/// Translation cache from guest block addresses to native code
+pub struct Jit {
+
+    blocks: HashMap<Address, BlockState>,
+
+}
+
+
+impl Jit {
+
+    pub fn new() -> Self {
+        Self {
+            blocks: HashMap::new(),
+        }
+    }
+
+
+    /// Count an entry into the block at `address` and execute its native code if it's compiled.
+    ///
+    /// Return whether the block was run as native code. If not, the block must be interpreted.
+    /// This includes the case where the native code returned at the entry point, because its first instruction must be left to the interpreter
+    pub fn try_execute(&mut self, address: Address, registers: &mut CPURegisters, memory: &mut Memory) -> bool {
+
+        if address >= memory.get_code_size() {
+            return false;
+        }
+
+        let state = self.blocks.entry(address).or_insert(BlockState::Counting(0));
+
+        if let BlockState::Counting(count) = state {
+            *count += 1;
+            if *count < HOT_BLOCK_THRESHOLD {
+                return false;
+            }
+
+            *state = match compile_block(address, memory) {
+                Some(block) => BlockState::Compiled(block),
+                None => BlockState::Uncompilable,
+            };
+        }
+
+        let BlockState::Compiled(block) = state else {
+            return false;
+        };
+
+        let code_size = memory.get_code_size();
+        let memory_size = memory.get_stack_base();
+
+        unsafe {
+            let native: NativeBlock = std::mem::transmute(block.code.ptr);
+            native(registers.as_mut_ptr(), memory.as_mut_ptr(), memory_size, code_size);
+        }
+
+        // Entering the block again would return at the same instruction forever
+        registers.pc() != address
+    }
+
+
+    /// Discard the compiled blocks that were compiled from code in the address range `start..end`.
+    /// Blocks whose first instruction overlaps the range are counted again, since the new instruction may be compilable
+    pub fn invalidate(&mut self, start: Address, end: Address) {
+        self.blocks.retain(|&entry, state| match state {
+            BlockState::Compiled(block) => block.guest_end <= start || block.guest_start >= end,
+            _ => entry + MAX_INSTRUCTION_SIZE <= start || entry >= end
+        });
+    }
+
+}
+
+
+/// Memory pages holding native code
+struct ExecutableBuffer {
+
+    ptr: *mut u8,
+    size: usize,
+
+}
+
+
+// The pages are owned by the buffer and never written after they're made executable
+unsafe impl Send for ExecutableBuffer {}
+
+
+impl ExecutableBuffer {
+
+    /// Copy the machine code into newly mapped executable memory
+    fn new(code: &[u8]) -> Option<Self> {
+        let size = code.len();
+
+        unsafe {
+            let ptr = libc::mmap(
+                std::ptr::null_mut(),
+                size,
+                libc::PROT_READ | libc::PROT_WRITE,
+                libc::MAP_PRIVATE | libc::MAP_ANONYMOUS,
+                -1,
+                0
+            );
+            if ptr == libc::MAP_FAILED {
+                return None;
+            }
+
+            std::ptr::copy_nonoverlapping(code.as_ptr(), ptr as *mut u8, size);
+
+            if libc::mprotect(ptr, size, libc::PROT_READ | libc::PROT_EXEC) != 0 {
+                libc::munmap(ptr, size);
+                return None;
+            }
+
+            Some(Self {
+                ptr: ptr as *mut u8,
+                size,
+            })
+        }
+    }
+
+}
+
+
+impl Drop for ExecutableBuffer {
+
+    fn drop(&mut self) {
+        unsafe {
+            libc::munmap(self.ptr as *mut libc::c_void, self.size);
+        }
+    }
+
+}
+
+
+#[cfg(not(target_arch = "x86_64"))]
+fn compile_block(_address: Address, _memory: &Memory) -> Option<CompiledBlock> {
+    None
+}
+
+
+#[cfg(target_arch = "x86_64")]
+fn compile_block(address: Address, memory: &Memory) -> Option<CompiledBlock> {
+    x86_64::compile_block(address, memory)
+}
+
+
+#[cfg(target_arch = "x86_64")]
+mod x86_64 {
+
+    use std::collections::HashMap;
+
+    use rusty_vm_lib::byte_code::{ByteCodes, JumpCondition};
+    use rusty_vm_lib::registers::Registers;
+    use rusty_vm_lib::vm::Address;
+
+    use crate::instruction_cache::{decode, DecodedInstruction};
+    use crate::memory::Memory;
+
+    use super::{CompiledBlock, ExecutableBuffer, MAX_BLOCK_INSTRUCTIONS};
+
+
+    // Host registers. The arguments of the native block stay in their System V registers
+    const RAX: u8 = 0;
+    const RCX: u8 = 1;
+    const RDX: u8 = 2;
+    const RSI: u8 = 6;
+    const RDI: u8 = 7;
+    const R9: u8 = 9;
+    const R10: u8 = 10;
+    const R11: u8 = 11;
+
+    /// Pointer to the guest register array
+    const GUEST_REGISTERS: u8 = RDI;
+    /// Pointer to the guest memory
+    const MEMORY_BASE: u8 = RSI;
+    const MEMORY_SIZE: u8 = RDX;
+    const CODE_SIZE: u8 = RCX;
+
+    // Condition codes
+    const CC_BELOW: u8 = 0x2;
+    const CC_EQUAL: u8 = 0x4;
+    const CC_NOT_EQUAL: u8 = 0x5;
+    const CC_ABOVE: u8 = 0x7;
+
+    // Arithmetic opcodes in the `op r/m64, r64` form and their `/digit` in the `op r/m64, imm32` form
+    const ADD: (u8, u8) = (0x01, 0);
+    const OR: (u8, u8) = (0x09, 1);
+    const AND: (u8, u8) = (0x21, 4);
+    const SUB: (u8, u8) = (0x29, 5);
+    const XOR: (u8, u8) = (0x31, 6);
+    const CMP: (u8, u8) = (0x39, 7);
+
+
+    /// The target of a native jump
+    #[derive(Clone, Copy)]
+    enum JumpTarget {
+        /// The start of the block
+        BlockStart,
+        /// Return to the interpreter at the given guest address
+        Exit(Address),
+    }
+
+
+    /// How a flag is computed from the result of an operation
+    #[derive(Clone, Copy)]
+    enum FlagValue {
+        /// The carry computed into R9
+        Carry,
+        /// The carry xor the sign of the result
+        CarryXorSign,
+        Constant(i32),
+    }
+
+
+    struct Assembler {
+
+        code: Vec<u8>,
+        /// Positions of the rel32 displacements that jump to an exit
+        exits: Vec<(usize, Address)>,
+
+    }
+
+
+    impl Assembler {
+
+        fn new() -> Self {
+            Self {
+                code: Vec::new(),
+                exits: Vec::new(),
+            }
+        }
+
+
+        fn rex(&mut self, wide: bool, reg: u8, index: u8, base: u8) {
+            self.code.push(0x40 | (wide as u8) << 3 | (reg >> 3) << 2 | (index >> 3) << 1 | base >> 3);
+        }
+
+
+        fn modrm(&mut self, mode: u8, reg: u8, rm: u8) {
+            self.code.push(mode << 6 | (reg & 7) << 3 | (rm & 7));
+        }
+
+
+        fn imm32(&mut self, value: i32) {
+            self.code.extend(value.to_le_bytes());
+        }
+
+
+        /// Encode a `[GUEST_REGISTERS + disp32]` operand referring to the given guest register
+        fn guest_register_operand(&mut self, reg: u8, guest: Registers) {
+            self.modrm(0b10, reg, GUEST_REGISTERS);
+            self.imm32(guest as i32 * 8);
+        }
+
+
+        /// Encode a `[MEMORY_BASE + index]` operand
+        fn memory_operand(&mut self, reg: u8, index: u8) {
+            self.modrm(0b00, reg, 0b100);
+            self.code.push((index & 7) << 3 | (MEMORY_BASE & 7));
+        }
+
+
+        /// mov dest, guest
+        fn load_guest(&mut self, dest: u8, guest: Registers) {
+            self.rex(true, dest, 0, GUEST_REGISTERS);
+            self.code.push(0x8B);
+            self.guest_register_operand(dest, guest);
+        }
+
+
+        /// mov guest, src
+        fn store_guest(&mut self, guest: Registers, src: u8) {
+            self.rex(true, src, 0, GUEST_REGISTERS);
+            self.code.push(0x89);
+            self.guest_register_operand(src, guest);
+        }
+
+
+        /// mov guest, imm32 (sign-extended)
+        fn store_guest_imm(&mut self, guest: Registers, value: i32) {
+            self.rex(true, 0, 0, GUEST_REGISTERS);
+            self.code.push(0xC7);
+            self.guest_register_operand(0, guest);
+            self.imm32(value);
+        }
+
+
+        /// cmp guest, imm8 (sign-extended)
+        fn compare_guest_imm(&mut self, guest: Registers, value: i8) {
+            self.rex(true, 0, 0, GUEST_REGISTERS);
+            self.code.push(0x83);
+            self.guest_register_operand(7, guest);
+            self.code.push(value as u8);
+        }
+
+
+        /// cmp reg, guest
+        fn compare_with_guest(&mut self, reg: u8, guest: Registers) {
+            self.rex(true, reg, 0, GUEST_REGISTERS);
+            self.code.push(0x3B);
+            self.guest_register_operand(reg, guest);
+        }
+
+
+        /// mov dest, imm64
+        fn mov_imm64(&mut self, dest: u8, value: u64) {
+            self.rex(true, 0, 0, dest);
+            self.code.push(0xB8 + (dest & 7));
+            self.code.extend(value.to_le_bytes());
+        }
+
+
+        /// op dest, src
+        fn alu(&mut self, op: (u8, u8), dest: u8, src: u8) {
+            self.rex(true, src, 0, dest);
+            self.code.push(op.0);
+            self.modrm(0b11, src, dest);
+        }
+
+
+        /// op dest, imm32 (sign-extended)
+        fn alu_imm(&mut self, op: (u8, u8), dest: u8, value: i32) {
+            self.rex(true, 0, 0, dest);
+            self.code.push(0x81);
+            self.modrm(0b11, op.1, dest);
+            self.imm32(value);
+        }
+
+
+        /// mov dest, src
+        fn mov(&mut self, dest: u8, src: u8) {
+            self.rex(true, src, 0, dest);
+            self.code.push(0x89);
+            self.modrm(0b11, src, dest);
+        }
+
+
+        /// test reg, reg
+        fn test(&mut self, reg: u8) {
+            self.rex(true, reg, 0, reg);
+            self.code.push(0x85);
+            self.modrm(0b11, reg, reg);
+        }
+
+
+        /// setcc dest8
+        fn set_condition(&mut self, condition_code: u8, dest: u8) {
+            self.rex(false, 0, 0, dest);
+            self.code.extend([0x0F, 0x90 + condition_code]);
+            self.modrm(0b11, 0, dest);
+        }
+
+
+        /// shr reg, imm8
+        fn shift_right(&mut self, reg: u8, amount: u8) {
+            self.rex(true, 0, 0, reg);
+            self.code.push(0xC1);
+            self.modrm(0b11, 5, reg);
+            self.code.push(amount);
+        }
+
+
+        /// Zero-extending load of `size` bytes from `[MEMORY_BASE + address]`
+        fn load_memory(&mut self, dest: u8, address: u8, size: u8) {
+            match size {
+                1 => { self.rex(false, dest, address, MEMORY_BASE); self.code.extend([0x0F, 0xB6]); },
+                2 => { self.rex(false, dest, address, MEMORY_BASE); self.code.extend([0x0F, 0xB7]); },
+                4 => { self.rex(false, dest, address, MEMORY_BASE); self.code.push(0x8B); },
+                8 => { self.rex(true, dest, address, MEMORY_BASE); self.code.push(0x8B); },
+                _ => unreachable!()
+            }
+            self.memory_operand(dest, address);
+        }
+
+
+        /// Store the low `size` bytes of `src` into `[MEMORY_BASE + address]`
+        fn store_memory(&mut self, address: u8, src: u8, size: u8) {
+            match size {
+                1 => { self.rex(false, src, address, MEMORY_BASE); self.code.push(0x88); },
+                2 => { self.code.push(0x66); self.rex(false, src, address, MEMORY_BASE); self.code.push(0x89); },
+                4 => { self.rex(false, src, address, MEMORY_BASE); self.code.push(0x89); },
+                8 => { self.rex(true, src, address, MEMORY_BASE); self.code.push(0x89); },
+                _ => unreachable!()
+            }
+            self.memory_operand(src, address);
+        }
+
+
+        /// jcc or jmp (if `condition_code` is `None`) to the target
+        fn jump(&mut self, condition_code: Option<u8>, target: JumpTarget) {
+            match condition_code {
+                Some(condition_code) => self.code.extend([0x0F, 0x80 + condition_code]),
+                None => self.code.push(0xE9),
+            }
+
+            match target {
+                JumpTarget::BlockStart => {
+                    let displacement = -(self.code.len() as i32 + 4);
+                    self.imm32(displacement);
+                },
+                JumpTarget::Exit(address) => {
+                    self.exits.push((self.code.len(), address));
+                    self.imm32(0);
+                },
+            }
+        }
+
+
+        /// Check that `size` bytes at the guest address in RAX are inside memory, and optionally outside the program image.
+        /// Otherwise, return to the interpreter at the current instruction, which will handle the access
+        fn check_access(&mut self, size: u8, is_write: bool, current: Address) {
+            // R11 = address + size, exit on overflow or if it is past the end of memory
+            self.mov(R11, RAX);
+            self.alu_imm(ADD, R11, size as i32);
+            self.jump(Some(CC_BELOW), JumpTarget::Exit(current));
+            self.alu(CMP, R11, MEMORY_SIZE);
+            self.jump(Some(CC_ABOVE), JumpTarget::Exit(current));
+
+            if is_write {
+                // Writes to the program image must invalidate the decoded code, so they are left to the interpreter
+                self.alu(CMP, RAX, CODE_SIZE);
+                self.jump(Some(CC_BELOW), JumpTarget::Exit(current));
+            }
+        }
+
+
+        /// Set the arithmetical flags from the result in RAX
+        fn set_flags(&mut self, carry: FlagValue, overflow: FlagValue) {
+            self.alu(XOR, R11, R11);
+            self.test(RAX);
+            self.set_condition(CC_EQUAL, R11);
+            self.store_guest(Registers::ZERO_FLAG, R11);
+
+            self.mov(R11, RAX);
+            self.shift_right(R11, 63);
+            self.store_guest(Registers::SIGN_FLAG, R11);
+
+            self.store_guest_imm(Registers::REMAINDER_FLAG, 0);
+
+            match carry {
+                FlagValue::Carry => self.store_guest(Registers::CARRY_FLAG, R9),
+                FlagValue::Constant(value) => self.store_guest_imm(Registers::CARRY_FLAG, value),
+                FlagValue::CarryXorSign => unreachable!(),
+            }
+
+            match overflow {
+                FlagValue::CarryXorSign => {
+                    // R11 still holds the sign
+                    self.alu(XOR, R11, R9);
+                    self.store_guest(Registers::OVERFLOW_FLAG, R11);
+                },
+                FlagValue::Constant(value) => self.store_guest_imm(Registers::OVERFLOW_FLAG, value),
+                FlagValue::Carry => unreachable!(),
+            }
+        }
+
+
+        /// Jump to the target if the condition holds for the guest flags, with the same semantics as the interpreter
+        fn jump_if(&mut self, condition: JumpCondition, target: JumpTarget) {
+            match condition {
+                JumpCondition::NotZero => { self.compare_guest_imm(Registers::ZERO_FLAG, 0); self.jump(Some(CC_EQUAL), target); },
+                JumpCondition::Zero => { self.compare_guest_imm(Registers::ZERO_FLAG, 1); self.jump(Some(CC_EQUAL), target); },
+                JumpCondition::Carry => { self.compare_guest_imm(Registers::CARRY_FLAG, 1); self.jump(Some(CC_EQUAL), target); },
+                JumpCondition::NotCarry => { self.compare_guest_imm(Registers::CARRY_FLAG, 0); self.jump(Some(CC_EQUAL), target); },
+                JumpCondition::Overflow => { self.compare_guest_imm(Registers::OVERFLOW_FLAG, 1); self.jump(Some(CC_EQUAL), target); },
+                JumpCondition::NotOverflow => { self.compare_guest_imm(Registers::OVERFLOW_FLAG, 0); self.jump(Some(CC_EQUAL), target); },
+                JumpCondition::Sign => { self.compare_guest_imm(Registers::SIGN_FLAG, 1); self.jump(Some(CC_EQUAL), target); },
+                JumpCondition::NotSign => { self.compare_guest_imm(Registers::SIGN_FLAG, 0); self.jump(Some(CC_EQUAL), target); },
+
+                JumpCondition::Less => {
+                    self.load_guest(RAX, Registers::SIGN_FLAG);
+                    self.compare_with_guest(RAX, Registers::OVERFLOW_FLAG);
+                    self.jump(Some(CC_NOT_EQUAL), target);
+                },
+                JumpCondition::GreaterOrEqual => {
+                    self.load_guest(RAX, Registers::SIGN_FLAG);
+                    self.compare_with_guest(RAX, Registers::OVERFLOW_FLAG);
+                    self.jump(Some(CC_EQUAL), target);
+                },
+                JumpCondition::LessOrEqual => {
+                    self.load_guest(RAX, Registers::SIGN_FLAG);
+                    self.compare_with_guest(RAX, Registers::OVERFLOW_FLAG);
+                    self.jump(Some(CC_NOT_EQUAL), target);
+                    self.compare_guest_imm(Registers::ZERO_FLAG, 1);
+                    self.jump(Some(CC_EQUAL), target);
+                },
+                JumpCondition::Greater => {
+                    self.load_guest(RAX, Registers::SIGN_FLAG);
+                    self.compare_with_guest(RAX, Registers::OVERFLOW_FLAG);
+                    // Skip the zero flag check and the jump if the sign and overflow differ
+                    self.code.extend([0x70 + CC_NOT_EQUAL, 0]);
+                    let skip = self.code.len();
+                    self.compare_guest_imm(Registers::ZERO_FLAG, 0);
+                    self.jump(Some(CC_EQUAL), target);
+                    self.code[skip - 1] = (self.code.len() - skip) as u8;
+                },
+            }
+        }
+
+
+        /// Emit the exit stubs and resolve the jumps to them
+        fn finish(mut self) -> Vec<u8> {
+            let mut stubs: HashMap<Address, usize> = HashMap::new();
+
+            for (position, address) in std::mem::take(&mut self.exits) {
+                let stub = *stubs.entry(address).or_insert_with(|| {
+                    let stub = self.code.len();
+                    self.mov_imm64(RAX, address as u64);
+                    self.store_guest(Registers::PROGRAM_COUNTER, RAX);
+                    self.code.push(0xC3);
+                    stub
+                });
+
+                let displacement = stub as i32 - (position as i32 + 4);
+                self.code[position..position + 4].copy_from_slice(&displacement.to_le_bytes());
+            }
+
+            self.code
+        }
+
+    }
+
+
+    /// Return the target of a guest jump from inside the block
+    fn jump_target(entry: Address, address: Address) -> JumpTarget {
+        if address == entry {
+            JumpTarget::BlockStart
+        } else {
+            JumpTarget::Exit(address)
+        }
+    }
+
+
+    /// Return whether the instruction can be compiled
+    fn is_supported(instruction: &DecodedInstruction) -> bool {
+        use ByteCodes::*;
+
+        let uses_pc = |reg: Registers| matches!(reg, Registers::PROGRAM_COUNTER);
+        let valid_size = matches!(instruction.handled_size, 1 | 2 | 4 | 8);
+
+        match instruction.opcode.generic_variant() {
+
+            NO_OPERATION |
+            INTEGER_ADD |
+            INTEGER_SUB |
+            AND |
+            OR |
+            XOR |
+            JUMP |
+            JUMP_NOT_ZERO |
+            JUMP_ZERO |
+            JUMP_GREATER |
+            JUMP_LESS |
+            JUMP_GREATER_OR_EQUAL |
+            JUMP_LESS_OR_EQUAL |
+            JUMP_CARRY |
+            JUMP_NOT_CARRY |
+            JUMP_OVERFLOW |
+            JUMP_NOT_OVERFLOW |
+            JUMP_SIGN |
+            JUMP_NOT_SIGN
+                => true,
+
+            INC_REG |
+            DEC_REG |
+            MOVE_INTO_REG_FROM_CONST
+                => !uses_pc(instruction.reg1),
+
+            MOVE_INTO_REG_FROM_REG |
+            COMPARE_REG_REG |
+            COMPARE_JUMP_REG_REG
+                => !uses_pc(instruction.reg1) && !uses_pc(instruction.reg2),
+
+            COMPARE_REG_CONST |
+            COMPARE_JUMP_REG_CONST
+                => !uses_pc(instruction.reg1),
+
+            MOVE_INTO_ADDR_IN_REG_FROM_CONST |
+            COMPARE_ADDR_IN_REG_CONST |
+            COMPARE_JUMP_ADDR_IN_REG_CONST
+                => valid_size && !uses_pc(instruction.reg1),
+
+            MOVE_INTO_REG_FROM_ADDR_IN_REG |
+            MOVE_INTO_ADDR_IN_REG_FROM_REG |
+            COMPARE_ADDR_IN_REG_REG |
+            COMPARE_JUMP_ADDR_IN_REG_REG
+                => valid_size && !uses_pc(instruction.reg1) && !uses_pc(instruction.reg2),
+
+            _ => false
+        }
+    }
+
+
+    /// Load the value of the left operand of a compare instruction into RAX and the right operand into R10
+    fn compile_compare_operands(asm: &mut Assembler, instruction: &DecodedInstruction, address: Address) {
+        use ByteCodes::*;
+
+        match instruction.opcode {
+
+            COMPARE_REG_REG | COMPARE_JUMP_REG_REG => {
+                asm.load_guest(RAX, instruction.reg1);
+                asm.load_guest(R10, instruction.reg2);
+            },
+
+            COMPARE_REG_CONST | COMPARE_JUMP_REG_CONST => {
+                asm.load_guest(RAX, instruction.reg1);
+                asm.mov_imm64(R10, instruction.arg2);
+            },
+
+            COMPARE_ADDR_IN_REG_REG | COMPARE_JUMP_ADDR_IN_REG_REG => {
+                asm.load_guest(RAX, instruction.reg1);
+                asm.check_access(instruction.handled_size, false, address);
+                asm.load_memory(RAX, RAX, instruction.handled_size);
+                asm.load_guest(R10, instruction.reg2);
+            },
+
+            COMPARE_ADDR_IN_REG_CONST | COMPARE_JUMP_ADDR_IN_REG_CONST => {
+                asm.load_guest(RAX, instruction.reg1);
+                asm.check_access(instruction.handled_size, false, address);
+                asm.load_memory(RAX, RAX, instruction.handled_size);
+                asm.mov_imm64(R10, instruction.arg2);
+            },
+
+            _ => unreachable!()
+        }
+    }
+
+
+    /// Compile the guest code starting at `entry` until the first unsupported instruction or unconditional jump.
+    /// The block ends at the end of the program image
+    pub fn compile_block(entry: Address, memory: &Memory) -> Option<CompiledBlock> {
+
+        let code = &memory.get_raw()[..memory.get_code_size()];
+        if entry >= code.len() {
+            return None;
+        }
+
+        let mut asm = Assembler::new();
+        let mut address = entry;
+        let mut compiled_instructions = 0;
+
+        loop {
+
+            let instruction = match code.get(address..).and_then(decode) {
+                Some(instruction) if is_supported(&instruction) && compiled_instructions < MAX_BLOCK_INSTRUCTIONS => instruction,
+                _ => {
+                    // Let the interpreter execute this instruction
+                    asm.jump(None, JumpTarget::Exit(address));
+                    break;
+                }
+            };
+
+            compiled_instructions += 1;
+            let next_address = address + instruction.size as usize;
+
+            match instruction.opcode.generic_variant() {
+
+                ByteCodes::NO_OPERATION => {},
+
+                ByteCodes::INTEGER_ADD | ByteCodes::INTEGER_SUB => {
+                    asm.load_guest(RAX, Registers::R1);
+                    asm.load_guest(R10, Registers::R2);
+                    asm.alu(XOR, R9, R9);
+                    asm.alu(if matches!(instruction.opcode, ByteCodes::INTEGER_ADD) { ADD } else { SUB }, RAX, R10);
+                    asm.set_condition(CC_BELOW, R9);
+                    asm.store_guest(Registers::R1, RAX);
+                    asm.set_flags(FlagValue::Carry, FlagValue::CarryXorSign);
+                },
+
+                ByteCodes::AND | ByteCodes::OR | ByteCodes::XOR => {
+                    let (op, overflow) = match instruction.opcode {
+                        ByteCodes::AND => (AND, 0),
+                        ByteCodes::OR => (OR, 0),
+                        _ => (XOR, 1)
+                    };
+                    asm.load_guest(RAX, Registers::R1);
+                    asm.load_guest(R10, Registers::R2);
+                    asm.alu(op, RAX, R10);
+                    asm.store_guest(Registers::R1, RAX);
+                    asm.set_flags(FlagValue::Constant(0), FlagValue::Constant(overflow));
+                },
+
+                ByteCodes::INC_REG => {
+                    // The interpreter saturates instead of wrapping around on overflow
+                    asm.load_guest(RAX, instruction.reg1);
+                    asm.alu(XOR, R9, R9);
+                    asm.alu_imm(CMP, RAX, -1);
+                    asm.set_condition(CC_EQUAL, R9);
+                    asm.alu_imm(ADD, RAX, 1);
+                    asm.alu(SUB, RAX, R9);
+                    asm.store_guest(instruction.reg1, RAX);
+                    asm.set_flags(FlagValue::Carry, FlagValue::CarryXorSign);
+                },
+
+                ByteCodes::DEC_REG => {
+                    asm.load_guest(RAX, instruction.reg1);
+                    asm.alu(XOR, R9, R9);
+                    asm.alu_imm(SUB, RAX, 1);
+                    asm.set_condition(CC_BELOW, R9);
+                    asm.store_guest(instruction.reg1, RAX);
+                    asm.set_flags(FlagValue::Carry, FlagValue::CarryXorSign);
+                },
+
+                ByteCodes::MOVE_INTO_REG_FROM_REG => {
+                    asm.load_guest(RAX, instruction.reg2);
+                    asm.store_guest(instruction.reg1, RAX);
+                },
+
+                ByteCodes::MOVE_INTO_REG_FROM_CONST => {
+                    asm.mov_imm64(RAX, instruction.arg2);
+                    asm.store_guest(instruction.reg1, RAX);
+                },
+
+                ByteCodes::MOVE_INTO_REG_FROM_ADDR_IN_REG => {
+                    asm.load_guest(RAX, instruction.reg2);
+                    asm.check_access(instruction.handled_size, false, address);
+                    asm.load_memory(R10, RAX, instruction.handled_size);
+                    asm.store_guest(instruction.reg1, R10);
+                },
+
+                ByteCodes::MOVE_INTO_ADDR_IN_REG_FROM_REG => {
+                    asm.load_guest(RAX, instruction.reg1);
+                    asm.check_access(instruction.handled_size, true, address);
+                    asm.load_guest(R10, instruction.reg2);
+                    asm.store_memory(RAX, R10, instruction.handled_size);
+                },
+
+                ByteCodes::MOVE_INTO_ADDR_IN_REG_FROM_CONST => {
+                    asm.load_guest(RAX, instruction.reg1);
+                    asm.check_access(instruction.handled_size, true, address);
+                    asm.mov_imm64(R10, instruction.arg2);
+                    asm.store_memory(RAX, R10, instruction.handled_size);
+                },
+
+                ByteCodes::COMPARE_REG_REG |
+                ByteCodes::COMPARE_REG_CONST |
+                ByteCodes::COMPARE_ADDR_IN_REG_REG |
+                ByteCodes::COMPARE_ADDR_IN_REG_CONST => {
+                    compile_compare_operands(&mut asm, &instruction, address);
+                    asm.alu(SUB, RAX, R10);
+                    asm.set_flags(FlagValue::Constant(0), FlagValue::Constant(0));
+                },
+
+                ByteCodes::COMPARE_JUMP_REG_REG |
+                ByteCodes::COMPARE_JUMP_REG_CONST |
+                ByteCodes::COMPARE_JUMP_ADDR_IN_REG_REG |
+                ByteCodes::COMPARE_JUMP_ADDR_IN_REG_CONST => {
+                    compile_compare_operands(&mut asm, &instruction, address);
+                    asm.alu(SUB, RAX, R10);
+                    asm.set_flags(FlagValue::Constant(0), FlagValue::Constant(0));
+                    asm.jump_if(instruction.condition, jump_target(entry, instruction.target));
+                },
+
+                ByteCodes::JUMP => {
+                    asm.jump(None, jump_target(entry, instruction.arg1 as Address));
+                    address = next_address;
+                    break;
+                },
+
+                opcode => {
+                    let condition = JumpCondition::from_jump(opcode).unwrap();
+                    asm.jump_if(condition, jump_target(entry, instruction.arg1 as Address));
+                },
+            }
+
+            address = next_address;
+        }
+
+        if compiled_instructions == 0 {
+            return None;
+        }
+
+        let code = asm.finish();
+
+        Some(CompiledBlock {
+            code: ExecutableBuffer::new(&code)?,
+            guest_start: entry,
+            guest_end: address,
+        })
+    }
+
+}
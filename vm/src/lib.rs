@@ -0,0 +1,34 @@
+//! The Rusty VM as a library.
+//!
+//! A `Processor` is built from a `ProcessorConfig` and loaded with a bytecode program.
+//! `Processor::run_for` runs the program for an instruction budget or until it exits, without ever terminating the host process,
+//! and `Processor::reset` makes the processor ready for another program without reallocating its memory.
+//! `WorkerPool` runs many processors in parallel, interleaving them in instruction quanta.
+//! A guest program can also spawn its own threads, which share its memory and modules.
+
+pub mod processor;
+pub mod cli_parser;
+pub mod error;
+pub mod files;
+pub mod pool;
+pub mod profiler;
+pub mod tracer;
+pub mod snapshot;
+mod memory;
+mod storage;
+mod terminal;
+mod register;
+mod modules;
+mod host_fs;
+mod instruction_cache;
+mod jit;
+mod allocator;
+mod output;
+mod threads;
+mod events;
+mod perf_counters;
+#[cfg(test)]
+mod test_utils;
+
+pub use processor::{ExitStatus, Processor, ProcessorConfig, RunState};
+pub use pool::WorkerPool;
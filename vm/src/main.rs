@@ -1,52 +1,120 @@
-mod processor;
-mod memory;
-mod files;
-mod cli_parser;
-mod error;
-mod storage;
-mod terminal;
-mod register;
-mod modules;
-mod host_fs;
-
 use std::path::Path;
 
 use clap::Parser;
 
-use cli_parser::CliParser;
-use processor::StorageOptions;
+use vm::cli_parser::{CliParser, ExecutionMode};
+use vm::processor::{Processor, ProcessorConfig, StorageOptions};
+use vm::profiler::ProfileOptions;
+use vm::snapshot::{Snapshot, SnapshotOptions};
+use vm::tracer::TraceOptions;
+use vm::{error, files};
+use rusty_vm_lib::executable::{Executable, EXECUTABLE_MAGIC};
+use rusty_vm_lib::symbols;
 
 
 fn main() {
  
     let args = CliParser::parse();
 
-    let main_path = Path::new(&args.input_file).canonicalize().unwrap_or_else(
-        |err| error::io_error(&args.input_file, &err, format!("Failed to canonicalize path \"{}\"", args.input_file.display()).as_str())
+    let input_path = args.restore.as_ref().or(args.input_file.as_ref()).unwrap();
+
+    let main_path = Path::new(input_path).canonicalize().unwrap_or_else(
+        |err| error::io_error(input_path, &err, format!("Failed to canonicalize path \"{}\"", input_path.display()).as_str())
     );
 
-    if let Some(extension) = main_path.extension() {
-        if extension != "bc" {
-            error::warn("The input file extension is not \".bc\".");
-        }
-    }
+    let snapshot = args.restore.as_ref().map(|path| Snapshot::load(path));
 
-    let byte_code = files::load_byte_code(&args.input_file);
-
-    let mut processor = processor::Processor::new(
-        args.max_memory_size,
-        args.quiet,
-        if let Some(storage_file) = args.storage_file {
-            Some(StorageOptions::new(
-                storage_file,
-                if args.max_storage_size == 0 { None } else { Some(args.max_storage_size) }
-            ))
-        } else {
-            None
+    let byte_code = if snapshot.is_none() {
+        if let Some(extension) = main_path.extension() {
+            if extension != "bc" {
+                error::warn("The input file extension is not \".bc\".");
+            }
         }
-    );
+        let byte_code = files::load_byte_code(input_path);
+        if args.verify && byte_code.bytes().starts_with(EXECUTABLE_MAGIC) {
+            Executable::verify(byte_code.bytes()).unwrap_or_else(|message| error::error(&message));
+        }
+        Some(byte_code)
+    } else {
+        None
+    };
 
-    processor.execute(&byte_code, args.mode);
+    let profile = if args.mode == ExecutionMode::Profile {
 
-}
+        let symbols = match &args.symbols_file {
+            Some(symbols_file) => symbols::load_symbols(symbols_file).unwrap_or_else(
+                |err| error::io_error(symbols_file, &err, format!("Failed to load symbols from \"{}\"", symbols_file.display()).as_str())
+            ),
+            // The symbols embedded in the executable always match its code, unlike a symbol file that may be stale
+            None => if let Some(embedded) = byte_code.as_ref().and_then(|byte_code| Executable::load(byte_code.bytes()).ok()?.symbols()) {
+                symbols::parse_symbols(embedded).unwrap_or_else(
+                    |err| error::io_error(input_path, &err, "Failed to load the symbols embedded in the executable")
+                )
+            } else {
+                let symbols_file = symbols::symbol_file_path(&main_path);
+                if symbols_file.exists() {
+                    symbols::load_symbols(&symbols_file).unwrap_or_else(
+                        |err| error::io_error(&symbols_file, &err, format!("Failed to load symbols from \"{}\"", symbols_file.display()).as_str())
+                    )
+                } else {
+                    error::warn("No symbol file found, functions will be shown as addresses. Assemble the program with --symbols to generate it.");
+                    symbols::SymbolTable::new()
+                }
+            }
+        };
+
+        Some(ProfileOptions::new(
+            symbols,
+            args.folded_stacks_file.clone().unwrap_or_else(|| main_path.with_extension("folded"))
+        ))
 
+    } else {
+        None
+    };
+
+    let trace = if args.mode == ExecutionMode::Trace {
+        Some(TraceOptions {
+            file_path: args.trace_file.clone().unwrap_or_else(|| main_path.with_extension("trace")),
+            pc_range: args.trace_range,
+            max_size: if args.max_trace_size == 0 { None } else { Some(args.max_trace_size) },
+            registers: args.trace_registers,
+            memory: args.trace_memory,
+        })
+    } else {
+        None
+    };
+
+    let snapshot_options = SnapshotOptions {
+        file_path: args.snapshot_file.clone().unwrap_or_else(
+            || if snapshot.is_some() { main_path.clone() } else { main_path.with_extension("img") }
+        ),
+        at_pc: args.snapshot_at,
+    };
+
+    let storage = if let Some(storage_file) = args.storage_file {
+        Some(StorageOptions::new(
+            storage_file,
+            if args.max_storage_size == 0 { None } else { Some(args.max_storage_size) }
+        ))
+    } else {
+        snapshot.as_ref().and_then(|snapshot| snapshot.storage.clone())
+    }.map(|storage| StorageOptions { mapped: storage.mapped || args.map_storage, ..storage });
+
+    let mut processor = Processor::new(ProcessorConfig {
+        max_memory_size: snapshot.as_ref().map_or(args.max_memory_size, |snapshot| snapshot.memory_size),
+        quiet_exit: args.quiet,
+        stdout_buffering: args.stdout_buffering,
+        capture_output: false,
+        storage,
+        profile,
+        trace,
+        snapshot: Some(snapshot_options),
+    });
+
+    match (snapshot, byte_code) {
+        (Some(snapshot), _) => processor.resume(snapshot, args.mode),
+        (None, Some(byte_code)) => processor.execute(&byte_code, args.mode),
+        (None, None) => unreachable!("The byte code is loaded when there is no snapshot"),
+    }
+
+}
@@ -1,40 +1,375 @@
+use std::fs::File;
+use std::io;
+use std::os::unix::fs::FileExt;
+use std::os::unix::io::AsRawFd;
+use std::sync::atomic::{AtomicBool, AtomicUsize, Ordering};
+use std::sync::{Arc, OnceLock};
+
 use rusty_vm_lib::vm::Address;
 
+use crate::error;
+use crate::output;
+
 
 pub type Byte = u8;
 
 
-/// Virtual memory module for the VM
+/// Size of the address space reserved when the memory size is unlimited
+const UNLIMITED_MEMORY_SIZE: usize = 1 << 32;
+
+/// Alignment of the start of memory on the host, which is the size of the largest atomic access
+const MEMORY_ALIGNMENT: usize = 8;
+
+/// Maximum number of memories whose guard pages are recognized by the fault handler at the same time
+const MAX_GUARDED_MEMORIES: usize = 64;
+
+
+/// Start addresses of the guard pages of the live memories. Zero marks a free slot
+static GUARD_PAGES: [AtomicUsize; MAX_GUARDED_MEMORIES] = [const { AtomicUsize::new(0) }; MAX_GUARDED_MEMORIES];
+
+/// Whether the program of each guarded memory exits without printing the stack overflow message
+static QUIET_GUARD_PAGES: [AtomicBool; MAX_GUARDED_MEMORIES] = [const { AtomicBool::new(false) }; MAX_GUARDED_MEMORIES];
+
+/// Message to print, unless the memory is quiet, and exit code to use when a guard page is hit
+static STACK_OVERFLOW_EXIT: OnceLock<(Box<[u8]>, i32)> = OnceLock::new();
+
+/// The SIGSEGV action that was installed before the guard page handler
+static PREVIOUS_SEGFAULT_ACTION: OnceLock<libc::sigaction> = OnceLock::new();
+
+
+pub fn page_size() -> usize {
+    unsafe { libc::sysconf(libc::_SC_PAGESIZE) as usize }
+}
+
+
+/// Terminate the program with a stack overflow error if the fault happened in a guard page.
+/// Other faults are handed back to the previous handler
+extern "C" fn handle_segfault(_signal: libc::c_int, info: *mut libc::siginfo_t, _context: *mut libc::c_void) {
+    let address = unsafe { (*info).si_addr() } as usize;
+    let page_size = page_size();
+
+    let guard_slot = GUARD_PAGES.iter().position(|guard| {
+        let start = guard.load(Ordering::Relaxed);
+        start != 0 && (start..start + page_size).contains(&address)
+    });
+
+    if let Some(slot) = guard_slot {
+        if let Some((message, exit_code)) = STACK_OVERFLOW_EXIT.get() {
+            output::flush_from_signal_handler();
+            unsafe {
+                if !QUIET_GUARD_PAGES[slot].load(Ordering::Relaxed) {
+                    libc::write(libc::STDOUT_FILENO, message.as_ptr() as *const libc::c_void, message.len());
+                }
+                libc::_exit(*exit_code);
+            }
+        }
+    }
+
+    // Restore the previous handler. Returning re-executes the faulting instruction, which then reaches it
+    if let Some(previous) = PREVIOUS_SEGFAULT_ACTION.get() {
+        unsafe { libc::sigaction(libc::SIGSEGV, previous, std::ptr::null_mut()); }
+    }
+}
+
+
+/// Make accesses to the guard page after the end of memory terminate the process with the given message and exit code.
+/// The message isn't printed for the memories marked with `set_quiet_stack_overflow`.
+///
+/// This is only suitable for a process that runs a single program, so it's installed when the program is started
+/// and not when a processor is created. The program must check the stack bounds explicitly
+/// while it's embedded or when its memory has no guard page. Only the first call has an effect
+pub fn install_stack_guard_handler(message: String, exit_code: i32) {
+    if STACK_OVERFLOW_EXIT.set((message.into_bytes().into_boxed_slice(), exit_code)).is_err() {
+        return;
+    }
+
+    unsafe {
+        let mut action: libc::sigaction = std::mem::zeroed();
+        action.sa_sigaction = handle_segfault as usize;
+        action.sa_flags = libc::SA_SIGINFO;
+        libc::sigemptyset(&mut action.sa_mask);
+
+        let mut previous: libc::sigaction = std::mem::zeroed();
+        if libc::sigaction(libc::SIGSEGV, &action, &mut previous) != 0 {
+            error::error("Failed to install the stack guard page handler");
+        }
+        PREVIOUS_SEGFAULT_ACTION.set(previous).ok();
+    }
+}
+
+
+/// Whether `install_stack_guard_handler` was called
+#[cfg(test)]
+pub fn is_stack_guard_handler_installed() -> bool {
+    STACK_OVERFLOW_EXIT.get().is_some()
+}
+
+
+/// The host mapping behind a memory. It's unmapped when the last memory that shares it is dropped
+struct Mapping {
+
+    /// Start of the whole mapping, including the padding and the guard page
+    start: *mut libc::c_void,
+    size: usize,
+    /// Slot of the guard page in `GUARD_PAGES`, if any was free
+    guard_slot: Option<usize>,
+
+}
+
+
+// The mapping is only accessed through the memories that share it
+unsafe impl Send for Mapping {}
+unsafe impl Sync for Mapping {}
+
+
+impl Drop for Mapping {
+
+    fn drop(&mut self) {
+        if let Some(slot) = self.guard_slot {
+            QUIET_GUARD_PAGES[slot].store(false, Ordering::Relaxed);
+            GUARD_PAGES[slot].store(0, Ordering::Relaxed);
+        }
+        unsafe {
+            libc::munmap(self.start, self.size);
+        }
+    }
+
+}
+
+
+/// Virtual memory module for the VM.
+/// 
+/// The memory is an anonymous mapping whose pages are only committed by the OS when they are first touched,
+/// so the cost of a VM doesn't depend on its maximum memory size.
+/// The end of the memory, which is the base of the stack, is followed by an inaccessible guard page.
+///
+/// The guest threads of a program access the same mapping through their own `Memory`, created with `share`.
+/// Loads and stores go straight to the mapping, so the threads must synchronize with atomic instructions like a native program
 pub struct Memory {
 
-    memory: Box<[Byte]>,
+    mapping: Arc<Mapping>,
+    /// Start of the guest memory
+    memory: *mut Byte,
+    size: usize,
+    /// Size of the program image at the start of memory. Writes to it are recorded to keep decoded instructions up to date
+    code_size: usize,
+    /// Address range of the program image that was written since the last call to `take_code_writes`
+    code_writes: Option<(Address, Address)>,
+    /// Address ranges written since the last call to `clear_write_log`. Only recorded while tracing memory writes
+    write_log: Option<Vec<(Address, usize)>>,
 
 }
 
 
+// The guest memory is part of the mapping, which the memory keeps alive
+unsafe impl Send for Memory {}
+
+
 impl Memory {
 
+    /// Create a memory of `max_size` bytes. With a size of 0, a large address space is reserved instead
     pub fn new(max_size: usize) -> Memory {
+
+        let size = if max_size == 0 { UNLIMITED_MEMORY_SIZE } else { max_size };
+
+        // The memory is placed so that it ends at a page boundary, right before the guard page.
+        // If the size isn't a multiple of the alignment, the start is aligned instead and a few bytes separate the end from the guard page
+        let page_size = page_size();
+        let memory_pages_size = size.div_ceil(page_size) * page_size;
+        let padding = (memory_pages_size - size) / MEMORY_ALIGNMENT * MEMORY_ALIGNMENT;
+        let mapping_size = memory_pages_size + page_size;
+
+        let mapping = unsafe {
+            libc::mmap(
+                std::ptr::null_mut(),
+                mapping_size,
+                libc::PROT_READ | libc::PROT_WRITE,
+                libc::MAP_PRIVATE | libc::MAP_ANONYMOUS | libc::MAP_NORESERVE,
+                -1,
+                0
+            )
+        };
+        if mapping == libc::MAP_FAILED {
+            error::error(format!("Failed to reserve {} bytes of memory", size).as_str());
+        }
+
+        let guard_page = unsafe { (mapping as *mut Byte).add(memory_pages_size) };
+        if unsafe { libc::mprotect(guard_page as *mut libc::c_void, page_size, libc::PROT_NONE) } != 0 {
+            error::error("Failed to protect the stack guard page");
+        }
+
+        // Accesses past the end of memory only fault if the guard page is right after it
+        let guard_slot = if padding + size == memory_pages_size {
+            GUARD_PAGES.iter().position(|slot| {
+                slot.compare_exchange(0, guard_page as usize, Ordering::Relaxed, Ordering::Relaxed).is_ok()
+            })
+        } else {
+            None
+        };
+
         Memory {
-            memory: vec![0; max_size].into_boxed_slice(),
+            mapping: Arc::new(Mapping {
+                start: mapping,
+                size: mapping_size,
+                guard_slot,
+            }),
+            memory: unsafe { (mapping as *mut Byte).add(padding) },
+            size,
+            code_size: 0,
+            code_writes: None,
+            write_log: None,
+        }
+    }
+
+
+    /// Whether the guard page after the end of memory is recognized by the fault handler.
+    /// Only a limited number of memories can be guarded at the same time, and only if their size is a multiple of `MEMORY_ALIGNMENT`
+    pub fn is_guarded(&self) -> bool {
+        self.mapping.guard_slot.is_some()
+    }
+
+
+    /// Don't print the stack overflow message when the guard page is hit
+    pub fn set_quiet_stack_overflow(&self, quiet: bool) {
+        if let Some(slot) = self.mapping.guard_slot {
+            QUIET_GUARD_PAGES[slot].store(quiet, Ordering::Relaxed);
+        }
+    }
+
+
+    /// Create another memory that accesses the same mapping, for a new guest thread.
+    ///
+    /// Each memory records its own writes to the program image, so the instructions decoded by a thread
+    /// aren't updated when another thread modifies them
+    pub fn share(&self) -> Memory {
+        Memory {
+            mapping: Arc::clone(&self.mapping),
+            memory: self.memory,
+            size: self.size,
+            code_size: self.code_size,
+            code_writes: None,
+            write_log: None,
+        }
+    }
+
+
+    /// Zero the whole memory and give its pages back to the OS so that it can be reused for another program
+    pub fn reset(&mut self) {
+        // Map fresh anonymous pages rather than discarding them, since the memory may be mapped from a snapshot image,
+        // whose discarded pages would be read again from the file
+        let mapping = unsafe {
+            libc::mmap(
+                self.mapping.start,
+                self.image_size(),
+                libc::PROT_READ | libc::PROT_WRITE,
+                libc::MAP_PRIVATE | libc::MAP_ANONYMOUS | libc::MAP_FIXED | libc::MAP_NORESERVE,
+                -1,
+                0
+            )
+        };
+        if mapping == libc::MAP_FAILED {
+            error::error("Failed to reset the memory");
+        }
+        self.code_size = 0;
+        self.code_writes = None;
+        self.write_log = None;
+    }
+
+
+    #[inline(always)]
+    fn as_slice(&self) -> &[Byte] {
+        unsafe { std::slice::from_raw_parts(self.memory, self.size) }
+    }
+
+
+    #[inline(always)]
+    fn as_mut_slice(&mut self) -> &mut [Byte] {
+        unsafe { std::slice::from_raw_parts_mut(self.memory, self.size) }
+    }
+
+
+    /// Mark the first `size` bytes of memory as the program image
+    pub fn set_code_size(&mut self, size: usize) {
+        self.code_size = size;
+        self.code_writes = None;
+    }
+
+
+    /// Record a write to the given address range if it overlaps the program image
+    #[inline(always)]
+    fn record_write(&mut self, address: Address, size: usize) {
+        if address < self.code_size && size != 0 {
+            let end = (address + size).min(self.code_size);
+            self.code_writes = Some(match self.code_writes {
+                Some((start, old_end)) => (start.min(address), old_end.max(end)),
+                None => (address, end)
+            });
+        }
+
+        if let Some(write_log) = &mut self.write_log {
+            write_log.push((address, size));
+        }
+    }
+
+
+    /// Start or stop recording every written address range
+    pub fn log_writes(&mut self, enable: bool) {
+        self.write_log = if enable { Some(Vec::new()) } else { None };
+    }
+
+
+    /// Get the address ranges written since the last call to `clear_write_log`
+    pub fn write_log(&self) -> &[(Address, usize)] {
+        self.write_log.as_deref().unwrap_or_default()
+    }
+
+
+    pub fn clear_write_log(&mut self) {
+        if let Some(write_log) = &mut self.write_log {
+            write_log.clear();
+        }
+    }
+
+
+    /// Return the address range of the program image that was written since the last call, if any
+    #[inline(always)]
+    pub fn take_code_writes(&mut self) -> Option<(Address, Address)> {
+        if self.code_writes.is_none() {
+            return None;
         }
+        self.code_writes.take()
     }
 
 
     /// Get the start address of the stack, which is the end of the memory
     pub fn get_stack_base(&self) -> Address {
-        self.memory.len()
+        self.size
+    }
+
+
+    /// Get the size of the program image at the start of memory
+    pub fn get_code_size(&self) -> usize {
+        self.code_size
+    }
+
+
+    /// Get a raw pointer to the start of memory.
+    /// 
+    /// Writes through the pointer aren't recorded, so they must not touch the program image
+    pub fn as_mut_ptr(&mut self) -> *mut Byte {
+        self.memory
     }
 
 
     /// Get a reference to the raw memory, unadviced
     pub fn get_raw(&self) -> &[Byte] {
-        &self.memory
+        self.as_slice()
     }
 
 
     pub fn set_bytes(&mut self, address: Address, data: &[Byte]) {
-        self.memory[address..address + data.len()].copy_from_slice(data);
+        self.record_write(address, data.len());
+        self.as_mut_slice()[address..address + data.len()].copy_from_slice(data);
     }
 
 
@@ -46,22 +381,127 @@ impl Memory {
     /// Copy `size` bytes from `src_address` to `dest_address`.
     /// Implements safe buffred copying for overlapping memory regions.
     pub fn memcpy(&mut self, src_address: Address, dest_address: Address, size: usize) {
-        self.memory.copy_within(src_address..src_address + size, dest_address);
+        self.record_write(dest_address, size);
+        self.as_mut_slice().copy_within(src_address..src_address + size, dest_address);
     }
 
 
     pub fn get_byte(&self, address: Address) -> Byte {
-        self.memory[address]
+        self.as_slice()[address]
     }
 
 
     pub fn get_bytes(&self, address: Address, size: usize) -> &[Byte] {
-        &self.memory[address..address + size]
+        &self.as_slice()[address..address + size]
+    }
+
+
+    /// Get a reference to the given stack range.
+    /// 
+    /// Unlike `get_bytes`, the range may extend into the guard page after the stack base, in which case the process is terminated with a stack overflow error
+    #[inline(always)]
+    pub fn get_stack_bytes(&self, address: Address, size: usize) -> &[Byte] {
+        let guarded = unsafe { std::slice::from_raw_parts(self.memory, self.size + page_size()) };
+        &guarded[address..address + size]
     }
 
 
+    /// Get a mutable reference to the given memory range. The range is assumed to be written
     pub fn get_bytes_mut(&mut self, address: Address, size: usize) -> &mut [Byte] {
-        &mut self.memory[address..address + size]
+        self.record_write(address, size);
+        &mut self.as_mut_slice()[address..address + size]
+    }
+
+
+    /// Size of the memory image written by `save_image`, which covers all the memory pages
+    pub fn image_size(&self) -> usize {
+        self.mapping.size - page_size()
+    }
+
+
+    /// Write the memory pages to `file` at `offset`, which must be page-aligned.
+    /// Pages that only contain zeros are left as holes, so the image only takes the space of the memory that was used
+    pub fn save_image(&self, file: &File, offset: u64) -> io::Result<()> {
+
+        let page_size = page_size();
+        let pages = unsafe { std::slice::from_raw_parts(self.mapping.start as *const Byte, self.image_size()) };
+
+        // Write consecutive non-zero pages with a single write
+        let mut run_start: Option<usize> = None;
+        for (index, page) in pages.chunks_exact(page_size).enumerate() {
+            let is_used = page.iter().any(|&byte| byte != 0);
+            match (is_used, run_start) {
+                (true, None) => run_start = Some(index * page_size),
+                (false, Some(start)) => {
+                    file.write_all_at(&pages[start..index * page_size], offset + start as u64)?;
+                    run_start = None;
+                },
+                _ => {}
+            }
+        }
+        if let Some(start) = run_start {
+            file.write_all_at(&pages[start..], offset + start as u64)?;
+        }
+
+        file.set_len(offset + pages.len() as u64)
+    }
+
+
+    /// Replace the memory content with the image written by `save_image` at `offset` in `file`.
+    ///
+    /// The image is mapped copy-on-write, so it's only read when its pages are first touched and the file is never modified.
+    /// The memory must have the same size as the one the image was saved from
+    pub fn map_image(&mut self, file: &File, offset: u64) -> io::Result<()> {
+
+        let mapping = unsafe {
+            libc::mmap(
+                self.mapping.start,
+                self.image_size(),
+                libc::PROT_READ | libc::PROT_WRITE,
+                libc::MAP_PRIVATE | libc::MAP_FIXED | libc::MAP_NORESERVE,
+                file.as_raw_fd(),
+                offset as libc::off_t
+            )
+        };
+        if mapping == libc::MAP_FAILED {
+            return Err(io::Error::last_os_error());
+        }
+
+        self.code_writes = None;
+        Ok(())
+    }
+
+
+    /// Return the first address at or after `address` whose host address is page-aligned
+    pub fn align_to_page(&self, address: Address) -> Address {
+        let page_size = page_size();
+        address + (page_size - (self.memory as usize + address) % page_size) % page_size
+    }
+
+
+    /// Map `size` bytes of `file` at `offset` over the memory at `address`. Both `address`, as given by `align_to_page`,
+    /// and `offset` must be page-aligned.
+    ///
+    /// The file is mapped copy-on-write, so writes to the range are never written back to it.
+    /// The range must not cover whole pages past the end of the file, which can't be accessed
+    pub fn map_file(&mut self, address: Address, size: usize, file: &File, offset: u64) -> io::Result<()> {
+
+        let mapping = unsafe {
+            libc::mmap(
+                self.memory.add(address) as *mut libc::c_void,
+                size,
+                libc::PROT_READ | libc::PROT_WRITE,
+                libc::MAP_PRIVATE | libc::MAP_FIXED | libc::MAP_NORESERVE,
+                file.as_raw_fd(),
+                offset as libc::off_t
+            )
+        };
+        if mapping == libc::MAP_FAILED {
+            return Err(io::Error::last_os_error());
+        }
+
+        self.record_write(address, size);
+        Ok(())
     }
 
 }
@@ -74,38 +514,95 @@ mod tests {
 
     #[test]
     fn test_overlapping_memcpy() {
-        let mut memory = Memory::new(0);
-        memory.memory = vec![0, 1, 2, 3, 4, 5, 6, 7].into_boxed_slice();
+        let mut memory = Memory::new(8);
+        memory.set_bytes(0, &[0, 1, 2, 3, 4, 5, 6, 7]);
         memory.memcpy(0, 4, 4);
-        assert_eq!(memory.memory, vec![0, 1, 2, 3, 0, 1, 2, 3].into_boxed_slice());
+        assert_eq!(memory.get_raw(), [0, 1, 2, 3, 0, 1, 2, 3]);
     }
 
 
     #[test]
     fn test_non_overlapping_memcpy() {
-        let mut memory = Memory::new(0);
-        memory.memory = vec![0, 1, 2, 3, 4, 5, 6, 7].into_boxed_slice();
+        let mut memory = Memory::new(8);
+        memory.set_bytes(0, &[0, 1, 2, 3, 4, 5, 6, 7]);
         memory.memcpy(0, 4, 3);
-        assert_eq!(memory.memory, vec![0, 1, 2, 3, 0, 1, 2, 7].into_boxed_slice());
+        assert_eq!(memory.get_raw(), [0, 1, 2, 3, 0, 1, 2, 7]);
     }
 
 
     #[test]
     fn test_memcpy_to_self() {
-        let mut memory = Memory::new(0);
-        memory.memory = vec![0, 1, 2, 3, 4, 5, 6, 7].into_boxed_slice();
+        let mut memory = Memory::new(8);
+        memory.set_bytes(0, &[0, 1, 2, 3, 4, 5, 6, 7]);
         memory.memcpy(0, 0, 4);
-        assert_eq!(memory.memory, vec![0, 1, 2, 3, 4, 5, 6, 7].into_boxed_slice());
+        assert_eq!(memory.get_raw(), [0, 1, 2, 3, 4, 5, 6, 7]);
     }
 
 
     #[test]
     fn test_memcpy_to_self_overlapping() {
-        let mut memory = Memory::new(0);
-        memory.memory = vec![0, 1, 2, 3, 4, 5, 6, 7].into_boxed_slice();
+        let mut memory = Memory::new(8);
+        memory.set_bytes(0, &[0, 1, 2, 3, 4, 5, 6, 7]);
         memory.memcpy(0, 2, 4);
-        assert_eq!(memory.memory, vec![0, 1, 0, 1, 2, 3, 6, 7].into_boxed_slice());
+        assert_eq!(memory.get_raw(), [0, 1, 0, 1, 2, 3, 6, 7]);
     }    
 
+
+    #[test]
+    fn test_unaligned_size() {
+        let memory = Memory::new(4100);
+        assert_eq!(memory.memory as usize % MEMORY_ALIGNMENT, 0);
+        assert_eq!(memory.get_stack_base(), 4100);
+        // The end of memory isn't right before the guard page
+        assert!(!memory.is_guarded());
+        assert!(Memory::new(4096).is_guarded());
+
+        let address = memory.align_to_page(1);
+        assert!((1..1 + page_size()).contains(&address));
+        assert_eq!((memory.memory as usize + address) % page_size(), 0);
+    }
+
+
+    #[test]
+    fn test_code_writes() {
+        let mut memory = Memory::new(16);
+        memory.set_code_size(8);
+
+        memory.set_bytes(8, &[1, 2]);
+        assert_eq!(memory.take_code_writes(), None);
+
+        memory.set_bytes(6, &[1, 2, 3, 4]);
+        memory.memcpy(8, 1, 2);
+        assert_eq!(memory.take_code_writes(), Some((1, 8)));
+        assert_eq!(memory.take_code_writes(), None);
+    }
+
+
+    #[test]
+    fn test_reset() {
+        let mut memory = Memory::new(0);
+        assert_eq!(memory.get_stack_base(), UNLIMITED_MEMORY_SIZE);
+
+        memory.set_bytes(UNLIMITED_MEMORY_SIZE - 4, &[1, 2, 3, 4]);
+        memory.set_bytes(0, &[5]);
+        memory.reset();
+        assert_eq!(memory.get_bytes(UNLIMITED_MEMORY_SIZE - 4, 4), [0, 0, 0, 0]);
+        assert_eq!(memory.get_byte(0), 0);
+    }
+
+
+    #[test]
+    fn test_share() {
+        let mut memory = Memory::new(16);
+        memory.set_code_size(8);
+
+        let mut shared = memory.share();
+        shared.set_bytes(4, &[1, 2]);
+        drop(memory);
+
+        assert_eq!(shared.get_bytes(4, 2), [1, 2]);
+        assert_eq!(shared.take_code_writes(), Some((4, 6)));
+    }
+
 }
 
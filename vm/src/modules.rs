@@ -1,27 +1,42 @@
+use std::sync::{Arc, Mutex};
+
 use crate::terminal::Terminal;
 use crate::storage::Storage;
 use crate::host_fs::HostFS;
+use crate::allocator::Allocator;
+use crate::threads::GuestThreads;
+use crate::events::Events;
+use crate::perf_counters::ModuleTimes;
 
 
 
+/// The modules of a processor, shared by all the threads of the program
 pub struct CPUModules {
 
     pub storage: Option<Storage>,
-    pub terminal: Terminal,
-    pub host_fs: HostFS
+    pub terminal: Mutex<Terminal>,
+    pub host_fs: HostFS,
+    pub allocator: Mutex<Allocator>,
+    pub threads: GuestThreads,
+    /// Shared with the modules that report events from their own threads
+    pub events: Arc<Events>,
+    pub module_times: ModuleTimes,
 
 }
 
 
 impl CPUModules {
 
-    pub fn new(storage: Option<Storage>, terminal: Terminal, host_fs: HostFS) -> Self {
+    pub fn new(storage: Option<Storage>, terminal: Terminal, host_fs: HostFS, allocator: Allocator, events: Arc<Events>) -> Self {
         Self {
             storage,
-            terminal,
+            terminal: Mutex::new(terminal),
             host_fs,
+            allocator: Mutex::new(allocator),
+            threads: GuestThreads::new(),
+            events,
+            module_times: ModuleTimes::default(),
         }
     }
 
 }
-
@@ -0,0 +1,236 @@
+use std::cell::RefCell;
+use std::fmt;
+use std::io::{self, BufWriter, Stdout, Write};
+use std::sync::{Arc, Mutex};
+
+use crate::cli_parser::StdoutBuffering;
+
+
+/// Size of the guest stdout buffer. Bigger writes bypass the buffer
+const BUFFER_CAPACITY: usize = 64 * 1024;
+
+
+/// Where the guest output goes
+enum Sink {
+
+    Stdout(BufWriter<Stdout>),
+    /// Keep the output in memory, to be taken by the embedder. The threads of the program share it
+    Capture(Arc<Mutex<Vec<u8>>>),
+    /// Buffered output whose writes to the underlying stream are recorded, to test when the buffer is flushed
+    #[cfg(test)]
+    Recorded(BufWriter<FlushRecorder>),
+
+}
+
+
+/// Stream that keeps every write it receives as a separate chunk
+#[cfg(test)]
+#[derive(Clone, Default)]
+pub struct FlushRecorder(pub Arc<Mutex<Vec<Vec<u8>>>>);
+
+#[cfg(test)]
+impl Write for FlushRecorder {
+
+    fn write(&mut self, bytes: &[u8]) -> io::Result<usize> {
+        self.0.lock().unwrap().push(bytes.to_vec());
+        Ok(bytes.len())
+    }
+
+
+    fn flush(&mut self) -> io::Result<()> {
+        Ok(())
+    }
+
+}
+
+
+/// Stdout of a guest program
+pub struct GuestStdout {
+
+    sink: Sink,
+    buffering: StdoutBuffering,
+
+}
+
+
+impl GuestStdout {
+
+    /// Buffered guest output written to the process stdout
+    pub fn new(buffering: StdoutBuffering) -> Self {
+        Self {
+            sink: Sink::Stdout(BufWriter::with_capacity(BUFFER_CAPACITY, io::stdout())),
+            buffering,
+        }
+    }
+
+
+    /// Guest output kept in memory
+    pub fn captured() -> Self {
+        Self {
+            sink: Sink::Capture(Arc::default()),
+            // Line buffering would only cost flushes that do nothing
+            buffering: StdoutBuffering::Full,
+        }
+    }
+
+
+    /// Buffered guest output written to `recorder`
+    #[cfg(test)]
+    pub fn recorded(buffering: StdoutBuffering, recorder: FlushRecorder) -> Self {
+        Self {
+            sink: Sink::Recorded(BufWriter::with_capacity(BUFFER_CAPACITY, recorder)),
+            buffering,
+        }
+    }
+
+
+    /// Take the output captured so far. Returns nothing if the output isn't captured
+    pub fn take_captured(&mut self) -> Vec<u8> {
+        match &mut self.sink {
+            Sink::Capture(output) => std::mem::take(&mut *output.lock().unwrap()),
+            _ => Vec::new()
+        }
+    }
+
+
+    /// Create the stdout of another thread of the same program, which writes to the same place with its own buffer
+    fn sibling(&self) -> Self {
+        Self {
+            sink: match &self.sink {
+                Sink::Stdout(_) => Sink::Stdout(BufWriter::with_capacity(BUFFER_CAPACITY, io::stdout())),
+                Sink::Capture(output) => Sink::Capture(Arc::clone(output)),
+                #[cfg(test)]
+                Sink::Recorded(writer) => Sink::Recorded(BufWriter::with_capacity(BUFFER_CAPACITY, writer.get_ref().clone())),
+            },
+            buffering: self.buffering,
+        }
+    }
+
+
+    fn write_all(&mut self, bytes: &[u8]) {
+        match &mut self.sink {
+            Sink::Stdout(writer) => writer.write_all(bytes).expect("Failed to write to stdout"),
+            Sink::Capture(output) => output.lock().unwrap().extend_from_slice(bytes),
+            #[cfg(test)]
+            Sink::Recorded(writer) => writer.write_all(bytes).unwrap(),
+        }
+    }
+
+
+    fn write_fmt(&mut self, args: fmt::Arguments) {
+        match &mut self.sink {
+            Sink::Stdout(writer) => writer.write_fmt(args).expect("Failed to write to stdout"),
+            Sink::Capture(output) => output.lock().unwrap().write_fmt(args).unwrap(),
+            #[cfg(test)]
+            Sink::Recorded(writer) => writer.write_fmt(args).unwrap(),
+        }
+    }
+
+
+    fn flush(&mut self) {
+        match &mut self.sink {
+            Sink::Stdout(writer) => writer.flush().expect("Failed to flush stdout"),
+            Sink::Capture(_) => {},
+            #[cfg(test)]
+            Sink::Recorded(writer) => writer.flush().unwrap(),
+        }
+    }
+
+}
+
+
+thread_local! {
+
+    /// Stdout of the guest program running on this thread.
+    /// It's kept outside of the processor so that it can be flushed when the VM is terminated from anywhere
+    static GUEST_STDOUT: RefCell<Option<GuestStdout>> = const { RefCell::new(None) };
+
+}
+
+
+/// Make `stdout` the output of the guest program running on this thread, flushing any previous one
+pub fn install(stdout: GuestStdout) {
+    if let Some(mut previous) = GUEST_STDOUT.with(|current| current.borrow_mut().replace(stdout)) {
+        previous.flush();
+    }
+}
+
+
+/// Remove the output of the guest program running on this thread, so that the program can be moved to another thread.
+/// The buffered output is flushed
+pub fn uninstall() -> Option<GuestStdout> {
+    let mut stdout = GUEST_STDOUT.with(|current| current.borrow_mut().take())?;
+    stdout.flush();
+    Some(stdout)
+}
+
+
+/// Create the stdout of a new thread of the guest program running on this thread
+pub fn sibling() -> GuestStdout {
+    GUEST_STDOUT.with(|stdout| {
+        match stdout.borrow().as_ref() {
+            Some(stdout) => stdout.sibling(),
+            None => panic!("Guest stdout is not initialized")
+        }
+    })
+}
+
+
+fn with_stdout(f: impl FnOnce(&mut GuestStdout)) {
+    GUEST_STDOUT.with(|stdout| {
+        match stdout.borrow_mut().as_mut() {
+            Some(stdout) => f(stdout),
+            None => panic!("Guest stdout is not initialized")
+        }
+    });
+}
+
+
+/// Write raw bytes to the guest stdout
+#[inline]
+pub fn write(bytes: &[u8]) {
+    with_stdout(|stdout| {
+        stdout.write_all(bytes);
+
+        if stdout.buffering == StdoutBuffering::Line && bytes.contains(&b'\n') {
+            stdout.flush();
+        }
+    });
+}
+
+
+/// Write formatted text to the guest stdout. The text must not contain newlines
+#[inline]
+pub fn write_fmt(args: fmt::Arguments) {
+    with_stdout(|stdout| {
+        stdout.write_fmt(args);
+    });
+}
+
+
+/// Write the buffered guest output to stdout
+pub fn flush() {
+    GUEST_STDOUT.with(|stdout| {
+        // The output may already be borrowed if the VM is terminated while writing
+        if let Ok(mut stdout) = stdout.try_borrow_mut() {
+            if let Some(stdout) = stdout.as_mut() {
+                stdout.flush();
+            }
+        }
+    });
+}
+
+
+/// Write the buffered guest output to stdout from a signal handler, without allocating or locking
+pub fn flush_from_signal_handler() {
+    GUEST_STDOUT.with(|stdout| {
+        if let Ok(stdout) = stdout.try_borrow() {
+            if let Some(GuestStdout { sink: Sink::Stdout(writer), .. }) = stdout.as_ref() {
+                let buffer = writer.buffer();
+                unsafe {
+                    libc::write(libc::STDOUT_FILENO, buffer.as_ptr() as *const libc::c_void, buffer.len());
+                }
+            }
+        }
+    });
+}
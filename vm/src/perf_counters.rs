@@ -0,0 +1,122 @@
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::time::Duration;
+
+use rusty_vm_lib::interrupts::Interrupts;
+
+
+/// Counters of the work done by a processor, which is a single guest thread.
+/// They are plain integers because only the thread itself updates them
+#[derive(Debug, Default, Clone, Copy)]
+pub struct ThreadCounters {
+
+    /// Instructions run by the interpreter. Instructions run as compiled native code are not counted
+    pub instructions: u64,
+    pub calls: u64,
+    pub returns: u64,
+    pub interrupts: u64,
+    /// Bytes copied or set by the bulk memory instructions
+    pub bulk_memory_bytes: u64,
+
+}
+
+
+/// Bytes transferred by a module on behalf of the guest, shared by all the threads of the program
+#[derive(Debug, Default)]
+pub struct Traffic {
+
+    read: AtomicU64,
+    written: AtomicU64,
+
+}
+
+
+impl Traffic {
+
+    pub fn record_read(&self, bytes: usize) {
+        self.read.fetch_add(bytes as u64, Ordering::Relaxed);
+    }
+
+
+    pub fn record_write(&self, bytes: usize) {
+        self.written.fetch_add(bytes as u64, Ordering::Relaxed);
+    }
+
+
+    pub fn read(&self) -> u64 {
+        self.read.load(Ordering::Relaxed)
+    }
+
+
+    pub fn written(&self) -> u64 {
+        self.written.load(Ordering::Relaxed)
+    }
+
+
+    pub fn reset(&self) {
+        self.read.store(0, Ordering::Relaxed);
+        self.written.store(0, Ordering::Relaxed);
+    }
+
+}
+
+
+/// Modules whose interrupts are timed. Their interrupts wait for the host, so reading the clock around them is cheap in comparison
+#[derive(Debug, Clone, Copy)]
+pub enum TimedModule {
+
+    Storage,
+    HostFs,
+    Terminal,
+
+}
+
+
+impl TimedModule {
+
+    /// Return the module that handles the interrupt, if it's timed
+    pub fn of(interrupt: Interrupts) -> Option<Self> {
+        match interrupt {
+            Interrupts::DiskRead |
+            Interrupts::DiskWrite |
+            Interrupts::DiskWait
+                => Some(Self::Storage),
+
+            Interrupts::HostFs => Some(Self::HostFs),
+
+            Interrupts::Terminal => Some(Self::Terminal),
+
+            _ => None
+        }
+    }
+
+}
+
+
+/// Time spent in the interrupts of every timed module, by all the threads of the program
+#[derive(Debug, Default)]
+pub struct ModuleTimes {
+
+    nanos: [AtomicU64; 3],
+
+}
+
+
+impl ModuleTimes {
+
+    pub fn record(&self, module: TimedModule, elapsed: Duration) {
+        self.nanos[module as usize].fetch_add(elapsed.as_nanos() as u64, Ordering::Relaxed);
+    }
+
+
+    pub fn nanos(&self, module: TimedModule) -> u64 {
+        self.nanos[module as usize].load(Ordering::Relaxed)
+    }
+
+
+    pub fn reset(&self) {
+        for nanos in &self.nanos {
+            nanos.store(0, Ordering::Relaxed);
+        }
+    }
+
+}
@@ -0,0 +1,241 @@
+use std::collections::VecDeque;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::Mutex;
+use std::thread;
+use std::time::Duration;
+
+use crate::processor::{Processor, RunState};
+
+
+/// Default number of instructions a processor runs before giving way to the others
+pub const DEFAULT_QUANTUM: u64 = 100_000;
+
+/// How long a worker sleeps when there is nothing to run or steal
+const WORKER_IDLE_SLEEP: Duration = Duration::from_micros(100);
+
+
+struct Task {
+
+    /// Position of the processor in the list given to `WorkerPool::run`
+    index: usize,
+    processor: Processor,
+
+}
+
+
+/// Runs many independent processors on a fixed number of threads.
+///
+/// Every worker has its own queue of processors. It runs the processor at the front for a quantum of instructions,
+/// then puts it back at the end if the program hasn't exited, so long programs don't hold up the others.
+/// A worker whose queue is empty steals from the back of the other queues
+pub struct WorkerPool {
+
+    threads: usize,
+    /// Instructions run by a processor before it's put back in the queue
+    quantum: u64,
+
+}
+
+
+impl WorkerPool {
+
+    pub fn new(threads: usize, quantum: u64) -> Self {
+        Self {
+            threads: threads.max(1),
+            quantum: quantum.max(1),
+        }
+    }
+
+
+    /// Create a pool with one worker per available core
+    pub fn with_available_parallelism(quantum: u64) -> Self {
+        Self::new(thread::available_parallelism().map_or(1, |threads| threads.get()), quantum)
+    }
+
+
+    /// Run the given processors, which must have a program loaded, until every program exits or faults.
+    /// Return the processors in the same order with their final state, so that their output can be taken and they can be reset
+    pub fn run(&self, processors: Vec<Processor>) -> Vec<(Processor, RunState)> {
+
+        let count = processors.len();
+
+        let queues: Vec<Mutex<VecDeque<Task>>> = (0..self.threads).map(|_| Mutex::default()).collect();
+        for (index, processor) in processors.into_iter().enumerate() {
+            queues[index % self.threads].lock().unwrap().push_back(Task { index, processor });
+        }
+
+        let remaining = AtomicUsize::new(count);
+
+        let finished: Vec<Vec<(Task, RunState)>> = thread::scope(|scope| {
+            let workers: Vec<_> = (0..self.threads).map(|worker| {
+                let queues = &queues;
+                let remaining = &remaining;
+                let quantum = self.quantum;
+                thread::Builder::new()
+                    .name(format!("vm worker {}", worker))
+                    .spawn_scoped(scope, move || work(worker, queues, remaining, quantum))
+                    .expect("Failed to start a worker thread")
+            }).collect();
+
+            workers.into_iter().map(|worker| worker.join().expect("A worker thread panicked")).collect()
+        });
+
+        let mut results: Vec<Option<(Processor, RunState)>> = (0..count).map(|_| None).collect();
+        for (task, state) in finished.into_iter().flatten() {
+            results[task.index] = Some((task.processor, state));
+        }
+
+        results.into_iter().map(|result| result.expect("Every processor has finished")).collect()
+    }
+
+}
+
+
+/// Run the tasks of the pool until all of them are finished. Return the tasks finished by this worker
+fn work(worker: usize, queues: &[Mutex<VecDeque<Task>>], remaining: &AtomicUsize, quantum: u64) -> Vec<(Task, RunState)> {
+
+    let mut finished = Vec::new();
+
+    while remaining.load(Ordering::Acquire) != 0 {
+
+        // The own queue must be unlocked before stealing, or two workers stealing from each other would deadlock
+        let task = queues[worker].lock().unwrap().pop_front();
+        let task = task.or_else(|| steal(worker, queues));
+
+        let Some(mut task) = task else {
+            // The remaining tasks are running on other workers
+            thread::sleep(WORKER_IDLE_SLEEP);
+            continue;
+        };
+
+        match task.processor.run_for(Some(quantum)) {
+            RunState::Paused => queues[worker].lock().unwrap().push_back(task),
+            state => {
+                remaining.fetch_sub(1, Ordering::Release);
+                finished.push((task, state));
+            }
+        }
+    }
+
+    finished
+}
+
+
+/// Take a task from the back of another worker's queue, trying the next workers first
+fn steal(worker: usize, queues: &[Mutex<VecDeque<Task>>]) -> Option<Task> {
+    (1..queues.len())
+        .map(|offset| (worker + offset) % queues.len())
+        .find_map(|victim| queues[victim].lock().unwrap().pop_back())
+}
+
+
+#[cfg(test)]
+mod tests {
+
+    use rusty_vm_lib::vm::ErrorCodes;
+
+    use super::*;
+    use crate::processor::ExitStatus;
+    use crate::test_utils::{assemble, processor};
+
+
+    /// Assemble a program that counts up to `count`, printing every number, then exits with `count % 256`
+    fn counter_program(count: u64) -> Vec<u8> {
+        assemble(&format!("
+.include:
+
+    archlib.asm
+
+.text:
+
+@start
+
+    mov8 r3 0
+
+    @loop
+        inc r3
+        mov print r3
+        intr =PRINT_UNSIGNED
+        cmp8 r3 {count}
+        jmplt loop
+
+    mov8 exit {}
+", count % 256))
+    }
+
+
+    fn expected_output(count: u64) -> Vec<u8> {
+        (1..=count).map(|n| n.to_string()).collect::<String>().into_bytes()
+    }
+
+
+    #[test]
+    fn test_budget_and_reset() {
+        let byte_code = counter_program(1000);
+        let mut processor = processor(&byte_code);
+
+        assert_eq!(processor.run_for(Some(10)), RunState::Paused);
+        assert_eq!(processor.run_for(None), RunState::Exited(ExitStatus { exit_code: (1000 % 256) as u8, error: 0 }));
+        assert_eq!(processor.take_output(), expected_output(1000));
+
+        // The exit state sticks until the processor is reset
+        assert!(matches!(processor.run_for(None), RunState::Exited(_)));
+
+        processor.reset();
+        processor.load(&counter_program(3)).unwrap();
+        assert_eq!(processor.run_for(None), RunState::Exited(ExitStatus { exit_code: 3, error: 0 }));
+        assert_eq!(processor.take_output(), expected_output(3));
+    }
+
+
+    #[test]
+    fn test_fault() {
+        // An invalid opcode at the entry point, which is address 0
+        let mut byte_code = vec![u8::MAX];
+        byte_code.extend_from_slice(&0usize.to_le_bytes());
+
+        let mut processor = processor(&byte_code);
+        assert!(matches!(processor.run_for(None), RunState::Faulted(_)));
+    }
+
+
+    #[test]
+    fn test_stack_underflow() {
+        let byte_code = assemble("
+.include:
+
+    archlib.asm
+
+.text:
+
+@start
+
+    pop8 r1
+    mov8 exit 0
+");
+
+        // More memories than the fault handler can guard, and none of them may terminate the process
+        let processors = (0..100).map(|_| processor(&byte_code)).collect();
+
+        for (_, state) in WorkerPool::new(4, 50).run(processors) {
+            assert_eq!(state, RunState::Exited(ExitStatus { exit_code: 0, error: ErrorCodes::StackOverflow as u8 }));
+        }
+    }
+
+
+    #[test]
+    fn test_pool() {
+        let counts: Vec<u64> = (0..200).map(|i| 1 + i * 37 % 500).collect();
+        let programs: Vec<Vec<u8>> = counts.iter().map(|&count| counter_program(count)).collect();
+
+        let processors = programs.iter().map(|byte_code| processor(byte_code)).collect();
+
+        let results = WorkerPool::new(4, 50).run(processors);
+
+        for ((mut processor, state), &count) in results.into_iter().zip(&counts) {
+            assert_eq!(state, RunState::Exited(ExitStatus { exit_code: (count % 256) as u8, error: 0 }));
+            assert_eq!(processor.take_output(), expected_output(count));
+        }
+    }
+
+}
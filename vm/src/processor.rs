@@ -1,43 +1,69 @@
 #![allow(clippy::no_effect)]
 
 
-use std::io::{Read, Write};
+use std::any::Any;
+use std::collections::HashMap;
+use std::fs::File;
+use std::io::Read;
 use std::io;
+use std::ops::Range;
+use std::panic::{self, AssertUnwindSafe};
 use std::path::PathBuf;
-use std::time::{SystemTime, UNIX_EPOCH};
+use std::sync::atomic::{self, AtomicU16, AtomicU32, AtomicU64, AtomicU8, Ordering};
+use std::sync::Arc;
+use std::thread;
+use std::time::{Duration, Instant, SystemTime, UNIX_EPOCH};
 use rand::Rng;
 
-use rusty_vm_lib::registers::Registers;
-use rusty_vm_lib::byte_code::ByteCodes;
+use rusty_vm_lib::registers::{Registers, REGISTER_COUNT};
+use rusty_vm_lib::byte_code::{ByteCodes, JumpCondition};
 use rusty_vm_lib::vm::{Address, ADDRESS_SIZE, ErrorCodes};
-use rusty_vm_lib::interrupts::Interrupts;
+use rusty_vm_lib::interrupts::{Interrupts, PerfCounter, PERF_COUNTER_COUNT, PERF_COUNTERS_SIZE};
+use rusty_vm_lib::trace::TraceRecord;
+use rusty_vm_lib::executable::{Executable, Section, SectionKind, MAPPED_SECTION_MIN_SIZE};
 
+use crate::allocator::Allocator;
 use crate::host_fs::HostFS;
-use crate::memory::{Memory, Byte};
-use crate::cli_parser::ExecutionMode;
+use crate::instruction_cache::{DecodedInstruction, InstructionCache};
+use crate::jit::{self, Jit};
+use crate::memory::{self, Memory, Byte};
+use crate::cli_parser::{ExecutionMode, StdoutBuffering};
 use crate::error;
+use crate::files::ByteCodeFile;
+use crate::output::{self, GuestStdout};
 use crate::modules::CPUModules;
-use crate::register::CPURegisters;
-use crate::storage::Storage;
+use crate::perf_counters::{ThreadCounters, TimedModule};
+use crate::profiler::{ProfileOptions, Profiler};
+use crate::register::{CPURegisters, LazyFlags};
+use crate::snapshot::{self, Snapshot, SnapshotOptions};
+use crate::storage::{RequestKind, RequestState, Storage};
 use crate::terminal::Terminal;
-
-
-/// Return whether the most significant bit of the given value is set
-#[inline(always)]
-fn is_msb_set(value: u64) -> bool {
-    value & (1 << 63) != 0
+use crate::events::{EventKind, Events};
+use crate::tracer::{TraceOptions, Tracer};
+
+
+/// Evaluate the expression with `$n` defined as the constant handled size `$size`.
+/// This calls the const-generic handlers, like `load_sized`, for the instructions whose handled size is an operand
+macro_rules! match_sized {
+    ($size:expr, $what:literal, |$n:ident| $expression:expr) => {
+        match $size {
+            1 => { const $n: usize = 1; $expression },
+            2 => { const $n: usize = 2; $expression },
+            4 => { const $n: usize = 4; $expression },
+            8 => { const $n: usize = 8; $expression },
+            size => error::error(format!("Invalid size for {}: {}.", $what, size).as_str()),
+        }
+    };
 }
 
 
-/// Converts a byte array to an integer
-fn bytes_to_int(bytes: &[Byte], handled_size: Byte) -> u64 {
-    match handled_size {
-        1 => bytes[0] as u64,
-        2 => u16::from_le_bytes(bytes.try_into().unwrap()) as u64,
-        4 => u32::from_le_bytes(bytes.try_into().unwrap()) as u64,
-        8 => u64::from_le_bytes(bytes.try_into().unwrap()),
-        _ => error::error(format!("Invalid number size: {}", handled_size).as_str()),
-    }
+/// Converts a little-endian byte array of a handled size to an integer
+fn bytes_to_int(bytes: &[Byte]) -> u64 {
+    match_sized!(bytes.len(), "number", |SIZE| {
+        let mut value = [0; 8];
+        value[..SIZE].copy_from_slice(bytes);
+        u64::from_le_bytes(value)
+    })
 }
 
 
@@ -50,25 +76,80 @@ fn bytes_as_address(bytes: &[Byte]) -> Address {
 }
 
 
+/// Unwinding payload that stops the processor when the program exits
+struct Halt;
+
+
+/// Number of instructions a guest thread runs between checks of whether it must stop
+const THREAD_QUANTUM: u64 = 100_000;
+
+
+/// How a program ended
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct ExitStatus {
+
+    /// Value of the exit register
+    pub exit_code: u8,
+    /// Value of the error register
+    pub error: u8,
+
+}
+
+
+/// State of a processor after running for a while
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub enum RunState {
+
+    Exited(ExitStatus),
+    /// The instruction budget ran out. Running the processor again continues the program
+    Paused,
+    /// The VM hit a fatal error, like an invalid instruction. The processor must be reset before running again
+    Faulted(String),
+
+}
+
+
 pub struct Processor {
 
     registers: CPURegisters,
     pub memory: Memory,
     start_time: SystemTime,
     quiet_exit: bool,
-    /// The program counter of the last instruction executed in interactive mode.
-    /// 
-    /// This is only used in interactive mode
-    interactive_last_instruction_pc: Address,
-    modules: CPUModules,
+    /// Output of the program, while it isn't installed on the thread that runs the program
+    stdout: Option<GuestStdout>,
+    modules: Arc<CPUModules>,
+    /// Start address of the stack of this thread
+    stack_base: Address,
+    /// Lowest address the stack of this thread may grow to. The stack of the main thread can grow down to address 0
+    stack_limit: Address,
+    /// Whether pops check the stack base explicitly. Otherwise, popping past it hits the guard page, which terminates the process
+    check_stack_bounds: bool,
+    /// Address the heap may not grow past when this thread allocates, if this isn't the main thread.
+    /// The main thread uses its stack top instead
+    heap_limit: Option<Address>,
+    instruction_cache: InstructionCache,
+    jit: Jit,
+    /// Ranges of the program image overwritten by the storage reads submitted by this thread, by request id.
+    /// The decoded and compiled instructions are discarded when the request is collected, since the read completes on another thread
+    code_reads: HashMap<u64, (Address, Address)>,
+    profiler: Option<Box<Profiler>>,
+    tracer: Option<Box<Tracer>>,
+    snapshot: Option<SnapshotOptions>,
+    /// How the last library run ended, if the program can't continue
+    final_state: Option<RunState>,
+    /// Read by the guest with the PerfCounters interrupt
+    perf: ThreadCounters,
 
 }
 
 
+#[derive(Clone)]
 pub struct StorageOptions {
 
     pub file_path: PathBuf,
     pub max_size: Option<usize>,
+    /// Map the storage file into memory instead of reading and writing it. Requires a maximum size
+    pub mapped: bool,
 
 }
 
@@ -79,279 +160,586 @@ impl StorageOptions {
         Self {
             file_path,
             max_size,
+            mapped: false,
+        }
+    }
+
+}
+
+
+/// Everything a processor is built from
+pub struct ProcessorConfig {
+
+    /// Maximum memory size in bytes. 0 reserves a 4 GiB address space
+    pub max_memory_size: usize,
+    /// Don't print any message when the program exits
+    pub quiet_exit: bool,
+    pub stdout_buffering: StdoutBuffering,
+    /// Keep the program output in memory instead of writing it to stdout. It's read with `Processor::take_output`
+    pub capture_output: bool,
+    pub storage: Option<StorageOptions>,
+    pub profile: Option<ProfileOptions>,
+    pub trace: Option<TraceOptions>,
+    /// Where the program can save snapshots. Without it, the snapshot interrupt fails
+    pub snapshot: Option<SnapshotOptions>,
+
+}
+
+
+impl Default for ProcessorConfig {
+
+    fn default() -> Self {
+        Self {
+            max_memory_size: 1000000,
+            quiet_exit: true,
+            stdout_buffering: StdoutBuffering::Line,
+            capture_output: false,
+            storage: None,
+            profile: None,
+            trace: None,
+            snapshot: None,
         }
     }
 
 }
 
 
+/// Apply an operation to the atomic integer of `$size` bytes at `$address` and return its result as a `u64`,
+/// or `None` if the address isn't aligned to the size
+macro_rules! atomic_sized {
+    ($self:ident, $address:expr, $size:expr, |$atomic:ident, $int:ident| $operation:expr) => {
+        match $size {
+            1 => atomic_sized!(@apply $self, $address, AtomicU8, u8, |$atomic, $int| $operation),
+            2 => atomic_sized!(@apply $self, $address, AtomicU16, u16, |$atomic, $int| $operation),
+            4 => atomic_sized!(@apply $self, $address, AtomicU32, u32, |$atomic, $int| $operation),
+            8 => atomic_sized!(@apply $self, $address, AtomicU64, u64, |$atomic, $int| $operation),
+            _ => error::error(format!("Invalid size for atomic instruction {}.", $size).as_str()),
+        }
+    };
+
+    (@apply $self:ident, $address:expr, $atomic_type:ident, $int_type:ident, |$atomic:ident, $int:ident| $operation:expr) => {
+        $self.atomic_ptr($address, std::mem::size_of::<$int_type>()).map(|ptr| {
+            #[allow(non_camel_case_types, dead_code)]
+            type $int = $int_type;
+            let $atomic = unsafe { $atomic_type::from_ptr(ptr as *mut $int_type) };
+            ($operation) as u64
+        })
+    };
+}
+
+
+/// Return the message of a panic that isn't a VM error
+fn panic_message(payload: &(dyn Any + Send)) -> String {
+    if let Some(message) = payload.downcast_ref::<&str>() {
+        message.to_string()
+    } else if let Some(message) = payload.downcast_ref::<String>() {
+        message.clone()
+    } else {
+        "The VM panicked".to_string()
+    }
+}
+
+
 impl Processor {
 
     const STATIC_PROGRAM_ADDRESS: Address = 0;
 
 
-    pub fn new(max_memory_size: usize, quiet_exit: bool, storage: Option<StorageOptions>) -> Self {
+    pub fn new(config: ProcessorConfig) -> Self {
 
-        let storage = if let Some(storage) = storage {
-            Some(Storage::new(storage.file_path, storage.max_size))
+        let storage = if let Some(storage) = config.storage {
+            Some(Storage::new(storage.file_path, storage.max_size, storage.mapped))
         } else {
             None
         };
 
+        let memory = Memory::new(config.max_memory_size);
+        memory.set_quiet_stack_overflow(config.quiet_exit);
+        let events = Arc::new(Events::new());
+
         Self {
             registers: CPURegisters::new(),
-            memory: Memory::new(max_memory_size),
-            // Initialize temporarily, will be reinitialized in `execute`
+            stack_base: memory.get_stack_base(),
+            stack_limit: 0,
+            // The guard page is only relied on once `start` installs its fault handler
+            check_stack_bounds: true,
+            heap_limit: None,
+            memory,
+            // Initialize temporarily, will be reinitialized in `load`
             start_time: SystemTime::now(),
-            quiet_exit,
-            interactive_last_instruction_pc: 0,
-            modules: CPUModules::new(
+            quiet_exit: config.quiet_exit,
+            stdout: Some(if config.capture_output {
+                GuestStdout::captured()
+            } else {
+                GuestStdout::new(config.stdout_buffering)
+            }),
+            modules: Arc::new(CPUModules::new(
                 storage,
-                Terminal::new(),
-                HostFS::new()
-            ),
+                Terminal::new(Arc::clone(&events)),
+                HostFS::new(),
+                Allocator::new(),
+                events
+            )),
+            instruction_cache: InstructionCache::new(),
+            jit: Jit::new(),
+            code_reads: HashMap::new(),
+            profiler: config.profile.map(|options| Box::new(Profiler::new(options))),
+            tracer: config.trace.map(|options| Box::new(Tracer::new(options))),
+            snapshot: config.snapshot,
+            final_state: None,
+            perf: ThreadCounters::default(),
         }
     }
 
 
-    /// Execute the given bytecode
-    pub fn execute(&mut self, byte_code: &[Byte], mode: ExecutionMode) {
+    /// Load the given bytecode into memory and point the program counter to its entry point.
+    /// The bytecode may be an executable file or a raw program image, as generated by the assembler
+    pub fn load(&mut self, byte_code: &[Byte]) -> Result<(), String> {
+        self.load_executable(&Executable::load(byte_code)?, None)
+    }
 
-        // Set the program counter to the start of the program
 
-        if byte_code.len() < ADDRESS_SIZE {
-            error::error(format!("Bytecode is too small to contain a start address: minimum required size is {} bytes, got {}", ADDRESS_SIZE, byte_code.len()).as_str());
+    /// Load the given bytecode file into memory and point the program counter to its entry point.
+    ///
+    /// The large sections of an executable file are mapped copy-on-write from the file when the memory is page-aligned, instead of being copied
+    pub fn load_file(&mut self, byte_code: &ByteCodeFile) -> Result<(), String> {
+        self.load_executable(&Executable::load(byte_code.bytes())?, Some(byte_code.file()))
+    }
+
+
+    fn load_executable(&mut self, executable: &Executable, file: Option<&File>) -> Result<(), String> {
+
+        let image_end = Self::STATIC_PROGRAM_ADDRESS + executable.image_size();
+
+        if image_end > self.memory.get_stack_base() {
+            return Err(format!("Bytecode is too big for the memory: {} bytes, but the memory size is {} bytes", executable.image_size(), self.memory.get_stack_base()));
         }
 
-        let program_start: Address = bytes_as_address(&byte_code[byte_code.len() - ADDRESS_SIZE..]);
-        self.registers.set(Registers::PROGRAM_COUNTER, program_start as u64);
+        // Set the program counter to the start of the program
+        self.registers.set(Registers::PROGRAM_COUNTER, executable.entry as u64);
 
         // Initialize the stack pointer to the end of the memory. The stack grows downwards
-        self.registers.set(Registers::STACK_TOP_POINTER, self.memory.get_stack_base() as u64);
+        self.stack_base = self.memory.get_stack_base();
+        self.registers.set(Registers::STACK_TOP_POINTER, self.stack_base as u64);
+
+        // Load the program into memory.
+        // Bss sections are left as they are, since the memory of a new or reset processor is zeroed and its pages are only allocated when touched
+        for section in executable.sections.iter().filter(|section| section.kind == SectionKind::Code) {
+
+            let address = Self::STATIC_PROGRAM_ADDRESS + section.address;
+
+            let mapped = match file {
+                Some(file) if section.data.len() >= MAPPED_SECTION_MIN_SIZE => self.map_section(file, address, section),
+                _ => 0..0
+            };
+
+            self.memory.set_bytes(address, &section.data[..mapped.start]);
+            self.memory.set_bytes(address + mapped.end, &section.data[mapped.end..]);
+        }
+
+        self.memory.set_code_size(image_end);
 
-        // Load the program into memory
-        self.memory.set_bytes(Self::STATIC_PROGRAM_ADDRESS, byte_code);
+        // The heap starts right after the program
+        self.modules.allocator.lock().unwrap().set_heap_start(image_end);
+
+        // Decode the program ahead of time so that the instructions don't have to be decoded while executing
+        self.instruction_cache.load(&self.memory, image_end, executable.entry);
 
         self.start_time = SystemTime::now();
 
-        // Execute the program
-        match mode {
-            ExecutionMode::Normal => self.run(),
-            ExecutionMode::Verbose => self.run_verbose(),
-            ExecutionMode::Interactive => self.run_interactive(byte_code.len()),
+        Ok(())
+    }
+
+
+    /// Map the pages of the section at the given address from the file, if the section and its address have the same page alignment.
+    /// Return the mapped range of the section, whose bytes before and after it must be copied
+    fn map_section(&mut self, file: &File, address: Address, section: &Section) -> Range<usize> {
+
+        let page_size = memory::page_size();
+
+        let start = self.memory.align_to_page(address) - address;
+        if start + page_size > section.data.len() || (section.offset + start) % page_size != 0 {
+            return 0..0;
+        }
+
+        // The rest of the last page would be filled with the bytes that follow the section in the file
+        let end = start + (section.data.len() - start) / page_size * page_size;
+
+        match self.memory.map_file(address + start, end - start, file, (section.offset + start) as u64) {
+            Ok(()) => start..end,
+            Err(_) => 0..0
         }
-            
     }
 
 
-    /// Return the length of a null-terminated string
-    fn strlen(&self, address: Address) -> usize {
-        let mut length = 0;
-        let mut byte = self.memory.get_byte(address);
+    /// Execute the given bytecode file, then terminate the process
+    pub fn execute(&mut self, byte_code: &ByteCodeFile, mode: ExecutionMode) -> ! {
+        self.load_file(byte_code).unwrap_or_else(|message| error::error(&message));
+        self.start(mode)
+    }
+
+
+    /// Resume the program saved in the given snapshot, then terminate the process.
+    ///
+    /// The memory image is mapped copy-on-write from the snapshot file, so only the pages the program touches are read
+    pub fn resume(&mut self, snapshot: Snapshot, mode: ExecutionMode) -> ! {
+
+        snapshot.map_memory(&mut self.memory);
+        self.memory.set_code_size(snapshot.code_size);
 
-        while byte != 0 {
-            length += 1;
-            byte = self.memory.get_byte(address + length);
+        for (register, &value) in snapshot.registers.iter().enumerate() {
+            self.registers.set(Registers::from(register as u8), value);
         }
 
-        length
+        *self.modules.allocator.lock().unwrap() = snapshot.allocator;
+
+        // The image may have been modified since it was loaded, so decode it lazily
+        self.instruction_cache.prepare(snapshot.code_size);
+
+        self.start_time = SystemTime::now();
+
+        self.start(mode)
     }
 
 
-    /// Push the stack pointer forward
-    /// Decrement the stack top pointer
-    #[inline]
-    fn push_stack_pointer(&mut self, offset: usize) {
-        self.registers.set(Registers::STACK_TOP_POINTER, self.registers.stack_top() as u64 - offset as u64);
+    /// Run the program in memory from the current program counter until it exits, then terminate the process
+    fn start(&mut self, mode: ExecutionMode) -> ! {
 
-        self.check_stack_overflow();
+        let code_size = self.memory.get_code_size();
+
+        // The process only runs this program from now on, so faults in the guard page can terminate it
+        memory::install_stack_guard_handler(
+            format!("Program exited with code {} ({})\n", ErrorCodes::StackOverflow as u8, ErrorCodes::StackOverflow),
+            ErrorCodes::StackOverflow as i32
+        );
+        self.check_stack_bounds = !self.memory.is_guarded();
+
+        output::install(self.stdout.take().expect("The guest stdout is already installed"));
+
+        if let Some(profiler) = &mut self.profiler {
+            profiler.start(code_size, self.registers.pc());
+        }
+
+        if let Some(tracer) = &self.tracer {
+            self.memory.log_writes(tracer.traces_memory());
+        }
+
+        let result = panic::catch_unwind(AssertUnwindSafe(|| {
+
+            if let Some(snapshot_pc) = self.snapshot.as_ref().and_then(|options| options.at_pc) {
+                self.run_until(snapshot_pc);
+                let registers = self.registers.snapshot();
+                self.save_snapshot(&registers).unwrap_or_else(|err| {
+                    let path = &self.snapshot.as_ref().unwrap().file_path;
+                    error::io_error(path, &err, format!("Failed to save snapshot \"{}\"", path.display()).as_str())
+                });
+            }
+
+            // Execute the program
+            match mode {
+                ExecutionMode::Normal => self.run(),
+                ExecutionMode::Verbose => self.run_verbose(),
+                ExecutionMode::Interactive => self.run_interactive(code_size),
+                ExecutionMode::Jit => self.run_jit(),
+                ExecutionMode::Profile => self.run_profile(),
+                ExecutionMode::Trace => self.run_trace(),
+            }
+        }));
+
+        if let Err(payload) = result {
+            if !payload.is::<Halt>() {
+                panic::resume_unwind(payload);
+            }
+        }
+
+        self.terminate()
     }
 
 
-    /// If the stack has overflowed, set the error register and terminate the program (stack overflow is unrecoverable)
-    fn check_stack_overflow(&mut self) {
-        if (self.registers.get(Registers::STACK_TOP_POINTER) as usize) > self.memory.get_stack_base() {
-            self.registers.set_error(ErrorCodes::StackOverflow);
-            self.handle_instruction(ByteCodes::EXIT);
+    /// Run the loaded program for at most `budget` instructions, or until it exits if there is no budget.
+    ///
+    /// Unlike `execute`, this never terminates the process: the program exit and the fatal VM errors are returned.
+    /// The processor can be moved to another thread between runs
+    pub fn run_for(&mut self, budget: Option<u64>) -> RunState {
+        self.run_embedded(|processor| match budget {
+            Some(budget) => processor.run_budget(budget),
+            None => processor.run(),
+        })
+    }
+
+
+    /// Call the given execution loop, returning the program exit and the fatal VM errors instead of terminating the process
+    fn run_embedded(&mut self, run: impl FnOnce(&mut Self)) -> RunState {
+
+        if let Some(state) = &self.final_state {
+            return state.clone();
+        }
+
+        output::install(self.stdout.take().expect("The guest stdout is already installed"));
+        let was_embedded = error::set_embedded(true);
+        // The guard page would terminate the host process along with the other programs it runs
+        self.check_stack_bounds = true;
+
+        let result = panic::catch_unwind(AssertUnwindSafe(|| run(self)));
+
+        error::set_embedded(was_embedded);
+        self.stdout = output::uninstall();
+
+        let state = match result {
+            Ok(()) => return RunState::Paused,
+            Err(payload) => self.stopped_state(payload)
+        };
+
+        // The other threads can't outlive the program
+        self.modules.threads.stop_all();
+
+        self.final_state = Some(state.clone());
+        state
+    }
+
+
+    /// Return the state of a program that was stopped by the given unwinding payload
+    fn stopped_state(&self, payload: Box<dyn Any + Send>) -> RunState {
+        if payload.is::<Halt>() {
+            return RunState::Exited(ExitStatus {
+                exit_code: self.registers.get(Registers::EXIT) as u8,
+                error: self.registers.get(Registers::ERROR) as u8,
+            });
+        }
+        match payload.downcast::<error::Fault>() {
+            Ok(fault) => RunState::Faulted(fault.0),
+            Err(payload) => RunState::Faulted(panic_message(payload.as_ref())),
         }
     }
 
 
-    /// Pop the stack pointer backwards
-    /// Increment the stack top pointer
-    fn pop_stack_pointer(&mut self, offset: usize) {
-        self.registers.set(Registers::STACK_TOP_POINTER, self.registers.stack_top() as u64 + offset as u64);
+    /// Start a guest thread that executes the code at `entry` with `argument` in r1, on a new stack of `stack_size` bytes allocated on the heap.
+    /// Return the id of the thread.
+    ///
+    /// The thread shares the memory and the modules of the program, but decodes the instructions on its own.
+    /// It isn't profiled, traced or compiled, and can't save snapshots
+    fn spawn_thread(&mut self, entry: Address, argument: u64, stack_size: usize) -> Result<u64, ErrorCodes> {
 
-        self.check_stack_overflow();
+        let heap_limit = self.heap_limit();
+        let stack = self.modules.allocator.lock().unwrap().malloc(stack_size, heap_limit)?;
+
+        let mut thread = Processor {
+            registers: CPURegisters::new(),
+            memory: self.memory.share(),
+            start_time: self.start_time,
+            quiet_exit: true,
+            stdout: Some(output::sibling()),
+            modules: Arc::clone(&self.modules),
+            stack_base: stack + stack_size,
+            stack_limit: stack,
+            // The stack is on the heap, where there is no guard page
+            check_stack_bounds: true,
+            heap_limit: Some(heap_limit),
+            instruction_cache: InstructionCache::new(),
+            jit: Jit::new(),
+            code_reads: HashMap::new(),
+            profiler: None,
+            tracer: None,
+            snapshot: None,
+            final_state: None,
+            perf: ThreadCounters::default(),
+        };
+
+        thread.instruction_cache.prepare(self.memory.get_code_size());
+        thread.registers.set(Registers::PROGRAM_COUNTER, entry as u64);
+        thread.registers.set(Registers::STACK_TOP_POINTER, thread.stack_base as u64);
+        thread.registers.set(Registers::R1, argument);
+
+        let embedded = error::is_embedded();
+
+        let spawned = thread::Builder::new()
+            .name("guest thread".to_string())
+            .spawn(move || {
+                let state = thread.run_thread(embedded);
+                thread.modules.allocator.lock().unwrap().free(stack).ok();
+                state
+            });
+
+        match spawned {
+            Ok(handle) => Ok(self.modules.threads.add(handle)),
+            Err(_) => {
+                self.modules.allocator.lock().unwrap().free(stack).ok();
+                Err(ErrorCodes::GenericError)
+            }
+        }
     }
 
 
-    /// Get the next address in the bytecode
-    #[inline(always)]
-    fn get_next_address(&mut self) -> Address {
-        let pc = self.registers.pc();
-        self.registers.inc_pc(ADDRESS_SIZE);
-        bytes_as_address(self.memory.get_bytes(pc, ADDRESS_SIZE))
+    /// Run a guest thread until it exits, faults or is stopped
+    fn run_thread(&mut self, embedded: bool) -> RunState {
+
+        output::install(self.stdout.take().expect("The guest stdout is already installed"));
+        // Fatal errors behave like in the main thread
+        error::set_embedded(embedded);
+
+        let result = panic::catch_unwind(AssertUnwindSafe(|| {
+            while !self.modules.threads.should_stop() {
+                self.run_budget(THREAD_QUANTUM);
+            }
+        }));
+
+        self.stdout = output::uninstall();
+
+        match result {
+            Ok(()) => RunState::Faulted("The thread was stopped".to_string()),
+            Err(payload) => self.stopped_state(payload)
+        }
     }
 
 
-    /// Increment the `size`-sized value at the given address
-    fn increment_bytes(&mut self, address: Address, size: Byte) {
-        let bytes = self.memory.get_bytes_mut(address, size as usize);
+    /// Wait for the thread with the given id to finish and return its exit code
+    fn join_thread(&mut self, id: u64) -> Result<u64, ErrorCodes> {
+        let thread = self.modules.threads.take(id).ok_or(ErrorCodes::NotFound)?;
+        match thread.join() {
+            Ok(RunState::Exited(status)) if status.error == ErrorCodes::StackOverflow as u8 => Err(ErrorCodes::StackOverflow),
+            Ok(RunState::Exited(status)) => Ok(status.exit_code as u64),
+            _ => Err(ErrorCodes::GenericError)
+        }
+    }
 
-        let (result, carry) = match size {
 
-            1 => {
-                let value = bytes[0];
-                let (res, carry) = {
-                    if let Some(res) = value.checked_add(1) {
-                        (res, false)
-                    } else {
-                        (value.wrapping_add(1), true)
-                    }
-                };
-                bytes[0] = res;
+    /// Return the address the heap may not grow past when this thread allocates
+    #[inline]
+    fn heap_limit(&self) -> Address {
+        self.heap_limit.unwrap_or_else(|| self.registers.stack_top())
+    }
 
-                (res as u64, carry)
-            },
 
-            2 => {
-                let value = u16::from_le_bytes(bytes.try_into().unwrap());
-                let (res, carry) = {
-                    if let Some(res) = value.checked_add(1) {
-                        (res, false)
-                    } else {
-                        (value.wrapping_add(1), true)
-                    }
-                };
-                bytes.copy_from_slice(&res.to_le_bytes());
+    /// Take the output the program wrote so far, if the output is captured
+    pub fn take_output(&mut self) -> Vec<u8> {
+        self.stdout.as_mut().map(GuestStdout::take_captured).unwrap_or_default()
+    }
 
-                (res as u64, carry)
-            },
 
-            4 => {
-                let value = u32::from_le_bytes(bytes.try_into().unwrap());
-                let (res, carry) = {
-                    if let Some(res) = value.checked_add(1) {
-                        (res, false)
-                    } else {
-                        (value.wrapping_add(1), true)
-                    }
-                };
-                bytes.copy_from_slice(&res.to_le_bytes());
+    /// Discard the loaded program and all its state, so that another program can be loaded.
+    /// The memory is zeroed but not reallocated, and the attached storage is kept
+    pub fn reset(&mut self) {
+        self.modules.threads.stop_all();
+        if let Some(storage) = &self.modules.storage {
+            storage.wait_all();
+        }
+        self.modules.host_fs.close_all();
+        self.modules.host_fs.traffic.reset();
+        self.modules.terminal.lock().unwrap().reset();
+        self.modules.events.reset();
+        self.memory.reset();
+        self.registers = CPURegisters::new();
+        *self.modules.allocator.lock().unwrap() = Allocator::new();
+        self.instruction_cache = InstructionCache::new();
+        self.jit = Jit::new();
+        self.code_reads.clear();
+        self.take_output();
+        self.final_state = None;
+        self.perf = ThreadCounters::default();
+        self.modules.module_times.reset();
+        if let Some(storage) = &self.modules.storage {
+            storage.traffic().reset();
+        }
+    }
 
-                (res as u64, carry)
-            },
 
-            8 => {
-                let value = u64::from_le_bytes(bytes.try_into().unwrap());
-                let (res, carry) = {
-                    if let Some(res) = value.checked_add(1) {
-                        (res, false)
-                    } else {
-                        (value.wrapping_add(1), true)
-                    }
-                };
-                bytes.copy_from_slice(&res.to_le_bytes());
+    /// Save the processor state with the given register values to the snapshot file
+    fn save_snapshot(&self, registers: &[u64; REGISTER_COUNT]) -> io::Result<()> {
+        let options = self.snapshot.as_ref().expect("Snapshots are not enabled");
+        // Output written before the snapshot must not be written again by the resumed program
+        output::flush();
+        snapshot::save(&options.file_path, registers, &self.memory, self.modules.storage.as_ref(), &self.modules.allocator.lock().unwrap())
+    }
 
-                (res, carry)
-            },
 
-            _ => error::error(format!("Invalid size for incrementing bytes: {}.", size).as_str()),
+    /// Return the length of a null-terminated string
+    fn strlen(&self, address: Address) -> usize {
+        self.memory.get_raw()[address..].iter().position(|&byte| byte == 0)
+            .unwrap_or_else(|| error::error(format!("String at address {} is not null-terminated", address).as_str()))
+    }
+
+
+    /// Return whether the `size` bytes at `address` are in memory. Otherwise, set the out of bounds error, which bulk memory instructions report instead of faulting
+    #[inline(always)]
+    fn check_bulk_range(&mut self, address: Address, size: usize) -> bool {
+        if address.checked_add(size).is_some_and(|end| end <= self.memory.get_raw().len()) {
+            true
+        } else {
+            self.registers.set_error(ErrorCodes::OutOfBounds);
+            false
+        }
+    }
+
+
+    /// Push the stack pointer forward
+    /// Decrement the stack top pointer
+    #[inline]
+    fn push_stack_pointer(&mut self, offset: usize) {
+        // The stack can only overflow past its limit, since the stack top is never above the stack base
+        let stack_top = match self.registers.stack_top().checked_sub(offset) {
+            Some(stack_top) if stack_top >= self.stack_limit => stack_top,
+            _ => {
+                self.registers.set_error(ErrorCodes::StackOverflow);
+                self.exit();
+            }
         };
 
-        self.set_arithmetical_flags(
-            result == 0,
-            is_msb_set(result),
-            0,
-            carry,
-            carry ^ is_msb_set(result)
-        );
+        self.registers.set(Registers::STACK_TOP_POINTER, stack_top as u64);
     }
-    
-    
-    /// Decrement the `size`-sized value at the given address
-    fn decrement_bytes(&mut self, address: Address, size: Byte) {
-        let bytes = self.memory.get_bytes_mut(address, size as usize);
 
-        let (result, carry) = match size {
 
-            1 => {
-                let value = bytes[0];
-                let (res, carry) = {
-                    if let Some(res) = value.checked_sub(1) {
-                        (res, false)
-                    } else {
-                        (value.wrapping_sub(1), true)
-                    }
-                };
-                bytes[0] = res;
+    /// If the stack has overflowed, set the error register and terminate the program (stack overflow is unrecoverable)
+    fn check_stack_overflow(&mut self) {
+        if (self.registers.get(Registers::STACK_TOP_POINTER) as usize) > self.stack_base {
+            self.registers.set_error(ErrorCodes::StackOverflow);
+            self.exit();
+        }
+    }
 
-                (res as u64, carry)
-            },
 
-            2 => {
-                let value = u16::from_le_bytes(bytes.try_into().unwrap());
-                let (res, carry) = {
-                    if let Some(res) = value.checked_sub(1) {
-                        (res, false)
-                    } else {
-                        (value.wrapping_sub(1), true)
-                    }
-                };
-                bytes.copy_from_slice(&res.to_le_bytes());
+    /// Pop the stack pointer backwards
+    /// Increment the stack top pointer
+    fn pop_stack_pointer(&mut self, offset: usize) {
+        self.registers.set(Registers::STACK_TOP_POINTER, self.registers.stack_top() as u64 + offset as u64);
 
-                (res as u64, carry)
-            },
+        self.check_stack_overflow();
+    }
 
-            4 => {
-                let value = u32::from_le_bytes(bytes.try_into().unwrap());
-                let (res, carry) = {
-                    if let Some(res) = value.checked_sub(1) {
-                        (res, false)
-                    } else {
-                        (value.wrapping_sub(1), true)
-                    }
-                };
-                bytes.copy_from_slice(&res.to_le_bytes());
 
-                (res as u64, carry)
-            },
+    /// Increment the `size`-sized value at the given address
+    fn increment_bytes(&mut self, address: Address, size: Byte) {
+        match_sized!(size, "incrementing bytes", |SIZE| self.step_sized::<SIZE>(address, true))
+    }
 
-            8 => {
-                let value = u64::from_le_bytes(bytes.try_into().unwrap());
-                let (res, carry) = {
-                    if let Some(res) = value.checked_sub(1) {
-                        (res, false)
-                    } else {
-                        (value.wrapping_sub(1), true)
-                    }
-                };
-                bytes.copy_from_slice(&res.to_le_bytes());
 
-                (res, carry)
-            },
+    /// Decrement the `size`-sized value at the given address
+    fn decrement_bytes(&mut self, address: Address, size: Byte) {
+        match_sized!(size, "decrementing bytes", |SIZE| self.step_sized::<SIZE>(address, false))
+    }
 
-            _ => error::error(format!("Invalid size for decrementing bytes: {}.", size).as_str()),
+
+    /// Increment or decrement the `SIZE` bytes long value at the given address.
+    /// The carry flag is set if the value wraps around at its size
+    #[inline(always)]
+    fn step_sized<const SIZE: usize>(&mut self, address: Address, increment: bool) {
+        let value = self.load_sized::<SIZE>(address);
+        let max = u64::MAX >> (64 - SIZE * 8);
+
+        let (result, carry) = if increment {
+            (value.wrapping_add(1) & max, value == max)
+        } else {
+            (value.wrapping_sub(1) & max, value == 0)
         };
 
-        self.set_arithmetical_flags(
-            result == 0,
-            is_msb_set(result),
-            0,
-            carry,
-            carry ^ is_msb_set(result)
-        );
+        self.store_sized::<SIZE>(address, result);
+        self.registers.set_flags(LazyFlags::Carry(result, carry));
     }
 
 
     /// Mobe a number of bytes from the given address into the given register
     fn move_bytes_into_register(&mut self, src_address: Address, dest_reg: Registers, handled_size: Byte) {
-        let bytes = self.memory.get_bytes(src_address, handled_size as usize);
-        self.registers.set(
-            dest_reg,
-            bytes_to_int(bytes, handled_size)
-        );
+        let value = self.load_bytes(src_address, handled_size);
+        self.registers.set(dest_reg, value);
     }
 
 
@@ -396,77 +784,204 @@ impl Processor {
     /// Pop `size` bytes from the stack
     fn pop_stack_bytes(&mut self, size: usize) -> &[Byte] {
 
-        self.pop_stack_pointer(size);
+        let stack_top = self.registers.stack_top();
+
+        if self.check_stack_bounds && stack_top + size > self.stack_base {
+            self.registers.set_error(ErrorCodes::StackOverflow);
+            self.exit();
+        }
+
+        self.registers.set(Registers::STACK_TOP_POINTER, (stack_top + size) as u64);
 
-        // Subtract the size from the stack top pointer to get the address of the previous top of the stack
-        self.memory.get_bytes(
-            self.registers.stack_top() - size,
-            size,
-        )
+        // Otherwise, popping past the stack base reads the guard page after the end of memory, which terminates the process with a stack overflow error
+        self.memory.get_stack_bytes(stack_top, size)
     }
 
 
     /// Move a number of bytes from the given register into the given address
     fn move_from_register_into_address(&mut self, src_reg: Registers, dest_address: Address, handled_size: Byte) {
         let value = self.registers.get(src_reg);
-
-        match handled_size {
-            1 => self.memory.set_bytes(dest_address, &(value as u8).to_le_bytes()),
-            2 => self.memory.set_bytes(dest_address, &(value as u16).to_le_bytes()),
-            4 => self.memory.set_bytes(dest_address, &(value as u32).to_le_bytes()),
-            8 => self.memory.set_bytes(dest_address, &value.to_le_bytes()),
-            _ => error::error(format!("Invalid size for move instruction {}.", handled_size).as_str()),
-        }
+        self.store_bytes(dest_address, value, handled_size);
     }
         
     
-    /// Get the next `size` bytes in the bytecode
-    fn get_next_bytes(&mut self, size: usize) -> &[Byte] {
-        let pc = self.registers.pc();
-        self.registers.inc_pc(size);
-        self.memory.get_bytes(pc, size)
+    /// Discard the decoded and compiled instructions whose code was overwritten by the last instruction
+    #[inline(always)]
+    fn sync_code_writes(&mut self) {
+        if let Some((start, end)) = self.memory.take_code_writes() {
+            self.instruction_cache.invalidate(start, end);
+            self.jit.invalidate(start, end);
+        }
+    }
+
+
+    /// Discard the decoded and compiled instructions overwritten by the storage read with the given id, which was collected
+    fn sync_code_read(&mut self, id: u64) {
+        if let Some((start, end)) = self.code_reads.remove(&id) {
+            self.instruction_cache.invalidate(start, end);
+            self.jit.invalidate(start, end);
+        }
     }
 
 
-    /// Get the next byte in the bytecode
-    fn get_next_byte(&mut self) -> Byte {
-        let pc = self.registers.pc();
-        self.registers.inc_pc(1);
-        self.memory.get_byte(pc)
+    /// Fetch the decoded instruction at the program counter and move the program counter past it
+    #[inline(always)]
+    fn fetch_instruction(&mut self) -> DecodedInstruction {
+
+        self.sync_code_writes();
+
+        let instruction = self.instruction_cache.fetch(self.registers.pc(), &self.memory);
+        self.registers.inc_pc(instruction.size as usize);
+        self.perf.instructions += 1;
+        instruction
     }
 
 
     fn run(&mut self) {
         loop {
-            let opcode = ByteCodes::from(self.get_next_byte());
-            self.handle_instruction(opcode);
+            let instruction = self.fetch_instruction();
+            self.handle_instruction(instruction);
         }
     }
 
 
-    fn run_interactive(&mut self, byte_code_size: usize) {
+    /// Interpret at most `budget` instructions
+    fn run_budget(&mut self, budget: u64) {
+        for _ in 0..budget {
+            let instruction = self.fetch_instruction();
+            self.handle_instruction(instruction);
+        }
+    }
 
-        println!("Running VM in interactive mode");
-        println!("Byte code size is {} bytes", byte_code_size);
-        println!("Start address is: {:#X}", self.registers.pc());
-        println!();
 
-        loop {
+    /// Interpret the program until the program counter reaches `address`. The program may exit before that
+    fn run_until(&mut self, address: Address) {
+        while self.registers.pc() != address {
+            let instruction = self.fetch_instruction();
+            self.handle_instruction(instruction);
+        }
+    }
 
-            let previous_args = self.memory.get_bytes(
-                self.interactive_last_instruction_pc,
-                self.registers.pc().saturating_sub(self.interactive_last_instruction_pc)
-            );
-            println!("Previous args: {:?}", previous_args);
 
-            let opcode = ByteCodes::from(self.get_next_byte());
+    /// Execute hot basic blocks as native code and interpret the rest
+    fn run_jit(&mut self) {
+        loop {
+            self.sync_code_writes();
 
-            self.interactive_last_instruction_pc = self.registers.pc();
+            if self.jit.try_execute(self.registers.pc(), &mut self.registers, &mut self.memory) {
+                continue;
+            }
 
-            println!();
+            // Interpret the basic block
+            loop {
+                let instruction = self.fetch_instruction();
+                self.handle_instruction(instruction);
 
-            println!("PC: {}, opcode: {}", self.registers.pc(), opcode);
-            println!("Registers: {}", self.display_registers());
+                if jit::ends_basic_block(instruction.opcode) {
+                    break;
+                }
+            }
+        }
+    }
+
+
+    /// Interpret the program while collecting execution statistics
+    fn run_profile(&mut self) {
+        loop {
+            let pc = self.registers.pc();
+            let instruction = self.fetch_instruction();
+
+            self.profiler.as_mut().expect("Profile mode requires profile options").record_instruction(pc, instruction.opcode);
+
+            self.handle_instruction(instruction);
+
+            let profiler = self.profiler.as_mut().unwrap();
+            match instruction.opcode {
+                ByteCodes::CALL |
+                ByteCodes::PUSH_FROM_REG_CALL |
+                ByteCodes::PUSH_FROM_CONST_CALL
+                    => profiler.enter_function(self.registers.pc()),
+
+                ByteCodes::RETURN |
+                ByteCodes::POP_INTO_REG_RETURN
+                    => profiler.leave_function(),
+
+                _ => {}
+            }
+        }
+    }
+
+
+    /// Interpret the program while recording the executed instructions and their effects
+    fn run_trace(&mut self) {
+        loop {
+            let pc = self.registers.pc();
+            let instruction = self.fetch_instruction();
+
+            self.memory.clear_write_log();
+
+            let tracer = self.tracer.as_mut().expect("Trace mode requires trace options");
+            if !tracer.traces(pc) {
+                self.handle_instruction(instruction);
+                continue;
+            }
+
+            tracer.record(TraceRecord::Instruction {
+                pc,
+                opcode: instruction.opcode as u8,
+                handled_size: instruction.handled_size,
+                reg1: instruction.reg1 as u8,
+                reg2: instruction.reg2 as u8,
+                condition: instruction.condition as u8,
+                arg1: instruction.arg1,
+                arg2: instruction.arg2,
+                target: instruction.target,
+            });
+
+            let registers_before = if tracer.traces_registers() { Some(self.registers.snapshot()) } else { None };
+
+            self.handle_instruction(instruction);
+
+            let tracer = self.tracer.as_mut().unwrap();
+
+            if let Some(registers_before) = registers_before {
+                let registers_after = self.registers.snapshot();
+                for (register, (&before, &after)) in registers_before.iter().zip(registers_after.iter()).enumerate() {
+                    // The program counter is implied by the next instruction record
+                    if before != after && register != Registers::PROGRAM_COUNTER as usize {
+                        tracer.record(TraceRecord::Register { register: register as u8, value: after });
+                    }
+                }
+            }
+
+            for &(address, size) in self.memory.write_log() {
+                let data = self.memory.get_bytes(address, size.min(8));
+                let mut bytes = [0; 8];
+                bytes[..data.len()].copy_from_slice(data);
+                tracer.record(TraceRecord::Memory { address, size, data: u64::from_le_bytes(bytes) });
+            }
+        }
+    }
+
+
+    fn run_interactive(&mut self, byte_code_size: usize) {
+
+        println!("Running VM in interactive mode");
+        println!("Byte code size is {} bytes", byte_code_size);
+        println!("Start address is: {:#X}", self.registers.pc());
+        println!();
+
+        loop {
+
+            let pc = self.registers.pc();
+            let instruction = self.fetch_instruction();
+
+            output::flush();
+            println!();
+
+            println!("PC: {}, opcode: {}", pc, instruction.opcode);
+            println!("Args: {:?}", self.memory.get_bytes(pc + 1, instruction.size as usize - 1));
+            println!("Registers: {}", self.display_registers());
 
             const MAX_STACK_VIEW_RANGE: usize = 32;
             let stack_top = self.memory.get_stack_base() - self.registers.get(Registers::STACK_TOP_POINTER) as Address;
@@ -480,13 +995,13 @@ impl Processor {
 
             io::stdin().read_line(&mut String::new()).unwrap();
 
-            self.handle_instruction(opcode);
+            self.handle_instruction(instruction);
 
         }
     }
 
 
-    fn display_registers(&self) -> String {
+    fn display_registers(&mut self) -> String {
         self.registers.iter().enumerate().fold(String::new(), |mut output, (i, reg)| {
             output.push_str(format!("{}: {}, ", Registers::from(i as u8), reg).as_str());
             output
@@ -496,15 +1011,20 @@ impl Processor {
 
     fn run_verbose(&mut self) {
         loop {
-            let opcode = ByteCodes::from(self.get_next_byte());
-            println!("PC: {}, opcode: {}", self.registers.pc(), opcode);
-            self.handle_instruction(opcode);
+            let pc = self.registers.pc();
+            let instruction = self.fetch_instruction();
+            output::flush();
+            println!("PC: {}, opcode: {}", pc, instruction.opcode);
+            self.handle_instruction(instruction);
         }
     }
 
     
-    fn handle_instruction(&mut self, opcode: ByteCodes) {
-        match opcode {
+    fn handle_instruction(&mut self, instruction: DecodedInstruction) {
+
+        let DecodedInstruction { handled_size: size, reg1, reg2, arg1, arg2, .. } = instruction;
+
+        match instruction.opcode {
 
             ByteCodes::INTEGER_ADD => {
                 let r1 = self.registers.get(Registers::R1);
@@ -517,13 +1037,7 @@ impl Processor {
 
                 self.registers.set(Registers::R1, result);
 
-                self.set_arithmetical_flags(
-                    result == 0,
-                    is_msb_set(result),
-                    0,
-                    carry,
-                    carry ^ is_msb_set(result)
-                );
+                self.registers.set_flags(LazyFlags::Carry(result, carry));
             },
 
             ByteCodes::INTEGER_SUB => {
@@ -537,13 +1051,7 @@ impl Processor {
 
                 self.registers.set(Registers::R1, result);
 
-                self.set_arithmetical_flags(
-                    result == 0,
-                    is_msb_set(result),
-                    0,
-                    carry,
-                    carry ^ is_msb_set(result)
-                );
+                self.registers.set_flags(LazyFlags::Carry(result, carry));
             },
 
             ByteCodes::INTEGER_MUL => {
@@ -557,13 +1065,7 @@ impl Processor {
 
                 self.registers.set(Registers::R1, result);
 
-                self.set_arithmetical_flags(
-                    result == 0,
-                    is_msb_set(result),
-                    0,
-                    carry,
-                    carry ^ is_msb_set(result)
-                );
+                self.registers.set_flags(LazyFlags::Carry(result, carry));
             },
 
             ByteCodes::INTEGER_DIV => {
@@ -580,13 +1082,7 @@ impl Processor {
                 
                 self.registers.set(Registers::R1, result);
         
-                self.set_arithmetical_flags(
-                    result == 0,
-                    is_msb_set(result),
-                    r1 % r2,
-                    false,
-                    false
-                );  
+                self.registers.set_flags(LazyFlags::Remainder(result, r1 % r2));
             },
 
             ByteCodes::INTEGER_MOD => {
@@ -602,13 +1098,7 @@ impl Processor {
 
                 self.registers.set(Registers::R1, result);
 
-                self.set_arithmetical_flags(
-                    result == 0,
-                    is_msb_set(result),
-                    0,
-                    false,
-                    false
-                );
+                self.registers.set_flags(LazyFlags::Result(result));
             },
 
             ByteCodes::FLOAT_ADD => {
@@ -619,14 +1109,7 @@ impl Processor {
 
                 self.registers.set(Registers::R1, result as u64);
 
-                self.set_arithmetical_flags(
-                    result == 0.0,
-                    result.is_sign_negative(),
-                    // Use unused integer flags as float flags
-                    result.is_nan() as u64,
-                    result.is_infinite() && result.is_sign_positive(),
-                    result.is_infinite() && result.is_sign_negative()
-                );
+                self.registers.set_flags(LazyFlags::Float(result));
             },
 
             ByteCodes::FLOAT_SUB => {
@@ -637,14 +1120,7 @@ impl Processor {
         
                 self.registers.set(Registers::R1, result as u64);
         
-                self.set_arithmetical_flags(
-                    result == 0.0,
-                    result.is_sign_negative(),
-                    // Use unused integer flags as float flags
-                    result.is_nan() as u64,
-                    result.is_infinite() && result.is_sign_positive(),
-                    result.is_infinite() && result.is_sign_negative()
-                );
+                self.registers.set_flags(LazyFlags::Float(result));
             },
 
             ByteCodes::FLOAT_MUL => {
@@ -655,14 +1131,7 @@ impl Processor {
         
                 self.registers.set(Registers::R1, result as u64);
         
-                self.set_arithmetical_flags(
-                    result == 0.0,
-                    result.is_sign_negative(),
-                    // Use unused integer flags as float flags
-                    result.is_nan() as u64,
-                    result.is_infinite() && result.is_sign_positive(),
-                    result.is_infinite() && result.is_sign_negative()
-                );
+                self.registers.set_flags(LazyFlags::Float(result));
             },
 
             ByteCodes::FLOAT_DIV => {
@@ -673,14 +1142,7 @@ impl Processor {
         
                 self.registers.set(Registers::R1, result as u64);
         
-                self.set_arithmetical_flags(
-                    result == 0.0,
-                    result.is_sign_negative(),
-                    // Use unused integer flags as float flags
-                    result.is_nan() as u64,
-                    result.is_infinite() && result.is_sign_positive(),
-                    result.is_infinite() && result.is_sign_negative()
-                );
+                self.registers.set_flags(LazyFlags::Float(result));
             },
 
             ByteCodes::FLOAT_MOD => {
@@ -691,18 +1153,11 @@ impl Processor {
         
                 self.registers.set(Registers::R1, result as u64);
         
-                self.set_arithmetical_flags(
-                    result == 0.0,
-                    result.is_sign_negative(),
-                    // Use unused integer flags as float flags
-                    result.is_nan() as u64,
-                    result.is_infinite() && result.is_sign_positive(),
-                    result.is_infinite() && result.is_sign_negative()
-                );
+                self.registers.set_flags(LazyFlags::Float(result));
             },
 
             ByteCodes::INC_REG => {
-                let dest_reg = Registers::from(self.get_next_byte());
+                let dest_reg = reg1;
                 let value = self.registers.get(dest_reg);
         
                 let (result, carry) = match value.checked_add(1) {
@@ -712,32 +1167,24 @@ impl Processor {
         
                 self.registers.set(dest_reg, result);
         
-                self.set_arithmetical_flags(
-                    result == 0,
-                    is_msb_set(result),
-                    0,
-                    carry,
-                    carry ^ is_msb_set(result)
-                );  
+                self.registers.set_flags(LazyFlags::Carry(result, carry));  
             },
 
             ByteCodes::INC_ADDR_IN_REG => {
-                let size = self.get_next_byte();
-                let address_reg = Registers::from(self.get_next_byte());
+                let address_reg = reg1;
                 let address: Address = self.registers.get(address_reg) as Address;
                 
                 self.increment_bytes(address, size);
             },
 
             ByteCodes::INC_ADDR_LITERAL => {
-                let size = self.get_next_byte();
-                let dest_address = self.get_next_address();
+                let dest_address = arg1 as Address;
                 
                 self.increment_bytes(dest_address, size);
             },
 
             ByteCodes::DEC_REG => {
-                let dest_reg = Registers::from(self.get_next_byte());
+                let dest_reg = reg1;
                 let value = self.registers.get(dest_reg);
         
                 let (result, carry) = match value.checked_sub(1) {
@@ -747,26 +1194,18 @@ impl Processor {
         
                 self.registers.set(dest_reg, result);
         
-                self.set_arithmetical_flags(
-                    result == 0,
-                    is_msb_set(result),
-                    0,
-                    carry,
-                    carry ^ is_msb_set(result)
-                );
+                self.registers.set_flags(LazyFlags::Carry(result, carry));
             },
 
             ByteCodes::DEC_ADDR_IN_REG => {
-                let size = self.get_next_byte();
-                let address_reg = Registers::from(self.get_next_byte());
+                let address_reg = reg1;
                 let address: Address = self.registers.get(address_reg) as Address;
                 
                 self.decrement_bytes(address, size);
             },
 
             ByteCodes::DEC_ADDR_LITERAL => {
-                let size = self.get_next_byte();
-            let dest_address = self.get_next_address();
+            let dest_address = arg1 as Address;
             
             self.decrement_bytes(dest_address, size);
             },
@@ -776,52 +1215,41 @@ impl Processor {
             },
 
             ByteCodes::MOVE_INTO_REG_FROM_REG => {
-                let dest_reg = Registers::from(self.get_next_byte());
-                let source_reg = Registers::from(self.get_next_byte());
+                let dest_reg = reg1;
+                let source_reg = reg2;
                 self.registers.set(dest_reg, self.registers.get(source_reg));
             },
 
             ByteCodes::MOVE_INTO_REG_FROM_ADDR_IN_REG => {
-                let size = self.get_next_byte();
-                let dest_reg = Registers::from(self.get_next_byte());
-                let address_reg = Registers::from(self.get_next_byte());
+                let dest_reg = reg1;
+                let address_reg = reg2;
                 let src_address = self.registers.get(address_reg) as Address;
 
                 self.move_bytes_into_register(src_address, dest_reg, size);
             },
 
             ByteCodes::MOVE_INTO_REG_FROM_CONST => {
-                let size = self.get_next_byte();
-                let dest_reg = Registers::from(self.get_next_byte());
-        
-                // Hack the borrow checker
-                let src_address = self.registers.pc();
-        
-                self.move_bytes_into_register(src_address, dest_reg, size);
-                self.registers.inc_pc(size as usize);
+                self.registers.set(reg1, arg2);
             },
             
             ByteCodes::MOVE_INTO_REG_FROM_ADDR_LITERAL => {
-                let size = self.get_next_byte();
-                let dest_reg = Registers::from(self.get_next_byte());
-                let src_address = self.get_next_address();
+                let dest_reg = reg1;
+                let src_address = arg2 as Address;
 
                 self.move_bytes_into_register(src_address, dest_reg, size);
             },
             
             ByteCodes::MOVE_INTO_ADDR_IN_REG_FROM_REG => {
-                let size = self.get_next_byte();
-                let dest_address_reg = Registers::from(self.get_next_byte());
-                let src_reg = Registers::from(self.get_next_byte());
+                let dest_address_reg = reg1;
+                let src_reg = reg2;
                 let dest_address = self.registers.get(dest_address_reg) as Address;
 
                 self.move_from_register_into_address(src_reg, dest_address, size);
             },
             
             ByteCodes::MOVE_INTO_ADDR_IN_REG_FROM_ADDR_IN_REG => {
-                let size = self.get_next_byte();
-                let dest_address_reg = Registers::from(self.get_next_byte());
-                let src_address_reg = Registers::from(self.get_next_byte());
+                let dest_address_reg = reg1;
+                let src_address_reg = reg2;
                 let dest_address = self.registers.get(dest_address_reg) as Address;
                 let src_address = self.registers.get(src_address_reg) as Address;
                 
@@ -829,139 +1257,110 @@ impl Processor {
             },
             
             ByteCodes::MOVE_INTO_ADDR_IN_REG_FROM_CONST => {
-                let size = self.get_next_byte();
-                let dest_address_reg = Registers::from(self.get_next_byte());
-                let dest_address = self.registers.get(dest_address_reg) as Address;
-                let src_address = self.registers.pc();
-                
-                self.memory.memcpy(src_address, dest_address, size as usize);
-                self.registers.inc_pc(size as usize);
+                let dest_address = self.registers.get(reg1) as Address;
+
+                self.memory.set_bytes(dest_address, &arg2.to_le_bytes()[..size as usize]);
             },
             
             ByteCodes::MOVE_INTO_ADDR_IN_REG_FROM_ADDR_LITERAL => {
-                let size = self.get_next_byte();
-                let dest_address_reg = Registers::from(self.get_next_byte());
+                let dest_address_reg = reg1;
                 let dest_address = self.registers.get(dest_address_reg) as Address;
-                let src_address = self.get_next_address();
+                let src_address = arg2 as Address;
         
                 self.memory.memcpy(src_address, dest_address, size as usize);
             },
             
             ByteCodes::MOVE_INTO_ADDR_LITERAL_FROM_REG => {
-                let size = self.get_next_byte();
-                let dest_address = self.get_next_address();
-                let src_reg = Registers::from(self.get_next_byte());
+                let dest_address = arg1 as Address;
+                let src_reg = reg2;
         
                 self.move_from_register_into_address(src_reg, dest_address, size);
             },
             
             ByteCodes::MOVE_INTO_ADDR_LITERAL_FROM_ADDR_IN_REG => {
-                let size = self.get_next_byte();
-                let dest_address = self.get_next_address();
-                let src_address_reg = Registers::from(self.get_next_byte());
+                let dest_address = arg1 as Address;
+                let src_address_reg = reg2;
                 let src_address = self.registers.get(src_address_reg) as Address;
         
                 self.memory.memcpy(src_address, dest_address, size as usize);  
             },
             
             ByteCodes::MOVE_INTO_ADDR_LITERAL_FROM_CONST => {
-                let size = self.get_next_byte();
-                let dest_address = self.get_next_address();
-                let src_address = self.registers.pc();
+                let dest_address = arg1 as Address;
         
-                self.memory.memcpy(src_address, dest_address, size as usize);
-                self.registers.inc_pc(size as usize);
+                self.memory.set_bytes(dest_address, &arg2.to_le_bytes()[..size as usize]);
             },
             
             ByteCodes::MOVE_INTO_ADDR_LITERAL_FROM_ADDR_LITERAL => {
-                let size = self.get_next_byte();
-                let dest_address = self.get_next_address();
-                let src_address = self.get_next_address();
+                let dest_address = arg1 as Address;
+                let src_address = arg2 as Address;
 
                 self.memory.memcpy(src_address, dest_address, size as usize);
             },
             
             ByteCodes::PUSH_FROM_REG => {
-                let src_reg = Registers::from(self.get_next_byte());
+                let src_reg = reg1;
 
                 self.push_stack(self.registers.get(src_reg));
             },
             
             ByteCodes::PUSH_FROM_ADDR_IN_REG => {
-                let size = self.get_next_byte();
-
-                let src_address_reg = Registers::from(self.get_next_byte());
+                let src_address_reg = reg1;
                 let src_address = self.registers.get(src_address_reg) as Address;
         
                 self.push_stack_from_address(src_address, size as usize);  
             },
             
             ByteCodes::PUSH_FROM_CONST => {
-                let size = self.get_next_byte();
-
-                // Hack to get around the borrow checker
-                self.push_stack_from_address(self.registers.pc(), size as usize);
-                self.registers.inc_pc(size as usize);
+                self.push_stack_bytes(&arg1.to_le_bytes()[..size as usize]);
             },
             
             ByteCodes::PUSH_FROM_ADDR_LITERAL => {
-                let size = self.get_next_byte();
-
-                let src_address = self.get_next_address();
+                let src_address = arg1 as Address;
 
                 self.push_stack_from_address(src_address, size as usize);
             },
             
             ByteCodes::PUSH_STACK_POINTER_REG => {
-                let reg = Registers::from(self.get_next_byte());
+                let reg = reg1;
                 let offset = self.registers.get(reg);
         
                 self.push_stack_pointer(offset as usize);
             },
             
             ByteCodes::PUSH_STACK_POINTER_ADDR_IN_REG => {
-                let size = self.get_next_byte();
-
-                let address_reg = Registers::from(self.get_next_byte());
+                let address_reg = reg1;
                 let address = self.registers.get(address_reg) as Address;
         
-                let offset = bytes_to_int(self.memory.get_bytes(address, size as usize), size);
+                let offset = self.load_bytes(address, size);
         
                 self.push_stack_pointer(offset as usize);
             },
             
             ByteCodes::PUSH_STACK_POINTER_CONST => {
-                let size = self.get_next_byte();
-
-                let offset = bytes_to_int(self.get_next_bytes(size as usize), size);
+                let offset = arg1;
         
                 self.push_stack_pointer(offset as usize);  
             },
             
             ByteCodes::PUSH_STACK_POINTER_ADDR_LITERAL => {
-                let size = self.get_next_byte();
-
-                let address = self.get_next_address();
+                let address = arg1 as Address;
         
-                let offset = bytes_to_int(self.memory.get_bytes(address, size as usize), size);
+                let offset = self.load_bytes(address, size);
         
                 self.push_stack_pointer(offset as usize);
             },
             
             ByteCodes::POP_INTO_REG => {
-                let size = self.get_next_byte();
-
-                let dest_reg = Registers::from(self.get_next_byte());
+                let dest_reg = reg1;
                 let bytes = self.pop_stack_bytes(size as usize);
-                let value = bytes_to_int(bytes, size);
+                let value = bytes_to_int(bytes);
         
                 self.registers.set(dest_reg, value);
             },
             
             ByteCodes::POP_INTO_ADDR_IN_REG => {
-                let size = self.get_next_byte();
-
-                let dest_address_reg = Registers::from(self.get_next_byte());
+                let dest_address_reg = reg1;
                 let dest_address = self.registers.get(dest_address_reg) as Address;
         
                 self.memory.memcpy(self.registers.stack_top(), dest_address, size as usize);
@@ -970,9 +1369,7 @@ impl Processor {
             },
             
             ByteCodes::POP_INTO_ADDR_LITERAL => {
-                let size = self.get_next_byte();
-
-                let dest_address = self.get_next_address();
+                let dest_address = arg1 as Address;
         
                 self.memory.memcpy(self.registers.stack_top(), dest_address, size as usize);
         
@@ -980,37 +1377,31 @@ impl Processor {
             },
             
             ByteCodes::POP_STACK_POINTER_REG => {
-                let reg = Registers::from(self.get_next_byte());
+                let reg = reg1;
                 let offset = self.registers.get(reg);
 
                 self.pop_stack_pointer(offset as usize);
             },
             
             ByteCodes::POP_STACK_POINTER_ADDR_IN_REG => {
-                let size = self.get_next_byte();
-
-                let address_reg = Registers::from(self.get_next_byte());
+                let address_reg = reg1;
                 let address = self.registers.get(address_reg) as Address;
         
-                let offset = bytes_to_int(self.memory.get_bytes(address, size as usize), size);
+                let offset = self.load_bytes(address, size);
         
                 self.pop_stack_pointer(offset as usize);
             },
             
             ByteCodes::POP_STACK_POINTER_CONST => {
-                let size = self.get_next_byte();
-
-                let offset = bytes_to_int(self.get_next_bytes(size as usize), size);
+                let offset = arg1;
         
                 self.pop_stack_pointer(offset as usize);
             },
             
             ByteCodes::POP_STACK_POINTER_ADDR_LITERAL => {
-                let size = self.get_next_byte();
-
-                let address = self.get_next_address();
+                let address = arg1 as Address;
         
-                let offset = bytes_to_int(self.memory.get_bytes(address, size as usize), size);
+                let offset = self.load_bytes(address, size);
         
                 self.pop_stack_pointer(offset as usize);
             },
@@ -1020,110 +1411,86 @@ impl Processor {
             },
             
             ByteCodes::JUMP => {
-                let addr = self.get_next_address();
+                let addr = arg1 as Address;
                 self.jump_to(addr);
             },
             
             ByteCodes::JUMP_NOT_ZERO => {
-                let jump_address = self.get_next_address();
-
-                if self.registers.get(Registers::ZERO_FLAG) == 0 {
-                    self.jump_to(jump_address);
+                if self.check_condition(JumpCondition::NotZero) {
+                    self.jump_to(arg1 as Address);
                 }
             },
             
             ByteCodes::JUMP_ZERO => {
-                let jump_address = self.get_next_address();
-
-                if self.registers.get(Registers::ZERO_FLAG) == 1 {
-                    self.jump_to(jump_address);
+                if self.check_condition(JumpCondition::Zero) {
+                    self.jump_to(arg1 as Address);
                 }
             },
             
             ByteCodes::JUMP_GREATER => {
-                let jump_address = self.get_next_address();
-
-                if self.registers.get(Registers::SIGN_FLAG) == self.registers.get(Registers::OVERFLOW_FLAG)
-                    && self.registers.get(Registers::ZERO_FLAG) == 0 {
-                    self.jump_to(jump_address);
+                if self.check_condition(JumpCondition::Greater) {
+                    self.jump_to(arg1 as Address);
                 }
             },
             
             ByteCodes::JUMP_LESS => {
-                let jump_address = self.get_next_address();
-
-                if self.registers.get(Registers::SIGN_FLAG) != self.registers.get(Registers::OVERFLOW_FLAG) {
-                    self.jump_to(jump_address);
+                if self.check_condition(JumpCondition::Less) {
+                    self.jump_to(arg1 as Address);
                 }
             },
             
             ByteCodes::JUMP_GREATER_OR_EQUAL => {
-                let jump_address = self.get_next_address();
-
-                if self.registers.get(Registers::SIGN_FLAG) == self.registers.get(Registers::OVERFLOW_FLAG) {
-                    self.jump_to(jump_address);
+                if self.check_condition(JumpCondition::GreaterOrEqual) {
+                    self.jump_to(arg1 as Address);
                 }
             },
             
             ByteCodes::JUMP_LESS_OR_EQUAL => {
-                let jump_address = self.get_next_address();
-
-                if self.registers.get(Registers::SIGN_FLAG) != self.registers.get(Registers::OVERFLOW_FLAG)
-                    || self.registers.get(Registers::ZERO_FLAG) == 1 {
-                    self.jump_to(jump_address);
+                if self.check_condition(JumpCondition::LessOrEqual) {
+                    self.jump_to(arg1 as Address);
                 }
             },
             
             ByteCodes::JUMP_CARRY => {
-                let jump_address = self.get_next_address();
-
-                if self.registers.get(Registers::CARRY_FLAG) == 1 {
-                    self.jump_to(jump_address);
+                if self.check_condition(JumpCondition::Carry) {
+                    self.jump_to(arg1 as Address);
                 }
             },
             
             ByteCodes::JUMP_NOT_CARRY => {
-                let jump_address = self.get_next_address();
-
-                if self.registers.get(Registers::CARRY_FLAG) == 0 {
-                    self.jump_to(jump_address);
+                if self.check_condition(JumpCondition::NotCarry) {
+                    self.jump_to(arg1 as Address);
                 }
             },
             
             ByteCodes::JUMP_OVERFLOW => {
-                let jump_address = self.get_next_address();
-
-                if self.registers.get(Registers::OVERFLOW_FLAG) == 1 {
-                    self.jump_to(jump_address);
+                if self.check_condition(JumpCondition::Overflow) {
+                    self.jump_to(arg1 as Address);
                 }
             },
             
             ByteCodes::JUMP_NOT_OVERFLOW => {
-                let jump_address = self.get_next_address();
-
-                if self.registers.get(Registers::OVERFLOW_FLAG) == 0 {
-                    self.jump_to(jump_address);
+                if self.check_condition(JumpCondition::NotOverflow) {
+                    self.jump_to(arg1 as Address);
                 }
             },
             
             ByteCodes::JUMP_SIGN => {
-                let jump_address = self.get_next_address();
-
-                if self.registers.get(Registers::SIGN_FLAG) == 1 {
-                    self.jump_to(jump_address);
-                }  
+                if self.check_condition(JumpCondition::Sign) {
+                    self.jump_to(arg1 as Address);
+                }
             },
             
             ByteCodes::JUMP_NOT_SIGN => {
-                let jump_address = self.get_next_address();
-
-                if self.registers.get(Registers::SIGN_FLAG) == 0 {
-                    self.jump_to(jump_address);
+                if self.check_condition(JumpCondition::NotSign) {
+                    self.jump_to(arg1 as Address);
                 }
             },
             
             ByteCodes::CALL => {
-                let jump_address = self.get_next_address();
+                let jump_address = arg1 as Address;
+
+                self.perf.calls += 1;
 
                 // Push the return address onto the stack (return address is the current pc)
                 self.push_stack(self.registers.pc() as u64);
@@ -1133,6 +1500,8 @@ impl Processor {
             },
             
             ByteCodes::RETURN => {
+                self.perf.returns += 1;
+
                 // Get the return address from the stack
                 let return_address = bytes_as_address(
                     self.pop_stack_bytes(ADDRESS_SIZE)
@@ -1143,324 +1512,192 @@ impl Processor {
             },
             
             ByteCodes::COMPARE_REG_REG => {
-                let left_reg = Registers::from(self.get_next_byte());
-                let right_reg = Registers::from(self.get_next_byte());
+                let left_reg = reg1;
+                let right_reg = reg2;
             
                 let result = self.registers.get(left_reg) as i64 - self.registers.get(right_reg) as i64;
         
-                self.set_arithmetical_flags(
-                    result == 0,
-                    is_msb_set(result as u64),
-                    0,
-                    false,
-                    false
-                );
+                self.registers.set_flags(LazyFlags::Result(result as u64));
             },
             
             ByteCodes::COMPARE_REG_ADDR_IN_REG => {
-                let size = self.get_next_byte();
-
-                let left_reg = Registers::from(self.get_next_byte());
+                let left_reg = reg1;
                 let left_value = self.registers.get(left_reg);
         
-                let right_address_reg = Registers::from(self.get_next_byte());
+                let right_address_reg = reg2;
                 let right_address = self.registers.get(right_address_reg) as Address;
-                let right_value = bytes_to_int(self.memory.get_bytes(right_address, size as usize), size);
+                let right_value = self.load_bytes(right_address, size);
         
                 let result = left_value as i64 - right_value as i64;
         
-                self.set_arithmetical_flags(
-                    result == 0,
-                    is_msb_set(result as u64),
-                    0,
-                    false,
-                    false
-                );
+                self.registers.set_flags(LazyFlags::Result(result as u64));
             },
             
             ByteCodes::COMPARE_REG_CONST => {
-                let size = self.get_next_byte();
-
-                let left_reg = Registers::from(self.get_next_byte());
+                let left_reg = reg1;
                 let left_value = self.registers.get(left_reg);
         
-                let right_value = bytes_to_int(self.get_next_bytes(size as usize), size);
+                let right_value = arg2;
         
                 let result = left_value as i64 - right_value as i64;
         
-                self.set_arithmetical_flags(
-                    result == 0,
-                    is_msb_set(result as u64),
-                    0,
-                    false,
-                    false
-                );
+                self.registers.set_flags(LazyFlags::Result(result as u64));
             },
             
             ByteCodes::COMPARE_REG_ADDR_LITERAL => {
-                let size = self.get_next_byte();
-
-                let left_reg = Registers::from(self.get_next_byte());
+                let left_reg = reg1;
                 let left_value = self.registers.get(left_reg);
         
-                let right_address = self.get_next_address();
-                let right_value = bytes_to_int(self.memory.get_bytes(right_address, size as usize), size);
+                let right_address = arg2 as Address;
+                let right_value = self.load_bytes(right_address, size);
         
                 let result = left_value as i64 - right_value as i64;
         
-                self.set_arithmetical_flags(
-                    result == 0,
-                    is_msb_set(result as u64),
-                    0,
-                    false,
-                    false
-                );
+                self.registers.set_flags(LazyFlags::Result(result as u64));
             },
             
             ByteCodes::COMPARE_ADDR_IN_REG_REG => {
-                let size = self.get_next_byte();
-
-                let left_address_reg = Registers::from(self.get_next_byte());
+                let left_address_reg = reg1;
                 let left_address = self.registers.get(left_address_reg) as Address;
-                let left_value = bytes_to_int(self.memory.get_bytes(left_address, size as usize), size);
+                let left_value = self.load_bytes(left_address, size);
                 
-                let right_reg = Registers::from(self.get_next_byte());
+                let right_reg = reg2;
                 let right_value = self.registers.get(right_reg);
         
                 let result = left_value as i64 - right_value as i64;
         
-                self.set_arithmetical_flags(
-                    result == 0,
-                    is_msb_set(result as u64),
-                    0,
-                    false,
-                    false
-                );
+                self.registers.set_flags(LazyFlags::Result(result as u64));
             },
             
             ByteCodes::COMPARE_ADDR_IN_REG_ADDR_IN_REG => {
-                let size = self.get_next_byte();
-
-                let left_address_reg = Registers::from(self.get_next_byte());
+                let left_address_reg = reg1;
                 let left_address = self.registers.get(left_address_reg) as Address;
-                let left_value = bytes_to_int(self.memory.get_bytes(left_address, size as usize), size);
+                let left_value = self.load_bytes(left_address, size);
                 
-                let right_address_reg = Registers::from(self.get_next_byte());
+                let right_address_reg = reg2;
                 let right_address = self.registers.get(right_address_reg) as Address;
-                let right_value = bytes_to_int(self.memory.get_bytes(right_address, size as usize), size);
+                let right_value = self.load_bytes(right_address, size);
         
                 let result = left_value as i64 - right_value as i64;
         
-                self.set_arithmetical_flags(
-                    result == 0,
-                    is_msb_set(result as u64),
-                    0,
-                    false,
-                    false
-                );
+                self.registers.set_flags(LazyFlags::Result(result as u64));
             },
             
             ByteCodes::COMPARE_ADDR_IN_REG_CONST => {
-                let size = self.get_next_byte();
-
-                let left_address_reg = Registers::from(self.get_next_byte());
+                let left_address_reg = reg1;
                 let left_address = self.registers.get(left_address_reg) as Address;
-                let left_value = bytes_to_int(self.memory.get_bytes(left_address, size as usize), size);
+                let left_value = self.load_bytes(left_address, size);
                
-                let right_value = bytes_to_int(self.get_next_bytes(size as usize), size);
+                let right_value = arg2;
         
                 let result = left_value as i64 - right_value as i64;
         
-                self.set_arithmetical_flags(
-                    result == 0,
-                    is_msb_set(result as u64),
-                    0,
-                    false,
-                    false
-                );
+                self.registers.set_flags(LazyFlags::Result(result as u64));
             },
             
             ByteCodes::COMPARE_ADDR_IN_REG_ADDR_LITERAL => {
-                let size = self.get_next_byte();
-
-                let left_address_reg = Registers::from(self.get_next_byte());
+                let left_address_reg = reg1;
                 let left_address = self.registers.get(left_address_reg) as Address;
-                let left_value = bytes_to_int(self.memory.get_bytes(left_address, size as usize), size);
+                let left_value = self.load_bytes(left_address, size);
                
-                let right_address = self.get_next_address();
-                let right_value = bytes_to_int(self.memory.get_bytes(right_address, size as usize), size);
+                let right_address = arg2 as Address;
+                let right_value = self.load_bytes(right_address, size);
         
                 let result = left_value as i64 - right_value as i64;
         
-                self.set_arithmetical_flags(
-                    result == 0,
-                    is_msb_set(result as u64),
-                    0,
-                    false,
-                    false
-                );
+                self.registers.set_flags(LazyFlags::Result(result as u64));
             },
             
             ByteCodes::COMPARE_CONST_REG => {
-                let size = self.get_next_byte();
-
-                let left_address = self.get_next_bytes(size as usize);
-                let left_value = bytes_to_int(left_address, size);
+                let left_value = arg1;
         
-                let right_reg = Registers::from(self.get_next_byte());
+                let right_reg = reg2;
                 let right_value = self.registers.get(right_reg);
                 
                 let result = left_value as i64 - right_value as i64;
         
-                self.set_arithmetical_flags(
-                    result == 0,
-                    is_msb_set(result as u64),
-                    0,
-                    false,
-                    false
-                );
+                self.registers.set_flags(LazyFlags::Result(result as u64));
             },
             
             ByteCodes::COMPARE_CONST_ADDR_IN_REG => {
-                let size = self.get_next_byte();
-
-                let left_address = self.get_next_bytes(size as usize);
-                let left_value = bytes_to_int(left_address, size);
+                let left_value = arg1;
         
-                let right_address_reg = Registers::from(self.get_next_byte());
+                let right_address_reg = reg2;
                 let right_address = self.registers.get(right_address_reg) as Address;
-                let right_value = bytes_to_int(self.memory.get_bytes(right_address, size as usize), size);
+                let right_value = self.load_bytes(right_address, size);
         
                 let result = left_value as i64 - right_value as i64;
         
-                self.set_arithmetical_flags(
-                    result == 0,
-                    is_msb_set(result as u64),
-                    0,
-                    false,
-                    false
-                );
+                self.registers.set_flags(LazyFlags::Result(result as u64));
             },
             
             ByteCodes::COMPARE_CONST_CONST => {
-                let size = self.get_next_byte();
-
-                let left_address = self.get_next_bytes(size as usize);
-                let left_value = bytes_to_int(left_address, size);
+                let left_value = arg1;
         
-                let right_address = self.get_next_bytes(size as usize);
-                let right_value = bytes_to_int(right_address, size);
+                let right_value = arg2;
                 
                 let result = left_value as i64 - right_value as i64;
         
-                self.set_arithmetical_flags(
-                    result == 0,
-                    is_msb_set(result as u64),
-                    0,
-                    false,
-                    false
-                );
+                self.registers.set_flags(LazyFlags::Result(result as u64));
             },
             
             ByteCodes::COMPARE_CONST_ADDR_LITERAL => {
-                let size = self.get_next_byte();
-
-                let left_address = self.get_next_bytes(size as usize);
-                let left_value = bytes_to_int(left_address, size);
+                let left_value = arg1;
         
-                let right_address = self.get_next_address();
-                let right_value = bytes_to_int(self.memory.get_bytes(right_address, size as usize), size);
+                let right_address = arg2 as Address;
+                let right_value = self.load_bytes(right_address, size);
         
                 let result = left_value as i64 - right_value as i64;
         
-                self.set_arithmetical_flags(
-                    result == 0,
-                    is_msb_set(result as u64), 
-                    0,
-                    false,
-                    false
-                );
+                self.registers.set_flags(LazyFlags::Result(result as u64));
             },
             
             ByteCodes::COMPARE_ADDR_LITERAL_REG => {
-                let size = self.get_next_byte();
-
-                let left_address = self.get_next_address();
-                let left_value = bytes_to_int(self.memory.get_bytes(left_address, size as usize), size);
+                let left_address = arg1 as Address;
+                let left_value = self.load_bytes(left_address, size);
         
-                let right_reg = Registers::from(self.get_next_byte());
+                let right_reg = reg2;
                 let right_value = self.registers.get(right_reg);
         
                 let result = left_value as i64 - right_value as i64;
         
-                self.set_arithmetical_flags(
-                    result == 0,
-                    is_msb_set(result as u64), 
-                    0,
-                    false,
-                    false
-                );
+                self.registers.set_flags(LazyFlags::Result(result as u64));
             },
             
             ByteCodes::COMPARE_ADDR_LITERAL_ADDR_IN_REG => {
-                let size = self.get_next_byte();
-
-                let left_address = self.get_next_address();
-                let left_value = bytes_to_int(self.memory.get_bytes(left_address, size as usize), size);
+                let left_address = arg1 as Address;
+                let left_value = self.load_bytes(left_address, size);
         
-                let right_address_reg = Registers::from(self.get_next_byte());
+                let right_address_reg = reg2;
                 let right_address = self.registers.get(right_address_reg) as Address;
-                let right_value = bytes_to_int(self.memory.get_bytes(right_address, size as usize), size);
+                let right_value = self.load_bytes(right_address, size);
         
                 let result = left_value as i64 - right_value as i64;
         
-                self.set_arithmetical_flags(
-                    result == 0,
-                    is_msb_set(result as u64), 
-                    0,
-                    false,
-                    false
-                );
+                self.registers.set_flags(LazyFlags::Result(result as u64));
             },
             
             ByteCodes::COMPARE_ADDR_LITERAL_CONST => {
-                let size = self.get_next_byte();
-
-                let left_address = self.get_next_address();
-                let left_value = bytes_to_int(self.memory.get_bytes(left_address, size as usize), size);
+                let left_address = arg1 as Address;
+                let left_value = self.load_bytes(left_address, size);
         
-                let right_address = self.get_next_bytes(size as usize);
-                let right_value = bytes_to_int(right_address, size);
+                let right_value = arg2;
                 
                 let result = left_value as i64 - right_value as i64;
         
-                self.set_arithmetical_flags(
-                    result == 0,
-                    is_msb_set(result as u64), 
-                    0,
-                    false,
-                    false
-                );
+                self.registers.set_flags(LazyFlags::Result(result as u64));
             },
             
             ByteCodes::COMPARE_ADDR_LITERAL_ADDR_LITERAL => {
-                let size = self.get_next_byte();
-
-                let left_address = self.get_next_address();
-                let left_value = bytes_to_int(self.memory.get_bytes(left_address, size as usize), size);
+                let left_address = arg1 as Address;
+                let left_value = self.load_bytes(left_address, size);
         
-                let right_address = self.get_next_address();
-                let right_value = bytes_to_int(self.memory.get_bytes(right_address, size as usize), size);
+                let right_address = arg2 as Address;
+                let right_value = self.load_bytes(right_address, size);
                 
                 let result = left_value as i64 - right_value as i64;
         
-                self.set_arithmetical_flags(
-                    result == 0,
-                    is_msb_set(result as u64), 
-                    0,
-                    false,
-                    false
-                );
+                self.registers.set_flags(LazyFlags::Result(result as u64));
             },
             
             ByteCodes::AND => {
@@ -1468,13 +1705,7 @@ impl Processor {
 
                 self.registers.set(Registers::R1, result);
         
-                self.set_arithmetical_flags(
-                    result == 0,
-                    is_msb_set(result),
-                    0,
-                    false,
-                    false
-                );
+                self.registers.set_flags(LazyFlags::Result(result));
             },
             
             ByteCodes::OR => {
@@ -1482,13 +1713,7 @@ impl Processor {
 
                 self.registers.set(Registers::R1, result);
         
-                self.set_arithmetical_flags(
-                    result == 0,
-                    is_msb_set(result),
-                    0,
-                    false,
-                    false
-                );
+                self.registers.set_flags(LazyFlags::Result(result));
             },
             
             ByteCodes::XOR => {
@@ -1496,13 +1721,7 @@ impl Processor {
 
                 self.registers.set(Registers::R1, result);
         
-                self.set_arithmetical_flags(
-                    result == 0,
-                    is_msb_set(result),
-                    0,
-                    false,
-                    true
-                );
+                self.registers.set_flags(LazyFlags::ResultWithOverflow(result));
             },
             
             ByteCodes::NOT => {
@@ -1510,13 +1729,7 @@ impl Processor {
 
                 self.registers.set(Registers::R1, result);
         
-                self.set_arithmetical_flags(
-                    result == 0,
-                    is_msb_set(result),
-                    0,
-                    false,
-                    true
-                );
+                self.registers.set_flags(LazyFlags::ResultWithOverflow(result));
             },
             
             ByteCodes::SHIFT_LEFT => {
@@ -1538,201 +1751,531 @@ impl Processor {
             },
             
             ByteCodes::INTERRUPT_REG => {
-                let reg = Registers::from(self.get_next_byte());
+                let reg = reg1;
                 let intr_code = self.registers.get(reg) as u8;
         
                 self.handle_interrupt(intr_code);
             },
             
             ByteCodes::INTERRUPT_ADDR_IN_REG => {
-                let address_reg = Registers::from(self.get_next_byte());
+                let address_reg = reg1;
                 let address = self.registers.get(address_reg) as Address;
-                let intr_code = bytes_to_int(self.memory.get_bytes(address, 1), 1) as u8;
+                let intr_code = self.load_sized::<1>(address) as u8;
         
                 self.handle_interrupt(intr_code);
             },
             
             ByteCodes::INTERRUPT_CONST => {
-                let intr_code = self.get_next_byte();
+                let intr_code = arg1 as u8;
 
                 self.handle_interrupt(intr_code);
             },
             
             ByteCodes::INTERRUPT_ADDR_LITERAL => {
-                let address = self.get_next_address();
-                let intr_code = bytes_to_int(self.memory.get_bytes(address, 1), 1) as u8;
+                let address = arg1 as Address;
+                let intr_code = self.load_sized::<1>(address) as u8;
         
                 self.handle_interrupt(intr_code);
             },
             
             ByteCodes::EXIT => {
-                let exit_code_n = self.registers.get(Registers::EXIT) as u8;
-                let exit_code = ErrorCodes::from(exit_code_n);
-        
-                if !self.quiet_exit {
-                    println!("Program exited with code {} ({})", exit_code_n, exit_code);
-                }
-                
-                std::process::exit(exit_code as i32);
+                self.exit();
             },
-        }
-    }
 
+            ByteCodes::MEMORY_COPY => {
+                let dest = self.registers.get(Registers::R1) as Address;
+                let src = self.registers.get(Registers::R2) as Address;
+                let size = self.registers.get(Registers::R3) as usize;
 
-    /// Set the arithmetical flags
-    fn set_arithmetical_flags(&mut self, zf: bool, sf: bool, rf: u64, cf: bool, of: bool) {
-        self.registers.set(Registers::ZERO_FLAG, zf as u64);
-        self.registers.set(Registers::SIGN_FLAG, sf as u64);
-        self.registers.set(Registers::REMAINDER_FLAG, rf);
-        self.registers.set(Registers::CARRY_FLAG, cf as u64);
-        self.registers.set(Registers::OVERFLOW_FLAG, of as u64);
-    }
+                if !self.check_bulk_range(src, size) || !self.check_bulk_range(dest, size) {
+                    return;
+                }
 
+                self.memory.memcpy(src, dest, size);
+                self.perf.bulk_memory_bytes += size as u64;
+            },
 
-    fn handle_interrupt(&mut self, intr_code: u8) {
+            ByteCodes::MEMORY_SET => {
+                let dest = self.registers.get(Registers::R1) as Address;
+                let value = self.registers.get(Registers::R2) as u8;
+                let size = self.registers.get(Registers::R3) as usize;
 
-        match Interrupts::from(intr_code) {
+                if !self.check_bulk_range(dest, size) {
+                    return;
+                }
 
-            Interrupts::PrintSigned => {
-                let value = self.registers.get(Registers::PRINT);
-                print!("{}", value as i64);
-                io::stdout().flush().expect("Failed to flush stdout");
+                self.memory.get_bytes_mut(dest, size).fill(value);
+                self.perf.bulk_memory_bytes += size as u64;
             },
 
-            Interrupts::PrintUnsigned => {
-                let value = self.registers.get(Registers::PRINT);
-                print!("{}", value);
-                io::stdout().flush().expect("Failed to flush stdout");
-            },
+            ByteCodes::MEMORY_COMPARE => {
+                let left_address = self.registers.get(Registers::R1) as Address;
+                let right_address = self.registers.get(Registers::R2) as Address;
+                let size = self.registers.get(Registers::R3) as usize;
 
-            Interrupts::PrintFloat => {
-                let value = self.registers.get(Registers::PRINT);
-                print!("{}", value as f64);
-                io::stdout().flush().expect("Failed to flush stdout");
-            }
+                if !self.check_bulk_range(left_address, size) || !self.check_bulk_range(right_address, size) {
+                    return;
+                }
 
-            Interrupts::PrintChar => {
-                let value = self.registers.get(Registers::PRINT);
-                io::stdout().write_all(&[value as u8]).expect("Failed to write to stdout");
-                io::stdout().flush().expect("Failed to flush stdout");
-            },
+                let left = self.memory.get_bytes(left_address, size);
+                let right = self.memory.get_bytes(right_address, size);
 
-            Interrupts::PrintString => {
-                let string_address = self.registers.get(Registers::PRINT) as Address;
-                let length = self.strlen(string_address);
-                let bytes = self.memory.get_bytes(string_address, length);
+                // Compare the first differing bytes, like cmp would
+                let (left_byte, right_byte) = if left == right {
+                    (0, 0)
+                } else {
+                    let index = left.iter().zip(right).position(|(l, r)| l != r).unwrap();
+                    (left[index], right[index])
+                };
 
-                io::stdout().write_all(bytes).expect("Failed to write to stdout");
-                io::stdout().flush().expect("Failed to flush stdout");
+                self.compare(left_byte as u64, right_byte as u64);
             },
 
-            Interrupts::PrintBytes => {
-                let bytes_address = self.registers.get(Registers::PRINT) as Address;
-                let length = self.registers.get(Registers::R1) as usize;
-                let bytes = self.memory.get_bytes(bytes_address, length);
+            ByteCodes::STRING_LENGTH => {
+                let address = self.registers.get(Registers::R1) as Address;
+
+                // Unlike the interrupts, a string that isn't terminated before the end of memory is reported to the program
+                let Some(length) = self.memory.get_raw().get(address..).and_then(|bytes| bytes.iter().position(|&byte| byte == 0)) else {
+                    self.registers.set_error(ErrorCodes::OutOfBounds);
+                    return;
+                };
 
-                io::stdout().write_all(bytes).expect("Failed to write to stdout");
-                io::stdout().flush().expect("Failed to flush stdout");
+                self.registers.set(Registers::R1, length as u64);
             },
 
-            Interrupts::InputSignedInt => {
-                let mut input = String::new();
+            ByteCodes::MEMORY_FIND => {
+                let address = self.registers.get(Registers::R1) as Address;
+                let value = self.registers.get(Registers::R2) as u8;
+                let size = self.registers.get(Registers::R3) as usize;
 
-                match io::stdin().read_line(&mut input) {
-                    Ok(bytes_read) => {
+                if !self.check_bulk_range(address, size) {
+                    return;
+                }
 
-                        // Check for EOF errors
-                        if bytes_read == 0 {
-                            self.registers.set_error(ErrorCodes::EndOfFile);
-                            return;
-                        }
+                // Address 0 is a valid address, so the end of the range means the byte wasn't found
+                let index = self.memory.get_bytes(address, size).iter().position(|&byte| byte == value).unwrap_or(size);
 
-                        match input.trim().parse::<i64>() {
-                            Ok(value) => {
-                                self.registers.set(Registers::INPUT, value as u64);
-                                self.registers.set_error(ErrorCodes::NoError);
-                            },
-                            Err(_) => {
-                                self.registers.set_error(ErrorCodes::InvalidInput);
-                            }
-                        }
-                    },
-                    Err(_) => {
-                        self.registers.set_error(ErrorCodes::GenericError);
-                    },
-                }
+                self.registers.set(Registers::R1, (address + index) as u64);
             },
 
-            Interrupts::InputUnsignedInt => {
-                let mut input = String::new();
+            ByteCodes::ATOMIC_COMPARE_EXCHANGE => {
+                let address = self.registers.get(Registers::R1) as Address;
+                let expected = self.registers.get(Registers::R2);
+                let new = self.registers.get(Registers::R3);
 
-                match io::stdin().read_line(&mut input) {
-                    Ok(bytes_read) => {
+                let Some(old) = atomic_sized!(self, address, size, |atomic, Int| {
+                    atomic.compare_exchange(expected as Int, new as Int, Ordering::SeqCst, Ordering::SeqCst).unwrap_or_else(|old| old)
+                }) else {
+                    self.registers.set_error(ErrorCodes::UnalignedAddress);
+                    return;
+                };
 
-                        // Check for EOF errors
-                        if bytes_read == 0 {
-                            self.registers.set_error(ErrorCodes::EndOfFile);
-                            return;
-                        }
+                self.registers.set(Registers::R1, old);
+                // The zero flag is set if the value was exchanged
+                self.compare(old, bytes_to_int(&expected.to_le_bytes()[..size as usize]));
+            },
 
-                        match input.trim().parse::<u64>() {
-                            Ok(value) => {
-                                self.registers.set(Registers::INPUT, value);
-                                self.registers.set_error(ErrorCodes::NoError);
-                            },
-                            Err(_) => {
-                                self.registers.set_error(ErrorCodes::InvalidInput);
-                            }
-                        }
-                    },
-                    Err(_) => {
-                        self.registers.set_error(ErrorCodes::GenericError);
-                    },
-                }
+            ByteCodes::ATOMIC_FETCH_ADD => {
+                let address = self.registers.get(Registers::R1) as Address;
+                let value = self.registers.get(Registers::R2);
+
+                let Some(old) = atomic_sized!(self, address, size, |atomic, Int| atomic.fetch_add(value as Int, Ordering::SeqCst)) else {
+                    self.registers.set_error(ErrorCodes::UnalignedAddress);
+                    return;
+                };
+
+                self.registers.set(Registers::R1, old);
             },
 
-            Interrupts::InputString => {
-                
-                let buf_addr = self.registers.get(Registers::R1) as Address;
-                let size = self.registers.get(Registers::R2) as usize;
-                    
-                let buf = self.memory.get_bytes_mut(buf_addr, size);
+            ByteCodes::ATOMIC_EXCHANGE => {
+                let address = self.registers.get(Registers::R1) as Address;
+                let value = self.registers.get(Registers::R2);
 
-                match io::stdin().read(buf) {
-                    Ok(bytes_read) => {
+                let Some(old) = atomic_sized!(self, address, size, |atomic, Int| atomic.swap(value as Int, Ordering::SeqCst)) else {
+                    self.registers.set_error(ErrorCodes::UnalignedAddress);
+                    return;
+                };
 
-                        // Check for EOF errors
-                        if bytes_read == 0 {
-                            self.registers.set_error(ErrorCodes::EndOfFile);
-                            return;
-                        }
+                self.registers.set(Registers::R1, old);
+            },
 
-                        self.registers.set(Registers::INPUT, bytes_read as u64);
-                        self.registers.set_error(ErrorCodes::NoError); 
-                    },
+            ByteCodes::FENCE => atomic::fence(Ordering::SeqCst),
 
-                    Err(_) => {
-                        self.registers.set_error(ErrorCodes::GenericError);
-                    },
+            ByteCodes::COMPARE_JUMP_REG_REG => {
+                self.compare(self.registers.get(reg1), self.registers.get(reg2));
+
+                if self.check_condition(instruction.condition) {
+                    self.jump_to(instruction.target);
                 }
             },
 
-            Interrupts::Random => {
-                let mut rng = rand::thread_rng();
-                let random_number = rng.gen_range(u64::MIN..u64::MAX);
+            ByteCodes::COMPARE_JUMP_REG_CONST => {
+                self.compare(self.registers.get(reg1), arg2);
 
-                self.registers.set(Registers::R1, random_number);
+                if self.check_condition(instruction.condition) {
+                    self.jump_to(instruction.target);
+                }
             },
 
-            Interrupts::HostTimeNanos => {
-                // Casting to u64 will be ok until around 2500
-                let time = SystemTime::now().duration_since(UNIX_EPOCH).unwrap().as_nanos() as u64;
+            ByteCodes::COMPARE_JUMP_ADDR_IN_REG_REG => {
+                let left_address = self.registers.get(reg1) as Address;
+                let left_value = self.load_bytes(left_address, size);
 
-                self.registers.set(Registers::R1, time);
+                self.compare(left_value, self.registers.get(reg2));
+
+                if self.check_condition(instruction.condition) {
+                    self.jump_to(instruction.target);
+                }
             },
 
-            Interrupts::ElapsedTimeNanos => {
-                // Casting to u64 will be ok until around 2500
+            ByteCodes::COMPARE_JUMP_ADDR_IN_REG_CONST => {
+                let left_address = self.registers.get(reg1) as Address;
+                let left_value = self.load_bytes(left_address, size);
+
+                self.compare(left_value, arg2);
+
+                if self.check_condition(instruction.condition) {
+                    self.jump_to(instruction.target);
+                }
+            },
+
+            ByteCodes::PUSH_FROM_REG_CALL => {
+                self.perf.calls += 1;
+
+                self.push_stack(self.registers.get(reg1));
+
+                self.push_stack(self.registers.pc() as u64);
+                self.jump_to(instruction.target);
+            },
+
+            ByteCodes::PUSH_FROM_CONST_CALL => {
+                self.perf.calls += 1;
+
+                self.push_stack_bytes(&arg1.to_le_bytes()[..size as usize]);
+
+                self.push_stack(self.registers.pc() as u64);
+                self.jump_to(instruction.target);
+            },
+
+            ByteCodes::POP_INTO_REG_RETURN => {
+                self.perf.returns += 1;
+
+                let value = bytes_to_int(self.pop_stack_bytes(size as usize));
+                self.registers.set(reg1, value);
+
+                let return_address = bytes_as_address(
+                    self.pop_stack_bytes(ADDRESS_SIZE)
+                );
+                self.jump_to(return_address);
+            },
+
+            ByteCodes::MOVE_INTO_REG_FROM_ADDR_IN_REG_1 => self.registers.set(reg1, self.load_sized::<1>(self.registers.get(reg2) as Address)),
+            ByteCodes::MOVE_INTO_REG_FROM_ADDR_IN_REG_2 => self.registers.set(reg1, self.load_sized::<2>(self.registers.get(reg2) as Address)),
+            ByteCodes::MOVE_INTO_REG_FROM_ADDR_IN_REG_4 => self.registers.set(reg1, self.load_sized::<4>(self.registers.get(reg2) as Address)),
+            ByteCodes::MOVE_INTO_REG_FROM_ADDR_IN_REG_8 => self.registers.set(reg1, self.load_sized::<8>(self.registers.get(reg2) as Address)),
+
+            ByteCodes::MOVE_INTO_REG_FROM_ADDR_LITERAL_1 => self.registers.set(reg1, self.load_sized::<1>(arg2 as Address)),
+            ByteCodes::MOVE_INTO_REG_FROM_ADDR_LITERAL_2 => self.registers.set(reg1, self.load_sized::<2>(arg2 as Address)),
+            ByteCodes::MOVE_INTO_REG_FROM_ADDR_LITERAL_4 => self.registers.set(reg1, self.load_sized::<4>(arg2 as Address)),
+            ByteCodes::MOVE_INTO_REG_FROM_ADDR_LITERAL_8 => self.registers.set(reg1, self.load_sized::<8>(arg2 as Address)),
+
+            ByteCodes::MOVE_INTO_ADDR_IN_REG_FROM_REG_1 => self.store_sized::<1>(self.registers.get(reg1) as Address, self.registers.get(reg2)),
+            ByteCodes::MOVE_INTO_ADDR_IN_REG_FROM_REG_2 => self.store_sized::<2>(self.registers.get(reg1) as Address, self.registers.get(reg2)),
+            ByteCodes::MOVE_INTO_ADDR_IN_REG_FROM_REG_4 => self.store_sized::<4>(self.registers.get(reg1) as Address, self.registers.get(reg2)),
+            ByteCodes::MOVE_INTO_ADDR_IN_REG_FROM_REG_8 => self.store_sized::<8>(self.registers.get(reg1) as Address, self.registers.get(reg2)),
+
+            ByteCodes::MOVE_INTO_ADDR_IN_REG_FROM_CONST_1 => self.store_sized::<1>(self.registers.get(reg1) as Address, arg2),
+            ByteCodes::MOVE_INTO_ADDR_IN_REG_FROM_CONST_2 => self.store_sized::<2>(self.registers.get(reg1) as Address, arg2),
+            ByteCodes::MOVE_INTO_ADDR_IN_REG_FROM_CONST_4 => self.store_sized::<4>(self.registers.get(reg1) as Address, arg2),
+            ByteCodes::MOVE_INTO_ADDR_IN_REG_FROM_CONST_8 => self.store_sized::<8>(self.registers.get(reg1) as Address, arg2),
+
+            ByteCodes::MOVE_INTO_ADDR_LITERAL_FROM_REG_1 => self.store_sized::<1>(arg1 as Address, self.registers.get(reg2)),
+            ByteCodes::MOVE_INTO_ADDR_LITERAL_FROM_REG_2 => self.store_sized::<2>(arg1 as Address, self.registers.get(reg2)),
+            ByteCodes::MOVE_INTO_ADDR_LITERAL_FROM_REG_4 => self.store_sized::<4>(arg1 as Address, self.registers.get(reg2)),
+            ByteCodes::MOVE_INTO_ADDR_LITERAL_FROM_REG_8 => self.store_sized::<8>(arg1 as Address, self.registers.get(reg2)),
+
+            ByteCodes::MOVE_INTO_ADDR_LITERAL_FROM_CONST_1 => self.store_sized::<1>(arg1 as Address, arg2),
+            ByteCodes::MOVE_INTO_ADDR_LITERAL_FROM_CONST_2 => self.store_sized::<2>(arg1 as Address, arg2),
+            ByteCodes::MOVE_INTO_ADDR_LITERAL_FROM_CONST_4 => self.store_sized::<4>(arg1 as Address, arg2),
+            ByteCodes::MOVE_INTO_ADDR_LITERAL_FROM_CONST_8 => self.store_sized::<8>(arg1 as Address, arg2),
+        }
+    }
+
+
+    /// Read a `SIZE` bytes long little-endian integer from memory
+    #[inline(always)]
+    fn load_sized<const SIZE: usize>(&self, address: Address) -> u64 {
+        let mut bytes = [0; 8];
+        bytes[..SIZE].copy_from_slice(self.memory.get_bytes(address, SIZE));
+        u64::from_le_bytes(bytes)
+    }
+
+
+    /// Write the `SIZE` least significant bytes of the value to memory
+    #[inline(always)]
+    fn store_sized<const SIZE: usize>(&mut self, address: Address, value: u64) {
+        self.memory.set_bytes(address, &value.to_le_bytes()[..SIZE]);
+    }
+
+
+    /// Read a little-endian integer of the handled size from memory
+    #[inline(always)]
+    fn load_bytes(&self, address: Address, size: Byte) -> u64 {
+        match_sized!(size, "loading bytes", |SIZE| self.load_sized::<SIZE>(address))
+    }
+
+
+    /// Write the least significant bytes of the value to memory, as many as the handled size
+    #[inline(always)]
+    fn store_bytes(&mut self, address: Address, value: u64, size: Byte) {
+        match_sized!(size, "storing bytes", |SIZE| self.store_sized::<SIZE>(address, value))
+    }
+
+
+    /// Get a pointer to the `size` bytes at `address` to access them atomically, or `None` if they aren't aligned to their size.
+    /// The bytes are assumed to be written
+    #[inline(always)]
+    fn atomic_ptr(&mut self, address: Address, size: usize) -> Option<*mut Byte> {
+        // The memory base is aligned to the largest atomic size, so aligned guest addresses are aligned on the host
+        if address % size == 0 {
+            Some(self.memory.get_bytes_mut(address, size).as_mut_ptr())
+        } else {
+            None
+        }
+    }
+
+
+    /// Compare the two values and set the arithmetical flags accordingly
+    #[inline(always)]
+    fn compare(&mut self, left: u64, right: u64) {
+        let result = left as i64 - right as i64;
+
+        self.registers.set_flags(LazyFlags::Result(result as u64));
+    }
+
+
+    /// Return whether the jump condition is satisfied by the current flags
+    #[inline(always)]
+    fn check_condition(&self, condition: JumpCondition) -> bool {
+        match condition {
+            JumpCondition::NotZero => self.registers.get(Registers::ZERO_FLAG) == 0,
+            JumpCondition::Zero => self.registers.get(Registers::ZERO_FLAG) == 1,
+            JumpCondition::Greater => self.registers.get(Registers::SIGN_FLAG) == self.registers.get(Registers::OVERFLOW_FLAG)
+                && self.registers.get(Registers::ZERO_FLAG) == 0,
+            JumpCondition::Less => self.registers.get(Registers::SIGN_FLAG) != self.registers.get(Registers::OVERFLOW_FLAG),
+            JumpCondition::GreaterOrEqual => self.registers.get(Registers::SIGN_FLAG) == self.registers.get(Registers::OVERFLOW_FLAG),
+            JumpCondition::LessOrEqual => self.registers.get(Registers::SIGN_FLAG) != self.registers.get(Registers::OVERFLOW_FLAG)
+                || self.registers.get(Registers::ZERO_FLAG) == 1,
+            JumpCondition::Carry => self.registers.get(Registers::CARRY_FLAG) == 1,
+            JumpCondition::NotCarry => self.registers.get(Registers::CARRY_FLAG) == 0,
+            JumpCondition::Overflow => self.registers.get(Registers::OVERFLOW_FLAG) == 1,
+            JumpCondition::NotOverflow => self.registers.get(Registers::OVERFLOW_FLAG) == 0,
+            JumpCondition::Sign => self.registers.get(Registers::SIGN_FLAG) == 1,
+            JumpCondition::NotSign => self.registers.get(Registers::SIGN_FLAG) == 0,
+        }
+    }
+
+
+    /// Stop the program. The exit code is stored in the exit register
+    fn exit(&mut self) -> ! {
+        // Unwind to the function that started the program, which knows how to report the exit
+        panic::resume_unwind(Box::new(Halt))
+    }
+
+
+    /// Terminate the process with the exit code stored in the exit register
+    fn terminate(&mut self) -> ! {
+        let exit_code_n = self.registers.get(Registers::EXIT) as u8;
+        let exit_code = ErrorCodes::from(exit_code_n);
+
+        output::flush();
+
+        // The modules aren't dropped when the process exits
+        if let Some(storage) = &self.modules.storage {
+            storage.close();
+        }
+
+        if let Some(profiler) = &self.profiler {
+            profiler.write_report();
+        }
+
+        if let Some(tracer) = &mut self.tracer {
+            tracer.finish();
+        }
+
+        if !self.quiet_exit {
+            println!("Program exited with code {} ({})", exit_code_n, exit_code);
+        }
+        
+        std::process::exit(exit_code as i32);
+    }
+
+
+    fn handle_interrupt(&mut self, intr_code: u8) {
+
+        self.perf.interrupts += 1;
+
+        let timed_module = TimedModule::of(Interrupts::from(intr_code));
+
+        if self.profiler.is_some() || timed_module.is_some() {
+            let start = Instant::now();
+            self.execute_interrupt(intr_code);
+            let elapsed = start.elapsed();
+            if let Some(module) = timed_module {
+                self.modules.module_times.record(module, elapsed);
+            }
+            if let Some(profiler) = &mut self.profiler {
+                profiler.record_interrupt(intr_code, elapsed);
+            }
+        } else {
+            self.execute_interrupt(intr_code);
+        }
+    }
+
+
+    fn execute_interrupt(&mut self, intr_code: u8) {
+
+        match Interrupts::from(intr_code) {
+
+            Interrupts::PrintSigned => {
+                let value = self.registers.get(Registers::PRINT);
+                output::write_fmt(format_args!("{}", value as i64));
+            },
+
+            Interrupts::PrintUnsigned => {
+                let value = self.registers.get(Registers::PRINT);
+                output::write_fmt(format_args!("{}", value));
+            },
+
+            Interrupts::PrintFloat => {
+                let value = self.registers.get(Registers::PRINT);
+                output::write_fmt(format_args!("{}", value as f64));
+            }
+
+            Interrupts::PrintChar => {
+                let value = self.registers.get(Registers::PRINT);
+                output::write(&[value as u8]);
+            },
+
+            Interrupts::PrintString => {
+                let string_address = self.registers.get(Registers::PRINT) as Address;
+                let length = self.strlen(string_address);
+                let bytes = self.memory.get_bytes(string_address, length);
+
+                output::write(bytes);
+            },
+
+            Interrupts::PrintBytes => {
+                let bytes_address = self.registers.get(Registers::PRINT) as Address;
+                let length = self.registers.get(Registers::R1) as usize;
+                let bytes = self.memory.get_bytes(bytes_address, length);
+
+                output::write(bytes);
+            },
+
+            Interrupts::InputSignedInt => {
+                output::flush();
+
+                let mut input = String::new();
+
+                match io::stdin().read_line(&mut input) {
+                    Ok(bytes_read) => {
+
+                        // Check for EOF errors
+                        if bytes_read == 0 {
+                            self.registers.set_error(ErrorCodes::EndOfFile);
+                            return;
+                        }
+
+                        match input.trim().parse::<i64>() {
+                            Ok(value) => {
+                                self.registers.set(Registers::INPUT, value as u64);
+                                self.registers.set_error(ErrorCodes::NoError);
+                            },
+                            Err(_) => {
+                                self.registers.set_error(ErrorCodes::InvalidInput);
+                            }
+                        }
+                    },
+                    Err(_) => {
+                        self.registers.set_error(ErrorCodes::GenericError);
+                    },
+                }
+            },
+
+            Interrupts::InputUnsignedInt => {
+                output::flush();
+
+                let mut input = String::new();
+
+                match io::stdin().read_line(&mut input) {
+                    Ok(bytes_read) => {
+
+                        // Check for EOF errors
+                        if bytes_read == 0 {
+                            self.registers.set_error(ErrorCodes::EndOfFile);
+                            return;
+                        }
+
+                        match input.trim().parse::<u64>() {
+                            Ok(value) => {
+                                self.registers.set(Registers::INPUT, value);
+                                self.registers.set_error(ErrorCodes::NoError);
+                            },
+                            Err(_) => {
+                                self.registers.set_error(ErrorCodes::InvalidInput);
+                            }
+                        }
+                    },
+                    Err(_) => {
+                        self.registers.set_error(ErrorCodes::GenericError);
+                    },
+                }
+            },
+
+            Interrupts::InputString => {
+                output::flush();
+
+                let buf_addr = self.registers.get(Registers::R1) as Address;
+                let size = self.registers.get(Registers::R2) as usize;
+                    
+                let buf = self.memory.get_bytes_mut(buf_addr, size);
+
+                match io::stdin().read(buf) {
+                    Ok(bytes_read) => {
+
+                        // Check for EOF errors
+                        if bytes_read == 0 {
+                            self.registers.set_error(ErrorCodes::EndOfFile);
+                            return;
+                        }
+
+                        self.registers.set(Registers::INPUT, bytes_read as u64);
+                        self.registers.set_error(ErrorCodes::NoError); 
+                    },
+
+                    Err(_) => {
+                        self.registers.set_error(ErrorCodes::GenericError);
+                    },
+                }
+            },
+
+            Interrupts::Random => {
+                let mut rng = rand::thread_rng();
+                let random_number = rng.gen_range(u64::MIN..u64::MAX);
+
+                self.registers.set(Registers::R1, random_number);
+            },
+
+            Interrupts::HostTimeNanos => {
+                // Casting to u64 will be ok until around 2500
+                let time = SystemTime::now().duration_since(UNIX_EPOCH).unwrap().as_nanos() as u64;
+
+                self.registers.set(Registers::R1, time);
+            },
+
+            Interrupts::ElapsedTimeNanos => {
+                // Casting to u64 will be ok until around 2500
                 let time = SystemTime::now().duration_since(self.start_time).unwrap().as_nanos() as u64;
 
                 self.registers.set(Registers::R1, time);
@@ -1744,11 +2287,9 @@ impl Processor {
                 let size = self.registers.get(Registers::R3) as usize;
         
                 let err = if let Some(storage) = &self.modules.storage {
-                    match storage.read(disk_address, size) {
-                        Ok(bytes) => {
-                            self.memory.set_bytes(buffer_address, &bytes);
-                            ErrorCodes::NoError
-                        },
+                    // Read straight into the guest buffer
+                    match storage.read_into(disk_address, self.memory.get_bytes_mut(buffer_address, size)) {
+                        Ok(()) => ErrorCodes::NoError,
                         Err(e) => e
                     }
                 } else {
@@ -1778,13 +2319,19 @@ impl Processor {
             },
 
             Interrupts::Terminal => {
+                // The terminal writes to stdout directly
+                output::flush();
+
                 let term_code = self.registers.get(Registers::PRINT); 
 
-                let err = self.modules.terminal.handle_code(term_code as usize, &mut self.registers, &mut self.memory);
+                let err = self.modules.terminal.lock().unwrap().handle_code(term_code as usize, &mut self.registers, &mut self.memory);
                 self.registers.set_error(err);
             },
 
             Interrupts::SetTimerNanos => {
+                // Show the output before idling
+                output::flush();
+
                 let time = self.registers.get(Registers::R1);
                 let duration = std::time::Duration::from_nanos(time);
         
@@ -1792,7 +2339,7 @@ impl Processor {
             },
 
             Interrupts::FlushStdout => {
-                io::stdout().flush().expect("Failed to flush stdout");
+                output::flush();
             },
 
             Interrupts::HostFs => {
@@ -1802,8 +2349,1449 @@ impl Processor {
                 self.registers.set_error(err);
             },
 
-        }
-    }
+            Interrupts::Malloc => {
+                let size = self.registers.get(Registers::R1) as usize;
 
-}
+                let result = self.modules.allocator.lock().unwrap().malloc(size, self.heap_limit());
+                self.set_allocation_result(result);
+            },
+
+            Interrupts::Calloc => {
+                let count = self.registers.get(Registers::R1) as usize;
+                let size = self.registers.get(Registers::R2) as usize;
+
+                let result = self.modules.allocator.lock().unwrap().calloc(count, size, self.heap_limit(), &mut self.memory);
+                self.set_allocation_result(result);
+            },
+
+            Interrupts::Realloc => {
+                let address = self.registers.get(Registers::R1) as Address;
+                let size = self.registers.get(Registers::R2) as usize;
+
+                let result = self.modules.allocator.lock().unwrap().realloc(address, size, self.heap_limit(), &mut self.memory);
+                self.set_allocation_result(result);
+            },
+
+            Interrupts::Free => {
+                let address = self.registers.get(Registers::R1) as Address;
+
+                self.registers.set_error(
+                    match self.modules.allocator.lock().unwrap().free(address) {
+                        Ok(()) => ErrorCodes::NoError,
+                        Err(e) => e
+                    }
+                );
+            },
+
+            Interrupts::HeapStats => {
+                let stats = self.modules.allocator.lock().unwrap().stats();
+
+                self.registers.set(Registers::R1, stats.allocated_bytes as u64);
+                self.registers.set(Registers::R2, stats.peak_allocated_bytes as u64);
+                self.registers.set(Registers::R3, stats.live_blocks as u64);
+                self.registers.set(Registers::R4, stats.total_allocations as u64);
+            },
+
+            Interrupts::Snapshot => {
+                let error = if self.snapshot.is_some() {
+                    // The resumed program sees 1 in r1 and no error, this one sees 0
+                    let mut registers = self.registers.snapshot();
+                    registers[Registers::R1 as usize] = 1;
+                    registers[Registers::ERROR as usize] = ErrorCodes::NoError as u64;
+
+                    ErrorCodes::from(self.save_snapshot(&registers))
+                } else {
+                    ErrorCodes::ModuleUnavailable
+                };
+
+                self.registers.set(Registers::R1, 0);
+                self.registers.set_error(error);
+            },
 
+            Interrupts::ThreadSpawn => {
+                let entry = self.registers.get(Registers::R1) as Address;
+                let argument = self.registers.get(Registers::R2);
+                let stack_size = self.registers.get(Registers::R3) as usize;
+
+                let result = self.spawn_thread(entry, argument, stack_size);
+                self.set_interrupt_result(result);
+            },
+
+            Interrupts::ThreadJoin => {
+                let id = self.registers.get(Registers::R1);
+
+                let result = self.join_thread(id);
+                self.set_interrupt_result(result);
+            },
+
+            Interrupts::MemoryWait => {
+                let address = self.registers.get(Registers::R1) as Address;
+                let expected = self.registers.get(Registers::R2);
+
+                let Some(value) = self.atomic_ptr(address, 8) else {
+                    self.registers.set_error(ErrorCodes::UnalignedAddress);
+                    return;
+                };
+                let value = unsafe { AtomicU64::from_ptr(value as *mut u64) };
+
+                self.modules.threads.wait(address, || value.load(Ordering::SeqCst) == expected);
+                self.registers.set_error(ErrorCodes::NoError);
+            },
+
+            Interrupts::MemoryNotify => {
+                let address = self.registers.get(Registers::R1) as Address;
+
+                self.modules.threads.notify(address);
+            },
+
+            Interrupts::DiskSubmitRead |
+            Interrupts::DiskSubmitWrite => {
+                let disk_address = self.registers.get(Registers::R1) as Address;
+                let buffer_address = self.registers.get(Registers::R2) as Address;
+                let size = self.registers.get(Registers::R3) as usize;
+
+                let result = if let Some(storage) = &self.modules.storage {
+                    // Check the buffer now, since the request runs on another thread
+                    let kind = if matches!(Interrupts::from(intr_code), Interrupts::DiskSubmitRead) {
+                        self.memory.get_bytes_mut(buffer_address, size);
+                        RequestKind::Read
+                    } else {
+                        self.memory.get_bytes(buffer_address, size);
+                        RequestKind::Write
+                    };
+                    let id = storage.submit(kind, disk_address, self.memory.share(), buffer_address, size, Arc::clone(&self.modules.events));
+
+                    let code_size = self.memory.get_code_size();
+                    if matches!(kind, RequestKind::Read) && buffer_address < code_size && size != 0 {
+                        self.code_reads.insert(id, (buffer_address, (buffer_address + size).min(code_size)));
+                    }
+                    Ok(id)
+                } else {
+                    Err(ErrorCodes::ModuleUnavailable)
+                };
+
+                self.set_interrupt_result(result);
+            },
+
+            Interrupts::DiskPoll => {
+                let id = self.registers.get(Registers::R1);
+
+                let (completed, err) = match self.modules.storage.as_ref().map(|storage| storage.poll(id)) {
+                    Some(Some(RequestState::Completed(result))) => (1, result),
+                    Some(Some(RequestState::Pending)) => (0, ErrorCodes::NoError),
+                    Some(None) => (0, ErrorCodes::NotFound),
+                    None => (0, ErrorCodes::ModuleUnavailable),
+                };
+                if completed == 1 {
+                    self.sync_code_read(id);
+                }
+
+                self.registers.set(Registers::R1, completed);
+                self.registers.set_error(err);
+            },
+
+            Interrupts::DiskWait => {
+                let id = self.registers.get(Registers::R1);
+
+                let err = match self.modules.storage.as_ref().map(|storage| storage.wait(id)) {
+                    Some(Some(result)) => result,
+                    Some(None) => ErrorCodes::NotFound,
+                    None => ErrorCodes::ModuleUnavailable,
+                };
+                self.sync_code_read(id);
+
+                self.registers.set_error(err);
+            },
+
+            Interrupts::TimerStart => {
+                let delay = Duration::from_nanos(self.registers.get(Registers::R1));
+                let period = Duration::from_nanos(self.registers.get(Registers::R2));
+
+                let id = self.modules.events.start_timer(delay, Some(period));
+                self.set_interrupt_result(Ok(id));
+            },
+
+            Interrupts::TimerCancel => {
+                let id = self.registers.get(Registers::R1);
+
+                self.registers.set_error(
+                    if self.modules.events.cancel_timer(id) {
+                        ErrorCodes::NoError
+                    } else {
+                        ErrorCodes::NotFound
+                    }
+                );
+            },
+
+            Interrupts::WaitEvents => {
+                // Show the output before idling
+                output::flush();
+
+                let timeout = self.registers.get(Registers::R1);
+                let deadline = (timeout != 0).then(|| Instant::now() + Duration::from_nanos(timeout));
+
+                let threads = &self.modules.threads;
+                let (kind, source, value, err) = match self.modules.events.wait(deadline, || threads.should_stop()) {
+                    Some(event) => {
+                        // The completed request is collected like with DiskPoll, so it doesn't pile up
+                        if let (EventKind::Storage, Some(storage)) = (event.kind, &self.modules.storage) {
+                            storage.poll(event.source);
+                        }
+                        (event.kind as u64, event.source, event.value, ErrorCodes::NoError)
+                    },
+                    None => (0, 0, 0, ErrorCodes::TimedOut)
+                };
+                if kind == EventKind::Storage as u64 {
+                    self.sync_code_read(source);
+                }
+
+                self.registers.set(Registers::R1, kind);
+                self.registers.set(Registers::R2, source);
+                self.registers.set(Registers::R3, value);
+                self.registers.set_error(err);
+            },
+
+            Interrupts::PerfCounters => {
+                let buffer_address = self.registers.get(Registers::R1) as Address;
+
+                let heap = self.modules.allocator.lock().unwrap().stats();
+                let (storage_read, storage_written) = self.modules.storage.as_ref().map_or(
+                    (0, 0), |storage| (storage.traffic().read(), storage.traffic().written())
+                );
+                let times = &self.modules.module_times;
+
+                let mut counters = [0; PERF_COUNTER_COUNT];
+                counters[PerfCounter::Instructions as usize] = self.perf.instructions;
+                counters[PerfCounter::Calls as usize] = self.perf.calls;
+                counters[PerfCounter::Returns as usize] = self.perf.returns;
+                counters[PerfCounter::Interrupts as usize] = self.perf.interrupts;
+                counters[PerfCounter::BulkMemoryBytes as usize] = self.perf.bulk_memory_bytes;
+                counters[PerfCounter::StorageBytesRead as usize] = storage_read;
+                counters[PerfCounter::StorageBytesWritten as usize] = storage_written;
+                counters[PerfCounter::HostFsBytesRead as usize] = self.modules.host_fs.traffic.read();
+                counters[PerfCounter::HostFsBytesWritten as usize] = self.modules.host_fs.traffic.written();
+                counters[PerfCounter::HeapLiveBytes as usize] = heap.allocated_bytes as u64;
+                counters[PerfCounter::HeapPeakBytes as usize] = heap.peak_allocated_bytes as u64;
+                counters[PerfCounter::StorageNanos as usize] = times.nanos(TimedModule::Storage);
+                counters[PerfCounter::HostFsNanos as usize] = times.nanos(TimedModule::HostFs);
+                counters[PerfCounter::TerminalNanos as usize] = times.nanos(TimedModule::Terminal);
+
+                let buffer = self.memory.get_bytes_mut(buffer_address, PERF_COUNTERS_SIZE);
+                for (bytes, counter) in buffer.chunks_exact_mut(8).zip(counters) {
+                    bytes.copy_from_slice(&counter.to_le_bytes());
+                }
+            },
+
+        }
+    }
+
+
+    /// Store the result of an interrupt in r1, or 0 and the error code if it failed
+    fn set_interrupt_result(&mut self, result: Result<u64, ErrorCodes>) {
+        match result {
+            Ok(value) => {
+                self.registers.set(Registers::R1, value);
+                self.registers.set_error(ErrorCodes::NoError);
+            },
+            Err(e) => {
+                self.registers.set(Registers::R1, 0);
+                self.registers.set_error(e);
+            }
+        }
+    }
+
+
+    /// Store the address of an allocated block in r1, or 0 and the error code if the allocation failed
+    fn set_allocation_result(&mut self, result: Result<Address, ErrorCodes>) {
+        match result {
+            Ok(address) => {
+                self.registers.set(Registers::R1, address as u64);
+                self.registers.set_error(ErrorCodes::NoError);
+            },
+            Err(e) => {
+                self.registers.set(Registers::R1, 0);
+                self.registers.set_error(e);
+            }
+        }
+    }
+
+}
+
+
+#[cfg(test)]
+mod tests {
+
+    use rusty_vm_lib::executable::EXECUTABLE_HEADER_SIZE;
+    use rusty_vm_lib::symbols;
+
+    use super::*;
+    use crate::test_utils::{assemble, assemble_with_labels, processor, processor_with};
+
+
+    /// Guest code that runs every atomic instruction of the given size on the 8-byte slot at r8, printing every result followed by a space.
+    /// Whether a compare-exchange succeeded is printed as `=` or `!`
+    fn atomics_block(size: usize) -> String {
+        let max = if size == 8 { u64::MAX } else { (1 << (size * 8)) - 1 };
+        format!("
+    mov8 r1 r8
+    mov8 r2 {max}
+    xadd{size}
+    !print_result
+
+    # Wraps around to 5 at the width of the operation
+    mov8 r1 r8
+    mov8 r2 6
+    xadd{size}
+    !print_result
+
+    mov8 r1 r8
+    mov8 r2 5
+    mov8 r3 9
+    cas{size}
+    !print_exchanged exchanged_{size}_a
+    !print_result
+
+    mov8 r1 r8
+    mov8 r2 5
+    mov8 r3 1
+    cas{size}
+    !print_exchanged exchanged_{size}_b
+    !print_result
+
+    mov8 r1 r8
+    mov8 r2 7
+    xchg{size}
+    !print_result
+
+    mov8 r1 [r8]
+    !print_result
+
+    mov8 r1 r8
+    mov1 r2 8
+    iadd
+    mov8 r8 r1
+")
+    }
+
+
+    /// Run the atomics of every size in a memory of `max_memory_size` bytes, which sets where the memory starts on the host
+    fn run_atomics(max_memory_size: usize) {
+        let blocks: String = [1, 2, 4, 8].into_iter().map(atomics_block).collect();
+        let byte_code = assemble(&format!("
+.include:
+
+    archlib.asm
+    stdlib/memory.asm
+
+.text:
+
+    %% print_result:
+        mov8 print r1
+        intr =PRINT_UNSIGNED
+        mov1 print 32
+        intr =PRINT_CHAR
+    %endmacro
+
+    %% print_exchanged label:
+        mov1 print '='
+        jmpz {{label}}
+        mov1 print '!'
+        @{{label}}
+        intr =PRINT_CHAR
+    %endmacro
+
+@start
+
+    !calloc 4 8
+    mov8 r8 r1
+{}
+    # An address that isn't aligned to the size fails
+    mov8 r1 r8
+    inc r1
+    xadd2
+    mov print error
+    intr =PRINT_UNSIGNED
+    mov1 error 0
+    mov1 exit 0
+", blocks));
+
+        let mut processor = Processor::new(ProcessorConfig {
+            max_memory_size,
+            capture_output: true,
+            ..Default::default()
+        });
+        processor.load(&byte_code).unwrap();
+        assert_eq!(processor.run_for(None), RunState::Exited(ExitStatus { exit_code: 0, error: 0 }));
+
+        let expected: String = [1, 2, 4, 8].into_iter().map(|size: u32| {
+            let max = if size == 8 { u64::MAX } else { (1 << (size * 8)) - 1 };
+            format!("0 {max} =5 !9 9 7 ")
+        }).collect();
+        let expected = format!("{expected}{}", ErrorCodes::UnalignedAddress as u8);
+        assert_eq!(String::from_utf8(processor.take_output()).unwrap(), expected);
+    }
+
+
+    #[test]
+    fn test_atomics() {
+        run_atomics(4096);
+        // The memory ends at a page boundary, so its start isn't 8-byte aligned on the host unless it's aligned explicitly
+        run_atomics(4100);
+    }
+
+
+    /// Guest code that runs every sized memory instruction of the given size on the 8-byte slots at r8 and at `slot`, printing every result followed by a space.
+    /// r1 holds a value whose bytes are all different
+    fn sized_block(size: usize) -> String {
+        let max = if size == 8 { u64::MAX } else { (1 << (size * 8)) - 1 };
+        format!("
+    mov8 [r8] r1
+    mov{size} r2 [r8]
+    !print_value r2
+
+    mov8 [r8] 0
+    mov{size} [r8] r1
+    mov8 r2 [r8]
+    !print_value r2
+
+    mov8 [r8] 0
+    mov{size} [r8] {max}
+    mov8 r2 [r8]
+    !print_value r2
+
+    mov8 [slot] r1
+    mov{size} r2 [slot]
+    !print_value r2
+
+    mov8 [slot] 0
+    mov{size} [slot] r1
+    mov8 r2 [slot]
+    !print_value r2
+
+    mov8 [slot] 0
+    mov{size} [slot] {max}
+    mov8 r2 [slot]
+    !print_value r2
+
+    # Wraps around to 0 and back at the width of the operation
+    inc{size} [r8]
+    !print_value cf
+    mov8 r2 [r8]
+    !print_value r2
+    dec{size} [r8]
+    !print_value cf
+    mov8 r2 [r8]
+    !print_value r2
+
+    mov8 [slot] 0
+    inc{size} [slot]
+    dec{size} [slot]
+    dec{size} [slot]
+    !print_value cf
+    mov8 r2 [slot]
+    !print_value r2
+
+    # Only the low bytes of the memory are compared
+    mov8 [r8] r1
+    mov{size} [r8] 0
+    cmp{size} [r8] 0
+    !print_value zf
+")
+    }
+
+
+    #[test]
+    fn test_sized_instructions() {
+        let value: u64 = 0x8877665544332211;
+        let blocks: String = [1, 2, 4, 8].into_iter().map(sized_block).collect();
+        let byte_code = assemble(&format!("
+.include:
+
+    archlib.asm
+    stdlib/memory.asm
+
+.bss:
+
+    slot u8
+
+.text:
+
+    %% print_value reg:
+        mov print {{reg}}
+        intr =PRINT_UNSIGNED
+        mov1 print 32
+        intr =PRINT_CHAR
+    %endmacro
+
+@start
+
+    !calloc 1 8
+    mov8 r8 r1
+    mov8 r1 {value}
+{blocks}
+    mov8 exit 0
+"));
+
+        let expected: String = [1, 2, 4, 8].into_iter().map(|size: u32| {
+            let max = if size == 8 { u64::MAX } else { (1 << (size * 8)) - 1 };
+            let low = value & max;
+            format!("{low} {low} {max} {low} {low} {max} 1 0 1 {max} 1 {max} 1 ")
+        }).collect();
+
+        let mut processor = processor(&byte_code);
+        assert_eq!(processor.run_for(None), EXITED);
+        assert_eq!(String::from_utf8(processor.take_output()).unwrap(), expected);
+    }
+
+
+    /// Macros shared by the bulk memory tests. `reset` restores the digits followed by their terminator in the buffer at r8
+    const BULK_MEMORY_MACROS: &str = "
+    %% print_bytes address:
+        mov8 print {address}
+        mov8 r1 10
+        intr =PRINT_BYTES
+        mov1 print 32
+        intr =PRINT_CHAR
+    %endmacro
+
+    %% print_value reg:
+        mov print {reg}
+        intr =PRINT_UNSIGNED
+        mov1 print 32
+        intr =PRINT_CHAR
+    %endmacro
+
+    %% print_error:
+        !print_value error
+        mov1 error 0
+    %endmacro
+
+    %% reset:
+        mov8 r1 r8
+        mov8 r2 DIGITS
+        mov8 r3 11
+        mcpy
+    %endmacro
+";
+
+
+    #[test]
+    fn test_bulk_memory() {
+        let byte_code = assemble(&format!("
+.include:
+
+    archlib.asm
+    stdlib/memory.asm
+
+.data:
+
+    DIGITS string \"0123456789\\0\"
+
+.text:
+{BULK_MEMORY_MACROS}
+@start
+
+    !calloc 1 16
+    mov8 r8 r1
+
+    # Overlapping copies, forwards and backwards
+    !reset
+    mov8 r1 r8
+    mov1 r2 2
+    iadd
+    mov8 r2 r8
+    mov8 r3 5
+    mcpy
+    !print_bytes r8
+
+    !reset
+    mov8 r1 r8
+    mov1 r2 2
+    iadd
+    mov8 r2 r1
+    mov8 r1 r8
+    mov8 r3 5
+    mcpy
+    !print_bytes r8
+
+    # Zero lengths change nothing, even at the end of memory
+    !reset
+    mov8 r1 r8
+    mov8 r2 4096
+    mov8 r3 0
+    mcpy
+    mov8 r1 4096
+    mov1 r2 120
+    mset
+    !print_bytes r8
+
+    mov8 r1 r8
+    mov1 r2 3
+    iadd
+    mov1 r2 120
+    mov8 r3 4
+    mset
+    !print_bytes r8
+
+    # Equal, different and empty ranges
+    !reset
+    mov8 r1 r8
+    mov8 r2 DIGITS
+    mov8 r3 10
+    mcmp
+    !print_value zf
+    mov8 r1 r8
+    mov8 r2 DIGITS
+    inc r2
+    mov8 r3 10
+    mcmp
+    !print_value zf
+    mov8 r3 0
+    mcmp
+    !print_value zf
+
+    mov8 r1 DIGITS
+    slen
+    !print_value r1
+
+    # Found, not found and empty ranges, as offsets from the start
+    mov8 r1 r8
+    mov1 r2 53
+    mov8 r3 10
+    mchr
+    mov8 r2 r8
+    isub
+    !print_value r1
+    mov8 r1 r8
+    mov1 r2 120
+    mov8 r3 10
+    mchr
+    mov8 r2 r8
+    isub
+    !print_value r1
+    mov8 r1 r8
+    mov1 r2 48
+    mov8 r3 0
+    mchr
+    mov8 r2 r8
+    isub
+    !print_value r1
+
+    # Ranges past the end of memory or wrapping around the address space fail without touching memory
+    mov8 r1 r8
+    mov8 r2 4090
+    mov8 r3 10
+    mcpy
+    !print_error
+    mov8 r1 4090
+    mov8 r2 r8
+    mcpy
+    !print_error
+    mov8 r1 r8
+    mov1 r2 120
+    mov8 r3 {wrapping}
+    mset
+    !print_error
+    mov8 r1 r8
+    mov8 r2 4090
+    mov8 r3 10
+    mcmp
+    !print_error
+    mov8 r1 4090
+    mov1 r2 0
+    mchr
+    !print_error
+    mov8 r1 5000
+    slen
+    !print_error
+    !print_bytes r8
+
+    # A string that isn't terminated before the end of memory
+    mov1 [4095] 1
+    mov8 r1 4095
+    slen
+    !print_error
+
+    mov1 exit 0
+", wrapping = u64::MAX));
+
+        let mut processor = processor(&byte_code);
+        assert_eq!(processor.run_for(None), EXITED);
+
+        let out_of_bounds = ErrorCodes::OutOfBounds as u8;
+        let expected = format!(
+            "0101234789 2345656789 0123456789 012xxxx789 1 0 1 10 5 10 0 {0} {0} {0} {0} {0} {0} 0123456789 {0} ",
+            out_of_bounds
+        );
+        assert_eq!(String::from_utf8(processor.take_output()).unwrap(), expected);
+    }
+
+
+    #[test]
+    fn test_string_library() {
+        // The routines of the string library, which are built on the bulk memory instructions, return what their byte loops returned
+        let byte_code = assemble(&format!("
+.include:
+
+    archlib.asm
+    stdlib/memory.asm
+    string.asm
+
+.data:
+
+    DIGITS string \"0123456789\\0\"
+    EMPTY string \"\\0\"
+    ABC string \"abc\\0\"
+    ABD string \"abd\\0\"
+    ABCD string \"abcd\\0\"
+
+.text:
+{BULK_MEMORY_MACROS}
+@start
+
+    !calloc 1 16
+    mov8 r8 r1
+    mov1 r2 12
+    iadd
+    mov8 r7 r1
+
+    !strlen DIGITS
+    !print_value r1
+    !strlen EMPTY
+    !print_value r1
+
+    !strcmp ABC ABC
+    !print_value r1
+    !strcmp ABC ABD
+    !print_value r1
+    !strcmp ABC ABCD
+    !print_value r1
+    !strncmp ABC ABD 2
+    !print_value r1
+    !strncmp ABC ABD 3
+    !print_value r1
+
+    # The terminator is copied too
+    !memset r8 120 11
+    !strcpy ABC r8
+    !print_bytes r8
+
+    # Padded with zeros up to the length, or truncated without a terminator
+    !memset r8 120 11
+    !strncpy ABC r8 6
+    !print_bytes r8
+    !memset r8 120 11
+    !strncpy ABCD r8 2
+    !print_bytes r8
+
+    !reset
+    !memcpy ABC r8 3
+    !print_bytes r8
+    !reset
+    mov8 r1 r8
+    mov1 r2 2
+    iadd
+    mov8 r6 r1
+    !memmove r8 r6 5
+    !print_bytes r8
+    !reset
+    !memmove r6 r8 5
+    !print_bytes r8
+
+    !reset
+    !memset r6 120 3
+    !print_bytes r8
+
+    !reset
+    !memchr r8 55 10
+    mov8 r2 r8
+    isub
+    !print_value r1
+    !memchr r8 120 10
+    mov8 r2 r8
+    isub
+    !print_value r1
+
+    !reset
+    mov8 r1 r8
+    mov1 r2 7
+    iadd
+    mov8 r6 r1
+    !memswap r8 r6 3
+    !print_bytes r8
+
+    # The routines preserve the registers they don't return in
+    !print_value r7
+
+    mov1 exit 0
+"));
+
+        let mut processor = processor(&byte_code);
+        assert_eq!(processor.run_for(None), EXITED);
+
+        let buffer = processor.registers.get(Registers::R8) + 12;
+        let expected = format!(
+            "10 0 1 0 0 1 0 abc\0xxxxxx abc\0\0\0xxxx abxxxxxxxx abc3456789 0101234789 2345656789 01xxx56789 7 10 7893456012 {buffer} "
+        );
+        assert_eq!(String::from_utf8(processor.take_output()).unwrap(), expected);
+    }
+
+
+    /// Parse the lines printed by the bench macro into the average of every counter by name
+    fn parse_bench_report(output: &str) -> HashMap<&str, u64> {
+        output.lines().map(|line| {
+            let (name, value) = line.split_once(": ").unwrap();
+            (name, value.parse().unwrap())
+        }).collect()
+    }
+
+
+    #[test]
+    fn test_perf_counters() {
+        // Every iteration runs the two instructions of the routine, the call and the loop's decrement and jump
+        let byte_code = assemble("
+.include:
+
+    archlib.asm
+    bench.asm
+
+.text:
+
+@routine
+
+    mov1 r2 32
+    ret
+
+@start
+
+    !bench routine 100
+    mov1 exit 0
+");
+
+        let mut processor = processor(&byte_code);
+        assert_eq!(processor.run_for(None), RunState::Exited(ExitStatus { exit_code: 0, error: 0 }));
+
+        let output = String::from_utf8(processor.take_output()).unwrap();
+        let counters = parse_bench_report(&output);
+        assert_eq!(counters["instructions"], 5, "{}", output);
+        assert_eq!(counters["calls"], 1);
+        assert_eq!(counters["returns"], 1);
+        assert_eq!(counters["interrupts"], 0);
+        assert_eq!(counters["bulk memory bytes"], 0);
+        assert_eq!(counters["host fs bytes read"], 0);
+        assert_eq!(counters["host fs nanos"], 0);
+    }
+
+
+    #[test]
+    fn test_host_fs_counters() {
+        let path = std::env::temp_dir().join(format!("rusty_vm_test_{}_host_fs_counters", std::process::id()));
+
+        // Every iteration writes 16 bytes to the file and reads them back
+        let byte_code = assemble(&format!("
+.include:
+
+    archlib.asm
+    bench.asm
+    host_fs.asm
+
+.data:
+
+    FILE_PATH string \"{}\\0\"
+
+.text:
+
+@routine
+
+    !host_fs_write_at r8 FILE_PATH 16 0
+    !host_fs_read_at r8 FILE_PATH 16 0
+    ret
+
+@start
+
+    # Read, write and create
+    !host_fs_open FILE_PATH 7
+    mov8 r8 r1
+
+    !bench routine 10
+    mov1 exit 0
+", path.display()));
+
+        let mut processor = processor(&byte_code);
+        let state = processor.run_for(None);
+        std::fs::remove_file(&path).ok();
+        assert_eq!(state, RunState::Exited(ExitStatus { exit_code: 0, error: 0 }));
+
+        let output = String::from_utf8(processor.take_output()).unwrap();
+        let counters = parse_bench_report(&output);
+        assert_eq!(counters["interrupts"], 2, "{}", output);
+        assert_eq!(counters["host fs bytes read"], 16);
+        assert_eq!(counters["host fs bytes written"], 16);
+        assert!(counters["host fs nanos"] > 0);
+        assert_eq!(counters["storage nanos"], 0);
+        assert_eq!(counters["terminal nanos"], 0);
+    }
+
+
+    #[test]
+    fn test_embedded_stack_bounds() {
+        let byte_code = assemble("
+.text:
+
+@start
+
+    # Pops past the stack base, into the guard page
+    pop8 r1
+");
+
+        let mut processor = processor(&byte_code);
+        // Only starting a program from the binary may take over the faults of the process
+        assert!(!memory::is_stack_guard_handler_installed());
+        assert!(processor.check_stack_bounds);
+
+        let state = processor.run_for(None);
+        assert_eq!(state, RunState::Exited(ExitStatus { exit_code: 0, error: ErrorCodes::StackOverflow as u8 }));
+        assert!(!memory::is_stack_guard_handler_installed());
+    }
+
+
+    #[test]
+    fn test_trace_decodes() {
+        let path = std::env::temp_dir().join(format!("rusty_vm_test_{}_trace", std::process::id()));
+
+        let byte_code = assemble("
+.text:
+
+@start
+
+    mov8 r1 7
+    push8 r1
+    mov1 exit 0
+");
+
+        let mut processor = processor_with(&byte_code, ProcessorConfig {
+            trace: Some(TraceOptions {
+                file_path: path.clone(),
+                pc_range: None,
+                max_size: None,
+                registers: true,
+                memory: true,
+            }),
+            ..Default::default()
+        });
+        processor.memory.log_writes(true);
+        let state = processor.run_embedded(Processor::run_trace);
+        processor.tracer.as_mut().unwrap().finish();
+        assert_eq!(state, EXITED);
+
+        let trace = std::fs::read(&path).unwrap();
+        std::fs::remove_file(&path).ok();
+        let listing: Vec<String> = rusty_vm_lib::trace::decode_trace(&trace).unwrap()
+            .iter()
+            .map(ToString::to_string)
+            .collect();
+
+        assert_eq!(listing, [
+            "0x00000000: MOVE_INTO_REG_FROM_CONST (8B) r1 7",
+            "            r1 = 7 (0x7)",
+            "0x0000000b: PUSH_FROM_REG r1",
+            "            stp = 4088 (0xff8)",
+            "            [0xff8; 8] = [7, 0, 0, 0, 0, 0, 0, 0]",
+            "0x0000000d: MOVE_INTO_REG_FROM_CONST (1B) exit 0",
+            "0x00000011: EXIT",
+        ]);
+    }
+
+
+    #[test]
+    fn test_storage_read_into_code() {
+        // The routine keeps running while the read overwrites its code, and must run the new code once the read is collected
+        let collect_with_poll = "
+    @wait
+        call patch
+        !disk_poll r8
+        cmp1 r1 0
+        jmpz wait
+";
+        let collect_with_wait = "
+    call patch
+    !disk_wait r8
+";
+
+        for collect in [collect_with_poll, collect_with_wait] {
+            let byte_code = assemble(&format!("
+.include:
+
+    archlib.asm
+    stdio/disk.asm
+
+.text:
+
+@patch
+
+    mov8 r5 1
+    ret
+
+@replacement
+
+    mov8 r5 2
+    ret
+
+@start
+
+    !disk_write 0 replacement 11
+    !disk_submit_read 0 patch 11
+    mov8 r8 r1
+{}
+    call patch
+    mov8 exit r5
+", collect));
+
+            let path = std::env::temp_dir().join(format!("rusty_vm_test_{}_storage_read_into_code", std::process::id()));
+            let mut processor = processor_with(&byte_code, ProcessorConfig {
+                storage: Some(StorageOptions::new(path.clone(), Some(64))),
+                ..Default::default()
+            });
+            let state = processor.run_for(None);
+            drop(processor);
+            std::fs::remove_file(&path).ok();
+
+            assert_eq!(state, RunState::Exited(ExitStatus { exit_code: 2, error: 0 }));
+        }
+    }
+
+
+    #[test]
+    fn test_load_executable() {
+        // The zeroed slots are stored as a bss section, which is not part of the file
+        let slots: String = (0..32).map(|i| format!("    slot{} u8\n", i)).collect();
+        let byte_code = assemble(&format!("
+.include:
+
+    archlib.asm
+
+.bss:
+
+{}
+.text:
+
+@start
+
+    mov8 r3 [slot31]
+    inc r3
+    mov8 [slot31] r3
+    mov8 exit [slot31]
+", slots));
+
+        let executable = Executable::from_image(&byte_code).unwrap();
+        assert!(executable.sections.iter().any(|section| section.kind == SectionKind::Bss));
+
+        let encoded = executable.encode();
+        assert!(encoded.len() < byte_code.len());
+
+        let mut processor = processor(&encoded);
+        assert_eq!(processor.run_for(None), RunState::Exited(ExitStatus { exit_code: 1, error: 0 }));
+
+        let mut corrupted = encoded;
+        corrupted[EXECUTABLE_HEADER_SIZE] ^= 1;
+        assert!(Processor::new(ProcessorConfig::default()).load(&corrupted).is_err());
+    }
+
+
+    /// Run the program until it stops, with the JIT or fully interpreted.
+    /// Return the final state, the registers, the memory and the number of interpreted instructions
+    fn run_program(byte_code: &[u8], jit: bool) -> (RunState, [u64; REGISTER_COUNT], Vec<u8>, u64) {
+        let mut processor = processor(byte_code);
+        let state = processor.run_embedded(if jit { Processor::run_jit } else { Processor::run });
+        (state, processor.registers.snapshot(), processor.memory.get_raw().to_vec(), processor.perf.instructions)
+    }
+
+
+    /// Check that the program stops in the same state with and without the JIT and return the JIT registers
+    fn assert_jit_equivalent(byte_code: &[u8], expected_state: RunState) -> [u64; REGISTER_COUNT] {
+        let (jit_state, jit_registers, jit_memory, jit_instructions) = run_program(byte_code, true);
+        let (state, registers, memory, instructions) = run_program(byte_code, false);
+
+        assert_eq!(state, expected_state);
+        assert_eq!(jit_state, state);
+        assert_eq!(jit_registers, registers);
+        assert!(jit_memory == memory, "The memory differs with the JIT");
+
+        // The instructions run as native code are not counted
+        #[cfg(target_arch = "x86_64")]
+        assert!(jit_instructions < instructions, "No block was compiled");
+        #[cfg(not(target_arch = "x86_64"))]
+        assert_eq!(jit_instructions, instructions);
+
+        jit_registers
+    }
+
+
+    const EXITED: RunState = RunState::Exited(ExitStatus { exit_code: 0, error: 0 });
+
+
+    #[test]
+    fn test_jit_hot_loop() {
+        // Every compilable instruction in a loop that runs for many more iterations than it takes to compile it
+        let byte_code = assemble("
+.include:
+
+    archlib.asm
+    stdlib/memory.asm
+
+.text:
+
+@start
+
+    !calloc 2 8
+    mov8 r8 r1
+    mov8 r3 0
+    mov8 r4 1
+
+    @loop
+        mov8 r1 r3
+        mov8 r2 r4
+        iadd
+        xor
+        mov8 r2 65535
+        and
+        mov8 r2 r3
+        or
+        mov8 r2 7
+        isub
+        mov8 r4 r1
+
+        mov8 [r8] r4
+        mov4 r5 [r8]
+        mov1 [r8] 9
+        mov2 r6 [r8]
+        dec r6
+        inc r7
+        cmp8 [r8] r6
+        cmp1 [r8] 200
+        cmp r5 r6
+
+        inc r3
+        cmp8 r3 1000
+        jmplt loop
+
+    mov8 exit 0
+");
+
+        assert_jit_equivalent(&byte_code, EXITED);
+    }
+
+
+    #[test]
+    fn test_jit_jump_conditions() {
+        // Additions with unsigned and signed overflow and a subtraction with borrow,
+        // each followed by a jump, and a compare whose jump may or may not be fused with it
+        for jump in ["jmpnz", "jmpz", "jmpgr", "jmpge", "jmplt", "jmple", "jmpof", "jmpnof", "jmpcr", "jmpncr", "jmpsn", "jmpnsn"] {
+            let byte_code = assemble(&format!("
+.include:
+
+    archlib.asm
+
+.text:
+
+@start
+
+    mov8 r3 0
+
+    @loop
+        mov8 r1 r3
+        mov8 r2 18446744073709551516
+        iadd
+        {jump} carry
+        inc r4
+        @carry
+
+        mov8 r1 r3
+        mov8 r2 9223372036854775708
+        iadd
+        {jump} overflow
+        inc r5
+        @overflow
+
+        mov8 r1 r3
+        mov8 r2 100
+        isub
+        {jump} borrow
+        inc r6
+        @borrow
+
+        cmp8 r3 150
+        {jump} fused
+        inc r7
+        @fused
+
+        cmp1 r3 50
+        @unfused
+        {jump} next
+        inc r8
+        @next
+
+        inc r3
+        cmp8 r3 200
+        jmplt loop
+
+    mov8 exit 0
+"));
+
+            let registers = assert_jit_equivalent(&byte_code, EXITED);
+            // At least one jump depends on the counter
+            let taken: Vec<u64> = [Registers::R4, Registers::R5, Registers::R6, Registers::R7, Registers::R8].map(|reg| registers[reg as usize]).into();
+            assert!(taken.iter().any(|&count| count != 0 && count != 200), "{}: {:?}", jump, taken);
+        }
+    }
+
+
+    #[test]
+    fn test_jit_code_write() {
+        // Halfway through the loop, the loop overwrites the constant it adds on every iteration
+        let byte_code = assemble("
+.include:
+
+    archlib.asm
+
+.text:
+
+@start
+
+    mov8 r3 0
+    mov8 r4 0
+
+    @loop
+        @patch
+        mov8 r5 1
+        mov8 r1 r4
+        mov8 r2 r5
+        iadd
+        mov8 r4 r1
+
+        inc r3
+        cmp8 r3 200
+        jmpnz next
+
+        # Skip the opcode, the size and the register
+        mov8 r1 patch
+        mov1 r2 3
+        iadd
+        mov1 [r1] 2
+
+        @next
+        cmp8 r3 400
+        jmplt loop
+
+    mov8 exit 0
+");
+
+        let registers = assert_jit_equivalent(&byte_code, EXITED);
+        assert_eq!(registers[Registers::R4 as usize], 200 + 200 * 2);
+    }
+
+
+    #[test]
+    fn test_jit_heap_code_write() {
+        // Like `test_jit_code_write`, but the hot code is copied to the heap, outside the program image
+        let byte_code = assemble("
+.include:
+
+    archlib.asm
+    stdlib/memory.asm
+    string/memcpy.asm
+
+.text:
+
+@template
+    mov8 r5 1
+    jmp back
+
+@start
+
+    !malloc 32
+    mov8 r8 r1
+    !memcpy template r8 20
+
+    # Point the jump in the loop to the copy of the template
+    mov8 r1 go
+    mov1 r2 1
+    iadd
+    mov8 [r1] r8
+
+    mov8 r3 0
+    mov8 r4 0
+
+    @loop
+        @go
+        jmp template
+
+        @back
+        mov8 r1 r4
+        mov8 r2 r5
+        iadd
+        mov8 r4 r1
+
+        inc r3
+        cmp8 r3 200
+        jmpnz next
+
+        # Skip the opcode, the size and the register
+        mov8 r1 r8
+        mov1 r2 3
+        iadd
+        mov1 [r1] 2
+
+        @next
+        cmp8 r3 400
+        jmplt loop
+
+    mov8 exit 0
+");
+
+        let registers = assert_jit_equivalent(&byte_code, EXITED);
+        assert_eq!(registers[Registers::R4 as usize], 200 + 200 * 2);
+    }
+
+
+    #[test]
+    fn test_jit_out_of_bounds() {
+        // Hot loops that read and write at increasing addresses until they go past the end of memory, which faults
+        let reads = assemble("
+.include:
+
+    archlib.asm
+
+.text:
+
+@start
+
+    mov8 r8 0
+
+    @loop
+        mov8 r5 [r8]
+        mov8 r1 r8
+        mov1 r2 8
+        iadd
+        mov8 r8 r1
+        jmp loop
+");
+
+        let writes = assemble("
+.include:
+
+    archlib.asm
+
+.text:
+
+@start
+
+    mov8 r8 end
+
+    @loop
+        mov8 [r8] r8
+        mov8 r1 r8
+        mov1 r2 8
+        iadd
+        mov8 r8 r1
+        jmp loop
+
+@end
+");
+
+        for byte_code in [reads, writes] {
+            let (state, ..) = run_program(&byte_code, false);
+            assert!(matches!(state, RunState::Faulted(_)), "{:?}", state);
+            assert_jit_equivalent(&byte_code, state);
+        }
+    }
+
+
+
+    /// Run the program with its output written to a recorder, returning the chunks written to the stream at every flush
+    fn recorded_output(byte_code: &[u8], buffering: StdoutBuffering) -> Vec<String> {
+        let recorder = output::FlushRecorder::default();
+        let mut processor = processor_with(byte_code, ProcessorConfig::default());
+        processor.stdout = Some(GuestStdout::recorded(buffering, recorder.clone()));
+        assert_eq!(processor.run_for(None), RunState::Exited(ExitStatus { exit_code: 0, error: 0 }));
+        let chunks = recorder.0.lock().unwrap().iter().map(|chunk| String::from_utf8(chunk.clone()).unwrap()).collect();
+        chunks
+    }
+
+
+    #[test]
+    fn test_stdout_flush_points() {
+        let byte_code = assemble("
+.include:
+
+    archlib.asm
+
+.text:
+
+@start
+
+    mov1 print 'a'
+    intr =PRINT_CHAR
+    mov1 print 'b'
+    intr =PRINT_CHAR
+    intr =FLUSH_STDOUT
+
+    mov1 print 'c'
+    intr =PRINT_CHAR
+    mov1 print 10
+    intr =PRINT_CHAR
+    mov8 print 42
+    intr =PRINT_UNSIGNED
+    mov1 print 'd'
+    intr =PRINT_CHAR
+
+    mov1 exit 0
+");
+
+        // The prints are buffered until the program flushes or exits
+        assert_eq!(recorded_output(&byte_code, StdoutBuffering::Full), ["ab", "c\n42d"]);
+        // Line buffering also writes the output at every newline
+        assert_eq!(recorded_output(&byte_code, StdoutBuffering::Line), ["ab", "c\n", "42d"]);
+    }
+
+
+
+    #[test]
+    fn test_profile() {
+        let (byte_code, labels) = assemble_with_labels("
+.text:
+
+@@increment
+    inc r1
+    ret
+
+@start
+
+    mov1 r1 0
+    call increment
+    call increment
+    mov1 exit 0
+");
+
+        // Go through the symbol file written by the assembler
+        let symbols_path = std::env::temp_dir().join(format!("rusty_vm_test_{}_profile.sym", std::process::id()));
+        symbols::save_symbols(&::assembler::assembler::symbol_table(&labels), &symbols_path).unwrap();
+        let symbols = symbols::load_symbols(&symbols_path).unwrap();
+        std::fs::remove_file(&symbols_path).unwrap();
+
+        let mut processor = processor_with(&byte_code, ProcessorConfig {
+            profile: Some(ProfileOptions::new(symbols, PathBuf::new())),
+            ..Default::default()
+        });
+        let code_size = processor.memory.get_code_size();
+        let pc = processor.registers.pc();
+        processor.profiler.as_mut().unwrap().start(code_size, pc);
+
+        assert_eq!(processor.run_embedded(Processor::run_profile), RunState::Exited(ExitStatus { exit_code: 0, error: 0 }));
+
+        // The calls and the final exit count in the caller, the returns in the callee
+        let folded = processor.profiler.as_ref().unwrap().folded_stacks();
+        assert_eq!(folded, "start 5\nstart;increment 4\n");
+    }
+
+}
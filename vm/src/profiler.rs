@@ -0,0 +1,372 @@
+use std::collections::HashMap;
+use std::fs;
+use std::io::{self, Write};
+use std::path::PathBuf;
+use std::time::{Duration, Instant};
+
+use rusty_vm_lib::byte_code::{ByteCodes, BYTE_CODE_COUNT};
+use rusty_vm_lib::interrupts::Interrupts;
+use rusty_vm_lib::symbols::{self, SymbolTable};
+use rusty_vm_lib::vm::Address;
+
+
+/// Number of entries shown in each table of the report
+const REPORT_TOP_ENTRIES: usize = 20;
+
+
+pub struct ProfileOptions {
+
+    pub symbols: SymbolTable,
+    /// Where to write the folded call stacks
+    pub folded_stacks_path: PathBuf,
+
+}
+
+
+impl ProfileOptions {
+
+    pub fn new(symbols: SymbolTable, folded_stacks_path: PathBuf) -> Self {
+        Self {
+            symbols,
+            folded_stacks_path,
+        }
+    }
+
+}
+
+
+/// A function in the call tree, identified by the path of calls that led to it
+struct CallNode {
+
+    function: Address,
+    parent: usize,
+    children: HashMap<Address, usize>,
+    /// Instructions executed in this function, excluding its callees
+    self_instructions: u64,
+
+}
+
+
+impl CallNode {
+
+    fn new(function: Address, parent: usize) -> Self {
+        Self {
+            function,
+            parent,
+            children: HashMap::new(),
+            self_instructions: 0,
+        }
+    }
+
+}
+
+
+#[derive(Default, Clone, Copy)]
+struct InterruptStats {
+
+    count: u64,
+    time: Duration,
+
+}
+
+
+/// Collects execution statistics of the guest program
+pub struct Profiler {
+
+    options: ProfileOptions,
+    opcode_counts: [u64; BYTE_CODE_COUNT],
+    /// Execution count of every address of the program image
+    pc_counts: Vec<u64>,
+    /// Execution count of the addresses outside of the program image
+    other_pc_counts: HashMap<Address, u64>,
+    call_tree: Vec<CallNode>,
+    current_node: usize,
+    interrupts: HashMap<u8, InterruptStats>,
+    start_time: Instant,
+
+}
+
+
+impl Profiler {
+
+    pub fn new(options: ProfileOptions) -> Self {
+        Self {
+            options,
+            opcode_counts: [0; BYTE_CODE_COUNT],
+            pc_counts: Vec::new(),
+            other_pc_counts: HashMap::new(),
+            call_tree: vec![CallNode::new(0, 0)],
+            current_node: 0,
+            interrupts: HashMap::new(),
+            start_time: Instant::now(),
+        }
+    }
+
+
+    /// Start profiling a program of `code_size` bytes whose execution starts at `program_start`, discarding the previous statistics
+    pub fn start(&mut self, code_size: usize, program_start: Address) {
+        self.opcode_counts = [0; BYTE_CODE_COUNT];
+        self.pc_counts = vec![0; code_size];
+        self.other_pc_counts.clear();
+        self.call_tree = vec![CallNode::new(program_start, 0)];
+        self.current_node = 0;
+        self.interrupts.clear();
+        self.start_time = Instant::now();
+    }
+
+
+    /// Record the execution of the instruction at `pc`
+    #[inline]
+    pub fn record_instruction(&mut self, pc: Address, opcode: ByteCodes) {
+        self.opcode_counts[opcode as usize] += 1;
+
+        match self.pc_counts.get_mut(pc) {
+            Some(count) => *count += 1,
+            None => *self.other_pc_counts.entry(pc).or_default() += 1
+        }
+
+        self.call_tree[self.current_node].self_instructions += 1;
+    }
+
+
+    /// Record a call to the function at `function`
+    pub fn enter_function(&mut self, function: Address) {
+        let next_index = self.call_tree.len();
+        let current_node = self.current_node;
+
+        let child = *self.call_tree[current_node].children.entry(function).or_insert(next_index);
+        if child == next_index {
+            self.call_tree.push(CallNode::new(function, current_node));
+        }
+
+        self.current_node = child;
+    }
+
+
+    /// Record a return from the current function. Returns from the outermost function are ignored
+    pub fn leave_function(&mut self) {
+        self.current_node = self.call_tree[self.current_node].parent;
+    }
+
+
+    pub fn record_interrupt(&mut self, intr_code: u8, time: Duration) {
+        let stats = self.interrupts.entry(intr_code).or_default();
+        stats.count += 1;
+        stats.time += time;
+    }
+
+
+    fn function_name(&self, address: Address) -> String {
+        match self.options.symbols.get(&address) {
+            Some(name) => name.clone(),
+            None => format!("{:#x}", address)
+        }
+    }
+
+
+    fn location_name(&self, address: Address) -> String {
+        match symbols::resolve(&self.options.symbols, address) {
+            Some((name, 0)) => name.to_string(),
+            Some((name, offset)) => format!("{}+{:#x}", name, offset),
+            None => format!("{:#x}", address)
+        }
+    }
+
+
+    /// Return the call stacks in the folded format read by flamegraph tools. The weight of a stack is the number of instructions executed in it
+    pub fn folded_stacks(&self) -> String {
+        let mut output = String::new();
+
+        for (index, node) in self.call_tree.iter().enumerate() {
+            if node.self_instructions == 0 {
+                continue;
+            }
+
+            let mut stack = Vec::new();
+            let mut current = index;
+            loop {
+                stack.push(self.function_name(self.call_tree[current].function));
+                if current == 0 {
+                    break;
+                }
+                current = self.call_tree[current].parent;
+            }
+            stack.reverse();
+
+            output.push_str(&format!("{} {}\n", stack.join(";"), node.self_instructions));
+        }
+
+        output
+    }
+
+
+    fn write_folded_stacks(&self) -> io::Result<()> {
+        fs::write(&self.options.folded_stacks_path, self.folded_stacks())
+    }
+
+
+    /// Write the profiling report to stderr and the folded call stacks to their file
+    pub fn write_report(&self) {
+        let mut report = String::new();
+
+        let total_instructions: u64 = self.opcode_counts.iter().sum();
+        let elapsed = self.start_time.elapsed();
+
+        report.push_str(&format!("\n==== Profile ====\n\n{} instructions executed in {:?}\n", total_instructions, elapsed));
+
+        let percent = |count: u64| count as f64 * 100.0 / total_instructions.max(1) as f64;
+
+        // Opcodes
+        let mut opcodes: Vec<(usize, u64)> = self.opcode_counts.iter().copied().enumerate().filter(|&(_, count)| count != 0).collect();
+        opcodes.sort_unstable_by(|a, b| b.1.cmp(&a.1).then(a.0.cmp(&b.0)));
+
+        report.push_str("\nOpcodes:\n");
+        for &(opcode, count) in opcodes.iter().take(REPORT_TOP_ENTRIES) {
+            report.push_str(&format!("{:>14} {:>6.2}%  {}\n", count, percent(count), ByteCodes::from(opcode as u8)));
+        }
+
+        // Addresses
+        let mut pcs: Vec<(Address, u64)> = self.pc_counts.iter().copied().enumerate()
+            .filter(|&(_, count)| count != 0)
+            .chain(self.other_pc_counts.iter().map(|(&pc, &count)| (pc, count)))
+            .collect();
+        pcs.sort_unstable_by(|a, b| b.1.cmp(&a.1).then(a.0.cmp(&b.0)));
+
+        report.push_str("\nHottest instructions:\n");
+        for &(pc, count) in pcs.iter().take(REPORT_TOP_ENTRIES) {
+            report.push_str(&format!("{:>14} {:>6.2}%  {:#x} {}\n", count, percent(count), pc, self.location_name(pc)));
+        }
+
+        // Functions
+        let mut self_counts: HashMap<Address, u64> = HashMap::new();
+        let mut total_counts: HashMap<Address, u64> = HashMap::new();
+        for (index, node) in self.call_tree.iter().enumerate() {
+            *self_counts.entry(node.function).or_default() += node.self_instructions;
+
+            // Count the instructions once for every distinct function in the stack, so recursion isn't counted twice
+            let mut seen = Vec::new();
+            let mut current = index;
+            loop {
+                let function = self.call_tree[current].function;
+                if !seen.contains(&function) {
+                    seen.push(function);
+                    *total_counts.entry(function).or_default() += node.self_instructions;
+                }
+                if current == 0 {
+                    break;
+                }
+                current = self.call_tree[current].parent;
+            }
+        }
+        let mut functions: Vec<(Address, u64)> = total_counts.into_iter().collect();
+        functions.sort_unstable_by(|a, b| b.1.cmp(&a.1).then(a.0.cmp(&b.0)));
+
+        report.push_str("\nFunctions:       total            self\n");
+        for &(function, total) in functions.iter().take(REPORT_TOP_ENTRIES) {
+            let self_count = self_counts[&function];
+            report.push_str(&format!(
+                "{:>14} {:>6.2}% {:>14} {:>6.2}%  {}\n",
+                total, percent(total), self_count, percent(self_count), self.function_name(function)
+            ));
+        }
+
+        // Interrupts
+        if !self.interrupts.is_empty() {
+            let mut interrupts: Vec<(u8, InterruptStats)> = self.interrupts.iter().map(|(&code, &stats)| (code, stats)).collect();
+            interrupts.sort_unstable_by(|a, b| b.1.time.cmp(&a.1.time));
+
+            report.push_str("\nInterrupts:\n");
+            for (code, stats) in interrupts {
+                report.push_str(&format!("{:>14} calls {:>14?}  {:?}\n", stats.count, stats.time, Interrupts::from(code)));
+            }
+        }
+
+        match self.write_folded_stacks() {
+            Ok(()) => report.push_str(&format!("\nFolded call stacks written to {}\n", self.options.folded_stacks_path.display())),
+            Err(error) => report.push_str(&format!("\nFailed to write folded call stacks to {}: {}\n", self.options.folded_stacks_path.display(), error))
+        }
+
+        io::stderr().write_all(report.as_bytes()).expect("Failed to write to stderr");
+    }
+
+}
+
+
+#[cfg(test)]
+mod tests {
+
+    use super::*;
+
+
+    fn profiler() -> Profiler {
+        let symbols = SymbolTable::from([(0, "start".to_string()), (10, "helper".to_string())]);
+        let mut profiler = Profiler::new(ProfileOptions::new(symbols, PathBuf::new()));
+        profiler.start(20, 0);
+        profiler
+    }
+
+
+    #[test]
+    fn test_counts() {
+        let mut profiler = profiler();
+
+        profiler.record_instruction(0, ByteCodes::NO_OPERATION);
+        profiler.record_instruction(1, ByteCodes::CALL);
+        profiler.enter_function(10);
+        for _ in 0..2 {
+            profiler.record_instruction(10, ByteCodes::INC_REG);
+        }
+        profiler.record_instruction(11, ByteCodes::RETURN);
+        profiler.leave_function();
+        // Addresses outside of the program image are counted separately
+        profiler.record_instruction(100, ByteCodes::NO_OPERATION);
+
+        profiler.record_interrupt(Interrupts::PrintChar as u8, Duration::from_micros(3));
+        profiler.record_interrupt(Interrupts::PrintChar as u8, Duration::from_micros(4));
+
+        assert_eq!(profiler.opcode_counts[ByteCodes::NO_OPERATION as usize], 2);
+        assert_eq!(profiler.opcode_counts[ByteCodes::INC_REG as usize], 2);
+        assert_eq!(profiler.opcode_counts.iter().sum::<u64>(), 6);
+
+        assert_eq!(profiler.pc_counts[0], 1);
+        assert_eq!(profiler.pc_counts[10], 2);
+        assert_eq!(profiler.pc_counts.iter().sum::<u64>(), 5);
+        assert_eq!(profiler.other_pc_counts, HashMap::from([(100, 1)]));
+
+        let print_char = profiler.interrupts[&(Interrupts::PrintChar as u8)];
+        assert_eq!(print_char.count, 2);
+        assert_eq!(print_char.time, Duration::from_micros(7));
+
+        assert_eq!(profiler.location_name(12), "helper+0x2");
+        assert_eq!(profiler.function_name(10), "helper");
+        assert_eq!(profiler.function_name(5), "0x5");
+    }
+
+
+    #[test]
+    fn test_folded_stacks() {
+        let mut profiler = profiler();
+
+        profiler.record_instruction(0, ByteCodes::CALL);
+        // Calls through the same path are merged, calls from another function get their own stack
+        for _ in 0..2 {
+            profiler.enter_function(10);
+            profiler.record_instruction(10, ByteCodes::RETURN);
+            profiler.leave_function();
+        }
+        profiler.enter_function(5);
+        profiler.enter_function(10);
+        profiler.record_instruction(10, ByteCodes::RETURN);
+        profiler.leave_function();
+        profiler.leave_function();
+        // A return from the outermost function is ignored
+        profiler.leave_function();
+        profiler.record_instruction(1, ByteCodes::EXIT);
+
+        let folded = profiler.folded_stacks();
+        let mut stacks: Vec<&str> = folded.lines().collect();
+        stacks.sort_unstable();
+        assert_eq!(stacks, ["start 2", "start;0x5;helper 1", "start;helper 2"]);
+    }
+
+}
@@ -2,61 +2,332 @@ use rusty_vm_lib::registers::{REGISTER_COUNT, RegisterContentType, Registers};
 use rusty_vm_lib::vm::{ErrorCodes, Address};
 
 
-pub struct CPURegisters([RegisterContentType; REGISTER_COUNT]);
+/// Result of the last flag-producing operation, from which the flags are computed when they're read
+#[derive(Clone, Copy, Debug)]
+pub enum LazyFlags {
+
+    /// The flags are stored in the flag registers
+    Materialized,
+    /// The zero and sign flags are derived from the result. The other flags are cleared
+    Result(u64),
+    /// Like `Result`, but the overflow flag is set
+    ResultWithOverflow(u64),
+    /// Like `Result`, with the given carry flag. The overflow flag is set if either the carry or the sign flag is set, but not both
+    Carry(u64, bool),
+    /// Like `Result`, with the given remainder flag
+    Remainder(u64, u64),
+    /// Float result. The unused integer flags are used as float flags
+    Float(f64),
+
+}
+
+
+impl LazyFlags {
+
+    /// Compute the value of the given flag register
+    #[inline(always)]
+    fn flag(self, register: Registers) -> u64 {
+
+        let result = match self {
+            LazyFlags::Materialized => unreachable!(),
+            LazyFlags::Float(result) => return match register {
+                Registers::ZERO_FLAG => result == 0.0,
+                Registers::SIGN_FLAG => result.is_sign_negative(),
+                Registers::REMAINDER_FLAG => result.is_nan(),
+                Registers::CARRY_FLAG => result.is_infinite() && result.is_sign_positive(),
+                Registers::OVERFLOW_FLAG => result.is_infinite() && result.is_sign_negative(),
+                _ => unreachable!()
+            } as u64,
+            LazyFlags::Result(result) |
+            LazyFlags::ResultWithOverflow(result) |
+            LazyFlags::Carry(result, _) |
+            LazyFlags::Remainder(result, _)
+                => result
+        };
+
+        let sign = result >> 63;
+
+        match register {
+            Registers::ZERO_FLAG => (result == 0) as u64,
+            Registers::SIGN_FLAG => sign,
+            Registers::REMAINDER_FLAG => if let LazyFlags::Remainder(_, remainder) = self { remainder } else { 0 },
+            Registers::CARRY_FLAG => if let LazyFlags::Carry(_, carry) = self { carry as u64 } else { 0 },
+            Registers::OVERFLOW_FLAG => match self {
+                LazyFlags::ResultWithOverflow(_) => 1,
+                LazyFlags::Carry(_, carry) => carry as u64 ^ sign,
+                _ => 0
+            },
+            _ => unreachable!()
+        }
+    }
+
+}
+
+
+/// Flag registers, which are the last registers
+const FLAG_REGISTERS: [Registers; 5] = [
+    Registers::ZERO_FLAG,
+    Registers::SIGN_FLAG,
+    Registers::REMAINDER_FLAG,
+    Registers::CARRY_FLAG,
+    Registers::OVERFLOW_FLAG,
+];
+
+
+#[inline(always)]
+const fn is_flag_register(register: Registers) -> bool {
+    register as usize >= Registers::ZERO_FLAG as usize
+}
+
+
+pub struct CPURegisters {
+
+    registers: [RegisterContentType; REGISTER_COUNT],
+    /// Flags that haven't been written to the flag registers yet
+    flags: LazyFlags,
+
+}
 
 
 impl CPURegisters {
 
     pub fn new() -> Self {
-        CPURegisters([0; REGISTER_COUNT])
+        CPURegisters {
+            registers: [0; REGISTER_COUNT],
+            flags: LazyFlags::Materialized,
+        }
     }
 
 
-    /// Get the value of the given register
+    /// Get the value of the given register. Pending flags are computed on the fly
     #[inline(always)]
     pub fn get(&self, register: Registers) -> u64 {
-        self.0[register as usize]
+        if is_flag_register(register) && !matches!(self.flags, LazyFlags::Materialized) {
+            return self.flags.flag(register);
+        }
+        self.registers[register as usize]
     }
 
 
     /// Set the value of the given register
     #[inline(always)]
     pub fn set(&mut self, register: Registers, value: u64) {
-        self.0[register as usize] = value;
+        if is_flag_register(register) {
+            self.materialize_flags();
+        }
+        self.registers[register as usize] = value;
+    }
+
+
+    /// Record the result of a flag-producing operation. The flags are only computed when they're read
+    #[inline(always)]
+    pub fn set_flags(&mut self, flags: LazyFlags) {
+        self.flags = flags;
+    }
+
+
+    /// Write the pending flags to the flag registers
+    pub fn materialize_flags(&mut self) {
+        if matches!(self.flags, LazyFlags::Materialized) {
+            return;
+        }
+        for register in FLAG_REGISTERS {
+            self.registers[register as usize] = self.flags.flag(register);
+        }
+        self.flags = LazyFlags::Materialized;
     }
 
 
     /// Set the error register
     #[inline(always)]
     pub fn set_error(&mut self, error: ErrorCodes) {
-        self.0[Registers::ERROR as usize] = error as u64;
+        self.registers[Registers::ERROR as usize] = error as u64;
     }
 
 
     /// Increment the program counter by the given offset.
     #[inline(always)]
     pub fn inc_pc(&mut self, offset: usize) {
-        self.0[Registers::PROGRAM_COUNTER as usize] += offset as u64;
+        self.registers[Registers::PROGRAM_COUNTER as usize] += offset as u64;
     }
 
 
     /// Get the program counter
     #[inline(always)]
     pub fn pc(&self) -> Address {
-        self.0[Registers::PROGRAM_COUNTER as usize] as Address
+        self.registers[Registers::PROGRAM_COUNTER as usize] as Address
     }
 
 
     /// Get the stack top pointer
     #[inline(always)]
     pub fn stack_top(&self) -> Address {
-        self.0[Registers::STACK_TOP_POINTER as usize] as Address
+        self.registers[Registers::STACK_TOP_POINTER as usize] as Address
     }
 
 
-    pub fn iter(&self) -> std::slice::Iter<'_, u64> {
-        self.0.iter()
+    /// Get a raw pointer to the register array, indexed by `Registers`.
+    /// The pending flags are materialized, so the flag registers can be read and written through the pointer
+    pub fn as_mut_ptr(&mut self) -> *mut RegisterContentType {
+        self.materialize_flags();
+        self.registers.as_mut_ptr()
+    }
+
+
+    pub fn iter(&mut self) -> std::slice::Iter<'_, u64> {
+        self.materialize_flags();
+        self.registers.iter()
+    }
+
+
+    /// Return a copy of the register values, with the pending flags computed, without materializing them
+    #[inline]
+    pub fn snapshot(&self) -> [u64; REGISTER_COUNT] {
+        let mut values = self.registers;
+        if !matches!(self.flags, LazyFlags::Materialized) {
+            for register in FLAG_REGISTERS {
+                values[register as usize] = self.flags.flag(register);
+            }
+        }
+        values
     }
 
 }
 
+
+
+#[cfg(test)]
+mod tests {
+
+    use super::*;
+
+
+    /// The flag registers as the interpreter wrote them on every operation before they were evaluated lazily
+    fn eager_flags(zf: bool, sf: bool, rf: u64, cf: bool, of: bool) -> [u64; 5] {
+        [zf as u64, sf as u64, rf, cf as u64, of as u64]
+    }
+
+
+    fn is_msb_set(value: u64) -> bool {
+        value & (1 << 63) != 0
+    }
+
+
+    /// Flags of an integer operation with a carry, like additions, subtractions, increments and decrements
+    fn carry_case(result: u64, carry: bool) -> (LazyFlags, [u64; 5]) {
+        (LazyFlags::Carry(result, carry), eager_flags(result == 0, is_msb_set(result), 0, carry, carry ^ is_msb_set(result)))
+    }
+
+
+    /// Increment and decrement a value of the given width like the interpreter does, wrapping around at the width
+    fn step_cases(value: u64, width: u32) -> [(LazyFlags, [u64; 5]); 2] {
+        let max = u64::MAX >> (64 - width * 8);
+        let (increment, decrement) = (value.wrapping_add(1) & max, value.wrapping_sub(1) & max);
+        [carry_case(increment, value == max), carry_case(decrement, value == 0)]
+    }
+
+
+    /// Pairs of pending flags and the flags the eager code wrote for the same operation
+    fn cases() -> Vec<(LazyFlags, [u64; 5])> {
+        let mut cases = Vec::new();
+
+        for width in [1, 2, 4, 8] {
+            let max = u64::MAX >> (64 - width * 8);
+            // Zero, the largest signed and unsigned values and the smallest negative value at the width
+            for value in [0, 1, max >> 1, (max >> 1) + 1, max - 1, max] {
+                cases.extend(step_cases(value, width));
+            }
+        }
+
+        let operands = [0, 1, 2, i64::MAX as u64, i64::MIN as u64, u64::MAX];
+        for a in operands {
+            for b in operands {
+                let (sum, carry) = a.overflowing_add(b);
+                cases.push(carry_case(sum, carry));
+                let (difference, borrow) = a.overflowing_sub(b);
+                cases.push(carry_case(difference, borrow));
+
+                if b != 0 {
+                    cases.push((LazyFlags::Remainder(a / b, a % b), eager_flags(a / b == 0, is_msb_set(a / b), a % b, false, false)));
+                }
+
+                // Compares, logical and and or, and modulo
+                let result = (a as i64).wrapping_sub(b as i64) as u64;
+                cases.push((LazyFlags::Result(result), eager_flags(result == 0, is_msb_set(result), 0, false, false)));
+
+                // Xor and not
+                let result = a ^ b;
+                cases.push((LazyFlags::ResultWithOverflow(result), eager_flags(result == 0, is_msb_set(result), 0, false, true)));
+            }
+        }
+
+        for result in [0.0, -0.0, 1.5, -2.0, f64::NAN, -f64::NAN, f64::INFINITY, f64::NEG_INFINITY, f64::MIN_POSITIVE] {
+            cases.push((LazyFlags::Float(result), eager_flags(
+                result == 0.0,
+                result.is_sign_negative(),
+                result.is_nan() as u64,
+                result.is_infinite() && result.is_sign_positive(),
+                result.is_infinite() && result.is_sign_negative()
+            )));
+        }
+
+        cases
+    }
+
+
+    fn registers_with(flags: LazyFlags) -> CPURegisters {
+        let mut registers = CPURegisters::new();
+        registers.set(Registers::R1, 42);
+        registers.set_flags(flags);
+        registers
+    }
+
+
+    #[test]
+    fn test_lazy_flags() {
+        for (flags, expected) in cases() {
+            let registers = registers_with(flags);
+            assert_eq!(FLAG_REGISTERS.map(|register| registers.get(register)), expected, "get {:?}", flags);
+
+            let snapshot = registers.snapshot();
+            assert_eq!(FLAG_REGISTERS.map(|register| snapshot[register as usize]), expected, "snapshot {:?}", flags);
+            assert_eq!(snapshot[Registers::R1 as usize], 42);
+
+            let mut registers = registers_with(flags);
+            let values: Vec<u64> = registers.iter().copied().collect();
+            assert_eq!(FLAG_REGISTERS.map(|register| values[register as usize]), expected, "iter {:?}", flags);
+
+            let mut registers = registers_with(flags);
+            let pointer = registers.as_mut_ptr();
+            let values = FLAG_REGISTERS.map(|register| unsafe { *pointer.add(register as usize) });
+            assert_eq!(values, expected, "as_mut_ptr {:?}", flags);
+
+            // Writing a flag keeps the other pending flags
+            let mut registers = registers_with(flags);
+            registers.set(Registers::CARRY_FLAG, 7);
+            let mut expected = expected;
+            expected[3] = 7;
+            assert_eq!(FLAG_REGISTERS.map(|register| registers.get(register)), expected, "set {:?}", flags);
+        }
+    }
+
+
+    #[test]
+    fn test_materialize_flags() {
+        let mut registers = registers_with(LazyFlags::Carry(0, true));
+        registers.materialize_flags();
+        assert!(matches!(registers.flags, LazyFlags::Materialized));
+
+        // The flags written by native code through the pointer are the ones that are read
+        let pointer = registers.as_mut_ptr();
+        unsafe { *pointer.add(Registers::ZERO_FLAG as usize) = 0 };
+        assert_eq!(registers.get(Registers::ZERO_FLAG), 0);
+        assert_eq!(registers.get(Registers::CARRY_FLAG), 1);
+
+        // New pending flags replace the materialized ones
+        registers.set_flags(LazyFlags::Result(0));
+        assert_eq!(registers.get(Registers::ZERO_FLAG), 1);
+        assert_eq!(registers.get(Registers::CARRY_FLAG), 0);
+    }
+
+}
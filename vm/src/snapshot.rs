@@ -0,0 +1,326 @@
+use std::fs::{self, File};
+use std::io;
+use std::os::unix::fs::FileExt;
+use std::path::{Path, PathBuf};
+
+use rusty_vm_lib::registers::REGISTER_COUNT;
+use rusty_vm_lib::vm::Address;
+
+use crate::allocator::Allocator;
+use crate::error;
+use crate::memory::{self, Memory};
+use crate::processor::StorageOptions;
+use crate::storage::Storage;
+
+
+/// Bytes at the start of every snapshot file
+const SNAPSHOT_MAGIC: &[u8; 8] = b"RVMSNAP\0";
+
+const SNAPSHOT_VERSION: u32 = 2;
+
+/// Size of the fixed part of the header: magic, version, page size and state size
+const FIXED_HEADER_SIZE: usize = SNAPSHOT_MAGIC.len() + 4 + 4 + 8;
+
+
+pub struct SnapshotOptions {
+
+    /// Where snapshots are saved
+    pub file_path: PathBuf,
+    /// Save a snapshot right before the instruction at this address is first executed
+    pub at_pc: Option<Address>,
+
+}
+
+
+/// Little endian serializer of the snapshot state
+#[derive(Default)]
+pub struct Encoder {
+
+    bytes: Vec<u8>,
+
+}
+
+
+impl Encoder {
+
+    pub fn u64(&mut self, value: u64) {
+        self.bytes.extend_from_slice(&value.to_le_bytes());
+    }
+
+
+    pub fn usize(&mut self, value: usize) {
+        self.u64(value as u64);
+    }
+
+
+    /// Write a length-prefixed byte string
+    pub fn bytes(&mut self, bytes: &[u8]) {
+        self.usize(bytes.len());
+        self.bytes.extend_from_slice(bytes);
+    }
+
+
+    pub fn into_bytes(self) -> Vec<u8> {
+        self.bytes
+    }
+
+}
+
+
+/// Deserializer of the snapshot state written by `Encoder`. Every read returns `None` if the data is truncated
+pub struct Decoder<'a> {
+
+    bytes: &'a [u8],
+
+}
+
+
+impl<'a> Decoder<'a> {
+
+    pub fn new(bytes: &'a [u8]) -> Self {
+        Self { bytes }
+    }
+
+
+    pub fn u64(&mut self) -> Option<u64> {
+        let (value, rest) = self.bytes.split_first_chunk::<8>()?;
+        self.bytes = rest;
+        Some(u64::from_le_bytes(*value))
+    }
+
+
+    pub fn usize(&mut self) -> Option<usize> {
+        self.u64().map(|value| value as usize)
+    }
+
+
+    pub fn bytes(&mut self) -> Option<&'a [u8]> {
+        let size = self.usize()?;
+        if size > self.bytes.len() {
+            return None;
+        }
+        let (bytes, rest) = self.bytes.split_at(size);
+        self.bytes = rest;
+        Some(bytes)
+    }
+
+}
+
+
+/// Return the offset of the memory image in a snapshot whose state is `state_size` bytes long
+fn image_offset(state_size: usize) -> u64 {
+    let page_size = memory::page_size();
+    (FIXED_HEADER_SIZE + state_size).div_ceil(page_size) as u64 * page_size as u64
+}
+
+
+/// Save the state of a processor to a snapshot file.
+///
+/// The file starts with the processor state, followed by the memory image at a page-aligned offset, so that it can be mapped directly.
+/// The snapshot is written to a temporary file that then replaces the old one,
+/// so a program resumed from the old snapshot, which still maps it, isn't affected
+pub fn save(path: &Path, registers: &[u64; REGISTER_COUNT], memory: &Memory, storage: Option<&Storage>, allocator: &Allocator) -> io::Result<()> {
+
+    let mut state = Encoder::default();
+
+    state.usize(memory.get_stack_base());
+    state.usize(memory.get_code_size());
+
+    for &value in registers {
+        state.u64(value);
+    }
+
+    match storage {
+        Some(storage) => {
+            state.u64(1);
+            state.bytes(storage.file_path().as_os_str().as_encoded_bytes());
+            match storage.max_size() {
+                Some(max_size) => {
+                    state.u64(1);
+                    state.usize(max_size);
+                },
+                None => state.u64(0)
+            }
+            state.u64(storage.is_mapped() as u64);
+        },
+        None => state.u64(0)
+    }
+
+    allocator.encode(&mut state);
+    let state = state.into_bytes();
+
+    let mut header = Vec::with_capacity(FIXED_HEADER_SIZE + state.len());
+    header.extend_from_slice(SNAPSHOT_MAGIC);
+    header.extend_from_slice(&SNAPSHOT_VERSION.to_le_bytes());
+    header.extend_from_slice(&(memory::page_size() as u32).to_le_bytes());
+    header.extend_from_slice(&(state.len() as u64).to_le_bytes());
+    header.extend_from_slice(&state);
+
+    let temp_path = path.with_extension("tmp");
+    let file = File::create(&temp_path)?;
+
+    file.write_all_at(&header, 0)?;
+    memory.save_image(&file, image_offset(state.len()))?;
+
+    fs::rename(temp_path, path)
+}
+
+
+/// A processor state loaded from a snapshot file
+pub struct Snapshot {
+
+    path: PathBuf,
+    file: File,
+    image_offset: u64,
+    pub memory_size: usize,
+    pub code_size: usize,
+    pub registers: [u64; REGISTER_COUNT],
+    pub storage: Option<StorageOptions>,
+    pub allocator: Allocator,
+
+}
+
+
+impl Snapshot {
+
+    /// Load the processor state from a snapshot file. The memory image is only mapped by `map_memory`
+    pub fn load(path: &Path) -> Snapshot {
+
+        let invalid_snapshot = |message: &str| -> ! {
+            error::error(format!("Invalid snapshot file \"{}\": {}", path.display(), message).as_str())
+        };
+
+        let file = File::open(path).unwrap_or_else(
+            |err| error::io_error(path, &err, format!("Failed to open snapshot file \"{}\"", path.display()).as_str())
+        );
+
+        let mut fixed_header = [0; FIXED_HEADER_SIZE];
+        file.read_exact_at(&mut fixed_header, 0).unwrap_or_else(
+            |_| invalid_snapshot("the file is too small")
+        );
+
+        if &fixed_header[..8] != SNAPSHOT_MAGIC {
+            invalid_snapshot("not a snapshot file");
+        }
+
+        let version = u32::from_le_bytes(fixed_header[8..12].try_into().unwrap());
+        if version != SNAPSHOT_VERSION {
+            invalid_snapshot(format!("unsupported version {}", version).as_str());
+        }
+
+        let page_size = u32::from_le_bytes(fixed_header[12..16].try_into().unwrap()) as usize;
+        if page_size != memory::page_size() {
+            invalid_snapshot(format!("the snapshot was saved with {} byte pages, but the host uses {} byte pages", page_size, memory::page_size()).as_str());
+        }
+
+        let state_size = u64::from_le_bytes(fixed_header[16..24].try_into().unwrap()) as usize;
+        let mut state = vec![0; state_size];
+        file.read_exact_at(&mut state, FIXED_HEADER_SIZE as u64).unwrap_or_else(
+            |_| invalid_snapshot("the processor state is truncated")
+        );
+
+        let mut decoder = Decoder::new(&state);
+
+        let (memory_size, code_size, registers, storage, allocator) = (|| {
+
+            let memory_size = decoder.usize()?;
+            let code_size = decoder.usize()?;
+
+            let mut registers = [0; REGISTER_COUNT];
+            for value in registers.iter_mut() {
+                *value = decoder.u64()?;
+            }
+
+            let storage = if decoder.u64()? != 0 {
+                let file_path = PathBuf::from(String::from_utf8(decoder.bytes()?.to_vec()).ok()?);
+                let max_size = if decoder.u64()? != 0 { Some(decoder.usize()?) } else { None };
+                let mapped = decoder.u64()? != 0;
+                Some(StorageOptions { mapped, ..StorageOptions::new(file_path, max_size) })
+            } else {
+                None
+            };
+
+            let allocator = Allocator::decode(&mut decoder)?;
+
+            Some((memory_size, code_size, registers, storage, allocator))
+
+        })().unwrap_or_else(|| invalid_snapshot("the processor state is corrupted"));
+
+        Snapshot {
+            path: path.to_path_buf(),
+            file,
+            image_offset: image_offset(state_size),
+            memory_size,
+            code_size,
+            registers,
+            storage,
+            allocator,
+        }
+    }
+
+
+    /// Map the memory image of the snapshot copy-on-write into the given memory, which must have the snapshot's memory size
+    pub fn map_memory(&self, memory: &mut Memory) {
+        memory.map_image(&self.file, self.image_offset).unwrap_or_else(
+            |err| error::io_error(&self.path, &err, "Failed to map the snapshot memory image")
+        );
+    }
+
+}
+
+
+#[cfg(test)]
+mod tests {
+
+    use super::*;
+
+
+    #[test]
+    fn test_save_load() {
+        let temp_dir = std::env::temp_dir();
+        let storage_path = temp_dir.join(format!("rusty_vm_test_{}_snapshot_storage", std::process::id()));
+        let snapshot_path = temp_dir.join(format!("rusty_vm_test_{}_snapshot", std::process::id()));
+
+        let mut memory = Memory::new(4096);
+        memory.set_code_size(16);
+        memory.set_bytes(0, &[1, 2, 3, 4]);
+        memory.set_bytes(4000, &[5, 6, 7, 8]);
+
+        let registers: [u64; REGISTER_COUNT] = std::array::from_fn(|i| i as u64 * 3);
+
+        let mut allocator = Allocator::new();
+        allocator.set_heap_start(16);
+        allocator.malloc(10, 4096).unwrap();
+
+        // A zero size limit must not be restored as no limit, and the mapping must be kept
+        for (max_size, mapped) in [(None, false), (Some(0), true), (Some(64), false), (Some(64), true)] {
+            let storage = Storage::new(storage_path.clone(), max_size, mapped);
+            save(&snapshot_path, &registers, &memory, Some(&storage), &allocator).unwrap();
+            drop(storage);
+
+            let snapshot = Snapshot::load(&snapshot_path);
+            assert_eq!(snapshot.memory_size, memory.get_stack_base());
+            assert_eq!(snapshot.code_size, 16);
+            assert_eq!(snapshot.registers, registers);
+            assert_eq!(snapshot.allocator.stats(), allocator.stats());
+
+            let storage = snapshot.storage.as_ref().unwrap();
+            assert_eq!(storage.file_path, storage_path.canonicalize().unwrap());
+            assert_eq!(storage.max_size, max_size);
+            assert_eq!(storage.mapped, mapped);
+
+            let mut restored = Memory::new(snapshot.memory_size);
+            snapshot.map_memory(&mut restored);
+            assert_eq!(restored.get_bytes(0, 4), [1, 2, 3, 4]);
+            assert_eq!(restored.get_bytes(4000, 4), [5, 6, 7, 8]);
+
+            std::fs::remove_file(&storage_path).unwrap();
+        }
+
+        save(&snapshot_path, &registers, &memory, None, &allocator).unwrap();
+        assert!(Snapshot::load(&snapshot_path).storage.is_none());
+
+        std::fs::remove_file(&snapshot_path).unwrap();
+    }
+
+}
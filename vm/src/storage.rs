@@ -1,25 +1,211 @@
+use std::collections::HashMap;
 use std::fs::{File, OpenOptions, self};
+use std::os::unix::io::AsRawFd;
 use std::os::unix::prelude::FileExt;
 use std::path::{PathBuf, Path};
 use std::io;
+use std::sync::atomic::{AtomicU64, AtomicUsize, Ordering};
+use std::sync::mpsc::{self, Receiver, Sender};
+use std::sync::{Arc, Condvar, Mutex, OnceLock};
+use std::thread::{self, JoinHandle};
 
-use rusty_vm_lib::vm::ErrorCodes;
+use rusty_vm_lib::vm::{Address, ErrorCodes};
 
 use crate::error;
+use crate::events::{Event, EventKind, Events};
+use crate::memory::Memory;
+use crate::perf_counters::Traffic;
 
 
-pub struct Storage {
+/// Number of threads that run the asynchronous requests of a storage
+const STORAGE_WORKERS: usize = 4;
+
+
+/// Mapping of a storage file into the host memory
+struct FileMapping {
+
+    start: *mut u8,
+    size: usize,
+    /// Size of the file seen by the program. The file is extended to the mapping size while it's mapped
+    len: AtomicUsize,
+
+}
+
+
+// The mapping is owned by the storage file and only accessed through it
+unsafe impl Send for FileMapping {}
+unsafe impl Sync for FileMapping {}
+
+
+/// The storage file, shared with the threads that run the asynchronous requests
+struct StorageFile {
 
     file_path: PathBuf,
     file: File,
     max_size: Option<usize>,
+    /// The whole file, up to the maximum size, if the storage is mapped
+    mapping: Option<FileMapping>,
+    /// Bytes read and written by the program, synchronously or not
+    traffic: Traffic,
+
+}
+
+
+impl StorageFile {
+
+    fn read_into(&self, offset: usize, buffer: &mut [u8]) -> io::Result<()> {
+        let size = buffer.len();
+        let result = match &self.mapping {
+            Some(mapping) => {
+                if offset.saturating_add(buffer.len()) > mapping.len.load(Ordering::Acquire) {
+                    return Err(io::ErrorKind::UnexpectedEof.into());
+                }
+                unsafe { std::ptr::copy_nonoverlapping(mapping.start.add(offset), buffer.as_mut_ptr(), buffer.len()); }
+                Ok(())
+            },
+            None => self.file.read_exact_at(buffer, offset as u64)
+        };
+        if result.is_ok() {
+            self.traffic.record_read(size);
+        }
+        result
+    }
+
+
+    /// Write `data` at `offset`, which is already checked against the maximum size
+    fn write(&self, offset: usize, data: &[u8]) -> io::Result<()> {
+        let result = match &self.mapping {
+            Some(mapping) => {
+                unsafe { std::ptr::copy_nonoverlapping(data.as_ptr(), mapping.start.add(offset), data.len()); }
+                mapping.len.fetch_max(offset + data.len(), Ordering::AcqRel);
+                Ok(())
+            },
+            None => {
+                self.file.write_all_at(data, offset as u64).and_then(|()| self.file.sync_all())
+            }
+        };
+        if result.is_ok() {
+            self.traffic.record_write(data.len());
+        }
+        result
+    }
+
+
+    fn check_bounds(&self, offset: usize, size: usize) -> Result<(), ErrorCodes> {
+        match self.max_size {
+            Some(max_size) if offset.saturating_add(size) > max_size => Err(ErrorCodes::OutOfBounds),
+            _ => Ok(())
+        }
+    }
+
+
+    /// Write the mapped storage back to the file and sync it.
+    /// The mapping must not be accessed afterwards, since the file may be shorter than it
+    fn save(&self) {
+        if let Some(mapping) = &self.mapping {
+            unsafe {
+                libc::msync(mapping.start as *mut libc::c_void, mapping.size, libc::MS_SYNC);
+            }
+            // Remove the part of the file the program never wrote
+            self.file.set_len(mapping.len.load(Ordering::Acquire) as u64).unwrap_or_else(
+                |err| error::io_error(&self.file_path, &err, format!("Failed to resize storage file \"{}\"", self.file_path.display()).as_str())
+            );
+        }
+        self.file.sync_all().unwrap_or_else(
+            |err| error::io_error(&self.file_path, &err, format!("Failed to sync storage file \"{}\"", self.file_path.display()).as_str())
+        );
+    }
+
+}
+
+
+impl Drop for StorageFile {
+
+    fn drop(&mut self) {
+        self.save();
+        if let Some(mapping) = &self.mapping {
+            unsafe {
+                libc::munmap(mapping.start as *mut libc::c_void, mapping.size);
+            }
+        }
+    }
+
+}
+
+
+#[derive(Clone, Copy, PartialEq, Eq, Debug)]
+pub enum RequestKind {
+
+    /// Read from the storage into memory
+    Read,
+    /// Write from memory to the storage
+    Write,
+
+}
+
+
+#[derive(Clone, Copy, PartialEq, Eq, Debug)]
+pub enum RequestState {
+
+    Pending,
+    Completed(ErrorCodes),
+
+}
+
+
+/// An asynchronous storage request
+struct Request {
+
+    id: u64,
+    kind: RequestKind,
+    offset: usize,
+    /// View of the program memory that holds the buffer
+    memory: Memory,
+    address: Address,
+    size: usize,
+    /// Notified when the request completes
+    events: Arc<Events>,
+
+}
+
+
+/// State shared with the threads that run the asynchronous requests
+struct Shared {
+
+    file: StorageFile,
+    /// State of the requests that weren't collected by `poll` or `wait` yet
+    requests: Mutex<HashMap<u64, RequestState>>,
+    completed: Condvar,
+
+}
+
+
+struct Workers {
+
+    queue: Sender<Request>,
+    threads: Vec<JoinHandle<()>>,
+
+}
+
+
+/// Storage device of the VM, backed by a host file.
+///
+/// Guest buffers are read and written in place. In mapped mode, the file is mapped into the host memory, so accesses are plain copies
+/// and writes reach the file when the storage is dropped. Otherwise, every write is synced to the file.
+/// Requests can also be submitted asynchronously and run by worker threads, so that the program can compute while they complete
+pub struct Storage {
+
+    shared: Arc<Shared>,
+    /// Started by the first asynchronous request
+    workers: OnceLock<Workers>,
+    last_request_id: AtomicU64,
 
 }
 
 
 impl Storage {
 
-    pub fn new(file_path: PathBuf, max_size: Option<usize>) -> Self {
+    pub fn new(file_path: PathBuf, max_size: Option<usize>, mapped: bool) -> Self {
 
         let file: File = if file_path.exists() {
             let file = OpenOptions::new()
@@ -56,29 +242,98 @@ impl Storage {
                 |err| error::io_error(&file_path, &err, format!("Failed to create storage file \"{}\"", file_path.display()).as_str())
             )
         };
+
+        let mapping = if mapped {
+            let size = max_size.unwrap_or_else(
+                || error::error(format!("Mapped storage file \"{}\" needs a maximum size", file_path.display()).as_str())
+            );
+            Some(Self::map_file(&file, &file_path, size))
+        } else {
+            None
+        };
         
         Self {
-            file_path: file_path.canonicalize().unwrap_or_else(
-                |err| error::io_error(&file_path, &err, format!("Failed to canonicalize path \"{}\"", file_path.display()).as_str())
-            ),
-            file,
-            max_size,
+            shared: Arc::new(Shared {
+                file: StorageFile {
+                    file_path: file_path.canonicalize().unwrap_or_else(
+                        |err| error::io_error(&file_path, &err, format!("Failed to canonicalize path \"{}\"", file_path.display()).as_str())
+                    ),
+                    file,
+                    max_size,
+                    mapping,
+                    traffic: Traffic::default(),
+                },
+                requests: Mutex::default(),
+                completed: Condvar::new(),
+            }),
+            workers: OnceLock::new(),
+            last_request_id: AtomicU64::new(0),
         }
     }
 
 
-    /// Try to read `size` bytes from the storage file at `offset`.
-    pub fn read(&self, offset: usize, size: usize) -> Result<Vec<u8>, ErrorCodes> {
+    /// Extend the file to `size` bytes and map it
+    fn map_file(file: &File, file_path: &Path, size: usize) -> FileMapping {
 
-        let mut buffer = vec![0; size];
+        let len = file.metadata().unwrap_or_else(
+            |err| error::io_error(file_path, &err, format!("Failed to get metadata of storage file \"{}\"", file_path.display()).as_str())
+        ).len() as usize;
+
+        file.set_len(size as u64).unwrap_or_else(
+            |err| error::io_error(file_path, &err, format!("Failed to resize storage file \"{}\"", file_path.display()).as_str())
+        );
+
+        // An empty mapping isn't allowed
+        let start = if size == 0 {
+            std::ptr::NonNull::dangling().as_ptr()
+        } else {
+            let start = unsafe {
+                libc::mmap(std::ptr::null_mut(), size, libc::PROT_READ | libc::PROT_WRITE, libc::MAP_SHARED, file.as_raw_fd(), 0)
+            };
+            if start == libc::MAP_FAILED {
+                error::io_error(file_path, &io::Error::last_os_error(), format!("Failed to map storage file \"{}\"", file_path.display()).as_str());
+            }
+            start as *mut u8
+        };
+
+        FileMapping {
+            start,
+            size,
+            len: AtomicUsize::new(len),
+        }
+    }
+
+
+    pub fn file_path(&self) -> &Path {
+        &self.shared.file.file_path
+    }
+
+
+    pub fn max_size(&self) -> Option<usize> {
+        self.shared.file.max_size
+    }
+
+
+    pub fn is_mapped(&self) -> bool {
+        self.shared.file.mapping.is_some()
+    }
 
-        match self.file.read_exact_at(&mut buffer, offset as u64) {
 
-            Ok(_) => Ok(buffer),
+    pub fn traffic(&self) -> &Traffic {
+        &self.shared.file.traffic
+    }
+
+
+    /// Try to fill `buffer` with the bytes of the storage file at `offset`.
+    pub fn read_into(&self, offset: usize, buffer: &mut [u8]) -> Result<(), ErrorCodes> {
+
+        match self.shared.file.read_into(offset, buffer) {
+
+            Ok(_) => Ok(()),
             
             Err(err) => Err(match err.kind() {
                 io::ErrorKind::UnexpectedEof => ErrorCodes::EndOfFile,
-                _ => error::io_error(&self.file_path, &err, format!("Failed to read storage file \"{}\"", self.file_path.display()).as_str())
+                _ => error::io_error(self.file_path(), &err, format!("Failed to read storage file \"{}\"", self.file_path().display()).as_str())
             })
         }
     }
@@ -87,37 +342,134 @@ impl Storage {
     /// Try to write `data` to the storage file at `offset`.
     pub fn write(&self, offset: usize, data: &[u8]) -> Result<(), ErrorCodes> {
 
-        if let Some(max_size) = self.max_size {
-            if offset + data.len() > max_size {
-                return Err(ErrorCodes::OutOfBounds);
+        self.shared.file.check_bounds(offset, data.len())?;
+
+        self.shared.file.write(offset, data).unwrap_or_else(
+            |err| error::io_error(self.file_path(), &err, format!("Failed to write storage file \"{}\"", self.file_path().display()).as_str())
+        );
+
+        Ok(())
+    }
+
+
+    /// Queue a request to transfer `size` bytes between the storage at `offset` and `memory` at `address`, and return its id.
+    ///
+    /// The memory range must be valid. The program must not access it until the request is completed
+    pub fn submit(&self, kind: RequestKind, offset: usize, memory: Memory, address: Address, size: usize, events: Arc<Events>) -> u64 {
+
+        let id = self.last_request_id.fetch_add(1, Ordering::Relaxed) + 1;
+        self.shared.requests.lock().unwrap().insert(id, RequestState::Pending);
+
+        let workers = self.workers.get_or_init(|| self.start_workers());
+        workers.queue.send(Request { id, kind, offset, memory, address, size, events })
+            .expect("The storage workers are running");
+
+        id
+    }
+
+
+    fn start_workers(&self) -> Workers {
+
+        let (queue, requests) = mpsc::channel();
+        let requests = Arc::new(Mutex::new(requests));
+
+        let threads = (0..STORAGE_WORKERS).map(|_| {
+            let shared = Arc::clone(&self.shared);
+            let requests = Arc::clone(&requests);
+            thread::Builder::new()
+                .name("storage worker".to_string())
+                .spawn(move || run_requests(&shared, &requests))
+                .unwrap_or_else(|err| error::error(format!("Failed to start a storage worker: {}", err).as_str()))
+        }).collect();
+
+        Workers { queue, threads }
+    }
+
+
+    /// Return the state of the given request, or `None` if there is no such request.
+    /// A completed request is forgotten
+    pub fn poll(&self, id: u64) -> Option<RequestState> {
+        let mut requests = self.shared.requests.lock().unwrap();
+        let state = *requests.get(&id)?;
+        if state != RequestState::Pending {
+            requests.remove(&id);
+        }
+        Some(state)
+    }
+
+
+    /// Wait for the given request to complete and return its result, or `None` if there is no such request.
+    /// The request is forgotten
+    pub fn wait(&self, id: u64) -> Option<ErrorCodes> {
+        let mut requests = self.shared.requests.lock().unwrap();
+        loop {
+            match *requests.get(&id)? {
+                RequestState::Pending => requests = self.shared.completed.wait(requests).unwrap(),
+                RequestState::Completed(result) => {
+                    requests.remove(&id);
+                    return Some(result);
+                }
             }
         }
+    }
 
-        match self.file.write_all_at(data, offset as u64) {
 
-            Ok(_) => {
-                self.file.sync_all().unwrap_or_else(
-                    |err| error::io_error(&self.file_path, &err, format!("Failed to sync storage file \"{}\"", self.file_path.display()).as_str())
-                );
+    /// Complete the requests and save the storage file, right before the process exits without dropping the storage.
+    /// The storage must not be used afterwards
+    pub fn close(&self) {
+        self.wait_all();
+        self.shared.file.save();
+    }
 
-                Ok(())
-            },
-            
-            Err(err) => error::io_error(&self.file_path, &err, format!("Failed to write storage file \"{}\"", self.file_path.display()).as_str())
 
+    /// Wait for all the requests to complete and forget them, so that their memory can be reused
+    pub fn wait_all(&self) {
+        let mut requests = self.shared.requests.lock().unwrap();
+        while requests.values().any(|&state| state == RequestState::Pending) {
+            requests = self.shared.completed.wait(requests).unwrap();
         }
+        requests.clear();
     }
 
 
 }
 
 
+/// Run the queued requests until the storage is dropped
+fn run_requests(shared: &Shared, requests: &Mutex<Receiver<Request>>) {
+    loop {
+        // The lock is released as soon as a request is received
+        let Ok(mut request) = requests.lock().unwrap().recv() else {
+            return;
+        };
+
+        // Errors are reported to the program, since they can't stop the VM from this thread
+        let result = match request.kind {
+            RequestKind::Read => shared.file.read_into(request.offset, request.memory.get_bytes_mut(request.address, request.size))
+                .map_err(ErrorCodes::from),
+            RequestKind::Write => shared.file.check_bounds(request.offset, request.size).and_then(
+                |()| shared.file.write(request.offset, request.memory.get_bytes(request.address, request.size)).map_err(ErrorCodes::from)
+            ),
+        };
+        let result = result.err().unwrap_or(ErrorCodes::NoError);
+
+        shared.requests.lock().unwrap().insert(request.id, RequestState::Completed(result));
+        shared.completed.notify_all();
+        request.events.push(Event { kind: EventKind::Storage, source: request.id, value: result as u64 });
+    }
+}
+
+
 impl Drop for Storage {
 
     fn drop(&mut self) {
-        self.file.sync_all().unwrap_or_else(
-            |err| error::io_error(&self.file_path, &err, format!("Failed to sync storage file \"{}\"", self.file_path.display()).as_str())
-        );
+        // Let the workers finish the queued requests, then the file is synced when the last reference to it is dropped
+        if let Some(workers) = self.workers.take() {
+            drop(workers.queue);
+            for thread in workers.threads {
+                thread.join().ok();
+            }
+        }
     }
 
 }
@@ -134,47 +486,54 @@ mod tests {
         let id = LAST_UNIQUE_ID.fetch_add(1, std::sync::atomic::Ordering::SeqCst);
         format!("test/test_storage_{}.disk", id)
     }
+
+
+    fn read(storage: &Storage, offset: usize, size: usize) -> Result<Vec<u8>, ErrorCodes> {
+        let mut buffer = vec![0; size];
+        storage.read_into(offset, &mut buffer)?;
+        Ok(buffer)
+    }
     
 
     #[test]
     fn test_create_storage() {
         let file = get_unique_file_path();
-        let storage = Storage::new(PathBuf::from(&file), None);
-        assert_eq!(storage.file_path, PathBuf::from(&file).canonicalize().unwrap());
+        let storage = Storage::new(PathBuf::from(&file), None, false);
+        assert_eq!(storage.file_path(), PathBuf::from(&file).canonicalize().unwrap());
     }
 
 
     #[test]
     fn test_read_write() {
-        let storage = Storage::new(PathBuf::from(get_unique_file_path()), None);
+        let storage = Storage::new(PathBuf::from(get_unique_file_path()), None, false);
         let data = vec![0, 1, 2, 3, 4, 5, 6, 7];
         storage.write(0, &data).unwrap();
-        assert_eq!(storage.read(0, 8).unwrap(), data);
+        assert_eq!(read(&storage, 0, 8).unwrap(), data);
 
     }
 
 
     #[test]
     fn test_read_write_offset() {
-        let storage = Storage::new(PathBuf::from(get_unique_file_path()), None);
+        let storage = Storage::new(PathBuf::from(get_unique_file_path()), None, false);
         let data = vec![0, 1, 2, 3, 4, 5, 6, 7];
         storage.write(0, &data).unwrap();
-        assert_eq!(storage.read(4, 4).unwrap(), vec![4, 5, 6, 7]);
+        assert_eq!(read(&storage, 4, 4).unwrap(), vec![4, 5, 6, 7]);
     }
 
 
     #[test]
     fn test_read_write_offset_out_of_bounds() {
-        let storage = Storage::new(PathBuf::from(get_unique_file_path()), None);
+        let storage = Storage::new(PathBuf::from(get_unique_file_path()), None, false);
         let data = vec![0, 1, 2, 3, 4, 5, 6, 7];
         storage.write(0, &data).unwrap();
-        assert!(matches!(storage.read(8, 4).err().unwrap(), ErrorCodes::EndOfFile));
+        assert!(matches!(read(&storage, 8, 4).err().unwrap(), ErrorCodes::EndOfFile));
     }
 
 
     #[test]
     fn test_write_overflow() {
-        let storage = Storage::new(PathBuf::from(get_unique_file_path()), Some(8));
+        let storage = Storage::new(PathBuf::from(get_unique_file_path()), Some(8), false);
         let data = vec![0, 1, 2, 3, 4, 5, 6, 7, 8];
         let res = storage.write(0, &data);
         assert!(matches!(res.err().unwrap(), ErrorCodes::OutOfBounds));
@@ -183,11 +542,62 @@ mod tests {
 
     #[test]
     fn test_read_write_max_size_exact() {
-        let storage = Storage::new(PathBuf::from(get_unique_file_path()), Some(8));
+        let storage = Storage::new(PathBuf::from(get_unique_file_path()), Some(8), false);
         let data = vec![0, 1, 2, 3, 4, 5, 6, 7];
         storage.write(0, &data).unwrap();
-        assert_eq!(storage.read(0, 8).unwrap(), data);
+        assert_eq!(read(&storage, 0, 8).unwrap(), data);
     }
 
-}
 
+    #[test]
+    fn test_mapped() {
+        let file_path = PathBuf::from(get_unique_file_path());
+        {
+            let storage = Storage::new(file_path.clone(), Some(64), true);
+            storage.write(4, &[1, 2, 3, 4]).unwrap();
+            assert_eq!(read(&storage, 6, 2).unwrap(), vec![3, 4]);
+            // The file is only as big as what was written
+            assert!(matches!(read(&storage, 6, 4).err().unwrap(), ErrorCodes::EndOfFile));
+            assert!(matches!(storage.write(62, &[0; 4]).err().unwrap(), ErrorCodes::OutOfBounds));
+        }
+        assert_eq!(fs::read(&file_path).unwrap(), vec![0, 0, 0, 0, 1, 2, 3, 4]);
+
+        let storage = Storage::new(file_path, Some(64), false);
+        assert_eq!(read(&storage, 4, 4).unwrap(), vec![1, 2, 3, 4]);
+    }
+
+
+    #[test]
+    fn test_async_requests() {
+        let storage = Storage::new(PathBuf::from(get_unique_file_path()), Some(64), false);
+        let events = Arc::new(Events::new());
+        let mut memory = Memory::new(16);
+        memory.set_bytes(0, &[1, 2, 3, 4, 5, 6, 7, 8]);
+
+        let write = storage.submit(RequestKind::Write, 8, memory.share(), 0, 8, Arc::clone(&events));
+        assert_eq!(storage.wait(write), Some(ErrorCodes::NoError));
+        assert_eq!(storage.poll(write), None);
+        assert_eq!(events.wait(None, || false), Some(Event { kind: EventKind::Storage, source: write, value: 0 }));
+
+        let read_request = storage.submit(RequestKind::Read, 12, memory.share(), 8, 4, Arc::clone(&events));
+        let out_of_bounds = storage.submit(RequestKind::Write, 60, memory.share(), 0, 8, Arc::clone(&events));
+        let past_end = storage.submit(RequestKind::Read, 16, memory.share(), 8, 4, Arc::clone(&events));
+
+        assert_eq!(storage.wait(out_of_bounds), Some(ErrorCodes::OutOfBounds));
+        let state = loop {
+            match storage.poll(past_end) {
+                Some(RequestState::Pending) => continue,
+                state => break state
+            }
+        };
+        assert_eq!(state, Some(RequestState::Completed(ErrorCodes::EndOfFile)));
+        assert_eq!(storage.wait(read_request), Some(ErrorCodes::NoError));
+        assert_eq!(memory.get_bytes(8, 4), [5, 6, 7, 8]);
+
+        storage.submit(RequestKind::Read, 0, memory.share(), 0, 4, Arc::clone(&events));
+        storage.wait_all();
+        assert_eq!(memory.get_bytes(0, 4), [0; 4]);
+        assert_eq!(read(&storage, 8, 8).unwrap(), vec![1, 2, 3, 4, 5, 6, 7, 8]);
+    }
+
+}
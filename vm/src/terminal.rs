@@ -1,40 +1,94 @@
-use std::sync::mpsc::{self, Sender};
-use std::io;
+use std::fs::File;
+use std::io::{self, Read, Write};
+use std::os::unix::io::{AsRawFd, FromRawFd};
+use std::sync::Arc;
 use std::thread::{self, JoinHandle};
-use std::time::Duration;
 
 use rusty_vm_lib::vm::{ErrorCodes, Address};
 use rusty_vm_lib::registers::Registers;
 
 use termion::cursor;
+use termion::event::Key;
 use termion::input::TermRead;
 use termion::raw::IntoRawMode;
 use termion::cursor::DetectCursorPos;
 
 use crate::error;
+use crate::events::{Event, EventKind, Events};
 use crate::memory::Memory;
 use crate::register::CPURegisters;
 
 
 const KEY_DATA_SIZE: usize = 2;
-const KEYBOARD_LISTENER_INTERVAL: Duration = Duration::from_millis(50);
+
+/// Longest run of unchanged cells that is redrawn to avoid moving the cursor, which takes about as many bytes
+const MAX_REDRAWN_CELLS: usize = 6;
 
 // This type definition is placed here because it's unstable to place it inside the Terminal impl block
 type CodeHanlder = fn(&mut Terminal, &mut CPURegisters, &mut Memory) -> io::Result<()>;
 
 
+/// A thread that waits for key events on stdin and writes them to guest memory
+struct KeyListener {
+
+    /// Writing end of a pipe the listener also waits on, to wake it up when it must stop
+    stop: File,
+    thread: JoinHandle<()>,
+
+}
+
+
+/// The last frame presented to the terminal
+struct Frame {
+
+    width: usize,
+    cells: Vec<u8>,
+
+}
+
+
 pub struct Terminal {
 
-    key_listener: Option<(Sender<()>, JoinHandle<()>)>,
+    key_listener: Option<KeyListener>,
+    /// Frames are only drawn where they differ from the previous one
+    frame: Option<Frame>,
+    /// Key events are also reported here
+    events: Arc<Events>,
 
 }
 
 
 impl Terminal {
 
-    pub fn new() -> Self {
+    pub fn new(events: Arc<Events>) -> Self {
         Self {
             key_listener: None,
+            frame: None,
+            events,
+        }
+    }
+
+
+    /// Stop the key listener and forget the last frame, so that the terminal can be used by another program
+    pub fn reset(&mut self) {
+        if self.key_listener.is_some() {
+            self.stop_key_listener().ok();
+        }
+        self.frame = None;
+    }
+
+
+    fn stop_key_listener(&mut self) -> io::Result<()> {
+
+        match self.key_listener.take() {
+            Some(mut listener) => {
+                listener.stop.write_all(&[0])?;
+                listener.thread.join().unwrap_or_else(
+                    |err| error::error(format!("Could not join the keyboard listener thread\n{:?}", err).as_str())
+                );
+                Ok(())
+            },
+            None => Err(io::ErrorKind::NotFound.into())
         }
     }
  
@@ -60,6 +114,9 @@ impl Terminal {
     fn handle_clear(&mut self, _registers: &mut CPURegisters, _memory: &mut Memory) -> io::Result<()> {
         print!("{}", termion::clear::All);
 
+        // The next frame must be drawn whole
+        self.frame = None;
+
         Ok(())
     }
 
@@ -251,7 +308,9 @@ impl Terminal {
 
 
     /// Start a thread that listens for key events and writes them to the given address.
-    /// A key event is 2 bytes: the first byte is the modifier code, the second byte is the key code
+    /// A key event is 2 bytes: the first byte is the modifier code, the second byte is the key code.
+    ///
+    /// The thread blocks until stdin is readable, so keys are delivered as soon as they are typed
     fn handle_get_key_listener(&mut self, registers: &mut CPURegisters, memory: &mut Memory) -> io::Result<()> {
         
         // Check if a listener is already active
@@ -261,82 +320,63 @@ impl Terminal {
 
         let key_store_address = registers.get(Registers::R1) as Address;
         let key_data_slice = memory.get_bytes_mut(key_store_address, KEY_DATA_SIZE).as_mut_ptr() as Address;
-        
-        let (tx, rx) = mpsc::channel::<()>();
 
-        let join_handle = thread::spawn(move || {
-            use termion::event::Key;
+        let (stop_receiver, stop) = pipe()?;
+        let events = Arc::clone(&self.events);
+
+        let thread = thread::spawn(move || {
 
             let key_data_slice: &mut [u8; KEY_DATA_SIZE] = unsafe {
                 &mut *(key_data_slice as *mut [u8; KEY_DATA_SIZE])
             };
 
-            let mut key_events = termion::async_stdin().keys();
             let _stdout = io::stdout().into_raw_mode().unwrap();
-            
-            loop {
-
-                // Check for the stop signal
-                if rx.try_recv().is_ok() {
-                    break;
-                }
-
-                if let Some(key_event) = key_events.next() {
-
-                    let key_data: [u8; KEY_DATA_SIZE] = match key_event.unwrap() {
-                        Key::Backspace => [1, 0],
-                        Key::Left => [2, 0],
-                        Key::Right => [3, 0],
-                        Key::Up => [4, 0],
-                        Key::Down => [5, 0],
-                        Key::Home => [6, 0],
-                        Key::End => [7, 0],
-                        Key::PageUp => [8, 0],
-                        Key::PageDown => [9, 0],
-                        Key::BackTab => [10, 0],
-                        Key::Delete => [11, 0],
-                        Key::Insert => [12, 0],
-                        Key::F(n) => [13, n],
-                        Key::Char(c) => [14, c as u8],
-                        Key::Alt(c) => [15, c as u8],
-                        Key::Ctrl(c) => [16, c as u8],
-                        Key::Null => [17, 0],
-                        Key::Esc => [18, 0],
-                        Key::__IsNotComplete => [19, 0],
-                    };
-    
-                    key_data_slice.copy_from_slice(&key_data);
-                }
 
-                thread::sleep(KEYBOARD_LISTENER_INTERVAL);
-            }
+            listen_keys(io::stdin(), &stop_receiver, key_data_slice, &events);
         });
 
-        self.key_listener = Some((tx, join_handle));
+        self.key_listener = Some(KeyListener { stop, thread });
 
         Ok(())
     }
 
 
     fn handle_stop_key_listener(&mut self, _registers: &mut CPURegisters, _memory: &mut Memory) -> io::Result<()> {
+        self.stop_key_listener()
+    }
 
-        match self.key_listener.take() {
-            Some((tx, join_handle)) => {
-                if tx.send(()).is_err() {
-                    Err(io::ErrorKind::Other.into())
-                } else {
-                    join_handle.join().unwrap_or_else(
-                        |err| error::error(format!("Could not join the keyboard listener thread\n{:?}", err).as_str())
-                    );
-                    Ok(())
-                }
-            },
-            None => Err(io::ErrorKind::NotFound.into())
+
+    /// Present the frame of `r2` columns by `r3` rows at the address in r1. Every cell is the byte of a character, with 0 for a blank.
+    ///
+    /// Only the cells that changed since the last frame are drawn, with a single write to stdout
+    fn handle_present_frame(&mut self, registers: &mut CPURegisters, memory: &mut Memory) -> io::Result<()> {
+        let address = registers.get(Registers::R1) as Address;
+        let width = registers.get(Registers::R2) as usize;
+        let height = registers.get(Registers::R3) as usize;
+
+        if width > u16::MAX as usize || height > u16::MAX as usize {
+            return Err(io::ErrorKind::InvalidInput.into());
+        }
+
+        let cells = memory.get_bytes(address, width * height);
+
+        let mut output = Vec::new();
+        draw_frame(self.frame.as_ref(), width, cells, &mut output);
+
+        let mut stdout = io::stdout().lock();
+        stdout.write_all(&output)?;
+        stdout.flush()?;
+
+        match &mut self.frame {
+            Some(frame) if frame.width == width && frame.cells.len() == cells.len() => frame.cells.copy_from_slice(cells),
+            _ => self.frame = Some(Frame { width, cells: cells.to_vec() })
         }
+
+        Ok(())
     }
 
 
-    const CODE_HANDLERS: [ CodeHanlder; 29 ] = [
+    const CODE_HANDLERS: [ CodeHanlder; 30 ] = [
         Self::handle_goto,
         Self::handle_clear,
         Self::handle_blink,
@@ -366,7 +406,203 @@ impl Terminal {
         Self::handle_get_cursor_position,
         Self::handle_get_key_listener,
         Self::handle_stop_key_listener,
+        Self::handle_present_frame,
+    ];
+
+}
+
+
+/// Create a pipe, returning its reading and its writing end
+fn pipe() -> io::Result<(File, File)> {
+    let mut pipe = [0; 2];
+    if unsafe { libc::pipe(pipe.as_mut_ptr()) } != 0 {
+        return Err(io::Error::last_os_error());
+    }
+    Ok(unsafe { (File::from_raw_fd(pipe[0]), File::from_raw_fd(pipe[1])) })
+}
+
+
+/// Write the keys read from `input` to `key_data_slice` and report them as events, until `stop_receiver` is readable or the input ends.
+/// The thread blocks until either is readable
+fn listen_keys(mut input: impl Read + AsRawFd, stop_receiver: &File, key_data_slice: &mut [u8; KEY_DATA_SIZE], events: &Events) {
+
+    let mut poll_fds = [
+        libc::pollfd { fd: input.as_raw_fd(), events: libc::POLLIN, revents: 0 },
+        libc::pollfd { fd: stop_receiver.as_raw_fd(), events: libc::POLLIN, revents: 0 },
     ];
+    let mut buffer = [0; 64];
+
+    loop {
+
+        if unsafe { libc::poll(poll_fds.as_mut_ptr(), poll_fds.len() as libc::nfds_t, -1) } < 0 {
+            if io::Error::last_os_error().kind() == io::ErrorKind::Interrupted {
+                continue;
+            }
+            break;
+        }
+
+        // Check for the stop signal
+        if poll_fds[1].revents != 0 {
+            break;
+        }
+
+        // Stop at the end of the input
+        let count = match input.read(&mut buffer) {
+            Ok(0) | Err(_) => break,
+            Ok(count) => count
+        };
+
+        // Only the last key is kept if the program didn't read the previous ones
+        for key_event in (&buffer[..count]).keys().flatten() {
+            let key_data = key_data(key_event);
+            key_data_slice.copy_from_slice(&key_data);
+            events.push(Event { kind: EventKind::Key, source: key_data[0] as u64, value: key_data[1] as u64 });
+        }
+    }
+}
+
+
+fn key_data(key: Key) -> [u8; KEY_DATA_SIZE] {
+    match key {
+        Key::Backspace => [1, 0],
+        Key::Left => [2, 0],
+        Key::Right => [3, 0],
+        Key::Up => [4, 0],
+        Key::Down => [5, 0],
+        Key::Home => [6, 0],
+        Key::End => [7, 0],
+        Key::PageUp => [8, 0],
+        Key::PageDown => [9, 0],
+        Key::BackTab => [10, 0],
+        Key::Delete => [11, 0],
+        Key::Insert => [12, 0],
+        Key::F(n) => [13, n],
+        Key::Char(c) => [14, c as u8],
+        Key::Alt(c) => [15, c as u8],
+        Key::Ctrl(c) => [16, c as u8],
+        Key::Null => [17, 0],
+        Key::Esc => [18, 0],
+        Key::__IsNotComplete => [19, 0],
+    }
+}
+
+
+/// Write the escape sequences that turn the previous frame into the new one, or draw the whole frame if the previous one has another size
+fn draw_frame(previous: Option<&Frame>, width: usize, cells: &[u8], output: &mut Vec<u8>) {
+
+    let previous = previous.filter(|frame| frame.width == width && frame.cells.len() == cells.len());
+
+    for (row, new_row) in cells.chunks(width.max(1)).enumerate() {
+
+        let old_row = previous.map(|frame| &frame.cells[row * width..(row + 1) * width]);
+        let changed = |column: usize| old_row.map_or(true, |old_row| old_row[column] != new_row[column]);
+
+        let mut column = 0;
+        while column < width {
+            if !changed(column) {
+                column += 1;
+                continue;
+            }
+
+            // Extend the span over short runs of unchanged cells
+            let start = column;
+            let mut end = column + 1;
+            column += 1;
+            while column < width && column - end <= MAX_REDRAWN_CELLS {
+                if changed(column) {
+                    end = column + 1;
+                }
+                column += 1;
+            }
+
+            write!(output, "{}", cursor::Goto(start as u16 + 1, row as u16 + 1)).unwrap();
+            output.extend(new_row[start..end].iter().map(|&cell| if cell == 0 { b' ' } else { cell }));
+            column = end;
+        }
+    }
+}
+
+
+#[cfg(test)]
+mod tests {
+
+    use std::time::{Duration, Instant};
+
+    use super::*;
+
+
+    #[test]
+    fn test_draw_frame() {
+        let mut output = Vec::new();
+        draw_frame(None, 4, b"ab\0dxyzw", &mut output);
+        assert_eq!(output, format!("{}ab d{}xyzw", cursor::Goto(1, 1), cursor::Goto(1, 2)).into_bytes());
+
+        let previous = Frame { width: 4, cells: b"ab\0dxyzw".to_vec() };
+
+        output.clear();
+        draw_frame(Some(&previous), 4, b"ab\0dxyzw", &mut output);
+        assert!(output.is_empty());
+
+        // Nearby changes are drawn together
+        output.clear();
+        draw_frame(Some(&previous), 4, b"Ab\0Dxyzw", &mut output);
+        assert_eq!(output, format!("{}Ab D", cursor::Goto(1, 1)).into_bytes());
+
+        output.clear();
+        draw_frame(Some(&previous), 4, b"ab\0dxyWw", &mut output);
+        assert_eq!(output, format!("{}W", cursor::Goto(3, 2)).into_bytes());
+    }
+
+
+    /// Start listening for keys on a pipe, returning the writing end of the input, the stop pipe and the listener thread, which returns the last key
+    fn start_listener(events: &Arc<Events>) -> (File, File, JoinHandle<[u8; KEY_DATA_SIZE]>) {
+        let (input_receiver, input) = pipe().unwrap();
+        let (stop_receiver, stop) = pipe().unwrap();
+        let events = Arc::clone(events);
+
+        let thread = thread::spawn(move || {
+            let mut key_data_slice = [0; KEY_DATA_SIZE];
+            listen_keys(input_receiver, &stop_receiver, &mut key_data_slice, &events);
+            key_data_slice
+        });
+
+        (input, stop, thread)
+    }
+
+
+    #[test]
+    fn test_key_listener() {
+        let events = Arc::new(Events::new());
+        let (mut input, _stop, thread) = start_listener(&events);
+
+        let deadline = || Some(Instant::now() + Duration::from_secs(10));
+
+        // Every key wakes up the waiting program as soon as it's typed
+        input.write_all(b"a").unwrap();
+        assert_eq!(events.wait(deadline(), || false), Some(Event { kind: EventKind::Key, source: 14, value: b'a' as u64 }));
+
+        // Keys read together are all reported
+        input.write_all(b"xy").unwrap();
+        assert_eq!(events.wait(deadline(), || false), Some(Event { kind: EventKind::Key, source: 14, value: b'x' as u64 }));
+        assert_eq!(events.wait(deadline(), || false), Some(Event { kind: EventKind::Key, source: 14, value: b'y' as u64 }));
+
+        // The listener stops at the end of the input, leaving the last key in memory
+        drop(input);
+        assert_eq!(thread.join().unwrap(), [14, b'y']);
+        assert_eq!(events.wait(Some(Instant::now()), || false), None);
+    }
+
+
+    #[test]
+    fn test_stop_key_listener() {
+        let events = Arc::new(Events::new());
+        let (_input, mut stop, thread) = start_listener(&events);
+
+        // The listener is blocked on the open input until it's told to stop
+        stop.write_all(&[0]).unwrap();
+        assert_eq!(thread.join().unwrap(), [0; KEY_DATA_SIZE]);
+        assert_eq!(events.wait(Some(Instant::now()), || false), None);
+    }
 
 }
 
@@ -0,0 +1,51 @@
+//! Fixtures shared by the tests of the VM modules
+
+use std::path::Path;
+use std::sync::atomic::{AtomicUsize, Ordering};
+
+use ::assembler::assembler::{AssemblerOptions, LabelMap};
+
+use crate::processor::{Processor, ProcessorConfig};
+
+
+/// Assemble a program that includes the files of the asm library
+pub fn assemble(program: &str) -> Vec<u8> {
+    assemble_with_labels(program).0
+}
+
+
+/// Like `assemble`, also returning the labels exported by the program
+pub fn assemble_with_labels(program: &str) -> (Vec<u8>, LabelMap) {
+
+    // Tests run in parallel, so every program gets its own file
+    static LAST_UNIQUE_ID: AtomicUsize = AtomicUsize::new(0);
+    let id = LAST_UNIQUE_ID.fetch_add(1, Ordering::SeqCst);
+
+    let source = std::env::temp_dir().join(format!("rusty_vm_test_{}_{}.asm", std::process::id(), id));
+    std::fs::write(&source, program).unwrap();
+
+    let assembly = ::assembler::files::load_assembly(&source).unwrap();
+    // The cache is not used, so the tests neither depend on nor change the cache of the user
+    ::assembler::assembler::assemble(assembly, &source, AssemblerOptions {
+        include_lib_path: Path::new(env!("CARGO_MANIFEST_DIR")).join("../asm_lib"),
+        ..Default::default()
+    })
+}
+
+
+/// Create a processor with a small memory that captures the output of the program, and load the program
+pub fn processor(byte_code: &[u8]) -> Processor {
+    processor_with(byte_code, ProcessorConfig::default())
+}
+
+
+/// Like `processor`, with the other settings of the given configuration
+pub fn processor_with(byte_code: &[u8], config: ProcessorConfig) -> Processor {
+    let mut processor = Processor::new(ProcessorConfig {
+        max_memory_size: 4096,
+        capture_output: true,
+        ..config
+    });
+    processor.load(byte_code).unwrap();
+    processor
+}
@@ -0,0 +1,305 @@
+use std::collections::HashMap;
+use std::sync::atomic::{AtomicBool, AtomicU64, Ordering};
+use std::sync::{Condvar, Mutex};
+use std::thread::JoinHandle;
+use std::time::Duration;
+
+use rusty_vm_lib::vm::Address;
+
+use crate::processor::RunState;
+
+
+/// Number of wait queues. Addresses that hash to the same queue share it, which only costs spurious wakeups
+const WAIT_QUEUE_COUNT: usize = 64;
+
+/// Longest time a thread waits before returning to the program, so that it can be stopped
+const MAX_WAIT_TIME: Duration = Duration::from_millis(10);
+
+
+#[derive(Default)]
+struct WaitQueue {
+
+    lock: Mutex<()>,
+    wakeup: Condvar,
+
+}
+
+
+/// The guest threads spawned by a program and the queues they wait on.
+///
+/// The main thread of the program isn't registered here
+pub struct GuestThreads {
+
+    /// Threads that weren't joined yet, by id
+    threads: Mutex<HashMap<u64, JoinHandle<RunState>>>,
+    last_id: AtomicU64,
+    /// Set while the threads are being stopped
+    stop: AtomicBool,
+    wait_queues: [WaitQueue; WAIT_QUEUE_COUNT],
+
+}
+
+
+impl GuestThreads {
+
+    pub fn new() -> Self {
+        Self {
+            threads: Mutex::default(),
+            last_id: AtomicU64::new(0),
+            stop: AtomicBool::new(false),
+            wait_queues: std::array::from_fn(|_| WaitQueue::default()),
+        }
+    }
+
+
+    /// Register a running thread and return its id
+    pub fn add(&self, thread: JoinHandle<RunState>) -> u64 {
+        let id = self.last_id.fetch_add(1, Ordering::Relaxed) + 1;
+        self.threads.lock().unwrap().insert(id, thread);
+        id
+    }
+
+
+    /// Remove the thread with the given id, so that it can be joined
+    pub fn take(&self, id: u64) -> Option<JoinHandle<RunState>> {
+        self.threads.lock().unwrap().remove(&id)
+    }
+
+
+    /// Whether the threads must stop running the program
+    #[inline]
+    pub fn should_stop(&self) -> bool {
+        self.stop.load(Ordering::Relaxed)
+    }
+
+
+    /// Stop all the threads and wait for them to finish
+    pub fn stop_all(&self) {
+        self.stop.store(true, Ordering::Relaxed);
+
+        for queue in &self.wait_queues {
+            let _lock = queue.lock.lock().unwrap();
+            queue.wakeup.notify_all();
+        }
+
+        // Threads may spawn other threads while they are being stopped
+        loop {
+            let threads: Vec<_> = self.threads.lock().unwrap().drain().map(|(_, thread)| thread).collect();
+            if threads.is_empty() {
+                break;
+            }
+            for thread in threads {
+                thread.join().ok();
+            }
+        }
+
+        self.stop.store(false, Ordering::Relaxed);
+    }
+
+
+    fn wait_queue(&self, address: Address) -> &WaitQueue {
+        &self.wait_queues[(address / 8) % WAIT_QUEUE_COUNT]
+    }
+
+
+    /// Block the calling thread while `unchanged` returns true, until a thread notifies the address.
+    ///
+    /// The thread may also wake up spuriously or after `MAX_WAIT_TIME`, so the caller must check its condition again
+    pub fn wait(&self, address: Address, unchanged: impl FnOnce() -> bool) {
+        let queue = self.wait_queue(address);
+        let lock = queue.lock.lock().unwrap();
+
+        // The value is checked with the queue locked, so a notification sent after the value changed can't be missed
+        if unchanged() && !self.should_stop() {
+            drop(queue.wakeup.wait_timeout(lock, MAX_WAIT_TIME).unwrap());
+        }
+    }
+
+
+    /// Wake up all the threads waiting on the given address
+    pub fn notify(&self, address: Address) {
+        let queue = self.wait_queue(address);
+        let _lock = queue.lock.lock().unwrap();
+        queue.wakeup.notify_all();
+    }
+
+}
+
+
+#[cfg(test)]
+mod tests {
+
+    use std::sync::Arc;
+    use std::thread;
+    use std::time::Instant;
+
+    use super::*;
+    use crate::processor::ExitStatus;
+    use crate::test_utils::{assemble, processor};
+
+
+    /// Start a host thread that waits on `address` until the threads are stopped or `done` is set, then counts itself in `finished`
+    fn spawn_waiter(threads: &Arc<GuestThreads>, address: Address, done: &Arc<AtomicBool>, finished: &Arc<AtomicU64>) -> JoinHandle<RunState> {
+        let (threads, done, finished) = (Arc::clone(threads), Arc::clone(done), Arc::clone(finished));
+        thread::spawn(move || {
+            while !threads.should_stop() && !done.load(Ordering::Relaxed) {
+                threads.wait(address, || !done.load(Ordering::Relaxed));
+            }
+            finished.fetch_add(1, Ordering::Relaxed);
+            RunState::Faulted("The thread was stopped".to_string())
+        })
+    }
+
+
+    #[test]
+    fn test_add_take() {
+        let threads = GuestThreads::new();
+
+        let first = threads.add(thread::spawn(|| RunState::Paused));
+        let second = threads.add(thread::spawn(|| RunState::Paused));
+        assert_ne!(first, second);
+
+        assert_eq!(threads.take(first).unwrap().join().unwrap(), RunState::Paused);
+        assert!(threads.take(first).is_none());
+        assert!(threads.take(second).is_some());
+    }
+
+
+    #[test]
+    fn test_wait_notify() {
+        let threads = Arc::new(GuestThreads::new());
+
+        // A condition that doesn't hold returns at once, and a waiting thread returns after the timeout at the latest
+        let start = Instant::now();
+        threads.wait(64, || false);
+        threads.wait(64, || true);
+        assert!(start.elapsed() < Duration::from_secs(1));
+
+        let done = Arc::new(AtomicBool::new(false));
+        let finished = Arc::new(AtomicU64::new(0));
+        let waiters: Vec<_> = (0..4).map(|_| spawn_waiter(&threads, 64, &done, &finished)).collect();
+
+        done.store(true, Ordering::Relaxed);
+        threads.notify(64);
+
+        for waiter in waiters {
+            waiter.join().unwrap();
+        }
+        assert_eq!(finished.load(Ordering::Relaxed), 4);
+    }
+
+
+    #[test]
+    fn test_stop_all() {
+        let threads = Arc::new(GuestThreads::new());
+        let done = Arc::new(AtomicBool::new(false));
+        let finished = Arc::new(AtomicU64::new(0));
+
+        let ids: Vec<u64> = (0..4).map(|i| threads.add(spawn_waiter(&threads, i * 8, &done, &finished))).collect();
+
+        // A thread that spawns another one when it's stopped
+        let spawner = {
+            let (spawner_threads, done, finished) = (Arc::clone(&threads), Arc::clone(&done), Arc::clone(&finished));
+            thread::spawn(move || {
+                while !spawner_threads.should_stop() {
+                    spawner_threads.wait(0, || true);
+                }
+                spawner_threads.add(spawn_waiter(&spawner_threads, 0, &done, &finished));
+                finished.fetch_add(1, Ordering::Relaxed);
+                RunState::Paused
+            })
+        };
+        threads.add(spawner);
+
+        threads.stop_all();
+
+        assert_eq!(finished.load(Ordering::Relaxed), 6);
+        assert!(ids.iter().all(|&id| threads.take(id).is_none()));
+        assert!(!threads.should_stop());
+    }
+
+
+    #[test]
+    fn test_guest_threads() {
+        // Three threads increment a counter behind a mutex and another one atomically
+        let byte_code = assemble("
+.include:
+
+    archlib.asm
+    stdlib/memory.asm
+    thread.asm
+
+.text:
+
+@worker
+
+    mov8 r5 r1
+    mov8 r6 0
+
+    @loop
+        !mutex_lock r5
+
+        mov8 r1 r5
+        mov1 r2 8
+        iadd
+        mov8 r7 [r1]
+        inc r7
+        mov8 [r1] r7
+
+        !mutex_unlock r5
+
+        mov8 r1 r5
+        mov1 r2 16
+        iadd
+        mov8 r2 1
+        xadd8
+
+        inc r6
+        cmp8 r6 1000
+        jmplt loop
+
+    mov8 exit 7
+    exit
+
+@start
+
+    !calloc 3 8
+    mov8 r8 r1
+
+    !thread_spawn worker r8 1024
+    push8 r1
+    !thread_spawn worker r8 1024
+    push8 r1
+    !thread_spawn worker r8 1024
+    push8 r1
+
+    pop8 r1
+    !thread_join r1
+    mov8 print r1
+    intr =PRINT_UNSIGNED
+    pop8 r1
+    !thread_join r1
+    pop8 r1
+    !thread_join r1
+
+    mov8 r1 r8
+    mov1 r2 8
+    iadd
+    mov8 print [r1]
+    intr =PRINT_UNSIGNED
+
+    mov8 r1 r8
+    mov1 r2 16
+    iadd
+    mov8 print [r1]
+    intr =PRINT_UNSIGNED
+
+    mov8 exit 0
+");
+
+        let mut processor = processor(&byte_code);
+        assert_eq!(processor.run_for(None), RunState::Exited(ExitStatus { exit_code: 0, error: 0 }));
+        assert_eq!(processor.take_output(), b"730003000");
+    }
+
+}
@@ -0,0 +1,302 @@
+use std::cell::UnsafeCell;
+use std::fs::File;
+use std::io::{self, BufWriter, Write};
+use std::path::PathBuf;
+use std::sync::atomic::{AtomicBool, AtomicUsize, Ordering};
+use std::sync::Arc;
+use std::thread::{self, JoinHandle};
+use std::time::Duration;
+
+use rusty_vm_lib::trace::{self, TraceRecord, TRACE_HEADER_SIZE, TRACE_RECORD_SIZE};
+use rusty_vm_lib::vm::Address;
+
+use crate::error;
+
+
+/// Number of records the ring buffer can hold. Must be a power of two
+const RING_CAPACITY: usize = 1 << 16;
+
+/// How long the writer thread sleeps when there is nothing to write
+const WRITER_IDLE_SLEEP: Duration = Duration::from_micros(200);
+
+
+pub struct TraceOptions {
+
+    pub file_path: PathBuf,
+    /// Only the instructions in this address range are traced, end excluded
+    pub pc_range: Option<(Address, Address)>,
+    /// Maximum size of the trace file in bytes, after which tracing stops
+    pub max_size: Option<usize>,
+    /// Record the registers changed by every traced instruction
+    pub registers: bool,
+    /// Record the memory written by every traced instruction
+    pub memory: bool,
+
+}
+
+
+/// Single-producer single-consumer queue of encoded records.
+///
+/// `head` is only written by the VM thread and `tail` only by the writer thread, so no locks are needed
+struct RingBuffer {
+
+    slots: Box<[UnsafeCell<[u8; TRACE_RECORD_SIZE]>]>,
+    /// Number of records pushed so far
+    head: AtomicUsize,
+    /// Number of records written to the file so far
+    tail: AtomicUsize,
+    closed: AtomicBool,
+
+}
+
+
+// A slot is only accessed by the producer before it's published through `head` and by the consumer after,
+// until it's released through `tail`
+unsafe impl Sync for RingBuffer {}
+
+
+impl RingBuffer {
+
+    fn new() -> Self {
+        Self {
+            slots: (0..RING_CAPACITY).map(|_| UnsafeCell::new([0; TRACE_RECORD_SIZE])).collect(),
+            head: AtomicUsize::new(0),
+            tail: AtomicUsize::new(0),
+            closed: AtomicBool::new(false),
+        }
+    }
+
+
+    #[inline(always)]
+    fn slot(&self, index: usize) -> *mut [u8; TRACE_RECORD_SIZE] {
+        self.slots[index & (RING_CAPACITY - 1)].get()
+    }
+
+}
+
+
+/// Write the records of the ring buffer to the trace file until the buffer is closed and empty
+fn drain(buffer: &RingBuffer, mut writer: BufWriter<File>) -> io::Result<()> {
+    loop {
+        let tail = buffer.tail.load(Ordering::Relaxed);
+        // Check for closing before loading the head, so that the records pushed before closing are seen
+        let closed = buffer.closed.load(Ordering::Acquire);
+        let head = buffer.head.load(Ordering::Acquire);
+
+        if head == tail {
+            if closed {
+                return writer.flush();
+            }
+            thread::sleep(WRITER_IDLE_SLEEP);
+            continue;
+        }
+
+        // Write the published records in at most two contiguous chunks, since they may wrap around the end of the ring
+        let mut index = tail;
+        while index != head {
+            let start = index & (RING_CAPACITY - 1);
+            let count = (head - index).min(RING_CAPACITY - start);
+            let bytes = unsafe {
+                std::slice::from_raw_parts(buffer.slot(index) as *const u8, count * TRACE_RECORD_SIZE)
+            };
+            writer.write_all(bytes)?;
+            index += count;
+        }
+
+        buffer.tail.store(head, Ordering::Release);
+    }
+}
+
+
+/// Records the execution of the guest program into a binary trace file.
+///
+/// Records are pushed into a ring buffer and written to the file by a background thread,
+/// so the VM only pays for encoding them
+pub struct Tracer {
+
+    options: TraceOptions,
+    buffer: Arc<RingBuffer>,
+    writer: Option<JoinHandle<io::Result<()>>>,
+    /// Local copy of the head, which only this side writes
+    head: usize,
+    /// Last known tail, reloaded only when the buffer looks full
+    tail: usize,
+    /// Number of records that still fit in the maximum trace size
+    remaining_records: usize,
+
+}
+
+
+impl Tracer {
+
+    pub fn new(options: TraceOptions) -> Self {
+
+        let file = File::create(&options.file_path).unwrap_or_else(
+            |err| error::io_error(&options.file_path, &err, format!("Failed to create trace file \"{}\"", options.file_path.display()).as_str())
+        );
+        let mut writer = BufWriter::new(file);
+        writer.write_all(&trace::trace_header()).unwrap_or_else(
+            |err| error::io_error(&options.file_path, &err, "Failed to write the trace header")
+        );
+
+        let buffer = Arc::new(RingBuffer::new());
+
+        let thread_buffer = Arc::clone(&buffer);
+        let writer = thread::Builder::new()
+            .name("trace writer".to_string())
+            .spawn(move || drain(&thread_buffer, writer))
+            .unwrap_or_else(|err| error::error(format!("Failed to start the trace writer thread: {}", err).as_str()));
+
+        let remaining_records = match options.max_size {
+            Some(max_size) => max_size.saturating_sub(TRACE_HEADER_SIZE) / TRACE_RECORD_SIZE,
+            None => usize::MAX
+        };
+
+        Self {
+            options,
+            buffer,
+            writer: Some(writer),
+            head: 0,
+            tail: 0,
+            remaining_records,
+        }
+    }
+
+
+    #[inline(always)]
+    pub fn traces_registers(&self) -> bool {
+        self.options.registers
+    }
+
+
+    #[inline(always)]
+    pub fn traces_memory(&self) -> bool {
+        self.options.memory
+    }
+
+
+    /// Whether the instruction at `pc` should be traced
+    #[inline(always)]
+    pub fn traces(&self, pc: Address) -> bool {
+        self.remaining_records != 0 && match self.options.pc_range {
+            Some((start, end)) => pc >= start && pc < end,
+            None => true
+        }
+    }
+
+
+    /// Push a record to the trace. Records beyond the maximum trace size are dropped
+    #[inline]
+    pub fn record(&mut self, record: TraceRecord) {
+
+        if self.remaining_records == 0 {
+            return;
+        }
+        self.remaining_records -= 1;
+
+        // Wait for the writer to make room
+        while self.head - self.tail == RING_CAPACITY {
+            self.tail = self.buffer.tail.load(Ordering::Acquire);
+            if self.head - self.tail == RING_CAPACITY {
+                // The writer only stops early if it failed, and then it never makes room
+                if self.writer.as_ref().map_or(true, JoinHandle::is_finished) {
+                    self.stop();
+                    return;
+                }
+                thread::yield_now();
+            }
+        }
+
+        unsafe {
+            *self.buffer.slot(self.head) = record.encode();
+        }
+        self.head += 1;
+        self.buffer.head.store(self.head, Ordering::Release);
+    }
+
+
+    /// Report the error of the writer, if it failed, and drop the records from now on
+    #[cold]
+    fn stop(&mut self) {
+        self.remaining_records = 0;
+        self.finish();
+    }
+
+
+    /// Write the remaining records and close the trace file
+    pub fn finish(&mut self) {
+        self.buffer.closed.store(true, Ordering::Release);
+
+        if let Some(writer) = self.writer.take() {
+            match writer.join() {
+                Ok(Ok(())) => {},
+                Ok(Err(err)) => error::io_error(&self.options.file_path, &err, "Failed to write the trace file"),
+                Err(_) => error::error("The trace writer thread panicked")
+            }
+        }
+    }
+
+}
+
+
+#[cfg(test)]
+mod tests {
+
+    use std::panic::{self, AssertUnwindSafe};
+
+    use super::*;
+
+
+    fn options(file_path: PathBuf) -> TraceOptions {
+        TraceOptions { file_path, pc_range: None, max_size: None, registers: false, memory: false }
+    }
+
+
+    fn instruction(pc: Address) -> TraceRecord {
+        TraceRecord::Instruction { pc, opcode: 1, handled_size: 8, reg1: 2, reg2: 3, condition: 0, arg1: pc as u64 * 3, arg2: 0, target: 0 }
+    }
+
+
+    #[test]
+    fn test_ring_wrap_around() {
+        let file_path = std::env::temp_dir().join(format!("rusty_vm_trace_test_{}.trace", std::process::id()));
+
+        // Enough records to wrap around the ring a few times
+        let count = RING_CAPACITY * 3 + 17;
+
+        let mut tracer = Tracer::new(options(file_path.clone()));
+        for pc in 0..count {
+            tracer.record(instruction(pc));
+        }
+        tracer.finish();
+
+        let bytes = std::fs::read(&file_path).unwrap();
+        std::fs::remove_file(&file_path).ok();
+
+        trace::check_trace_header(&bytes).unwrap();
+        let records = bytes[TRACE_HEADER_SIZE..].chunks_exact(TRACE_RECORD_SIZE);
+        assert_eq!(records.len(), count);
+        for (pc, record) in records.enumerate() {
+            assert_eq!(TraceRecord::decode(record.try_into().unwrap()), Some(instruction(pc)));
+        }
+    }
+
+
+    #[test]
+    fn test_writer_failure() {
+        // Every write to /dev/full fails, so the writer stops while the ring is full
+        let mut tracer = Tracer::new(options(PathBuf::from("/dev/full")));
+
+        let was_embedded = error::set_embedded(true);
+        let result = panic::catch_unwind(AssertUnwindSafe(|| {
+            for pc in 0..RING_CAPACITY * 4 {
+                tracer.record(instruction(pc));
+            }
+        }));
+        error::set_embedded(was_embedded);
+
+        let payload = result.expect_err("The write error is reported");
+        assert!(payload.downcast_ref::<error::Fault>().is_some());
+    }
+
+}